@@ -122,10 +122,14 @@ namespace AMIStat
             }
         }
 
+        Thread listener;
+        public bool isListening => listener != null && listener.IsAlive;    // The receive thread may still be parsing after Close()
+
         public void StartListening()
         {
             _done = false;
-            new Thread(() => PortListener(waitHandle)).Start();
+            listener = new Thread(() => PortListener(waitHandle));
+            listener.Start();
         }
 
         public void StopListening()
@@ -228,6 +232,7 @@ namespace AMIStat
 
         public BatteryStatus BatteryStatus = new BatteryStatus();
         public DeviceInfo DeviceInfo = new DeviceInfo();
+        public AnomalyMonitor Anomalies;        // Shared by the ports, null when the detection is off
         JavaScriptSerializer json_serializer = new JavaScriptSerializer();
         private void Tick(byte b)
         {
@@ -330,6 +335,14 @@ namespace AMIStat
                                                 waitToStableBatteryInfoCounter = 0;
                                                 avgIsValid = false;
                                             }
+                                            AnomalyMonitor monitor = Anomalies;     // The form may clear the field meanwhile
+                                            if (monitor != null && !string.IsNullOrEmpty(DeviceInfo.SerialNumber))
+                                            {
+                                                // Live anomalies are logged as events, unless the status already is one
+                                                BatteryAnomaly[] anomalies = monitor.Feed(DeviceInfo.SerialNumber, evt, DateTime.Now, BatteryStatus.SOC, BatteryStatus.Voltage, charging);
+                                                if (evt == "" && anomalies.Length > 0)
+                                                    evt = anomalies[0].Name;
+                                            }
                                             DeviceInfo.ConnectionStatus = true;
                                             break;
                                         case AMIJsonCommands.GetDeviceInfoID:
@@ -0,0 +1,217 @@
+﻿using System;
+using System.Runtime.InteropServices;
+
+namespace AMIStat
+{
+    [StructLayout(LayoutKind.Sequential, Pack = 4, CharSet = CharSet.Ansi)]
+    public struct TelemetrySample
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Serial;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Firmware;
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Event;
+        public long Timestamp;          // ms since 1970-01-01 UTC
+        public ushort Voltage;          // mV
+        public byte SOC;                // %
+        public byte Charging;
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4, CharSet = CharSet.Ansi)]
+    public struct BatteryHealth
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Serial;
+        public long FirstTimestamp;     // ms since 1970-01-01 UTC
+        public long LastTimestamp;
+        public uint Samples;
+        public uint Discharges;         // Discharge segments fitted
+        public uint Charges;            // Charge segments fitted
+        public uint Flags;              // FAST_DRAIN 1, LOW_CAPACITY 2, RESISTANCE 4, NO_DATA 8
+        public float DischargeRate;     // % per hour, negative if unknown
+        public float ChargeRate;        // % per hour, negative if unknown
+        public float Capacity;          // % of the reference, negative if unknown
+        public float CapacityTrend;     // % per 30 days
+        public float VoltageAt50;       // mV
+        public float Resistance;        // mOhm, negative if unknown
+        public float ResistanceTrend;   // mOhm per 30 days
+        public float FleetScore;        // Discharge rate versus the fleet (robust z-score)
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4, CharSet = CharSet.Ansi)]
+    public struct BatteryAnomaly
+    {
+        [MarshalAs(UnmanagedType.ByValTStr, SizeConst = 32)]
+        public string Serial;
+        public long Timestamp;          // ms since 1970-01-01 UTC
+        public int Type;                // VOLTAGE_SAG 1, SOC_JUMP 2, CHARGE_STALL 3, SENSOR_GLITCH 4
+        public float Value;             // mV, SOC step (%) or minutes without SOC rise
+        public float Expected;
+        public float Score;
+
+        static readonly string[] names = { "", "VoltageSag", "SocJump", "ChargeStall", "SensorGlitch" };
+        public string Name => (Type > 0 && Type < names.Length) ? names[Type] : "";
+    }
+
+    /// <summary>
+    /// Wrapper over TT_AMI_Telemetry.dll: compressed, append-only battery telemetry store.
+    /// The store buffers samples and writes them by blocks, so logging stays cheap however long the station runs.
+    /// </summary>
+    class TelemetryStore : IDisposable
+    {
+        const string Dll = "TT_AMI_Telemetry.dll";
+        const int TLM_ERR_BUFSHORT = -5;
+
+        // The path is in the ANSI code page (as fopen takes it): no best fit, a character it lacks fails the open
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall, CharSet = CharSet.Ansi, BestFitMapping = false, ThrowOnUnmappableChar = true)]
+        static extern int TLM_Open(string dir, uint maxSegmentBytes, uint blockSamples, out IntPtr handle);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_Close(IntPtr handle);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_Append(IntPtr handle, ref TelemetrySample sample);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_Flush(IntPtr handle);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_Query(IntPtr handle, string serial, long from, long to, [Out] TelemetrySample[] buf, uint maxCount, out uint found);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_BatteryHealth(IntPtr handle, long from, long to, [Out] BatteryHealth[] buf, uint maxCount, out uint found);
+
+        IntPtr handle = IntPtr.Zero;
+        public bool isOpen => handle != IntPtr.Zero;
+
+        public bool Open(string dir)
+        {
+            try
+            {
+                return TLM_Open(dir, 0, 0, out handle) == 0;
+            }
+            catch (DllNotFoundException)
+            {
+                handle = IntPtr.Zero;       // Store is optional, the CSV log keeps working without it
+                return false;
+            }
+            catch (ArgumentException)
+            {
+                handle = IntPtr.Zero;       // Path not representable in the ANSI code page
+                return false;
+            }
+        }
+
+        public static long ToTimestamp(DateTime dt) => (long)(dt.ToUniversalTime() - new DateTime(1970, 1, 1, 0, 0, 0, DateTimeKind.Utc)).TotalMilliseconds;
+
+        public void Append(string serial, string firmware, string evt, DateTime dt, int soc, int voltage, bool charging)
+        {
+            if (!isOpen) return;
+            TelemetrySample s = new TelemetrySample
+            {
+                Serial = serial ?? "",
+                Firmware = firmware ?? "",
+                Event = evt ?? "",
+                Timestamp = ToTimestamp(dt),
+                SOC = (byte)Math.Max(0, Math.Min(255, soc)),
+                Voltage = (ushort)Math.Max(0, Math.Min(65535, voltage)),
+                Charging = (byte)(charging ? 1 : 0)
+            };
+            TLM_Append(handle, ref s);
+        }
+
+        public void Flush()
+        {
+            if (isOpen) TLM_Flush(handle);
+        }
+
+        public TelemetrySample[] Query(string serial, DateTime from, DateTime to)
+        {
+            if (!isOpen) return new TelemetrySample[0];
+            long f = ToTimestamp(from), t = ToTimestamp(to);
+            uint found;
+            int err = TLM_Query(handle, serial, f, t, null, 0, out found);
+            TelemetrySample[] buf = new TelemetrySample[found];
+            if (err == 0 || err == TLM_ERR_BUFSHORT)
+                TLM_Query(handle, serial, f, t, buf, found, out found);
+            return buf;
+        }
+
+        public BatteryHealth[] Health(DateTime from, DateTime to)
+        {
+            if (!isOpen) return new BatteryHealth[0];
+            long f = ToTimestamp(from), t = ToTimestamp(to);
+            uint found;
+            int err = TLM_BatteryHealth(handle, f, t, null, 0, out found);
+            BatteryHealth[] buf = new BatteryHealth[found];
+            if (err == 0 || err == TLM_ERR_BUFSHORT)
+                TLM_BatteryHealth(handle, f, t, buf, found, out found);
+            return buf;
+        }
+
+        public void Dispose()
+        {
+            if (isOpen) TLM_Close(handle);
+            handle = IntPtr.Zero;
+        }
+    }
+
+    /// <summary>
+    /// Live anomaly detection of TT_AMI_Telemetry.dll (voltage sag, SOC jump, charge stall, sensor glitch).
+    /// Fed with each battery status as it is received; keeps a small fixed state per device, whatever the number of devices.
+    /// </summary>
+    class AnomalyMonitor : IDisposable
+    {
+        const string Dll = "TT_AMI_Telemetry.dll";
+        const int ANOMALY_MAX_EVENTS = 4;
+
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_AnomalyOpen(out IntPtr monitor);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_AnomalyClose(IntPtr monitor);
+        [DllImport(Dll, CallingConvention = CallingConvention.StdCall)]
+        static extern int TLM_AnomalyFeed(IntPtr monitor, ref TelemetrySample sample, [Out] BatteryAnomaly[] buf, uint maxCount, out uint found);
+
+        IntPtr handle = IntPtr.Zero;
+        public bool isOpen => handle != IntPtr.Zero;
+
+        public bool Open()
+        {
+            try
+            {
+                return TLM_AnomalyOpen(out handle) == 0;
+            }
+            catch (DllNotFoundException)
+            {
+                handle = IntPtr.Zero;       // Detection is optional, the charger events keep working without it
+                return false;
+            }
+        }
+
+        /// <summary>
+        /// Feed one battery status of a device; returns the anomalies it raised (usually none).
+        /// Thread safe: called from the receive thread of each COM port.
+        /// </summary>
+        public BatteryAnomaly[] Feed(string serial, string evt, DateTime dt, int soc, int voltage, bool charging)
+        {
+            if (!isOpen) return new BatteryAnomaly[0];
+            TelemetrySample s = new TelemetrySample
+            {
+                Serial = serial ?? "",
+                Firmware = "",
+                Event = evt ?? "",
+                Timestamp = TelemetryStore.ToTimestamp(dt),
+                SOC = (byte)Math.Max(0, Math.Min(255, soc)),
+                Voltage = (ushort)Math.Max(0, Math.Min(65535, voltage)),
+                Charging = (byte)(charging ? 1 : 0)
+            };
+            BatteryAnomaly[] buf = new BatteryAnomaly[ANOMALY_MAX_EVENTS];
+            uint found;
+            if (TLM_AnomalyFeed(handle, ref s, buf, (uint)buf.Length, out found) != 0) found = 0;
+            Array.Resize(ref buf, (int)Math.Min(found, (uint)buf.Length));
+            return buf;
+        }
+
+        public void Dispose()
+        {
+            if (isOpen) TLM_AnomalyClose(handle);
+            handle = IntPtr.Zero;
+        }
+    }
+}
@@ -17,6 +17,11 @@ namespace AMIStat
     public partial class frmMonitor : Form
     {
         TTLAMICom amicom = new TTLAMICom();
+        TelemetryStore telemetry = new TelemetryStore();
+        AnomalyMonitor anomalies = new AnomalyMonitor();
+        System.Windows.Forms.Timer telemetryFlush = new System.Windows.Forms.Timer();
+        const int TelemetryFlushMs = 60000;     // Buffered samples written at least this often (not only on close)
+        const int LogViewMaxChars = 30000;      // Text kept on screen (TextBox limit 32767), the history is in the store
         public frmMonitor()
         {
             InitializeComponent();
@@ -111,7 +116,7 @@ namespace AMIStat
             {
                 this.Invoke((MethodInvoker)delegate
                 {
-                    txtLog.Text = s + "\r\n" + txtLog.Text;
+                    ShowLog(s + "\r\n");
                 });
             }
             catch
@@ -120,11 +125,29 @@ namespace AMIStat
             }
         }
 
+        /// <summary>
+        /// Show a record on top of the log view. The oldest lines are dropped so that the cost does not grow with the
+        /// time the station runs (the whole text was rebuilt for each record).
+        /// </summary>
+        void ShowLog(string text)
+        {
+            int keep = LogViewMaxChars - text.Length;
+            if (txtLog.TextLength > keep)
+            {
+                int cut = (keep > 0) ? txtLog.GetFirstCharIndexFromLine(txtLog.GetLineFromCharIndex(keep)) : 0;
+                txtLog.Select(cut, txtLog.TextLength - cut);
+                txtLog.SelectedText = "";
+            }
+            txtLog.Select(0, 0);
+            txtLog.SelectedText = text;
+            txtLog.Select(0, 0);
+        }
+
         private void btnExit_Click(object sender, EventArgs e)
         {
             amicom.Close();
             this.Enabled = false;
-            while (amicom.isOpen)
+            while (amicom.isOpen || amicom.isListening)
                 Application.DoEvents();
             Application.Exit();
         }
@@ -133,6 +156,7 @@ namespace AMIStat
         const int waveVOssfets = 300;
         string LogDir => Application.StartupPath + "\\Log\\";
         string LogFile => LogDir + "log.csv";
+        string TelemetryDir => LogDir + "Telemetry\\";
         
         private void frmMonitor_Load(object sender, EventArgs e)
         {
@@ -154,7 +178,15 @@ namespace AMIStat
                 formLoaded = true;
             if (!Directory.Exists(LogDir))
                 Directory.CreateDirectory(LogDir);
-            if (!File.Exists(LogFile))
+            if (!Directory.Exists(TelemetryDir))
+                Directory.CreateDirectory(TelemetryDir);
+            if (telemetry.Open(TelemetryDir))
+            {
+                telemetryFlush.Interval = TelemetryFlushMs;
+                telemetryFlush.Tick += (o, ev) => telemetry.Flush();
+                telemetryFlush.Start();
+            }
+            else if (!File.Exists(LogFile))     // No store (DLL absent): the CSV log
             {
                 try
                 {
@@ -170,6 +202,8 @@ namespace AMIStat
             {
                 File.Copy(LogFile,LogDir+ "Log_Backup_" + DateTime.Now.Ticks + ".csv");
             }
+            if (anomalies.Open())
+                amicom.Anomalies = anomalies;
 
             if (File.Exists("config.txt"))
             {
@@ -247,7 +281,7 @@ void ClosePort()
         {
             this.Enabled = false;
             amicom.Close();
-            while (amicom.isOpen)
+            while (amicom.isOpen || amicom.isListening)
                 Application.DoEvents();
             comboBox1.Enabled = btnOpen.Enabled = true;
             btnClose.Enabled = false;
@@ -314,10 +348,13 @@ void ClosePort()
         {
             if (chkRestrictedevent.Checked) log.Event = "DeviceConnected";
             logCountDuringConnection++;
-            File.AppendAllText(LogFile, log.Log);
+            if (telemetry.isOpen)
+                telemetry.Append(log.Serial, log.FWVersion, log.Event, log.DateTime, log.Percentage, log.Voltage, log.isCharging);
+            else
+                File.AppendAllText(LogFile, log.Log);
             if (!amicom.EnableDebugLog)
             {
-                txtLog.Text = log.LogText + txtLog.Text;
+                ShowLog(log.LogText);
               /*  for (int i = 0; i < amicom.BatteryVoltgeArray.Length; i++)
                     txtLog.Text = amicom.BatteryVoltgeArray[i] + " " + txtLog.Text;
                 for (int i = 0; i < amicom.BatteryVoltgeArray.Length; i++)
@@ -377,7 +414,11 @@ void ClosePort()
 
         private void frmMonitor_FormClosing(object sender, FormClosingEventArgs e)
         {
-            ClosePort();
+            ClosePort();                    // Returns once the receive thread is done with the monitor
+            amicom.Anomalies = null;
+            anomalies.Dispose();
+            telemetryFlush.Stop();
+            telemetry.Dispose();
         }
 
         private void chkUartLogEnable_CheckedChanged(object sender, EventArgs e)
@@ -0,0 +1,432 @@
+/*
+* BatteryAnomaly.cpp : This file contains the live detection of the anomalies of the batteries
+*               on the telemetry of the devices monitored.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include "BatteryAnomaly.h"
+
+#define ANOMALY_MS_PER_HOUR     3600000.0
+#define ANOMALY_MS_PER_MINUTE   60000.0
+#define ANOMALY_INVALID_SOC     0xFF        // SOC logged when the reading failed (as BATSTAT_INVALID_SOC)
+#define ANOMALY_MAD_SCALE       1.2533      // Mean absolute deviation to standard deviation, normal distribution
+#define ANOMALY_CLIP            3.0         // Samples learned clipped to this many scales
+#define ANOMALY_MIN_SOC_VAR     2.0f        // SOC variance of the samples of a line before its slope is used
+#define ANOMALY_SOC_REACH       2.0f        // A line is used up to this many SOC deviations from its mean SOC
+#define ANOMALY_SOC_EXTEND      10.0f       // A line next to the SOC is used up to this far from its mean SOC (%)
+#define ANOMALY_CONNECTED_EVENT "DeviceConnected"
+
+static const char *anomalyNames[] = { "", "VoltageSag", "SocJump", "ChargeStall", "SensorGlitch" };
+
+/**
+* @brief anomalyName: name of an anomaly type, as logged in the event of the samples
+*
+* @param type:      TLM_ANOMALY_xxx
+* @return The name, "" if unknown
+*/
+const char *anomalyName(int32_t type)
+{
+    return ((type > 0) && (type <= TLM_ANOMALY_SENSOR_GLITCH)) ? anomalyNames[type] : "";
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param cfg:       tuning
+* @return None.
+*/
+BatteryAnomalyDetector::BatteryAnomalyDetector(const BatteryAnomalyConfig &_cfg)
+: cfg(_cfg)
+{
+    reset();
+}
+
+/**
+* @brief reset: forget everything learned
+*
+* @return None.
+*/
+void BatteryAnomalyDetector::reset(void)
+{
+    memset(curves, 0, sizeof(curves));
+    rate[0] = rate[1] = 0.0f;
+    restart();
+}
+
+/**
+* @brief restart: forget the short term state but keep the learned voltage
+*
+* @return None.
+*/
+void BatteryAnomalyDetector::restart(void)
+{
+    hasLast = false;
+    lastScore = 0.0f;
+    hasHeld = false;
+    heldScore = 0.0f;
+    cusum = 0.0f;
+    sagRaised = false;
+    riseTime = 0;
+    stallRaised = false;
+}
+
+/**
+* @brief segmentOf: line of the curve for an SOC
+*
+* @param soc:       SOC (%, 0..100)
+* @return The segment index
+*/
+int BatteryAnomalyDetector::segmentOf(uint8_t soc)
+{
+    return std::min(soc / 10, ANOMALY_SOC_SEGMENTS - 1);
+}
+
+/**
+* @brief value: voltage of a line at an SOC
+*
+* @param g:         line
+* @param soc:       SOC (%)
+* @return The voltage (mV); the mean voltage while the SOC spread is too small for a slope
+*/
+float BatteryAnomalyDetector::value(const Segment &g, uint8_t soc)
+{
+    if (g.socVar < ANOMALY_MIN_SOC_VAR)     return g.voltage;
+    return g.voltage + g.covar / g.socVar * (soc - g.soc);
+}
+
+/**
+* @brief lineOf: line the voltage of a sample is compared to: the line of its SOC once learned
+*           around it, else a learned line next to it (the SOC just entered a new 10%)
+*
+* @param s:         sample
+* @return The segment index, -1 if none is learned near the SOC
+*/
+int BatteryAnomalyDetector::lineOf(const Sample &s) const
+{
+    const Curve &c = curves[s.charging];
+    int k = segmentOf(s.soc);
+    int best = -1;
+    float bestDistance = ANOMALY_SOC_EXTEND;
+
+    for (int i = std::max(k - 1, 0); i <= std::min(k + 1, ANOMALY_SOC_SEGMENTS - 1); i++)
+    {
+        const Segment &g = c.segments[i];
+        if ((g.count < cfg.warmup) || (g.socVar < ANOMALY_MIN_SOC_VAR))     continue;
+
+        float distance = fabsf(s.soc - g.soc);
+        if ((i == k) && (distance <= ANOMALY_SOC_REACH * sqrtf(g.socVar) + 1.0f))  return k;
+        if ((i != k) && (distance <= bestDistance))
+        {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+* @brief expected: usual voltage at the SOC of a sample, from the curve of its charging state
+*
+* @param s:         sample
+* @return The voltage (mV)
+*/
+float BatteryAnomalyDetector::expected(const Sample &s) const
+{
+    int k = lineOf(s);
+    return value(curves[s.charging].segments[(k < 0) ? segmentOf(s.soc) : k], s.soc);
+}
+
+/**
+* @brief score: robust z-score of the voltage of a sample
+*
+* @param s:         sample
+* @return The z-score, 0 while the curve is not learned near the SOC
+*/
+float BatteryAnomalyDetector::score(const Sample &s) const
+{
+    const Curve &c = curves[s.charging];
+    int k = lineOf(s);
+    if (k < 0)      return 0.0f;
+
+    float scale = std::max((float)(c.scale * ANOMALY_MAD_SCALE), (float)cfg.minScale);
+    return (s.voltage - value(c.segments[k], s.soc)) / scale;
+}
+
+/**
+* @brief learn: move the line of the SOC of a sample toward it. Once the curve is learned near
+*           the SOC, the sample is clipped to a few scales of it so that an outlier moves the
+*           line little, and its deviation updates the scale.
+*
+* @param s:         sample
+* @return None.
+*/
+void BatteryAnomalyDetector::learn(const Sample &s)
+{
+    Curve &c = curves[s.charging];
+    Segment &g = c.segments[segmentOf(s.soc)];
+    float voltage = s.voltage;
+
+    int k = lineOf(s);
+    if (k >= 0)
+    {
+        float e = value(c.segments[k], s.soc);
+        float limit = (float)(ANOMALY_CLIP * std::max((float)(c.scale * ANOMALY_MAD_SCALE), (float)cfg.minScale));
+        float d = std::max(-limit, std::min(limit, voltage - e));
+        voltage = e + d;
+
+        // (a sag reported is not the usual spread)
+        if (!sagRaised)
+        {
+            c.count = std::min(c.count + 1, (uint32_t)UINT32_MAX - 1);
+            c.scale += std::max((float)cfg.weight, 1.0f / c.count) * (fabsf(d) - c.scale);
+        }
+    }
+
+    // Exponentially weighted moments, plain means for the first samples
+    float w = std::max((float)cfg.weight, 1.0f / (g.count + 1.0f));
+    float dx = s.soc - g.soc;
+    float dy = voltage - g.voltage;
+    g.soc += w * dx;
+    g.voltage += w * dy;
+    g.socVar = (1.0f - w) * (g.socVar + w * dx * dx);
+    g.covar = (1.0f - w) * (g.covar + w * dx * dy);
+    if (g.count < UINT32_MAX)   g.count++;
+}
+
+/**
+* @brief level: z-score of the last sample accepted, as the level a sample is compared to
+*
+* @param s:         sample
+* @return The z-score, 0 (the usual voltage) if the charging state changed since
+*/
+float BatteryAnomalyDetector::level(const Sample &s) const
+{
+    return (hasLast && (last.charging == s.charging)) ? lastScore : 0.0f;
+}
+
+/**
+* @brief raise: fill an anomaly
+*/
+void BatteryAnomalyDetector::raise(BatteryAnomaly *event, int64_t t, int32_t type, float value, float expected, float score)
+{
+    memset(event->serial, 0, sizeof(event->serial));
+    event->timestamp = t;
+    event->type = type;
+    event->value = value;
+    event->expected = expected;
+    event->score = score;
+}
+
+/**
+* @brief accept: take a sample as the new level of the device: learn its SOC rate and voltage,
+*           run the sag CUSUM and the stall check
+*
+* @param s:         sample
+* @param z:         its z-score
+* @param events:    receives the anomalies
+* @return The number of anomalies raised
+*/
+int BatteryAnomalyDetector::accept(const Sample &s, float z, BatteryAnomaly *events)
+{
+    int n = 0;
+
+    if (hasLast && (s.charging == last.charging) && (s.t > last.t))
+    {
+        float r = (float)(((int)s.soc - (int)last.soc) * ANOMALY_MS_PER_HOUR / (double)(s.t - last.t));
+        rate[s.charging] += (float)cfg.weight * (r - rate[s.charging]);
+    }
+
+    // Voltage sag: on battery, the voltage holds below the curve
+    if (!s.charging && (z != 0.0f))
+    {
+        cusum = std::max(0.0f, cusum - z - (float)cfg.sagSlack);
+        if ((cusum > cfg.sagLimit) && !sagRaised)
+        {
+            raise(&events[n++], s.t, TLM_ANOMALY_VOLTAGE_SAG, s.voltage, expected(s), cusum);
+            sagRaised = true;
+        }
+        if (z > -cfg.sagSlack)
+        {
+            cusum = 0.0f;               // Back to the usual level: re-armed
+            sagRaised = false;
+        }
+    }
+    else if (s.charging)
+    {
+        cusum = 0.0f;
+        sagRaised = false;
+    }
+
+    // Charge stall: on the charger, the SOC does not rise
+    if (s.charging)
+    {
+        if (!hasLast || !last.charging || (s.soc > last.soc))
+        {
+            riseTime = s.t;
+            stallRaised = false;
+        }
+        double minutes = (s.t - riseTime) / ANOMALY_MS_PER_MINUTE;
+        if ((s.soc < cfg.fullSoc) && !stallRaised && (minutes >= cfg.stallMinutes))
+        {
+            float usual = (rate[1] > 0.0f) ? 60.0f / rate[1] : 0.0f;       // Minutes per % at the usual rate
+            raise(&events[n++], s.t, TLM_ANOMALY_CHARGE_STALL, (float)minutes, usual, (float)(minutes / cfg.stallMinutes));
+            stallRaised = true;
+        }
+    }
+
+    learn(s);
+    last = s;
+    lastScore = z;
+    hasLast = true;
+    return n;
+}
+
+/**
+* @brief add: feed one sample
+*
+* @param t:         time (ms since epoch)
+* @param soc:       state of charge (%), 255 when the reading failed
+* @param voltage:   battery voltage (mV)
+* @param charging:  charger connected
+* @param events:    receives up to ANOMALY_MAX_EVENTS anomalies
+* @return The number of anomalies raised
+*/
+int BatteryAnomalyDetector::add(int64_t t, uint8_t soc, uint16_t voltage, bool charging, BatteryAnomaly *events)
+{
+    int n = 0;
+    Sample s;
+    s.t = t;
+    s.voltage = voltage;
+    s.soc = soc;
+    s.charging = charging;
+
+    int64_t prev = hasHeld ? held.t : hasLast ? last.t : t;
+    if ((t < prev) || (t - prev > cfg.gapMs))   restart();
+
+    // Invalid reading: not learned, nothing else checked
+    if ((soc == ANOMALY_INVALID_SOC) || (soc > 100))
+    {
+        raise(&events[n++], t, TLM_ANOMALY_SENSOR_GLITCH, soc, hasLast ? last.soc : 0.0f, 0.0f);
+        return n;
+    }
+    if ((voltage < cfg.minVoltage) || (voltage > cfg.maxVoltage))
+    {
+        raise(&events[n++], t, TLM_ANOMALY_SENSOR_GLITCH, voltage, hasLast ? last.voltage : 0.0f, 0.0f);
+        return n;
+    }
+
+    float z = score(s);
+    if (hasHeld)
+    {
+        // The sample held was a glitch if this one is back to the level before it
+        float step = hasLast ? (float)(rate[s.charging] * (s.t - last.t) / ANOMALY_MS_PER_HOUR) : 0.0f;
+        bool socBack = !hasLast || (fabsf((float)s.soc - (float)last.soc - step) * 2.0f < cfg.jumpSoc);
+        bool voltBack = (z == 0.0f) || (fabsf(z - level(s)) < cfg.backScore);
+        if (socBack && voltBack)
+        {
+            bool socOff = hasLast && (abs((int)held.soc - (int)last.soc) >= (int)cfg.jumpSoc);
+            raise(&events[n++], held.t, TLM_ANOMALY_SENSOR_GLITCH, socOff ? held.soc : held.voltage,
+                  socOff ? last.soc : expected(held), heldScore);
+        }
+        else
+        {
+            if (hasLast)
+            {
+                float heldStep = (float)(rate[held.charging] * (held.t - last.t) / ANOMALY_MS_PER_HOUR);
+                float jump = (float)held.soc - (float)last.soc;
+                if (fabsf(jump - heldStep) >= cfg.jumpSoc)
+                {
+                    raise(&events[n++], held.t, TLM_ANOMALY_SOC_JUMP, jump, heldStep, (jump - heldStep) / cfg.jumpSoc);
+                }
+            }
+            n += accept(held, heldScore, &events[n]);
+            z = score(s);               // Against the curve learned with the held sample
+        }
+        hasHeld = false;
+    }
+
+    // A sample far off the previous one is held until the next one tells a glitch from a change
+    if (hasLast)
+    {
+        float step = (float)(rate[s.charging] * (s.t - last.t) / ANOMALY_MS_PER_HOUR);
+        bool socOff = fabsf((float)s.soc - (float)last.soc - step) >= cfg.jumpSoc;
+        bool voltOff = (z != 0.0f) && (fabsf(z - level(s)) >= cfg.outlierScore);
+        if (socOff || voltOff)
+        {
+            held = s;
+            heldScore = z;
+            hasHeld = true;
+            return n;
+        }
+    }
+    n += accept(s, z, &events[n]);
+    return n;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param cfg:       tuning of the detectors
+* @return None.
+*/
+BatteryAnomalyMonitor::BatteryAnomalyMonitor(const BatteryAnomalyConfig &_cfg)
+: cfg(_cfg)
+{
+}
+
+/**
+* @brief feed: feed one sample to the detector of its device
+*
+* @param sample:    sample
+* @param events:    receives up to ANOMALY_MAX_EVENTS anomalies
+* @return The number of anomalies raised
+*/
+int BatteryAnomalyMonitor::feed(const TelemetrySample &sample, BatteryAnomaly *events)
+{
+    std::string serial(sample.serial, strnlen(sample.serial, TLM_SERIAL_LEN));
+    Shard &shard = shards[std::hash<std::string>()(serial) % ANOMALY_SHARDS];
+    int n;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        std::unordered_map<std::string, BatteryAnomalyDetector>::iterator it = shard.detectors.find(serial);
+        if (it == shard.detectors.end())    it = shard.detectors.insert(std::make_pair(serial, BatteryAnomalyDetector(cfg))).first;
+        if (strncmp(sample.event, ANOMALY_CONNECTED_EVENT, TLM_EVENT_LEN) == 0)     it->second.restart();
+        n = it->second.add(sample.timestamp, sample.soc, sample.voltage, sample.charging != 0, events);
+    }
+    for (int i = 0; i < n; i++)     memcpy(events[i].serial, sample.serial, TLM_SERIAL_LEN);
+    return n;
+}
+
+/**
+* @brief forget: drop the detector of a device
+*
+* @param serial:    device serial number
+* @return None.
+*/
+void BatteryAnomalyMonitor::forget(const char *serial)
+{
+    std::string key(serial, strnlen(serial, TLM_SERIAL_LEN));
+    Shard &shard = shards[std::hash<std::string>()(key) % ANOMALY_SHARDS];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.detectors.erase(key);
+}
+
+/**
+* @brief deviceCount: number of devices monitored
+*/
+size_t BatteryAnomalyMonitor::deviceCount(void)
+{
+    size_t count = 0;
+    for (int i = 0; i < ANOMALY_SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> guard(shards[i].lock);
+        count += shards[i].detectors.size();
+    }
+    return count;
+}
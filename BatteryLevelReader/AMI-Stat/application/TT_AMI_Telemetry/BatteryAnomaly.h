@@ -0,0 +1,224 @@
+/*
+* BatteryAnomaly.h : This file contains the live detection of the anomalies of the batteries
+*               (voltage sag under load, SOC jumps, charge stalls, sensor glitches) on the
+*               telemetry of the devices monitored.
+*
+*   In a nutshell, this file implements:
+*       - BatteryAnomalyDetector: the detection for one device, fed one sample at a time, in a
+*           fixed size state (no history kept):
+*           - the usual voltage of the device against the SOC is learned for each charging state,
+*               as a line fitted on each 10% of SOC (exponentially weighted means, variance and
+*               covariance of the SOC and voltage), with the mean absolute deviation of the samples.
+*               The deviation of a sample is a robust z-score: the samples are clipped before they
+*               are learned and the samples far off are held out, so that the outliers neither move
+*               the line nor widen the scale. When the SOC enters a 10% not learned yet, the line
+*               next to it is extended; no z-score away from the SOC learned.
+*           - voltage sag: one-sided CUSUM of the negative z-scores on battery. A sag is reported
+*               once, then the detection re-arms when the voltage is back to its usual level.
+*           - a sample far off the previous one (z-score or SOC step) is held until the next one:
+*               if the next sample is back to the level before, the held one is a sensor glitch; if
+*               not, an SOC step is an SOC jump (and a voltage step feeds the CUSUM). Invalid readings
+*               (SOC 255, voltage out of range) are glitches right away.
+*           - charge stall: on the charger below the full SOC, no SOC rise for too long
+*           A gap in the log, or a new connection, restarts the short term detection.
+*       - BatteryAnomalyMonitor: the detectors of every device monitored, found by serial number
+*           in shards that have their own lock, so that the devices fed from different threads
+*           (one per COM port) seldom wait for each other.
+*
+*   No Windows dependency: the detection is also used by the host tools.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _BATTERYANOMALY_H
+#define _BATTERYANOMALY_H
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TelemetryTypes.h"
+
+#define ANOMALY_MAX_EVENTS      4           // Anomalies raised by one sample at most
+#define ANOMALY_SOC_SEGMENTS    10          // Lines of the learned voltage curve (0-9, 10-19, ..., 90-100% SOC)
+#define ANOMALY_SHARDS          16          // Locks of the monitor
+
+/**
+* @brief Tuning of the detection. The defaults suit a sample every few seconds to a few minutes.
+*/
+struct BatteryAnomalyConfig
+{
+    int64_t gapMs;              // A gap longer than this in the samples restarts the short term detection
+    uint16_t minVoltage;        // Voltage below this (mV): invalid reading
+    uint16_t maxVoltage;        // Voltage above this (mV): invalid reading
+    double weight;              // Weight of a new sample in the learned voltage (0..1)
+    uint32_t warmup;            // Samples learned on a line of the curve before its z-scores are used
+    double minScale;            // Scale of the z-scores never below this (mV)
+    double sagSlack;            // CUSUM slack: z-scores above -sagSlack do not add up
+    double sagLimit;            // CUSUM sum above this: voltage sag
+    double outlierScore;        // z-score this far from the previous one: sample held as a possible glitch
+    double backScore;           // z-score of the next sample this close to the level before: back to it
+    uint32_t jumpSoc;           // SOC step beyond the expected one above this (%): held as a possible jump
+    double stallMinutes;        // On the charger without SOC rise for longer: charge stall
+    uint32_t fullSoc;           // SOC from which the charge may level off (no stall)
+
+    BatteryAnomalyConfig()
+    : gapMs(30 * 60 * 1000), minVoltage(2800), maxVoltage(4500), weight(0.02), warmup(20), minScale(3.0)
+    , sagSlack(1.0), sagLimit(12.0), outlierScore(8.0), backScore(4.0), jumpSoc(8), stallMinutes(45.0)
+    , fullSoc(95) {}
+};
+
+/**
+* @brief anomalyName: name of an anomaly type, as logged in the event of the samples
+*
+* @param type:      TLM_ANOMALY_xxx
+* @return "VoltageSag", "SocJump", "ChargeStall", "SensorGlitch" or "" if unknown
+*/
+const char *anomalyName(int32_t type);
+
+class BatteryAnomalyDetector
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param cfg:       tuning
+    * @return None.
+    */
+    BatteryAnomalyDetector(const BatteryAnomalyConfig &cfg = BatteryAnomalyConfig());
+
+    /**
+    * @brief add: feed one sample. The samples must come in time order. The anomaly of a held
+    *           sample is raised with the next one, with the time of the held sample.
+    *
+    * @param t:         time (ms since epoch)
+    * @param soc:       state of charge (%), 255 when the reading failed
+    * @param voltage:   battery voltage (mV)
+    * @param charging:  charger connected
+    * @param events:    receives up to ANOMALY_MAX_EVENTS anomalies (serial left empty)
+    * @return The number of anomalies raised
+    */
+    int add(int64_t t, uint8_t soc, uint16_t voltage, bool charging, BatteryAnomaly *events);
+
+    /**
+    * @brief restart: forget the short term state (previous and held samples, CUSUM, stall) but
+    *           keep the learned voltage, e.g. when the device reconnects
+    *
+    * @return None.
+    */
+    void restart(void);
+
+    /**
+    * @brief reset: forget everything learned
+    *
+    * @return None.
+    */
+    void reset(void);
+
+private:
+    // Voltage learned on 10% of SOC: exponentially weighted moments of the samples
+    struct Segment
+    {
+        float soc;                              // Mean SOC (%)
+        float voltage;                          // Mean voltage (mV)
+        float socVar;                           // Variance of the SOC
+        float covar;                            // Covariance of the SOC and voltage
+        uint32_t count;                         // Samples learned
+    };
+
+    // Voltage learned for a charging state
+    struct Curve
+    {
+        Segment segments[ANOMALY_SOC_SEGMENTS];
+        float scale;                            // Mean absolute deviation from the lines (mV)
+        uint32_t count;                         // Deviations learned
+    };
+
+    // A sample
+    struct Sample
+    {
+        int64_t t;
+        uint16_t voltage;
+        uint8_t soc;
+        bool charging;
+    };
+
+    static int segmentOf(uint8_t soc);
+    static float value(const Segment &g, uint8_t soc);
+    int lineOf(const Sample &s) const;
+    float expected(const Sample &s) const;
+    float score(const Sample &s) const;
+    float level(const Sample &s) const;
+    void learn(const Sample &s);
+    int accept(const Sample &s, float z, BatteryAnomaly *events);
+    static void raise(BatteryAnomaly *event, int64_t t, int32_t type, float value, float expected, float score);
+
+    BatteryAnomalyConfig cfg;       // Tuning
+    Curve curves[2];                // Learned voltage, [charging]
+    float rate[2];                  // Learned SOC change (% per hour), [charging]
+
+    // Short term state
+    bool hasLast;                   // last is valid
+    Sample last;                    // Last sample accepted
+    float lastScore;                // Its z-score
+    bool hasHeld;                   // held is valid
+    Sample held;                    // Sample held as a possible glitch
+    float heldScore;                // Its z-score
+    float cusum;                    // Sag CUSUM sum
+    bool sagRaised;                 // Sag reported, not re-armed yet
+    int64_t riseTime;               // On the charger: time of the last SOC rise (or of the plug)
+    bool stallRaised;               // Stall reported for this charge
+};
+
+class BatteryAnomalyMonitor
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param cfg:       tuning of the detectors
+    * @return None.
+    */
+    BatteryAnomalyMonitor(const BatteryAnomalyConfig &cfg = BatteryAnomalyConfig());
+
+    /**
+    * @brief feed: feed one sample to the detector of its device (created on its first sample).
+    *           Thread safe; the samples of one device must come in time order.
+    *
+    * @param sample:    sample; an event "DeviceConnected" restarts the short term detection
+    * @param events:    receives up to ANOMALY_MAX_EVENTS anomalies
+    * @return The number of anomalies raised
+    */
+    int feed(const TelemetrySample &sample, BatteryAnomaly *events);
+
+    /**
+    * @brief forget: drop the detector of a device
+    *
+    * @param serial:    device serial number
+    * @return None.
+    */
+    void forget(const char *serial);
+
+    /**
+    * @brief deviceCount: number of devices monitored
+    */
+    size_t deviceCount(void);
+
+    /**
+    * @brief stateBytes: size of the state kept per device
+    */
+    static size_t stateBytes(void)                                      { return sizeof(BatteryAnomalyDetector); }
+
+private:
+    struct Shard
+    {
+        std::mutex lock;
+        std::unordered_map<std::string, BatteryAnomalyDetector> detectors;
+    };
+
+    BatteryAnomalyConfig cfg;       // Tuning of the detectors
+    Shard shards[ANOMALY_SHARDS];   // Detectors, by hash of the serial number
+};
+
+#endif // _BATTERYANOMALY_H
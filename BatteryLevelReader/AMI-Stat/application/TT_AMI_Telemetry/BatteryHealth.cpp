@@ -0,0 +1,442 @@
+/*
+* BatteryHealth.cpp : This file contains the estimation of the health of the batteries from the
+*               logged telemetry.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "BatteryHealth.h"
+#include "TelemetryStore.h"
+
+#define HEALTH_MS_PER_HOUR      3600000.0
+#define HEALTH_MS_PER_DAY       86400000.0
+#define HEALTH_TREND_DAYS       30.0        // Trends are given per 30 days
+#define HEALTH_MAD_SCALE        1.4826      // MAD to standard deviation, normal distribution
+#define HEALTH_MIN_SPREAD       0.02        // Spread of the fleet rates never taken below 2% of their median
+#define HEALTH_MIN_FLEET        3           // Fewer devices with a discharge rate: no ranking
+#define HEALTH_DEFAULT_JOBS     4           // Jobs when the number of processors is unknown
+
+/**
+* @brief median: median of values (the vector is reordered)
+*
+* @param v:         values
+* @return The median, -1 if there is no value
+*/
+static double median(std::vector<float> &v)
+{
+    if (v.empty())      return -1.0;
+
+    size_t mid = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + mid, v.end());
+    double m = v[mid];
+    if ((v.size() % 2) == 0)
+    {
+        m = (m + *std::max_element(v.begin(), v.begin() + mid)) / 2.0;
+    }
+    return m;
+}
+
+/**
+* @brief add: add a point to the fit
+*
+* @param x:         abscissa
+* @param y:         ordinate
+* @return None.
+*/
+void LineFit::add(double x, double y)
+{
+    if (n == 0)     x0 = x;
+    x -= x0;
+    n++;
+    sumX += x;
+    sumY += y;
+    sumXX += x * x;
+    sumXY += x * y;
+}
+
+/**
+* @brief valid: the slope can be computed (2 points at least, not all at the same abscissa)
+*
+* @return true if valid
+*/
+bool LineFit::valid(void) const
+{
+    return (n >= 2) && ((n * sumXX - sumX * sumX) > 1e-12 * n * sumXX);
+}
+
+/**
+* @brief slope: slope of the fitted line (valid() must be true)
+*
+* @return dy/dx
+*/
+double LineFit::slope(void) const
+{
+    return (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX);
+}
+
+/**
+* @brief at: ordinate of the fitted line (valid() must be true)
+*
+* @param x:         abscissa
+* @return y at x
+*/
+double LineFit::at(double x) const
+{
+    double b = slope();
+    return (sumY - b * sumX) / n + b * (x - x0);
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param cfg:       tuning
+* @return None.
+*/
+BatteryHealthEstimator::BatteryHealthEstimator(const BatteryHealthConfig &_cfg)
+: cfg(_cfg)
+{
+    reset();
+}
+
+/**
+* @brief reset: forget every sample
+*
+* @return None.
+*/
+void BatteryHealthEstimator::reset(void)
+{
+    segments.clear();
+    steps.clear();
+    samples = 0;
+    firstT = 0;
+    lastT = 0;
+    lastVoltage = 0;
+    lastCharging = false;
+    socFit.reset();
+    voltFit.reset();
+    segSamples = 0;
+    segFirst = 0;
+    segLast = 0;
+    segMin = 0xFF;
+    segMax = 0;
+}
+
+/**
+* @brief add: feed one sample. The samples must come in time order.
+*
+* @param t:         time (ms since epoch)
+* @param soc:       state of charge (%), BATTERY_HEALTH_INVALID_SOC when the reading failed
+* @param voltage:   battery voltage (mV)
+* @param charging:  charger connected
+* @return None.
+*/
+void BatteryHealthEstimator::add(int64_t t, uint8_t soc, uint16_t voltage, bool charging)
+{
+    if (soc > 100)      return;         // reading failed
+
+    if (samples == 0)
+    {
+        firstT = t;
+    }
+    else
+    {
+        bool change = (charging != lastCharging);
+        bool gap = (t - lastT > cfg.gapMs);
+
+        // the voltage jumps by the current swing through the internal resistance when the charger
+        // is plugged (at unplug, a full pack barely takes any current: not used)
+        if (change && charging && (soc <= cfg.chargeMaxSoc) && (t - lastT <= cfg.stepMs) && (cfg.stepCurrentMa > 0))
+        {
+            Step step;
+            step.t = t;
+            step.resistance = (float)(fabs((double)voltage - lastVoltage) * 1000.0 / cfg.stepCurrentMa);
+            steps.push_back(step);
+        }
+        if (change || gap)      closeSegment();
+    }
+    samples++;
+    segSamples++;
+
+    // discharge fitted whole, charge only while the current is constant
+    if ((charging == false) || (soc <= cfg.chargeMaxSoc))
+    {
+        if (socFit.n == 0)      segFirst = t;
+        segLast = t;
+        socFit.add(t / HEALTH_MS_PER_HOUR, soc);
+        if (charging == false)  voltFit.add(soc, voltage);
+        segMin = std::min(segMin, soc);
+        segMax = std::max(segMax, soc);
+    }
+
+    lastT = t;
+    lastVoltage = voltage;
+    lastCharging = charging;
+}
+
+/**
+* @brief flush: end the segment in progress (end of the log), so that report uses it
+*
+* @return None.
+*/
+void BatteryHealthEstimator::flush(void)
+{
+    closeSegment();
+}
+
+/**
+* @brief closeSegment: fit the segment in progress and keep it when it is long enough, then
+*           start a new one
+*
+* @return None.
+*/
+void BatteryHealthEstimator::closeSegment(void)
+{
+    if (segSamples == 0)    return;
+
+    bool enough = (socFit.n >= cfg.minSamples) && (segLast - segFirst >= (int64_t)cfg.minMinutes * 60000) &&
+                  (segMax - segMin >= (int)cfg.minSpan) && socFit.valid();
+    if (enough)
+    {
+        double rate = lastCharging ? socFit.slope() : -socFit.slope();
+        if (rate >= (lastCharging ? 0.0 : cfg.minRate))
+        {
+            Segment seg;
+            seg.end = segLast;
+            seg.rate = (float)rate;
+            seg.voltageAt50 = ((lastCharging == false) && voltFit.valid()) ? (float)voltFit.at(50.0) : -1.0f;
+            seg.charging = lastCharging;
+            segments.push_back(seg);
+        }
+    }
+
+    socFit.reset();
+    voltFit.reset();
+    segSamples = 0;
+    segMin = 0xFF;
+    segMax = 0;
+}
+
+/**
+* @brief reference: rate of the pack when new: the one configured, else the median of the
+*           first segments of the device
+*
+* @param charging:  charge or discharge rate
+* @return The rate (% per hour), -1 if unknown
+*/
+double BatteryHealthEstimator::reference(bool charging) const
+{
+    double known = charging ? cfg.newChargeRate : cfg.newDischargeRate;
+    if (known > 0)      return known;
+
+    std::vector<float> rates;
+    for (size_t i = 0; (i < segments.size()) && (rates.size() < cfg.referenceSegments); i++)
+    {
+        if (segments[i].charging == charging)   rates.push_back(segments[i].rate);
+    }
+    return median(rates);
+}
+
+/**
+* @brief report: the estimation with the segments ended so far. fleetScore is left at 0,
+*           see BatteryFleetHealth.
+*
+* @param serial:    device serial number, copied in the report
+* @param health:    filled with the estimation
+* @return None.
+*/
+void BatteryHealthEstimator::report(const char *serial, BatteryHealth *health) const
+{
+    memset(health, 0, sizeof(*health));
+    strncpy(health->serial, serial, sizeof(health->serial) - 1);
+    health->firstTimestamp = firstT;
+    health->lastTimestamp = lastT;
+    health->samples = samples;
+
+    // recent rates, and the capacity along the log against the reference
+    int64_t recentFrom = lastT - (int64_t)cfg.recentDays * (int64_t)HEALTH_MS_PER_DAY;
+    double refRate[2] = { reference(false), reference(true) };
+    std::vector<float> recentRates[2];
+    std::vector<float> recentVoltage;
+    LineFit capacityFit;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        const Segment &seg = segments[i];
+        int kind = seg.charging ? 1 : 0;
+        if (seg.charging)   health->charges++;
+        else                health->discharges++;
+        if (refRate[kind] > 0)      capacityFit.add(seg.end / HEALTH_MS_PER_DAY, 100.0 * refRate[kind] / seg.rate);
+        if (seg.end < recentFrom)   continue;
+        recentRates[kind].push_back(seg.rate);
+        if (seg.voltageAt50 > 0)    recentVoltage.push_back(seg.voltageAt50);
+    }
+    double rate[2] = { median(recentRates[0]), median(recentRates[1]) };
+    health->dischargeRate = (float)rate[0];
+    health->chargeRate = (float)rate[1];
+    health->voltageAt50 = (float)median(recentVoltage);
+
+    // both rates follow the capacity: average the estimates available
+    double capacity = 0;
+    int estimates = 0;
+    for (int kind = 0; kind < 2; kind++)
+    {
+        if ((refRate[kind] <= 0) || (rate[kind] <= 0))  continue;
+        capacity += 100.0 * refRate[kind] / rate[kind];
+        estimates++;
+    }
+    health->capacity = (estimates > 0) ? (float)(capacity / estimates) : -1.0f;
+    health->capacityTrend = capacityFit.valid() ? (float)(capacityFit.slope() * HEALTH_TREND_DAYS) : 0.0f;
+
+    std::vector<float> recentSteps;
+    LineFit resistanceFit;
+    for (size_t i = 0; i < steps.size(); i++)
+    {
+        resistanceFit.add(steps[i].t / HEALTH_MS_PER_DAY, steps[i].resistance);
+        if (steps[i].t >= recentFrom)   recentSteps.push_back(steps[i].resistance);
+    }
+    health->resistance = (float)median(recentSteps);
+    health->resistanceTrend = resistanceFit.valid() ? (float)(resistanceFit.slope() * HEALTH_TREND_DAYS) : 0.0f;
+
+    if (rate[0] <= 0)                                                           health->flags |= TLM_HEALTH_NO_DATA;
+    if ((health->capacity >= 0) && (health->capacity < cfg.lowCapacity))       health->flags |= TLM_HEALTH_LOW_CAPACITY;
+    if (health->resistanceTrend > cfg.resistanceRise)                           health->flags |= TLM_HEALTH_RESISTANCE;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param cfg:       tuning
+* @param jobs:      number of devices estimated at once (0: one per processor)
+* @return None.
+*/
+BatteryFleetHealth::BatteryFleetHealth(const BatteryHealthConfig &_cfg, unsigned _jobs)
+: cfg(_cfg)
+, jobs(_jobs)
+, store(NULL)
+, from(0)
+, to(0)
+, serials(NULL)
+, reports(NULL)
+, nextDevice(0)
+, error(TLM_OK)
+, scanned(0)
+{
+    if (jobs == 0)      jobs = std::thread::hardware_concurrency();
+    if (jobs == 0)      jobs = HEALTH_DEFAULT_JOBS;
+}
+
+/**
+* @brief analyze: estimate the health of every device of a store over a time range, and
+*           rank the devices against the fleet
+*
+* @param store:     opened store
+* @param from:      first timestamp included (ms since epoch)
+* @param to:        last timestamp included (ms since epoch)
+* @param out:       filled with one report per device, sorted by serial number
+* @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+*/
+int BatteryFleetHealth::analyze(TelemetryStore &_store, int64_t _from, int64_t _to, std::vector<BatteryHealth> &out)
+{
+    std::vector<std::string> devices;
+    _store.serials(devices);
+    std::sort(devices.begin(), devices.end());
+
+    out.clear();
+    out.resize(devices.size());
+    store = &_store;
+    from = _from;
+    to = _to;
+    serials = &devices;
+    reports = &out;
+    nextDevice = 0;
+    error = TLM_OK;
+    scanned = 0;
+
+    std::vector<std::thread> workers;
+    unsigned count = (unsigned)std::min((size_t)jobs, devices.size());
+    for (unsigned w = 0; w < count; w++)    workers.push_back(std::thread(workerEntry, this));
+    for (size_t w = 0; w < workers.size(); w++)     workers[w].join();
+
+    store = NULL;
+    serials = NULL;
+    reports = NULL;
+    rank(cfg, out);
+    return error;
+}
+
+/**
+* @brief workerEntry: worker thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void BatteryFleetHealth::workerEntry(BatteryFleetHealth *self)
+{
+    self->workerFunc();
+}
+
+/**
+* @brief workerFunc: estimate devices until none is left. Each device is scanned column by
+*           column, the columns are then fed to the estimator in one pass.
+*
+* @return None.
+*/
+void BatteryFleetHealth::workerFunc(void)
+{
+    TelemetryColumns cols;
+    BatteryHealthEstimator estimator(cfg);
+    size_t d;
+
+    while ((d = nextDevice++) < serials->size())
+    {
+        const char *serial = (*serials)[d].c_str();
+        cols.clear();
+        int err = store->scanColumns(serial, from, to, cols);
+        if (err != TLM_OK)      error = err;
+        scanned += cols.size();
+
+        estimator.reset();
+        const int64_t *t = cols.timestamp.data();
+        const uint8_t *soc = cols.soc.data();
+        const uint16_t *voltage = cols.voltage.data();
+        const uint8_t *charging = cols.charging.data();
+        for (size_t i = 0; i < cols.size(); i++)    estimator.add(t[i], soc[i], voltage[i], charging[i] != 0);
+        estimator.flush();
+        estimator.report(serial, &(*reports)[d]);
+    }
+}
+
+/**
+* @brief rank: score the discharge rate of each device against the fleet and flag those
+*           draining too fast
+*
+* @param cfg:       tuning
+* @param reports:   reports of the fleet, fleetScore and flags updated
+* @return None.
+*/
+void BatteryFleetHealth::rank(const BatteryHealthConfig &cfg, std::vector<BatteryHealth> &reports)
+{
+    std::vector<float> rates;
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        reports[i].fleetScore = 0.0f;
+        reports[i].flags &= ~TLM_HEALTH_FAST_DRAIN;
+        if (reports[i].dischargeRate > 0)   rates.push_back(reports[i].dischargeRate);
+    }
+    if (rates.size() < HEALTH_MIN_FLEET)    return;
+
+    // median and median absolute deviation: the bad packs do not move them
+    double m = median(rates);
+    for (size_t i = 0; i < rates.size(); i++)   rates[i] = (float)fabs(rates[i] - m);
+    double spread = std::max(HEALTH_MAD_SCALE * median(rates), HEALTH_MIN_SPREAD * m);
+
+    for (size_t i = 0; i < reports.size(); i++)
+    {
+        if (reports[i].dischargeRate <= 0)  continue;
+        reports[i].fleetScore = (float)((reports[i].dischargeRate - m) / spread);
+        if (reports[i].fleetScore > cfg.fleetScore)     reports[i].flags |= TLM_HEALTH_FAST_DRAIN;
+    }
+}
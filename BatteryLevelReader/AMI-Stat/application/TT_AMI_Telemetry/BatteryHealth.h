@@ -0,0 +1,222 @@
+/*
+* BatteryHealth.h : This file contains the estimation of the health of the batteries (remaining
+*               capacity, internal resistance, trends) from the telemetry logged by AMIStat.
+*
+*   In a nutshell, this file implements:
+*       - BatteryHealthEstimator: the estimation for one device, fed one sample at a time (O(1)
+*           per sample). The samples are cut into segments of constant charging state (a gap
+*           in the log also ends a segment), and the SOC of each segment is fitted against
+*           the time by least squares, from running sums:
+*               - discharge: SOC drop in % per hour, and voltage against SOC (voltage at 50%)
+*               - charge: SOC rise in % per hour, over the constant current part (SOC <= 80%)
+*           The load and the charge current of a device hardly change, so the rates follow the
+*           capacity of the pack: capacity = reference rate / recent rate. The reference is the
+*           rate of a new pack when known, the first segments of the device otherwise.
+*           The voltage step when the charger is plugged (constant current) gives the internal
+*           resistance (step / current swing). The trends are least square slopes over the segments.
+*       - BatteryFleetHealth: every device of a store estimated in parallel from columnar scans
+*           (TelemetryStore::scanColumns), then the discharge rates ranked against the fleet:
+*           a device whose robust z-score (median, MAD) is above the threshold drains too fast.
+*
+*   No Windows dependency: the estimation is also used by the host tools.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _BATTERYHEALTH_H
+#define _BATTERYHEALTH_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "TelemetryTypes.h"
+
+#define BATTERY_HEALTH_INVALID_SOC  0xFF    // SOC logged when the reading failed (as BATSTAT_INVALID_SOC)
+
+class TelemetryStore;
+
+/**
+* @brief Tuning of the estimation. The defaults suit the logging period of AMIStat (minutes).
+*/
+struct BatteryHealthConfig
+{
+    int64_t gapMs;              // A gap longer than this in the log ends a segment
+    uint32_t minSamples;        // Fewer samples: segment not fitted
+    uint32_t minMinutes;        // Shorter: segment not fitted
+    uint32_t minSpan;           // SOC moved by less than this (%): segment not fitted
+    double minRate;             // Discharge slower than this (% per hour): device idle, not fitted
+    uint32_t chargeMaxSoc;      // Charge fitted up to this SOC (constant current part)
+    int64_t stepMs;             // Samples around a charger change further apart: no resistance step
+    double stepCurrentMa;       // Current swing when the charger is plugged (charge + load, mA)
+    uint32_t referenceSegments; // Segments giving the reference rates when not known
+    double newDischargeRate;    // Discharge rate of a new pack (% per hour, 0: unknown)
+    double newChargeRate;       // Charge rate of a new pack (% per hour, 0: unknown)
+    uint32_t recentDays;        // Segments this close to the last sample give the recent rates
+    double lowCapacity;         // Capacity below this (%): TLM_HEALTH_LOW_CAPACITY
+    double resistanceRise;      // Resistance rising faster (mOhm per 30 days): TLM_HEALTH_RESISTANCE
+    double fleetScore;          // Robust z-score above this: TLM_HEALTH_FAST_DRAIN
+
+    BatteryHealthConfig()
+    : gapMs(2 * 3600 * 1000), minSamples(5), minMinutes(30), minSpan(5), minRate(0.5), chargeMaxSoc(80)
+    , stepMs(10 * 60 * 1000), stepCurrentMa(600.0), referenceSegments(10), newDischargeRate(0.0)
+    , newChargeRate(0.0), recentDays(30), lowCapacity(80.0), resistanceRise(5.0), fleetScore(3.0) {}
+};
+
+/**
+* @brief Least square fit of y against x from running sums. x is relative to the first point
+*           so that the sums keep their precision.
+*/
+struct LineFit
+{
+    uint32_t n;
+    double x0;
+    double sumX, sumY, sumXX, sumXY;
+
+    LineFit()                                   { reset(); }
+    void reset(void)                            { n = 0; x0 = sumX = sumY = sumXX = sumXY = 0.0; }
+    void add(double x, double y);
+    bool valid(void) const;
+    double slope(void) const;
+    double at(double x) const;
+};
+
+class BatteryHealthEstimator
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param cfg:       tuning
+    * @return None.
+    */
+    BatteryHealthEstimator(const BatteryHealthConfig &cfg = BatteryHealthConfig());
+
+    /**
+    * @brief add: feed one sample. The samples must come in time order.
+    *
+    * @param t:         time (ms since epoch)
+    * @param soc:       state of charge (%), BATTERY_HEALTH_INVALID_SOC when the reading failed
+    * @param voltage:   battery voltage (mV)
+    * @param charging:  charger connected
+    * @return None.
+    */
+    void add(int64_t t, uint8_t soc, uint16_t voltage, bool charging);
+
+    /**
+    * @brief flush: end the segment in progress (end of the log), so that report uses it
+    *
+    * @return None.
+    */
+    void flush(void);
+
+    /**
+    * @brief report: the estimation with the segments ended so far. fleetScore is left at 0,
+    *           see BatteryFleetHealth.
+    *
+    * @param serial:    device serial number, copied in the report
+    * @param health:    filled with the estimation
+    * @return None.
+    */
+    void report(const char *serial, BatteryHealth *health) const;
+
+    /**
+    * @brief reset: forget every sample
+    *
+    * @return None.
+    */
+    void reset(void);
+
+private:
+    // One segment fitted
+    struct Segment
+    {
+        int64_t end;                // Time of its last sample
+        float rate;                 // SOC change (% per hour, positive)
+        float voltageAt50;          // Voltage at 50% SOC (discharges only, mV)
+        bool charging;              // Charge or discharge
+    };
+
+    // A voltage step at a charger change
+    struct Step
+    {
+        int64_t t;                  // Time of the change
+        float resistance;           // mOhm
+    };
+
+    void closeSegment(void);
+    double reference(bool charging) const;
+
+    BatteryHealthConfig cfg;        // Tuning
+    std::vector<Segment> segments;  // Segments fitted, in time order
+    std::vector<Step> steps;        // Voltage steps, in time order
+    uint32_t samples;               // Samples fed
+    int64_t firstT;                 // Time of the first sample
+    int64_t lastT;                  // Time of the last sample
+    uint16_t lastVoltage;           // Voltage of the last sample
+    bool lastCharging;              // Charging state of the last sample
+
+    // Segment in progress
+    LineFit socFit;                 // SOC against time (hours)
+    LineFit voltFit;                // Voltage against SOC
+    uint32_t segSamples;            // Samples in the segment
+    int64_t segFirst;               // Time of the first sample fitted
+    int64_t segLast;                // Time of the last sample fitted
+    uint8_t segMin, segMax;         // SOC range of the samples fitted
+};
+
+class BatteryFleetHealth
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param cfg:       tuning
+    * @param jobs:      number of devices estimated at once (0: one per processor)
+    * @return None.
+    */
+    BatteryFleetHealth(const BatteryHealthConfig &cfg = BatteryHealthConfig(), unsigned jobs = 0);
+
+    /**
+    * @brief analyze: estimate the health of every device of a store over a time range, and
+    *           rank the devices against the fleet
+    *
+    * @param store:     opened store
+    * @param from:      first timestamp included (ms since epoch)
+    * @param to:        last timestamp included (ms since epoch)
+    * @param out:       filled with one report per device, sorted by serial number
+    * @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+    */
+    int analyze(TelemetryStore &store, int64_t from, int64_t to, std::vector<BatteryHealth> &out);
+
+    /**
+    * @brief rank: score the discharge rate of each device against the fleet and flag those
+    *           draining too fast
+    *
+    * @param cfg:       tuning
+    * @param reports:   reports of the fleet, fleetScore and flags updated
+    * @return None.
+    */
+    static void rank(const BatteryHealthConfig &cfg, std::vector<BatteryHealth> &reports);
+
+    unsigned jobCount(void) const                                       { return jobs; }
+    uint64_t scannedSamples(void) const                                 { return scanned; }
+
+private:
+    static void workerEntry(BatteryFleetHealth *self);
+    void workerFunc(void);
+
+    BatteryHealthConfig cfg;        // Tuning
+    unsigned jobs;                  // Devices estimated at once
+
+    // Analysis in progress
+    TelemetryStore *store;          // Store scanned
+    int64_t from, to;               // Time range
+    const std::vector<std::string> *serials;    // Devices of the store
+    std::vector<BatteryHealth> *reports;        // Their reports
+    std::atomic<size_t> nextDevice; // Next device to estimate
+    std::atomic<int> error;         // Last error of the scans
+    std::atomic<uint64_t> scanned;  // Samples scanned
+};
+
+#endif // _BATTERYHEALTH_H
@@ -0,0 +1,1470 @@
+/*
+* FleetQuery.cpp : This file contains the query engine over the battery telemetry and the
+*               history of the firmware updates of the fleet.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include "FleetQuery.h"
+#include "TelemetryStore.h"
+
+#define QUERY_MS_PER_DAY        86400000LL
+#define QUERY_MS_PER_HOUR       3600000.0
+#define QUERY_INVALID_SOC       0xFF        // SOC logged when the reading failed
+#define QUERY_DEFAULT_JOBS      4           // Jobs when the number of processors is unknown
+#define QUERY_INT_LIMIT         4.0e18      // Integer filter values clamped to this
+
+static const char *bucketNames[] = { "", "day", "week", "month" };
+static const char *funcNames[] = { "count", "sum", "avg", "min", "max" };
+
+/**
+* @brief daysFromCivil: days since 1970-01-01 of a date of the proleptic Gregorian calendar
+*
+* @param y, m, d:   year, month (1..12), day (1..31)
+* @return The number of days
+*/
+static int64_t daysFromCivil(int64_t y, unsigned m, unsigned d)
+{
+    y -= (m <= 2);
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned)(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+/**
+* @brief civilFromDays: date of a number of days since 1970-01-01
+*
+* @param z:         days
+* @param y, m, d:   receive the year, month (1..12) and day (1..31)
+* @return None.
+*/
+static void civilFromDays(int64_t z, int64_t *y, unsigned *m, unsigned *d)
+{
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned)(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static int64_t floorDiv(int64_t a, int64_t b)
+{
+    int64_t q = a / b;
+    return ((a % b) != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+/**
+* @brief bucketOf: time bucket of a timestamp. Days and weeks are numbered from 1970-01-01,
+*           the weeks start on Monday (1970-01-01 was a Thursday), the months are year * 12 + month.
+*
+* @param ms:        ms since the epoch
+* @param bucket:    day, week or month
+* @return The bucket number
+*/
+static int64_t bucketOf(int64_t ms, QueryBucket bucket)
+{
+    int64_t day = floorDiv(ms, QUERY_MS_PER_DAY);
+    if (bucket == QUERY_DAY)    return day;
+    if (bucket == QUERY_WEEK)   return floorDiv(day + 3, 7);
+
+    int64_t y;
+    unsigned m, d;
+    civilFromDays(day, &y, &m, &d);
+    return y * 12 + (m - 1);
+}
+
+/**
+* @brief formatTime: text of a timestamp or of a time bucket
+*
+* @param value:     timestamp (ms) or bucket number
+* @param bucket:    what the value is
+* @return The text: "YYYY-MM-DD hh:mm:ss", the first day of the day or week, "YYYY-MM" for a month
+*/
+static std::string formatTime(int64_t value, QueryBucket bucket)
+{
+    char text[32];
+    int64_t y;
+    unsigned m, d;
+
+    if (bucket == QUERY_MONTH)
+    {
+        snprintf(text, sizeof(text), "%04lld-%02u", (long long)floorDiv(value, 12), (unsigned)(value - floorDiv(value, 12) * 12 + 1));
+        return text;
+    }
+    int64_t day = (bucket == QUERY_DAY) ? value : (bucket == QUERY_WEEK) ? value * 7 - 3 : floorDiv(value, QUERY_MS_PER_DAY);
+    civilFromDays(day, &y, &m, &d);
+    if (bucket != QUERY_VALUE)
+    {
+        snprintf(text, sizeof(text), "%04lld-%02u-%02u", (long long)y, m, d);
+        return text;
+    }
+    int64_t sec = floorDiv(value, 1000) - day * 86400;
+    snprintf(text, sizeof(text), "%04lld-%02u-%02u %02u:%02u:%02u", (long long)y, m, d,
+             (unsigned)(sec / 3600), (unsigned)((sec / 60) % 60), (unsigned)(sec % 60));
+    return text;
+}
+
+static std::string trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t");
+    size_t e = s.find_last_not_of(" \t\r\n");
+    return (b == std::string::npos) ? std::string() : s.substr(b, e - b + 1);
+}
+
+/**
+* @brief parseNumber: parse a whole text as a number
+*
+* @return false if the text is not a number
+*/
+static bool parseNumber(const std::string &text, double *value)
+{
+    char *end;
+    if (text.empty())   return false;
+    *value = strtod(text.c_str(), &end);
+    return *end == '\0';
+}
+
+bool queryParseDate(const char *text, int64_t *ms)
+{
+    int y, m, d, hh = 0, mm = 0, ss = 0;
+    char sep;
+    int n = sscanf(text, "%4d-%2d-%2d%c%2d:%2d:%2d", &y, &m, &d, &sep, &hh, &mm, &ss);
+    if (n != 3 && n != 6 && n != 7)     return false;
+    if (n > 3 && sep != ' ' && sep != 'T')  return false;
+    if (m < 1 || m > 12 || d < 1 || d > 31 || hh > 23 || mm > 59 || ss > 59)   return false;
+
+    *ms = (daysFromCivil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss) * 1000;
+    return true;
+}
+
+bool queryParseFilter(const char *text, QueryFilter *filter)
+{
+    std::string s(text);
+    size_t p = s.find_first_of("!<>=");
+    if (p == std::string::npos || p == 0)   return false;
+
+    size_t len = 1;
+    if (s[p] == '=')                            filter->op = QUERY_EQ;
+    else if (s.compare(p, 2, "!=") == 0)        filter->op = QUERY_NE, len = 2;
+    else if (s.compare(p, 2, "<=") == 0)        filter->op = QUERY_LE, len = 2;
+    else if (s.compare(p, 2, ">=") == 0)        filter->op = QUERY_GE, len = 2;
+    else if (s[p] == '<')                       filter->op = QUERY_LT;
+    else if (s[p] == '>')                       filter->op = QUERY_GT;
+    else                                        return false;
+    if (filter->op == QUERY_EQ && s.compare(p, 2, "==") == 0)   len = 2;
+
+    filter->column = trim(s.substr(0, p));
+    filter->value = trim(s.substr(p + len));
+    return !filter->column.empty() && !filter->value.empty();
+}
+
+/**
+* @brief parseCall: split "name(argument)"
+*
+* @return false if the text has no parenthesis
+*/
+static bool parseCall(const std::string &s, std::string *name, std::string *arg)
+{
+    size_t open = s.find('(');
+    if (open == std::string::npos || s[s.size() - 1] != ')')    return false;
+    *name = trim(s.substr(0, open));
+    *arg = trim(s.substr(open + 1, s.size() - open - 2));
+    return true;
+}
+
+bool queryParseGroup(const char *text, QueryGroup *group)
+{
+    std::string s = trim(text), name, arg;
+    group->bucket = QUERY_VALUE;
+    group->column = s;
+    if (!parseCall(s, &name, &arg))     return !s.empty() && s.find_first_of("()") == std::string::npos;
+
+    for (int b = QUERY_DAY; b <= QUERY_MONTH; b++)
+    {
+        if (name == bucketNames[b])
+        {
+            group->bucket = (QueryBucket)b;
+            group->column = arg;
+            return !arg.empty();
+        }
+    }
+    return false;
+}
+
+bool queryParseAggregate(const char *text, QueryAggregate *aggregate)
+{
+    std::string s = trim(text), name, arg;
+    if (s == funcNames[QUERY_COUNT])
+    {
+        aggregate->func = QUERY_COUNT;
+        aggregate->column.clear();
+        return true;
+    }
+    if (!parseCall(s, &name, &arg))     return false;
+
+    for (int f = QUERY_COUNT; f <= QUERY_MAX; f++)
+    {
+        if (name == funcNames[f])
+        {
+            aggregate->func = (QueryFunc)f;
+            aggregate->column = arg;
+            return !arg.empty() || f == QUERY_COUNT;
+        }
+    }
+    return false;
+}
+
+int32_t QueryColumn::code(const std::string &text)
+{
+    std::unordered_map<std::string, int32_t>::const_iterator it = codes.find(text);
+    if (it != codes.end())  return it->second;
+
+    int32_t c = (int32_t)dict.size();
+    dict.push_back(text);
+    codes[text] = c;
+    return c;
+}
+
+size_t QueryColumn::size(void) const
+{
+    switch (storage)
+    {
+    case QUERY_U8:      return u8.size();
+    case QUERY_I32:     return i32.size();
+    case QUERY_I64:     return i64.size();
+    default:            return f32.size();
+    }
+}
+
+QueryColumn &QueryTable::addColumn(const char *name, QueryStorage storage, QueryKind kind)
+{
+    columns.push_back(QueryColumn());
+    QueryColumn &col = columns.back();
+    col.name = name;
+    col.storage = storage;
+    col.kind = kind;
+    return col;
+}
+
+int QueryTable::find(const std::string &name) const
+{
+    for (size_t c = 0; c < columns.size(); c++)
+    {
+        if (columns[c].name == name)    return (int)c;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------------------------
+// Telemetry loader
+//------------------------------------------------------------------------------------------------
+
+// Columns of the telemetry table
+enum { TCOL_SERIAL, TCOL_FIRMWARE, TCOL_TIME, TCOL_SOC, TCOL_VOLTAGE, TCOL_CHARGING, TCOL_RATE };
+
+/**
+* @brief Scan of the devices of a store in parallel. Each device is appended to the table
+*           under the lock once scanned, so that the samples of a device stay together.
+*/
+class TelemetryLoader
+{
+public:
+    TelemetryLoader(TelemetryStore &_store, int64_t _from, int64_t _to, QueryTable &_table)
+    : store(_store)
+    , from(_from)
+    , to(_to)
+    , table(_table)
+    , nextDevice(0)
+    , error(TLM_OK)
+    {
+    }
+
+    int run(unsigned jobs)
+    {
+        store.serials(serials);
+        std::sort(serials.begin(), serials.end());
+
+        std::vector<std::thread> workers;
+        unsigned count = (unsigned)std::min((size_t)jobs, serials.size());
+        for (unsigned w = 0; w < count; w++)    workers.push_back(std::thread(workerEntry, this));
+        for (size_t w = 0; w < workers.size(); w++)     workers[w].join();
+        return error;
+    }
+
+private:
+    static void workerEntry(TelemetryLoader *self)
+    {
+        self->workerFunc();
+    }
+
+    void workerFunc(void)
+    {
+        TelemetryColumns cols;
+        std::vector<float> rate;
+        std::vector<int32_t> firmwareCodes;
+        size_t d;
+
+        while ((d = nextDevice++) < serials.size())
+        {
+            cols.clear();
+            int err = store.scanColumns(serials[d].c_str(), from, to, cols, true);
+            if (err != TLM_OK)      error = err;
+            size_t n = cols.size();
+            if (n == 0)     continue;
+
+            // Rate against the previous sample of the device, when in the same segment
+            rate.assign(n, std::numeric_limits<float>::quiet_NaN());
+            for (size_t i = 1; i < n; i++)
+            {
+                int64_t dt = cols.timestamp[i] - cols.timestamp[i - 1];
+                if (dt <= 0 || dt > QUERY_RATE_GAP_MS)                  continue;
+                if (cols.charging[i] != cols.charging[i - 1])           continue;
+                if (cols.soc[i] == QUERY_INVALID_SOC || cols.soc[i - 1] == QUERY_INVALID_SOC)   continue;
+                rate[i] = (float)(((int)cols.soc[i] - (int)cols.soc[i - 1]) * QUERY_MS_PER_HOUR / (double)dt);
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            firmwareCodes.resize(cols.firmwares.size());
+            for (size_t f = 0; f < cols.firmwares.size(); f++)  firmwareCodes[f] = table.columns[TCOL_FIRMWARE].code(cols.firmwares[f]);
+
+            QueryColumn *c = table.columns.data();
+            c[TCOL_SERIAL].i32.insert(c[TCOL_SERIAL].i32.end(), n, c[TCOL_SERIAL].code(serials[d]));
+            std::vector<int32_t> &firmware = c[TCOL_FIRMWARE].i32;
+            for (size_t i = 0; i < n; i++)      firmware.push_back(firmwareCodes[cols.firmware[i]]);
+            c[TCOL_TIME].i64.insert(c[TCOL_TIME].i64.end(), cols.timestamp.begin(), cols.timestamp.end());
+            c[TCOL_SOC].u8.insert(c[TCOL_SOC].u8.end(), cols.soc.begin(), cols.soc.end());
+            c[TCOL_VOLTAGE].i32.insert(c[TCOL_VOLTAGE].i32.end(), cols.voltage.begin(), cols.voltage.end());
+            c[TCOL_CHARGING].u8.insert(c[TCOL_CHARGING].u8.end(), cols.charging.begin(), cols.charging.end());
+            c[TCOL_RATE].f32.insert(c[TCOL_RATE].f32.end(), rate.begin(), rate.end());
+        }
+    }
+
+    TelemetryStore &store;          // Store scanned
+    int64_t from, to;               // Time range
+    QueryTable &table;              // Table filled
+    std::vector<std::string> serials;   // Devices of the store
+    std::mutex lock;                // Protects the table
+    std::atomic<size_t> nextDevice; // Next device to scan
+    std::atomic<int> error;         // Last error of the scans
+};
+
+int queryLoadTelemetry(TelemetryStore &store, int64_t from, int64_t to, unsigned jobs, QueryTable &table)
+{
+    if (jobs == 0)      jobs = std::thread::hardware_concurrency();
+    if (jobs == 0)      jobs = QUERY_DEFAULT_JOBS;
+
+    table.clear();
+    table.addColumn("serial", QUERY_I32, QUERY_TEXT);
+    table.addColumn("firmware", QUERY_I32, QUERY_TEXT);
+    table.addColumn("time", QUERY_I64, QUERY_TIME);
+    table.addColumn("soc", QUERY_U8);
+    table.addColumn("voltage", QUERY_I32);
+    table.addColumn("charging", QUERY_U8);
+    table.addColumn("rate", QUERY_F32);
+
+    TelemetryLoader loader(store, from, to, table);
+    return loader.run(jobs);
+}
+
+//------------------------------------------------------------------------------------------------
+// Update history loader
+//------------------------------------------------------------------------------------------------
+
+// Columns of the update table
+enum { UCOL_DEVICE, UCOL_PACKAGE, UCOL_TIME, UCOL_RESULT, UCOL_FAILED, UCOL_DURATION, UCOL_THROUGHPUT,
+       UCOL_RETRIES, UCOL_TIMEOUTS, UCOL_FRAMING };
+
+// Cache of the parsed columns, next to the metrics file
+#define QUERY_CACHE_SUFFIX      ".cols"
+#define QUERY_CACHE_MAGIC       0x43505551  // "QUPC"
+#define QUERY_CACHE_VERSION     1           // Change with the columns or the parsing
+#define QUERY_CACHE_HEAD        4096        // First bytes of the metrics file hashed
+#define QUERY_CACHE_MAX_TEXT    65536       // Longest text value accepted from a cache
+
+/**
+* Header of a cache file, followed per column by its dictionary (count, then length and bytes of
+* each value) and its values. Written in the byte order of the machine: the cache is not shared.
+*/
+typedef struct
+{
+    uint32_t magic;             // QUERY_CACHE_MAGIC
+    uint32_t version;           // QUERY_CACHE_VERSION
+    uint32_t columns;           // Columns of the update table
+    uint32_t headLen;           // Bytes of the metrics file hashed (up to QUERY_CACHE_HEAD)
+    uint64_t headHash;          // Their hash
+    uint64_t parsed;            // Offset of the metrics file the rows end at
+    uint64_t rows;              // Rows cached
+} QueryCacheHeader;
+
+static bool querySeek(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static int64_t queryTell(FILE *f)
+{
+#ifdef _WIN32
+    return _ftelli64(f);
+#else
+    return (int64_t)ftello(f);
+#endif
+}
+
+static uint64_t querySize(FILE *f)
+{
+#ifdef _WIN32
+    bool ok = (_fseeki64(f, 0, SEEK_END) == 0);
+#else
+    bool ok = (fseeko(f, 0, SEEK_END) == 0);
+#endif
+    int64_t size = ok ? queryTell(f) : -1;
+    return (size > 0) ? (uint64_t)size : 0;
+}
+
+/**
+* @brief jsonValue: find the value of a key of a JSON line. The session fields come before the
+*           histograms, so the first match is the one of the session.
+*
+* @param line:      JSON line
+* @param key:       key
+* @return The first character of the value, NULL if the key is absent
+*/
+static const char *jsonValue(const char *line, const char *key)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(line, pattern);
+    return (p != NULL) ? p + strlen(pattern) : NULL;
+}
+
+static std::string jsonText(const char *line, const char *key)
+{
+    const char *p = jsonValue(line, key);
+    if (p == NULL || *p != '"')     return std::string();
+    const char *end = strchr(p + 1, '"');
+    return (end != NULL) ? std::string(p + 1, end) : std::string();
+}
+
+static double jsonNumber(const char *line, const char *key)
+{
+    const char *p = jsonValue(line, key);
+    return (p != NULL) ? strtod(p, NULL) : std::numeric_limits<double>::quiet_NaN();
+}
+
+/**
+* @brief updateColumns: create the columns of the update table
+*/
+static void updateColumns(QueryTable &table)
+{
+    table.addColumn("device", QUERY_I32, QUERY_TEXT);
+    table.addColumn("package", QUERY_I32, QUERY_TEXT);
+    table.addColumn("time", QUERY_I64, QUERY_TIME);
+    table.addColumn("result", QUERY_I32);
+    table.addColumn("failed", QUERY_U8);
+    table.addColumn("duration", QUERY_F32);
+    table.addColumn("throughput", QUERY_F32);
+    table.addColumn("retries", QUERY_I32);
+    table.addColumn("timeouts", QUERY_I32);
+    table.addColumn("framingErrors", QUERY_I32);
+}
+
+/**
+* @brief parseUpdates: parse the sessions of a metrics file from the current position to its end
+*
+* @param f:         metrics file
+* @param table:     receives the sessions
+* @param complete:  receives the offset after the last complete line (a line being written is parsed, not counted)
+* @param completeRows: receives the rows of table up to that line
+* @return TLM_OK, TLM_ERR_IO
+*/
+static int parseUpdates(FILE *f, QueryTable &table, uint64_t *complete, size_t *completeRows)
+{
+    QueryColumn *c = table.columns.data();
+    uint64_t offset = (uint64_t)queryTell(f);
+
+    *complete = offset;
+    *completeRows = table.rows();
+
+    // The lines hold the latency histograms: read them in pieces
+    std::string line;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f) != NULL)
+    {
+        line += buf;
+        if (line[line.size() - 1] != '\n' && !feof(f))     continue;
+
+        const char *l = line.c_str();
+        double started = jsonNumber(l, "startedAt");
+        if (!isnan(started))    // Sessions logged before the start time was: nothing to group them on
+        {
+            int32_t result = (int32_t)jsonNumber(l, "lastResult");
+            c[UCOL_DEVICE].i32.push_back(c[UCOL_DEVICE].code(jsonText(l, "label")));
+            c[UCOL_PACKAGE].i32.push_back(c[UCOL_PACKAGE].code(jsonText(l, "package")));
+            c[UCOL_TIME].i64.push_back((int64_t)started);
+            c[UCOL_RESULT].i32.push_back(result);
+            c[UCOL_FAILED].u8.push_back(result != 0);
+            c[UCOL_DURATION].f32.push_back((float)(jsonNumber(l, "durationUs") / 1e6));
+            c[UCOL_THROUGHPUT].f32.push_back((float)jsonNumber(l, "throughputBps"));
+            c[UCOL_RETRIES].i32.push_back((int32_t)jsonNumber(l, "retries"));
+            c[UCOL_TIMEOUTS].i32.push_back((int32_t)jsonNumber(l, "timeouts"));
+            c[UCOL_FRAMING].i32.push_back((int32_t)jsonNumber(l, "framingErrors"));
+        }
+        offset += line.size();
+        if (line[line.size() - 1] == '\n')
+        {
+            *complete = offset;
+            *completeRows = table.rows();
+        }
+        line.clear();
+    }
+    return (ferror(f) != 0) ? TLM_ERR_IO : TLM_OK;
+}
+
+/**
+* @brief fileHead: hash (FNV-1a) of the first bytes of a file, to tell that it was not replaced
+*
+* @return false if the file is shorter
+*/
+static bool fileHead(FILE *f, uint32_t len, uint64_t *hash)
+{
+    uint8_t buf[QUERY_CACHE_HEAD];
+    if ((querySeek(f, 0) == false) || (fread(buf, 1, len, f) != len))    return false;
+
+    uint64_t h = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < len; i++)  h = (h ^ buf[i]) * 1099511628211ULL;
+    *hash = h;
+    return true;
+}
+
+/**
+* @brief cacheLoad: read the columns cached for a metrics file, when they still match its first
+*           bytes (the file is append only; once rotated or replaced, it is parsed again)
+*
+* @param cachePath: cache file
+* @param f:         metrics file
+* @param table:     receives the rows cached (the update columns, empty when the cache is not used)
+* @return The offset of the metrics file the rows cached end at, 0 if none
+*/
+static uint64_t cacheLoad(const std::string &cachePath, FILE *f, QueryTable &table)
+{
+    FILE *cache = fopen(cachePath.c_str(), "rb");
+    if (cache == NULL)  return 0;
+
+    QueryCacheHeader hdr;
+    uint64_t hash;
+    bool ok = (fread(&hdr, sizeof(hdr), 1, cache) == 1) && (hdr.magic == QUERY_CACHE_MAGIC) && (hdr.version == QUERY_CACHE_VERSION)
+        && (hdr.columns == table.columns.size()) && (hdr.headLen <= QUERY_CACHE_HEAD)
+        && fileHead(f, hdr.headLen, &hash) && (hash == hdr.headHash)
+        && (querySize(f) >= hdr.parsed);
+
+    for (size_t k = 0; ok && k < table.columns.size(); k++)
+    {
+        QueryColumn &col = table.columns[k];
+        uint32_t words;
+        ok = (fread(&words, sizeof(words), 1, cache) == 1);
+        for (uint32_t w = 0; ok && w < words; w++)
+        {
+            uint32_t len;
+            ok = (fread(&len, sizeof(len), 1, cache) == 1) && (len < QUERY_CACHE_MAX_TEXT);
+            std::string text(ok ? len : 0, '\0');
+            ok = ok && ((len == 0) || (fread(&text[0], 1, len, cache) == len));
+            if (ok)     col.code(text);
+        }
+        switch (col.storage)
+        {
+        case QUERY_U8:      col.u8.resize((size_t)hdr.rows);    ok = ok && (fread(col.u8.data(), 1, (size_t)hdr.rows, cache) == hdr.rows);    break;
+        case QUERY_I32:     col.i32.resize((size_t)hdr.rows);   ok = ok && (fread(col.i32.data(), 4, (size_t)hdr.rows, cache) == hdr.rows);   break;
+        case QUERY_I64:     col.i64.resize((size_t)hdr.rows);   ok = ok && (fread(col.i64.data(), 8, (size_t)hdr.rows, cache) == hdr.rows);   break;
+        default:            col.f32.resize((size_t)hdr.rows);   ok = ok && (fread(col.f32.data(), 4, (size_t)hdr.rows, cache) == hdr.rows);   break;
+        }
+    }
+    fclose(cache);
+
+    if (ok)     return hdr.parsed;
+    for (size_t k = 0; k < table.columns.size(); k++)
+    {
+        QueryColumn &col = table.columns[k];
+        col.u8.clear(), col.i32.clear(), col.i64.clear(), col.f32.clear(), col.dict.clear(), col.codes.clear();
+    }
+    return 0;
+}
+
+/**
+* @brief cacheSave: write the columns of the rows parsed from a metrics file (under a temporary
+*           name, then renamed). A cache that cannot be written is not an error: the next load
+*           parses the file again.
+*
+* @param rows:      rows of table to write (up to the last complete line)
+* @param parsed:    offset of the metrics file they end at
+*/
+static void cacheSave(const std::string &cachePath, FILE *f, const QueryTable &table, size_t rows, uint64_t parsed)
+{
+    QueryCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = QUERY_CACHE_MAGIC;
+    hdr.version = QUERY_CACHE_VERSION;
+    hdr.columns = (uint32_t)table.columns.size();
+    hdr.parsed = parsed;
+    hdr.rows = rows;
+    hdr.headLen = (uint32_t)std::min(parsed, (uint64_t)QUERY_CACHE_HEAD);
+    if (fileHead(f, hdr.headLen, &hdr.headHash) == false)   return;
+
+    std::string tmpPath = cachePath + ".tmp";
+    FILE *cache = fopen(tmpPath.c_str(), "wb");
+    if (cache == NULL)  return;
+
+    bool ok = (fwrite(&hdr, sizeof(hdr), 1, cache) == 1);
+    for (size_t k = 0; ok && k < table.columns.size(); k++)
+    {
+        const QueryColumn &col = table.columns[k];
+        uint32_t words = (uint32_t)col.dict.size();
+        ok = (fwrite(&words, sizeof(words), 1, cache) == 1);
+        for (uint32_t w = 0; ok && w < words; w++)
+        {
+            uint32_t len = (uint32_t)col.dict[w].size();
+            ok = (fwrite(&len, sizeof(len), 1, cache) == 1) && (fwrite(col.dict[w].data(), 1, len, cache) == len);
+        }
+        switch (col.storage)
+        {
+        case QUERY_U8:      ok = ok && (fwrite(col.u8.data(), 1, rows, cache) == rows);     break;
+        case QUERY_I32:     ok = ok && (fwrite(col.i32.data(), 4, rows, cache) == rows);    break;
+        case QUERY_I64:     ok = ok && (fwrite(col.i64.data(), 8, rows, cache) == rows);    break;
+        default:            ok = ok && (fwrite(col.f32.data(), 4, rows, cache) == rows);    break;
+        }
+    }
+    ok = (fclose(cache) == 0) && ok;
+
+    if (ok)
+    {
+        remove(cachePath.c_str());                  // rename() does not replace an existing file on Windows
+        ok = (rename(tmpPath.c_str(), cachePath.c_str()) == 0);
+    }
+    if (ok == false)    remove(tmpPath.c_str());
+}
+
+/**
+* @brief appendTable: append the rows of a table with the same columns, the text codes translated
+*/
+static void appendTable(QueryTable &table, QueryTable &rows)
+{
+    if (table.rows() == 0)
+    {
+        table.columns.swap(rows.columns);
+        return;
+    }
+    std::vector<int32_t> codes;
+    for (size_t k = 0; k < table.columns.size(); k++)
+    {
+        QueryColumn &dst = table.columns[k];
+        const QueryColumn &src = rows.columns[k];
+        switch (dst.storage)
+        {
+        case QUERY_U8:      dst.u8.insert(dst.u8.end(), src.u8.begin(), src.u8.end());      break;
+        case QUERY_I64:     dst.i64.insert(dst.i64.end(), src.i64.begin(), src.i64.end());  break;
+        case QUERY_F32:     dst.f32.insert(dst.f32.end(), src.f32.begin(), src.f32.end());  break;
+        default:
+            if (dst.kind != QUERY_TEXT)
+            {
+                dst.i32.insert(dst.i32.end(), src.i32.begin(), src.i32.end());
+                break;
+            }
+            codes.resize(src.dict.size());
+            for (size_t w = 0; w < src.dict.size(); w++)    codes[w] = dst.code(src.dict[w]);
+            for (size_t i = 0; i < src.i32.size(); i++)     dst.i32.push_back(codes[src.i32[i]]);
+            break;
+        }
+    }
+}
+
+int queryLoadUpdates(const char *path, QueryTable &table, bool cache)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)  return TLM_ERR_IO;
+
+    if (table.columns.empty())  updateColumns(table);
+    QueryTable rows;
+    updateColumns(rows);
+
+    // Rows cached by the previous loads, then the sessions appended since
+    std::string cachePath = std::string(path) + QUERY_CACHE_SUFFIX;
+    uint64_t parsed = cache ? cacheLoad(cachePath, f, rows) : 0;
+    size_t cachedRows = rows.rows();
+    uint64_t complete = parsed;
+    size_t completeRows = cachedRows;
+    int err = querySeek(f, parsed) ? parseUpdates(f, rows, &complete, &completeRows) : TLM_ERR_IO;
+    if (cache && (err == TLM_OK) && (completeRows > cachedRows))    cacheSave(cachePath, f, rows, completeRows, complete);
+    fclose(f);
+
+    if (err == TLM_OK)  appendTable(table, rows);
+    return err;
+}
+
+//------------------------------------------------------------------------------------------------
+// Query engine
+//------------------------------------------------------------------------------------------------
+
+// Query with its columns resolved
+struct QueryEngine::Plan
+{
+    struct Filter
+    {
+        const QueryColumn *col;
+        QueryOp op;
+        double real;            // Value compared to a float column
+        int64_t bound;          // Value compared to an integer column
+        bool none;              // No row can match
+        bool all;               // Every row matches
+    };
+    struct Group
+    {
+        const QueryColumn *col;
+        QueryBucket bucket;
+        int64_t base;           // Smallest key (dense groups)
+        uint64_t radix;         // Number of keys (dense groups)
+        uint64_t stride;        // Weight of the key in the group number (dense groups)
+    };
+    struct Aggregate
+    {
+        const QueryColumn *col; // NULL: count of the rows
+        QueryFunc func;
+    };
+
+    std::vector<Filter> filters;
+    std::vector<Group> groups;
+    std::vector<Aggregate> aggregates;
+    bool dense;                 // Groups numbered from their keys, otherwise hashed
+    size_t denseGroups;         // Number of group numbers (dense groups)
+};
+
+// Keys of a group (hashed groups)
+struct GroupKey
+{
+    int64_t k[QUERY_MAX_GROUPS];
+    bool operator==(const GroupKey &o) const    { return memcmp(k, o.k, sizeof(k)) == 0; }
+};
+
+struct GroupKeyHash
+{
+    size_t operator()(const GroupKey &key) const
+    {
+        uint64_t h = 1469598103934665603ULL;
+        for (int i = 0; i < QUERY_MAX_GROUPS; i++)  h = (h ^ (uint64_t)key.k[i]) * 1099511628211ULL;
+        return (size_t)(h ^ (h >> 29));
+    }
+};
+
+// Results of a worker
+struct QueryEngine::Partial
+{
+    std::vector<uint64_t> rows;         // Rows of each group
+    std::vector<double> acc;            // Sum, minimum or maximum: group * aggregates + aggregate
+    std::vector<uint64_t> count;        // Values accumulated (NaN skipped): group * aggregates + aggregate
+    std::unordered_map<GroupKey, uint32_t, GroupKeyHash> slots;    // Hashed groups: group numbers
+    std::vector<GroupKey> keys;         // Hashed groups: keys of each group number
+    uint64_t scanned;
+    uint64_t selected;
+
+    // Chunk in progress
+    std::vector<uint8_t> sel;           // Selection mask
+    std::vector<uint32_t> idx;          // Rows selected (in the chunk)
+    std::vector<uint32_t> slot;         // Their group numbers
+    std::vector<int64_t> key;           // Their keys: group * rows + row
+
+    Partial() : scanned(0), selected(0) {}
+
+    /**
+    * @brief addGroups: add groups, their aggregates set to their neutral value
+    *
+    * @param plan:      query
+    * @param groups:    number of groups to add
+    * @return None.
+    */
+    void addGroups(const Plan &plan, size_t groups)
+    {
+        size_t n = plan.aggregates.size();
+        size_t first = acc.size();
+        rows.resize(rows.size() + groups, 0);
+        count.resize(count.size() + groups * n, 0);
+        acc.resize(first + groups * n);
+        for (size_t i = first; i < acc.size(); i++)
+        {
+            QueryFunc f = plan.aggregates[(i - first) % n].func;
+            acc[i] = (f == QUERY_MIN) ? HUGE_VAL : (f == QUERY_MAX) ? -HUGE_VAL : 0.0;
+        }
+    }
+};
+
+/**
+* @brief filterInt: apply a comparison to an integer column. The values are widened to 64 bits
+*           so that the loops vectorize and the bound never overflows.
+*
+* @param v:         values of the chunk
+* @param n:         number of values
+* @param op:        comparison
+* @param b:         bound
+* @param sel:       selection mask, cleared where the comparison fails
+* @return None.
+*/
+template <typename T> static void filterInt(const T *v, size_t n, QueryOp op, int64_t b, uint8_t *sel)
+{
+    switch (op)
+    {
+    case QUERY_EQ:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] == b);   break;
+    case QUERY_NE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] != b);   break;
+    case QUERY_LT:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] < b);    break;
+    case QUERY_LE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] <= b);   break;
+    case QUERY_GT:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] > b);    break;
+    case QUERY_GE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((int64_t)v[i] >= b);   break;
+    }
+}
+
+/**
+* @brief filterReal: apply a comparison to a float column. No comparison matches a NaN.
+*/
+static void filterReal(const float *v, size_t n, QueryOp op, float x, uint8_t *sel)
+{
+    switch (op)
+    {
+    case QUERY_EQ:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)(v[i] == x);    break;
+    case QUERY_NE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)((v[i] < x) | (v[i] > x)); break;
+    case QUERY_LT:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)(v[i] < x);     break;
+    case QUERY_LE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)(v[i] <= x);    break;
+    case QUERY_GT:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)(v[i] > x);     break;
+    case QUERY_GE:  for (size_t i = 0; i < n; i++)  sel[i] &= (uint8_t)(v[i] >= x);    break;
+    }
+}
+
+/**
+* @brief aggregate: accumulate a column of the rows selected into their groups
+*
+* @param v:         values of the chunk
+* @param idx:       rows selected
+* @param slot:      their group numbers (NULL: all in group 0)
+* @param n:         number of rows selected
+* @param func:      aggregate
+* @param stride:    aggregates per group
+* @param acc:       accumulators of the aggregate (group 0)
+* @param count:     value counts of the aggregate (group 0)
+* @return None.
+*/
+template <typename T> static void aggregate(const T *v, const uint32_t *idx, const uint32_t *slot, size_t n,
+                                            QueryFunc func, size_t stride, double *acc, uint64_t *count)
+{
+    if (slot == NULL)
+    {
+        // Single group: accumulate in registers
+        double a = *acc;
+        uint64_t c = 0;
+        for (size_t j = 0; j < n; j++)
+        {
+            double x = (double)v[idx[j]];
+            if (x != x)     continue;
+            c++;
+            if (func == QUERY_MIN)          a = (x < a) ? x : a;
+            else if (func == QUERY_MAX)     a = (x > a) ? x : a;
+            else                            a += x;
+        }
+        *acc = a;
+        *count += c;
+        return;
+    }
+    for (size_t j = 0; j < n; j++)
+    {
+        double x = (double)v[idx[j]];
+        if (x != x)     continue;
+        size_t s = slot[j] * stride;
+        count[s]++;
+        if (func == QUERY_MIN)          acc[s] = std::min(acc[s], x);
+        else if (func == QUERY_MAX)     acc[s] = std::max(acc[s], x);
+        else                            acc[s] += x;
+    }
+}
+
+
+/**
+* @brief groupKeys: keys of a group column for the rows selected of a chunk
+*
+* @param col:       group column
+* @param bucket:    time bucket (time columns)
+* @param first:     first row of the chunk
+* @param idx:       rows selected
+* @param n:         number of rows selected
+* @param key:       receives the keys (floats: their bits)
+* @return None.
+*/
+static void groupKeys(const QueryColumn *col, QueryBucket bucket, size_t first, const uint32_t *idx, size_t n, int64_t *key)
+{
+    switch (col->storage)
+    {
+    case QUERY_U8:
+    {
+        const uint8_t *v = col->u8.data() + first;
+        for (size_t j = 0; j < n; j++)  key[j] = v[idx[j]];
+        break;
+    }
+    case QUERY_I32:
+    {
+        const int32_t *v = col->i32.data() + first;
+        for (size_t j = 0; j < n; j++)  key[j] = v[idx[j]];
+        break;
+    }
+    case QUERY_I64:
+    {
+        const int64_t *v = col->i64.data() + first;
+        if (bucket == QUERY_VALUE)      for (size_t j = 0; j < n; j++)  key[j] = v[idx[j]];
+        else if (bucket == QUERY_MONTH)
+        {
+            // The rows of a device are in time order: the month changes seldom from a row to the next
+            int64_t day = INT64_MIN, month = 0;
+            for (size_t j = 0; j < n; j++)
+            {
+                int64_t d = floorDiv(v[idx[j]], QUERY_MS_PER_DAY);
+                if (d != day)   day = d, month = bucketOf(v[idx[j]], QUERY_MONTH);
+                key[j] = month;
+            }
+        }
+        else
+        {
+            int64_t days = (bucket == QUERY_WEEK) ? 7 : 1;
+            int64_t shift = (bucket == QUERY_WEEK) ? 3 * QUERY_MS_PER_DAY : 0;
+            for (size_t j = 0; j < n; j++)  key[j] = floorDiv(v[idx[j]] + shift, days * QUERY_MS_PER_DAY);
+        }
+        break;
+    }
+    case QUERY_F32:
+    {
+        const float *v = col->f32.data() + first;
+        for (size_t j = 0; j < n; j++)
+        {
+            float x = v[idx[j]];
+            if (x == 0.0f)      x = 0.0f;           // -0 and 0 in the same group
+            else if (x != x)    x = std::numeric_limits<float>::quiet_NaN();    // One group for the NaN
+            int32_t bits;
+            memcpy(&bits, &x, sizeof(bits));
+            key[j] = bits;
+        }
+        break;
+    }
+    }
+}
+
+/**
+* @brief keyValue: value of a key, for sorting
+*
+* @param col:       group column
+* @param key:       key
+* @param rank:      alphabetical rank of the codes (text columns)
+* @return The value
+*/
+static double keyValue(const QueryColumn *col, int64_t key, const std::vector<uint32_t> &rank)
+{
+    if (col->kind == QUERY_TEXT)
+    {
+        return (key >= 0 && (size_t)key < rank.size()) ? (double)rank[(size_t)key] : -1.0;
+    }
+    if (col->storage == QUERY_F32)
+    {
+        int32_t bits = (int32_t)key;
+        float x;
+        memcpy(&x, &bits, sizeof(x));
+        return (x == x) ? x : HUGE_VAL;     // No value: last
+    }
+    return (double)key;
+}
+
+/**
+* @brief keyText: text of a key
+*/
+static std::string keyText(const QueryColumn *col, QueryBucket bucket, int64_t key)
+{
+    char text[32];
+    if (col->kind == QUERY_TEXT)
+    {
+        return (key >= 0 && (size_t)key < col->dict.size()) ? col->dict[(size_t)key] : std::string();
+    }
+    if (col->kind == QUERY_TIME)    return formatTime(key, bucket);
+    if (col->storage == QUERY_F32)
+    {
+        double x = keyValue(col, key, std::vector<uint32_t>());
+        if (x == HUGE_VAL)  return "-";
+        snprintf(text, sizeof(text), "%g", x);
+        return text;
+    }
+    snprintf(text, sizeof(text), "%lld", (long long)key);
+    return text;
+}
+
+/**
+* @brief keyRange: smallest and largest key of a group column over the whole table
+*
+* @return false if the column has no row
+*/
+static bool keyRange(const QueryColumn *col, QueryBucket bucket, int64_t *lo, int64_t *hi)
+{
+    if (col->size() == 0)   return false;
+    if (col->storage == QUERY_I32)
+    {
+        std::pair<std::vector<int32_t>::const_iterator, std::vector<int32_t>::const_iterator> mm
+            = std::minmax_element(col->i32.begin(), col->i32.end());
+        *lo = *mm.first;
+        *hi = *mm.second;
+        return true;
+    }
+    std::pair<std::vector<int64_t>::const_iterator, std::vector<int64_t>::const_iterator> mm
+        = std::minmax_element(col->i64.begin(), col->i64.end());
+    *lo = bucketOf(*mm.first, bucket);      // The buckets follow the time order
+    *hi = bucketOf(*mm.second, bucket);
+    return true;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param jobs:      worker threads (0: one per processor)
+* @return None.
+*/
+QueryEngine::QueryEngine(unsigned _jobs)
+: jobs(_jobs)
+, table(NULL)
+, plan(NULL)
+, nextChunk(0)
+{
+    if (jobs == 0)      jobs = std::thread::hardware_concurrency();
+    if (jobs == 0)      jobs = QUERY_DEFAULT_JOBS;
+}
+
+/**
+* @brief run: run a query. The columns are resolved first, then the chunks are scanned by the
+*           workers, then their partial results are merged, sorted and formatted.
+*
+* @param table:     table queried
+* @param spec:      query
+* @param result:    filled with the result
+* @return TLM_OK, TLM_ERR_INV_PARAM (see result->error)
+*/
+int QueryEngine::run(const QueryTable &_table, const QuerySpec &spec, QueryResult *result)
+{
+    Plan p;
+    char text[128];
+
+    result->header.clear();
+    result->rows.clear();
+    result->error.clear();
+    result->scanned = 0;
+    result->selected = 0;
+    result->groups = 0;
+
+    // Resolve the columns
+    if (spec.groups.size() > QUERY_MAX_GROUPS)
+    {
+        result->error = "too many group keys";
+        return TLM_ERR_INV_PARAM;
+    }
+    if (spec.aggregates.empty() || spec.orderBy >= (int)spec.aggregates.size())
+    {
+        result->error = spec.aggregates.empty() ? "no aggregate" : "order on an unknown aggregate";
+        return TLM_ERR_INV_PARAM;
+    }
+    for (size_t i = 0; i < spec.filters.size(); i++)
+    {
+        const QueryFilter &qf = spec.filters[i];
+        int c = _table.find(qf.column);
+        if (c < 0)
+        {
+            result->error = "unknown column " + qf.column;
+            return TLM_ERR_INV_PARAM;
+        }
+        Plan::Filter f;
+        f.col = &_table.columns[c];
+        f.op = qf.op;
+        f.none = false;
+        f.all = false;
+        f.bound = 0;
+
+        double x = 0.0;
+        int64_t ms;
+        if (f.col->kind == QUERY_TEXT)
+        {
+            if (f.op != QUERY_EQ && f.op != QUERY_NE)
+            {
+                result->error = "text column " + qf.column + " only compared with = or !=";
+                return TLM_ERR_INV_PARAM;
+            }
+            std::unordered_map<std::string, int32_t>::const_iterator it = f.col->codes.find(qf.value);
+            x = (it != f.col->codes.end()) ? it->second : -1.0;     // Unknown text: no code matches
+        }
+        else if (f.col->kind == QUERY_TIME && queryParseDate(qf.value.c_str(), &ms))
+        {
+            x = (double)ms;
+        }
+        else if (!parseNumber(qf.value, &x))
+        {
+            result->error = "invalid value " + qf.value + " for " + qf.column;
+            return TLM_ERR_INV_PARAM;
+        }
+
+        f.real = x;
+        if (f.col->storage != QUERY_F32)
+        {
+            // Integer column: the comparison with the nearest integer gives the same rows
+            x = std::max(-QUERY_INT_LIMIT, std::min(QUERY_INT_LIMIT, x));
+            bool integral = (floor(x) == x);
+            if (f.op == QUERY_EQ)           f.none = !integral;
+            else if (f.op == QUERY_NE)      f.all = !integral;
+            f.bound = (int64_t)(((f.op == QUERY_LT) || (f.op == QUERY_GE)) ? ceil(x) : floor(x));
+        }
+        if (!f.all)     p.filters.push_back(f);
+    }
+    p.dense = true;
+    p.denseGroups = 1;
+    for (size_t i = 0; i < spec.groups.size(); i++)
+    {
+        const QueryGroup &qg = spec.groups[i];
+        int c = _table.find(qg.column);
+        if (c < 0)
+        {
+            result->error = "unknown column " + qg.column;
+            return TLM_ERR_INV_PARAM;
+        }
+        Plan::Group g;
+        g.col = &_table.columns[c];
+        g.bucket = qg.bucket;
+        if (g.bucket != QUERY_VALUE && g.col->kind != QUERY_TIME)
+        {
+            result->error = std::string(bucketNames[g.bucket]) + " of " + qg.column + ", not a time column";
+            return TLM_ERR_INV_PARAM;
+        }
+
+        // Keys with a small domain: the groups are numbered from them
+        int64_t lo = 0, hi = -1;
+        if (g.col->kind == QUERY_TEXT)                      hi = (int64_t)g.col->dict.size() - 1;
+        else if (g.col->storage == QUERY_U8)                hi = 255;
+        else if (g.col->storage == QUERY_I32 || g.bucket != QUERY_VALUE)
+        {
+            if (!keyRange(g.col, g.bucket, &lo, &hi))       hi = lo;
+        }
+        else                                                p.dense = false;
+        g.base = lo;
+        g.radix = (hi >= lo) ? (uint64_t)(hi - lo) + 1 : 1;
+        g.stride = p.denseGroups;
+        if (p.dense && (hi - lo >= QUERY_DENSE_MAX || p.denseGroups * g.radix > QUERY_DENSE_MAX))   p.dense = false;
+        if (p.dense)    p.denseGroups *= g.radix;
+        p.groups.push_back(g);
+
+        snprintf(text, sizeof(text), (g.bucket == QUERY_VALUE) ? "%s%s" : "%s(%s)", bucketNames[g.bucket], qg.column.c_str());
+        result->header.push_back(text);
+    }
+    for (size_t i = 0; i < spec.aggregates.size(); i++)
+    {
+        const QueryAggregate &qa = spec.aggregates[i];
+        Plan::Aggregate a;
+        a.func = qa.func;
+        a.col = NULL;
+        if (!qa.column.empty())
+        {
+            int c = _table.find(qa.column);
+            if (c < 0)
+            {
+                result->error = "unknown column " + qa.column;
+                return TLM_ERR_INV_PARAM;
+            }
+            a.col = &_table.columns[c];
+            if (a.col->kind == QUERY_TEXT && a.func != QUERY_COUNT)
+            {
+                result->error = std::string(funcNames[a.func]) + " of text column " + qa.column;
+                return TLM_ERR_INV_PARAM;
+            }
+        }
+        else if (a.func != QUERY_COUNT)
+        {
+            result->error = std::string(funcNames[a.func]) + " without a column";
+            return TLM_ERR_INV_PARAM;
+        }
+        p.aggregates.push_back(a);
+
+        snprintf(text, sizeof(text), qa.column.empty() ? "%s" : "%s(%s)", funcNames[a.func], qa.column.c_str());
+        result->header.push_back(text);
+    }
+
+    // Scan
+    size_t chunks = (_table.rows() + QUERY_CHUNK_ROWS - 1) / QUERY_CHUNK_ROWS;
+    unsigned count = (unsigned)std::max((size_t)1, std::min((size_t)jobs, chunks));
+    std::vector<Partial> partials(count);
+    for (unsigned w = 0; w < count; w++)
+    {
+        if (p.dense)    partials[w].addGroups(p, p.denseGroups);
+    }
+    table = &_table;
+    plan = &p;
+    nextChunk = 0;
+
+    std::vector<std::thread> workers;
+    for (unsigned w = 0; w < count && chunks > 0; w++)  workers.push_back(std::thread(workerEntry, this, &partials[w]));
+    for (size_t w = 0; w < workers.size(); w++)     workers[w].join();
+    table = NULL;
+    plan = NULL;
+
+    // Merge the partial results in the first one
+    Partial &total = partials[0];
+    size_t na = p.aggregates.size();
+    for (unsigned w = 1; w < count; w++)
+    {
+        Partial &o = partials[w];
+        for (size_t s = 0; s < o.rows.size(); s++)
+        {
+            if (o.rows[s] == 0)     continue;
+
+            size_t t = s;
+            if (!p.dense)
+            {
+                std::pair<std::unordered_map<GroupKey, uint32_t, GroupKeyHash>::iterator, bool> ins
+                    = total.slots.insert(std::make_pair(o.keys[s], (uint32_t)total.rows.size()));
+                t = ins.first->second;
+                if (ins.second)
+                {
+                    total.keys.push_back(o.keys[s]);
+                    total.addGroups(p, 1);
+                }
+            }
+            total.rows[t] += o.rows[s];
+            for (size_t a = 0; a < na; a++)
+            {
+                double &acc = total.acc[t * na + a];
+                double x = o.acc[s * na + a];
+                if (p.aggregates[a].func == QUERY_MIN)          acc = std::min(acc, x);
+                else if (p.aggregates[a].func == QUERY_MAX)     acc = std::max(acc, x);
+                else                                            acc += x;
+                total.count[t * na + a] += o.count[s * na + a];
+            }
+        }
+        total.scanned += o.scanned;
+        total.selected += o.selected;
+    }
+    result->scanned = total.scanned;
+    result->selected = total.selected;
+
+    // Rows of the result, with their sort keys
+    std::vector<std::vector<uint32_t> > ranks(p.groups.size());
+    for (size_t g = 0; g < p.groups.size(); g++)
+    {
+        const std::vector<std::string> &dict = p.groups[g].col->dict;
+        std::vector<uint32_t> order(dict.size());
+        for (size_t i = 0; i < order.size(); i++)   order[i] = (uint32_t)i;
+        std::sort(order.begin(), order.end(), [&dict](uint32_t a, uint32_t b) { return dict[a] < dict[b]; });
+        ranks[g].resize(dict.size());
+        for (size_t i = 0; i < order.size(); i++)   ranks[g][order[i]] = (uint32_t)i;
+    }
+
+    struct Sorted
+    {
+        std::vector<double> keys;
+        double value;
+        size_t row;
+    };
+    std::vector<Sorted> sorted;
+    for (size_t s = 0; s < total.rows.size(); s++)
+    {
+        if (total.rows[s] == 0 && !p.groups.empty())    continue;     // Without group key: one row, even empty
+
+        QueryRow row;
+        Sorted order;
+        for (size_t g = 0; g < p.groups.size(); g++)
+        {
+            const Plan::Group &pg = p.groups[g];
+            int64_t key = p.dense ? pg.base + (int64_t)((s / pg.stride) % pg.radix) : total.keys[s].k[g];
+            row.keys.push_back(keyText(pg.col, pg.bucket, key));
+            order.keys.push_back(keyValue(pg.col, key, ranks[g]));
+        }
+        for (size_t a = 0; a < na; a++)
+        {
+            const Plan::Aggregate &pa = p.aggregates[a];
+            double acc = total.acc[s * na + a];
+            uint64_t n = (pa.col == NULL) ? total.rows[s] : total.count[s * na + a];
+            double v;
+            if (pa.func == QUERY_COUNT)     v = (double)n;
+            else if (n == 0)                v = std::numeric_limits<double>::quiet_NaN();
+            else if (pa.func == QUERY_AVG)  v = acc / (double)n;
+            else                            v = acc;
+            row.values.push_back(v);
+        }
+        order.value = (spec.orderBy >= 0) ? row.values[spec.orderBy] : 0.0;
+        order.row = result->rows.size();
+        result->rows.push_back(row);
+        sorted.push_back(order);
+    }
+    result->groups = (uint32_t)sorted.size();
+
+    bool byValue = spec.orderBy >= 0;
+    bool desc = spec.descending;
+    std::sort(sorted.begin(), sorted.end(), [byValue, desc](const Sorted &a, const Sorted &b)
+    {
+        if (byValue && !(a.value == b.value || (a.value != a.value && b.value != b.value)))
+        {
+            if (a.value != a.value)     return false;       // No value: last
+            if (b.value != b.value)     return true;
+            return desc ? (a.value > b.value) : (a.value < b.value);
+        }
+        return (byValue || !desc) ? (a.keys < b.keys) : (b.keys < a.keys);
+    });
+    size_t kept = (spec.limit > 0) ? std::min(spec.limit, sorted.size()) : sorted.size();
+    std::vector<QueryRow> rows(kept);
+    for (size_t i = 0; i < kept; i++)   std::swap(rows[i], result->rows[sorted[i].row]);
+    result->rows.swap(rows);
+    return TLM_OK;
+}
+
+/**
+* @brief workerEntry: worker thread entry point
+*
+* @param self:      engine
+* @param partial:   results of the worker
+* @return None.
+*/
+void QueryEngine::workerEntry(QueryEngine *self, Partial *partial)
+{
+    self->workerFunc(partial);
+}
+
+/**
+* @brief workerFunc: scan chunks until none is left
+*
+* @param partial:   results of the worker
+* @return None.
+*/
+void QueryEngine::workerFunc(Partial *partial)
+{
+    size_t rows = table->rows();
+    size_t c;
+
+    partial->sel.resize(QUERY_CHUNK_ROWS);
+    partial->idx.resize(QUERY_CHUNK_ROWS);
+    partial->slot.resize(QUERY_CHUNK_ROWS);
+    partial->key.resize((size_t)QUERY_CHUNK_ROWS * QUERY_MAX_GROUPS);
+    while ((c = nextChunk++) * QUERY_CHUNK_ROWS < rows)
+    {
+        size_t first = c * QUERY_CHUNK_ROWS;
+        scanChunk(first, std::min((size_t)QUERY_CHUNK_ROWS, rows - first), partial);
+    }
+}
+
+/**
+* @brief scanChunk: filter, group and aggregate a chunk of rows, one column at a time
+*
+* @param first:     first row
+* @param count:     number of rows
+* @param partial:   results of the worker
+* @return None.
+*/
+void QueryEngine::scanChunk(size_t first, size_t count, Partial *partial)
+{
+    const Plan &p = *plan;
+    uint8_t *sel = partial->sel.data();
+    uint32_t *idx = partial->idx.data();
+    uint32_t *slot = partial->slot.data();
+    int64_t *key = partial->key.data();
+
+    // Filters: one pass per column over the whole chunk
+    memset(sel, 1, count);
+    for (size_t i = 0; i < p.filters.size(); i++)
+    {
+        const Plan::Filter &f = p.filters[i];
+        if (f.none)
+        {
+            memset(sel, 0, count);
+            break;
+        }
+        switch (f.col->storage)
+        {
+        case QUERY_U8:  filterInt(f.col->u8.data() + first, count, f.op, f.bound, sel);     break;
+        case QUERY_I32: filterInt(f.col->i32.data() + first, count, f.op, f.bound, sel);    break;
+        case QUERY_I64: filterInt(f.col->i64.data() + first, count, f.op, f.bound, sel);    break;
+        case QUERY_F32: filterReal(f.col->f32.data() + first, count, f.op, (float)f.real, sel); break;
+        }
+    }
+
+    // Rows selected (without a branch per row)
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        idx[n] = (uint32_t)i;
+        n += sel[i];
+    }
+    partial->scanned += count;
+    partial->selected += n;
+    if (n == 0)     return;
+
+    // Group numbers
+    size_t ng = p.groups.size();
+    for (size_t g = 0; g < ng; g++)     groupKeys(p.groups[g].col, p.groups[g].bucket, first, idx, n, key + g * n);
+    if (ng == 0)
+    {
+        partial->rows[0] += n;
+    }
+    else if (p.dense)
+    {
+        memset(slot, 0, n * sizeof(uint32_t));
+        for (size_t g = 0; g < ng; g++)
+        {
+            const int64_t *k = key + g * n;
+            int64_t base = p.groups[g].base;
+            uint32_t stride = (uint32_t)p.groups[g].stride;
+            for (size_t j = 0; j < n; j++)  slot[j] += (uint32_t)(k[j] - base) * stride;
+        }
+        for (size_t j = 0; j < n; j++)      partial->rows[slot[j]]++;
+    }
+    else
+    {
+        GroupKey gk;
+        memset(&gk, 0, sizeof(gk));
+        for (size_t j = 0; j < n; j++)
+        {
+            for (size_t g = 0; g < ng; g++)     gk.k[g] = key[g * n + j];
+            std::pair<std::unordered_map<GroupKey, uint32_t, GroupKeyHash>::iterator, bool> ins
+                = partial->slots.insert(std::make_pair(gk, (uint32_t)partial->rows.size()));
+            if (ins.second)
+            {
+                partial->keys.push_back(gk);
+                partial->addGroups(p, 1);
+            }
+            slot[j] = ins.first->second;
+            partial->rows[slot[j]]++;
+        }
+    }
+
+    // Aggregates: one pass per column over the rows selected
+    size_t na = p.aggregates.size();
+    const uint32_t *slots = (ng == 0) ? NULL : slot;
+    for (size_t a = 0; a < na; a++)
+    {
+        const Plan::Aggregate &pa = p.aggregates[a];
+        if (pa.col == NULL)     continue;       // Count of the rows
+
+        double *acc = partial->acc.data() + a;
+        uint64_t *cnt = partial->count.data() + a;
+        switch (pa.col->storage)
+        {
+        case QUERY_U8:  aggregate(pa.col->u8.data() + first, idx, slots, n, pa.func, na, acc, cnt);     break;
+        case QUERY_I32: aggregate(pa.col->i32.data() + first, idx, slots, n, pa.func, na, acc, cnt);    break;
+        case QUERY_I64: aggregate(pa.col->i64.data() + first, idx, slots, n, pa.func, na, acc, cnt);    break;
+        case QUERY_F32: aggregate(pa.col->f32.data() + first, idx, slots, n, pa.func, na, acc, cnt);    break;
+        }
+    }
+}
@@ -0,0 +1,258 @@
+/*
+* FleetQuery.h : This file contains a small query engine over the battery telemetry and the
+*               history of the firmware updates of the fleet (filter, group by, aggregate).
+*
+*   In a nutshell, this file implements:
+*       - QueryTable: a table held column by column, each column in the smallest type that
+*           holds it (u8, i32, i64 or float); the text columns hold a code per row and their
+*           dictionary
+*       - the loaders of the two tables:
+*           - telemetry: the samples of a TelemetryStore, scanned in parallel column by column,
+*               plus "rate": the SOC change since the previous sample of the device (% per hour,
+*               negative while discharging), empty (NaN) when the charging state changed or the
+*               log has a gap
+*           - updates: the update sessions appended by the updater to TT_AMI_Updater_metrics.jsonl
+*               (one JSON line per session, see ProtocolMetrics). The columns parsed are cached
+*               next to the file, so that only the sessions appended since are parsed again.
+*       - QuerySpec: the filters (column op value, all of them must match), the group keys
+*           (a column, or the day, week or month of a time column) and the aggregates
+*           (count, sum, avg, min, max), parsed from text by queryParseFilter...
+*       - QueryEngine: the rows cut in chunks shared by worker threads. On a chunk, each filter
+*           is one pass over its column into a selection mask (a loop the compiler vectorizes),
+*           then the rows selected get their group number, then each aggregate is one pass over
+*           its column. When the keys have a small domain (codes, days...), the groups are an
+*           array indexed by the key, otherwise a hash map. The partial results of the workers
+*           are merged at the end.
+*
+*   Every function returns TLM_OK or a negative TLM_ERR_xxx code (see TelemetryTypes.h).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _FLEETQUERY_H
+#define _FLEETQUERY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "TelemetryTypes.h"
+
+#define QUERY_MAX_GROUPS        4           // Group keys of a query
+#define QUERY_CHUNK_ROWS        65536       // Rows handed to a worker at once
+#define QUERY_DENSE_MAX         (1 << 18)   // Groups held in an array up to that many keys
+#define QUERY_RATE_GAP_MS       (2 * 3600 * 1000)   // Samples further apart: no rate
+
+class TelemetryStore;
+
+typedef enum
+{
+    QUERY_U8,                   // uint8_t
+    QUERY_I32,                  // int32_t
+    QUERY_I64,                  // int64_t
+    QUERY_F32                   // float, NaN: no value
+} QueryStorage;
+
+typedef enum
+{
+    QUERY_NUMBER,               // Printed as is
+    QUERY_TEXT,                 // Code in the dictionary of the column
+    QUERY_TIME                  // ms since 1970-01-01 UTC, printed as a date
+} QueryKind;
+
+typedef struct QueryColumn
+{
+    std::string name;
+    QueryStorage storage;
+    QueryKind kind;
+    std::vector<uint8_t> u8;
+    std::vector<int32_t> i32;
+    std::vector<int64_t> i64;
+    std::vector<float> f32;
+    std::vector<std::string> dict;  // Values of a text column, indexed by the codes
+    std::unordered_map<std::string, int32_t> codes;    // Codes of the values of a text column
+
+    /**
+    * @brief code: code of a text value, added to the dictionary when new (text columns)
+    */
+    int32_t code(const std::string &text);
+
+    size_t size(void) const;
+} QueryColumn;
+
+class QueryTable
+{
+public:
+    /**
+    * @brief addColumn: add an empty column
+    *
+    * @param name:      column name
+    * @param storage:   type of the values
+    * @param kind:      meaning of the values
+    * @return The column (valid until the next addColumn)
+    */
+    QueryColumn &addColumn(const char *name, QueryStorage storage, QueryKind kind = QUERY_NUMBER);
+
+    /**
+    * @brief find: column of a name
+    *
+    * @return The column number, -1 if none
+    */
+    int find(const std::string &name) const;
+
+    size_t rows(void) const                                             { return columns.empty() ? 0 : columns[0].size(); }
+    void clear(void)                                                    { columns.clear(); }
+
+    std::vector<QueryColumn> columns;
+};
+
+typedef enum { QUERY_EQ, QUERY_NE, QUERY_LT, QUERY_LE, QUERY_GT, QUERY_GE } QueryOp;
+typedef enum { QUERY_COUNT, QUERY_SUM, QUERY_AVG, QUERY_MIN, QUERY_MAX } QueryFunc;
+typedef enum { QUERY_VALUE, QUERY_DAY, QUERY_WEEK, QUERY_MONTH } QueryBucket;
+
+typedef struct
+{
+    std::string column;
+    QueryOp op;
+    std::string value;          // Number, text (text columns) or date (time columns)
+} QueryFilter;
+
+typedef struct
+{
+    std::string column;
+    QueryBucket bucket;         // Time columns: day, week (starting on Monday) or month
+} QueryGroup;
+
+typedef struct
+{
+    QueryFunc func;
+    std::string column;         // Empty for count
+} QueryAggregate;
+
+typedef struct QuerySpec
+{
+    std::vector<QueryFilter> filters;
+    std::vector<QueryGroup> groups;
+    std::vector<QueryAggregate> aggregates;
+    int orderBy;                // Aggregate the rows are sorted on, -1: group keys
+    bool descending;
+    size_t limit;               // Rows returned, 0: all
+
+    QuerySpec() : orderBy(-1), descending(false), limit(0) {}
+} QuerySpec;
+
+typedef struct
+{
+    std::vector<std::string> keys;      // Group keys, as text
+    std::vector<double> values;         // Aggregates (NaN: no value)
+} QueryRow;
+
+typedef struct
+{
+    std::vector<std::string> header;    // Group columns then aggregates
+    std::vector<QueryRow> rows;
+    std::string error;                  // Why the query was refused
+    uint64_t scanned;                   // Rows scanned
+    uint64_t selected;                  // Rows matching the filters
+    uint32_t groups;                    // Groups before the limit
+} QueryResult;
+
+/**
+* @brief queryParseFilter: parse "column<op>value", op one of = != < <= > >=
+*
+* @return false if the text is not a filter
+*/
+bool queryParseFilter(const char *text, QueryFilter *filter);
+
+/**
+* @brief queryParseGroup: parse "column", "day(column)", "week(column)" or "month(column)"
+*
+* @return false if the text is not a group key
+*/
+bool queryParseGroup(const char *text, QueryGroup *group);
+
+/**
+* @brief queryParseAggregate: parse "count", "sum(column)", "avg(column)", "min(column)" or "max(column)"
+*
+* @return false if the text is not an aggregate
+*/
+bool queryParseAggregate(const char *text, QueryAggregate *aggregate);
+
+/**
+* @brief queryParseDate: parse "YYYY-MM-DD" or "YYYY-MM-DD hh:mm[:ss]" (UTC)
+*
+* @param text:      date
+* @param ms:        receives the ms since the epoch
+* @return false if the text is not a date
+*/
+bool queryParseDate(const char *text, int64_t *ms);
+
+/**
+* @brief queryLoadTelemetry: load the samples of a store: columns serial, firmware, time, soc,
+*           voltage, charging and rate. soc is 255 when the reading failed (filter soc<=100).
+*
+* @param store:     opened store
+* @param from:      first timestamp included (ms since epoch)
+* @param to:        last timestamp included (ms since epoch)
+* @param jobs:      devices scanned at once (0: one per processor)
+* @param table:     filled with the samples, by device then time
+* @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+*/
+int queryLoadTelemetry(TelemetryStore &store, int64_t from, int64_t to, unsigned jobs, QueryTable &table);
+
+/**
+* @brief queryLoadUpdates: load update sessions from a metrics file: columns device, package,
+*           time, result, failed, duration (s), throughput (bytes/s), retries, timeouts,
+*           framingErrors. The rows are appended, so that many files can be loaded.
+*           The columns parsed are cached next to the file (<path>.cols): the next loads read
+*           them and only parse the sessions appended since. The file is parsed again when it was
+*           replaced (its first bytes differ) or when the cache cannot be read.
+*
+* @param path:      metrics file (JSON lines)
+* @param table:     receives the sessions (columns created when empty)
+* @param cache:     use and update the cache of the parsed columns
+* @return TLM_OK, TLM_ERR_IO
+*/
+int queryLoadUpdates(const char *path, QueryTable &table, bool cache = true);
+
+class QueryEngine
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param jobs:      worker threads (0: one per processor)
+    * @return None.
+    */
+    QueryEngine(unsigned jobs = 0);
+
+    /**
+    * @brief run: run a query
+    *
+    * @param table:     table queried
+    * @param spec:      query
+    * @param result:    filled with the result
+    * @return TLM_OK, TLM_ERR_INV_PARAM (unknown column, aggregate of a text column...: see result->error)
+    */
+    int run(const QueryTable &table, const QuerySpec &spec, QueryResult *result);
+
+    unsigned jobCount(void) const                                       { return jobs; }
+
+private:
+    struct Plan;
+    struct Partial;
+
+    static void workerEntry(QueryEngine *self, Partial *partial);
+    void workerFunc(Partial *partial);
+    void scanChunk(size_t first, size_t count, Partial *partial);
+
+    unsigned jobs;                      // Worker threads
+
+    // Query in progress
+    const QueryTable *table;            // Table queried
+    const Plan *plan;                   // Columns resolved
+    std::atomic<size_t> nextChunk;      // Next chunk to scan
+};
+
+#endif // _FLEETQUERY_H
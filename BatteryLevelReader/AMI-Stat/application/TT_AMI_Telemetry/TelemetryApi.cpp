@@ -0,0 +1,119 @@
+/*
+* TelemetryApi.cpp : C interface of the telemetry store (TT_AMI_Telemetry.dll)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include <vector>
+#include "TelemetryApi.h"
+#include "TelemetryStore.h"
+#include "BatteryHealth.h"
+#include "BatteryAnomaly.h"
+
+TLM_ENTRY(int) TLM_Open(const char *dir, uint32_t maxSegmentBytes, uint32_t blockSamples, TLM_HANDLE *handle)
+{
+    if ((dir == NULL) || (handle == NULL))  return TLM_ERR_INV_PARAM;
+
+    TelemetryStore *store = new TelemetryStore();
+    int err = store->open(dir, (maxSegmentBytes != 0) ? maxSegmentBytes : TLM_DEFAULT_SEGMENT_BYTES,
+                               (blockSamples != 0) ? blockSamples : TLM_DEFAULT_BLOCK_SAMPLES);
+    if (err != TLM_OK)
+    {
+        delete store;
+        store = NULL;
+    }
+    *handle = store;
+    return err;
+}
+
+TLM_ENTRY(int) TLM_Close(TLM_HANDLE handle)
+{
+    if (handle == NULL)                     return TLM_ERR_INV_PARAM;
+
+    delete static_cast<TelemetryStore *>(handle);       // dtor flushes
+    return TLM_OK;
+}
+
+TLM_ENTRY(int) TLM_Append(TLM_HANDLE handle, const TelemetrySample *sample)
+{
+    if ((handle == NULL) || (sample == NULL))   return TLM_ERR_INV_PARAM;
+
+    return static_cast<TelemetryStore *>(handle)->append(*sample);
+}
+
+TLM_ENTRY(int) TLM_Flush(TLM_HANDLE handle)
+{
+    if (handle == NULL)                     return TLM_ERR_INV_PARAM;
+
+    return static_cast<TelemetryStore *>(handle)->flush();
+}
+
+TLM_ENTRY(int) TLM_Query(TLM_HANDLE handle, const char *serial, int64_t from, int64_t to, TelemetrySample *buf, uint32_t maxCount, uint32_t *found)
+{
+    if ((handle == NULL) || (found == NULL) || ((buf == NULL) && (maxCount != 0)))  return TLM_ERR_INV_PARAM;
+
+    std::vector<TelemetrySample> results;
+    int err = static_cast<TelemetryStore *>(handle)->query(serial, from, to, results);
+
+    *found = (uint32_t)results.size();
+    size_t n = (results.size() < maxCount) ? results.size() : maxCount;
+    if (n != 0)                             memcpy(buf, results.data(), n * sizeof(TelemetrySample));
+
+    if ((err == TLM_OK) && (results.size() > maxCount))     err = TLM_ERR_BUFSHORT;
+    return err;
+}
+
+TLM_ENTRY(int) TLM_SampleCount(TLM_HANDLE handle, uint64_t *count)
+{
+    if ((handle == NULL) || (count == NULL))    return TLM_ERR_INV_PARAM;
+
+    *count = static_cast<TelemetryStore *>(handle)->sampleCount();
+    return TLM_OK;
+}
+
+TLM_ENTRY(int) TLM_BatteryHealth(TLM_HANDLE handle, int64_t from, int64_t to, BatteryHealth *buf, uint32_t maxCount, uint32_t *found)
+{
+    if ((handle == NULL) || (found == NULL) || ((buf == NULL) && (maxCount != 0)))  return TLM_ERR_INV_PARAM;
+
+    std::vector<BatteryHealth> results;
+    BatteryFleetHealth fleet;
+    int err = fleet.analyze(*static_cast<TelemetryStore *>(handle), from, to, results);
+
+    *found = (uint32_t)results.size();
+    size_t n = (results.size() < maxCount) ? results.size() : maxCount;
+    if (n != 0)                             memcpy(buf, results.data(), n * sizeof(BatteryHealth));
+
+    if ((err == TLM_OK) && (results.size() > maxCount))     err = TLM_ERR_BUFSHORT;
+    return err;
+}
+
+TLM_ENTRY(int) TLM_AnomalyOpen(TLM_HANDLE *monitor)
+{
+    if (monitor == NULL)                    return TLM_ERR_INV_PARAM;
+
+    *monitor = new BatteryAnomalyMonitor();
+    return TLM_OK;
+}
+
+TLM_ENTRY(int) TLM_AnomalyClose(TLM_HANDLE monitor)
+{
+    if (monitor == NULL)                    return TLM_ERR_INV_PARAM;
+
+    delete static_cast<BatteryAnomalyMonitor *>(monitor);
+    return TLM_OK;
+}
+
+TLM_ENTRY(int) TLM_AnomalyFeed(TLM_HANDLE monitor, const TelemetrySample *sample, BatteryAnomaly *buf, uint32_t maxCount, uint32_t *found)
+{
+    if ((monitor == NULL) || (sample == NULL) || (found == NULL) || ((buf == NULL) && (maxCount != 0)))    return TLM_ERR_INV_PARAM;
+
+    BatteryAnomaly events[ANOMALY_MAX_EVENTS];
+    uint32_t n = (uint32_t)static_cast<BatteryAnomalyMonitor *>(monitor)->feed(*sample, events);
+
+    *found = n;
+    if (n > maxCount)                       n = maxCount;
+    if (n != 0)                             memcpy(buf, events, n * sizeof(BatteryAnomaly));
+
+    return (*found > maxCount) ? TLM_ERR_BUFSHORT : TLM_OK;
+}
@@ -0,0 +1,111 @@
+/*
+* TelemetryApi.h : C interface of the telemetry store (TT_AMI_Telemetry.dll)
+*
+*   Same conventions as the AMI SDK: __stdcall entries with C linkage, so that AMIStat (C#,
+*   through P/Invoke) and any other front-end can use the store.
+*   Every function returns TLM_OK or a negative TLM_ERR_xxx code (see TelemetryTypes.h).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TELEMETRYAPI_H
+#define _TELEMETRYAPI_H
+
+#include "TelemetryTypes.h"
+
+#if defined(_WIN32)
+    #ifdef TELEMETRY_EXPORTS
+        #define TLM_DEC_SPEC    __declspec(dllexport)
+    #else
+        #define TLM_DEC_SPEC    __declspec(dllimport)
+    #endif
+    #define TLM_CALL            __stdcall
+#else
+    #define TLM_DEC_SPEC        __attribute__((visibility("default")))
+    #define TLM_CALL
+#endif
+
+#ifdef __cplusplus
+    #define TLM_ENTRY(RET)      extern "C" TLM_DEC_SPEC RET TLM_CALL
+#else
+    #define TLM_ENTRY(RET)      TLM_DEC_SPEC RET TLM_CALL
+#endif
+
+typedef void * TLM_HANDLE;
+
+/**
+* @brief TLM_Open: open (or create) a store in an existing directory
+*
+* @param dir:               directory holding the segment files (ANSI code page, as fopen)
+* @param maxSegmentBytes:   segment rotation size, 0 for the default
+* @param blockSamples:      samples buffered per device before being written, 0 for the default
+* @param handle:            filled with the store handle
+*/
+TLM_ENTRY(int) TLM_Open(const char *dir, uint32_t maxSegmentBytes, uint32_t blockSamples, TLM_HANDLE *handle);
+
+/**
+* @brief TLM_Close: flush and close a store. The handle is invalid afterward.
+*/
+TLM_ENTRY(int) TLM_Close(TLM_HANDLE handle);
+
+/**
+* @brief TLM_Append: add one sample (buffered)
+*/
+TLM_ENTRY(int) TLM_Append(TLM_HANDLE handle, const TelemetrySample *sample);
+
+/**
+* @brief TLM_Flush: write the buffered samples to disk
+*/
+TLM_ENTRY(int) TLM_Flush(TLM_HANDLE handle);
+
+/**
+* @brief TLM_Query: extract the samples of a device (serial NULL or "" for all) in [from, to]
+*
+* @param buf:       filled with up to maxCount samples, sorted by timestamp
+* @param maxCount:  capacity of buf (0 to only count)
+* @param found:     filled with the number of samples matching. TLM_ERR_BUFSHORT is returned
+*                   when it is above maxCount.
+*/
+TLM_ENTRY(int) TLM_Query(TLM_HANDLE handle, const char *serial, int64_t from, int64_t to, TelemetrySample *buf, uint32_t maxCount, uint32_t *found);
+
+/**
+* @brief TLM_SampleCount: number of samples in the store
+*/
+TLM_ENTRY(int) TLM_SampleCount(TLM_HANDLE handle, uint64_t *count);
+
+/**
+* @brief TLM_BatteryHealth: estimate the battery health of every device from its samples in
+*           [from, to] (capacity, internal resistance, trends), ranked against the fleet
+*
+* @param buf:       filled with up to maxCount reports, sorted by serial number
+* @param maxCount:  capacity of buf (0 to only count)
+* @param found:     filled with the number of devices. TLM_ERR_BUFSHORT is returned when it is
+*                   above maxCount.
+*/
+TLM_ENTRY(int) TLM_BatteryHealth(TLM_HANDLE handle, int64_t from, int64_t to, BatteryHealth *buf, uint32_t maxCount, uint32_t *found);
+
+/**
+* @brief TLM_AnomalyOpen: create a live anomaly detection (voltage sag, SOC jump, charge stall,
+*           sensor glitch), fed with the samples of the devices as they are received
+*
+* @param monitor:   filled with the detection handle
+*/
+TLM_ENTRY(int) TLM_AnomalyOpen(TLM_HANDLE *monitor);
+
+/**
+* @brief TLM_AnomalyClose: release a detection. The handle is invalid afterward.
+*/
+TLM_ENTRY(int) TLM_AnomalyClose(TLM_HANDLE monitor);
+
+/**
+* @brief TLM_AnomalyFeed: feed one sample to the detection of its device (thread safe; the
+*           samples of a device in time order). Takes constant time and memory per device.
+*
+* @param buf:       filled with up to maxCount anomalies raised by the sample
+* @param maxCount:  capacity of buf (ANOMALY_MAX_EVENTS is always enough)
+* @param found:     filled with the number of anomalies raised. TLM_ERR_BUFSHORT is returned
+*                   when it is above maxCount.
+*/
+TLM_ENTRY(int) TLM_AnomalyFeed(TLM_HANDLE monitor, const TelemetrySample *sample, BatteryAnomaly *buf, uint32_t maxCount, uint32_t *found);
+
+#endif // _TELEMETRYAPI_H
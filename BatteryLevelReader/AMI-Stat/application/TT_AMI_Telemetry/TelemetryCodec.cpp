@@ -0,0 +1,149 @@
+/*
+* TelemetryCodec.cpp : Column codecs used by the telemetry store segments
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "TelemetryCodec.h"
+
+/**
+* @brief encodeDelta: first value followed by the differences, zigzag varint encoded.
+*           SOC and voltage move by a few units between samples: 1 byte per value.
+*
+* @param w:         writer to append to
+* @param values:    values to encode
+* @param count:     number of values
+* @return None.
+*/
+void encodeDelta(ByteWriter &w, const int64_t *values, size_t count)
+{
+    int64_t prev = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        w.svarint(values[i] - prev);
+        prev = values[i];
+    }
+}
+
+/**
+* @brief decodeDelta: reverse of encodeDelta
+*
+* @param r:         reader positioned on the column
+* @param values:    filled with count values
+* @param count:     number of values to decode
+* @return false if the column is malformed
+*/
+bool decodeDelta(ByteReader &r, int64_t *values, size_t count)
+{
+    int64_t prev = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        prev += r.svarint();
+        values[i] = prev;
+    }
+    return !r.failed();
+}
+
+/**
+* @brief encodeDeltaOfDelta: first value, first delta, then the change of delta.
+*           Samples taken at a fixed period encode in 1 byte each (0 most of the time).
+*
+* @param w:         writer to append to
+* @param values:    values to encode
+* @param count:     number of values
+* @return None.
+*/
+void encodeDeltaOfDelta(ByteWriter &w, const int64_t *values, size_t count)
+{
+    int64_t prev = 0;
+    int64_t prevDelta = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int64_t delta = values[i] - prev;
+        w.svarint(delta - prevDelta);
+        prevDelta = delta;
+        prev = values[i];
+    }
+}
+
+/**
+* @brief decodeDeltaOfDelta: reverse of encodeDeltaOfDelta
+*
+* @param r:         reader positioned on the column
+* @param values:    filled with count values
+* @param count:     number of values to decode
+* @return false if the column is malformed
+*/
+bool decodeDeltaOfDelta(ByteReader &r, int64_t *values, size_t count)
+{
+    int64_t prev = 0;
+    int64_t delta = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        delta += r.svarint();
+        prev += delta;
+        values[i] = prev;
+    }
+    return !r.failed();
+}
+
+/**
+* @brief encodeRunLength: (value, run length) pairs. Categorical columns barely change
+*           within a block, so a whole block usually costs 2 to 4 bytes per column.
+*
+* @param w:         writer to append to
+* @param values:    values to encode
+* @param count:     number of values
+* @return None.
+*/
+void encodeRunLength(ByteWriter &w, const uint32_t *values, size_t count)
+{
+    size_t i = 0;
+    while (i < count)
+    {
+        size_t run = 1;
+        while ((i + run < count) && (values[i + run] == values[i]))     run++;
+        w.varint(values[i]);
+        w.varint(run);
+        i += run;
+    }
+}
+
+/**
+* @brief decodeRunLength: reverse of encodeRunLength
+*
+* @param r:         reader positioned on the column
+* @param values:    filled with count values
+* @param count:     number of values to decode
+* @return false if the column is malformed
+*/
+bool decodeRunLength(ByteReader &r, uint32_t *values, size_t count)
+{
+    size_t i = 0;
+    while ((i < count) && !r.failed())
+    {
+        uint32_t value = (uint32_t)r.varint();
+        uint64_t run = r.varint();
+        if ((run == 0) || (run > count - i))    return false;
+        for (uint64_t j = 0; j < run; j++)      values[i++] = value;
+    }
+    return !r.failed() && (i == count);
+}
+
+/**
+* @brief fnv1a: 32 bits FNV-1a hash
+*
+* @param data:      bytes to hash
+* @param len:       number of bytes
+* @return the hash
+*/
+uint32_t fnv1a(const uint8_t *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,129 @@
+/*
+* TelemetryCodec.h : Byte level encoding helpers used by the telemetry store segments
+*
+*   In a nutshell, this file implements:
+*       - ByteWriter: appends little endian integers, LEB128 varints and strings to a buffer
+*       - ByteReader: reads them back, with bound checks (a truncated block never reads out of range)
+*       - the column codecs:
+*           - delta:            first value then differences, zigzag varint encoded
+*           - delta of delta:   used for timestamps sampled at a regular period (mostly 1 byte per sample)
+*           - run length:       used for categorical columns (charging, firmware, event)
+*       - a FNV-1a hash used as block checksum
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TELEMETRYCODEC_H
+#define _TELEMETRYCODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class ByteWriter
+{
+public:
+    ByteWriter(std::vector<uint8_t> &_buf) : buf(_buf) {}
+
+    void u8(uint8_t v)                  { buf.push_back(v); }
+    void u16(uint16_t v)                { u8((uint8_t)v); u8((uint8_t)(v >> 8)); }
+    void u32(uint32_t v)                { u16((uint16_t)v); u16((uint16_t)(v >> 16)); }
+    void u64(uint64_t v)                { u32((uint32_t)v); u32((uint32_t)(v >> 32)); }
+    void bytes(const void *p, size_t n) { buf.insert(buf.end(), (const uint8_t *)p, (const uint8_t *)p + n); }
+
+    /**
+    * @brief varint: LEB128 encoding, 7 bits per byte, MSB set when more bytes follow
+    */
+    void varint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            u8((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        u8((uint8_t)v);
+    }
+    void svarint(int64_t v)             { varint(zigzag(v)); }
+    void str(const std::string &s)      { varint(s.size()); bytes(s.data(), s.size()); }
+
+    size_t size(void) const             { return buf.size(); }
+
+    static uint64_t zigzag(int64_t v)   { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+
+private:
+    std::vector<uint8_t> &buf;          // Buffer being appended to
+};
+
+class ByteReader
+{
+public:
+    ByteReader(const uint8_t *_ptr, size_t _len) : ptr(_ptr), end(_ptr + _len), error(false) {}
+
+    uint8_t u8(void)                    { if (ptr >= end) { error = true; return 0; } return *ptr++; }
+    uint16_t u16(void)                  { uint16_t v = u8(); return (uint16_t)(v | (u8() << 8)); }
+    uint32_t u32(void)                  { uint32_t v = u16(); return v | ((uint32_t)u16() << 16); }
+    uint64_t u64(void)                  { uint64_t v = u32(); return v | ((uint64_t)u32() << 32); }
+
+    uint64_t varint(void)
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            uint8_t b = u8();
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if ((b & 0x80) == 0)    return v;
+        }
+        error = true;                   // more than 10 bytes: not a varint
+        return 0;
+    }
+    int64_t svarint(void)               { return unzigzag(varint()); }
+
+    std::string str(void)
+    {
+        size_t n = (size_t)varint();
+        if (n > remaining())            { error = true; return std::string(); }
+        std::string s((const char *)ptr, n);
+        ptr += n;
+        return s;
+    }
+
+    /**
+    * @brief sub: extract a sub-reader of n bytes and skip them in this reader
+    */
+    ByteReader sub(size_t n)
+    {
+        if (n > remaining())            { error = true; n = remaining(); }
+        ByteReader r(ptr, n);
+        ptr += n;
+        return r;
+    }
+
+    size_t remaining(void) const        { return (size_t)(end - ptr); }
+    bool failed(void) const             { return error; }
+
+    static int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+private:
+    const uint8_t *ptr;                 // Next byte to read
+    const uint8_t *end;                 // One past the last readable byte
+    bool error;                         // Set as soon as a read goes out of range
+};
+
+/**
+* @brief Column codecs. Encoders append to the writer, decoders fill exactly count values
+*        and return false if the column is truncated or malformed.
+*/
+void encodeDelta(ByteWriter &w, const int64_t *values, size_t count);
+bool decodeDelta(ByteReader &r, int64_t *values, size_t count);
+void encodeDeltaOfDelta(ByteWriter &w, const int64_t *values, size_t count);
+bool decodeDeltaOfDelta(ByteReader &r, int64_t *values, size_t count);
+void encodeRunLength(ByteWriter &w, const uint32_t *values, size_t count);
+bool decodeRunLength(ByteReader &r, uint32_t *values, size_t count);
+
+/**
+* @brief fnv1a: 32 bits FNV-1a hash, used to detect torn or corrupted blocks
+*/
+uint32_t fnv1a(const uint8_t *data, size_t len);
+
+#endif // _TELEMETRYCODEC_H
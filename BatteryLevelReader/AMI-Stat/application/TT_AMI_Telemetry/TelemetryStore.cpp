@@ -0,0 +1,706 @@
+/*
+* TelemetryStore.cpp : This file contains the class responsible to store the battery telemetry
+*               (serial, timestamp, SOC, voltage, charging, firmware, event) on disk.
+*
+*   Segment file layout (all integers little endian):
+*       - segment header:   "TLMS", u32 version
+*       - blocks, one after the other:
+*           - block header: u32 magic, u32 payloadLen, u32 checksum, u32 count,
+*                           i64 tMin, i64 tMax, u8 serialLen, serial (no terminator)
+*           - payload:      string table (firmware and event values used in the block),
+*                           then 6 columns, each prefixed with its length in bytes so a reader
+*                           can skip the columns it does not need.
+*
+*   A block is written with a single fwrite. If the application dies during that write, the
+*   truncated block is detected at open time and the next samples go into a new segment.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "TelemetryStore.h"
+#include "TelemetryCodec.h"
+
+#define SEG_MAGIC           0x534D4C54      // "TLMS"
+#define SEG_VERSION         1
+#define SEG_HEADER_LEN      8
+#define BLK_MAGIC           0x424D4C54      // "TLMB"
+#define BLK_FIXED_LEN       33              // Block header length without the serial number
+
+// Column order in the payload
+enum
+{
+    COL_TIMESTAMP,                          // delta of delta
+    COL_SOC,                                // delta
+    COL_VOLTAGE,                            // delta
+    COL_CHARGING,                           // run length
+    COL_FIRMWARE,                           // run length of string table index
+    COL_EVENT,                              // run length of string table index
+    COL_COUNT
+};
+
+/**
+* @brief copyField: copy a string in a fixed size, always terminated, char field
+*/
+static void copyField(char *dst, size_t dstLen, const std::string &src)
+{
+    size_t n = std::min(src.size(), dstLen - 1);
+    memcpy(dst, src.data(), n);
+    dst[n] = '\0';
+}
+
+/**
+* @brief fieldString: convert a fixed size char field (maybe not terminated) to a string
+*/
+static std::string fieldString(const char *src, size_t srcLen)
+{
+    return std::string(src, strnlen(src, srcLen));
+}
+
+/**
+* @brief firmwareIndex: index of a firmware version in the columns, added when new
+*/
+static uint16_t firmwareIndex(TelemetryColumns &out, const std::string &version)
+{
+    for (size_t i = 0; i < out.firmwares.size(); i++)
+    {
+        if (out.firmwares[i] == version)    return (uint16_t)i;
+    }
+    out.firmwares.push_back(version);
+    return (uint16_t)(out.firmwares.size() - 1);
+}
+
+/**
+* @brief ctor: class constructor. The store must be opened before use.
+*
+* @return None.
+*/
+TelemetryStore::TelemetryStore()
+: maxSegBytes(TLM_DEFAULT_SEGMENT_BYTES)
+, blockSize(TLM_DEFAULT_BLOCK_SAMPLES)
+, segFile(NULL)
+, segNo(0)
+, segSize(0)
+, nbSamples(0)
+{
+}
+
+/**
+* @brief dtor: class destructor. Flushes and closes the store.
+*
+* @return None.
+*/
+TelemetryStore::~TelemetryStore()
+{
+    close();
+}
+
+/**
+* @brief open: open (or create) the store located in a directory and rebuild the index
+*
+* @param dir:               existing directory holding the segment files
+* @param maxSegmentBytes:   size after which a new segment file is started
+* @param blockSamples:      number of samples buffered per device before a block is written
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::open(const std::string &dir, uint32_t maxSegmentBytes, uint32_t blockSamples)
+{
+    if (blockSamples == 0)                  return TLM_ERR_INV_PARAM;
+
+    close();
+
+    std::lock_guard<std::mutex> guard(lock);
+    dirPath = dir;
+    maxSegBytes = maxSegmentBytes;
+    blockSize = blockSamples;
+
+    // Rebuild the index from the block headers of every segment, in order
+    uint32_t n = 0;
+    uint32_t lastSize = 0;
+    int lastErr = TLM_OK;
+    for (;; n++)
+    {
+        uint32_t size;
+        int err = scanSegment(n, &size);
+        if (err == TLM_ERR_IO)              break;      // no more segment
+        lastErr = err;
+        lastSize = size;
+    }
+
+    if (n == 0)                             return openSegment(0, 0);           // new store
+    if (lastErr == TLM_OK)                  return openSegment(n - 1, lastSize); // keep appending to the last segment
+    return openSegment(n, 0);               // last segment has a damaged tail: do not append after it
+}
+
+/**
+* @brief close: write the pending samples and close the store
+*
+* @return None.
+*/
+void TelemetryStore::close(void)
+{
+    flush();
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (segFile != NULL)    fclose(segFile);
+    segFile = NULL;
+    series.clear();
+    nbSamples = 0;
+}
+
+/**
+* @brief append: add a sample. It is buffered until the block of its device is full.
+*
+* @param sample:    sample to add
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::append(const TelemetrySample &sample)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (segFile == NULL)                    return TLM_ERR_CLOSED;
+
+    std::string serial = fieldString(sample.serial, sizeof(sample.serial));
+    Series &s = series[serial];
+    s.pending.push_back(sample);
+    nbSamples++;
+
+    if (s.pending.size() >= blockSize)      return writeBlock(serial, s);
+    return TLM_OK;
+}
+
+/**
+* @brief flush: write all the pending samples to disk
+*
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::flush(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (segFile == NULL)                    return TLM_ERR_CLOSED;
+
+    int retCode = TLM_OK;
+    for (auto it = series.begin(); it != series.end(); ++it)
+    {
+        if (it->second.pending.empty())     continue;
+        int err = writeBlock(it->first, it->second);
+        if (err != TLM_OK)                  retCode = err;
+    }
+    return retCode;
+}
+
+/**
+* @brief query: extract the samples of a device (or of all devices) within a time range.
+*           Pending samples are included. Results are sorted by timestamp.
+*
+* @param serial:    device serial number, NULL or "" for all devices
+* @param from:      first timestamp included (ms since epoch)
+* @param to:        last timestamp included (ms since epoch)
+* @param out:       samples found are appended to this vector
+* @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+*/
+int TelemetryStore::query(const char *serial, int64_t from, int64_t to, std::vector<TelemetrySample> &out)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (segFile == NULL)                    return TLM_ERR_CLOSED;
+
+    int retCode = TLM_OK;
+    size_t first = out.size();
+    bool all = (serial == NULL) || (*serial == '\0');
+
+    auto it = all ? series.begin() : series.find(serial);
+    for (; it != series.end(); ++it)
+    {
+        for (const BlockRef &ref : it->second.blocks)
+        {
+            if ((ref.tMax < from) || (ref.tMin > to))   continue;       // index: block not in range
+            int err = readBlock(it->first, ref, from, to, out);
+            if (err != TLM_OK)                          retCode = err;
+        }
+        for (const TelemetrySample &s : it->second.pending)
+        {
+            if ((s.timestamp >= from) && (s.timestamp <= to))   out.push_back(s);
+        }
+        if (!all)                           break;
+    }
+
+    std::stable_sort(out.begin() + first, out.end(),
+        [](const TelemetrySample &a, const TelemetrySample &b) { return a.timestamp < b.timestamp; });
+    return retCode;
+}
+
+/**
+* @brief scanColumns: extract the numeric columns of the samples of a device within a time
+*           range. The event column is skipped, and the firmware one unless asked.
+*           Pending samples are included. Results are sorted by timestamp.
+*           The index is copied under the lock, then the blocks are read without it: they are
+*           never modified once written.
+*
+* @param serial:    device serial number
+* @param from:      first timestamp included (ms since epoch)
+* @param to:        last timestamp included (ms since epoch)
+* @param out:       samples found are appended to these columns
+* @param firmware:  also fill the firmware column
+* @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+*/
+int TelemetryStore::scanColumns(const char *serial, int64_t from, int64_t to, TelemetryColumns &out, bool firmware)
+{
+    if ((serial == NULL) || (*serial == '\0'))     return TLM_ERR_INV_PARAM;
+
+    std::string name(serial);
+    std::string dir;
+    std::vector<BlockRef> blocks;
+    std::vector<TelemetrySample> pending;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (segFile == NULL)                return TLM_ERR_CLOSED;
+        auto it = series.find(name);
+        if (it == series.end())             return TLM_OK;
+        dir = dirPath;
+        for (const BlockRef &ref : it->second.blocks)
+        {
+            if ((ref.tMax >= from) && (ref.tMin <= to))     blocks.push_back(ref);     // index: block in range
+        }
+        pending = it->second.pending;
+    }
+
+    int retCode = TLM_OK;
+    size_t first = out.size();
+    FILE *f = NULL;
+    uint32_t fileSeg = 0;
+    for (const BlockRef &ref : blocks)
+    {
+        // the blocks of a device follow the segments: keep the segment opened between them
+        if ((f == NULL) || (ref.segment != fileSeg))
+        {
+            if (f != NULL)                  fclose(f);
+            fileSeg = ref.segment;
+            f = fopen(segmentPath(dir, fileSeg).c_str(), "rb");
+            if (f == NULL)
+            {
+                retCode = TLM_ERR_IO;
+                continue;
+            }
+        }
+        int err = readColumns(f, name, ref, from, to, firmware, out);
+        if (err != TLM_OK)                  retCode = err;
+    }
+    if (f != NULL)                          fclose(f);
+
+    for (const TelemetrySample &s : pending)
+    {
+        if ((s.timestamp < from) || (s.timestamp > to))     continue;
+        out.timestamp.push_back(s.timestamp);
+        out.soc.push_back(s.soc);
+        out.voltage.push_back(s.voltage);
+        out.charging.push_back(s.charging ? 1 : 0);
+        if (firmware)   out.firmware.push_back(firmwareIndex(out, fieldString(s.firmware, sizeof(s.firmware))));
+    }
+
+    // samples are logged in time order: only sort when a clock went back
+    size_t count = out.size() - first;
+    if (!std::is_sorted(out.timestamp.begin() + first, out.timestamp.end()))
+    {
+        std::vector<uint32_t> order(count);
+        for (size_t i = 0; i < count; i++)  order[i] = (uint32_t)i;
+        std::stable_sort(order.begin(), order.end(),
+            [&](uint32_t a, uint32_t b) { return out.timestamp[first + a] < out.timestamp[first + b]; });
+
+        TelemetryColumns sorted;
+        for (uint32_t i : order)
+        {
+            sorted.timestamp.push_back(out.timestamp[first + i]);
+            sorted.soc.push_back(out.soc[first + i]);
+            sorted.voltage.push_back(out.voltage[first + i]);
+            sorted.charging.push_back(out.charging[first + i]);
+            if (firmware)   sorted.firmware.push_back(out.firmware[first + i]);
+        }
+        std::copy(sorted.timestamp.begin(), sorted.timestamp.end(), out.timestamp.begin() + first);
+        std::copy(sorted.soc.begin(), sorted.soc.end(), out.soc.begin() + first);
+        std::copy(sorted.voltage.begin(), sorted.voltage.end(), out.voltage.begin() + first);
+        std::copy(sorted.charging.begin(), sorted.charging.end(), out.charging.begin() + first);
+        std::copy(sorted.firmware.begin(), sorted.firmware.end(), out.firmware.begin() + first);
+    }
+    return retCode;
+}
+
+/**
+* @brief serials: list the devices known by the store
+*
+* @param out:       filled with the serial numbers
+* @return None.
+*/
+void TelemetryStore::serials(std::vector<std::string> &out)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for (auto it = series.begin(); it != series.end(); ++it)    out.push_back(it->first);
+}
+
+/**
+* @brief sampleCount: number of samples in the store (written and pending)
+*
+* @return the number of samples
+*/
+uint64_t TelemetryStore::sampleCount(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return nbSamples;
+}
+
+/**
+* @brief writeBlock: encode the pending samples of a device and append them to the segment.
+*           Called with the lock taken.
+*
+* @param serial:    device serial number
+* @param s:         device series. Its pending samples are moved to a block.
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::writeBlock(const std::string &serial, Series &s)
+{
+    const std::vector<TelemetrySample> &p = s.pending;
+    size_t count = p.size();
+    assert(count > 0);
+
+    // Split the samples into columns. Strings go in a table local to the block.
+    std::vector<std::string> strTable;
+    std::map<std::string, uint32_t> strIndex;
+    auto intern = [&](const char *field, size_t len) -> uint32_t
+    {
+        std::string v = fieldString(field, len);
+        auto found = strIndex.find(v);
+        if (found != strIndex.end())    return found->second;
+        strIndex[v] = (uint32_t)strTable.size();
+        strTable.push_back(v);
+        return (uint32_t)strTable.size() - 1;
+    };
+
+    std::vector<int64_t> ts(count), soc(count), volt(count);
+    std::vector<uint32_t> chg(count), fw(count), evt(count);
+    int64_t tMin = p[0].timestamp;
+    int64_t tMax = p[0].timestamp;
+    for (size_t i = 0; i < count; i++)
+    {
+        ts[i]   = p[i].timestamp;
+        soc[i]  = p[i].soc;
+        volt[i] = p[i].voltage;
+        chg[i]  = p[i].charging ? 1 : 0;
+        fw[i]   = intern(p[i].firmware, sizeof(p[i].firmware));
+        evt[i]  = intern(p[i].event, sizeof(p[i].event));
+        tMin = std::min(tMin, ts[i]);
+        tMax = std::max(tMax, ts[i]);
+    }
+
+    // Payload: string table then each column prefixed by its length
+    std::vector<uint8_t> payload;
+    ByteWriter w(payload);
+    w.varint(strTable.size());
+    for (const std::string &str : strTable)     w.str(str);
+
+    std::vector<uint8_t> col;
+    ByteWriter cw(col);
+    for (int c = 0; c < COL_COUNT; c++)
+    {
+        col.clear();
+        switch (c)
+        {
+            case COL_TIMESTAMP: encodeDeltaOfDelta(cw, ts.data(), count);   break;
+            case COL_SOC:       encodeDelta(cw, soc.data(), count);         break;
+            case COL_VOLTAGE:   encodeDelta(cw, volt.data(), count);        break;
+            case COL_CHARGING:  encodeRunLength(cw, chg.data(), count);     break;
+            case COL_FIRMWARE:  encodeRunLength(cw, fw.data(), count);      break;
+            case COL_EVENT:     encodeRunLength(cw, evt.data(), count);     break;
+        }
+        w.varint(col.size());
+        w.bytes(col.data(), col.size());
+    }
+
+    // Header + payload are written in one shot
+    std::string ser = serial.substr(0, 255);
+    std::vector<uint8_t> block;
+    ByteWriter bw(block);
+    bw.u32(BLK_MAGIC);
+    bw.u32((uint32_t)payload.size());
+    bw.u32(fnv1a(payload.data(), payload.size()));
+    bw.u32((uint32_t)count);
+    bw.u64((uint64_t)tMin);
+    bw.u64((uint64_t)tMax);
+    bw.u8((uint8_t)ser.size());
+    bw.bytes(ser.data(), ser.size());
+    bw.bytes(payload.data(), payload.size());
+
+    // Rotate when this block would overflow the segment (a segment holds at least 1 block)
+    if ((segSize > SEG_HEADER_LEN) && ((uint64_t)segSize + block.size() > maxSegBytes))
+    {
+        fclose(segFile);
+        segFile = NULL;
+        int err = openSegment(segNo + 1, 0);
+        if (err != TLM_OK)                  return err;
+    }
+
+    bool written = (fwrite(block.data(), 1, block.size(), segFile) == block.size());
+    if ((fflush(segFile) != 0) || (written == false))
+    {
+        // Part of the block may be on disk: never append after it, the offsets would be wrong.
+        // The scan at the next open stops at the damaged tail, as for a crash.
+        fclose(segFile);
+        segFile = NULL;
+        openSegment(segNo + 1, 0);
+        return TLM_ERR_IO;                  // The samples stay pending for the next flush
+    }
+
+    BlockRef ref;
+    ref.segment = segNo;
+    ref.offset = segSize;
+    ref.payloadLen = (uint32_t)payload.size();
+    ref.checksum = fnv1a(payload.data(), payload.size());
+    ref.count = (uint32_t)count;
+    ref.tMin = tMin;
+    ref.tMax = tMax;
+    s.blocks.push_back(ref);
+    s.pending.clear();
+    segSize += (uint32_t)block.size();
+    return TLM_OK;
+}
+
+/**
+* @brief scanSegment: read the block headers of a segment and add them to the index.
+*           Called with the lock taken.
+*
+* @param segNo:     segment number
+* @param retSize:   filled with the size of the valid part of the segment
+* @return TLM_OK, TLM_ERR_IO if the segment does not exist, TLM_ERR_CORRUPT if its tail is damaged
+*/
+int TelemetryStore::scanSegment(uint32_t segNo, uint32_t *retSize)
+{
+    FILE *f = fopen(segmentPath(segNo).c_str(), "rb");
+    if (f == NULL)                          return TLM_ERR_IO;
+
+    fseek(f, 0, SEEK_END);
+    long fileLen = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    int retCode = TLM_OK;
+    uint8_t hdr[BLK_FIXED_LEN + 255];
+    uint32_t pos = SEG_HEADER_LEN;
+    if ((fread(hdr, 1, SEG_HEADER_LEN, f) != SEG_HEADER_LEN) || (ByteReader(hdr, 4).u32() != SEG_MAGIC))
+    {
+        retCode = TLM_ERR_CORRUPT;
+        pos = 0;
+    }
+
+    while ((retCode == TLM_OK) && ((long)pos < fileLen))
+    {
+        if (fread(hdr, 1, BLK_FIXED_LEN, f) != BLK_FIXED_LEN)  { retCode = TLM_ERR_CORRUPT; break; }
+        ByteReader r(hdr, BLK_FIXED_LEN);
+        BlockRef ref;
+        uint32_t magic = r.u32();
+        ref.segment = segNo;
+        ref.offset = pos;
+        ref.payloadLen = r.u32();
+        ref.checksum = r.u32();
+        ref.count = r.u32();
+        ref.tMin = (int64_t)r.u64();
+        ref.tMax = (int64_t)r.u64();
+        uint8_t serialLen = r.u8();
+
+        uint32_t blockLen = BLK_FIXED_LEN + serialLen + ref.payloadLen;
+        if ((magic != BLK_MAGIC) || ((long)pos + (long)blockLen > fileLen))    { retCode = TLM_ERR_CORRUPT; break; }
+        if (fread(hdr, 1, serialLen, f) != serialLen)                           { retCode = TLM_ERR_CORRUPT; break; }
+
+        Series &s = series[std::string((const char *)hdr, serialLen)];
+        s.blocks.push_back(ref);
+        nbSamples += ref.count;
+
+        fseek(f, ref.payloadLen, SEEK_CUR);     // skip the payload, the index only needs the header
+        pos += blockLen;
+    }
+
+    fclose(f);
+    *retSize = pos;
+    return retCode;
+}
+
+/**
+* @brief openSegment: open a segment for appending. Called with the lock taken.
+*
+* @param n:         segment number
+* @param size:      size of the valid part of the segment (0: new segment)
+* @return TLM_OK or TLM_ERR_IO
+*/
+int TelemetryStore::openSegment(uint32_t n, uint32_t size)
+{
+    segFile = fopen(segmentPath(n).c_str(), (size == 0) ? "wb" : "ab");
+    if (segFile == NULL)                    return TLM_ERR_IO;
+
+    segNo = n;
+    segSize = size;
+    if (size == 0)
+    {
+        std::vector<uint8_t> hdr;
+        ByteWriter w(hdr);
+        w.u32(SEG_MAGIC);
+        w.u32(SEG_VERSION);
+        if (fwrite(hdr.data(), 1, hdr.size(), segFile) != hdr.size())   return TLM_ERR_IO;
+        fflush(segFile);
+        segSize = SEG_HEADER_LEN;
+    }
+    return TLM_OK;
+}
+
+/**
+* @brief readBlock: decode a block and append the samples within the range.
+*           Called with the lock taken.
+*
+* @param serial:    device serial number of that block
+* @param ref:       block location
+* @param from:      first timestamp included
+* @param to:        last timestamp included
+* @param out:       samples found are appended to this vector
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::readBlock(const std::string &serial, const BlockRef &ref, int64_t from, int64_t to, std::vector<TelemetrySample> &out)
+{
+    std::vector<uint8_t> payload(ref.payloadLen);
+
+    FILE *f = fopen(segmentPath(ref.segment).c_str(), "rb");     // segFile is append only, use a read handle
+    if (f == NULL)                          return TLM_ERR_IO;
+
+    long payloadPos = (long)ref.offset + BLK_FIXED_LEN + (long)serial.size();
+    bool ok = (fseek(f, payloadPos, SEEK_SET) == 0) && (fread(payload.data(), 1, payload.size(), f) == payload.size());
+    fclose(f);
+    if (!ok)                                return TLM_ERR_IO;
+    if (fnv1a(payload.data(), payload.size()) != ref.checksum)  return TLM_ERR_CORRUPT;
+
+    ByteReader r(payload.data(), payload.size());
+    std::vector<std::string> strTable((size_t)r.varint());
+    for (std::string &str : strTable)       str = r.str();
+
+    size_t count = ref.count;
+    std::vector<int64_t> ts(count), soc(count), volt(count);
+    std::vector<uint32_t> chg(count), fw(count), evt(count);
+    bool decoded = !r.failed();
+    for (int c = 0; (c < COL_COUNT) && decoded; c++)
+    {
+        ByteReader cr = r.sub((size_t)r.varint());
+        switch (c)
+        {
+            case COL_TIMESTAMP: decoded = decodeDeltaOfDelta(cr, ts.data(), count); break;
+            case COL_SOC:       decoded = decodeDelta(cr, soc.data(), count);       break;
+            case COL_VOLTAGE:   decoded = decodeDelta(cr, volt.data(), count);      break;
+            case COL_CHARGING:  decoded = decodeRunLength(cr, chg.data(), count);   break;
+            case COL_FIRMWARE:  decoded = decodeRunLength(cr, fw.data(), count);    break;
+            case COL_EVENT:     decoded = decodeRunLength(cr, evt.data(), count);   break;
+        }
+        decoded = decoded && !r.failed();
+    }
+    if (!decoded)                           return TLM_ERR_CORRUPT;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((ts[i] < from) || (ts[i] > to))                         continue;
+        if ((fw[i] >= strTable.size()) || (evt[i] >= strTable.size()))  return TLM_ERR_CORRUPT;
+
+        TelemetrySample s;
+        memset(&s, 0, sizeof(s));
+        copyField(s.serial, sizeof(s.serial), serial);
+        copyField(s.firmware, sizeof(s.firmware), strTable[fw[i]]);
+        copyField(s.event, sizeof(s.event), strTable[evt[i]]);
+        s.timestamp = ts[i];
+        s.soc = (uint8_t)soc[i];
+        s.voltage = (uint16_t)volt[i];
+        s.charging = (uint8_t)chg[i];
+        out.push_back(s);
+    }
+    return TLM_OK;
+}
+
+/**
+* @brief readColumns: decode the timestamp, SOC, voltage and charging columns of a block and
+*           append the samples within the range. The event column is not decoded, nor the
+*           firmware column and the string table unless asked.
+*
+* @param f:         segment file of the block, opened for reading
+* @param serial:    device serial number of that block
+* @param ref:       block location
+* @param from:      first timestamp included
+* @param to:        last timestamp included
+* @param firmware:  also fill the firmware column
+* @param out:       samples found are appended to these columns
+* @return TLM_OK or a TLM_ERR_xxx error code
+*/
+int TelemetryStore::readColumns(FILE *f, const std::string &serial, const BlockRef &ref, int64_t from, int64_t to, bool firmware, TelemetryColumns &out)
+{
+    std::vector<uint8_t> payload(ref.payloadLen);
+
+    long payloadPos = (long)ref.offset + BLK_FIXED_LEN + (long)serial.size();
+    if ((fseek(f, payloadPos, SEEK_SET) != 0) || (fread(payload.data(), 1, payload.size(), f) != payload.size()))  return TLM_ERR_IO;
+    if (fnv1a(payload.data(), payload.size()) != ref.checksum)  return TLM_ERR_CORRUPT;
+
+    ByteReader r(payload.data(), payload.size());
+    uint64_t strings = r.varint();
+    std::vector<std::string> strTable;
+    for (uint64_t i = 0; (i < strings) && !r.failed(); i++)
+    {
+        if (firmware)   strTable.push_back(r.str());
+        else            r.sub((size_t)r.varint());
+    }
+
+    size_t count = ref.count;
+    std::vector<int64_t> ts(count), soc(count), volt(count);
+    std::vector<uint32_t> chg(count), fw(firmware ? count : 0);
+    bool decoded = !r.failed();
+    for (int c = 0; (c <= (firmware ? COL_FIRMWARE : COL_CHARGING)) && decoded; c++)
+    {
+        ByteReader cr = r.sub((size_t)r.varint());
+        switch (c)
+        {
+            case COL_TIMESTAMP: decoded = decodeDeltaOfDelta(cr, ts.data(), count); break;
+            case COL_SOC:       decoded = decodeDelta(cr, soc.data(), count);       break;
+            case COL_VOLTAGE:   decoded = decodeDelta(cr, volt.data(), count);      break;
+            case COL_CHARGING:  decoded = decodeRunLength(cr, chg.data(), count);   break;
+            case COL_FIRMWARE:  decoded = decodeRunLength(cr, fw.data(), count);    break;
+        }
+        decoded = decoded && !r.failed();
+    }
+    if (!decoded)                           return TLM_ERR_CORRUPT;
+    for (size_t i = 0; i < fw.size(); i++)
+    {
+        if (fw[i] >= strTable.size())       return TLM_ERR_CORRUPT;
+    }
+
+    // index in out.firmwares of the strings of the block, looked up when first used
+    std::vector<int> strIndex(strTable.size(), -1);
+
+    bool whole = (ref.tMin >= from) && (ref.tMax <= to);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!whole && ((ts[i] < from) || (ts[i] > to)))     continue;
+        out.timestamp.push_back(ts[i]);
+        out.soc.push_back((uint8_t)soc[i]);
+        out.voltage.push_back((uint16_t)volt[i]);
+        out.charging.push_back((uint8_t)chg[i]);
+        if (firmware)
+        {
+            if (strIndex[fw[i]] < 0)    strIndex[fw[i]] = firmwareIndex(out, strTable[fw[i]]);
+            out.firmware.push_back((uint16_t)strIndex[fw[i]]);
+        }
+    }
+    return TLM_OK;
+}
+
+/**
+* @brief segmentPath: build the file name of a segment
+*
+* @param dir:       directory of the store
+* @param n:         segment number
+* @return the full path of that segment
+*/
+std::string TelemetryStore::segmentPath(const std::string &dir, uint32_t n)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "tlm_%06u.seg", n);
+    if (dir.empty())                        return name;
+    char last = dir[dir.size() - 1];
+    return ((last == '/') || (last == '\\')) ? dir + name : dir + "/" + name;
+}
@@ -0,0 +1,185 @@
+/*
+* TelemetryStore.h : This file contains the class responsible to store the battery telemetry
+*               (serial, timestamp, SOC, voltage, charging, firmware, event) on disk.
+*
+*   In a nutshell, this class implements:
+*       - an append-only store made of segment files (tlm_000000.seg, tlm_000001.seg, ...)
+*           in a directory. A new segment is started when the current one is full.
+*       - samples are buffered per device and written as one compressed block once
+*           blockSamples samples are pending (or on flush()/close()).
+*       - each block holds the samples of a single device, column per column:
+*           timestamps are delta of delta encoded, SOC/voltage delta encoded and the
+*           categorical columns (charging, firmware, event) run length encoded.
+*       - an in-memory index (device -> blocks with their time range) rebuilt from the block
+*           headers at open time, so range queries only decode the blocks they need.
+*       - a columnar scan of one device (scanColumns): only the timestamp, SOC, voltage and
+*           charging columns of the blocks (and the firmware when asked) are decoded, straight
+*           into one vector per column.
+*           The blocks are read without holding the lock, so many devices can be scanned at once.
+*
+*   All the methods are thread safe.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TELEMETRYSTORE_H
+#define _TELEMETRYSTORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "TelemetryTypes.h"
+
+#define TLM_DEFAULT_SEGMENT_BYTES   (4 * 1024 * 1024)   // Segment rotation size
+#define TLM_DEFAULT_BLOCK_SAMPLES   512                 // Samples buffered per device before writing a block
+
+/**
+* @brief Numeric columns of the samples of one device, as filled by TelemetryStore::scanColumns
+*/
+struct TelemetryColumns
+{
+    std::vector<int64_t> timestamp;     // ms since 1970-01-01 UTC
+    std::vector<uint8_t> soc;           // %
+    std::vector<uint16_t> voltage;      // mV
+    std::vector<uint8_t> charging;      // 0 or 1
+    std::vector<uint16_t> firmware;     // Index in firmwares (filled when asked only)
+    std::vector<std::string> firmwares; // Firmware versions found
+
+    size_t size(void) const             { return timestamp.size(); }
+    void clear(void)                    { timestamp.clear(); soc.clear(); voltage.clear(); charging.clear(); firmware.clear(); firmwares.clear(); }
+};
+
+class TelemetryStore
+{
+public:
+    /**
+    * @brief ctor: class constructor. The store must be opened before use.
+    *
+    * @return None.
+    */
+    TelemetryStore();
+
+    /**
+    * @brief dtor: class destructor. Flushes and closes the store.
+    *
+    * @return None.
+    */
+    virtual ~TelemetryStore();
+
+    /**
+    * @brief open: open (or create) the store located in a directory and rebuild the index
+    *
+    * @param dir:               existing directory holding the segment files
+    * @param maxSegmentBytes:   size after which a new segment file is started
+    * @param blockSamples:      number of samples buffered per device before a block is written
+    * @return TLM_OK or a TLM_ERR_xxx error code
+    */
+    int open(const std::string &dir, uint32_t maxSegmentBytes = TLM_DEFAULT_SEGMENT_BYTES, uint32_t blockSamples = TLM_DEFAULT_BLOCK_SAMPLES);
+
+    /**
+    * @brief close: write the pending samples and close the store
+    *
+    * @return None.
+    */
+    void close(void);
+
+    /**
+    * @brief append: add a sample. It is buffered until the block of its device is full.
+    *
+    * @param sample:    sample to add
+    * @return TLM_OK or a TLM_ERR_xxx error code
+    */
+    int append(const TelemetrySample &sample);
+
+    /**
+    * @brief flush: write all the pending samples to disk
+    *
+    * @return TLM_OK or a TLM_ERR_xxx error code
+    */
+    int flush(void);
+
+    /**
+    * @brief query: extract the samples of a device (or of all devices) within a time range.
+    *           Pending samples are included. Results are sorted by timestamp.
+    *
+    * @param serial:    device serial number, NULL or "" for all devices
+    * @param from:      first timestamp included (ms since epoch)
+    * @param to:        last timestamp included (ms since epoch)
+    * @param out:       samples found are appended to this vector
+    * @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+    */
+    int query(const char *serial, int64_t from, int64_t to, std::vector<TelemetrySample> &out);
+
+    /**
+    * @brief scanColumns: extract the numeric columns of the samples of a device within a time
+    *           range. The event column is skipped, and the firmware one unless asked.
+    *           Pending samples are included. Results are sorted by timestamp.
+    *           Thread safe, and the blocks are decoded without holding the lock.
+    *
+    * @param serial:    device serial number
+    * @param from:      first timestamp included (ms since epoch)
+    * @param to:        last timestamp included (ms since epoch)
+    * @param out:       samples found are appended to these columns
+    * @param firmware:  also fill the firmware column
+    * @return TLM_OK or a TLM_ERR_xxx error code (TLM_ERR_CORRUPT: damaged blocks were skipped)
+    */
+    int scanColumns(const char *serial, int64_t from, int64_t to, TelemetryColumns &out, bool firmware = false);
+
+    /**
+    * @brief serials: list the devices known by the store
+    *
+    * @param out:       filled with the serial numbers
+    * @return None.
+    */
+    void serials(std::vector<std::string> &out);
+
+    /**
+    * @brief sampleCount: number of samples in the store (written and pending)
+    *
+    * @return the number of samples
+    */
+    uint64_t sampleCount(void);
+
+private:
+    // Location of a block on disk, along with what is needed to decide if a query must decode it
+    struct BlockRef
+    {
+        uint32_t segment;               // Segment file number
+        uint32_t offset;                // Offset of the block header in the segment
+        uint32_t payloadLen;            // Number of bytes after the block header
+        uint32_t checksum;              // FNV-1a of the payload
+        uint32_t count;                 // Number of samples in the block
+        int64_t tMin;                   // Smallest timestamp in the block
+        int64_t tMax;                   // Largest timestamp in the block
+    };
+
+    // Everything known about one device
+    struct Series
+    {
+        std::vector<BlockRef> blocks;           // Blocks already on disk, in write order
+        std::vector<TelemetrySample> pending;   // Samples not written yet
+    };
+
+    int writeBlock(const std::string &serial, Series &series);
+    int scanSegment(uint32_t segNo, uint32_t *retSize);
+    int openSegment(uint32_t segNo, uint32_t size);
+    int readBlock(const std::string &serial, const BlockRef &ref, int64_t from, int64_t to, std::vector<TelemetrySample> &out);
+    static int readColumns(FILE *f, const std::string &serial, const BlockRef &ref, int64_t from, int64_t to, bool firmware, TelemetryColumns &out);
+    std::string segmentPath(uint32_t segNo) const                       { return segmentPath(dirPath, segNo); }
+    static std::string segmentPath(const std::string &dir, uint32_t segNo);
+
+    std::mutex lock;                        // Protects everything below
+    std::string dirPath;                    // Directory holding the segments
+    uint32_t maxSegBytes;                   // Segment rotation size
+    uint32_t blockSize;                     // Samples per block
+    std::map<std::string, Series> series;   // Index, per device serial number
+    FILE *segFile;                          // Segment being appended, NULL when the store is closed
+    uint32_t segNo;                         // Number of the segment being appended
+    uint32_t segSize;                       // Current size of that segment
+    uint64_t nbSamples;                     // Samples in the store
+};
+
+#endif // _TELEMETRYSTORE_H
@@ -0,0 +1,93 @@
+/*
+* TelemetryTypes.h : Types and error codes shared by the telemetry store and its C interface
+*
+*   This header is plain C so it can be included by the C API users (AMIStat goes through
+*   P/Invoke, the host tools link the C++ classes directly). Keep the structures POD and the
+*   string fields fixed size: the C# marshaller maps them with ByValTStr.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TELEMETRYTYPES_H
+#define _TELEMETRYTYPES_H
+
+#include <stdint.h>
+
+#define TLM_SERIAL_LEN          32      // Same size as DeviceInfoC::SerialNumber
+#define TLM_FIRMWARE_LEN        32      // Same size as DeviceInfoC::FirmwareVersion
+#define TLM_EVENT_LEN           32      // "DeviceConnected", "ChargerDisconnected", ...
+
+// Error codes returned by the store (same convention as ErrCodes.h: 0 is ok, errors are negative)
+#define TLM_OK                  0       // No error
+#define TLM_ERR_IO              -1      // File could not be opened, read or written
+#define TLM_ERR_CORRUPT         -2      // A block failed its integrity check
+#define TLM_ERR_INV_PARAM       -3      // Invalid parameter provided by the caller
+#define TLM_ERR_CLOSED          -4      // The store is not opened
+#define TLM_ERR_BUFSHORT        -5      // Buffer provided is too short to hold all the results
+
+#pragma pack(push, 4)
+/**
+* @brief One battery telemetry sample, as logged by AMIStat
+*/
+typedef struct tagTelemetrySample
+{
+    char        serial[TLM_SERIAL_LEN];         // Device serial number
+    char        firmware[TLM_FIRMWARE_LEN];     // Device firmware version at sample time
+    char        event[TLM_EVENT_LEN];           // Reason of the sample ("" for periodic samples)
+    int64_t     timestamp;                      // ms since 1970-01-01 UTC
+    uint16_t    voltage;                        // mV
+    uint8_t     soc;                            // %
+    uint8_t     charging;                       // 0 or 1
+} TelemetrySample;
+
+/**
+* @brief Health of the battery of one device, as estimated from its telemetry (see BatteryHealth.h).
+*           Rates, capacity, voltage and resistance that could not be estimated (not enough data)
+*           are negative, trends that could not be estimated are 0.
+*/
+typedef struct tagBatteryHealth
+{
+    char        serial[TLM_SERIAL_LEN];         // Device serial number
+    int64_t     firstTimestamp;                 // First sample used (ms since 1970-01-01 UTC)
+    int64_t     lastTimestamp;                  // Last sample used
+    uint32_t    samples;                        // Number of samples used
+    uint32_t    discharges;                     // Discharge segments fitted
+    uint32_t    charges;                        // Charge segments fitted
+    uint32_t    flags;                          // TLM_HEALTH_xxx
+    float       dischargeRate;                  // Recent SOC drop while in use (% per hour)
+    float       chargeRate;                     // Recent SOC rise while charging (% per hour)
+    float       capacity;                       // Remaining capacity (% of the reference)
+    float       capacityTrend;                  // Change of the capacity (% per 30 days)
+    float       voltageAt50;                    // Voltage at 50% SOC while in use (mV)
+    float       resistance;                     // Internal resistance (mOhm)
+    float       resistanceTrend;                // Change of the resistance (mOhm per 30 days)
+    float       fleetScore;                     // Discharge rate versus the fleet (robust z-score)
+} BatteryHealth;
+
+/**
+* @brief Anomaly raised by the live detection on the telemetry of a device (see BatteryAnomaly.h)
+*/
+typedef struct tagBatteryAnomaly
+{
+    char        serial[TLM_SERIAL_LEN];         // Device serial number
+    int64_t     timestamp;                      // Sample that raised the anomaly (ms since 1970-01-01 UTC)
+    int32_t     type;                           // TLM_ANOMALY_xxx
+    float       value;                          // Measured: voltage (mV), SOC step (%) or minutes without SOC rise
+    float       expected;                       // What the history of the device expected instead
+    float       score;                          // Robust z-score, CUSUM sum or stall length against its threshold
+} BatteryAnomaly;
+#pragma pack(pop)
+
+// BatteryHealth::flags
+#define TLM_HEALTH_FAST_DRAIN   0x01    // SOC drops faster than the rest of the fleet
+#define TLM_HEALTH_LOW_CAPACITY 0x02    // Capacity below the replacement threshold
+#define TLM_HEALTH_RESISTANCE   0x04    // Internal resistance rising
+#define TLM_HEALTH_NO_DATA      0x08    // No recent discharge to estimate from
+
+// BatteryAnomaly::type
+#define TLM_ANOMALY_VOLTAGE_SAG     1   // Voltage held below its usual level for the SOC, on battery
+#define TLM_ANOMALY_SOC_JUMP        2   // SOC stepped from a sample to the next, and stayed there
+#define TLM_ANOMALY_CHARGE_STALL    3   // On the charger, SOC not rising
+#define TLM_ANOMALY_SENSOR_GLITCH   4   // Reading invalid, or off for one sample only
+
+#endif // _TELEMETRYTYPES_H
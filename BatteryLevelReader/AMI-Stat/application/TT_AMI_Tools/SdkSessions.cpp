@@ -0,0 +1,607 @@
+/*
+* SdkSessions.cpp : This file contains the access to the sessions stored in a device through the
+*               AMI SDK, for the session downloader and the session exporter, and to the samples
+*               streamed by a device, for the acquisition pipeline.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "SdkSessions.h"
+
+#ifdef AMI_SDK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "ErrCodes.h"
+
+#define SDK_OK(r)       (TTL_ERROR_CODE(r) == TTL_ERROR_NONE)
+
+/**
+* @brief widen: convert a path to the wide characters of the SDK (current code page)
+*
+* @param path:      path
+* @return The wide path
+*/
+static std::wstring widen(const char *path)
+{
+    std::vector<wchar_t> wide(strlen(path) + 1);
+    size_t len = mbstowcs(wide.data(), path, wide.size());
+    if (len == (size_t)-1)  return std::wstring();
+    return std::wstring(wide.data(), len);
+}
+
+/**
+* @brief narrow: convert a wide path of the SDK to the current code page
+*
+* @param path:      wide path
+* @return The path
+*/
+static std::string narrow(const wchar_t *path)
+{
+    std::vector<char> buffer(wcslen(path) * MB_CUR_MAX + 1);
+    size_t len = wcstombs(buffer.data(), path, buffer.size());
+    if (len == (size_t)-1)  return std::string();
+    return std::string(buffer.data(), len);
+}
+
+/**
+* @brief sdkScanDevices: initialize the SDK and list the devices available
+*
+* @param filter:    scan filter ("" for all devices)
+* @param devices:   receives the devices
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int sdkScanDevices(const char *filter, std::vector<SdkDevice> *devices)
+{
+    TTL_UINT32 count = 0;
+
+    devices->clear();
+    AMI_SetScanFilter(filter);
+    if (!SDK_OK(AMI_Init()))                        return ERR_SDK_CALL;
+    AMI_SetScanMode(SCAN_FAST);
+    AMI_ResumeScan();
+    AMI_PauseScan();
+    if (!SDK_OK(AMI_GetAvailableDevicesCount(count)))   return ERR_SDK_CALL;
+
+    for (TTL_UINT32 i = 0; i < count; i++)
+    {
+        ConnectionInfo ci;
+        if (!SDK_OK(AMI_GetDeviceConnectionInfo(i, ci)))    continue;
+        SdkDevice device;
+        device.handle = i;
+        device.id = ci.ID;
+        devices->push_back(device);
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief sdkEnd: release the SDK
+*
+* @return None.
+*/
+void sdkEnd(void)
+{
+    AMI_End();
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param device:    device, from sdkScanDevices()
+* @param format:    format of the sessions downloaded (RAW or RMS)
+* @return None.
+*/
+SdkSessions::SdkSessions(const SdkDevice &device, TTL_EMGType _format)
+: handle(device.handle)
+, name(device.id)
+, format(_format)
+, opened(false)
+, fnct(NULL)
+, ctx(NULL)
+{
+    for (size_t i = 0; i < name.size(); i++)        // the ID becomes part of file names
+    {
+        char c = name[i];
+        bool valid = ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '-');
+        if (valid == false)     name[i] = '_';
+    }
+}
+
+SdkSessions::~SdkSessions()
+{
+    close();
+}
+
+/**
+* @brief open: open the device and register the download callback
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkSessions::open(void)
+{
+    if (!SDK_OK(AMI_DeviceOpen(handle)))            return ERR_SDK_CALL;
+    opened = true;
+    if (!SDK_OK(AMI_DeviceDownloadSetCallback(handle, downloadEntry, this)))    return ERR_SDK_CALL;
+    return ERR_OK;
+}
+
+/**
+* @brief close: close the device
+*
+* @return None.
+*/
+void SdkSessions::close(void)
+{
+    if (opened == false)    return;
+    AMI_DeviceDownloadSetCallback(handle, NULL, NULL);
+    AMI_DeviceClose(handle);
+    opened = false;
+}
+
+int SdkSessions::count(uint16_t *count)
+{
+    TTL_UINT16 n = 0;
+    if (!SDK_OK(AMI_DeviceGetStoredSessionCount(handle, n)))    return ERR_SDK_CALL;
+    *count = n;
+    return ERR_OK;
+}
+
+int SdkSessions::info(uint16_t index, StoredSessionInfo *info)
+{
+    SessionInfo si;
+    if (!SDK_OK(AMI_DeviceGetStoredSessionInfo(handle, index, si)))     return ERR_SDK_CALL;
+    info->size = si.Size;
+    info->deleted = (si.Deleted != 0);
+    return ERR_OK;
+}
+
+/**
+* @brief start: start the download of a session, the SDK calls downloadEntry for each batch
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkSessions::start(uint16_t index, StoredBatch_t _fnct, void *_ctx, uint32_t *batchCount)
+{
+    DownloadInfo di;
+    TTL_UINT32 batches = 0;
+
+    fnct = _fnct;
+    ctx = _ctx;
+    di.index = index;
+    di.format = format;
+    if (!SDK_OK(AMI_DeviceDownloadStoredSession(handle, di, batches)))  return ERR_SDK_CALL;
+    *batchCount = batches;
+    return ERR_OK;
+}
+
+/**
+* @brief retry: report a batch in error, the device sends it again
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkSessions::retry(uint32_t batch)
+{
+    return SDK_OK(AMI_DeviceDownloadStoredSessionError(handle, batch)) ? ERR_OK : ERR_SDK_CALL;
+}
+
+int SdkSessions::end(void)
+{
+    int err = SDK_OK(AMI_DeviceDownloadStoredSessionEnd(handle)) ? ERR_OK : ERR_SDK_CALL;
+    fnct = NULL;
+    return err;
+}
+
+/**
+* @brief downloadEntry: DOWNLOAD_CALLBACK of the SDK
+*
+* @param param:     An abstract pointer to this instance.
+* @return None.
+*/
+void __stdcall SdkSessions::downloadEntry(TTL_UINT32 batchNumber, const char *buffer, TTL_UINT32 bufferSize, void *param)
+{
+    SdkSessions *self = static_cast<SdkSessions *>(param);
+    StoredBatch_t call = self->fnct;
+    if (call != NULL)       call(self->ctx, batchNumber, (const uint8_t *)buffer, bufferSize);
+}
+
+/**
+* @brief list: list the recorded sessions of a folder
+*
+* @param folder:    folder of the sessions
+* @param sources:   receives the sessions
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkExporter::list(const char *folder, std::vector<ExportSource> *sources)
+{
+    std::wstring wideFolder = widen(folder);
+    TTL_UINT32 count = 0;
+
+    sources->clear();
+    sensors.clear();
+    if (!SDK_OK(AMI_BeginRecordedSessionsEnum(wideFolder.c_str())))     return ERR_SDK_CALL;
+    if (!SDK_OK(AMI_GetRecordedSessionsCount(count)))
+    {
+        AMI_EndRecordedSessionsEnum();
+        return ERR_SDK_CALL;
+    }
+
+    for (TTL_UINT32 i = 0; i < count; i++)
+    {
+        MyonixHeaderInfo *header = NULL;
+        wchar_t *fileName = NULL;
+        if (!SDK_OK(AMI_GetRecordedSessionInfo(i, header, fileName)) || (header == NULL) || (fileName == NULL))   continue;
+
+        ExportSource source;
+        source.path = narrow(fileName);
+        if (source.path.empty())    continue;
+        source.mtime = exportFileTime(source.path.c_str(), &source.size);
+        if (source.mtime < 0)       continue;
+
+        size_t slash = source.path.find_last_of("/\\");
+        std::string base = source.path.substr((slash == std::string::npos) ? 0 : slash + 1);
+        size_t dot = base.find_last_of('.');
+        source.name = base.substr(0, dot) + SDK_EXPORT_EXT;
+
+        // the fields describing the recording (not the padding of the structure)
+        uint64_t fp = exportFingerprint(&header->sampleRate, sizeof(header->sampleRate));
+        fp = exportFingerprint(&header->samplesCount_raw, sizeof(header->samplesCount_raw), fp);
+        fp = exportFingerprint(&header->samplesCount_rms, sizeof(header->samplesCount_rms), fp);
+        fp = exportFingerprint(&header->eventsCount, sizeof(header->eventsCount), fp);
+        fp = exportFingerprint(&header->sessionType, sizeof(header->sessionType), fp);
+        fp = exportFingerprint(header->channelSensorsID, sizeof(header->channelSensorsID), fp);
+        fp = exportFingerprint(header->patientID, strnlen(header->patientID, sizeof(header->patientID)), fp);
+        fp = exportFingerprint(&header->dateTime, sizeof(header->dateTime), fp);
+        fp = exportFingerprint(&header->Modified, sizeof(header->Modified), fp);
+        fp = exportFingerprint(header->serialNumber, strnlen(header->serialNumber, sizeof(header->serialNumber)), fp);
+        source.fingerprint = fp;
+
+        sensors[source.path] = std::make_pair(header->channelSensorsID[0], header->channelSensorsID[1]);
+        sources->push_back(source);
+    }
+    AMI_EndRecordedSessionsEnum();
+    return ERR_OK;
+}
+
+/**
+* @brief exportFile: export one session in the BioGraph Infiniti format
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkExporter::exportFile(const ExportSource &source, const char *path, ExportProgress_t fnct, void *ctx, uint32_t *samples)
+{
+    std::wstring src = widen(source.path.c_str());
+    std::wstring dst = widen(path);
+    std::map<std::string, std::pair<TTL_INT32, TTL_INT32> >::const_iterator it = sensors.find(source.path);   // read only: shared by the workers
+    if (it == sensors.end())    return ERR_SDK_CALL;
+    ProgressCtx pctx = { fnct, ctx };
+    TTL_UINT32 exported = 0;
+
+    // the SDK takes non-const strings
+    std::vector<wchar_t> srcBuf(src.begin(), src.end());
+    std::vector<wchar_t> dstBuf(dst.begin(), dst.end());
+    srcBuf.push_back(0);
+    dstBuf.push_back(0);
+
+    CALL_RESULT r = AMI_ExportRecordedSession(srcBuf.data(), dstBuf.data(), EXPORT_BGI, exported, progressEntry, &pctx, it->second.first, it->second.second);
+    *samples = exported;
+    return SDK_OK(r) ? ERR_OK : ERR_SDK_CALL;
+}
+
+/**
+* @brief progressEntry: ExportProgressCallback of the SDK
+*
+* @param param:     An abstract pointer to a ProgressCtx.
+* @return None.
+*/
+void __stdcall SdkExporter::progressEntry(int percent, void *param)
+{
+    ProgressCtx *pctx = static_cast<ProgressCtx *>(param);
+    if (pctx->fnct != NULL)     pctx->fnct(pctx->ctx, percent);
+}
+
+
+/**
+* @brief readHeader: read the header of a session file
+*
+* @param path:      session file
+* @param header:    receives the header
+* @return ERR_OK or ERR_SDK_CALL (not a session)
+*/
+int SdkHeaders::readHeader(const char *path, SessionHeader *header)
+{
+    std::wstring wide = widen(path);
+    std::vector<wchar_t> pathBuf(wide.begin(), wide.end());    // the SDK takes non-const strings
+    MyonixHeaderInfo info;
+
+    pathBuf.push_back(0);
+    memset(&info, 0, sizeof(info));
+    if ((wide.empty()) || !SDK_OK(AMI_GetSessionFileInfo(pathBuf.data(), &info)))     return ERR_SDK_CALL;
+
+    memset(header, 0, sizeof(*header));
+    header->sampleRate = info.sampleRate;
+    header->rawCount = info.samplesCount_raw;
+    header->rmsCount = info.samplesCount_rms;
+    header->eventsCount = info.eventsCount;
+    header->sessionType = info.sessionType;
+    for (int i = 0; i < CATALOG_SENSORS; i++)   header->sensors[i] = info.channelSensorsID[i];
+    header->dateTime = (int64_t)info.dateTime;
+    header->modified = info.Modified;
+    header->productType = info.productType;
+    // the strings of the SDK are not always terminated: the catalog ones have room for it
+    memcpy(header->patientID, info.patientID, std::min(sizeof(info.patientID), sizeof(header->patientID) - 1));
+    memcpy(header->serialNumber, info.serialNumber, std::min(sizeof(info.serialNumber), sizeof(header->serialNumber) - 1));
+    memcpy(header->protocolVersion, info.protocolVersion, std::min(sizeof(info.protocolVersion), sizeof(header->protocolVersion) - 1));
+    return ERR_OK;
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param device:    device, from sdkScanDevices()
+* @return None.
+*/
+SdkUpload::SdkUpload(const SdkDevice &device)
+: handle(device.handle)
+, name(device.id)
+, opened(false)
+{
+    for (size_t i = 0; i < name.size(); i++)        // the ID becomes part of file names (manifest)
+    {
+        char c = name[i];
+        bool valid = ((c >= '0') && (c <= '9')) || ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) || (c == '-');
+        if (valid == false)     name[i] = '_';
+    }
+}
+
+SdkUpload::~SdkUpload()
+{
+    close();
+}
+
+/**
+* @brief open: open the device
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkUpload::open(void)
+{
+    if (!SDK_OK(AMI_DeviceOpen(handle)))            return ERR_SDK_CALL;
+    opened = true;
+    return ERR_OK;
+}
+
+/**
+* @brief close: close the device
+*
+* @return None.
+*/
+void SdkUpload::close(void)
+{
+    if (opened == false)    return;
+    AMI_DeviceClose(handle);
+    opened = false;
+}
+
+int SdkUpload::start(uint8_t id, const char *fileName, uint32_t size, uint16_t batchCount, uint32_t cs)
+{
+    return SDK_OK(AMI_UploadFileStart(handle, id, fileName, size, batchCount, cs)) ? ERR_OK : ERR_SDK_CALL;
+}
+
+/**
+* @brief writeBatch: send a batch and wait for its acknowledge
+*
+* @return ERR_OK (refused holds the error code of the device) or ERR_SDK_CALL
+*/
+int SdkUpload::writeBatch(uint8_t id, uint16_t batch, const uint8_t *data, uint16_t len, uint8_t *refused)
+{
+    std::vector<TTL_BYTE> buffer(data, data + len);     // the SDK takes a non-const buffer
+    TTL_BYTE errorCode = 0;
+
+    if (!SDK_OK(AMI_UploadFileWriteBatch(handle, id, batch, buffer.data(), len, errorCode)))     return ERR_SDK_CALL;
+    *refused = errorCode;
+    return ERR_OK;
+}
+
+int SdkUpload::cancel(uint8_t id)
+{
+    return SDK_OK(AMI_UploadFileCancel(handle, id)) ? ERR_OK : ERR_SDK_CALL;
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param device:    device, from sdkScanDevices()
+* @return None.
+*/
+SdkInventory::SdkInventory(const SdkDevice &device)
+: handle(device.handle)
+, id(device.id)
+, opened(false)
+{
+}
+
+SdkInventory::~SdkInventory()
+{
+    close();
+}
+
+/**
+* @brief open: open the device
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkInventory::open(void)
+{
+    if (!SDK_OK(AMI_DeviceOpen(handle)))            return ERR_SDK_CALL;
+    opened = true;
+    return ERR_OK;
+}
+
+/**
+* @brief query: run the command of an item, store its fields
+*
+* @param item:      INVENTORY_INFO...
+* @param record:    receives the fields of the item
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkInventory::query(uint32_t item, InventoryRecord *record)
+{
+    switch (item)
+    {
+        case INVENTORY_INFO:
+        {
+            DeviceInfoC info;
+            memset(&info, 0, sizeof(info));
+            if (!SDK_OK(AMI_DeviceGetInfo(handle, info, 1)))    return ERR_SDK_CALL;
+            strncpy(record->productNumber, info.ProductNumber, sizeof(record->productNumber) - 1);
+            strncpy(record->serialNumber, info.SerialNumber, sizeof(record->serialNumber) - 1);
+            strncpy(record->firmwareVersion, info.FirmwareVersion, sizeof(record->firmwareVersion) - 1);
+            strncpy(record->subMcuVersion, info.SubMCUVersion, sizeof(record->subMcuVersion) - 1);
+            strncpy(record->hardwareVersion, info.HardwareVersion, sizeof(record->hardwareVersion) - 1);
+            record->productType = info.ProductType;
+            record->hardwareConfig = info.HardwareConfig;
+            return ERR_OK;
+        }
+        case INVENTORY_BATTERY:
+        {
+            BatteryStatus battery;
+            if (!SDK_OK(AMI_DeviceGetBatteryStatus(handle, battery)))   return ERR_SDK_CALL;
+            record->soc = battery.SOC;
+            record->voltage = battery.Voltage;
+            record->charging = battery.Charging ? 1 : 0;
+            return ERR_OK;
+        }
+        case INVENTORY_MEMORY:
+        {
+            SessionMemoryStatus memory;
+            if (!SDK_OK(AMI_DeviceGetSessionMemoryStatus(handle, memory)))  return ERR_SDK_CALL;
+            record->storageSize = memory.StorageSize;
+            record->freeSpace = memory.FreeSpace;
+            record->sessionCount = memory.SessionNum;
+            return ERR_OK;
+        }
+        case INVENTORY_ERROR_LOG:
+        {
+            TTL_UINT16 log[AMI_MAX_ERROR_TYPES];
+            memset(log, 0, sizeof(log));
+            if (!SDK_OK(AMI_DeviceGetErrorLog(handle, log)))    return ERR_SDK_CALL;
+            for (int e = 0; (e < AMI_MAX_ERROR_TYPES) && (e < INVENTORY_ERROR_TYPES); e++)     record->errorLog[e] = log[e];
+            return ERR_OK;
+        }
+        case INVENTORY_SELFTEST:
+        {
+            TTLDateTime date;
+            if (!SDK_OK(AMI_DeviceGetLastSelftestDate(handle, date)))   return ERR_SDK_CALL;
+            snprintf(record->selftestDate, sizeof(record->selftestDate), "%04u-%02u-%02u %02u:%02u:%02u",
+                date.year % 10000, date.month % 100, date.day % 100, date.hour % 100, date.minutes % 100, date.seconds % 100);
+            return ERR_OK;
+        }
+    }
+    return ERR_SDK_CALL;
+}
+
+/**
+* @brief close: close the device
+*
+* @return None.
+*/
+void SdkInventory::close(void)
+{
+    if (opened == false)    return;
+    AMI_DeviceClose(handle);
+    opened = false;
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param device:    device, from sdkScanDevices()
+* @param notch:     notch filter of the samples
+* @return None.
+*/
+SdkStream::SdkStream(const SdkDevice &device, TTL_NotchFrequency _notch)
+: handle(device.handle)
+, notch(_notch)
+, opened(false)
+, streaming(false)
+{
+}
+
+SdkStream::~SdkStream()
+{
+    stop();
+}
+
+/**
+* @brief start: open the device in computerized mode, raw samples, and start streaming
+*
+* @param channels:  receives the number of channels
+* @param rate:      receives the samples per second of each channel
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkStream::start(uint32_t *channels, uint32_t *rate)
+{
+    if (!SDK_OK(AMI_DeviceOpenConnection(handle, COMPUTERIZED, RAW, notch)))    return ERR_SDK_CALL;
+    opened = true;
+    if (!SDK_OK(AMI_DeviceStartStreaming(handle)))  return ERR_SDK_CALL;
+    streaming = true;
+    *channels = TTL_MAX_AMI_CHANNELS;
+    *rate = SAMPLING_RATE;
+    return ERR_OK;
+}
+
+/**
+* @brief available: number of samples waiting in the SDK
+*
+* @param counts:    receives the number of each channel (0 for the channels not in the mask)
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkStream::available(uint32_t *counts)
+{
+    TTL_BYTE mask = 0;
+    TTL_UINT32 waiting[TTL_MAX_AMI_CHANNELS] = { 0 };
+
+    if (!SDK_OK(AMI_DeviceAvailableSamples(handle, mask, waiting)))     return ERR_SDK_CALL;
+    for (uint32_t c = 0; (c < TTL_MAX_AMI_CHANNELS) && (c < ACQ_MAX_CHANNELS); c++)
+    {
+        counts[c] = (mask & (1 << c)) ? waiting[c] : 0;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief read: take the samples waiting on a channel. AMI_DeviceChannelData is given the
+*           room of the buffer and returns the number of samples copied.
+*
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int SdkStream::read(uint32_t channel, float *samples, uint32_t max, uint32_t *count)
+{
+    TTL_UINT32 n = max;
+
+    *count = 0;
+    if (!SDK_OK(AMI_DeviceChannelData(handle, (TTL_Channel)channel, n, samples)))   return ERR_SDK_CALL;
+    *count = (n < max) ? n : max;
+    return ERR_OK;
+}
+
+/**
+* @brief stop: stop streaming and close the device
+*
+* @return None.
+*/
+void SdkStream::stop(void)
+{
+    if (streaming)          AMI_DeviceStopStreaming(handle);
+    if (opened)             AMI_DeviceCloseConnection(handle);
+    streaming = false;
+    opened = false;
+}
+
+#endif // AMI_SDK
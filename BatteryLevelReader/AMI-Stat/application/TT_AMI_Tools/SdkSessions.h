@@ -0,0 +1,278 @@
+/*
+* SdkSessions.h : This file contains the access to the sessions stored in a device through the
+*               AMI SDK, for the session downloader and the session exporter, and to the samples
+*               streamed by a device, for the acquisition pipeline.
+*
+*   In a nutshell, this file implements:
+*       - the scan of the devices (sdkScanDevices)
+*       - SdkSessions: IStoredSessions on AMI_DeviceGetStoredSessionCount/Info,
+*           AMI_DeviceDownloadStoredSession (batches given to DOWNLOAD_CALLBACK),
+*           AMI_DeviceDownloadStoredSessionError (retry of one batch) and
+*           AMI_DeviceDownloadStoredSessionEnd
+*       - SdkExporter: ISessionExporter on AMI_BeginRecordedSessionsEnum/AMI_GetRecordedSessionInfo
+*           (listing of a folder of recorded sessions) and AMI_ExportRecordedSession (EXPORT_BGI,
+*           progress given to ExportProgressCallback)
+*       - SdkHeaders: ISessionHeaders on AMI_GetSessionFileInfo (header of a session file, for
+*           the session catalog)
+*       - SdkUpload: IUploadTarget on AMI_UploadFileStart, AMI_UploadFileWriteBatch and
+*           AMI_UploadFileCancel
+*       - SdkInventory: IInventoryDevice on AMI_DeviceGetInfo, AMI_DeviceGetBatteryStatus,
+*           AMI_DeviceGetSessionMemoryStatus, AMI_DeviceGetErrorLog and
+*           AMI_DeviceGetLastSelftestDate
+*       - SdkStream: ISampleSource on AMI_DeviceOpenConnection (computerized, raw samples),
+*           AMI_DeviceStartStreaming, AMI_DeviceAvailableSamples and AMI_DeviceChannelData
+*
+*   Only built with AMI_SDK defined (Win32 configurations, linked with amisdk/ami.lib).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SDKSESSIONS_H
+#define _SDKSESSIONS_H
+
+#ifdef AMI_SDK
+
+#include <map>
+#include <string>
+#include <vector>
+#include "ami.h"
+#include "Acquisition.h"
+#include "SessionDownload.h"
+#include "SessionExport.h"
+#include "SessionCatalog.h"
+#include "FileUpload.h"
+#include "FleetInventory.h"
+
+#define SDK_EXPORT_EXT          ".txt"      // Extension of the files exported by EXPORT_BGI
+
+typedef struct
+{
+    AMI_DEVICE_HANDLE handle;   // Handle of the device in the SDK
+    std::string id;             // Connection ID (serial port / bluetooth name)
+} SdkDevice;
+
+/**
+* @brief sdkScanDevices: initialize the SDK and list the devices available
+*
+* @param filter:    scan filter ("" for all devices)
+* @param devices:   receives the devices
+* @return ERR_OK or ERR_SDK_CALL
+*/
+int sdkScanDevices(const char *filter, std::vector<SdkDevice> *devices);
+
+/**
+* @brief sdkEnd: release the SDK
+*
+* @return None.
+*/
+void sdkEnd(void);
+
+
+class SdkSessions : public IStoredSessions
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param device:    device, from sdkScanDevices()
+    * @param format:    format of the sessions downloaded (RAW or RMS)
+    * @return None.
+    */
+    SdkSessions(const SdkDevice &device, TTL_EMGType format);
+    virtual ~SdkSessions();
+
+    /**
+    * @brief open: open the device and register the download callback
+    *
+    * @return ERR_OK or ERR_SDK_CALL
+    */
+    int open(void);
+
+    /**
+    * @brief close: close the device
+    *
+    * @return None.
+    */
+    void close(void);
+
+    const char *label(void)                                             { return name.c_str(); }
+    int count(uint16_t *count);
+    int info(uint16_t index, StoredSessionInfo *info);
+    int start(uint16_t index, StoredBatch_t fnct, void *ctx, uint32_t *batchCount);
+    int retry(uint32_t batch);
+    int end(void);
+
+private:
+    static void __stdcall downloadEntry(TTL_UINT32 batchNumber, const char *buffer, TTL_UINT32 bufferSize, void *param);
+
+    AMI_DEVICE_HANDLE handle;           // Handle of the device in the SDK
+    std::string name;                   // Label of the device, usable in a file name
+    TTL_EMGType format;                 // Format of the sessions downloaded
+    bool opened;                        // The device is open
+    StoredBatch_t fnct;                 // Function receiving the batches
+    void *ctx;                          // Its context
+};
+
+
+
+class SdkExporter : public ISessionExporter
+{
+public:
+    /**
+    * @brief list: list the recorded sessions of a folder. The SDK enumeration is not reentrant:
+    *           called from one thread only.
+    *
+    * @param folder:    folder of the sessions
+    * @param sources:   receives the sessions
+    * @return ERR_OK or ERR_SDK_CALL
+    */
+    int list(const char *folder, std::vector<ExportSource> *sources);
+
+    /**
+    * @brief exportFile: export one session in the BioGraph Infiniti format, the two first
+    *           channels (sensors of the session header)
+    *
+    * @return ERR_OK or ERR_SDK_CALL
+    */
+    int exportFile(const ExportSource &source, const char *path, ExportProgress_t fnct, void *ctx, uint32_t *samples);
+
+private:
+    typedef struct
+    {
+        ExportProgress_t fnct;
+        void *ctx;
+    } ProgressCtx;
+
+    static void __stdcall progressEntry(int percent, void *param);
+
+    std::map<std::string, std::pair<TTL_INT32, TTL_INT32> > sensors;  // Sensors of each session, from list()
+};
+
+
+
+class SdkHeaders : public ISessionHeaders
+{
+public:
+    int list(const char *folder, std::vector<CatalogFile> *files)      { return catalogListFolder(folder, files); }
+
+    /**
+    * @brief readHeader: read the header of a session file. AMI_GetSessionFileInfo only reads the
+    *           file given into the structure given (no enumeration state): called by the workers
+    *           at once.
+    *
+    * @return ERR_OK or ERR_SDK_CALL (not a session)
+    */
+    int readHeader(const char *path, SessionHeader *header);
+};
+
+
+
+class SdkUpload : public IUploadTarget
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param device:    device, from sdkScanDevices()
+    * @return None.
+    */
+    SdkUpload(const SdkDevice &device);
+    virtual ~SdkUpload();
+
+    /**
+    * @brief open: open the device
+    *
+    * @return ERR_OK or ERR_SDK_CALL
+    */
+    int open(void);
+
+    /**
+    * @brief close: close the device
+    *
+    * @return None.
+    */
+    void close(void);
+
+    const char *label(void)                                             { return name.c_str(); }
+    int start(uint8_t id, const char *name, uint32_t size, uint16_t batchCount, uint32_t cs);
+
+    /**
+    * @brief writeBatch: AMI_UploadFileWriteBatch, the batch number given: the batches may be
+    *           sent from many threads at once and acknowledged out of order
+    */
+    int writeBatch(uint8_t id, uint16_t batch, const uint8_t *data, uint16_t len, uint8_t *refused);
+    int cancel(uint8_t id);
+
+private:
+    AMI_DEVICE_HANDLE handle;           // Handle of the device in the SDK
+    std::string name;                   // Label of the device, usable in a file name
+    bool opened;                        // The device is open
+};
+
+
+
+class SdkInventory : public IInventoryDevice
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param device:    device, from sdkScanDevices()
+    * @return None.
+    */
+    SdkInventory(const SdkDevice &device);
+    virtual ~SdkInventory();
+
+    const char *label(void)                                             { return id.c_str(); }
+    int open(void);
+
+    /**
+    * @brief query: run the command of an item on the device handle, the commands of the other
+    *           items possibly in flight
+    *
+    * @return ERR_OK or ERR_SDK_CALL
+    */
+    int query(uint32_t item, InventoryRecord *record);
+    void close(void);
+
+private:
+    AMI_DEVICE_HANDLE handle;           // Handle of the device in the SDK
+    std::string id;                     // Connection ID
+    bool opened;                        // The device is open
+};
+
+
+
+class SdkStream : public ISampleSource
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param device:    device, from sdkScanDevices()
+    * @param notch:     notch filter of the samples
+    * @return None.
+    */
+    SdkStream(const SdkDevice &device, TTL_NotchFrequency notch);
+    virtual ~SdkStream();
+
+    int start(uint32_t *channels, uint32_t *rate);
+    int available(uint32_t *counts);
+
+    /**
+    * @brief read: take the samples waiting on a channel. AMI_DeviceChannelData is given the
+    *           room of the buffer and returns the number of samples copied.
+    */
+    int read(uint32_t channel, float *samples, uint32_t max, uint32_t *count);
+    void stop(void);
+
+private:
+    AMI_DEVICE_HANDLE handle;           // Handle of the device in the SDK
+    TTL_NotchFrequency notch;           // Notch filter of the samples
+    bool opened;                        // The device is open
+    bool streaming;                     // The device streams
+};
+
+#endif // AMI_SDK
+
+#endif // _SDKSESSIONS_H
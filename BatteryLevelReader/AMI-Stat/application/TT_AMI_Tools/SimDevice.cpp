@@ -0,0 +1,325 @@
+/*
+* SimDevice.cpp : This file contains the class simulating an AMI device at the end of a connection,
+*               to run the protocol engines in process without Bluetooth.
+*
+*   In a nutshell, this class implements:
+*       - the device side SLIP decoding of the requests and encoding of the answers
+*       - the update ("Q") and JSON ("A") channels and the heartbeats ("H")
+*       - the answers due at a time of the clock of the device, and the faults
+*       - the packets of the stream channel ("B")
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "SimDevice.h"
+#include "UpdateSession.h"
+#include "DeviceEvents.h"
+#include "StreamPacket.h"
+#include "ErrCodes.h"
+
+// SLIP special character codes (see Slip.h)
+#define SIM_SLIP_END            0xC0
+#define SIM_SLIP_ESC            0xDB
+#define SIM_SLIP_ESC_END        0xDC
+#define SIM_SLIP_ESC_ESC        0xDD
+
+/**
+* @brief simCrc32: CRC-32 (IEEE 802.3) of a buffer, as checked by the device at the end of an update
+*
+* @param data:      bytes
+* @param len:       number of bytes
+* @param crc:       CRC of the previous bytes (0 to start)
+* @return CRC of the bytes
+*/
+uint32_t simCrc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    static uint32_t table[256];
+    static bool tableReady = false;
+
+    if (tableReady == false)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)     c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+            table[i] = c;
+        }
+        tableReady = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param clock:     clock of the answer delays and of the waits in read()
+* @return None.
+*/
+SimDevice::SimDevice(IClock *_clock)
+: clock(_clock)
+, closing(false)
+, escape(false)
+, expectedCrc(0)
+, answers(0)
+, requests(0)
+, chunks(0)
+, eraseDelayMs(0)
+, chunkDelayMs(0)
+, crcDelayMs(0)
+, refuseEvery(0)
+, dropFirst(0)
+, dropCount(0)
+, heartbeatEvery(0)
+, soc(80)
+, voltage(3900)
+, charging(true)
+{
+    frame.reserve(SIM_FRAME_MAX);
+}
+
+/**
+* @brief reset: forget the image received and the pending answers (new connection)
+*
+* @param expectedCrc: CRC of the package, checked by the final update transaction
+* @return None.
+*/
+void SimDevice::reset(uint32_t _expectedCrc)
+{
+    closing = false;
+    escape = false;
+    frame.clear();
+    pending.clear();
+    rx.clear();
+    received.clear();
+    expectedCrc = _expectedCrc;
+    answers = 0;
+    requests = 0;
+    chunks = 0;
+}
+
+/**
+* @brief send: SLIP decode the bytes sent by the engine and answer the complete frames
+*
+* @return msgLen, ERR_SPP_CLOSING once closed
+*/
+int SimDevice::send(const uint8_t *msg, int msgLen)
+{
+    if (closing)            return ERR_SPP_CLOSING;
+
+    for (int i = 0; i < msgLen; i++)
+    {
+        uint8_t data = msg[i];
+        if (escape)
+        {
+            frame.push_back((data == SIM_SLIP_ESC_END) ? SIM_SLIP_END : SIM_SLIP_ESC);
+            escape = false;
+        }
+        else if (data == SIM_SLIP_ESC)      escape = true;
+        else if (data == SIM_SLIP_END)
+        {
+            if (frame.empty() == false)     frameReceived();
+        }
+        else if (frame.size() < SIM_FRAME_MAX)  frame.push_back(data);
+    }
+    return msgLen;
+}
+
+/**
+* @brief read: deliver the answer bytes sent, waiting on the clock for the next answer
+*
+* @return > 0 number of bytes, 0 when no answer is due within maxWaitTimeMs, ERR_SPP_CLOSING once closed
+*/
+int SimDevice::read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
+{
+    if (closing)            return ERR_SPP_CLOSING;
+
+    if (rx.empty())
+    {
+        int64_t now = clock->nowMs();
+        if (pending.empty() || (pending.front().dueMs > now + (int64_t)maxWaitTimeMs))
+        {
+            clock->sleepMs(maxWaitTimeMs);                          // nothing comes in time
+            return 0;
+        }
+        if (pending.front().dueMs > now)    clock->sleepMs((uint32_t)(pending.front().dueMs - now));
+        rx.insert(rx.end(), pending.front().bytes.begin(), pending.front().bytes.end());
+        pending.pop_front();
+    }
+
+    int nb = 0;
+    while ((nb < maxLen) && (rx.empty() == false))
+    {
+        retMsg[nb++] = rx.front();
+        rx.pop_front();
+    }
+    return nb;
+}
+
+/**
+* @brief frameReceived: process a complete request frame
+*
+* @return None.
+*/
+void SimDevice::frameReceived(void)
+{
+    const uint8_t *req = frame.data();
+    int len = (int)frame.size();
+    int index = requests++;
+
+    if ((index >= dropFirst) && (index < dropFirst + dropCount))   // left unanswered
+    {
+        frame.clear();
+        return;
+    }
+
+    if ((len >= CMD_UPDREQ_DATA) && (req[CHAN_OFF] == CHAN_UPDATE) && (req[CMD_OFF] == CMD_UPDREQ))
+    {
+        uint32_t offset = ((uint32_t)req[CMD_UPDREQ_OFFSET] << 24) | ((uint32_t)req[CMD_UPDREQ_OFFSET+1] << 16)
+                        | ((uint32_t)req[CMD_UPDREQ_OFFSET+2] << 8) | (uint32_t)req[CMD_UPDREQ_OFFSET+3];
+        int dataLen = len - CMD_UPDREQ_DATA;
+        uint8_t err = RESP_ERR_OK;
+        int delayMs = (received.empty() && (dataLen > 0)) ? eraseDelayMs : chunkDelayMs;
+
+        if (dataLen == 0)                                           // end of transfer: verify the image
+        {
+            if ((offset != received.size()) || (simCrc32(received.data(), received.size()) != expectedCrc))    err = RESP_ERR_CRCDWLD;
+            delayMs = crcDelayMs;
+        }
+        else if ((refuseEvery > 0) && ((++chunks % refuseEvery) == 0))     {}  // refused: the same offset is asked again
+        else if (offset == received.size())     received.insert(received.end(), req + CMD_UPDREQ_DATA, req + len);
+        // else: not the expected chunk, answer the offset expected
+
+        uint32_t next = (uint32_t)received.size();
+        uint8_t resp[CMD_UPDRESP_LEN] = { CHAN_UPDATE, CMD_UPDRESP, err,
+            (uint8_t)(next >> 24), (uint8_t)(next >> 16), (uint8_t)(next >> 8), (uint8_t)next };
+        answer(resp, sizeof(resp), delayMs);
+    }
+    else if ((len > 1) && (req[CHAN_OFF] == 'A'))
+    {
+        char text[512];
+        std::string json((const char *)req, len);
+        if (json.find("GetBatteryStatus") != std::string::npos)
+        {
+            snprintf(text, sizeof(text), SIM_BATTERY_ANSWER, soc, voltage, charging ? "true" : "false");
+            answer((const uint8_t *)text, (int)strlen(text), 0);
+        }
+        else if (json.find("GetDeviceInfo") != std::string::npos)   answer((const uint8_t *)SIM_DEVINFO_ANSWER, (int)strlen(SIM_DEVINFO_ANSWER), 0);
+    }
+    frame.clear();
+}
+
+/**
+* @brief answer: queue an answer, preceded by a heartbeat every Nth time
+*
+* @param data:      answer frame
+* @param len:       number of bytes
+* @param delayMs:   time before the answer is sent
+* @return None.
+*/
+void SimDevice::answer(const uint8_t *data, int len, int delayMs)
+{
+    static const uint8_t heartbeat[] = { DEVEVT_CHANNEL_HEARTBEAT, 0x01, 0x00 };
+    PendingAnswer pend;
+
+    pend.dueMs = clock->nowMs() + delayMs;
+    answers++;
+    if ((heartbeatEvery > 0) && ((answers % heartbeatEvery) == 0))     encode(&pend.bytes, heartbeat, sizeof(heartbeat));
+    encode(&pend.bytes, data, len);
+    pending.push_back(pend);
+}
+
+/**
+* @brief encode: SLIP encode a frame
+*
+* @param out:       receives the encoded frame, appended
+* @param data:      frame
+* @param len:       number of bytes
+* @return None.
+*/
+void SimDevice::encode(std::vector<uint8_t> *out, const uint8_t *data, int len)
+{
+    out->push_back(SIM_SLIP_END);
+    for (int i = 0; i < len; i++)
+    {
+        if (data[i] == SIM_SLIP_END)        { out->push_back(SIM_SLIP_ESC); out->push_back(SIM_SLIP_ESC_END); }
+        else if (data[i] == SIM_SLIP_ESC)   { out->push_back(SIM_SLIP_ESC); out->push_back(SIM_SLIP_ESC_ESC); }
+        else                                out->push_back(data[i]);
+    }
+    out->push_back(SIM_SLIP_END);
+}
+
+/**
+* @brief simStreamSample: sample of a record of the stream, a function of its index
+*
+* @param record:    index of the record
+* @param channel:   channel (0: ChannelA, 1: ChannelB)
+* @return The sample (the full range, the SLIP special bytes included)
+*/
+int16_t simStreamSample(uint32_t record, uint32_t channel)
+{
+    return (int16_t)(record * ((channel == 0) ? 40503u : 2654435761u) >> 8);
+}
+
+/**
+* @brief simStream: SLIP encoded bytes streamed by a device on the "B" channel
+*
+* @param shape:     records and faults of the stream
+* @param out:       receives the bytes, appended
+* @param kept:      receives the index of the records the parser must keep (optional)
+* @param counts:    receives the packets and faults generated
+* @return None.
+*/
+void simStream(const SimStreamShape &shape, std::vector<uint8_t> *out, std::vector<uint32_t> *kept, SimStreamCounts *counts)
+{
+    uint8_t packet[BSTREAM_PACKET_MAX];
+    uint32_t perPacket = ((shape.perPacket > 0) && (shape.perPacket <= BSTREAM_RECORDS_MAX)) ? shape.perPacket : BSTREAM_RECORDS_MAX;
+
+    memset(counts, 0, sizeof(*counts));
+    for (uint32_t first = 0; first < shape.records; first += perPacket)
+    {
+        uint32_t len = 0;
+        packet[len++] = BSTREAM_CHANNEL;
+        for (uint32_t r = first; (r < first + perPacket) && (r < shape.records); r++)
+        {
+            // the first and last records are always sent: a loss there would not show in the sequence
+            if ((shape.lostEvery > 0) && (r % shape.lostEvery == shape.lostEvery - 1) && (r > 0) && (r + 1 < shape.records))
+            {
+                counts->lost++;
+                continue;
+            }
+            uint8_t *rec = packet + len;
+            int16_t a = simStreamSample(r, 0);
+            int16_t b = simStreamSample(r, 1);
+            uint16_t mask = BSTREAM_HAS_A | BSTREAM_HAS_B;
+            rec[0] = (uint8_t)mask;         rec[1] = (uint8_t)(mask >> 8);
+            rec[2] = (uint8_t)a;            rec[3] = (uint8_t)((uint16_t)a >> 8);
+            rec[4] = (uint8_t)b;            rec[5] = (uint8_t)((uint16_t)b >> 8);
+            rec[6] = (uint8_t)r;
+            uint16_t sum = 0;
+            for (int i = 0; i < BSTREAM_RECORD_LEN - 2; i++)    sum = (uint16_t)(sum + rec[i]);
+
+            if ((shape.corruptEvery > 0) && (r % shape.corruptEvery == shape.corruptEvery - 1) && (r > 0) && (r + 1 < shape.records))
+            {
+                sum ^= 0x5A5A;
+                counts->corrupted++;
+            }
+            else if (kept != NULL)      kept->push_back(r);
+            rec[7] = (uint8_t)sum;          rec[8] = (uint8_t)(sum >> 8);
+            len += BSTREAM_RECORD_LEN;
+        }
+        SimDevice::encode(out, packet, (int)len);
+        counts->packets++;
+
+        if ((shape.otherEvery > 0) && (counts->packets % shape.otherEvery == 0))
+        {
+            SimDevice::encode(out, (const uint8_t *)SIM_DEVINFO_ANSWER, (int)strlen(SIM_DEVINFO_ANSWER));
+            counts->others++;
+        }
+    }
+}
@@ -0,0 +1,160 @@
+/*
+* SimDevice.h : This file contains the class simulating an AMI device at the end of a connection,
+*               to run the protocol engines in process without Bluetooth.
+*
+*   In a nutshell, this class implements:
+*       - an IComm decoding the SLIP frames sent by the engines and queueing SLIP encoded answers
+*       - the update channel ("Q"): each chunk at the expected offset is stored and acknowledged
+*           with the next offset, the final transaction checks the CRC of the image received
+*       - the JSON channel ("A"): GetBatteryStatus and GetDeviceInfo answers
+*       - heartbeats ("H") pushed before every Nth answer
+*       - the stream channel ("B"): simStream() builds the SLIP encoded packets streamed by a
+*           device, with records lost, corrupted checksums and frames of the other channels
+*       - faults: answer delays (flash erase, chunk, CRC), requests left unanswered, chunks
+*           refused (the device asks for the same offset again)
+*
+*   The answers are due at a time of the clock of the device (see DeadlineClock.h). read() waits
+*   on that clock for the next answer, or for maxWaitTimeMs when it is not due in time: with a
+*   SimClock, a 30 s timeout of the engine costs no real time.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SIMDEVICE_H
+#define _SIMDEVICE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "icomm.h"
+#include "DeadlineClock.h"
+
+#define SIM_FRAME_MAX           (64 * 1024)     // Largest frame accepted by the device
+#define SIM_BATTERY_ANSWER      "A{\"ID\":\"GetBatteryStatus\",\"Content\":{\"SOC\":%d,\"Voltage\":%d,\"Charging\":%s},\"Status\":0}"
+#define SIM_DEVINFO_ANSWER      "A{\"ID\":\"GetDeviceInfo\",\"Content\":{\"ProductNumber\":\"SA9000\",\"SerialNumber\":\"GA000028\"," \
+                                "\"ProductType\":1,\"HardwareConfig\":4,\"FirmwarePNumber\":\"TT9000\",\"FirmwareVersion\":\"1.26.0.0\"," \
+                                "\"HardwareVersion\":\"2.0.0\",\"ProtocolVersion\":\"1.0.0\"},\"Status\":0}"
+
+/**
+* @brief simCrc32: CRC-32 (IEEE 802.3) of a buffer, as checked by the device at the end of an update
+*
+* @param data:      bytes
+* @param len:       number of bytes
+* @param crc:       CRC of the previous bytes (0 to start)
+* @return CRC of the bytes
+*/
+uint32_t simCrc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+typedef struct
+{
+    uint32_t records;           // Records generated, lost and corrupted ones included
+    uint32_t perPacket;         // Records per packet (BSTREAM_RECORDS_MAX max)
+    uint32_t lostEvery;         // Every Nth record is not sent (0: none)
+    uint32_t corruptEvery;      // Every Nth record is sent with a wrong checksum (0: none)
+    uint32_t otherEvery;        // A JSON answer follows every Nth packet (0: none)
+} SimStreamShape;
+
+typedef struct
+{
+    uint32_t packets;           // Stream packets
+    uint32_t lost;              // Records not sent
+    uint32_t corrupted;         // Records with a wrong checksum
+    uint32_t others;            // Frames of the other channels
+} SimStreamCounts;
+
+/**
+* @brief simStreamSample: sample of a record of the stream, a function of its index
+*
+* @param record:    index of the record
+* @param channel:   channel (0: ChannelA, 1: ChannelB)
+* @return The sample
+*/
+int16_t simStreamSample(uint32_t record, uint32_t channel);
+
+/**
+* @brief simStream: SLIP encoded bytes streamed by a device on the "B" channel
+*
+* @param shape:     records and faults of the stream
+* @param out:       receives the bytes, appended
+* @param kept:      receives the index of the records the parser must keep (optional)
+* @param counts:    receives the packets and faults generated
+* @return None.
+*/
+void simStream(const SimStreamShape &shape, std::vector<uint8_t> *out, std::vector<uint32_t> *kept, SimStreamCounts *counts);
+
+
+class SimDevice : public IComm
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param clock:     clock of the answer delays and of the waits in read()
+    * @return None.
+    */
+    SimDevice(IClock *clock = systemClock());
+
+    /**
+    * @brief reset: forget the image received and the pending answers (new connection)
+    *
+    * @param expectedCrc: CRC of the package, checked by the final update transaction
+    * @return None.
+    */
+    void reset(uint32_t expectedCrc);
+
+    void setHeartbeatEvery(int frames)                                  { heartbeatEvery = frames; }
+    void setBattery(int _soc, int _voltage, bool _charging)             { soc = _soc; voltage = _voltage; charging = _charging; }
+    void setDelays(int eraseMs, int chunkMs, int crcMs)                { eraseDelayMs = eraseMs; chunkDelayMs = chunkMs; crcDelayMs = crcMs; }
+    void setRefuseEvery(int chunks)                                     { refuseEvery = chunks; }
+    const std::vector<uint8_t> &image(void) const                       { return received; }
+
+    /**
+    * @brief dropRequests: leave requests unanswered (device busy, frames lost)
+    *
+    * @param first:     index of the first request dropped, counted from reset()
+    * @param count:     number of requests dropped (0: none)
+    * @return None.
+    */
+    void dropRequests(int first, int count)                             { dropFirst = first; dropCount = count; }
+
+    void close(void)                                                    { closing = true; }
+    int send(const uint8_t *msg, int msgLen);
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs);
+
+    static void encode(std::vector<uint8_t> *out, const uint8_t *frame, int len);
+
+private:
+    void frameReceived(void);
+    void answer(const uint8_t *frame, int len, int delayMs);
+
+    typedef struct
+    {
+        int64_t dueMs;                  // Clock time when the answer is sent
+        std::vector<uint8_t> bytes;     // SLIP encoded answer (and heartbeat)
+    } PendingAnswer;
+
+    IClock *clock;                  // Clock of the delays
+    bool closing;                   // close() was called
+    std::vector<uint8_t> frame;     // Frame being decoded
+    bool escape;                    // Previous byte was SLIP_ESC
+    std::deque<PendingAnswer> pending;  // Answers not sent yet
+    std::deque<uint8_t> rx;         // SLIP encoded bytes sent, waiting to be read
+    std::vector<uint8_t> received;  // Image received on the update channel
+    uint32_t expectedCrc;           // CRC checked at the end of the update
+    int answers;                    // Number of answers sent
+    int requests;                   // Number of requests received
+    int chunks;                     // Number of chunks received
+    int eraseDelayMs;               // Delay of the answer to the first chunk (flash erase)
+    int chunkDelayMs;               // Delay of the answer to the other chunks
+    int crcDelayMs;                 // Delay of the answer to the final transaction (CRC check)
+    int refuseEvery;                // Every Nth chunk is refused (0: none)
+    int dropFirst;                  // First request left unanswered
+    int dropCount;                  // Number of requests left unanswered
+    int heartbeatEvery;             // A heartbeat precedes every Nth answer (0: none)
+    int soc;                        // Battery status answered
+    int voltage;
+    bool charging;
+};
+
+#endif // _SIMDEVICE_H
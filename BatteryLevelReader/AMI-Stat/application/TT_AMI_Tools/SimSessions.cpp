@@ -0,0 +1,155 @@
+/*
+* SimSessions.cpp : This file contains the class simulating the stored sessions of a device, to
+*               run the session downloader without the AMI SDK.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "SimSessions.h"
+#include "ErrCodes.h"
+
+/**
+* @brief simContent: byte of a simulated session
+*
+* @param session:   session index
+* @param offset:    offset in the session
+* @return The byte
+*/
+uint8_t simContent(uint16_t session, uint32_t offset)
+{
+    return (uint8_t)((offset * 31) ^ (offset >> 9) ^ (session * 7));
+}
+
+/**
+* @brief ctor: class constructor, starts the thread of the device
+*
+* @param label:     name of the device
+* @param sessions:  number of sessions stored
+* @param sessionBytes: size of each session
+* @return None.
+*/
+SimSessions::SimSessions(const char *label, uint16_t _sessions, uint32_t _sessionBytes)
+: name(label)
+, sessions(_sessions)
+, sessionBytes(_sessionBytes)
+, lostFaults(0)
+, errorFaults(0)
+, session(0)
+, fnct(NULL)
+, ctx(NULL)
+, delivering(false)
+, running(true)
+, sent(0)
+{
+    worker = std::thread(threadEntry, this);
+}
+
+SimSessions::~SimSessions()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        wake.notify_one();
+    }
+    if (worker.joinable())  worker.join();
+}
+
+int SimSessions::count(uint16_t *count)
+{
+    *count = sessions;
+    return ERR_OK;
+}
+
+int SimSessions::info(uint16_t index, StoredSessionInfo *info)
+{
+    (void)index;
+    info->size = sessionBytes;
+    info->deleted = false;
+    return ERR_OK;
+}
+
+/**
+* @brief start: queue every batch of a session
+*
+* @return ERR_OK
+*/
+int SimSessions::start(uint16_t index, StoredBatch_t _fnct, void *_ctx, uint32_t *batchCount)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    session = index;
+    fnct = _fnct;
+    ctx = _ctx;
+    *batchCount = (sessionBytes + SIM_BATCH_BYTES - 1) / SIM_BATCH_BYTES;
+    for (uint32_t b = 0; b < *batchCount; b++)      queue.push_back(b);
+    wake.notify_one();
+    return ERR_OK;
+}
+
+/**
+* @brief retry: send a batch again, before the batches still queued
+*
+* @return ERR_OK
+*/
+int SimSessions::retry(uint32_t batch)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push_front(batch);
+    wake.notify_one();
+    return ERR_OK;
+}
+
+/**
+* @brief end: stop sending. No batch is delivered once it returns.
+*
+* @return ERR_OK
+*/
+int SimSessions::end(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    queue.clear();
+    fnct = NULL;
+    while (delivering)      idle.wait(guard);
+    return ERR_OK;
+}
+
+void SimSessions::threadEntry(SimSessions *self)
+{
+    self->threadFunc();
+}
+
+/**
+* @brief threadFunc: deliver the queued batches
+*
+* @return None.
+*/
+void SimSessions::threadFunc(void)
+{
+    std::vector<uint8_t> data(SIM_BATCH_BYTES);
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true)
+    {
+        while (running && (queue.empty() || (fnct == NULL)))    wake.wait(guard);
+        if (running == false)       break;
+
+        uint32_t batch = queue.front();
+        queue.pop_front();
+        sent++;
+        bool lostBatch = (lostFaults > 0) && ((sent % lostFaults) == 0);
+        bool errorBatch = (errorFaults > 0) && ((sent % errorFaults) == 0);
+        if (lostBatch)              continue;
+
+        uint32_t offset = batch * SIM_BATCH_BYTES;
+        uint32_t len = (sessionBytes - offset < SIM_BATCH_BYTES) ? sessionBytes - offset : SIM_BATCH_BYTES;
+        for (uint32_t i = 0; i < len; i++)      data[i] = simContent(session, offset + i);
+
+        StoredBatch_t call = fnct;
+        void *callCtx = ctx;
+        delivering = true;
+        guard.unlock();
+        call(callCtx, batch, errorBatch ? NULL : data.data(), errorBatch ? 0 : len);
+        guard.lock();
+        delivering = false;
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,91 @@
+/*
+* SimSessions.h : This file contains the class simulating the stored sessions of a device, to
+*               run the session downloader without the AMI SDK.
+*
+*   In a nutshell, this class implements:
+*       - sessions of a given size, cut in batches delivered by a thread of the device (as the SDK
+*           does), the batches requested again served first
+*       - faults: every Nth batch lost, every Mth batch received in error
+*       - the content of the sessions, so that the files written can be checked (simContent())
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SIMSESSIONS_H
+#define _SIMSESSIONS_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SessionDownload.h"
+
+#define SIM_BATCH_BYTES         4096        // Bytes per batch
+
+/**
+* @brief simContent: byte of a simulated session
+*
+* @param session:   session index
+* @param offset:    offset in the session
+* @return The byte
+*/
+uint8_t simContent(uint16_t session, uint32_t offset);
+
+
+class SimSessions : public IStoredSessions
+{
+public:
+    /**
+    * @brief ctor: class constructor, starts the thread of the device
+    *
+    * @param label:     name of the device
+    * @param sessions:  number of sessions stored
+    * @param sessionBytes: size of each session
+    * @return None.
+    */
+    SimSessions(const char *label, uint16_t sessions, uint32_t sessionBytes);
+    virtual ~SimSessions();
+
+    /**
+    * @brief setFaults: make batches fail
+    *
+    * @param lostEvery: every Nth batch sent is lost (0: none)
+    * @param errorEvery: every Nth batch sent is received in error (0: none)
+    * @return None.
+    */
+    void setFaults(int lostEvery, int errorEvery)                      { lostFaults = lostEvery; errorFaults = errorEvery; }
+
+    const char *label(void)                                             { return name.c_str(); }
+    int count(uint16_t *count);
+    int info(uint16_t index, StoredSessionInfo *info);
+    int start(uint16_t index, StoredBatch_t fnct, void *ctx, uint32_t *batchCount);
+    int retry(uint32_t batch);
+    int end(void);
+
+private:
+    static void threadEntry(SimSessions *self);
+    void threadFunc(void);
+
+    std::string name;                   // Device name
+    uint16_t sessions;                  // Number of sessions
+    uint32_t sessionBytes;              // Size of each session
+    int lostFaults;                     // Every Nth batch is lost
+    int errorFaults;                    // Every Nth batch is received in error
+
+    std::mutex lock;                    // Protects everything below
+    std::condition_variable wake;       // Signaled when batches are queued, on end() and on stop
+    std::condition_variable idle;       // Signaled when the thread stops delivering
+    std::deque<uint32_t> queue;         // Batches to send
+    uint16_t session;                   // Session being downloaded
+    StoredBatch_t fnct;                 // Function receiving the batches
+    void *ctx;                          // Its context
+    bool delivering;                    // The thread is calling fnct
+    bool running;                       // The thread must keep running
+    uint32_t sent;                      // Batches sent
+    std::thread worker;                 // Thread of the device
+};
+
+#endif // _SIMSESSIONS_H
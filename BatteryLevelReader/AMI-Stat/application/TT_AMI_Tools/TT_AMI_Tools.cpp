@@ -0,0 +1,130 @@
+/*
+* TT_AMI_Tools.cpp : Entry point of the command line tools working on the AMI protocol engines
+*               without a device (capture replay, benchmarks...) and on the sessions of the devices.
+*
+*   In a nutshell, this file implements:
+*       - the table of the commands
+*       - the dispatch of "TT_AMI_Tools <command> [arguments]" to the command
+*
+*   The tools only use the portable sources of TT_AMI_Updater and TT_AMI_Telemetry (no Windows,
+*   no MFC) and also build on Linux, e.g.:
+*       g++ -std=c++14 -O2 -DAMI_TRACE -I../TT_AMI_Updater -I../TT_AMI_Telemetry *.cpp ../TT_AMI_Updater/Slip.cpp
+*           ../TT_AMI_Updater/WireCapture.cpp ../TT_AMI_Updater/UpdateSession.cpp
+*           ../TT_AMI_Updater/ProtocolMetrics.cpp ../TT_AMI_Updater/FlightRecorder.cpp
+*           ../TT_AMI_Updater/TraceBuffer.cpp ../TT_AMI_Updater/JsonFields.cpp
+*           ../TT_AMI_Updater/BatteryQuery.cpp ../TT_AMI_Updater/DeadlineClock.cpp
+*           ../TT_AMI_Updater/BatchWriter.cpp ../TT_AMI_Updater/SessionDownload.cpp
+*           ../TT_AMI_Updater/SessionExport.cpp ../TT_AMI_Updater/SessionColumns.cpp
+*           ../TT_AMI_Updater/SessionPyramid.cpp ../TT_AMI_Updater/Acquisition.cpp
+*           ../TT_AMI_Updater/SignalDsp.cpp ../TT_AMI_Updater/StreamPacket.cpp
+*           ../TT_AMI_Updater/SessionCatalog.cpp ../TT_AMI_Updater/FileUpload.cpp
+*           ../TT_AMI_Updater/FleetInventory.cpp ../TT_AMI_Updater/ChargeForecast.cpp
+*           ../TT_AMI_Updater/FileFolder.cpp
+*           ../TT_AMI_Telemetry/TelemetryCodec.cpp
+*           ../TT_AMI_Telemetry/TelemetryStore.cpp ../TT_AMI_Telemetry/BatteryHealth.cpp
+*           ../TT_AMI_Telemetry/FleetQuery.cpp ../TT_AMI_Telemetry/BatteryAnomaly.cpp
+*           -pthread -o TT_AMI_Tools
+*
+*   The Win32 configurations also define AMI_SDK and link amisdk/ami.lib: the download, export,
+*   stream, catalog, upload and inventory commands then reach the devices and the recorded sessions.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "ToolCommands.h"
+
+typedef int (*ToolCommand_t)(int argc, char **argv);
+
+typedef struct
+{
+    const char *name;           // Name typed on the command line
+    ToolCommand_t fnct;         // Function executing the command
+    const char *usage;          // Arguments and description
+} ToolEntry;
+
+static const ToolEntry tools[] =
+{
+    { "replay",     cmdReplay,      "<capture> [--realtime] [--iterations N] [--package file] [--json] [--trace file]\n"
+                                    "        Feed a capture file back through the SLIP and update protocol engines" },
+    { "trace",      cmdTrace,       "<trace> [--events]\n"
+                                    "        Decode a trace file: time per trace point, update session timelines" },
+    { "bench",      cmdBench,       "[--filter text] [--samples N] [--save file] [--baseline file] [--threshold pct]\n"
+                                    "        Benchmark the protocol engines against a simulated device, compare with a baseline" },
+    { "download",   cmdDownload,    "<folder> [--device id]... [--scan filter] [--format raw|rms] [--idle-ms N] [--retry-ms N]\n"
+                                    "        <folder> --sim N [--sessions N] [--size bytes] [--loss N] [--errors N] [--verify]\n"
+                                    "        Download the sessions stored in the devices (AMI SDK) or in simulated devices" },
+    { "export",     cmdExport,      "<sessions folder> <output folder> [--jobs N] [--force] [--quiet]\n"
+                                    "        <sessions folder> <output folder> --sim N [--size bytes] [--ms N] [--touch N]\n"
+                                    "        Export the recorded sessions of a folder in parallel (AMI SDK), skip those up to date" },
+    { "columns",    cmdColumns,     "import <file.amc> --raw <text> [--rms <text>] [--events <text>] [--skip N] [--rate Hz]\n"
+                                    "        sim|info|pyramid <file.amc>, read <file.amc> [--channel N] [--rms] [--from s] [--to s]\n"
+                                    "        view <file.amc> [--channel N] [--from s] [--to s] [--pixels N] [--check]\n"
+                                    "        Convert the exported sessions to the columnar format, read time ranges of it, draw\n"
+                                    "        viewports from its level of detail pyramid" },
+    { "stream",     cmdStream,      "--sim [--seconds N] [--channels N] [--rate Hz] [--packet N] [--speed X] [--ring N] [--slow ms]\n"
+                                    "        [--device id] [--scan filter] [--notch 0|50|60]\n"
+                                    "        Acquire streamed samples through the lock-free pipeline, report overruns and latency" },
+    { "dsp",        cmdDsp,         "check, rms <file.amc> [--channel N] [--notch 0|50|60] [--tolerance pct]\n"
+                                    "        Check the notch, RMS and decimation kernels against the scalar ones, and the RMS\n"
+                                    "        they compute against the RMS recorded in a session" },
+    { "packets",    cmdPackets,     "[--seconds N] [--loss N] [--corrupt N] [--other N] [--chunk bytes] [--frames]\n"
+                                    "        Decode a synthetic stream of binary \"B\" packets, check the samples and loss counters" },
+    { "catalog",    cmdCatalog,     "update <sessions folder> [--index file] [--jobs N] [--sim N [--ms N] [--touch N]]\n"
+                                    "        query <sessions folder> [--index file] [--patient id] [--serial sn] [--type N]\n"
+                                    "        [--from date] [--to date] [--all]\n"
+                                    "        Index the headers of the recorded sessions (new and changed files only), query them" },
+    { "upload",     cmdUpload,      "<file>... [--id N] [--name name] [--window N] [--batch bytes] [--manifest file] [--force]\n"
+                                    "        [--device id] [--scan filter] | --sim [--rtt ms] [--kbps N] [--errors N]\n"
+                                    "        Upload files to a device, batches pipelined, files the device holds skipped" },
+    { "inventory",  cmdInventory,   "collect <snapshot> [--parallel N] [--depth N] [--device id]... [--scan filter] [--quiet]\n"
+                                    "        collect <snapshot> --sim N [--connect ms] [--rtt ms] [--unreachable N]\n"
+                                    "        query <snapshot> [--serial sn] [--firmware version] [--battery-below pct]\n"
+                                    "        [--free-below pct] [--failed]\n"
+                                    "        Snapshot the versions, battery, memory and error logs of the devices, in parallel" },
+    { "health",     cmdHealth,      "report <store folder> [--serial sn] [--from date] [--to date] [--jobs N] [--new-rate pct/h]\n"
+                                    "        [--current mA] [--all] [--rows]\n"
+                                    "        sim <store folder> [--devices N] [--days N] [--period s] [--worn N]\n"
+                                    "        Estimate the battery capacity and resistance of the devices from the telemetry store,\n"
+                                    "        flag the packs draining faster than the fleet" },
+    { "query",      cmdQuery,       "telemetry <store folder> [--from date] [--to date] [options]\n"
+                                    "        updates <metrics file>... [--no-cache] [options]\n"
+                                    "        sim-updates <metrics file> [--rows N]\n"
+                                    "        options: [--where col<op>value]... [--group col|week(col),...] [--agg count|avg(col),...]\n"
+                                    "        [--order N] [--desc] [--limit N] [--jobs N]\n"
+                                    "        Filter, group and aggregate the battery telemetry or the update history of the fleet" },
+    { "anomaly",    cmdAnomaly,     "scan <store folder> [--serial sn] [--from date] [--to date] [--show N]\n"
+                                    "        sim [--devices N] [--hours N] [--period s] [--every h] [--threads N]\n"
+                                    "        Detect the battery anomalies (voltage sag, SOC jump, charge stall, sensor glitch)\n"
+                                    "        sample by sample, as the devices stream their telemetry" },
+    { "charge",     cmdCharge,      "eval <store folder> [--serial sn] [--from date] [--to date] [--target %] [--every min]\n"
+                                    "        Check the forecast of the time on the charger to reach the battery level of the\n"
+                                    "        update against the charges recorded in the telemetry store" },
+};
+
+/**
+* @brief usage: print the list of the commands
+*
+* @return process exit code
+*/
+static int usage(void)
+{
+    fprintf(stderr, "usage: TT_AMI_Tools <command> [arguments]\n\n");
+    for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++)
+    {
+        fprintf(stderr, "    %s %s\n", tools[i].name, tools[i].usage);
+    }
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)           return usage();
+
+    for (size_t i = 0; i < sizeof(tools) / sizeof(tools[0]); i++)
+    {
+        if (strcmp(argv[1], tools[i].name) == 0)    return tools[i].fnct(argc - 2, argv + 2);
+    }
+    return usage();
+}
@@ -0,0 +1,482 @@
+/*
+* ToolAnomaly.cpp : This file contains the "anomaly" command: live detection of the battery
+*               anomalies (voltage sag under load, SOC jumps, charge stalls, sensor glitches).
+*
+*   In a nutshell, this command:
+*       - scan: replays the samples of a telemetry store (Log\Telemetry) through the detection,
+*           device by device, as AMIStat would have raised the anomalies live
+*       - sim: streams a simulated fleet (--devices, a sample every --period seconds) into one
+*           BatteryAnomalyMonitor from several threads (--threads, as the COM ports of a station),
+*           injecting an anomaly of each type in turn every --every hours into every device.
+*           Prints, per type, the anomalies injected, detected, missed, the false alarms and
+*           the detection delay, then the samples fed per second.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ToolCommands.h"
+#include "BatteryAnomaly.h"
+#include "TelemetryStore.h"
+#include "SessionCatalog.h"
+#include "FileFolder.h"
+
+#define ANOMALY_SIM_DEVICES     300         // Default number of simulated devices
+#define ANOMALY_SIM_HOURS       96          // Default hours of stream
+#define ANOMALY_SIM_WARMUP_H    24          // No injection before (a cycle or two to learn the voltage)
+#define ANOMALY_SIM_PERIOD_S    60          // Default period of the samples
+#define ANOMALY_SIM_EVERY_H     6           // Default hours between two injections into a device
+#define ANOMALY_SIM_THREADS     4           // Default feeding threads
+#define ANOMALY_SIM_START_MS    1735689600000LL     // 2025-01-01 00:00 UTC
+#define ANOMALY_TYPES           (TLM_ANOMALY_SENSOR_GLITCH + 1)
+#define ANOMALY_SAG_MINUTES     20          // Length of an injected sag
+#define ANOMALY_STALL_MINUTES   90          // Length of an injected stall
+
+/**
+* Anomaly injected into a simulated device
+*/
+typedef struct
+{
+    int type;                   // TLM_ANOMALY_xxx
+    int64_t t;                  // Start (ms)
+    int64_t window;             // Detected if raised in [t, t + window]
+    bool detected;
+} SimInjection;
+
+/**
+* Simulated device: a pack discharged in use, then charged (constant current up to 80%, then
+* constant voltage), left on the charger a while, and again
+*/
+typedef struct
+{
+    char serial[TLM_SERIAL_LEN];
+    uint32_t seed;              // Random generator
+    double soc;                 // %
+    bool charging;
+    double useRate;             // SOC drop in use (% per hour)
+    double lowSoc;              // Charged from this SOC
+    int64_t unplugAt;           // Full: unplugged at this time
+    double load;                // Voltage drop in use (mV)
+    int next;                   // Next anomaly type to inject
+    int64_t nextAt;             // When the state of the device allows
+    int64_t sagUntil;           // Injected sag in progress
+    double sag;                 // Its depth (mV)
+    int64_t stallUntil;         // Injected stall in progress
+    std::vector<SimInjection> injections;
+    uint32_t falseAlarms[ANOMALY_TYPES];
+} SimDevice;
+
+/**
+* @brief simRandom: next number of a linear congruential generator
+*
+* @param state:     generator state, updated
+* @return A number in [0, 1)
+*/
+static double simRandom(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / 16777216.0;
+}
+
+/**
+* @brief simNoise: about normal noise (sum of uniforms), standard deviation 1
+*/
+static double simNoise(uint32_t *state)
+{
+    return (simRandom(state) + simRandom(state) + simRandom(state) + simRandom(state) - 2.0) * 1.732;
+}
+
+/**
+* @brief simStep: move a simulated device to a time and give its sample, injecting the anomalies
+*
+* @param dev:       device
+* @param t:         time of the sample (ms)
+* @param hours:     time since the previous sample (hours)
+* @param every:     time between two injections (ms)
+* @param sample:    filled with the sample
+* @return None.
+*/
+static void simStep(SimDevice *dev, int64_t t, double hours, int64_t every, TelemetrySample *sample)
+{
+    // Battery
+    if (t >= dev->stallUntil)
+    {
+        if (!dev->charging)
+        {
+            dev->soc -= dev->useRate * hours;
+            if (dev->soc <= dev->lowSoc)    dev->charging = true;
+        }
+        else if (dev->soc < 100.0)
+        {
+            dev->soc = std::min(100.0, dev->soc + ((dev->soc < 80.0) ? 30.0 : 8.0) * hours);
+            if (dev->soc >= 100.0)  dev->unplugAt = t + (int64_t)(simRandom(&dev->seed) * 3600000.0);
+        }
+        else if (t >= dev->unplugAt)
+        {
+            dev->charging = false;
+            dev->lowSoc = 15.0 + simRandom(&dev->seed) * 25.0;
+        }
+    }
+    double ocv = 3300.0 + 9.0 * dev->soc;
+    double voltage = dev->charging ? ocv + ((dev->soc < 80.0) ? 90.0 : 40.0) : ocv - dev->load;
+    voltage += simNoise(&dev->seed) * 3.0;
+    if ((t < dev->sagUntil) && !dev->charging)  voltage -= dev->sag;       // (a sag under load)
+    int soc = (int)dev->soc;
+
+    // Next injection, once the device is in a state where it shows
+    if (t >= dev->nextAt)
+    {
+        SimInjection inj;
+        inj.type = dev->next;
+        inj.t = t;
+        inj.detected = false;
+        inj.window = 0;
+        if ((inj.type == TLM_ANOMALY_VOLTAGE_SAG) && !dev->charging && (dev->soc > 30.0))
+        {
+            dev->sagUntil = t + ANOMALY_SAG_MINUTES * 60000LL;
+            dev->sag = 50.0 + simRandom(&dev->seed) * 100.0;
+            voltage -= dev->sag;
+            inj.window = ANOMALY_SAG_MINUTES * 60000LL;
+        }
+        else if ((inj.type == TLM_ANOMALY_SOC_JUMP) && !dev->charging && (dev->soc > 40.0))
+        {
+            dev->soc -= 15.0;
+            soc = (int)dev->soc;
+            inj.window = 10 * 60000LL;
+        }
+        else if ((inj.type == TLM_ANOMALY_CHARGE_STALL) && dev->charging && (dev->soc < 70.0))
+        {
+            dev->stallUntil = t + ANOMALY_STALL_MINUTES * 60000LL;
+            inj.window = ANOMALY_STALL_MINUTES * 60000LL;
+        }
+        else if (inj.type == TLM_ANOMALY_SENSOR_GLITCH)
+        {
+            double u = simRandom(&dev->seed);
+            if (u < 0.33)       soc = 255;
+            else if (u < 0.66)  soc = (soc > 50) ? soc - 30 : soc + 30;
+            else                voltage -= 400.0;
+            inj.window = 10 * 60000LL;
+        }
+        if (inj.window != 0)
+        {
+            dev->injections.push_back(inj);
+            dev->next = (dev->next % TLM_ANOMALY_SENSOR_GLITCH) + 1;
+            dev->nextAt = t + every;
+        }
+    }
+
+    memset(sample, 0, sizeof(*sample));
+    memcpy(sample->serial, dev->serial, TLM_SERIAL_LEN);
+    sample->timestamp = t;
+    sample->soc = (uint8_t)std::max(0, std::min(255, soc));
+    sample->voltage = (uint16_t)std::max(0.0, voltage);
+    sample->charging = dev->charging ? 1 : 0;
+}
+
+/**
+* @brief simCheck: match an anomaly raised against the injections of its device
+*
+* @param dev:       device
+* @param a:         anomaly raised
+* @param delays:    delay of the detections, summed per type (ms)
+* @return None.
+*/
+static void simCheck(SimDevice *dev, const BatteryAnomaly &a, double *delays)
+{
+    for (size_t i = 0; i < dev->injections.size(); i++)
+    {
+        SimInjection &inj = dev->injections[i];
+        if ((inj.type == a.type) && !inj.detected && (a.timestamp >= inj.t) && (a.timestamp <= inj.t + inj.window))
+        {
+            inj.detected = true;
+            delays[a.type] += (double)(a.timestamp - inj.t);
+            return;
+        }
+    }
+    dev->falseAlarms[a.type]++;
+}
+
+/**
+* Stream of a simulated fleet, fed from several threads
+*/
+class AnomalySim
+{
+public:
+    AnomalySim(std::vector<SimDevice> &_devices, int64_t _samples, int64_t _periodMs, int64_t _everyMs)
+    : fed(0)
+    , devices(_devices)
+    , samples(_samples)
+    , periodMs(_periodMs)
+    , everyMs(_everyMs)
+    {
+        memset(delays, 0, sizeof(delays));
+    }
+
+    void run(unsigned threads)
+    {
+        std::vector<std::thread> workers;
+        std::vector<std::vector<double> > workerDelays(threads, std::vector<double>(ANOMALY_TYPES, 0.0));
+        for (unsigned w = 0; w < threads; w++)  workers.push_back(std::thread(workerEntry, this, w, threads, workerDelays[w].data()));
+        for (size_t w = 0; w < workers.size(); w++)     workers[w].join();
+        for (unsigned w = 0; w < threads; w++)
+        {
+            for (int k = 0; k < ANOMALY_TYPES; k++)     delays[k] += workerDelays[w][k];
+        }
+    }
+
+    BatteryAnomalyMonitor monitor;
+    double delays[ANOMALY_TYPES];           // Detection delays summed per type (ms)
+    std::atomic<uint64_t> fed;              // Samples fed
+
+private:
+    static void workerEntry(AnomalySim *self, unsigned first, unsigned step, double *delays)
+    {
+        self->workerFunc(first, step, delays);
+    }
+
+    // Feed the devices first, first + step, ... sample after sample, as their COM port threads would
+    void workerFunc(unsigned first, unsigned step, double *delays)
+    {
+        TelemetrySample sample;
+        BatteryAnomaly events[ANOMALY_MAX_EVENTS];
+        uint64_t count = 0;
+
+        for (int64_t k = 0; k < samples; k++)
+        {
+            int64_t t = ANOMALY_SIM_START_MS + k * periodMs;
+            for (size_t d = first; d < devices.size(); d += step)
+            {
+                simStep(&devices[d], t, periodMs / 3600000.0, everyMs, &sample);
+                int n = monitor.feed(sample, events);
+                for (int i = 0; i < n; i++)     simCheck(&devices[d], events[i], delays);
+                count++;
+            }
+        }
+        fed += count;
+    }
+
+    std::vector<SimDevice> &devices;
+    int64_t samples;                        // Samples per device
+    int64_t periodMs;                       // Period of the samples
+    int64_t everyMs;                        // Time between two injections into a device
+};
+
+/**
+* @brief anomalySim: "anomaly sim"
+*
+* @return process exit code (1: an anomaly type detected less than 90% of the times)
+*/
+static int anomalySim(int argc, char **argv)
+{
+    int devices = ANOMALY_SIM_DEVICES;
+    int hours = ANOMALY_SIM_HOURS;
+    int period = ANOMALY_SIM_PERIOD_S;
+    int every = ANOMALY_SIM_EVERY_H;
+    int threads = ANOMALY_SIM_THREADS;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--devices") == 0) && (i + 1 < argc))        devices = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--hours") == 0) && (i + 1 < argc))     hours = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--period") == 0) && (i + 1 < argc))    period = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--every") == 0) && (i + 1 < argc))     every = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))   threads = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "anomaly: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((devices < 1) || (hours < 1) || (period < 1) || (every < 1) || (threads < 1))
+    {
+        fprintf(stderr, "usage: anomaly sim [--devices N] [--hours N] [--period s] [--every h] [--threads N]\n");
+        return 2;
+    }
+
+    std::vector<SimDevice> fleet(devices);
+    uint32_t seed = 4242;
+    for (int d = 0; d < devices; d++)
+    {
+        SimDevice &dev = fleet[d];
+        snprintf(dev.serial, sizeof(dev.serial), "SIM%05d", d);
+        dev.seed = seed + d * 7919u;
+        dev.soc = 30.0 + simRandom(&dev.seed) * 70.0;
+        dev.charging = false;
+        dev.useRate = 6.0 + simRandom(&dev.seed) * 6.0;
+        dev.lowSoc = 15.0 + simRandom(&dev.seed) * 25.0;
+        dev.unplugAt = 0;
+        dev.load = 40.0 + simRandom(&dev.seed) * 40.0;
+        dev.next = TLM_ANOMALY_VOLTAGE_SAG;
+        dev.nextAt = ANOMALY_SIM_START_MS + ANOMALY_SIM_WARMUP_H * 3600000LL + (int64_t)(simRandom(&dev.seed) * every * 3600000.0);
+        dev.sagUntil = 0;
+        dev.sag = 0.0;
+        dev.stallUntil = 0;
+        memset(dev.falseAlarms, 0, sizeof(dev.falseAlarms));
+    }
+
+    int64_t samples = (int64_t)hours * 3600 / period;
+    int64_t end = ANOMALY_SIM_START_MS + samples * period * 1000LL;
+    AnomalySim sim(fleet, samples, period * 1000LL, every * 3600000LL);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    sim.run((unsigned)std::min(threads, devices));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int result = 0;
+    printf("%-14s %9s %9s %9s %9s %11s\n", "anomaly", "injected", "detected", "missed", "false", "delay min");
+    for (int k = TLM_ANOMALY_VOLTAGE_SAG; k < ANOMALY_TYPES; k++)
+    {
+        uint32_t injected = 0, detected = 0, falseAlarms = 0;
+        for (int d = 0; d < devices; d++)
+        {
+            for (size_t i = 0; i < fleet[d].injections.size(); i++)
+            {
+                const SimInjection &inj = fleet[d].injections[i];
+                if ((inj.type != k) || (inj.t + inj.window > end))  continue;     // Cut by the end of the stream
+                injected++;
+                if (inj.detected)   detected++;
+            }
+            falseAlarms += fleet[d].falseAlarms[k];
+        }
+        printf("%-14s %9u %9u %9u %9u %11.1f\n", anomalyName(k), injected, detected, injected - detected, falseAlarms,
+            detected ? sim.delays[k] / detected / 60000.0 : 0.0);
+        if (detected < injected * 0.9)  result = 1;
+    }
+    uint64_t fed = sim.fed;
+    printf("devices  %zu monitored  %zu bytes of state each\n", sim.monitor.deviceCount(), BatteryAnomalyMonitor::stateBytes());
+    printf("feed     %llu samples  %.2f s  %.2f M samples/s  %.0f ns/sample  %d threads\n", (unsigned long long)fed, seconds,
+        fed / seconds / 1e6, seconds * 1e9 / fed, std::min(threads, devices));
+    return result;
+}
+
+/**
+* @brief formatDate: format a time of the store
+*
+* @param ms:        ms since the epoch
+* @param text:      receives "YYYY-MM-DD hh:mm:ss" (UTC)
+* @param size:      size of text
+* @return text
+*/
+static const char *formatDate(int64_t ms, char *text, size_t size)
+{
+    time_t t = (time_t)(ms / 1000);
+    struct tm *tm = gmtime(&t);
+
+    if (tm == NULL)     snprintf(text, size, "%lld", (long long)ms);
+    else                strftime(text, size, "%Y-%m-%d %H:%M:%S", tm);
+    return text;
+}
+
+/**
+* @brief anomalyScan: "anomaly scan"
+*
+* @return process exit code (1: store not readable)
+*/
+static int anomalyScan(const char *folder, int argc, char **argv)
+{
+    const char *serial = NULL;
+    int64_t from = INT64_MIN / 1000;
+    int64_t to = INT64_MAX / 1000;
+    int show = 20;
+    bool valid = true;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--serial") == 0) && (i + 1 < argc))         serial = argv[++i];
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))      valid = valid && catalogParseDate(argv[++i], &from);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))        valid = valid && catalogParseDate(argv[++i], &to);
+        else if ((strcmp(argv[i], "--show") == 0) && (i + 1 < argc))      show = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "anomaly: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((valid == false) || (show < 0))
+    {
+        fprintf(stderr, "usage: anomaly scan <store folder> [--serial sn] [--from YYYY-MM-DD[ hh:mm]] [--to YYYY-MM-DD[ hh:mm]] [--show N]\n");
+        return 2;
+    }
+    from *= 1000;
+    to = (to == INT64_MAX / 1000) ? INT64_MAX : to * 1000;
+
+    if (folderExists(folder) == false)
+    {
+        fprintf(stderr, "anomaly: %s: %s\n", folder, strerror(errno));
+        return 1;
+    }
+    TelemetryStore store;
+    if (store.open(folder) != TLM_OK)
+    {
+        fprintf(stderr, "anomaly: %s: cannot open the store\n", folder);
+        return 1;
+    }
+    std::vector<std::string> serials;
+    if (serial != NULL)     serials.push_back(serial);
+    else                    store.serials(serials);
+    std::sort(serials.begin(), serials.end());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<TelemetrySample> samples;
+    BatteryAnomaly events[ANOMALY_MAX_EVENTS];
+    uint32_t counts[ANOMALY_TYPES] = { 0 };
+    uint64_t scanned = 0;
+    int shown = 0;
+    for (size_t d = 0; d < serials.size(); d++)
+    {
+        samples.clear();
+        if (store.query(serials[d].c_str(), from, to, samples) != TLM_OK)
+        {
+            fprintf(stderr, "anomaly: %s: damaged blocks skipped\n", serials[d].c_str());
+        }
+        BatteryAnomalyMonitor monitor;
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            int n = monitor.feed(samples[i], events);
+            for (int k = 0; k < n; k++)
+            {
+                counts[events[k].type]++;
+                if (shown++ >= show)    continue;
+                char date[32];
+                printf("%-16s %s  %-13s value %8.1f  expected %8.1f  score %6.1f\n", events[k].serial,
+                    formatDate(events[k].timestamp, date, sizeof(date)),
+                    anomalyName(events[k].type), events[k].value, events[k].expected, events[k].score);
+            }
+        }
+        scanned += samples.size();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    for (int k = TLM_ANOMALY_VOLTAGE_SAG; k < ANOMALY_TYPES; k++)   printf("%-13s %u\n", anomalyName(k), counts[k]);
+    printf("scan     %zu devices  %llu samples  %.0f ms\n", serials.size(), (unsigned long long)scanned, ms);
+    return 0;
+}
+
+/**
+* @brief cmdAnomaly: detect the battery anomalies in a telemetry store, or in a simulated
+*           fleet streamed live
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdAnomaly(int argc, char **argv)
+{
+    if ((argc >= 1) && (strcmp(argv[0], "sim") == 0))    return anomalySim(argc - 1, argv + 1);
+    if ((argc < 2) || (argv[1][0] == '-') || (strcmp(argv[0], "scan") != 0))
+    {
+        fprintf(stderr, "usage: anomaly scan <store folder> [options] | anomaly sim [options]\n");
+        return 2;
+    }
+    return anomalyScan(argv[1], argc - 2, argv + 2);
+}
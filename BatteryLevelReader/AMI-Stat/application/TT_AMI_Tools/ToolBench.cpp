@@ -0,0 +1,698 @@
+/*
+* ToolBench.cpp : This file contains the "bench" command: micro benchmarks of the protocol engines
+*               run in process, without a device.
+*
+*   In a nutshell, this command:
+*       - times the SLIP encoding and decoding, the JSON response parsing, the package chunking
+*           and CRC, and complete update and battery poll sessions against SimDevice
+*       - times the signal processing kernels (SignalDsp.h) on one second of raw signal, with
+*           the vectorized kernels and with the scalar ones (.scalar)
+*       - times the decoding of the binary stream packets ("B" channel), deframed in place
+*       - times the timeout, retry and recovery scenarios on a simulated clock (SimClock): the
+*           30 s erase and CRC waits, 2 s chunk and 10 s battery timeouts cost no real time
+*       - calibrates each benchmark to run at least BENCH_MIN_BATCH_NS per sample and reports
+*           the median time per operation over the samples
+*       - saves the results as a baseline file (--save) and compares a run with a baseline
+*           (--baseline), flagging the benchmarks slower than the threshold: the exit code is 1
+*           when one of them regressed, so that a build script can gate on it
+*
+*   Baseline file: one "<benchmark> <ns per operation>" line per benchmark, '#' starts a comment.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "SimDevice.h"
+#include "Slip.h"
+#include "UpdateSession.h"
+#include "BatteryQuery.h"
+#include "JsonFields.h"
+#include "ProtocolMetrics.h"
+#include "SignalDsp.h"
+#include "StreamPacket.h"
+#include "DeadlineClock.h"
+#include "ErrCodes.h"
+
+#define BENCH_MIN_BATCH_NS      10000000    // Minimum duration of a sample (10 ms)
+#define BENCH_DEFAULT_SAMPLES   11          // Samples per benchmark, the median is reported
+#define BENCH_DEFAULT_THRESHOLD 10.0        // Slowdown (%) flagged as a regression
+#define BENCH_PACKAGE_LEN       (1024 * 1024)   // Package chunked and CRCed
+#define BENCH_SESSION_LEN       (256 * 1024)    // Package transferred by session.update
+#define BENCH_DECODE_FRAMES     64          // Frames in the slip.decode stream
+#define BENCH_SCENARIO_LEN      (16 * 1024)     // Package transferred by the scenarios
+#define BENCH_DSP_SAMPLES       DSP_RAW_RATE    // Samples per channel processed by a dsp operation (1 s)
+#define BENCH_STREAM_RECORDS    2048        // Records of the stream.parse stream (1 s)
+#define BENCH_BLUETOOTH_WAIT_MS 20000       // Wait before reconnecting after a timeout (BLUETOOTH_TIMEOUT of DeviceUpdate)
+
+typedef struct BenchContext BenchContext;
+
+/**
+  * @brief Signature of a benchmark: run the operation a number of times
+  *
+  * @param bench:       shared data of the benchmarks
+  * @param iterations:  number of operations to run
+  * @return         false if an operation failed
+  */
+typedef bool (*BenchFnct_t) (BenchContext *bench, int iterations);
+
+typedef struct
+{
+    const char *name;           // Name printed and stored in the baseline
+    BenchFnct_t fnct;           // Function running the operations
+    int bytesPerOp;             // Bytes processed per operation, for the throughput (0: none)
+} BenchEntry;
+
+/**
+* @brief SinkComm: connection dropping everything sent, for the encoding benchmark
+*/
+class SinkComm : public IComm
+{
+public:
+    void close(void)                                                    {}
+    int send(const uint8_t *msg, int msgLen)                            { (void)msg; return msgLen; }
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)       { (void)retMsg; (void)maxLen; (void)maxWaitTimeMs; return 0; }
+};
+
+/**
+* @brief LoopComm: connection delivering the same SLIP encoded stream over and over, for the
+*               decoding benchmark
+*/
+class LoopComm : public IComm
+{
+public:
+    LoopComm() : pos(0)                                                 {}
+
+    void close(void)                                                    {}
+    int send(const uint8_t *msg, int msgLen)                            { stream.insert(stream.end(), msg, msg + msgLen); return msgLen; }
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
+    {
+        (void)maxWaitTimeMs;
+        int nb = std::min(maxLen, (int)(stream.size() - pos));
+        memcpy(retMsg, stream.data() + pos, nb);
+        pos += nb;
+        if (pos == stream.size())       pos = 0;
+        return nb;
+    }
+
+private:
+    std::vector<uint8_t> stream;    // Encoded frames
+    size_t pos;                     // Next byte delivered
+};
+
+struct BenchContext
+{
+    BenchContext() : simDevice(&simClock)                               {}
+
+    std::vector<uint8_t> package;   // Pseudo random package (SLIP special characters included)
+    uint32_t packageCrc;            // CRC of the first BENCH_SESSION_LEN bytes
+    uint32_t scenarioCrc;           // CRC of the first BENCH_SCENARIO_LEN bytes
+    std::string batteryJson;        // Battery status answer
+    std::string deviceInfoJson;     // Device info answer
+    SinkComm sink;
+    LoopComm loop;
+    SimDevice device;               // Device answering at once, on the real clock
+    SimClock simClock;              // Simulated time of the scenarios
+    SimDevice simDevice;            // Device of the scenarios, on the simulated clock
+    std::vector<float> signal[DSP_MAX_CHANNELS];    // Raw signal of the dsp benchmarks
+    std::vector<float> work[DSP_MAX_CHANNELS];      // Samples filtered in place by dsp.notch
+    std::vector<float> dspOut;      // Outputs of dsp.rms and dsp.decimate
+    std::vector<uint8_t> stream;    // SLIP encoded "B" packets of stream.parse
+    std::vector<uint8_t> streamWork;    // Copy decoded in place
+    volatile uint32_t keep;         // Results kept alive so that the compiler does not drop the work
+};
+
+/**
+* @brief benchSlipEncode: frame a full update request
+*/
+static bool benchSlipEncode(BenchContext *bench, int iterations)
+{
+    uint8_t frame[CMD_UPDREQ_MAXLEN];
+    int len = UpdateSession::buildRequest(frame, 0, bench->package.data(), CMD_UPDREQ_MAXDATALEN);
+    Slip slip(&bench->sink);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (slip.send(frame, len) != len)       return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchSlipDecode: decode full update requests
+*/
+static bool benchSlipDecode(BenchContext *bench, int iterations)
+{
+    uint8_t frame[CMD_UPDREQ_MAXLEN + 1];      // Slip needs room for one more byte than the frame
+    Slip slip(&bench->loop);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if (slip.read(frame, sizeof(frame), UPDATE_CHUNK_TIMEOUT_MS) != CMD_UPDREQ_MAXLEN)     return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchJsonBattery: parse the fields of a battery status answer
+*/
+static bool benchJsonBattery(BenchContext *bench, int iterations)
+{
+    const char *json = bench->batteryJson.c_str();
+    float soc, voltage;
+    bool charging;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if ((jsonGetNumber(json, "\"SOC\"", &soc) == false) || (jsonGetNumber(json, "\"Voltage\"", &voltage) == false) ||
+            (jsonGetBool(json, "\"Charging\"", &charging) == false))
+            return false;
+        bench->keep += (uint32_t)soc + (uint32_t)voltage + charging;
+    }
+    return true;
+}
+
+/**
+* @brief benchJsonDeviceInfo: parse the fields of a device info answer used by the updater
+*/
+static bool benchJsonDeviceInfo(BenchContext *bench, int iterations)
+{
+    const char *json = bench->deviceInfoJson.c_str();
+    std::string serial, firmware, product;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        if ((jsonGetString(json, "\"SerialNumber\"", &serial) == false) || (jsonGetString(json, "\"FirmwareVersion\"", &firmware) == false) ||
+            (jsonGetString(json, "\"ProductNumber\"", &product) == false))
+            return false;
+        bench->keep += (uint32_t)(serial.size() + firmware.size() + product.size());
+    }
+    return true;
+}
+
+/**
+* @brief benchPackageChunk: format the update requests of a whole package
+*/
+static bool benchPackageChunk(BenchContext *bench, int iterations)
+{
+    uint8_t frame[CMD_UPDREQ_MAXLEN];
+    const uint8_t *data = bench->package.data();
+    int total = (int)bench->package.size();
+
+    for (int i = 0; i < iterations; i++)
+    {
+        for (int offset = 0; offset < total; offset += CMD_UPDREQ_MAXDATALEN)
+        {
+            int len = UpdateSession::buildRequest(frame, offset, data + offset, std::min(CMD_UPDREQ_MAXDATALEN, total - offset));
+            bench->keep += frame[len - 1];
+        }
+    }
+    return true;
+}
+
+/**
+* @brief benchPackageCrc: CRC of a whole package
+*/
+static bool benchPackageCrc(BenchContext *bench, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        bench->keep += simCrc32(bench->package.data(), bench->package.size());
+    }
+    return true;
+}
+
+/**
+* @brief benchSessionUpdate: complete update session, the device checking the CRC at the end
+*/
+static bool benchSessionUpdate(BenchContext *bench, int iterations)
+{
+    for (int i = 0; i < iterations; i++)
+    {
+        bench->device.reset(bench->packageCrc);
+        Slip slip(&bench->device);
+        UpdateSession session(&slip);
+        if (session.run(bench->package.data(), BENCH_SESSION_LEN, NULL, NULL) != ERR_OK)    return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchSessionBattery: battery status poll, heartbeats pushed before the answers
+*/
+static bool benchSessionBattery(BenchContext *bench, int iterations)
+{
+    BatteryReading reading;
+
+    bench->device.reset(0);
+    Slip slip(&bench->device);
+    for (int i = 0; i < iterations; i++)
+    {
+        BatteryQuery query(&slip);
+        if (query.run(&reading, NULL, NULL) != ERR_OK)      return false;
+        bench->keep += reading.soc;
+    }
+    return true;
+}
+
+/**
+* @brief scenarioUpdate: update session of a scenario, on the simulated clock
+*
+* @param bench:     shared data
+* @param elapsedMs: receives the simulated duration of the session
+* @return The result of the session
+*/
+static int scenarioUpdate(BenchContext *bench, int64_t *elapsedMs)
+{
+    int64_t start = bench->simClock.nowMs();
+    bench->simDevice.reset(bench->scenarioCrc);
+
+    Slip slip(&bench->simDevice);
+    slip.setClock(&bench->simClock);
+    UpdateSession session(&slip);
+    int err = session.run(bench->package.data(), BENCH_SCENARIO_LEN, NULL, NULL);
+
+    *elapsedMs = bench->simClock.nowMs() - start;
+    return err;
+}
+
+/**
+* @brief benchScenarioTimeout: the device leaves a chunk unanswered, the session times out
+*/
+static bool benchScenarioTimeout(BenchContext *bench, int iterations)
+{
+    int64_t elapsedMs;
+
+    bench->simDevice.setDelays(0, 0, 0);
+    bench->simDevice.setRefuseEvery(0);
+    bench->simDevice.dropRequests(3, 1);
+    for (int i = 0; i < iterations; i++)
+    {
+        if (scenarioUpdate(bench, &elapsedMs) != ERR_SLIP_TIMEOUT)     return false;
+        if (elapsedMs < UPDATE_CHUNK_TIMEOUT_MS)                        return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchScenarioRetry: long flash erase and CRC check, every 4th chunk asked again
+*/
+static bool benchScenarioRetry(BenchContext *bench, int iterations)
+{
+    int64_t elapsedMs;
+
+    bench->simDevice.setDelays(UPDATE_FIRST_TIMEOUT_MS - 5000, 50, UPDATE_CRC_TIMEOUT_MS - 5000);
+    bench->simDevice.setRefuseEvery(4);
+    bench->simDevice.dropRequests(0, 0);
+    for (int i = 0; i < iterations; i++)
+    {
+        if (scenarioUpdate(bench, &elapsedMs) != ERR_OK)                return false;
+        if (bench->simDevice.image().size() != BENCH_SCENARIO_LEN)      return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchScenarioRecovery: the flash erase outlasts the first chunk timeout, the updater waits
+*               for the Bluetooth stack to recover and the second attempt succeeds
+*/
+static bool benchScenarioRecovery(BenchContext *bench, int iterations)
+{
+    int64_t elapsedMs;
+
+    bench->simDevice.setRefuseEvery(0);
+    bench->simDevice.dropRequests(0, 0);
+    for (int i = 0; i < iterations; i++)
+    {
+        bench->simDevice.setDelays(UPDATE_FIRST_TIMEOUT_MS + 5000, 0, 0);
+        if (scenarioUpdate(bench, &elapsedMs) != ERR_SLIP_TIMEOUT)     return false;
+
+        bench->simClock.sleepMs(BENCH_BLUETOOTH_WAIT_MS);
+        bench->simDevice.setDelays(5000, 0, 0);
+        if (scenarioUpdate(bench, &elapsedMs) != ERR_OK)                return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchScenarioBattery: the first battery request is lost, the query times out and the
+*               next poll succeeds
+*/
+static bool benchScenarioBattery(BenchContext *bench, int iterations)
+{
+    BatteryReading reading;
+
+    bench->simDevice.setDelays(0, 0, 0);
+    for (int i = 0; i < iterations; i++)
+    {
+        bench->simDevice.dropRequests(0, 1);
+        bench->simDevice.reset(0);
+        Slip slip(&bench->simDevice);
+        slip.setClock(&bench->simClock);
+
+        int64_t start = bench->simClock.nowMs();
+        BatteryQuery lost(&slip);
+        if (lost.run(&reading, NULL, NULL) != ERR_SLIP_TIMEOUT)        return false;
+        if (bench->simClock.nowMs() - start < BATTERY_QUERY_TIMEOUT_MS)    return false;
+
+        BatteryQuery query(&slip);
+        if (query.run(&reading, NULL, NULL) != ERR_OK)                  return false;
+    }
+    return true;
+}
+
+/**
+* @brief benchDspNotch: notch filter of the four channels
+*/
+static bool benchDspNotch(BenchContext *bench, int iterations)
+{
+    NotchFilter notch;
+    float *planes[DSP_MAX_CHANNELS];
+
+    notch.design(DSP_RAW_RATE, DSP_NOTCH_US);
+    for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)     planes[c] = bench->work[c].data();
+    for (int i = 0; i < iterations; i++)
+    {
+        for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)     memcpy(planes[c], bench->signal[c].data(), BENCH_DSP_SAMPLES * sizeof(float));
+        notch.process(planes, BENCH_DSP_SAMPLES, DSP_MAX_CHANNELS);
+        bench->keep += (uint32_t)planes[0][BENCH_DSP_SAMPLES - 1];
+    }
+    return true;
+}
+
+/**
+* @brief benchDspRms: RMS envelope of a channel
+*/
+static bool benchDspRms(BenchContext *bench, int iterations)
+{
+    RmsEnvelope envelope;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        uint32_t n = envelope.process(bench->signal[0].data(), BENCH_DSP_SAMPLES, bench->dspOut.data(), (uint32_t)bench->dspOut.size());
+        if (n == 0)     return false;
+        bench->keep += (uint32_t)bench->dspOut[0];
+    }
+    return true;
+}
+
+/**
+* @brief benchDspDecimate: decimation of a channel by DSP_RMS_DECIMATION
+*/
+static bool benchDspDecimate(BenchContext *bench, int iterations)
+{
+    Decimator decimator(DSP_RMS_DECIMATION);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        uint32_t n = decimator.process(bench->signal[0].data(), BENCH_DSP_SAMPLES, bench->dspOut.data(), (uint32_t)bench->dspOut.size());
+        if (n == 0)     return false;
+        bench->keep += (uint32_t)bench->dspOut[0];
+    }
+    return true;
+}
+
+static bool benchDspNotchScalar(BenchContext *bench, int iterations)
+{
+    dspForceScalar(true);
+    bool ok = benchDspNotch(bench, iterations);
+    dspForceScalar(false);
+    return ok;
+}
+
+static bool benchDspRmsScalar(BenchContext *bench, int iterations)
+{
+    dspForceScalar(true);
+    bool ok = benchDspRms(bench, iterations);
+    dspForceScalar(false);
+    return ok;
+}
+
+static bool benchDspDecimateScalar(BenchContext *bench, int iterations)
+{
+    dspForceScalar(true);
+    bool ok = benchDspDecimate(bench, iterations);
+    dspForceScalar(false);
+    return ok;
+}
+
+/**
+* @brief benchStreamParse: decode one second of stream packets, as read from the connection
+*/
+static bool benchStreamParse(BenchContext *bench, int iterations)
+{
+    StreamPacketParser parser;
+    SampleRing ring(BENCH_STREAM_RECORDS);
+    float samples[BENCH_STREAM_RECORDS];
+
+    parser.setRing(0, &ring);
+    for (int i = 0; i < iterations; i++)
+    {
+        memcpy(bench->streamWork.data(), bench->stream.data(), bench->stream.size());
+        parser.feed(bench->streamWork.data(), (uint32_t)bench->streamWork.size());
+        if (ring.read(samples, BENCH_STREAM_RECORDS) != BENCH_STREAM_RECORDS)  return false;
+    }
+    return parser.stats().checksumErrors == 0;
+}
+
+static const BenchEntry benchmarks[] =
+{
+    { "slip.encode",        benchSlipEncode,        CMD_UPDREQ_MAXLEN },
+    { "slip.decode",        benchSlipDecode,        CMD_UPDREQ_MAXLEN },
+    { "json.battery",       benchJsonBattery,       0 },
+    { "json.deviceinfo",    benchJsonDeviceInfo,    0 },
+    { "package.chunk",      benchPackageChunk,      BENCH_PACKAGE_LEN },
+    { "package.crc",        benchPackageCrc,        BENCH_PACKAGE_LEN },
+    { "session.update",     benchSessionUpdate,     BENCH_SESSION_LEN },
+    { "session.battery",    benchSessionBattery,    0 },
+    { "dsp.notch",          benchDspNotch,          BENCH_DSP_SAMPLES * DSP_MAX_CHANNELS * sizeof(float) },
+    { "dsp.notch.scalar",   benchDspNotchScalar,    BENCH_DSP_SAMPLES * DSP_MAX_CHANNELS * sizeof(float) },
+    { "dsp.rms",            benchDspRms,            BENCH_DSP_SAMPLES * sizeof(float) },
+    { "dsp.rms.scalar",     benchDspRmsScalar,      BENCH_DSP_SAMPLES * sizeof(float) },
+    { "dsp.decimate",       benchDspDecimate,       BENCH_DSP_SAMPLES * sizeof(float) },
+    { "dsp.decimate.scalar", benchDspDecimateScalar, BENCH_DSP_SAMPLES * sizeof(float) },
+    { "stream.parse",       benchStreamParse,       BENCH_STREAM_RECORDS * BSTREAM_RECORD_LEN },
+    { "scenario.timeout",   benchScenarioTimeout,   0 },
+    { "scenario.retry",     benchScenarioRetry,     BENCH_SCENARIO_LEN },
+    { "scenario.recovery",  benchScenarioRecovery,  BENCH_SCENARIO_LEN },
+    { "scenario.battery",   benchScenarioBattery,   0 },
+};
+
+/**
+* @brief prepare: build the data shared by the benchmarks
+*
+* @param bench:     receives the data
+* @return None.
+*/
+static void prepare(BenchContext *bench)
+{
+    char text[512];
+    uint32_t seed = 0x414D4931;
+
+    bench->package.resize(BENCH_PACKAGE_LEN);
+    for (size_t i = 0; i < bench->package.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;                           // LCG: SLIP_END and SLIP_ESC occur as in a real package
+        bench->package[i] = (uint8_t)(seed >> 16);
+    }
+    bench->packageCrc = simCrc32(bench->package.data(), BENCH_SESSION_LEN);
+    bench->scenarioCrc = simCrc32(bench->package.data(), BENCH_SCENARIO_LEN);
+
+    snprintf(text, sizeof(text), SIM_BATTERY_ANSWER, 80, 3900, "true");
+    bench->batteryJson = text;
+    bench->deviceInfoJson = SIM_DEVINFO_ANSWER;
+
+    // slip.decode reads back full update requests, escaped characters included
+    uint8_t frame[CMD_UPDREQ_MAXLEN];
+    Slip slip(&bench->loop);
+    for (int i = 0; i < BENCH_DECODE_FRAMES; i++)
+    {
+        int offset = i * CMD_UPDREQ_MAXDATALEN;
+        int len = UpdateSession::buildRequest(frame, offset, bench->package.data() + offset, CMD_UPDREQ_MAXDATALEN);
+        slip.send(frame, len);
+    }
+
+    // dsp: contraction-like sine, mains and noise on each channel
+    for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)
+    {
+        bench->signal[c].resize(BENCH_DSP_SAMPLES);
+        bench->work[c].resize(BENCH_DSP_SAMPLES);
+        for (uint32_t i = 0; i < BENCH_DSP_SAMPLES; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            double t = (double)i / DSP_RAW_RATE;
+            bench->signal[c][i] = (float)(100.0 * sin(2 * 3.14159265358979 * (80 + 20 * c) * t) +
+                50.0 * sin(2 * 3.14159265358979 * DSP_NOTCH_US * t) + ((seed >> 16) & 0xFF) / 25.6);
+        }
+    }
+    bench->dspOut.resize(BENCH_DSP_SAMPLES / DSP_RMS_DECIMATION + 1);
+
+    SimStreamShape shape = { BENCH_STREAM_RECORDS, BSTREAM_RECORDS_MAX, 0, 0, 0 };
+    SimStreamCounts counts;
+    simStream(shape, &bench->stream, NULL, &counts);
+    bench->streamWork.resize(bench->stream.size());
+
+    bench->device.setHeartbeatEvery(4);
+    bench->simDevice.setHeartbeatEvery(4);
+    bench->keep = 0;
+}
+
+/**
+* @brief measure: time a benchmark
+*
+* @param bench:     shared data
+* @param entry:     benchmark
+* @param samples:   number of samples
+* @param nsPerOp:   receives the median time per operation
+* @return false if an operation failed
+*/
+static bool measure(BenchContext *bench, const BenchEntry &entry, int samples, double *nsPerOp)
+{
+    // calibrate: double the batch until a sample lasts long enough
+    int iterations = 1;
+    while (true)
+    {
+        int64_t start = metricsNowUs();
+        if (entry.fnct(bench, iterations) == false)     return false;
+        int64_t elapsedNs = (metricsNowUs() - start) * 1000;
+        if ((elapsedNs >= BENCH_MIN_BATCH_NS) || (iterations >= (1 << 30)))    break;
+        iterations *= 2;
+    }
+
+    std::vector<double> results;
+    for (int s = 0; s < samples; s++)
+    {
+        int64_t start = metricsNowUs();
+        if (entry.fnct(bench, iterations) == false)     return false;
+        results.push_back((metricsNowUs() - start) * 1000.0 / iterations);
+    }
+    std::sort(results.begin(), results.end());
+    *nsPerOp = results[results.size() / 2];
+    return true;
+}
+
+/**
+* @brief loadBaseline: read a baseline file
+*
+* @param path:      file written by --save
+* @param baseline:  receives the time per operation of each benchmark
+* @return false if the file cannot be read
+*/
+static bool loadBaseline(const char *path, std::map<std::string, double> *baseline)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return false;
+
+    char line[256], name[128];
+    double ns;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#')                                             continue;
+        if (sscanf(line, "%127s %lf", name, &ns) == 2)                  (*baseline)[name] = ns;
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+* @brief cmdBench: run the benchmarks of the protocol engines
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdBench(int argc, char **argv)
+{
+    const char *filter = NULL, *savePath = NULL, *baselinePath = NULL;
+    int samples = BENCH_DEFAULT_SAMPLES;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--filter") == 0) && (i + 1 < argc))         filter = argv[++i];
+        else if ((strcmp(argv[i], "--samples") == 0) && (i + 1 < argc))   samples = std::max(1, atoi(argv[++i]));
+        else if ((strcmp(argv[i], "--save") == 0) && (i + 1 < argc))      savePath = argv[++i];
+        else if ((strcmp(argv[i], "--baseline") == 0) && (i + 1 < argc))  baselinePath = argv[++i];
+        else if ((strcmp(argv[i], "--threshold") == 0) && (i + 1 < argc)) threshold = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "usage: bench [--filter text] [--samples N] [--save file] [--baseline file] [--threshold pct]\n");
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if ((baselinePath != NULL) && (loadBaseline(baselinePath, &baseline) == false))
+    {
+        fprintf(stderr, "bench: %s: cannot read file\n", baselinePath);
+        return 1;
+    }
+
+    BenchContext *bench = new BenchContext;
+    prepare(bench);
+
+    std::vector<std::pair<std::string, double> > results;
+    int regressions = 0, failures = 0;
+
+    printf("%-20s %14s %12s", "benchmark", "ns/op", "MB/s");
+    if (baselinePath != NULL)       printf(" %14s %9s", "baseline", "change");
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        const BenchEntry &entry = benchmarks[i];
+        if ((filter != NULL) && (strstr(entry.name, filter) == NULL))  continue;
+
+        double nsPerOp;
+        if (measure(bench, entry, samples, &nsPerOp) == false)
+        {
+            printf("%-20s FAILED\n", entry.name);
+            failures++;
+            continue;
+        }
+        results.push_back(std::make_pair(std::string(entry.name), nsPerOp));
+
+        printf("%-20s %14.1f", entry.name, nsPerOp);
+        if (entry.bytesPerOp > 0)   printf(" %12.1f", entry.bytesPerOp * 1e3 / nsPerOp);
+        else                        printf(" %12s", "-");
+
+        std::map<std::string, double>::const_iterator ref = baseline.find(entry.name);
+        if (ref != baseline.end())
+        {
+            double change = (nsPerOp / ref->second - 1.0) * 100.0;
+            printf(" %14.1f %+8.1f%%", ref->second, change);
+            if (change > threshold)
+            {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        else if (baselinePath != NULL)  printf(" %14s %9s", "-", "new");
+        printf("\n");
+    }
+    delete bench;
+
+    if (savePath != NULL)
+    {
+        FILE *file = fopen(savePath, "w");
+        if (file == NULL)
+        {
+            fprintf(stderr, "bench: %s: cannot write file\n", savePath);
+            return 1;
+        }
+        fprintf(file, "# TT_AMI_Tools bench baseline: <benchmark> <ns per operation>\n");
+        for (size_t i = 0; i < results.size(); i++)     fprintf(file, "%s %.1f\n", results[i].first.c_str(), results[i].second);
+        fclose(file);
+    }
+
+    if (baselinePath != NULL)
+        printf("\n%d regression(s) beyond %.1f%%\n", regressions, threshold);
+    return ((regressions > 0) || (failures > 0)) ? 1 : 0;
+}
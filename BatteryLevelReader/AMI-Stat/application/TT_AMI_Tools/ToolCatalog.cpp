@@ -0,0 +1,274 @@
+/*
+* ToolCatalog.cpp : This file contains the "catalog" command: index of the headers of a folder of
+*               recorded sessions, and queries on it.
+*
+*   In a nutshell, this command:
+*       - update: brings the index file of a folder up to date (SessionCatalog), reading only the
+*           headers of the new and changed files, with a pool of worker threads (--jobs), and
+*           reports the files kept, read and removed with the durations
+*       - query: loads the index file and lists the sessions of a patient, a device, a type of
+*           session and a date range, without opening any session
+*       - reaches the sessions through the AMI SDK (Win32 build only), or through simulated
+*           sessions (--sim) to measure the update without the SDK
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include "ToolCommands.h"
+#include "SessionCatalog.h"
+#include "SdkSessions.h"
+#include "ErrCodes.h"
+
+#define CATALOG_SIM_MS          5           // Default time to read a simulated header
+#define CATALOG_SIM_BYTES       (512 * 1024)    // Size of a simulated session
+#define CATALOG_SIM_MTIME       1700000000  // Modification time of the simulated sessions
+#define CATALOG_SIM_PATIENTS    200         // Patients of the simulated sessions
+#define CATALOG_SIM_DEVICES     8           // Devices of the simulated sessions
+#define CATALOG_SIM_OTHER       97          // One file in CATALOG_SIM_OTHER is not a session
+#define CATALOG_LIST_MAX        50          // Sessions printed by a query (--all: every one)
+
+/**
+* Simulated sessions: "session_NNNN.myx", one recorded every 6 hours from CATALOG_SIM_MTIME on,
+* by CATALOG_SIM_PATIENTS patients on CATALOG_SIM_DEVICES devices
+*/
+class SimHeaders : public ISessionHeaders
+{
+public:
+    SimHeaders(uint32_t _files, uint32_t _readMs, uint32_t _touched)
+    : files(_files), readMs(_readMs), touched(_touched)     {}
+
+    int list(const char *folder, std::vector<CatalogFile> *out)
+    {
+        out->clear();
+        for (uint32_t i = 0; i < files; i++)
+        {
+            char name[64];
+            CatalogFile file;
+            snprintf(name, sizeof(name), "/session_%04u.myx", i);
+            file.path = std::string(folder) + name;
+            file.size = CATALOG_SIM_BYTES;
+            file.mtime = CATALOG_SIM_MTIME + ((i < touched) ? 1 : 0);    // the first sessions modified since
+            out->push_back(file);
+        }
+        return ERR_OK;
+    }
+
+    int readHeader(const char *path, SessionHeader *header)
+    {
+        const char *name = strrchr(path, '/');
+        unsigned i;
+
+        systemClock()->sleepMs(readMs);
+        if ((name == NULL) || (sscanf(name, "/session_%u.myx", &i) != 1))     return ERR_FILE_READ;
+        if (i % CATALOG_SIM_OTHER == CATALOG_SIM_OTHER - 1)                     return ERR_FILE_FORMAT;
+
+        memset(header, 0, sizeof(*header));
+        header->sampleRate = 2048;
+        header->rawCount = 2048 * (60 + i % 600);
+        header->rmsCount = header->rawCount / 102;
+        header->eventsCount = i % 5;
+        header->sessionType = i % 3;
+        header->sensors[0] = 1;
+        header->sensors[1] = 1;
+        header->dateTime = (int64_t)CATALOG_SIM_MTIME + (int64_t)i * 6 * 3600;
+        header->productType = 1;
+        snprintf(header->patientID, sizeof(header->patientID), "P%04u", i % CATALOG_SIM_PATIENTS);
+        snprintf(header->serialNumber, sizeof(header->serialNumber), "AMI%06u", 100 + i % CATALOG_SIM_DEVICES);
+        snprintf(header->protocolVersion, sizeof(header->protocolVersion), "1.0");
+        return ERR_OK;
+    }
+
+private:
+    uint32_t files;                     // Number of sessions
+    uint32_t readMs;                    // Time to read a header
+    uint32_t touched;                   // Number of sessions modified since CATALOG_SIM_MTIME
+};
+
+/**
+* @brief formatDate: format a date of a session header
+*
+* @param seconds:   seconds since the epoch
+* @param text:      receives "YYYY-MM-DD hh:mm" (UTC)
+* @param size:      size of text
+* @return text
+*/
+static const char *formatDate(int64_t seconds, char *text, size_t size)
+{
+    time_t t = (time_t)seconds;
+    struct tm *tm = gmtime(&t);
+
+    if (tm == NULL)     snprintf(text, size, "%lld", (long long)seconds);
+    else                strftime(text, size, "%Y-%m-%d %H:%M", tm);
+    return text;
+}
+
+/**
+* @brief catalogUpdate: "catalog update"
+*
+* @return process exit code
+*/
+static int catalogUpdate(const char *folder, const char *index, int argc, char **argv)
+{
+    int jobs = 0;
+    int simFiles = 0;
+    int simMs = CATALOG_SIM_MS;
+    int simTouched = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--jobs") == 0) && (i + 1 < argc))           jobs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--sim") == 0) && (i + 1 < argc))       simFiles = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--ms") == 0) && (i + 1 < argc))        simMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--touch") == 0) && (i + 1 < argc))     simTouched = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "catalog: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((jobs < 0) || (jobs > CATALOG_MAX_WORKERS) || (simFiles < 0) || (simMs < 0) || (simTouched < 0))
+    {
+        fprintf(stderr, "usage: catalog update <sessions folder> [--index file] [--jobs N] [--sim N [--ms N] [--touch N]]\n");
+        return 2;
+    }
+
+    ISessionHeaders *headers = NULL;
+    if (simFiles > 0)
+    {
+        headers = new SimHeaders((uint32_t)simFiles, (uint32_t)simMs, (uint32_t)simTouched);
+    }
+    else
+    {
+#ifdef AMI_SDK
+        headers = new SdkHeaders();
+#else
+        fprintf(stderr, "catalog: recorded sessions need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+
+    SessionCatalog catalog(headers, (unsigned)jobs);
+    CatalogStats stats;
+    int err = catalog.load(index);
+    if (err != ERR_OK)      fprintf(stderr, "catalog: %s: not an index file (%d), rebuilt\n", index, err);
+    err = catalog.update(folder, &stats);
+    if (err != ERR_OK)
+    {
+        delete headers;
+        fprintf(stderr, "catalog: %s: cannot list the sessions (%d)\n", folder, err);
+        return 1;
+    }
+    bool saved = catalog.changed();
+    if (saved)              err = catalog.save(index);
+    delete headers;
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "catalog: %s: cannot write the index (%d)\n", index, err);
+        return 1;
+    }
+
+    printf("files     %u  unchanged %u  read %u (%u not sessions)  removed %u  workers %u\n",
+        stats.files, stats.unchanged, stats.read, stats.notSessions, stats.removed, catalog.workerCount());
+    printf("update    list %lld ms  read %lld ms  %.1f headers/s\n", (long long)stats.listMs, (long long)stats.readMs,
+        (stats.readMs > 0) ? stats.read * 1000.0 / stats.readMs : 0.0);
+    printf("index     %s  %zu entries  %s\n", index, catalog.size(), saved ? "saved" : "up to date");
+    return 0;
+}
+
+/**
+* @brief catalogQuery: "catalog query"
+*
+* @return process exit code (1: no index)
+*/
+static int catalogQuery(const char *index, int argc, char **argv)
+{
+    CatalogQuery q;
+    bool all = false;
+    bool valid = true;
+
+    q.patient = NULL;
+    q.serial = NULL;
+    q.sessionType = -1;
+    q.from = INT64_MIN;
+    q.to = INT64_MAX;
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--patient") == 0) && (i + 1 < argc))        q.patient = argv[++i];
+        else if ((strcmp(argv[i], "--serial") == 0) && (i + 1 < argc))    q.serial = argv[++i];
+        else if ((strcmp(argv[i], "--type") == 0) && (i + 1 < argc))      q.sessionType = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))      valid = valid && catalogParseDate(argv[++i], &q.from);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))        valid = valid && catalogParseDate(argv[++i], &q.to);
+        else if (strcmp(argv[i], "--all") == 0)                           all = true;
+        else
+        {
+            fprintf(stderr, "catalog: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (valid == false)
+    {
+        fprintf(stderr, "usage: catalog query <sessions folder> [--index file] [--patient id] [--serial sn] [--type N]\n"
+                        "       [--from YYYY-MM-DD[ hh:mm]] [--to YYYY-MM-DD[ hh:mm]] [--all]\n");
+        return 2;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SessionCatalog catalog(NULL, 1);
+    int err = catalog.load(index);
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if ((err != ERR_OK) || (catalog.size() == 0))
+    {
+        fprintf(stderr, "catalog: %s: no index (%d), run catalog update first\n", index, err);
+        return 1;
+    }
+
+    std::vector<const CatalogEntry *> found;
+    start = std::chrono::steady_clock::now();
+    catalog.query(q, &found);
+    double queryUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < found.size() && (all || (i < CATALOG_LIST_MAX)); i++)
+    {
+        const SessionHeader &h = found[i]->header;
+        char date[32];
+        printf("%s  %-12s  %-10s  type %u  %u Hz  %7.1f s  %s\n", formatDate(h.dateTime, date, sizeof(date)), h.patientID,
+            h.serialNumber, h.sessionType, h.sampleRate, (h.sampleRate > 0) ? (double)h.rawCount / h.sampleRate : 0.0,
+            found[i]->file.path.c_str());
+    }
+    if ((all == false) && (found.size() > CATALOG_LIST_MAX))    printf("... %zu more (--all)\n", found.size() - CATALOG_LIST_MAX);
+    printf("matches   %zu of %zu files  load %.2f ms  query %.1f us\n", found.size(), catalog.size(), loadMs, queryUs);
+    return 0;
+}
+
+/**
+* @brief cmdCatalog: update the index of the session headers of a folder, query it
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdCatalog(int argc, char **argv)
+{
+    std::string index;
+    std::vector<char *> rest;
+
+    if ((argc < 2) || (argv[1][0] == '-') || ((strcmp(argv[0], "update") != 0) && (strcmp(argv[0], "query") != 0)))
+    {
+        fprintf(stderr, "usage: catalog update|query <sessions folder> [--index file] [options]\n");
+        return 2;
+    }
+    for (int i = 2; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--index") == 0) && (i + 1 < argc))          index = argv[++i];
+        else                                                            rest.push_back(argv[i]);
+    }
+    if (index.empty())      index = std::string(argv[1]) + "/" + CATALOG_INDEX_FILE;
+
+    if (strcmp(argv[0], "update") == 0)     return catalogUpdate(argv[1], index.c_str(), (int)rest.size(), rest.data());
+    return catalogQuery(index.c_str(), (int)rest.size(), rest.data());
+}
@@ -0,0 +1,273 @@
+/*
+* ToolCharge.cpp : This file contains the "charge" command: accuracy of the charge time
+*               forecast (time for a device to reach the battery level required for its update).
+*
+*   In a nutshell, this command:
+*       - eval: replays the samples of a telemetry store (Log\Telemetry) through the forecast,
+*           device by device, as the Updater would have fed it live. Every --every minutes of a
+*           charge below the --target level, the time to reach it is forecast, then compared to
+*           the time the log shows it was reached in that charge (the forecasts of charges that
+*           ended before, or were interrupted by a use of the device, are not counted). Prints,
+*           per horizon, the forecasts checked, their mean absolute error, bias, the part within
+*           20% and within the range given, against the default rates (no history) and the
+*           device history without the live factor.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "ChargeForecast.h"
+#include "TelemetryStore.h"
+#include "SessionCatalog.h"
+#include "FileFolder.h"
+
+#define CHARGE_EVAL_EVERY_MIN   10          // Default minutes between two forecasts
+#define CHARGE_EVAL_HORIZONS    4           // Horizons reported: < 30 min, < 1 h, < 2 h, more
+#define CHARGE_EVAL_CLOSE       0.2         // Forecast "close": within 20% of the time taken
+
+// Forecasts compared: the default rates, the device history alone, the history with the live factor
+enum { EVAL_DEFAULT, EVAL_HISTORY, EVAL_LIVE, EVAL_KINDS };
+
+/**
+* Forecast waiting for the target to be reached
+*/
+typedef struct
+{
+    int64_t t;                  // Time of the forecast (ms)
+    double minutes[EVAL_KINDS]; // Time forecast
+    double low;                 // Range of the live forecast
+    double high;
+} EvalPending;
+
+/**
+* Accuracy over a horizon
+*/
+typedef struct
+{
+    uint32_t count;             // Forecasts checked
+    double absError[EVAL_KINDS];    // Sum of the absolute errors (min)
+    double error;               // Sum of the errors of the live forecast (min, > 0: too long)
+    uint32_t close;             // Live forecasts within CHARGE_EVAL_CLOSE
+    uint32_t inRange;           // Times taken within the range of the live forecast
+} EvalHorizon;
+
+static int horizonOf(double minutes)
+{
+    if (minutes < 30.0)     return 0;
+    if (minutes < 60.0)     return 1;
+    if (minutes < 120.0)    return 2;
+    return 3;
+}
+
+/**
+* @brief evalResolve: the target was reached at t: check the forecasts pending
+*/
+static void evalResolve(std::vector<EvalPending> &pending, int64_t t, EvalHorizon *horizons, std::vector<double> &errors)
+{
+    for (size_t i = 0; i < pending.size(); i++)
+    {
+        const EvalPending &p = pending[i];
+        double actual = (t - p.t) / 60000.0;
+        EvalHorizon &h = horizons[horizonOf(actual)];
+        h.count++;
+        for (int k = 0; k < EVAL_KINDS; k++)    h.absError[k] += fabs(p.minutes[k] - actual);
+        h.error += p.minutes[EVAL_LIVE] - actual;
+        if (fabs(p.minutes[EVAL_LIVE] - actual) <= CHARGE_EVAL_CLOSE * actual)  h.close++;
+        if ((actual >= p.low) && (actual <= p.high))                            h.inRange++;
+        errors.push_back(fabs(p.minutes[EVAL_LIVE] - actual));
+    }
+    pending.clear();
+}
+
+static void evalPrint(const char *name, const EvalHorizon &h)
+{
+    if (h.count == 0)
+    {
+        printf("%-9s %7u\n", name, 0u);
+        return;
+    }
+    printf("%-9s %7u %9.1f %9.1f %9.1f %+7.1f %8.1f%% %8.1f%%\n", name, h.count,
+        h.absError[EVAL_DEFAULT] / h.count, h.absError[EVAL_HISTORY] / h.count, h.absError[EVAL_LIVE] / h.count,
+        h.error / h.count, 100.0 * h.close / h.count, 100.0 * h.inRange / h.count);
+}
+
+/**
+* @brief chargeEval: check the forecast against the charges of a telemetry store
+*
+* @return process exit code (1: store not readable)
+*/
+static int chargeEval(const char *folder, int argc, char **argv)
+{
+    const char *serial = NULL;
+    int64_t from = INT64_MIN / 1000;
+    int64_t to = INT64_MAX / 1000;
+    int target = CHARGE_UPDATE_MIN_SOC;
+    int every = CHARGE_EVAL_EVERY_MIN;
+    bool valid = true;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--serial") == 0) && (i + 1 < argc))         serial = argv[++i];
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))      valid = valid && catalogParseDate(argv[++i], &from);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))        valid = valid && catalogParseDate(argv[++i], &to);
+        else if ((strcmp(argv[i], "--target") == 0) && (i + 1 < argc))    target = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--every") == 0) && (i + 1 < argc))     every = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "charge: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((valid == false) || (target < 1) || (target > 100) || (every < 1))
+    {
+        fprintf(stderr, "usage: charge eval <store folder> [--serial sn] [--from YYYY-MM-DD[ hh:mm]] [--to YYYY-MM-DD[ hh:mm]] [--target %%] [--every min]\n");
+        return 2;
+    }
+    from *= 1000;
+    to = (to == INT64_MAX / 1000) ? INT64_MAX : to * 1000;
+
+    if (folderExists(folder) == false)
+    {
+        fprintf(stderr, "charge: %s: %s\n", folder, strerror(errno));
+        return 1;
+    }
+    TelemetryStore store;
+    if (store.open(folder) != TLM_OK)
+    {
+        fprintf(stderr, "charge: %s: cannot open the store\n", folder);
+        return 1;
+    }
+    std::vector<std::string> serials;
+    if (serial != NULL)     serials.push_back(serial);
+    else                    store.serials(serials);
+    std::sort(serials.begin(), serials.end());
+
+    ChargeForecastConfig cfg;
+    ChargeForecastConfig historyCfg;
+    historyCfg.live = false;
+    int64_t everyMs = (int64_t)every * 60000;
+
+    TelemetryColumns cols;
+    EvalHorizon horizons[CHARGE_EVAL_HORIZONS];
+    memset(horizons, 0, sizeof(horizons));
+    std::vector<double> errors;
+    std::vector<EvalPending> pending;
+    uint64_t samples = 0;
+    uint32_t dropped = 0;
+    double updateMs = 0.0;
+    for (size_t d = 0; d < serials.size(); d++)
+    {
+        cols.clear();
+        if (store.scanColumns(serials[d].c_str(), from, to, cols) != TLM_OK)
+        {
+            fprintf(stderr, "charge: %s: damaged blocks skipped\n", serials[d].c_str());
+        }
+        ChargePredictor live(cfg);
+        ChargePredictor history(historyCfg);
+        ChargePredictor fresh(cfg);
+        pending.clear();
+        int64_t chargeMs = INT64_MIN;       // Last sample of the charge in progress
+        int64_t nextMs = INT64_MIN;         // Time of the next forecast
+        uint8_t lastSoc = 0;
+        for (size_t i = 0; i < cols.size(); i++)
+        {
+            int64_t t = cols.timestamp[i];
+            uint8_t soc = cols.soc[i];
+            bool charging = (cols.charging[i] != 0);
+            if (soc > 100)      continue;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            live.update(t, soc, charging);
+            updateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            history.update(t, soc, charging);
+
+            // Same charge as the forecasts pending: as the predictor, short disconnections do not end it
+            bool sameCharge = (t - chargeMs <= cfg.gapMs);
+            if (charging)                   chargeMs = t;
+            else if (sameCharge == false)   chargeMs = INT64_MIN;
+            if ((charging || sameCharge) && (soc >= target))
+            {
+                evalResolve(pending, t, horizons, errors);
+                continue;
+            }
+            if (((charging == false) && (sameCharge == false)) || (soc < lastSoc))
+            {
+                dropped += (uint32_t)pending.size();
+                pending.clear();
+            }
+            lastSoc = soc;
+            if ((charging == false) || (t < nextMs))    continue;
+
+            EvalPending p;
+            ChargeForecast f;
+            p.t = t;
+            live.forecast(t, target, f);
+            p.minutes[EVAL_LIVE] = f.minutes;
+            p.low = f.lowMinutes;
+            p.high = f.highMinutes;
+            history.forecast(t, target, f);
+            p.minutes[EVAL_HISTORY] = f.minutes;
+            fresh.reset();
+            fresh.update(t, soc, true);
+            fresh.forecast(t, target, f);
+            p.minutes[EVAL_DEFAULT] = f.minutes;
+            pending.push_back(p);
+            nextMs = t + everyMs;
+        }
+        dropped += (uint32_t)pending.size();
+        samples += cols.size();
+    }
+
+    EvalHorizon all;
+    memset(&all, 0, sizeof(all));
+    for (int h = 0; h < CHARGE_EVAL_HORIZONS; h++)
+    {
+        all.count += horizons[h].count;
+        for (int k = 0; k < EVAL_KINDS; k++)    all.absError[k] += horizons[h].absError[k];
+        all.error += horizons[h].error;
+        all.close += horizons[h].close;
+        all.inRange += horizons[h].inRange;
+    }
+
+    printf("target %d%%  %zu devices  %llu samples  %u forecasts of charges unfinished or interrupted\n", target, serials.size(),
+        (unsigned long long)samples, dropped);
+    printf("horizon     count   default   history      live    bias   within20%%   inRange\n");
+    evalPrint("< 30 min", horizons[0]);
+    evalPrint("< 1 h", horizons[1]);
+    evalPrint("< 2 h", horizons[2]);
+    evalPrint(">= 2 h", horizons[3]);
+    evalPrint("all", all);
+    if (errors.empty() == false)
+    {
+        std::nth_element(errors.begin(), errors.begin() + errors.size() / 2, errors.end());
+        printf("median absolute error %.1f min\n", errors[errors.size() / 2]);
+    }
+    if (samples > 0)    printf("update   %.0f ns per sample\n", updateMs * 1e6 / samples);
+    return 0;
+}
+
+/**
+* @brief cmdCharge: check the charge time forecast against the charges of a telemetry store
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdCharge(int argc, char **argv)
+{
+    if ((argc < 2) || (argv[1][0] == '-') || (strcmp(argv[0], "eval") != 0))
+    {
+        fprintf(stderr, "usage: charge eval <store folder> [options]\n");
+        return 2;
+    }
+    return chargeEval(argv[1], argc - 2, argv + 2);
+}
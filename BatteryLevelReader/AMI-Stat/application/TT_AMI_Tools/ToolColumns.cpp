@@ -0,0 +1,514 @@
+/*
+* ToolColumns.cpp : This file contains the "columns" command: conversion of the recorded sessions
+*               to the columnar file format (SessionColumns.h) and reading of those files.
+*
+*   In a nutshell, this command:
+*       - imports a session exported as text (one line per sample, the values of the channels
+*           separated by tabs, commas or spaces; lines without numbers are skipped; --skip drops
+*           leading columns such as a time stamp), its RMS export (one RMS per DSP_RMS_DECIMATION
+*           raw samples as the device streams it, or at --rms-rate) and an events file
+*           ("<seconds> <code> [value]" per line)
+*       - generates a synthetic session (sim), to exercise the format without recordings
+*       - prints the header of a file (info)
+*       - reads a time range of a channel through the mapping (read): min, max, mean and the
+*           time taken, the events of the range
+*       - builds the level of detail pyramid next to the file (SessionPyramid.h): during import
+*           and sim, from the samples as they are written; for an existing file (pyramid)
+*       - draws a viewport of a time range from the pyramid (view): the time taken, and with
+*           --check the comparison with a scan of the raw samples
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "ToolCommands.h"
+#include "SessionColumns.h"
+#include "SessionPyramid.h"
+#include "SignalDsp.h"
+#include "ErrCodes.h"
+
+#define COLUMNS_LINE_MAX        4096        // Max length of a line of a text export
+#define COLUMNS_SIM_EVENT_SEC   10          // Period of the events of a synthetic session
+#define COLUMNS_PI              3.14159265358979
+#define COLUMNS_VIEW_PIXELS     1920        // Default width of a viewport
+
+typedef struct
+{
+    uint32_t channels;          // Values per frame
+    uint64_t frames;            // Number of frames
+} TextShape;
+
+/**
+* @brief parseLine: values of a line of a text export
+*
+* @param line:      line
+* @param skip:      number of leading columns dropped
+* @param values:    receives the values (COLUMNS_MAX_CHANNELS max)
+* @return Number of values, 0 for a line without numbers
+*/
+static uint32_t parseLine(char *line, int skip, float *values)
+{
+    uint32_t count = 0;
+    int column = 0;
+    char *p = line;
+
+    while (count < COLUMNS_MAX_CHANNELS)
+    {
+        while ((*p == ' ') || (*p == '\t') || (*p == ','))     p++;
+        if ((*p == 0) || (*p == '\r') || (*p == '\n'))          break;
+
+        char *end;
+        double v = strtod(p, &end);
+        if (end == p)       return 0;                   // not a line of numbers
+        if (column++ >= skip)   values[count++] = (float)v;
+        p = end;
+    }
+    return count;
+}
+
+/**
+* @brief scanText: number of frames and channels of a text export
+*
+* @return true when the file could be read and holds frames
+*/
+static bool scanText(const char *path, int skip, TextShape *shape)
+{
+    char line[COLUMNS_LINE_MAX];
+    float values[COLUMNS_MAX_CHANNELS];
+
+    shape->channels = 0;
+    shape->frames = 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return false;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        uint32_t n = parseLine(line, skip, values);
+        if (n == 0)         continue;
+        if (shape->channels == 0)   shape->channels = n;
+        if (n == shape->channels)   shape->frames++;
+    }
+    fclose(file);
+    return (shape->frames > 0);
+}
+
+/**
+* @brief importText: append the frames of a text export
+*
+* @param rms:       RMS export (otherwise raw)
+* @return ERR_OK or an error
+*/
+static int importText(ColumnWriter &writer, const char *path, int skip, uint32_t channels, bool rms)
+{
+    char line[COLUMNS_LINE_MAX];
+    std::vector<float> frames;
+    float values[COLUMNS_MAX_CHANNELS];
+    int err = ERR_OK;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return ERR_FILE_READ;
+    frames.reserve(COLUMNS_BLOCK * channels);
+    while ((err == ERR_OK) && (fgets(line, sizeof(line), file) != NULL))
+    {
+        if (parseLine(line, skip, values) != channels)     continue;
+        frames.insert(frames.end(), values, values + channels);
+        if (frames.size() >= COLUMNS_BLOCK * channels)
+        {
+            err = rms ? writer.appendRms(frames.data(), COLUMNS_BLOCK) : writer.appendRaw(frames.data(), COLUMNS_BLOCK);
+            frames.clear();
+        }
+    }
+    fclose(file);
+
+    uint32_t left = (uint32_t)(frames.size() / channels);
+    if ((err == ERR_OK) && (left > 0))  err = rms ? writer.appendRms(frames.data(), left) : writer.appendRaw(frames.data(), left);
+    return err;
+}
+
+/**
+* @brief loadEvents: read an events file ("<seconds> <code> [value]" per line)
+*
+* @return true when the file could be read
+*/
+static bool loadEvents(const char *path, uint32_t rawRate, std::vector<ColumnEvent> *events)
+{
+    char line[COLUMNS_LINE_MAX];
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return false;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        double seconds;
+        unsigned code;
+        float value = 0;
+        if (sscanf(line, "%lf %u %f", &seconds, &code, &value) < 2)    continue;
+        ColumnEvent event = { (uint64_t)(seconds * rawRate), code, value };
+        events->push_back(event);
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+* @brief simSession: write a synthetic session: bursts of a noisy sine on each channel, its RMS
+*           as the device streams it (one RMS per DSP_RMS_DECIMATION raw samples, 20.08 Hz),
+*           an event every COLUMNS_SIM_EVENT_SEC. The RMS is summed directly in double, not with
+*           RmsEnvelope: "dsp rms" checks the kernel against it.
+*
+* @return ERR_OK or an error
+*/
+static int simSession(const char *path, uint32_t seconds, uint32_t channels)
+{
+    ColumnLayout layout;
+    ColumnWriter writer;
+    PyramidBuilder pyramid;
+
+    memset(&layout, 0, sizeof(layout));
+    layout.channels = channels;
+    layout.rawRate = COLUMNS_RAW_RATE;
+    layout.rmsRate = COLUMNS_RMS_RATE;
+    layout.rmsDecimation = DSP_RMS_DECIMATION;
+    layout.rawCount = (uint64_t)seconds * COLUMNS_RAW_RATE;
+    layout.rmsCount = layout.rawCount / DSP_RMS_DECIMATION;
+    layout.eventCount = seconds / COLUMNS_SIM_EVENT_SEC;
+    for (uint32_t c = 0; c < channels; c++)    layout.sensors[c] = (int32_t)(100 + c);
+
+    int err = pyramid.begin(channels, layout.rawRate, layout.rawCount);
+    if (err == ERR_OK)  err = writer.create(path, layout);
+    writer.setRawSink(PyramidBuilder::addEntry, &pyramid);
+    std::vector<float> frames(COLUMNS_RAW_RATE * channels);
+    std::vector<float> rmsFrames((COLUMNS_RAW_RATE / DSP_RMS_DECIMATION + 1) * channels);
+    double sumSquares[COLUMNS_MAX_CHANNELS] = { 0 };    // Of the RMS window in progress
+    uint32_t inWindow = 0;                              // Raw samples in that window
+    uint32_t noise = 12345;
+
+    for (uint32_t s = 0; (err == ERR_OK) && (s < seconds); s++)
+    {
+        double amplitude = 50.0 + 400.0 * (((s / 5) % 2) ? 1.0 : 0.1);      // contractions of 5 s
+        for (uint32_t i = 0; i < COLUMNS_RAW_RATE; i++)
+        {
+            double t = (double)(s * COLUMNS_RAW_RATE + i) / COLUMNS_RAW_RATE;
+            for (uint32_t c = 0; c < channels; c++)
+            {
+                noise = noise * 1103515245 + 12345;
+                double n = ((noise >> 16) & 0x7FFF) / 16384.0 - 1.0;
+                frames[i * channels + c] = (float)(amplitude * (sin(2 * COLUMNS_PI * (80 + 20 * c) * t) + 0.3 * n));
+            }
+        }
+        uint32_t rmsCount = 0;
+        for (uint32_t i = 0; i < COLUMNS_RAW_RATE; i++)
+        {
+            for (uint32_t c = 0; c < channels; c++)     sumSquares[c] += (double)frames[i * channels + c] * frames[i * channels + c];
+            if (++inWindow < DSP_RMS_DECIMATION)        continue;
+            for (uint32_t c = 0; c < channels; c++)
+            {
+                rmsFrames[rmsCount * channels + c] = (float)sqrt(sumSquares[c] / DSP_RMS_DECIMATION);
+                sumSquares[c] = 0;
+            }
+            rmsCount++;
+            inWindow = 0;
+        }
+        err = writer.appendRaw(frames.data(), COLUMNS_RAW_RATE);
+        if ((err == ERR_OK) && (rmsCount > 0))  err = writer.appendRms(rmsFrames.data(), rmsCount);
+        if ((err == ERR_OK) && (s % COLUMNS_SIM_EVENT_SEC == COLUMNS_SIM_EVENT_SEC - 1))
+        {
+            err = writer.addEvent((uint64_t)s * COLUMNS_RAW_RATE, s / COLUMNS_SIM_EVENT_SEC, (float)amplitude);
+        }
+    }
+    if (err == ERR_OK)  err = writer.finish();
+    if (err == ERR_OK)  err = pyramid.write(pyramidPathFor(path).c_str());
+    return err;
+}
+
+/**
+* @brief buildPyramid: build the pyramid of an existing columnar file, in one pass over the mapping
+*
+* @return ERR_OK or an error
+*/
+static int buildPyramid(const char *path, ColumnFile &file)
+{
+    const ColumnHeader &h = file.info();
+    PyramidBuilder pyramid;
+
+    int err = pyramid.begin(h.channels, h.rawRate, h.raw[0].count);
+    for (uint32_t c = 0; (err == ERR_OK) && (c < h.channels); c++)
+    {
+        uint64_t count = 0;
+        const float *samples = file.raw(c, 0, file.durationSec() + 1, &count);
+        for (uint64_t i = 0; i < count; i += COLUMNS_BLOCK)
+        {
+            pyramid.add(c, samples + i, (uint32_t)((count - i < COLUMNS_BLOCK) ? count - i : COLUMNS_BLOCK));
+        }
+    }
+    if (err == ERR_OK)  err = pyramid.write(pyramidPathFor(path).c_str());
+    return err;
+}
+
+/**
+* @brief checkView: compare the pixels of a viewport with a scan of the raw samples
+*
+* @return Number of pixels that differ
+*/
+static uint32_t checkView(ColumnFile &file, uint32_t channel, double fromSec, double toSec, const PyramidBucket *pixels, uint32_t count)
+{
+    uint64_t total = 0;
+    uint64_t first = 0;
+    const float *samples = file.raw(channel, fromSec, toSec, &total, &first);
+    uint32_t errors = 0;
+
+    for (uint32_t p = 0; p < count; p++)
+    {
+        uint64_t lo = total * p / count;
+        uint64_t hi = total * (p + 1) / count;
+        float minV = samples[lo], maxV = samples[lo];
+        double sum = 0;
+        for (uint64_t i = lo; i < hi; i++)
+        {
+            if (samples[i] < minV)  minV = samples[i];
+            if (samples[i] > maxV)  maxV = samples[i];
+            sum += samples[i];
+        }
+        double mean = sum / (double)(hi - lo);
+        if ((pixels[p].min != minV) || (pixels[p].max != maxV) || (fabs(pixels[p].mean - mean) > 1e-3 * (fabs(mean) + maxV - minV + 1)))
+        {
+            if (errors++ < 5)
+            {
+                fprintf(stderr, "pixel %u: min %.3f/%.3f  max %.3f/%.3f  mean %.3f/%.3f\n", p, pixels[p].min, minV,
+                    pixels[p].max, maxV, pixels[p].mean, mean);
+            }
+        }
+    }
+    return errors;
+}
+
+/**
+* @brief printInfo: print the header of a columnar file
+*
+* @return None.
+*/
+static void printInfo(const char *path, ColumnFile &file)
+{
+    const ColumnHeader &h = file.info();
+    printf("file      %s  version %u  %llu bytes\n", path, h.version, (unsigned long long)h.fileSize);
+    printf("session   %u channels  raw %u Hz  RMS %.2f Hz  %.1f s  %llu events\n", h.channels, h.rawRate, file.rmsRateHz(),
+        file.durationSec(), (unsigned long long)h.events.count);
+    for (uint32_t c = 0; c < h.channels; c++)
+    {
+        printf("channel %u sensor %d  raw %llu samples @%llu  RMS %llu samples @%llu\n", c, h.sensors[c],
+            (unsigned long long)h.raw[c].count, (unsigned long long)h.raw[c].offset,
+            (unsigned long long)h.rms[c].count, (unsigned long long)h.rms[c].offset);
+    }
+}
+
+/**
+* @brief cmdColumns: convert the sessions to the columnar format and read those files
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdColumns(int argc, char **argv)
+{
+    const char *action = (argc > 0) ? argv[0] : "";
+    const char *path = (argc > 1) ? argv[1] : NULL;
+    const char *rawPath = NULL;
+    const char *rmsPath = NULL;
+    const char *eventsPath = NULL;
+    int skip = 0;
+    int rawRate = COLUMNS_RAW_RATE;
+    int rmsRate = 0;                                // 0: the RMS of the device, one per DSP_RMS_DECIMATION raw samples
+    int seconds = 60;
+    int channels = COLUMNS_MAX_CHANNELS;
+    int channel = 0;
+    int pixels = COLUMNS_VIEW_PIXELS;
+    bool useRms = false;
+    bool check = false;
+    double fromSec = 0;
+    double toSec = 1e12;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--raw") == 0) && (i + 1 < argc))            rawPath = argv[++i];
+        else if ((strcmp(argv[i], "--rms") == 0) && (i + 1 < argc) && (strcmp(action, "import") == 0))   rmsPath = argv[++i];
+        else if (strcmp(argv[i], "--rms") == 0)                           useRms = true;
+        else if ((strcmp(argv[i], "--events") == 0) && (i + 1 < argc))    eventsPath = argv[++i];
+        else if ((strcmp(argv[i], "--skip") == 0) && (i + 1 < argc))      skip = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--rate") == 0) && (i + 1 < argc))      rawRate = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--rms-rate") == 0) && (i + 1 < argc))  rmsRate = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--seconds") == 0) && (i + 1 < argc))   seconds = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--channels") == 0) && (i + 1 < argc))  channels = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--channel") == 0) && (i + 1 < argc))   channel = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))      fromSec = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))        toSec = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--pixels") == 0) && (i + 1 < argc))    pixels = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--check") == 0)                         check = true;
+        else
+        {
+            fprintf(stderr, "columns: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((path == NULL) || (skip < 0) || (rawRate <= 0) || (rmsRate < 0) || (seconds <= 0) ||
+        (channels <= 0) || (channels > COLUMNS_MAX_CHANNELS) || (channel < 0) || (pixels <= 0))
+    {
+        action = "";
+    }
+
+    if (strcmp(action, "import") == 0)
+    {
+        TextShape rawShape;
+        TextShape rmsShape = { 0, 0 };
+        std::vector<ColumnEvent> events;
+        if ((rawPath == NULL) || (scanText(rawPath, skip, &rawShape) == false))
+        {
+            fprintf(stderr, "columns: %s: no samples\n", (rawPath != NULL) ? rawPath : "--raw missing");
+            return 1;
+        }
+        if ((rmsPath != NULL) && ((scanText(rmsPath, skip, &rmsShape) == false) || (rmsShape.channels != rawShape.channels)))
+        {
+            fprintf(stderr, "columns: %s: no samples or not the channels of the raw export\n", rmsPath);
+            return 1;
+        }
+        if ((eventsPath != NULL) && (loadEvents(eventsPath, (uint32_t)rawRate, &events) == false))
+        {
+            fprintf(stderr, "columns: %s: cannot read file\n", eventsPath);
+            return 1;
+        }
+
+        ColumnLayout layout;
+        ColumnWriter writer;
+        PyramidBuilder pyramid;
+        memset(&layout, 0, sizeof(layout));
+        layout.channels = rawShape.channels;
+        layout.rawRate = (uint32_t)rawRate;
+        layout.rmsRate = (rmsRate > 0) ? (uint32_t)rmsRate : COLUMNS_RMS_RATE;
+        layout.rmsDecimation = (rmsRate > 0) ? 0 : DSP_RMS_DECIMATION;
+        layout.rawCount = rawShape.frames;
+        layout.rmsCount = rmsShape.frames;
+        layout.eventCount = events.size();
+
+        int err = pyramid.begin(layout.channels, layout.rawRate, layout.rawCount);
+        if (err == ERR_OK)  err = writer.create(path, layout);
+        writer.setRawSink(PyramidBuilder::addEntry, &pyramid);
+        if (err == ERR_OK)  err = importText(writer, rawPath, skip, rawShape.channels, false);
+        if ((err == ERR_OK) && (rmsPath != NULL))   err = importText(writer, rmsPath, skip, rawShape.channels, true);
+        for (size_t e = 0; (err == ERR_OK) && (e < events.size()); e++)    err = writer.addEvent(events[e].sample, events[e].code, events[e].value);
+        if (err == ERR_OK)  err = writer.finish();
+        if (err == ERR_OK)  err = pyramid.write(pyramidPathFor(path).c_str());
+        if (err != ERR_OK)
+        {
+            fprintf(stderr, "columns: %s: conversion failed (%d)\n", path, err);
+            return 1;
+        }
+        printf("imported  %u channels  %llu raw  %llu RMS samples  %zu events\n", rawShape.channels,
+            (unsigned long long)rawShape.frames, (unsigned long long)rmsShape.frames, events.size());
+        return 0;
+    }
+
+    if (strcmp(action, "sim") == 0)
+    {
+        int err = simSession(path, (uint32_t)seconds, (uint32_t)channels);
+        if (err != ERR_OK)
+        {
+            fprintf(stderr, "columns: %s: cannot write file (%d)\n", path, err);
+            return 1;
+        }
+        return 0;
+    }
+
+    if ((strcmp(action, "info") == 0) || (strcmp(action, "read") == 0) || (strcmp(action, "pyramid") == 0) || (strcmp(action, "view") == 0))
+    {
+        ColumnFile file;
+        int err = file.open(path);
+        if (err != ERR_OK)
+        {
+            fprintf(stderr, "columns: %s: %s\n", path, (err == ERR_FILE_READ) ? "cannot read file" : "not a columnar file");
+            return 1;
+        }
+        if (strcmp(action, "info") == 0)
+        {
+            printInfo(path, file);
+            return 0;
+        }
+        if (strcmp(action, "pyramid") == 0)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            err = buildPyramid(path, file);
+            if (err != ERR_OK)
+            {
+                fprintf(stderr, "columns: %s: cannot write file (%d)\n", pyramidPathFor(path).c_str(), err);
+                return 1;
+            }
+            printf("pyramid   %s  %.1f ms\n", pyramidPathFor(path).c_str(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            return 0;
+        }
+        if ((uint32_t)channel >= file.info().channels)
+        {
+            fprintf(stderr, "columns: %s: %u channels\n", path, file.info().channels);
+            return 1;
+        }
+        if (strcmp(action, "view") == 0)
+        {
+            PyramidFile pyramid;
+            std::string pyramidPath = pyramidPathFor(path);
+            if (pyramid.open(pyramidPath.c_str(), file.info()) != ERR_OK)
+            {
+                fprintf(stderr, "columns: %s: missing or stale pyramid (columns pyramid %s)\n", pyramidPath.c_str(), path);
+                return 1;
+            }
+            std::vector<PyramidBucket> view((size_t)pixels);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            uint32_t drawn = pyramid.viewport(file, (uint32_t)channel, fromSec, toSec, (uint32_t)pixels, view.data());
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+            printf("view channel %d  %.3f..%.3f s  %u pixels  %.1f us\n", channel, (fromSec > 0) ? fromSec : 0.0,
+                (toSec < file.durationSec()) ? toSec : file.durationSec(), drawn, us);
+            if (check)
+            {
+                uint32_t errors = checkView(file, (uint32_t)channel, fromSec, toSec, view.data(), drawn);
+                printf("check     %s (%u pixels differ)\n", (errors == 0) ? "ok" : "FAILED", errors);
+                return (errors == 0) ? 0 : 1;
+            }
+            return 0;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t count = 0;
+        uint64_t first = 0;
+        const float *samples = useRms ? file.rms((uint32_t)channel, fromSec, toSec, &count, &first)
+                                      : file.raw((uint32_t)channel, fromSec, toSec, &count, &first);
+        float minV = 0, maxV = 0;
+        double sum = 0;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            float v = samples[i];
+            if ((i == 0) || (v < minV))     minV = v;
+            if ((i == 0) || (v > maxV))     maxV = v;
+            sum += v;
+        }
+        uint64_t eventCount = 0;
+        const ColumnEvent *events = file.events(fromSec, toSec, &eventCount);
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%s channel %d  samples %llu..%llu (%llu)  min %.3f  max %.3f  mean %.3f  %.1f us\n", useRms ? "rms" : "raw",
+            channel, (unsigned long long)first, (unsigned long long)(first + count), (unsigned long long)count,
+            minV, maxV, (count > 0) ? sum / count : 0.0, us);
+        for (uint64_t e = 0; e < eventCount; e++)
+        {
+            printf("event     %.3f s  code %u  value %.3f\n", (double)events[e].sample / file.info().rawRate, events[e].code, events[e].value);
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "usage: columns import <file.amc> --raw <text> [--rms <text>] [--events <text>] [--skip N] [--rate Hz] [--rms-rate Hz]\n"
+                    "       columns sim <file.amc> [--seconds N] [--channels N]\n"
+                    "       columns info|pyramid <file.amc>\n"
+                    "       columns read <file.amc> [--channel N] [--rms] [--from s] [--to s]\n"
+                    "       columns view <file.amc> [--channel N] [--from s] [--to s] [--pixels N] [--check]\n");
+    return 2;
+}
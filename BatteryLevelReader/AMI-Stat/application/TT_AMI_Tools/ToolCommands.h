@@ -0,0 +1,172 @@
+/*
+* ToolCommands.h : This file contains the entry points of the TT_AMI_Tools commands
+*
+*   In a nutshell, each command:
+*       - receives the arguments following its name on the command line
+*       - prints its results on stdout and its errors on stderr
+*       - returns the process exit code (0: success)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TOOLCOMMANDS_H
+#define _TOOLCOMMANDS_H
+
+/**
+* @brief cmdReplay: feed a capture file back through the SLIP and update protocol engines
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdReplay(int argc, char **argv);
+
+/**
+* @brief cmdTrace: decode a trace file: statistics per trace point and update session timelines
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdTrace(int argc, char **argv);
+
+/**
+* @brief cmdBench: run the benchmarks of the protocol engines, save or compare with a baseline
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: regression beyond the threshold)
+*/
+int cmdBench(int argc, char **argv);
+
+/**
+* @brief cmdDownload: download every session stored in one or many devices, report the throughput
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: sessions failed)
+*/
+int cmdDownload(int argc, char **argv);
+
+/**
+* @brief cmdExport: export the recorded sessions of a folder in parallel, skipping those up to date
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: sessions failed)
+*/
+int cmdExport(int argc, char **argv);
+
+/**
+* @brief cmdColumns: convert the sessions to the columnar format, read ranges of those files, draw
+*           viewports from their level of detail pyramid
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdColumns(int argc, char **argv);
+
+/**
+* @brief cmdStream: acquire the samples streamed by a device (or a synthetic source) through the
+*           acquisition pipeline, report the throughput, overruns and latency of its consumers
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: samples lost without an overrun counted, source failure)
+*/
+int cmdStream(int argc, char **argv);
+
+/**
+* @brief cmdDsp: check the signal processing kernels against the scalar reference, and the RMS
+*           they compute against the RMS recorded in a session
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: a check failed, the RMS differ)
+*/
+int cmdDsp(int argc, char **argv);
+
+/**
+* @brief cmdPackets: decode a synthetic stream of binary "B" packets, check the samples and the
+*           loss and checksum counters, report the decoding rate
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: samples or counters wrong)
+*/
+int cmdPackets(int argc, char **argv);
+
+/**
+* @brief cmdCatalog: update the index of the session headers of a folder (new and changed files
+*           read in parallel), query it by patient, device, type of session and date
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdCatalog(int argc, char **argv);
+
+/**
+* @brief cmdUpload: upload files to a device, batches pipelined and sent again when refused, the
+*           files the device holds unchanged skipped
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: files failed)
+*/
+int cmdUpload(int argc, char **argv);
+
+/**
+* @brief cmdInventory: collect the inventory of a fleet of devices in parallel (commands pipelined
+*           per device) into a JSON and an indexed binary snapshot, query the snapshot
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdInventory(int argc, char **argv);
+
+/**
+* @brief cmdHealth: estimate the battery health of the devices of a telemetry store (capacity,
+*           internal resistance, trends, packs draining faster than the fleet), fill a store with
+*           a simulated fleet
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdHealth(int argc, char **argv);
+
+/**
+* @brief cmdQuery: filter, group and aggregate the battery telemetry of a fleet or the history of
+*           its firmware updates (e.g. discharge rate per firmware, failures by error code per week),
+*           write a simulated update history
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdQuery(int argc, char **argv);
+
+/**
+* @brief cmdAnomaly: detect the battery anomalies in the samples of a telemetry store, or in a
+*           simulated fleet streamed live, and rate the detection
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdAnomaly(int argc, char **argv);
+
+/**
+* @brief cmdCharge: check the forecast of the charge time to a battery level (the level required
+*           for an update) against the charges of a telemetry store
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdCharge(int argc, char **argv);
+
+#endif // _TOOLCOMMANDS_H
@@ -0,0 +1,279 @@
+/*
+* ToolDownload.cpp : This file contains the "download" command: download of every session stored
+*               in one or many devices, one file per session.
+*
+*   In a nutshell, this command:
+*       - downloads the devices in parallel, one thread and one SessionDownloader per device, each
+*           streaming its batches to disk through its own write-behind thread
+*       - reaches the devices through the AMI SDK (--device, --scan; Win32 build only) or through
+*           simulated devices (--sim), with lost and erroneous batches (--loss, --errors) to
+*           exercise the retries, and checks the files written against the simulated content (--verify)
+*       - creates the folder when missing; prints the cause of each session that failed
+*       - re-requests the missing batches after --idle-ms / --retry-ms: the defaults suit the
+*           Bluetooth link, a simulated device answers at once and uses much shorter ones
+*       - reports per device and in total: sessions downloaded, failed and skipped, bytes,
+*           batches, retries, duration and throughput
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ToolCommands.h"
+#include "SessionDownload.h"
+#include "SimSessions.h"
+#include "SdkSessions.h"
+#include "FileFolder.h"
+#include "ErrCodes.h"
+
+#define DOWNLOAD_MAX_DEVICES    32          // Max number of devices downloaded at once
+#define DOWNLOAD_SIM_SESSIONS   4           // Default number of sessions of a simulated device
+#define DOWNLOAD_SIM_BYTES      (1024 * 1024)   // Default size of a simulated session
+#define DOWNLOAD_SIM_IDLE_MS    100         // Default timeouts with simulated devices (no link latency)
+#define DOWNLOAD_SIM_RETRY_MS   50
+
+typedef struct
+{
+    IStoredSessions *source;    // Device
+    uint32_t idleMs;            // Timeouts of the retries
+    uint32_t retryMs;
+    DownloadStats stats;        // Statistics of its download
+    std::vector<std::string> errors;    // Sessions that failed and why
+    int err;                    // Result of the download
+} DownloadJob;
+
+/**
+* @brief downloadDevice: download every session of a device (thread of the device)
+*
+* @param job:       device and results
+* @param folder:    folder receiving the files
+* @return None.
+*/
+static void downloadDevice(DownloadJob *job, const char *folder)
+{
+    SessionDownloader downloader(job->source);
+    downloader.setTimeouts(job->idleMs, job->retryMs);
+    job->err = downloader.run(folder, &job->stats);
+    job->errors = downloader.errors();
+}
+
+/**
+* @brief printStats: print the statistics of a download
+*
+* @param label:     device name, or "total"
+* @param stats:     statistics
+* @return None.
+*/
+static void printStats(const char *label, const DownloadStats &stats)
+{
+    double seconds = stats.durationMs / 1000.0;
+    double mb = stats.bytes / (1024.0 * 1024.0);
+
+    printf("%-24s sessions %4u  failed %3u  skipped %3u  %9.2f MB  batches %7u  retries %5u  %7.2f s  %8.2f MB/s\n",
+        label, stats.sessions, stats.failed, stats.skipped, mb, stats.batches, stats.retries, seconds,
+        (seconds > 0) ? mb / seconds : 0.0);
+}
+
+/**
+* @brief verifySim: check the files of a simulated device against the content it sent
+*
+* @param folder:    folder of the files
+* @param label:     device name
+* @param sessions:  number of sessions
+* @param sessionBytes: size of each session
+* @return Number of files wrong or missing
+*/
+static int verifySim(const char *folder, const char *label, uint16_t sessions, uint32_t sessionBytes)
+{
+    std::vector<uint8_t> data(SIM_BATCH_BYTES);
+    int wrong = 0;
+
+    for (uint16_t index = 0; index < sessions; index++)
+    {
+        char path[DOWNLOAD_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s_%03u" DOWNLOAD_FILE_EXT, folder, label, index);
+        FILE *file = fopen(path, "rb");
+        bool ok = (file != NULL);
+        uint32_t offset = 0;
+        size_t len;
+
+        if (file == NULL)
+        {
+            fprintf(stderr, "download: %s: %s\n", path, strerror(errno));
+            wrong++;
+            continue;
+        }
+        while (ok && ((len = fread(data.data(), 1, data.size(), file)) > 0))
+        {
+            for (size_t i = 0; ok && (i < len); i++)    ok = (data[i] == simContent(index, offset + (uint32_t)i));
+            offset += (uint32_t)len;
+        }
+        if (file != NULL)           fclose(file);
+        if (ok && (offset != sessionBytes))             ok = false;
+        if (ok == false)
+        {
+            fprintf(stderr, "download: %s: wrong content\n", path);
+            wrong++;
+        }
+    }
+    return wrong;
+}
+
+/**
+* @brief cmdDownload: download every session stored in one or many devices
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: sessions failed)
+*/
+int cmdDownload(int argc, char **argv)
+{
+    const char *folder = NULL;
+    const char *scanFilter = "";
+    std::vector<std::string> deviceIds;
+    bool rms = false;
+    int simDevices = 0;
+    int simSessions = DOWNLOAD_SIM_SESSIONS;
+    long simBytes = DOWNLOAD_SIM_BYTES;
+    int lostEvery = 0;
+    int errorEvery = 0;
+    int idleMs = -1;                // -1: default of the source
+    int retryMs = -1;
+    bool verify = false;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--device") == 0) && (i + 1 < argc))         deviceIds.push_back(argv[++i]);
+        else if ((strcmp(argv[i], "--scan") == 0) && (i + 1 < argc))      scanFilter = argv[++i];
+        else if ((strcmp(argv[i], "--format") == 0) && (i + 1 < argc))    rms = (strcmp(argv[++i], "rms") == 0);
+        else if ((strcmp(argv[i], "--sim") == 0) && (i + 1 < argc))       simDevices = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--sessions") == 0) && (i + 1 < argc))  simSessions = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--size") == 0) && (i + 1 < argc))      simBytes = atol(argv[++i]);
+        else if ((strcmp(argv[i], "--loss") == 0) && (i + 1 < argc))      lostEvery = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--errors") == 0) && (i + 1 < argc))    errorEvery = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--idle-ms") == 0) && (i + 1 < argc))   idleMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--retry-ms") == 0) && (i + 1 < argc))  retryMs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--verify") == 0)                        verify = true;
+        else if ((argv[i][0] != '-') && (folder == NULL))                 folder = argv[i];
+        else
+        {
+            fprintf(stderr, "download: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((folder == NULL) || (simDevices < 0) || (simDevices > DOWNLOAD_MAX_DEVICES) || (simSessions < 0) ||
+        (simSessions > 0xFFFF) || (simBytes <= 0) || (lostEvery < 0) || (errorEvery < 0) || (idleMs == 0) || (retryMs == 0))
+    {
+        fprintf(stderr, "usage: download <folder> [--device id]... [--scan filter] [--format raw|rms] [--idle-ms N] [--retry-ms N]\n"
+                        "       download <folder> --sim N [--sessions N] [--size bytes] [--loss N] [--errors N] [--verify] [--idle-ms N] [--retry-ms N]\n");
+        return 2;
+    }
+    if (idleMs < 0)         idleMs = (simDevices > 0) ? DOWNLOAD_SIM_IDLE_MS : DOWNLOAD_IDLE_TIMEOUT_MS;
+    if (retryMs < 0)        retryMs = (simDevices > 0) ? DOWNLOAD_SIM_RETRY_MS : DOWNLOAD_RETRY_TIMEOUT_MS;
+    if (folderCreate(folder) != ERR_OK)
+    {
+        fprintf(stderr, "download: %s: cannot create the folder: %s\n", folder, strerror(errno));
+        return 1;
+    }
+
+    std::vector<IStoredSessions *> sources;
+    if (simDevices > 0)
+    {
+        for (int d = 0; d < simDevices; d++)
+        {
+            char label[16];
+            snprintf(label, sizeof(label), "sim%d", d);
+            SimSessions *sim = new SimSessions(label, (uint16_t)simSessions, (uint32_t)simBytes);
+            sim->setFaults(lostEvery, errorEvery);
+            sources.push_back(sim);
+        }
+    }
+    else
+    {
+#ifdef AMI_SDK
+        std::vector<SdkDevice> devices;
+        if (sdkScanDevices(scanFilter, &devices) != ERR_OK)
+        {
+            fprintf(stderr, "download: cannot initialize the AMI SDK\n");
+            return 1;
+        }
+        for (size_t d = 0; (d < devices.size()) && (sources.size() < DOWNLOAD_MAX_DEVICES); d++)
+        {
+            bool wanted = deviceIds.empty();
+            for (size_t k = 0; k < deviceIds.size(); k++)      wanted = wanted || (deviceIds[k] == devices[d].id);
+            if (wanted == false)    continue;
+
+            SdkSessions *sdk = new SdkSessions(devices[d], rms ? RMS : RAW);
+            if (sdk->open() != ERR_OK)
+            {
+                fprintf(stderr, "download: %s: cannot open the device\n", devices[d].id.c_str());
+                delete sdk;
+                continue;
+            }
+            sources.push_back(sdk);
+        }
+#else
+        (void)scanFilter;
+        (void)rms;
+        fprintf(stderr, "download: devices need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+    if (sources.empty())
+    {
+        fprintf(stderr, "download: no device\n");
+        return 1;
+    }
+
+    std::vector<DownloadJob> jobs(sources.size());
+    std::vector<std::thread> threads;
+    for (size_t d = 0; d < sources.size(); d++)
+    {
+        jobs[d].source = sources[d];
+        jobs[d].idleMs = (uint32_t)idleMs;
+        jobs[d].retryMs = (uint32_t)retryMs;
+        jobs[d].err = ERR_OK;
+        threads.push_back(std::thread(downloadDevice, &jobs[d], folder));
+    }
+
+    DownloadStats total;
+    memset(&total, 0, sizeof(total));
+    int failed = 0;
+    for (size_t d = 0; d < jobs.size(); d++)
+    {
+        threads[d].join();
+        const DownloadStats &s = jobs[d].stats;
+        if (jobs[d].err != ERR_OK)
+        {
+            fprintf(stderr, "download: %s: cannot list the sessions (%d)\n", sources[d]->label(), jobs[d].err);
+            failed++;
+        }
+        for (size_t e = 0; e < jobs[d].errors.size(); e++)     fprintf(stderr, "download: %s\n", jobs[d].errors[e].c_str());
+        printStats(sources[d]->label(), s);
+
+        total.sessions += s.sessions;
+        total.failed += s.failed;
+        total.skipped += s.skipped;
+        total.bytes += s.bytes;
+        total.batches += s.batches;
+        total.retries += s.retries;
+        if (s.durationMs > total.durationMs)    total.durationMs = s.durationMs;    // in parallel: the longest
+        failed += (int)s.failed;
+    }
+    if (jobs.size() > 1)    printStats("total", total);
+
+    for (size_t d = 0; d < sources.size(); d++)
+    {
+        if (verify && (simDevices > 0))     failed += verifySim(folder, sources[d]->label(), (uint16_t)simSessions, (uint32_t)simBytes);
+        delete sources[d];
+    }
+#ifdef AMI_SDK
+    if (simDevices == 0)    sdkEnd();
+#endif
+    return (failed > 0) ? 1 : 0;
+}
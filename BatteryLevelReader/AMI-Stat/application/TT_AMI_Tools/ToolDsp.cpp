@@ -0,0 +1,302 @@
+/*
+* ToolDsp.cpp : This file contains the "dsp" command: checks of the signal processing kernels
+*               (SignalDsp.h) against the scalar reference and against the recorded RMS.
+*
+*   In a nutshell, this command:
+*       - check: runs the notch filter, RMS envelope and decimator on a synthetic signal with the
+*           vectorized kernels and with the scalar ones, in one block and in blocks of random
+*           sizes, and compares the results; checks the rejection of the notch and the gain of
+*           the decimator at DC
+*       - rms: recomputes the RMS of a columnar session (SessionColumns.h) from its raw samples,
+*           optionally through the notch filter, and compares it with the RMS recorded next to
+*           them (the RMS streamed by the device, or imported with the session)
+*
+*   The throughput of the kernels is measured by the bench command (dsp.* benchmarks).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ToolCommands.h"
+#include "SignalDsp.h"
+#include "SessionColumns.h"
+#include "ErrCodes.h"
+
+#define DSP_CHECK_PI            3.14159265358979323846
+#define DSP_CHECK_SECONDS       30          // Duration of the signal of dsp check
+#define DSP_CHECK_TOLERANCE     1e-4        // Relative difference allowed between the kernels
+#define DSP_CHECK_REJECTION     20.0        // Attenuation (dB) of the notch expected at its frequency
+#define DSP_RMS_TOLERANCE       0.1         // Default relative difference (%) allowed by dsp rms
+#define DSP_SETTLE_SAMPLES      (4 * DSP_RAW_RATE)  // Samples ignored while the notch settles
+
+/**
+* @brief makeSignal: synthetic signal of each channel: a contraction-like sine, mains at 60 Hz
+*           and noise
+*
+* @param channels:  receives the samples of each channel
+* @param count:     samples per channel
+* @return None.
+*/
+static void makeSignal(std::vector<float> *channels, uint32_t count)
+{
+    uint32_t noise = 0x414D4931;
+
+    for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)
+    {
+        channels[c].resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            double t = (double)i / DSP_RAW_RATE;
+            noise = noise * 1103515245 + 12345;
+            double n = ((noise >> 16) & 0x7FFF) / 16384.0 - 1.0;
+            channels[c][i] = (float)(100.0 * sin(2 * DSP_CHECK_PI * (80 + 20 * c) * t) + 50.0 * sin(2 * DSP_CHECK_PI * DSP_NOTCH_US * t) + 10.0 * n);
+        }
+    }
+}
+
+/**
+* @brief maxRelative: largest difference between two arrays, relative to the largest value
+*
+* @return The difference
+*/
+static double maxRelative(const std::vector<float> &a, const std::vector<float> &b)
+{
+    double diff = 0, scale = 0;
+
+    if (a.size() != b.size())       return 1.0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        diff = fmax(diff, fabs((double)a[i] - b[i]));
+        scale = fmax(scale, fabs((double)b[i]));
+    }
+    return (scale > 0) ? diff / scale : diff;
+}
+
+/**
+* @brief runKernels: notch, RMS and decimation of the channels, in blocks
+*
+* @param input:     samples of each channel (DSP_MAX_CHANNELS)
+* @param block:     samples per block, 0 for blocks of random sizes
+* @param notched:   receives the filtered samples of each channel
+* @param rms:       receives the RMS of channel 0
+* @param decimated: receives the decimated samples of channel 0
+* @return None.
+*/
+static void runKernels(const std::vector<float> *input, uint32_t block, std::vector<float> *notched,
+                       std::vector<float> *rms, std::vector<float> *decimated)
+{
+    NotchFilter notch;
+    RmsEnvelope envelope;
+    Decimator decimator(DSP_RMS_DECIMATION);
+    uint32_t count = (uint32_t)input[0].size();
+    uint32_t seed = 7;
+
+    notch.design(DSP_RAW_RATE, DSP_NOTCH_US);
+    for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)     notched[c] = input[c];
+    rms->resize(count / DSP_RMS_DECIMATION + 1);
+    decimated->resize(count / DSP_RMS_DECIMATION + 1);
+
+    uint32_t rmsCount = 0, decimatedCount = 0;
+    for (uint32_t start = 0; start < count; )
+    {
+        uint32_t n = block;
+        if (n == 0)
+        {
+            seed = seed * 1103515245 + 12345;
+            n = 1 + (seed >> 16) % 300;                             // odd sizes, across the vector widths and hops
+        }
+        if (n > count - start)  n = count - start;
+
+        float *planes[DSP_MAX_CHANNELS];
+        for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)     planes[c] = notched[c].data() + start;
+        notch.process(planes, n, DSP_MAX_CHANNELS);
+        rmsCount += envelope.process(planes[0], n, rms->data() + rmsCount, (uint32_t)rms->size() - rmsCount);
+        decimatedCount += decimator.process(planes[0], n, decimated->data() + decimatedCount, (uint32_t)decimated->size() - decimatedCount);
+        start += n;
+    }
+    rms->resize(rmsCount);
+    decimated->resize(decimatedCount);
+}
+
+/**
+* @brief dspCheck: compare the vectorized kernels with the scalar ones
+*
+* @return process exit code (1: a check failed)
+*/
+static int dspCheck(void)
+{
+    std::vector<float> input[DSP_MAX_CHANNELS];
+    std::vector<float> notched[DSP_MAX_CHANNELS], rms, decimated;
+    std::vector<float> refNotched[DSP_MAX_CHANNELS], refRms, refDecimated;
+    int failures = 0;
+
+    makeSignal(input, DSP_CHECK_SECONDS * DSP_RAW_RATE);
+    dspForceScalar(true);
+    runKernels(input, (uint32_t)input[0].size(), refNotched, &refRms, &refDecimated);
+    dspForceScalar(false);
+    printf("kernels   %s\n", dspKernels());
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        const char *name = (pass == 0) ? "one block" : "random blocks";
+        runKernels(input, (pass == 0) ? (uint32_t)input[0].size() : 0, notched, &rms, &decimated);
+
+        double notchDiff = 0;
+        for (uint32_t c = 0; c < DSP_MAX_CHANNELS; c++)     notchDiff = fmax(notchDiff, maxRelative(notched[c], refNotched[c]));
+        double rmsDiff = maxRelative(rms, refRms);
+        double decimatedDiff = maxRelative(decimated, refDecimated);
+        bool ok = (notchDiff < DSP_CHECK_TOLERANCE) && (rmsDiff < DSP_CHECK_TOLERANCE) && (decimatedDiff < DSP_CHECK_TOLERANCE);
+
+        printf("%-13s notch %.2e  rms %.2e (%zu)  decimate %.2e (%zu)  %s\n", name, notchDiff, rmsDiff, rms.size(),
+            decimatedDiff, decimated.size(), ok ? "ok" : "FAILED");
+        if (ok == false)    failures++;
+    }
+
+    // rejection: a pure sine at the notch frequency, once the filter has settled
+    std::vector<float> mains(DSP_CHECK_SECONDS * DSP_RAW_RATE);
+    for (size_t i = 0; i < mains.size(); i++)   mains[i] = (float)sin(2 * DSP_CHECK_PI * DSP_NOTCH_US * i / DSP_RAW_RATE);
+    double before = sqrt(dspSumSquares(mains.data() + DSP_SETTLE_SAMPLES, (uint32_t)mains.size() - DSP_SETTLE_SAMPLES));
+    NotchFilter notch;
+    float *planes[1] = { mains.data() };
+    notch.design(DSP_RAW_RATE, DSP_NOTCH_US);
+    notch.process(planes, (uint32_t)mains.size(), 1);
+    double after = sqrt(dspSumSquares(mains.data() + DSP_SETTLE_SAMPLES, (uint32_t)mains.size() - DSP_SETTLE_SAMPLES));
+    double rejection = 20 * log10(before / fmax(after, 1e-12));
+    printf("notch     %.0f Hz rejected by %.1f dB  %s\n", DSP_NOTCH_US, rejection, (rejection >= DSP_CHECK_REJECTION) ? "ok" : "FAILED");
+    if (rejection < DSP_CHECK_REJECTION)    failures++;
+
+    // gain at DC: a constant comes out unchanged once the history is full
+    Decimator decimator(DSP_RMS_DECIMATION);
+    std::vector<float> dc(decimator.taps() * 2, 1.0f);
+    std::vector<float> out(dc.size() / DSP_RMS_DECIMATION + 1);
+    uint32_t n = decimator.process(dc.data(), (uint32_t)dc.size(), out.data(), (uint32_t)out.size());
+    double gain = (n > 0) ? out[n - 1] : 0;
+    bool ok = fabs(gain - 1.0) < 1e-4;
+    printf("decimator %u taps  gain at DC %.6f  %s\n", decimator.taps(), gain, ok ? "ok" : "FAILED");
+    if (ok == false)    failures++;
+
+    return (failures == 0) ? 0 : 1;
+}
+
+/**
+* @brief dspRms: recompute the RMS of a session from its raw samples, compare with its RMS column
+*
+* @param path:      columnar file
+* @param channel:   channel, -1 for all
+* @param notchFreq: notch applied to the raw samples first (0: none)
+* @param tolerance: relative difference allowed (%)
+* @return process exit code (1: the RMS differ)
+*/
+static int dspRms(const char *path, int channel, int notchFreq, double tolerance)
+{
+    ColumnFile file;
+    int err = file.open(path);
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "dsp: %s: %s\n", path, (err == ERR_FILE_READ) ? "cannot read file" : "not a columnar file");
+        return 1;
+    }
+    const ColumnHeader &h = file.info();
+    if ((channel >= 0) && ((uint32_t)channel >= h.channels))
+    {
+        fprintf(stderr, "dsp: %s: %u channels\n", path, h.channels);
+        return 1;
+    }
+
+    int failures = 0;
+    for (uint32_t c = 0; c < h.channels; c++)
+    {
+        if ((channel >= 0) && ((uint32_t)channel != c))     continue;
+
+        uint64_t rawCount = 0, rmsCount = 0;
+        const float *raw = file.raw(c, 0, file.durationSec() + 1, &rawCount);
+        const float *recorded = file.rms(c, 0, file.durationSec() + 1, &rmsCount);
+        if ((raw == NULL) || (recorded == NULL))
+        {
+            printf("channel %u  no %s samples\n", c, (raw == NULL) ? "raw" : "RMS");
+            failures++;
+            continue;
+        }
+
+        // The window of the RMS recorded: its decimation, or the raw samples per RMS at its rate
+        uint32_t window = h.rmsDecimation;
+        if ((window == 0) && (h.rmsRate > 0))   window = (uint32_t)((h.rawRate + h.rmsRate / 2) / h.rmsRate);
+        if (window == 0)                        window = DSP_RMS_DECIMATION;
+        NotchFilter notch;
+        RmsEnvelope envelope(window, window);
+        std::vector<float> block(DSP_RAW_RATE);
+        std::vector<float> rms((size_t)(rawCount / window + 1));
+        uint32_t computed = 0;
+        notch.design(h.rawRate, notchFreq);
+        for (uint64_t start = 0; start < rawCount; start += block.size())
+        {
+            uint32_t n = (uint32_t)((rawCount - start < block.size()) ? rawCount - start : block.size());
+            float *planes[1] = { block.data() };
+            memcpy(block.data(), raw + start, n * sizeof(float));
+            notch.process(planes, n, 1);
+            computed += envelope.process(block.data(), n, rms.data() + computed, (uint32_t)rms.size() - computed);
+        }
+
+        uint64_t compared = (computed < rmsCount) ? computed : rmsCount;
+        double maxDiff = 0, maxRel = 0, scale = 0;
+        for (uint64_t i = 0; i < compared; i++)     scale = fmax(scale, fabs((double)recorded[i]));
+        for (uint64_t i = 0; i < compared; i++)
+        {
+            double diff = fabs((double)rms[i] - recorded[i]);
+            maxDiff = fmax(maxDiff, diff);
+            if (scale > 0)  maxRel = fmax(maxRel, diff / scale);
+        }
+        bool match = (compared > 0) && (maxRel * 100 <= tolerance);
+        printf("channel %u  computed %u  recorded %llu  compared %llu  max diff %.4f (%.4f %%)  %s\n", c, computed,
+            (unsigned long long)rmsCount, (unsigned long long)compared, maxDiff, maxRel * 100, match ? "match" : "DIFFER");
+        if (match == false)     failures++;
+    }
+    return (failures == 0) ? 0 : 1;
+}
+
+/**
+* @brief cmdDsp: check the signal processing kernels
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdDsp(int argc, char **argv)
+{
+    const char *action = (argc > 0) ? argv[0] : "";
+    const char *path = NULL;
+    int channel = -1;
+    int notch = 0;
+    double tolerance = DSP_RMS_TOLERANCE;
+    int i = 1;
+
+    if ((strcmp(action, "rms") == 0) && (argc > 1))     path = argv[i++];
+    for (; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--channel") == 0) && (i + 1 < argc))        channel = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--notch") == 0) && (i + 1 < argc))     notch = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--tolerance") == 0) && (i + 1 < argc)) tolerance = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "dsp: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (strcmp(action, "check") == 0)
+    {
+        return dspCheck();
+    }
+    if ((strcmp(action, "rms") == 0) && (path != NULL) && (tolerance >= 0) && ((notch == 0) || (notch == 50) || (notch == 60)))
+    {
+        return dspRms(path, channel, notch, tolerance);
+    }
+
+    fprintf(stderr, "usage: dsp check\n"
+                    "       dsp rms <file.amc> [--channel N] [--notch 0|50|60] [--tolerance pct]\n");
+    return 2;
+}
@@ -0,0 +1,183 @@
+/*
+* ToolExport.cpp : This file contains the "export" command: export of a folder of recorded
+*               sessions, in parallel.
+*
+*   In a nutshell, this command:
+*       - exports the sessions with a pool of worker threads (--jobs, one per core by default),
+*           skipping the sessions whose output is up to date (--force exports them all)
+*       - reaches the sessions through the AMI SDK (Win32 build only), or through simulated
+*           sessions (--sim) to measure the scheduling without the SDK
+*       - reports the aggregate progress every EXPORT_REPORT_MS, then the files exported,
+*           skipped and failed, the bytes and samples, the duration and the throughput
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ToolCommands.h"
+#include "SessionExport.h"
+#include "SdkSessions.h"
+#include "ErrCodes.h"
+#include "FileFolder.h"
+
+#define EXPORT_SIM_BYTES        (256 * 1024)    // Default size of a simulated session
+#define EXPORT_SIM_MS           20              // Default time to export a simulated session
+#define EXPORT_SIM_STEPS        10              // Progress steps of a simulated export
+#define EXPORT_SIM_MTIME        1700000000      // Modification time of the simulated sessions
+
+/**
+* Simulated sessions: "session_NNNN.myx", exported as text with one sample per line
+*/
+class SimExporter : public ISessionExporter
+{
+public:
+    SimExporter(uint32_t _files, uint32_t _bytes, uint32_t _exportMs, uint32_t _touched)
+    : files(_files), bytes(_bytes), exportMs(_exportMs), touched(_touched)     {}
+
+    int list(const char *folder, std::vector<ExportSource> *sources)
+    {
+        sources->clear();
+        for (uint32_t i = 0; i < files; i++)
+        {
+            char name[64];
+            ExportSource source;
+            snprintf(name, sizeof(name), "session_%04u", i);
+            source.path = std::string(folder) + "/" + name + ".myx";
+            source.name = std::string(name) + ".txt";
+            source.fingerprint = exportFingerprint(&i, sizeof(i));
+            source.mtime = EXPORT_SIM_MTIME + ((i < touched) ? 1 : 0);    // the first sessions modified since
+            source.size = bytes;
+            sources->push_back(source);
+        }
+        return ERR_OK;
+    }
+
+    int exportFile(const ExportSource &source, const char *path, ExportProgress_t fnct, void *ctx, uint32_t *samples)
+    {
+        FILE *file = fopen(path, "w");
+        if (file == NULL)       return ERR_FILE_WRITE;
+
+        uint32_t count = (uint32_t)(source.size / 4);
+        for (int step = 1; step <= EXPORT_SIM_STEPS; step++)
+        {
+            for (uint32_t s = count * (step - 1) / EXPORT_SIM_STEPS; s < count * step / EXPORT_SIM_STEPS; s++)
+            {
+                fprintf(file, "%u\t%d\n", s, (int)(s % 1000) - 500);
+            }
+            systemClock()->sleepMs(exportMs / EXPORT_SIM_STEPS);
+            fnct(ctx, step * 100 / EXPORT_SIM_STEPS);
+        }
+        *samples = count;
+        return (fclose(file) == 0) ? ERR_OK : ERR_FILE_WRITE;
+    }
+
+private:
+    uint32_t files;                     // Number of sessions
+    uint32_t bytes;                     // Size of each session
+    uint32_t exportMs;                  // Time to export a session
+    uint32_t touched;                   // Number of sessions modified since EXPORT_SIM_MTIME
+};
+
+/**
+* @brief printProgress: print the progress of the export (ExportReport_t)
+*
+* @return None.
+*/
+static void printProgress(void *ctx, const ExportStats *stats, double percent)
+{
+    (void)ctx;
+    double seconds = stats->durationMs / 1000.0;
+    double mb = stats->bytes / (1024.0 * 1024.0);
+
+    fprintf(stderr, "progress %5.1f%%  exported %u  skipped %u  failed %u / %u  %7.2f MB/s  %7.1f files/s\n",
+        percent, stats->exported, stats->skipped, stats->failed, stats->files,
+        (seconds > 0) ? mb / seconds : 0.0, (seconds > 0) ? stats->exported / seconds : 0.0);
+}
+
+/**
+* @brief cmdExport: export the recorded sessions of a folder in parallel
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: sessions failed)
+*/
+int cmdExport(int argc, char **argv)
+{
+    const char *srcFolder = NULL;
+    const char *dstFolder = NULL;
+    int jobs = 0;
+    bool force = false;
+    bool quiet = false;
+    int simFiles = 0;
+    long simBytes = EXPORT_SIM_BYTES;
+    int simMs = EXPORT_SIM_MS;
+    int simTouched = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--jobs") == 0) && (i + 1 < argc))           jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--force") == 0)                         force = true;
+        else if (strcmp(argv[i], "--quiet") == 0)                         quiet = true;
+        else if ((strcmp(argv[i], "--sim") == 0) && (i + 1 < argc))       simFiles = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--size") == 0) && (i + 1 < argc))      simBytes = atol(argv[++i]);
+        else if ((strcmp(argv[i], "--ms") == 0) && (i + 1 < argc))        simMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--touch") == 0) && (i + 1 < argc))     simTouched = atoi(argv[++i]);
+        else if ((argv[i][0] != '-') && (srcFolder == NULL))              srcFolder = argv[i];
+        else if ((argv[i][0] != '-') && (dstFolder == NULL))              dstFolder = argv[i];
+        else
+        {
+            fprintf(stderr, "export: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((srcFolder == NULL) || (dstFolder == NULL) || (jobs < 0) || (jobs > EXPORT_MAX_WORKERS) ||
+        (simFiles < 0) || (simBytes < 0) || (simMs < 0) || (simTouched < 0))
+    {
+        fprintf(stderr, "usage: export <sessions folder> <output folder> [--jobs N] [--force] [--quiet]\n"
+                        "       export <sessions folder> <output folder> --sim N [--size bytes] [--ms N] [--touch N] [--jobs N] [--force]\n");
+        return 2;
+    }
+
+    if (folderCreate(dstFolder) != ERR_OK)
+    {
+        fprintf(stderr, "export: %s: cannot create the folder: %s\n", dstFolder, strerror(errno));
+        return 1;
+    }
+
+    ISessionExporter *exporter = NULL;
+    if (simFiles > 0)
+    {
+        exporter = new SimExporter((uint32_t)simFiles, (uint32_t)simBytes, (uint32_t)simMs, (uint32_t)simTouched);
+    }
+    else
+    {
+#ifdef AMI_SDK
+        exporter = new SdkExporter();
+#else
+        fprintf(stderr, "export: recorded sessions need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+
+    BatchExporter batch(exporter, (unsigned)jobs);
+    ExportStats stats;
+    batch.setForce(force);
+    int err = batch.run(srcFolder, dstFolder, &stats, quiet ? NULL : printProgress, NULL);
+    delete exporter;
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "export: %s: cannot list the sessions (%d)\n", srcFolder, err);
+        return 1;
+    }
+
+    double seconds = stats.durationMs / 1000.0;
+    double mb = stats.bytes / (1024.0 * 1024.0);
+    printf("sessions  %u  exported %u  skipped %u (up to date)  failed %u  workers %u\n",
+        stats.files, stats.exported, stats.skipped, stats.failed, batch.workerCount());
+    printf("exported  %.2f MB  %llu samples  %.2f s  %.2f MB/s  %.1f files/s\n", mb, (unsigned long long)stats.samples,
+        seconds, (seconds > 0) ? mb / seconds : 0.0, (seconds > 0) ? stats.exported / seconds : 0.0);
+    return (stats.failed > 0) ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+/*
+* ToolHealth.cpp : This file contains the "health" command: health of the batteries of a fleet
+*               (remaining capacity, internal resistance, trends, packs draining faster than the
+*               rest of the fleet) estimated from the telemetry store of AMIStat.
+*
+*   In a nutshell, this command:
+*       - report: estimates every device of a store (Log\Telemetry) with a BatteryFleetHealth,
+*           the devices scanned in parallel column by column (--jobs), and lists the packs flagged
+*           (every device with --all). --rows estimates from the rows of TelemetryStore::query
+*           instead, one device after the other, to compare the scan times
+*       - sim: fills a store with the history of a simulated fleet (--devices, --days, a sample
+*           every --period seconds): a working day on battery, charged in the evening, on the
+*           charger at night and on weekends. Every Nth pack is worn (--worn): smaller, fading
+*           fast, its resistance rising
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "BatteryHealth.h"
+#include "TelemetryStore.h"
+#include "SessionCatalog.h"
+#include "FileFolder.h"
+#include "ErrCodes.h"
+
+#define HEALTH_SIM_DEVICES      100         // Default number of simulated devices
+#define HEALTH_SIM_DAYS         365         // Default days of history
+#define HEALTH_SIM_PERIOD_S     300         // Default period of the samples
+#define HEALTH_SIM_WORN         20          // Default: every 20th pack is worn
+#define HEALTH_SIM_START_MS     1735689600000LL     // 2025-01-01 00:00 UTC
+#define HEALTH_SIM_LOAD_MA      200         // Current drawn by a device in use
+#define HEALTH_SIM_CHARGE_MA    400         // Charge current (constant current part)
+#define HEALTH_SIM_USE_RATE     8.0         // SOC drop of a new pack in use (% per hour)
+#define HEALTH_SIM_CC_RATE      25.0        // SOC rise of a new pack, constant current (% per hour)
+#define HEALTH_SIM_CV_RATE      5.0         // SOC rise of a new pack, constant voltage (% per hour)
+#define HEALTH_MS_PER_DAY       86400000LL
+
+/**
+* Simulated pack: its capacity and resistance drift linearly over the days
+*/
+typedef struct
+{
+    char serial[TLM_SERIAL_LEN];
+    double capacity;            // Capacity on the first day (fraction of a new pack)
+    double fadePerYear;         // Capacity lost per year (fraction of a new pack)
+    double resistance;          // Resistance on the first day (mOhm)
+    double risePerYear;         // Resistance gained per year (mOhm)
+    double usage;               // Load of the device against the fleet (1: average)
+    int startHour;              // Hour the working day starts
+    int hours;                  // Length of the working day
+} SimPack;
+
+/**
+* @brief simRandom: next number of a linear congruential generator
+*
+* @param state:     generator state, updated
+* @return A number in [0, 1)
+*/
+static double simRandom(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / 16777216.0;
+}
+
+/**
+* @brief healthSim: "health sim"
+*
+* @return process exit code
+*/
+static int healthSim(const char *folder, int argc, char **argv)
+{
+    int devices = HEALTH_SIM_DEVICES;
+    int days = HEALTH_SIM_DAYS;
+    int period = HEALTH_SIM_PERIOD_S;
+    int worn = HEALTH_SIM_WORN;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--devices") == 0) && (i + 1 < argc))        devices = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--days") == 0) && (i + 1 < argc))      days = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--period") == 0) && (i + 1 < argc))    period = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--worn") == 0) && (i + 1 < argc))      worn = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "health: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((devices < 1) || (days < 1) || (period < 1) || (worn < 0))
+    {
+        fprintf(stderr, "usage: health sim <store folder> [--devices N] [--days N] [--period s] [--worn N]\n");
+        return 2;
+    }
+
+    if (folderCreate(folder) != ERR_OK)
+    {
+        fprintf(stderr, "health: %s: cannot create the folder: %s\n", folder, strerror(errno));
+        return 1;
+    }
+    TelemetryStore store;
+    if (store.open(folder) != TLM_OK)
+    {
+        fprintf(stderr, "health: %s: cannot open the store\n", folder);
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint32_t seed = 12345;
+    uint64_t written = 0;
+    int err = TLM_OK;
+    printf("worn     ");
+    for (int d = 0; (d < devices) && (err == TLM_OK); d++)
+    {
+        SimPack pack;
+        bool isWorn = (worn > 0) && ((d % worn) == worn - 1);
+        snprintf(pack.serial, sizeof(pack.serial), "SIM%05d", d);
+        pack.capacity = isWorn ? 0.85 : 1.0 - 0.05 * simRandom(&seed);
+        pack.fadePerYear = isWorn ? 0.35 : 0.05 + 0.07 * simRandom(&seed);
+        pack.resistance = isWorn ? 200.0 : 130.0 + 40.0 * simRandom(&seed);
+        pack.risePerYear = isWorn ? 150.0 : 10.0 + 20.0 * simRandom(&seed);
+        pack.usage = 0.9 + 0.2 * simRandom(&seed);
+        pack.startHour = 7 + (int)(3 * simRandom(&seed));
+        pack.hours = 6 + (int)(3 * simRandom(&seed));
+        if (isWorn)     printf(" %s", pack.serial);
+
+        TelemetrySample s;
+        memset(&s, 0, sizeof(s));
+        memcpy(s.serial, pack.serial, sizeof(s.serial));
+        strcpy(s.firmware, "1.0.0.0");
+        double soc = 100.0;
+        int64_t samplesPerDay = HEALTH_MS_PER_DAY / ((int64_t)period * 1000);
+        for (int day = 0; (day < days) && (err == TLM_OK); day++)
+        {
+            double age = day / 365.0;
+            double capacity = pack.capacity - pack.fadePerYear * age;
+            double resistance = pack.resistance + pack.risePerYear * age;
+            bool workday = ((day % 7) < 5);
+            for (int64_t k = 0; (k < samplesPerDay) && (err == TLM_OK); k++)
+            {
+                int64_t tod = k * period * 1000;
+                double hours = period / 3600.0;
+                bool inUse = workday && (tod >= pack.startHour * 3600000LL) && (tod < (pack.startHour + pack.hours) * 3600000LL) && (soc > 5.0);
+                double current;
+                if (inUse)
+                {
+                    soc -= HEALTH_SIM_USE_RATE * pack.usage / capacity * hours;
+                    current = -HEALTH_SIM_LOAD_MA;
+                }
+                else if (soc < 80.0)
+                {
+                    soc += HEALTH_SIM_CC_RATE / capacity * hours;
+                    current = HEALTH_SIM_CHARGE_MA;
+                }
+                else
+                {
+                    soc += HEALTH_SIM_CV_RATE / capacity * hours;
+                    current = HEALTH_SIM_CHARGE_MA * (100.0 - soc) / 20.0;
+                }
+                soc = std::min(std::max(soc, 0.0), 100.0);
+
+                double ocv = 3300.0 + 9.0 * soc;
+                double noise = 6.0 * simRandom(&seed) - 3.0;
+                s.timestamp = HEALTH_SIM_START_MS + day * HEALTH_MS_PER_DAY + tod;
+                s.soc = (uint8_t)(soc + 0.5);
+                s.voltage = (uint16_t)(ocv + current * resistance / 1000.0 + noise);
+                s.charging = inUse ? 0 : 1;
+                err = store.append(s);
+                written++;
+            }
+        }
+    }
+    printf("\n");
+    if (err == TLM_OK)  err = store.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    store.close();
+    if (err != TLM_OK)
+    {
+        fprintf(stderr, "health: %s: cannot write the store (%d)\n", folder, err);
+        return 1;
+    }
+
+    printf("written  %d devices  %d days  %llu samples  %.2f s\n", devices, days, (unsigned long long)written, seconds);
+    return 0;
+}
+
+/**
+* @brief printHealth: print the estimation of one device
+*
+* @return None.
+*/
+static void printHealth(const BatteryHealth &h)
+{
+    static const struct { uint32_t flag; const char *name; } names[] =
+    {
+        { TLM_HEALTH_FAST_DRAIN, "fast-drain" }, { TLM_HEALTH_LOW_CAPACITY, "low-capacity" },
+        { TLM_HEALTH_RESISTANCE, "resistance" }, { TLM_HEALTH_NO_DATA, "no-data" },
+    };
+    std::string flags;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        if ((h.flags & names[i].flag) == 0)     continue;
+        if (flags.empty() == false)             flags += ",";
+        flags += names[i].name;
+    }
+    printf("%-16s %6.1f %+7.2f %7.2f %7.2f %7.0f %7.0f %+7.2f %6.1f  %s\n", h.serial, h.capacity, h.capacityTrend,
+        h.dischargeRate, h.chargeRate, h.voltageAt50, h.resistance, h.resistanceTrend, h.fleetScore, flags.c_str());
+}
+
+/**
+* @brief healthReport: "health report"
+*
+* @return process exit code (1: store not readable)
+*/
+static int healthReport(const char *folder, int argc, char **argv)
+{
+    BatteryHealthConfig cfg;
+    const char *serial = NULL;
+    int64_t from = INT64_MIN / 1000;
+    int64_t to = INT64_MAX / 1000;
+    int jobs = 0;
+    bool all = false;
+    bool rows = false;
+    bool valid = true;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--serial") == 0) && (i + 1 < argc))             serial = argv[++i];
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))          valid = valid && catalogParseDate(argv[++i], &from);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))            valid = valid && catalogParseDate(argv[++i], &to);
+        else if ((strcmp(argv[i], "--jobs") == 0) && (i + 1 < argc))          jobs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--new-rate") == 0) && (i + 1 < argc))      cfg.newDischargeRate = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--current") == 0) && (i + 1 < argc))       cfg.stepCurrentMa = atof(argv[++i]);
+        else if (strcmp(argv[i], "--all") == 0)                               all = true;
+        else if (strcmp(argv[i], "--rows") == 0)                              rows = true;
+        else
+        {
+            fprintf(stderr, "health: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((valid == false) || (jobs < 0) || (cfg.newDischargeRate < 0) || (cfg.stepCurrentMa <= 0))
+    {
+        fprintf(stderr, "usage: health report <store folder> [--serial sn] [--from YYYY-MM-DD[ hh:mm]] [--to YYYY-MM-DD[ hh:mm]]\n"
+                        "       [--jobs N] [--new-rate pct/h] [--current mA] [--all] [--rows]\n");
+        return 2;
+    }
+    from *= 1000;
+    to = (to == INT64_MAX / 1000) ? INT64_MAX : to * 1000;
+
+    if (folderExists(folder) == false)
+    {
+        fprintf(stderr, "health: %s: %s\n", folder, strerror(errno));
+        return 1;
+    }
+    TelemetryStore store;
+    if (store.open(folder) != TLM_OK)
+    {
+        fprintf(stderr, "health: %s: cannot open the store\n", folder);
+        return 1;
+    }
+
+    BatteryFleetHealth fleet(cfg, (unsigned)jobs);
+    std::vector<BatteryHealth> reports;
+    uint64_t scanned = 0;
+    int err = TLM_OK;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (rows)
+    {
+        // same estimation from the rows, to compare with the columnar scan
+        std::vector<std::string> serials;
+        store.serials(serials);
+        std::sort(serials.begin(), serials.end());
+        std::vector<TelemetrySample> samples;
+        BatteryHealthEstimator estimator(cfg);
+        for (size_t d = 0; d < serials.size(); d++)
+        {
+            samples.clear();
+            int e = store.query(serials[d].c_str(), from, to, samples);
+            if (e != TLM_OK)    err = e;
+            scanned += samples.size();
+            estimator.reset();
+            for (size_t i = 0; i < samples.size(); i++)
+            {
+                estimator.add(samples[i].timestamp, samples[i].soc, samples[i].voltage, samples[i].charging != 0);
+            }
+            estimator.flush();
+            reports.push_back(BatteryHealth());
+            estimator.report(serials[d].c_str(), &reports.back());
+        }
+        BatteryFleetHealth::rank(cfg, reports);
+    }
+    else
+    {
+        err = fleet.analyze(store, from, to, reports);
+        scanned = fleet.scannedSamples();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (err != TLM_OK)      fprintf(stderr, "health: %s: damaged blocks skipped (%d)\n", folder, err);
+
+    printf("%-16s %6s %7s %7s %7s %7s %7s %7s %6s  %s\n", "serial", "cap %", "/30d", "drain", "charge", "V@50%",
+        "R mOhm", "/30d", "score", "flags");
+    uint32_t flagged = 0;
+    for (size_t d = 0; d < reports.size(); d++)
+    {
+        bool shown = (serial != NULL) ? (strcmp(reports[d].serial, serial) == 0) : (all || (reports[d].flags != 0));
+        if (reports[d].flags != 0)  flagged++;
+        if (shown)                  printHealth(reports[d]);
+    }
+    printf("devices  %zu  flagged %u\n", reports.size(), flagged);
+    printf("scan     %llu samples  %.0f ms  %.1f M samples/s  %s\n", (unsigned long long)scanned, ms,
+        (ms > 0) ? scanned / ms / 1000.0 : 0.0, rows ? "rows, one device at a time" : "columns");
+    if (rows == false)  printf("jobs     %u\n", fleet.jobCount());
+    return 0;
+}
+
+/**
+* @brief cmdHealth: estimate the battery health of the devices of a telemetry store, fill a
+*           store with a simulated fleet
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdHealth(int argc, char **argv)
+{
+    if ((argc < 2) || (argv[1][0] == '-') || ((strcmp(argv[0], "report") != 0) && (strcmp(argv[0], "sim") != 0)))
+    {
+        fprintf(stderr, "usage: health report|sim <store folder> [options]\n");
+        return 2;
+    }
+    if (strcmp(argv[0], "sim") == 0)    return healthSim(argv[1], argc - 2, argv + 2);
+    return healthReport(argv[1], argc - 2, argv + 2);
+}
@@ -0,0 +1,316 @@
+/*
+* ToolInventory.cpp : This file contains the "inventory" command: snapshot of the identification,
+*               versions, battery, session memory, error log and last self-test of a fleet of
+*               devices, and queries on it.
+*
+*   In a nutshell, this command:
+*       - collect: queries the devices with a FleetInventory (--parallel devices at once,
+*           --depth commands in flight per device), writes the snapshot as "<snapshot>.json"
+*           and "<snapshot>.inv" (indexed binary), reports the collection time of each device
+*       - query: loads "<snapshot>.inv" and lists the devices of a serial number, a firmware
+*           version, a battery or free memory below a level, or whose collection failed
+*       - reaches the devices through the AMI SDK (--device, --scan; Win32 build only) or
+*           simulated devices (--sim): a connection time (--connect), a round trip per command
+*           (--rtt, the answers sharing the link) and unreachable devices (--unreachable)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ToolCommands.h"
+#include "FleetInventory.h"
+#include "SdkSessions.h"
+#include "ErrCodes.h"
+
+#define INVENTORY_SIM_CONNECT_MS    300     // Default connection time of a simulated device
+#define INVENTORY_SIM_RTT_MS        40      // Default round trip of a command
+#define INVENTORY_SIM_ANSWER_US     2000    // Transfer of an answer on the link of a simulated device
+#define INVENTORY_SIM_STORAGE       (512u * 1024 * 1024)    // Session memory of a simulated device
+#define INVENTORY_JSON_EXT          ".json" // Extension of the JSON snapshot
+#define INVENTORY_INDEX_EXT         ".inv"  // Extension of the binary snapshot
+
+static const char *simFirmwares[] = { "1.2.0.0", "1.3.0.0", "1.3.1.0" };
+
+/**
+* Simulated device "simNNN": the answers of its commands share its link, their round trips overlap
+*/
+class SimInventory : public IInventoryDevice
+{
+public:
+    SimInventory(uint32_t _index, uint32_t _connectMs, uint32_t _rttMs, bool _reachable)
+    : index(_index), connectMs(_connectMs), rttMs(_rttMs), reachable(_reachable)
+    {
+        snprintf(name, sizeof(name), "sim%03u", index);
+    }
+
+    const char *label(void)                                             { return name; }
+
+    int open(void)
+    {
+        systemClock()->sleepMs(connectMs);
+        return reachable ? ERR_OK : ERR_SLIP_TIMEOUT;
+    }
+
+    int query(uint32_t item, InventoryRecord *record)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(rttMs));
+        {
+            std::lock_guard<std::mutex> guard(link);
+            std::this_thread::sleep_for(std::chrono::microseconds(INVENTORY_SIM_ANSWER_US));
+        }
+
+        switch (item)
+        {
+            case INVENTORY_INFO:
+                snprintf(record->productNumber, sizeof(record->productNumber), "SA9000");
+                snprintf(record->serialNumber, sizeof(record->serialNumber), "GA%06u", 1000 + index * 7);
+                snprintf(record->firmwareVersion, sizeof(record->firmwareVersion), "%s", simFirmwares[index % 3]);
+                snprintf(record->subMcuVersion, sizeof(record->subMcuVersion), "0.%u.0", 4 + index % 2);
+                snprintf(record->hardwareVersion, sizeof(record->hardwareVersion), "2.0.0");
+                record->productType = 1;
+                record->hardwareConfig = 4;
+                return ERR_OK;
+            case INVENTORY_BATTERY:
+                record->soc = (uint8_t)((index * 37) % 101);
+                record->voltage = (uint16_t)(3500 + record->soc * 7);
+                record->charging = (index % 4 == 0) ? 1 : 0;
+                return ERR_OK;
+            case INVENTORY_MEMORY:
+                record->storageSize = INVENTORY_SIM_STORAGE;
+                record->sessionCount = (index * 13) % 200;
+                record->freeSpace = INVENTORY_SIM_STORAGE - record->sessionCount * (2u * 1024 * 1024);
+                return ERR_OK;
+            case INVENTORY_ERROR_LOG:
+                for (int e = 0; e < INVENTORY_ERROR_TYPES; e++)     record->errorLog[e] = (uint16_t)(((index + e) % 11 == 0) ? 1 + index % 3 : 0);
+                return ERR_OK;
+            case INVENTORY_SELFTEST:
+                snprintf(record->selftestDate, sizeof(record->selftestDate), "2024-%02u-%02u 09:%02u:00", 1 + index % 12, 1 + index % 28, index % 60);
+                return ERR_OK;
+        }
+        return ERR_INV_RESPONSE;
+    }
+
+    void close(void)                                                    {}
+
+private:
+    uint32_t index;                     // Number of the device
+    uint32_t connectMs;                 // Connection time
+    uint32_t rttMs;                     // Round trip of a command
+    bool reachable;                     // The connection succeeds
+    char name[16];                      // Label
+    std::mutex link;                    // Held while an answer is transferred
+};
+
+/**
+* @brief printRecord: print one line per device
+*
+* @return None.
+*/
+static void printRecord(const InventoryRecord &r)
+{
+    char battery[16] = "-";
+    char memory[16] = "-";
+
+    if (r.items & INVENTORY_BATTERY)    snprintf(battery, sizeof(battery), "%u%%%s", r.soc, r.charging ? "+" : "");
+    if ((r.items & INVENTORY_MEMORY) && (r.storageSize > 0))   snprintf(memory, sizeof(memory), "%.0f%%", 100.0 * r.freeSpace / r.storageSize);
+    printf("%-16s  %-10s  %-10s  %-8s  bat %-5s  free %-4s  %-19s  %5u ms  %s\n", r.label, (r.items & INVENTORY_INFO) ? r.serialNumber : "-",
+        (r.items & INVENTORY_INFO) ? r.firmwareVersion : "-", (r.items & INVENTORY_INFO) ? r.subMcuVersion : "-", battery, memory,
+        (r.items & INVENTORY_SELFTEST) ? r.selftestDate : "-", r.collectMs, (r.err == ERR_OK) ? "ok" : "FAILED");
+}
+
+/**
+* @brief inventoryCollect: "inventory collect"
+*
+* @return process exit code (1: devices failed)
+*/
+static int inventoryCollect(const char *snapshot, int argc, char **argv)
+{
+    std::vector<std::string> deviceIds;
+    const char *scanFilter = "";
+    int parallel = INVENTORY_PARALLEL;
+    int depth = INVENTORY_DEPTH;
+    int simDevices = 0;
+    int connectMs = INVENTORY_SIM_CONNECT_MS;
+    int rttMs = INVENTORY_SIM_RTT_MS;
+    int unreachable = 0;
+    bool quiet = false;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--parallel") == 0) && (i + 1 < argc))       parallel = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--depth") == 0) && (i + 1 < argc))     depth = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--device") == 0) && (i + 1 < argc))    deviceIds.push_back(argv[++i]);
+        else if ((strcmp(argv[i], "--scan") == 0) && (i + 1 < argc))      scanFilter = argv[++i];
+        else if ((strcmp(argv[i], "--sim") == 0) && (i + 1 < argc))       simDevices = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--connect") == 0) && (i + 1 < argc))   connectMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--rtt") == 0) && (i + 1 < argc))       rttMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--unreachable") == 0) && (i + 1 < argc))   unreachable = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--quiet") == 0)                         quiet = true;
+        else
+        {
+            fprintf(stderr, "inventory: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((parallel < 1) || (parallel > INVENTORY_MAX_PARALLEL) || (depth < 1) || (depth > INVENTORY_MAX_DEPTH) ||
+        (simDevices < 0) || (connectMs < 0) || (rttMs < 0) || (unreachable < 0))
+    {
+        fprintf(stderr, "usage: inventory collect <snapshot> [--parallel N] [--depth N] [--device id]... [--scan filter] [--quiet]\n"
+                        "       inventory collect <snapshot> --sim N [--connect ms] [--rtt ms] [--unreachable N] [--parallel N] [--depth N]\n");
+        return 2;
+    }
+
+    std::vector<IInventoryDevice *> devices;
+    if (simDevices > 0)
+    {
+        for (int d = 0; d < simDevices; d++)
+        {
+            bool reachable = (unreachable == 0) || (d % unreachable != unreachable - 1);
+            devices.push_back(new SimInventory((uint32_t)d, (uint32_t)connectMs, (uint32_t)rttMs, reachable));
+        }
+    }
+    else
+    {
+#ifdef AMI_SDK
+        std::vector<SdkDevice> found;
+        if (sdkScanDevices(scanFilter, &found) != ERR_OK)
+        {
+            fprintf(stderr, "inventory: cannot initialize the AMI SDK\n");
+            return 1;
+        }
+        for (size_t d = 0; d < found.size(); d++)
+        {
+            bool wanted = deviceIds.empty();
+            for (size_t k = 0; k < deviceIds.size(); k++)      wanted = wanted || (deviceIds[k] == found[d].id);
+            if (wanted)     devices.push_back(new SdkInventory(found[d]));
+        }
+#else
+        (void)scanFilter;
+        fprintf(stderr, "inventory: devices need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+    if (devices.empty())
+    {
+        fprintf(stderr, "inventory: no device\n");
+#ifdef AMI_SDK
+        if (simDevices == 0)    sdkEnd();
+#endif
+        return 1;
+    }
+
+    FleetInventory inventory((unsigned)parallel, (unsigned)depth);
+    std::vector<InventoryRecord> records;
+    int64_t takenAt = (int64_t)::time(NULL);
+    int64_t collectMs = inventory.collect(devices, &records);
+    for (size_t d = 0; d < devices.size(); d++)     delete devices[d];
+#ifdef AMI_SDK
+    if (simDevices == 0)    sdkEnd();
+#endif
+
+    uint32_t failed = 0;
+    uint64_t sumMs = 0;
+    uint32_t slowest = 0;
+    for (size_t d = 0; d < records.size(); d++)
+    {
+        if (quiet == false)     printRecord(records[d]);
+        if (records[d].err != ERR_OK)   failed++;
+        sumMs += records[d].collectMs;
+        slowest = std::max(slowest, records[d].collectMs);
+    }
+
+    std::string jsonPath = std::string(snapshot) + INVENTORY_JSON_EXT;
+    std::string indexPath = std::string(snapshot) + INVENTORY_INDEX_EXT;
+    int err = inventorySaveJson(jsonPath.c_str(), records, takenAt, collectMs);
+    if (err == ERR_OK)      err = inventorySaveIndex(indexPath.c_str(), records, takenAt, collectMs);
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "inventory: %s: cannot write the snapshot (%d)\n", snapshot, err);
+        return 1;
+    }
+
+    printf("devices   %zu  collected %zu  failed %u  parallel %u  depth %u\n", records.size(), records.size() - failed, failed,
+        inventory.parallelCount(), inventory.depthCount());
+    printf("collect   %lld ms  per device: mean %.0f ms  max %u ms  (%.0f ms one after the other)\n", (long long)collectMs,
+        (double)sumMs / records.size(), slowest, (double)sumMs);
+    printf("snapshot  %s  %s\n", jsonPath.c_str(), indexPath.c_str());
+    return (failed > 0) ? 1 : 0;
+}
+
+/**
+* @brief inventoryQuery: "inventory query"
+*
+* @return process exit code (1: no snapshot)
+*/
+static int inventoryQuery(const char *snapshot, int argc, char **argv)
+{
+    InventoryQuery q;
+
+    q.serial = NULL;
+    q.firmware = NULL;
+    q.socBelow = -1;
+    q.freeBelow = -1;
+    q.failed = false;
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--serial") == 0) && (i + 1 < argc))             q.serial = argv[++i];
+        else if ((strcmp(argv[i], "--firmware") == 0) && (i + 1 < argc))      q.firmware = argv[++i];
+        else if ((strcmp(argv[i], "--battery-below") == 0) && (i + 1 < argc)) q.socBelow = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--free-below") == 0) && (i + 1 < argc))    q.freeBelow = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--failed") == 0)                            q.failed = true;
+        else
+        {
+            fprintf(stderr, "inventory: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    std::string indexPath = std::string(snapshot) + INVENTORY_INDEX_EXT;
+    InventorySnapshot loaded;
+    int err = loaded.load(indexPath.c_str());
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "inventory: %s: no snapshot (%d), run inventory collect first\n", indexPath.c_str(), err);
+        return 1;
+    }
+
+    std::vector<const InventoryRecord *> found;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    loaded.select(q, &found);
+    double queryUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    for (size_t i = 0; i < found.size(); i++)   printRecord(*found[i]);
+    time_t takenAt = (time_t)loaded.time();
+    char date[32] = "";
+    struct tm *tm = gmtime(&takenAt);
+    if (tm != NULL)     strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", tm);
+    printf("matches   %zu of %zu devices  snapshot %s UTC  query %.1f us\n", found.size(), loaded.size(), date, queryUs);
+    return 0;
+}
+
+/**
+* @brief cmdInventory: collect the inventory of the devices in parallel, query the snapshot
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdInventory(int argc, char **argv)
+{
+    if ((argc < 2) || (argv[1][0] == '-') || ((strcmp(argv[0], "collect") != 0) && (strcmp(argv[0], "query") != 0)))
+    {
+        fprintf(stderr, "usage: inventory collect|query <snapshot> [options]\n");
+        return 2;
+    }
+    if (strcmp(argv[0], "collect") == 0)    return inventoryCollect(argv[1], argc - 2, argv + 2);
+    return inventoryQuery(argv[1], argc - 2, argv + 2);
+}
@@ -0,0 +1,201 @@
+/*
+* ToolPackets.cpp : This file contains the "packets" command: decoding of the binary stream
+*               packets of the "B" channel (StreamPacket.h) from a synthetic stream.
+*
+*   In a nutshell, this command:
+*       - builds the SLIP encoded stream of a device (simStream): both channels at 2048 Hz, with
+*           records lost (--loss), corrupted checksums (--corrupt) and JSON answers between the
+*           packets (--other)
+*       - feeds it to the parser in reads of random sizes around --chunk bytes, as they come
+*           from the connection (in place deframing), or frame by frame through Slip::read
+*           (--frames)
+*       - drains the rings after each read and checks every sample against the records sent,
+*           and the counters against the faults generated
+*       - reports the decoding rate (MB/s of encoded bytes, packets per second)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "ToolCommands.h"
+#include "SimDevice.h"
+#include "Slip.h"
+#include "StreamPacket.h"
+#include "ErrCodes.h"
+
+#define PACKETS_RATE            2048        // Records per second of the synthetic stream (SAMPLING_RATE)
+#define PACKETS_CHUNK           4096        // Default mean size of the reads
+#define PACKETS_RING            ACQ_RING_SAMPLES    // Capacity of the rings
+#define PACKETS_WAIT_MS         1000        // Wait of Slip::read (the stream ends with a timeout)
+
+/**
+* @brief BufferComm: connection delivering a stream once, in reads of random sizes
+*/
+class BufferComm : public IComm
+{
+public:
+    BufferComm(const std::vector<uint8_t> &_bytes, uint32_t _chunk) : bytes(_bytes), chunk(_chunk), pos(0), seed(1) {}
+
+    void close(void)                                                    {}
+    int send(const uint8_t *msg, int msgLen)                            { (void)msg; return msgLen; }
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
+    {
+        (void)maxWaitTimeMs;
+        int nb = std::min(std::min(maxLen, (int)(bytes.size() - pos)), (int)nextChunk());
+        memcpy(retMsg, bytes.data() + pos, nb);
+        pos += nb;
+        return nb;
+    }
+
+    /**
+    * @brief nextChunk: size of the next read, 1 to 2 * chunk - 1 bytes
+    *
+    * @return The size
+    */
+    uint32_t nextChunk(void)
+    {
+        seed = seed * 1103515245 + 12345;
+        return 1 + (seed >> 8) % (2 * chunk - 1);
+    }
+
+    bool done(void)                                                     { return pos == bytes.size(); }
+
+private:
+    const std::vector<uint8_t> &bytes;  // Stream
+    uint32_t chunk;                 // Mean size of the reads
+    size_t pos;                     // Next byte delivered
+    uint32_t seed;                  // Sizes of the reads
+};
+
+typedef struct
+{
+    const std::vector<uint32_t> *kept;  // Records expected, in order
+    size_t next[BSTREAM_CHANNELS];      // Next expected record of each channel
+    uint64_t mismatches;                // Samples not those expected
+} PacketsCheck;
+
+/**
+* @brief drain: read the rings, compare the samples with the records expected
+*
+* @return None.
+*/
+static void drain(SampleRing **rings, PacketsCheck *check)
+{
+    float samples[1024];
+
+    for (uint32_t c = 0; c < BSTREAM_CHANNELS; c++)
+    {
+        uint32_t n;
+        while ((n = rings[c]->read(samples, sizeof(samples) / sizeof(samples[0]))) > 0)
+        {
+            for (uint32_t i = 0; i < n; i++)
+            {
+                size_t k = check->next[c]++;
+                if ((k >= check->kept->size()) || (samples[i] != (float)simStreamSample((*check->kept)[k], c)))     check->mismatches++;
+            }
+        }
+    }
+}
+
+/**
+* @brief cmdPackets: decode a synthetic stream of "B" packets, check the samples and counters
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdPackets(int argc, char **argv)
+{
+    SimStreamShape shape;
+    int seconds = 60;
+    int chunk = PACKETS_CHUNK;
+    bool frames = false;
+
+    memset(&shape, 0, sizeof(shape));
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--seconds") == 0) && (i + 1 < argc))        seconds = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--loss") == 0) && (i + 1 < argc))      shape.lostEvery = (uint32_t)atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--corrupt") == 0) && (i + 1 < argc))   shape.corruptEvery = (uint32_t)atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--other") == 0) && (i + 1 < argc))     shape.otherEvery = (uint32_t)atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--chunk") == 0) && (i + 1 < argc))     chunk = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--frames") == 0)                        frames = true;
+        else
+        {
+            fprintf(stderr, "packets: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((seconds <= 0) || (chunk <= 0) || (shape.lostEvery == 1) || (shape.corruptEvery == 1))
+    {
+        fprintf(stderr, "usage: packets [--seconds N] [--loss N] [--corrupt N] [--other N] [--chunk bytes] [--frames]\n");
+        return 2;
+    }
+
+    std::vector<uint8_t> stream;
+    std::vector<uint32_t> kept;
+    SimStreamCounts counts;
+    shape.records = (uint32_t)seconds * PACKETS_RATE;
+    shape.perPacket = BSTREAM_RECORDS_MAX;
+    simStream(shape, &stream, &kept, &counts);
+
+    StreamPacketParser parser;
+    SampleRing ringA(PACKETS_RING), ringB(PACKETS_RING);
+    SampleRing *rings[BSTREAM_CHANNELS] = { &ringA, &ringB };
+    PacketsCheck check;
+    memset(&check, 0, sizeof(check));
+    check.kept = &kept;
+    for (uint32_t c = 0; c < BSTREAM_CHANNELS; c++)     parser.setRing(c, rings[c]);
+
+    // the reads come from a connection: copied out of the stream (kept intact) before decoding
+    BufferComm comm(stream, (uint32_t)chunk);
+    std::vector<uint8_t> buffer(2 * chunk + BSTREAM_PACKET_MAX);
+    double decodeUs = 0;
+    if (frames)
+    {
+        // timed: the deframing by Slip::read (byte per byte from the connection) and the parsing
+        Slip slip(&comm);
+        while (true)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            int len = slip.read(buffer.data(), (int)buffer.size(), PACKETS_WAIT_MS);
+            if (len > 0)    parser.parseFrame(buffer.data(), (uint32_t)len);
+            decodeUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (len == ERR_SLIP_TIMEOUT)    break;
+            drain(rings, &check);
+        }
+    }
+    else
+    {
+        while (comm.done() == false)
+        {
+            int len = comm.read(buffer.data(), (int)buffer.size(), 0);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            parser.feed(buffer.data(), (uint32_t)len);
+            decodeUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            drain(rings, &check);
+        }
+    }
+
+    const StreamPacketStats &s = parser.stats();
+    printf("stream    %zu bytes  %u packets  %u records  %u lost  %u corrupted  %u other frames\n", stream.size(),
+        counts.packets, shape.records, counts.lost, counts.corrupted, counts.others);
+    printf("parsed    %llu packets  %llu records  seq lost %llu  checksum %llu  malformed %llu  framing %llu  other %llu\n",
+        (unsigned long long)s.packets, (unsigned long long)s.records, (unsigned long long)s.seqLost,
+        (unsigned long long)s.checksumErrors, (unsigned long long)s.malformed, (unsigned long long)s.framingErrors,
+        (unsigned long long)s.otherFrames);
+    printf("decode    %s  %.1f ms  %.1f MB/s  %.0f packets/s\n", frames ? "frames (Slip::read)" : "in place", decodeUs / 1000,
+        (decodeUs > 0) ? stream.size() / decodeUs : 0.0, (decodeUs > 0) ? s.packets * 1e6 / decodeUs : 0.0);
+
+    bool ok = (s.packets == counts.packets) && (s.records == kept.size()) && (s.seqLost == (uint64_t)counts.lost + counts.corrupted) &&
+              (s.checksumErrors == counts.corrupted) && (s.otherFrames == counts.others) && (s.malformed == 0) &&
+              (s.framingErrors == 0) && (check.mismatches == 0) && (ringA.overruns() + ringB.overruns() == 0);
+    for (uint32_t c = 0; c < BSTREAM_CHANNELS; c++)     ok = ok && (check.next[c] == kept.size()) && (s.samples[c] == kept.size());
+    printf("check     %s (%llu samples differ)\n", ok ? "ok" : "FAILED", (unsigned long long)check.mismatches);
+    return ok ? 0 : 1;
+}
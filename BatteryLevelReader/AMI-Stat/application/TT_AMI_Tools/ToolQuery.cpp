@@ -0,0 +1,335 @@
+/*
+* ToolQuery.cpp : This file contains the "query" command: filter, group by and aggregate over the
+*               battery telemetry of the fleet and over the history of its firmware updates.
+*
+*   In a nutshell, this command:
+*       - telemetry: loads the samples of a telemetry store (Log\Telemetry), e.g. the average
+*           discharge rate per firmware version:
+*               query telemetry <store> --where charging=0 --group firmware --agg "avg(rate),count"
+*       - updates: loads one or more update histories (TT_AMI_Updater_metrics.jsonl, and the
+*           part rotated out, TT_AMI_Updater_metrics.jsonl.1), e.g. the update failures by error
+*           code per week:
+*               query updates <file>... --where failed=1 --group "week(time),result" --agg count
+*           The columns parsed are cached next to each file (<file>.cols), so that the next
+*           queries only parse the sessions appended since (--no-cache: parse it all).
+*       - sim-updates: writes the history of a simulated fleet of updates, a bad package raising
+*           the timeouts for a few weeks, to try the queries on millions of sessions
+*   The load time (files to columns) and the query time (the parallel scans) are printed apart.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "FleetQuery.h"
+#include "TelemetryStore.h"
+#include "SessionCatalog.h"
+#include "FileFolder.h"
+#include "ErrCodes.h"
+
+#define QUERY_SIM_ROWS          2000000     // Default number of simulated sessions
+#define QUERY_SIM_DEVICES       5000        // Devices of the simulated fleet
+#define QUERY_SIM_WEEKS         52          // Weeks of simulated history
+#define QUERY_SIM_START_MS      1735689600000LL     // 2025-01-01 00:00 UTC
+#define QUERY_MS_PER_WEEK       (7 * 86400000LL)
+
+/**
+* @brief splitList: split a comma separated list, the commas inside parentheses excepted
+*
+* @param text:      list
+* @param out:       receives the items
+* @return None.
+*/
+static void splitList(const char *text, std::vector<std::string> &out)
+{
+    std::string item;
+    int depth = 0;
+    for (const char *p = text; ; p++)
+    {
+        if (*p == '\0' || (*p == ',' && depth == 0))
+        {
+            if (!item.empty())  out.push_back(item);
+            item.clear();
+            if (*p == '\0')     break;
+            continue;
+        }
+        if (*p == '(')          depth++;
+        else if (*p == ')')     depth--;
+        item += *p;
+    }
+}
+
+/**
+* @brief printResult: print the rows of a query result as aligned columns
+*
+* @param result:    query result
+* @return None.
+*/
+static void printResult(const QueryResult &result)
+{
+    std::vector<size_t> width(result.header.size());
+    for (size_t c = 0; c < width.size(); c++)   width[c] = std::max((size_t)10, result.header[c].size());
+    for (size_t r = 0; r < result.rows.size(); r++)
+    {
+        for (size_t k = 0; k < result.rows[r].keys.size(); k++)     width[k] = std::max(width[k], result.rows[r].keys[k].size());
+    }
+
+    size_t keys = result.rows.empty() ? width.size() : result.rows[0].keys.size();
+    for (size_t c = 0; c < width.size(); c++)   printf("%s%*s", c ? "  " : "", (c < keys) ? -(int)width[c] : (int)width[c], result.header[c].c_str());
+    printf("\n");
+    for (size_t r = 0; r < result.rows.size(); r++)
+    {
+        const QueryRow &row = result.rows[r];
+        size_t c = 0;
+        for (size_t k = 0; k < row.keys.size(); k++, c++)   printf("%s%-*s", c ? "  " : "", (int)width[c], row.keys[k].c_str());
+        for (size_t v = 0; v < row.values.size(); v++, c++)
+        {
+            double x = row.values[v];
+            if (isnan(x))                               printf("%s%*s", c ? "  " : "", (int)width[c], "-");
+            else if (x == floor(x) && fabs(x) < 1e15)   printf("%s%*.0f", c ? "  " : "", (int)width[c], x);
+            else                                        printf("%s%*.4f", c ? "  " : "", (int)width[c], x);
+        }
+        printf("\n");
+    }
+}
+
+/**
+* @brief queryRun: parse the query options, load the table and run the query
+*
+* @param what:      "telemetry" or "updates"
+* @param argc:      number of arguments following the subcommand
+* @param argv:      sources (store folder or update files) then options
+* @return process exit code
+*/
+static int queryRun(const char *what, int argc, char **argv)
+{
+    bool telemetry = (strcmp(what, "telemetry") == 0);
+    std::vector<const char *> sources;
+    QuerySpec spec;
+    std::vector<std::string> items;
+    int64_t from = INT64_MIN / 1000;
+    int64_t to = INT64_MAX / 1000;
+    int jobs = 0;
+    bool cache = true;
+    bool valid = true;
+
+    int i = 0;
+    for (; i < argc && argv[i][0] != '-'; i++)  sources.push_back(argv[i]);
+    for (; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--where") == 0) && (i + 1 < argc))
+        {
+            QueryFilter f;
+            valid = valid && queryParseFilter(argv[++i], &f);
+            spec.filters.push_back(f);
+        }
+        else if ((strcmp(argv[i], "--group") == 0) && (i + 1 < argc))
+        {
+            items.clear();
+            splitList(argv[++i], items);
+            for (size_t k = 0; k < items.size(); k++)
+            {
+                QueryGroup g;
+                valid = valid && queryParseGroup(items[k].c_str(), &g);
+                spec.groups.push_back(g);
+            }
+        }
+        else if ((strcmp(argv[i], "--agg") == 0) && (i + 1 < argc))
+        {
+            items.clear();
+            splitList(argv[++i], items);
+            for (size_t k = 0; k < items.size(); k++)
+            {
+                QueryAggregate a;
+                valid = valid && queryParseAggregate(items[k].c_str(), &a);
+                spec.aggregates.push_back(a);
+            }
+        }
+        else if ((strcmp(argv[i], "--order") == 0) && (i + 1 < argc))     spec.orderBy = atoi(argv[++i]) - 1;
+        else if (strcmp(argv[i], "--desc") == 0)                          spec.descending = true;
+        else if ((strcmp(argv[i], "--limit") == 0) && (i + 1 < argc))     spec.limit = (size_t)atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--from") == 0) && (i + 1 < argc))      valid = valid && catalogParseDate(argv[++i], &from);
+        else if ((strcmp(argv[i], "--to") == 0) && (i + 1 < argc))        valid = valid && catalogParseDate(argv[++i], &to);
+        else if ((strcmp(argv[i], "--jobs") == 0) && (i + 1 < argc))      jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-cache") == 0)                      cache = false;
+        else
+        {
+            fprintf(stderr, "query: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((valid == false) || sources.empty() || (telemetry && sources.size() != 1) || (jobs < 0) || (spec.orderBy < -1))
+    {
+        fprintf(stderr, "usage: query telemetry <store folder> [--from YYYY-MM-DD[ hh:mm]] [--to YYYY-MM-DD[ hh:mm]] [options]\n"
+                        "       query updates <metrics file>... [--no-cache] [options]\n"
+                        "options: [--where col<op>value]... [--group col|day(col)|week(col)|month(col),...]\n"
+                        "       [--agg count|sum(col)|avg(col)|min(col)|max(col),...] [--order N] [--desc] [--limit N] [--jobs N]\n");
+        return 2;
+    }
+    if (spec.aggregates.empty())
+    {
+        QueryAggregate count;
+        count.func = QUERY_COUNT;
+        spec.aggregates.push_back(count);
+    }
+
+    // Load
+    QueryTable table;
+    int err = TLM_OK;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (telemetry)
+    {
+        if (folderExists(sources[0]) == false)
+        {
+            fprintf(stderr, "query: %s: %s\n", sources[0], strerror(errno));
+            return 1;
+        }
+        TelemetryStore store;
+        if (store.open(sources[0]) != TLM_OK)
+        {
+            fprintf(stderr, "query: %s: cannot open the store\n", sources[0]);
+            return 1;
+        }
+        err = queryLoadTelemetry(store, from * 1000, (to == INT64_MAX / 1000) ? INT64_MAX : to * 1000, (unsigned)jobs, table);
+        if (err != TLM_OK)  fprintf(stderr, "query: %s: damaged blocks skipped (%d)\n", sources[0], err);
+    }
+    else
+    {
+        for (size_t s = 0; s < sources.size(); s++)
+        {
+            if (queryLoadUpdates(sources[s], table, cache) != TLM_OK)
+            {
+                fprintf(stderr, "query: %s: cannot read the file\n", sources[s]);
+                return 1;
+            }
+        }
+    }
+    double loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    // Query
+    QueryEngine engine((unsigned)jobs);
+    QueryResult result;
+    start = std::chrono::steady_clock::now();
+    err = engine.run(table, spec, &result);
+    double queryMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (err != TLM_OK)
+    {
+        fprintf(stderr, "query: %s\n", result.error.c_str());
+        return 2;
+    }
+
+    printResult(result);
+    printf("rows     %llu scanned  %llu selected  %u groups\n", (unsigned long long)result.scanned,
+        (unsigned long long)result.selected, result.groups);
+    printf("load     %.0f ms\n", loadMs);
+    printf("query    %.1f ms  %.1f M rows/s  %u jobs\n", queryMs, (queryMs > 0) ? result.scanned / queryMs / 1000.0 : 0.0,
+        engine.jobCount());
+    return 0;
+}
+
+/**
+* @brief simRandom: next number of a linear congruential generator
+*
+* @param state:     generator state, updated
+* @return A number in [0, 1)
+*/
+static double simRandom(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (*state >> 8) / 16777216.0;
+}
+
+/**
+* @brief querySimUpdates: "query sim-updates": a history of update sessions in the format of
+*           ProtocolMetrics::appendToFile (the histograms left out). A new package every
+*           13 weeks; the second one times out on a device out of ten until its fix 3 weeks later.
+*
+* @return process exit code
+*/
+static int querySimUpdates(const char *path, int argc, char **argv)
+{
+    static const char *packages[] = { "1.4.2", "1.5.0", "1.5.1", "1.6.0", "1.6.1" };
+    int rows = QUERY_SIM_ROWS;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--rows") == 0) && (i + 1 < argc))   rows = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "query: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (rows < 1)
+    {
+        fprintf(stderr, "usage: query sim-updates <metrics file> [--rows N]\n");
+        return 2;
+    }
+
+    FILE *f = (folderCreateFor(path) == ERR_OK) ? fopen(path, "wb") : NULL;
+    if (f == NULL)
+    {
+        fprintf(stderr, "query: %s: cannot create the file: %s\n", path, strerror(errno));
+        return 1;
+    }
+    uint32_t seed = 2025;
+    int64_t span = QUERY_SIM_WEEKS * QUERY_MS_PER_WEEK;
+    for (int r = 0; r < rows; r++)
+    {
+        int64_t t = QUERY_SIM_START_MS + (int64_t)((double)r * span / rows);
+        int week = (int)((t - QUERY_SIM_START_MS) / QUERY_MS_PER_WEEK);
+        int pkg = (week < 13) ? 0 : (week < 26) ? 1 : (week < 29) ? 2 : (week < 39) ? 3 : 4;
+        unsigned device = (unsigned)(simRandom(&seed) * QUERY_SIM_DEVICES);
+
+        // Failures: framing errors and timeouts of the link, a bad package timing out
+        double u = simRandom(&seed);
+        int result = 0;
+        int timeouts = (int)(simRandom(&seed) * 3);
+        if ((pkg == 1) && (week >= 23) && (device % 10 == 0))      result = -3, timeouts += 20;
+        else if (u < 0.010)                                         result = -3, timeouts += 10;
+        else if (u < 0.016)                                         result = -2;
+        else if (u < 0.019)                                         result = -7;
+        double duration = 40.0 + simRandom(&seed) * 20.0 + timeouts * 0.5;
+        fprintf(f, "{\"label\":\"%012llX\",\"package\":\"%s\",\"startedAt\":%lld,\"sessions\":1,\"failures\":%d,"
+                   "\"lastResult\":%d,\"durationUs\":%lld,\"framingErrors\":%d,\"timeouts\":%d,\"retries\":%d,"
+                   "\"throughputBps\":%.1f}\n",
+                0xA0B1C2000000ULL + device, packages[pkg], (long long)t, result != 0, result, (long long)(duration * 1e6),
+                (result == -2) ? 3 : 0, timeouts, timeouts + (int)(simRandom(&seed) * 2), 180000.0 / duration);
+    }
+    bool failed = (ferror(f) != 0);
+    fclose(f);
+    if (failed)
+    {
+        fprintf(stderr, "query: %s: write error\n", path);
+        return 1;
+    }
+    printf("%d update sessions written to %s\n", rows, path);
+    return 0;
+}
+
+/**
+* @brief cmdQuery: filter, group and aggregate the telemetry of a fleet or its update history
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdQuery(int argc, char **argv)
+{
+    if ((argc < 2) || (argv[1][0] == '-') || ((strcmp(argv[0], "telemetry") != 0) && (strcmp(argv[0], "updates") != 0)
+        && (strcmp(argv[0], "sim-updates") != 0)))
+    {
+        fprintf(stderr, "usage: query telemetry|updates|sim-updates <store folder|metrics file> [options]\n");
+        return 2;
+    }
+    if (strcmp(argv[0], "sim-updates") == 0)    return querySimUpdates(argv[1], argc - 2, argv + 2);
+    return queryRun(argv[0], argc - 1, argv + 1);
+}
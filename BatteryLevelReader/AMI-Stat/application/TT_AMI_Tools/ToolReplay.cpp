@@ -0,0 +1,253 @@
+/*
+* ToolReplay.cpp : This file contains the "replay" command: a capture file recorded by the
+*               updater ("/capture=<folder>" option) is fed back through the protocol engines.
+*
+*   In a nutshell, this command:
+*       - decodes the received byte stream through Slip and counts the frames per channel
+*       - when the capture holds an update session, rebuilds the package from the requests sent
+*           (or takes it from --package) and runs UpdateSession on a ReplayComm, checking that
+*           the engine sends exactly the bytes of the capture
+*       - runs it at the recorded pace (--realtime) or as fast as possible, N times, and prints
+*           the time per run, the throughput and the protocol metrics
+*       - prints the flight recorder of the first run that fails or diverges from the capture
+*       - with --trace, collects the trace points of the runs in a trace file (see "trace")
+*
+*   At max speed, the replay only measures the host side (SLIP encode/decode, protocol engine):
+*   it is deterministic and can be used as a performance regression benchmark on field traffic.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "WireCapture.h"
+#include "Slip.h"
+#include "UpdateSession.h"
+#include "ProtocolMetrics.h"
+#include "ErrCodes.h"
+#include "TraceBuffer.h"
+
+#define REPLAY_FRAME_MAX        (64 * 1024)     // Largest SLIP frame decoded
+#define REPLAY_MAX_ITERATIONS   100000          // Sanity limit of --iterations
+#define REPLAY_READ_WAIT_MS     60000           // Frame timeout when decoding at max speed (never reached)
+
+/**
+* @brief loadFile: read a whole file in memory
+*
+* @param path:      file to read
+* @param out:       receives the content
+* @return false if the file cannot be read
+*/
+static bool loadFile(const char *path, std::vector<uint8_t> &out)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)          return false;
+
+    uint8_t block[64 * 1024];
+    size_t nb;
+    out.clear();
+    while ((nb = fread(block, 1, sizeof(block), f)) > 0)    out.insert(out.end(), block, block + nb);
+    fclose(f);
+    return true;
+}
+
+/**
+* @brief countFrames: decode one direction of the capture and count the frames per channel
+*
+* @param reader:    capture
+* @param dir:       CAPTURE_DIR_TX or CAPTURE_DIR_RX
+* @param perChannel: receives the number of frames per channel byte
+* @param framingErrors: receives the number of framing errors
+* @return Number of frames decoded
+*/
+static int countFrames(const CaptureReader &reader, uint8_t dir, int perChannel[256], int *framingErrors)
+{
+    std::vector<uint8_t> frame(REPLAY_FRAME_MAX);
+    ReplayComm comm(&reader, REPLAY_MAXSPEED, dir);
+    Slip slip(&comm);
+    int frames = 0;
+
+    memset(perChannel, 0, 256 * sizeof(int));
+    *framingErrors = 0;
+    while (true)
+    {
+        int len = slip.read(frame.data(), (int)frame.size(), REPLAY_READ_WAIT_MS);
+        if (len > 0)
+        {
+            perChannel[frame[0]]++;
+            frames++;
+        }
+        else if ((len == ERR_SLIP_FRAMING) || (len == ERR_SLIP_BUFSHORT))   (*framingErrors)++;
+        else if (len != ERR_SLIP_TIMEOUT)   break;          // capture exhausted
+    }
+    return frames;
+}
+
+/**
+* @brief extractPackage: rebuild the package from the update requests sent in the capture
+*
+*   When the session failed before the last transaction, the package is truncated after the last
+*   chunk sent, which is enough to replay the session up to its failure.
+*
+* @param reader:    capture
+* @param package:   receives the package
+* @param complete:  set to true when the capture holds the last transaction (package length known)
+* @return false if the capture holds no update request
+*/
+static bool extractPackage(const CaptureReader &reader, std::vector<uint8_t> &package, bool *complete)
+{
+    std::vector<uint8_t> frame(REPLAY_FRAME_MAX);
+    ReplayComm comm(&reader, REPLAY_MAXSPEED, CAPTURE_DIR_TX);
+    Slip slip(&comm);
+
+    *complete = false;
+    package.clear();
+    while (true)
+    {
+        int len = slip.read(frame.data(), (int)frame.size(), REPLAY_READ_WAIT_MS);
+        if ((len == ERR_SLIP_TIMEOUT) || (len == ERR_SLIP_FRAMING) || (len == ERR_SLIP_BUFSHORT))   continue;
+        if (len <= 0)           break;
+        if ((len < CMD_UPDREQ_DATA) || (frame[CHAN_OFF] != CHAN_UPDATE) || (frame[CMD_OFF] != CMD_UPDREQ))   continue;
+
+        size_t offset = ((size_t)frame[CMD_UPDREQ_OFFSET] << 24) | ((size_t)frame[CMD_UPDREQ_OFFSET+1] << 16)
+                      | ((size_t)frame[CMD_UPDREQ_OFFSET+2] << 8) | (size_t)frame[CMD_UPDREQ_OFFSET+3];
+        size_t dataLen = (size_t)(len - CMD_UPDREQ_DATA);
+        if (dataLen == 0)                   // last transaction: offset = package length
+        {
+            package.resize(offset);
+            *complete = true;
+        }
+        else
+        {
+            if (package.size() < offset + dataLen)  package.resize(offset + dataLen);
+            memcpy(&package[offset], &frame[CMD_UPDREQ_DATA], dataLen);
+        }
+    }
+    return !package.empty();
+}
+
+/**
+* @brief cmdReplay: feed a capture file back through the SLIP and update protocol engines
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdReplay(int argc, char **argv)
+{
+    const char *capturePath = NULL;
+    const char *packagePath = NULL;
+    const char *tracePath = NULL;
+    int mode = REPLAY_MAXSPEED;
+    int iterations = 1;
+    bool json = false;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)                         mode = REPLAY_REALTIME;
+        else if (strcmp(argv[i], "--json") == 0)                        json = true;
+        else if ((strcmp(argv[i], "--iterations") == 0) && (i + 1 < argc))  iterations = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--package") == 0) && (i + 1 < argc))     packagePath = argv[++i];
+        else if ((strcmp(argv[i], "--trace") == 0) && (i + 1 < argc))       tracePath = argv[++i];
+        else if ((argv[i][0] != '-') && (capturePath == NULL))          capturePath = argv[i];
+        else
+        {
+            fprintf(stderr, "replay: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((capturePath == NULL) || (iterations < 1) || (iterations > REPLAY_MAX_ITERATIONS))
+    {
+        fprintf(stderr, "usage: replay <capture> [--realtime] [--iterations N] [--package file] [--json] [--trace file]\n");
+        return 2;
+    }
+
+    CaptureReader reader;
+    int err = reader.open(capturePath);
+    if (err != 0)
+    {
+        fprintf(stderr, "replay: %s: %s\n", capturePath, (err == -1) ? "cannot read file" : "not a capture file");
+        return 1;
+    }
+
+    int perChannel[256];
+    int framingErrors;
+    int rxFrames = countFrames(reader, CAPTURE_DIR_RX, perChannel, &framingErrors);
+    printf("capture   %s  label %s  %zu records  %.3f s\n", capturePath, reader.label(), reader.count(), reader.durationUs() / 1e6);
+    printf("bytes     tx %llu  rx %llu\n", (unsigned long long)reader.totalBytes(CAPTURE_DIR_TX), (unsigned long long)reader.totalBytes(CAPTURE_DIR_RX));
+    printf("rx frames %d  framing errors %d ", rxFrames, framingErrors);
+    for (int c = 0; c < 256; c++)
+    {
+        if (perChannel[c] == 0)     continue;
+        if ((c >= 0x20) && (c < 0x7F))  printf(" '%c':%d", c, perChannel[c]);
+        else                            printf(" 0x%02X:%d", c, perChannel[c]);
+    }
+    printf("\n");
+
+    std::vector<uint8_t> package;
+    bool complete = true;
+    if (packagePath != NULL)
+    {
+        if (loadFile(packagePath, package) == false)
+        {
+            fprintf(stderr, "replay: %s: cannot read file\n", packagePath);
+            return 1;
+        }
+    }
+    else if (extractPackage(reader, package, &complete) == false)
+    {
+        printf("no update session in the capture\n");
+        return 0;
+    }
+
+    std::vector<double> runMs;
+    int result = ERR_OK;
+    uint64_t mismatches = 0;
+    uint64_t wireBytes = 0;
+    std::string flight;                 // Flight recorder of the first failing run
+    if (tracePath != NULL)      TraceBuffer::start(tracePath);
+    for (int i = 0; i < iterations; i++)
+    {
+        ReplayComm comm(&reader, mode);
+        Slip slip(&comm);
+        ProtocolMetrics metrics;
+        UpdateSession session(&slip, &metrics);
+
+        slip.setMetrics(&metrics);
+        slip.flightRecorder().setLabel(reader.label());
+        metrics.beginSession(reader.label());
+        auto start = std::chrono::steady_clock::now();
+        result = session.run(package.data(), (int)package.size(), NULL, NULL);
+        auto stop = std::chrono::steady_clock::now();
+        metrics.endSession(result);
+
+        runMs.push_back(std::chrono::duration<double, std::milli>(stop - start).count());
+        if (((result != ERR_OK) || (comm.txMismatches() != 0)) && flight.empty())   slip.flightRecorder().toText(flight);
+        mismatches += comm.txMismatches();
+        wireBytes = comm.bytesSent() + comm.bytesRead();
+    }
+    if ((tracePath != NULL) && (TraceBuffer::stop() != 0))      fprintf(stderr, "replay: %s: cannot write the trace\n", tracePath);
+
+    std::sort(runMs.begin(), runMs.end());
+    double medianMs = runMs[runMs.size() / 2];
+    printf("update    package %zu bytes%s  result %d%s  tx mismatches %llu\n", package.size(), complete ? "" : " (session incomplete)",
+        result, (result == ERR_OK) ? " (done)" : "", (unsigned long long)mismatches);
+    printf("runs      %d %s  min %.3f ms  median %.3f ms  max %.3f ms  %.1f MB/s on the wire\n", iterations,
+        (mode == REPLAY_REALTIME) ? "realtime" : "max speed", runMs.front(), medianMs, runMs.back(),
+        (medianMs > 0) ? wireBytes / (medianMs * 1000.0) : 0.0);
+
+    if (flight.empty() == false)    fprintf(stderr, "%s", flight.c_str());
+
+    std::string out;
+    if (json)       ProtocolMetrics::aggregateJson(out);
+    else            ProtocolMetrics::aggregateText(out);
+    printf("%s\n", out.c_str());
+
+    return (mismatches == 0) ? 0 : 1;
+}
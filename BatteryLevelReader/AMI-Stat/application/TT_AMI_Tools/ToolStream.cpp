@@ -0,0 +1,351 @@
+/*
+* ToolStream.cpp : This file contains the "stream" command: acquisition of the samples streamed
+*               by a device through the acquisition pipeline (Acquisition.h).
+*
+*   In a nutshell, this command:
+*       - streams from a device through the AMI SDK (Win32 build only), or from a synthetic
+*           source (--sim) releasing packets of samples at the sample rate (--speed: faster than
+*           real time), each sample holding its index to check the samples received
+*       - runs three consumers reading their rings at their own pace: display (every
+*           STREAM_DISPLAY_MS), recorder (every STREAM_RECORDER_MS, --slow to make it late) and
+*           analytics (every STREAM_ANALYTICS_MS, running RMS)
+*       - reports the polls of the producer, and per consumer the samples, overruns, latency
+*           (from the time the sample was available in the source) and, for the synthetic
+*           source, the gaps found against the overruns counted
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "ToolCommands.h"
+#include "Acquisition.h"
+#include "SdkSessions.h"
+#include "ErrCodes.h"
+
+#define STREAM_RATE             2048        // Default sample rate of the synthetic source (SAMPLING_RATE)
+#define STREAM_PACKET           32          // Default samples per packet of the synthetic source
+#define STREAM_DISPLAY_MS       16          // Period of the display consumer
+#define STREAM_RECORDER_MS      250         // Default period of the recorder consumer
+#define STREAM_ANALYTICS_MS     1           // Period of the analytics consumer
+#define STREAM_READ_MAX         4096        // Samples read from a ring at once
+#define STREAM_INDEX_MASK       0xFFFFFF    // Sample indexes held exactly by a float
+
+/**
+* Synthetic source: packets of samples released at the sample rate, the value of a sample is its
+* index (modulo STREAM_INDEX_MASK + 1)
+*/
+class SimStream : public ISampleSource
+{
+public:
+    SimStream(uint32_t _channels, uint32_t _rate, uint32_t _packet, double _speed)
+    : channels(_channels), rate(_rate), packet(_packet), speed(_speed), due(0)
+    {
+        memset(produced, 0, sizeof(produced));
+    }
+
+    int start(uint32_t *outChannels, uint32_t *outRate)
+    {
+        startTime = std::chrono::steady_clock::now();
+        *outChannels = channels;
+        *outRate = rate;
+        return ERR_OK;
+    }
+
+    int available(uint32_t *counts)
+    {
+        double elapsedUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count();
+        due = (uint64_t)(elapsedUs * rate * speed / 1e6) / packet * packet;
+        for (uint32_t c = 0; c < channels; c++)     counts[c] = (uint32_t)(due - produced[c]);
+        return ERR_OK;
+    }
+
+    int read(uint32_t channel, float *samples, uint32_t max, uint32_t *count)
+    {
+        uint64_t waiting = due - produced[channel];
+        uint32_t n = (max < waiting) ? max : (uint32_t)waiting;
+        for (uint32_t i = 0; i < n; i++)    samples[i] = (float)((produced[channel] + i) & STREAM_INDEX_MASK);
+        produced[channel] += n;
+        *count = n;
+        return ERR_OK;
+    }
+
+    void stop(void)                                                     {}
+
+    /**
+    * @brief availableAt: time a sample was released (end of its packet)
+    *
+    * @param index:     sample
+    * @return The time
+    */
+    std::chrono::steady_clock::time_point availableAt(uint64_t index)
+    {
+        double us = (double)((index / packet + 1) * packet) * 1e6 / (rate * speed);
+        return startTime + std::chrono::microseconds((int64_t)us);
+    }
+
+private:
+    uint32_t channels;                  // Number of channels
+    uint32_t rate;                      // Samples per second
+    uint32_t packet;                    // Samples per packet
+    double speed;                       // Speed against real time
+    std::chrono::steady_clock::time_point startTime;    // Start of the streaming
+    uint64_t due;                       // Samples released per channel at the last available()
+    uint64_t produced[ACQ_MAX_CHANNELS];    // Samples read per channel
+};
+
+typedef struct
+{
+    const char *name;           // Name of the consumer
+    uint32_t periodMs;          // Period of its reads
+    int id;                     // Consumer of the pipeline
+    uint64_t samples[ACQ_MAX_CHANNELS];     // Samples read per channel
+    uint64_t next[ACQ_MAX_CHANNELS];        // Index of the next sample expected (synthetic source)
+    uint64_t gaps[ACQ_MAX_CHANNELS];        // Samples missing per channel (synthetic source)
+    double sumSquares;          // Running RMS of the analytics
+    double latencySumUs;        // Sum of the latencies
+    double latencyMaxUs;        // Max latency
+    uint64_t latencyCount;      // Number of latencies measured
+} StreamConsumer;
+
+typedef struct
+{
+    AcquisitionPipeline *pipeline;
+    SimStream *sim;             // Synthetic source (NULL for a device)
+    StreamConsumer *consumer;
+    std::atomic<bool> *stopping;
+} StreamCtx;
+
+/**
+* @brief consumeOnce: read every sample waiting in the rings of a consumer
+*
+* @return None.
+*/
+static void consumeOnce(StreamCtx *ctx, std::vector<float> &buffer)
+{
+    StreamConsumer *consumer = ctx->consumer;
+
+    for (uint32_t c = 0; c < ctx->pipeline->channelCount(); c++)
+    {
+        SampleRing *ring = ctx->pipeline->ring(consumer->id, c);
+        uint32_t n;
+        while ((n = ring->read(buffer.data(), (uint32_t)buffer.size())) > 0)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            consumer->samples[c] += n;
+            if (ctx->sim != NULL)
+            {
+                // the samples hold their index: a jump is a gap, to be matched by the overruns
+                uint64_t oldest = 0;
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    uint64_t expected = consumer->next[c];
+                    uint64_t jump = ((uint64_t)buffer[i] - expected) & STREAM_INDEX_MASK;
+                    consumer->gaps[c] += jump;
+                    if (i == 0)     oldest = expected + jump;
+                    consumer->next[c] = expected + jump + 1;
+                }
+                double us = std::chrono::duration<double, std::micro>(now - ctx->sim->availableAt(oldest)).count();
+                consumer->latencySumUs += us;
+                consumer->latencyCount++;
+                if (us > consumer->latencyMaxUs)    consumer->latencyMaxUs = us;
+            }
+            if (strcmp(consumer->name, "analytics") == 0)
+            {
+                for (uint32_t i = 0; i < n; i++)    consumer->sumSquares += (double)buffer[i] * buffer[i];
+            }
+        }
+    }
+}
+
+/**
+* @brief consumerEntry: consumer thread: read the rings every period until stopped, then drain them
+*
+* @param ctx:       An abstract pointer to a StreamCtx.
+* @return None.
+*/
+static void consumerEntry(StreamCtx *ctx)
+{
+    std::vector<float> buffer(STREAM_READ_MAX);
+
+    while (ctx->stopping->load() == false)
+    {
+        consumeOnce(ctx, buffer);
+        std::this_thread::sleep_for(std::chrono::milliseconds(ctx->consumer->periodMs));
+    }
+    consumeOnce(ctx, buffer);
+}
+
+/**
+* @brief cmdStream: acquire the samples streamed by a device through the acquisition pipeline
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdStream(int argc, char **argv)
+{
+    const char *deviceId = NULL;
+    const char *scanFilter = "";
+    bool sim = false;
+    int notch = 0;
+    int seconds = 10;
+    int channels = ACQ_MAX_CHANNELS;
+    int rate = STREAM_RATE;
+    int packet = STREAM_PACKET;
+    double speed = 1.0;
+    int ring = ACQ_RING_SAMPLES;
+    int slowMs = STREAM_RECORDER_MS;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--sim") == 0)                                sim = true;
+        else if ((strcmp(argv[i], "--device") == 0) && (i + 1 < argc))    deviceId = argv[++i];
+        else if ((strcmp(argv[i], "--scan") == 0) && (i + 1 < argc))      scanFilter = argv[++i];
+        else if ((strcmp(argv[i], "--notch") == 0) && (i + 1 < argc))     notch = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--seconds") == 0) && (i + 1 < argc))   seconds = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--channels") == 0) && (i + 1 < argc))  channels = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--rate") == 0) && (i + 1 < argc))      rate = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--packet") == 0) && (i + 1 < argc))    packet = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--speed") == 0) && (i + 1 < argc))     speed = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--ring") == 0) && (i + 1 < argc))      ring = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--slow") == 0) && (i + 1 < argc))      slowMs = atoi(argv[++i]);
+        else
+        {
+            fprintf(stderr, "stream: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if ((seconds <= 0) || (channels <= 0) || (channels > ACQ_MAX_CHANNELS) || (rate <= 0) || (packet <= 0) ||
+        (speed <= 0) || (ring <= 0) || (slowMs <= 0) || ((notch != 0) && (notch != 50) && (notch != 60)))
+    {
+        fprintf(stderr, "usage: stream --sim [--seconds N] [--channels N] [--rate Hz] [--packet N] [--speed X] [--ring N] [--slow ms]\n"
+                        "       stream [--device id] [--scan filter] [--notch 0|50|60] [--seconds N] [--ring N] [--slow ms]\n");
+        return 2;
+    }
+
+    ISampleSource *source = NULL;
+    SimStream *simSource = NULL;
+    if (sim)
+    {
+        simSource = new SimStream((uint32_t)channels, (uint32_t)rate, (uint32_t)packet, speed);
+        source = simSource;
+    }
+    else
+    {
+#ifdef AMI_SDK
+        std::vector<SdkDevice> devices;
+        if (sdkScanDevices(scanFilter, &devices) != ERR_OK)
+        {
+            fprintf(stderr, "stream: cannot initialize the AMI SDK\n");
+            return 1;
+        }
+        for (size_t d = 0; (d < devices.size()) && (source == NULL); d++)
+        {
+            if ((deviceId == NULL) || (devices[d].id == deviceId))     source = new SdkStream(devices[d], (TTL_NotchFrequency)notch);
+        }
+        if (source == NULL)
+        {
+            fprintf(stderr, "stream: no device\n");
+            sdkEnd();
+            return 1;
+        }
+#else
+        (void)deviceId;
+        (void)scanFilter;
+        fprintf(stderr, "stream: devices need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+
+    AcquisitionPipeline pipeline(source);
+    StreamConsumer consumers[] =
+    {
+        { "display",    STREAM_DISPLAY_MS,      0, { 0 }, { 0 }, { 0 }, 0, 0, 0, 0 },
+        { "recorder",   (uint32_t)slowMs,       0, { 0 }, { 0 }, { 0 }, 0, 0, 0, 0 },
+        { "analytics",  STREAM_ANALYTICS_MS,    0, { 0 }, { 0 }, { 0 }, 0, 0, 0, 0 },
+    };
+    const size_t consumerCount = sizeof(consumers) / sizeof(consumers[0]);
+    std::atomic<bool> stopping(false);
+    StreamCtx ctxs[consumerCount];
+    std::vector<std::thread> threads;
+
+    for (size_t k = 0; k < consumerCount; k++)
+    {
+        consumers[k].id = pipeline.addConsumer((uint32_t)ring);
+        StreamCtx ctx = { &pipeline, simSource, &consumers[k], &stopping };
+        ctxs[k] = ctx;
+    }
+    int err = pipeline.start();
+    if (err != ERR_OK)
+    {
+        fprintf(stderr, "stream: cannot start streaming (%d)\n", err);
+        delete source;
+        return 1;
+    }
+    for (size_t k = 0; k < consumerCount; k++)      threads.push_back(std::thread(consumerEntry, &ctxs[k]));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (pipeline.running() && (std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds)))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    err = pipeline.stop();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stopping = true;
+    for (size_t t = 0; t < threads.size(); t++)     threads[t].join();
+
+    AcquisitionStats stats;
+    pipeline.snapshot(&stats);
+    uint32_t ringSize = pipeline.ring(0, 0)->capacity();
+    printf("stream    %u channels  %u Hz  %.1f s  %llu samples/channel (%.0f/s)  polls %llu (%llu idle)  max batch %u  errors %u\n",
+        pipeline.channelCount(), pipeline.sampleRate(), elapsed, (unsigned long long)stats.samples[0], stats.samples[0] / elapsed,
+        (unsigned long long)stats.polls, (unsigned long long)stats.idlePolls, stats.maxBatch, stats.errors);
+
+    bool ok = (err == ERR_OK);
+    for (size_t k = 0; k < consumerCount; k++)
+    {
+        StreamConsumer &consumer = consumers[k];
+        uint64_t received = 0;
+        uint64_t overruns = 0;
+        uint64_t gaps = 0;
+        bool complete = true;
+        for (uint32_t c = 0; c < pipeline.channelCount(); c++)
+        {
+            SampleRing *r = pipeline.ring(consumer.id, c);
+            received += consumer.samples[c];
+            overruns += r->overruns();
+            complete = complete && (consumer.samples[c] + r->overruns() == stats.samples[c]);
+            if (simSource != NULL)
+            {
+                // the samples missing must be exactly the samples dropped: inside the stream
+                // (gaps) or after the last sample received
+                gaps += consumer.gaps[c];
+                complete = complete && (consumer.gaps[c] + (stats.samples[c] - consumer.next[c]) == r->overruns());
+            }
+        }
+        printf("%-9s every %u ms  ring %u  %llu samples  overruns %llu", consumer.name, consumer.periodMs, ringSize,
+            (unsigned long long)received, (unsigned long long)overruns);
+        if (simSource != NULL)
+        {
+            printf("  gaps %llu  latency mean %.2f ms  max %.2f ms", (unsigned long long)gaps,
+                (consumer.latencyCount > 0) ? consumer.latencySumUs / consumer.latencyCount / 1000 : 0.0, consumer.latencyMaxUs / 1000);
+        }
+        if ((strcmp(consumer.name, "analytics") == 0) && (received > 0))   printf("  rms %.1f", sqrt(consumer.sumSquares / received));
+        printf("  %s\n", complete ? "ok" : "MISMATCH");
+        ok = ok && complete;
+    }
+    if (err != ERR_OK)      fprintf(stderr, "stream: the source failed (%d)\n", err);
+
+    delete source;
+#ifdef AMI_SDK
+    if (sim == false)       sdkEnd();
+#endif
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,262 @@
+/*
+* ToolTrace.cpp : This file contains the "trace" command: decoder of the trace files written by
+*               the updater ("/trace=<file>" option) or by "replay --trace".
+*
+*   In a nutshell, this command:
+*       - pairs the begin and end points of each thread and prints the count and the duration
+*           distribution of every trace point
+*       - rebuilds the timeline of each update session: connection, erase (first chunk until
+*           its acknowledge), chunk stream, CRC verification
+*       - prints the records one per line with --events
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "ToolCommands.h"
+#include "TraceBuffer.h"
+
+#define TRACE_NO_TIME           (-1)        // Phase time not found in the trace
+
+typedef struct
+{
+    std::vector<double> durationsUs;    // Durations of the begin/end pairs
+    unsigned count = 0;                 // Number of records of the point (begin points for the pairs)
+} PointStats;
+
+typedef struct
+{
+    uint16_t thread = 0;                // Thread running the session
+    uint32_t packageLen = 0;            // Package length
+    int64_t connectNs = TRACE_NO_TIME;  // Start of the last connection before the session
+    int64_t connectedNs = TRACE_NO_TIME;    // End of that connection
+    int64_t beginNs = TRACE_NO_TIME;    // Session start (first chunk sent)
+    int64_t firstAckNs = TRACE_NO_TIME; // First chunk acknowledged (flash erased)
+    int64_t crcNs = TRACE_NO_TIME;      // Final request sent
+    int64_t endNs = TRACE_NO_TIME;      // Session end
+    int32_t result = 0;                 // Session result
+    uint32_t reached = 0;               // Offset reached
+    unsigned chunks = 0;                // Chunks sent
+    unsigned retries = 0;               // Chunks acknowledged without progress
+    uint32_t firstAck = 0;              // Offset of the first acknowledge
+    uint32_t lastAck = 0;               // Offset of the last acknowledge
+    std::vector<double> ackGapsUs;      // Time between consecutive acknowledges of the chunk stream
+    int64_t lastAckNs = TRACE_NO_TIME;  // Time of the last acknowledge
+} SessionTimeline;
+
+/**
+* @brief percentile: value at a given rank of sorted values
+*
+* @param sorted:    values, sorted
+* @param pct:       rank in percent
+* @return The value, 0 if there is none
+*/
+static double percentile(const std::vector<double> &sorted, double pct)
+{
+    if (sorted.empty())     return 0;
+    size_t idx = (size_t)(pct / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/**
+* @brief phaseMs: print a phase duration
+*
+* @return Text of the duration, "-" when a bound is missing
+*/
+static std::string phaseMs(int64_t fromNs, int64_t toNs)
+{
+    char text[32];
+    if ((fromNs == TRACE_NO_TIME) || (toNs == TRACE_NO_TIME))   return "-";
+    snprintf(text, sizeof(text), "%.3f ms", (toNs - fromNs) / 1e6);
+    return text;
+}
+
+/**
+* @brief printEvent: print a record on one line
+*
+* @param trace:     trace file
+* @param rec:       record
+* @param durationNs: duration of the pair for an end point, TRACE_NO_TIME otherwise
+* @return None.
+*/
+static void printEvent(const TraceReader &trace, const TraceRecord &rec, int64_t durationNs)
+{
+    uint8_t kind = trace.pointKind(rec.point);
+    const char *mark = (kind == TRACE_KIND_BEGIN) ? ">" : (kind == TRACE_KIND_END) ? "<" : "*";
+
+    printf("%12.3f  t%-2u %s %-12s %11d %11d", rec.timeNs / 1e6, rec.thread, mark, trace.pointName(rec.point),
+        (int32_t)rec.arg0, (int32_t)rec.arg1);
+    if (durationNs != TRACE_NO_TIME)    printf("  %10.1f us", durationNs / 1e3);
+    printf("\n");
+}
+
+/**
+* @brief cmdTrace: decode a trace file
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code
+*/
+int cmdTrace(int argc, char **argv)
+{
+    const char *tracePath = NULL;
+    bool events = false;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--events") == 0)                           events = true;
+        else if ((argv[i][0] != '-') && (tracePath == NULL))            tracePath = argv[i];
+        else
+        {
+            fprintf(stderr, "trace: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (tracePath == NULL)
+    {
+        fprintf(stderr, "usage: trace <file> [--events]\n");
+        return 2;
+    }
+
+    TraceReader trace;
+    int err = trace.open(tracePath);
+    if (err != 0)
+    {
+        fprintf(stderr, "trace: %s: %s\n", tracePath, (err == -1) ? "cannot read file" : "not a trace file");
+        return 1;
+    }
+
+    std::vector<PointStats> stats(trace.pointCount());
+    std::map<std::pair<uint16_t, uint16_t>, std::vector<int64_t> > open;   // (thread, begin point) -> begin times
+    std::vector<SessionTimeline> sessions;
+    std::map<uint16_t, size_t> running;         // thread -> index of its session in progress
+    int64_t connectNs = TRACE_NO_TIME, connectedNs = TRACE_NO_TIME;
+    uint16_t threads = 0;
+
+    for (size_t i = 0; i < trace.count(); i++)
+    {
+        const TraceRecord &rec = trace.record(i);
+        uint8_t kind = trace.pointKind(rec.point);
+        int64_t durationNs = TRACE_NO_TIME;
+        std::string name = trace.pointName(rec.point);
+
+        threads = std::max(threads, rec.thread);
+        if (rec.point >= stats.size())      continue;
+
+        if (kind == TRACE_KIND_END)
+        {
+            std::vector<int64_t> &begins = open[std::make_pair(rec.thread, (uint16_t)(rec.point - 1))];
+            if (begins.empty() == false)
+            {
+                durationNs = rec.timeNs - begins.back();
+                stats[rec.point - 1].durationsUs.push_back(durationNs / 1e3);
+                if (name == "spp.connect")
+                {
+                    connectNs = begins.back();
+                    connectedNs = rec.timeNs;
+                }
+                begins.pop_back();
+            }
+        }
+        else
+        {
+            stats[rec.point].count++;
+            if (kind == TRACE_KIND_BEGIN)   open[std::make_pair(rec.thread, rec.point)].push_back(rec.timeNs);
+        }
+
+        // update session timeline
+        if ((name == "upd.session") && (kind == TRACE_KIND_BEGIN))
+        {
+            SessionTimeline session;
+            session.thread = rec.thread;
+            session.packageLen = rec.arg0;
+            session.beginNs = rec.timeNs;
+            session.connectNs = connectNs;
+            session.connectedNs = connectedNs;
+            running[rec.thread] = sessions.size();
+            sessions.push_back(session);
+        }
+        else if (running.count(rec.thread) != 0)
+        {
+            SessionTimeline &session = sessions[running[rec.thread]];
+            if (name == "upd.chunk")        session.chunks++;
+            else if (name == "upd.crc")     session.crcNs = rec.timeNs;
+            else if (name == "upd.ack")
+            {
+                if (session.firstAckNs == TRACE_NO_TIME)
+                {
+                    session.firstAckNs = rec.timeNs;
+                    session.firstAck = rec.arg0;
+                }
+                else
+                {
+                    session.ackGapsUs.push_back((rec.timeNs - session.lastAckNs) / 1e3);
+                    if (rec.arg0 <= session.lastAck)        session.retries++;
+                }
+                session.lastAck = rec.arg0;
+                session.lastAckNs = rec.timeNs;
+            }
+            else if ((name == "upd.session") && (kind == TRACE_KIND_END))
+            {
+                session.endNs = rec.timeNs;
+                session.result = (int32_t)rec.arg0;
+                session.reached = rec.arg1;
+                running.erase(rec.thread);
+            }
+        }
+
+        if (events)     printEvent(trace, rec, durationNs);
+    }
+    if (events)     printf("\n");
+
+    double spanMs = (trace.count() != 0) ? trace.record(trace.count() - 1).timeNs / 1e6 : 0;
+    printf("trace     %s  %zu records  %u dropped  %.3f ms  %u threads\n", tracePath, trace.count(), trace.dropped(), spanMs, threads);
+    printf("%-14s %8s %12s %10s %10s %10s %10s\n", "point", "count", "total ms", "min us", "median us", "p99 us", "max us");
+    for (size_t p = 1; p < stats.size(); p++)
+    {
+        PointStats &st = stats[p];
+        if (st.count == 0)      continue;
+        if (trace.pointKind((uint16_t)p) != TRACE_KIND_BEGIN)
+        {
+            printf("%-14s %8u\n", trace.pointName((uint16_t)p), st.count);
+            continue;
+        }
+        std::sort(st.durationsUs.begin(), st.durationsUs.end());
+        double totalUs = 0;
+        for (size_t i = 0; i < st.durationsUs.size(); i++)      totalUs += st.durationsUs[i];
+        printf("%-14s %8u %12.3f %10.1f %10.1f %10.1f %10.1f\n", trace.pointName((uint16_t)p), st.count, totalUs / 1e3,
+            percentile(st.durationsUs, 0), percentile(st.durationsUs, 50), percentile(st.durationsUs, 99), percentile(st.durationsUs, 100));
+    }
+
+    for (size_t s = 0; s < sessions.size(); s++)
+    {
+        SessionTimeline &session = sessions[s];
+        int64_t streamEndNs = (session.crcNs != TRACE_NO_TIME) ? session.crcNs : session.endNs;
+
+        std::sort(session.ackGapsUs.begin(), session.ackGapsUs.end());
+        printf("\nupdate session %zu  thread t%u  package %u bytes  result %d  offset reached %u\n", s + 1, session.thread,
+            session.packageLen, session.result, session.reached);
+        printf("    connect       %s\n", phaseMs(session.connectNs, session.connectedNs).c_str());
+        printf("    erase         %s  (first chunk until acknowledged)\n", phaseMs(session.beginNs, session.firstAckNs).c_str());
+        printf("    chunk stream  %s  %u chunks  %u retries", phaseMs(session.firstAckNs, streamEndNs).c_str(),
+            session.chunks, session.retries);
+        if (session.ackGapsUs.empty() == false)
+        {
+            printf("  ack every %.1f us median, %.1f us p99, %.1f us max", percentile(session.ackGapsUs, 50),
+                percentile(session.ackGapsUs, 99), percentile(session.ackGapsUs, 100));
+        }
+        if ((session.firstAckNs != TRACE_NO_TIME) && (streamEndNs != TRACE_NO_TIME) && (streamEndNs > session.firstAckNs))
+        {
+            printf("  %.1f kB/s", (session.lastAck - session.firstAck) / 1.024 / ((streamEndNs - session.firstAckNs) / 1e6));
+        }
+        printf("\n");
+        printf("    crc           %s\n", phaseMs(session.crcNs, session.endNs).c_str());
+        printf("    total         %s\n", phaseMs(session.beginNs, session.endNs).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,263 @@
+/*
+* ToolUpload.cpp : This file contains the "upload" command: upload of files to a device (assets,
+*               custom stimulation programs, images), batches pipelined.
+*
+*   In a nutshell, this command:
+*       - uploads the files given with a FileUploader: "window" batches in flight (--window),
+*           batches refused sent again, files the device holds (manifest, checksum and size
+*           unchanged) skipped unless --force
+*       - keeps the manifest of a device in "<label>.upload" (--manifest to choose the file)
+*       - reaches the device through the AMI SDK (--device, --scan; Win32 build only) or a
+*           simulated device (--sim): each batch takes the round trip of the link (--rtt) plus its
+*           transfer at the rate of the link (--kbps, shared by the batches in flight), every Nth
+*           batch is refused (--errors); the files it receives are checked against their checksum
+*       - reports the files uploaded, unchanged and failed, the bytes, batches, retries, duration
+*           and throughput
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ToolCommands.h"
+#include "FileUpload.h"
+#include "SdkSessions.h"
+#include "ErrCodes.h"
+
+#define UPLOAD_SIM_RTT_MS       20          // Default round trip of a batch on the simulated link
+#define UPLOAD_SIM_KBPS         1000        // Default rate of the simulated link, kbit/s
+#define UPLOAD_MANIFEST_EXT     ".upload"   // Extension of the default manifest, after the device label
+
+/**
+* Simulated device: the batches of a file are kept until all of them are received, then the file
+* is checked against the checksum announced
+*/
+class SimUpload : public IUploadTarget
+{
+public:
+    SimUpload(uint32_t _rttMs, uint32_t _kbps, uint32_t _errorEvery)
+    : rttMs(_rttMs), kbps(_kbps), errorEvery(_errorEvery), calls(0), complete(0), corrupted(0)  {}
+
+    const char *label(void)                                             { return "sim"; }
+
+    int start(uint8_t id, const char *name, uint32_t size, uint16_t batchCount, uint32_t cs)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        SimFile &file = files[id];
+        file.name = name;
+        file.cs = cs;
+        file.size = size;
+        file.batchCount = batchCount;
+        file.batches.clear();
+        if (batchCount == 0)    finish(file);
+        return ERR_OK;
+    }
+
+    int writeBatch(uint8_t id, uint16_t batch, const uint8_t *data, uint16_t len, uint8_t *refused)
+    {
+        {
+            // the transfers share the link, the round trips overlap
+            std::lock_guard<std::mutex> guard(link);
+            std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)len * 8 * 1000 / kbps));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(rttMs));
+
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<uint8_t, SimFile>::iterator it = files.find(id);
+        if ((it == files.end()) || (batch >= it->second.batchCount))   return ERR_INV_RESPONSE;
+        SimFile &file = it->second;
+        *refused = 0;
+        if ((errorEvery > 0) && (++calls % errorEvery == 0))
+        {
+            *refused = 1;
+            return ERR_OK;
+        }
+        bool first = (file.batches.count(batch) == 0);
+        file.batches[batch].assign(data, data + len);
+        if (first && (file.batches.size() == file.batchCount))     finish(file);
+        return ERR_OK;
+    }
+
+    int cancel(uint8_t id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        files.erase(id);
+        return ERR_OK;
+    }
+
+    uint32_t filesComplete(void)                                        { return complete; }
+    uint32_t filesCorrupted(void)                                       { return corrupted; }
+
+private:
+    typedef struct
+    {
+        std::string name;               // Name of the file
+        uint32_t cs;                    // Checksum announced
+        uint32_t size;                  // Size announced
+        uint32_t batchCount;            // Number of batches announced
+        std::map<uint16_t, std::vector<uint8_t> > batches;     // Batches received, per number
+    } SimFile;
+
+    /**
+    * @brief finish: check a file received whole, its batches put end to end
+    *
+    * @return None.
+    */
+    void finish(SimFile &file)
+    {
+        std::vector<uint8_t> data;
+        for (std::map<uint16_t, std::vector<uint8_t> >::const_iterator b = file.batches.begin(); b != file.batches.end(); ++b)
+        {
+            data.insert(data.end(), b->second.begin(), b->second.end());
+        }
+        if ((data.size() == file.size) && (uploadChecksum(data.data(), data.size()) == file.cs))    complete++;
+        else                                                                                        corrupted++;
+    }
+
+    uint32_t rttMs;                     // Round trip of a batch
+    uint32_t kbps;                      // Rate of the link
+    uint32_t errorEvery;                // Every Nth batch is refused
+    std::mutex link;                    // Held while a batch is transferred
+    std::mutex lock;                    // Protects everything below
+    std::map<uint8_t, SimFile> files;   // File being uploaded per ID
+    uint32_t calls;                     // Batches received
+    uint32_t complete;                  // Files received whole, checksum right
+    uint32_t corrupted;                 // Files received whole, checksum wrong
+};
+
+/**
+* @brief cmdUpload: upload files to a device, batches pipelined, unchanged files skipped
+*
+* @param argc:      number of arguments
+* @param argv:      arguments following the command name
+* @return process exit code (1: files failed)
+*/
+int cmdUpload(int argc, char **argv)
+{
+    std::vector<const char *> paths;
+    const char *name = NULL;
+    const char *manifestPath = NULL;
+    const char *deviceId = NULL;
+    const char *scanFilter = "";
+    int id = 0;
+    int window = UPLOAD_WINDOW;
+    int batchBytes = UPLOAD_BATCH_BYTES;
+    bool force = false;
+    bool sim = false;
+    int rttMs = UPLOAD_SIM_RTT_MS;
+    int kbps = UPLOAD_SIM_KBPS;
+    int errorEvery = 0;
+
+    for (int i = 0; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "--id") == 0) && (i + 1 < argc))             id = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--name") == 0) && (i + 1 < argc))      name = argv[++i];
+        else if ((strcmp(argv[i], "--window") == 0) && (i + 1 < argc))    window = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--batch") == 0) && (i + 1 < argc))     batchBytes = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--manifest") == 0) && (i + 1 < argc))  manifestPath = argv[++i];
+        else if (strcmp(argv[i], "--force") == 0)                         force = true;
+        else if ((strcmp(argv[i], "--device") == 0) && (i + 1 < argc))    deviceId = argv[++i];
+        else if ((strcmp(argv[i], "--scan") == 0) && (i + 1 < argc))      scanFilter = argv[++i];
+        else if (strcmp(argv[i], "--sim") == 0)                           sim = true;
+        else if ((strcmp(argv[i], "--rtt") == 0) && (i + 1 < argc))       rttMs = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--kbps") == 0) && (i + 1 < argc))      kbps = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--errors") == 0) && (i + 1 < argc))    errorEvery = atoi(argv[++i]);
+        else if (argv[i][0] != '-')                                     paths.push_back(argv[i]);
+        else
+        {
+            fprintf(stderr, "upload: unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+    if (paths.empty() || ((name != NULL) && (paths.size() > 1)) || (id < 0) || (id > 0xFF) || (window < 1) ||
+        (window > UPLOAD_MAX_WINDOW) || (batchBytes < 1) || (batchBytes > UPLOAD_BATCH_MAX) || (rttMs < 0) ||
+        (kbps <= 0) || (errorEvery < 0) || (errorEvery == 1))
+    {
+        fprintf(stderr, "usage: upload <file>... [--id N] [--name name] [--window N] [--batch bytes] [--manifest file] [--force]\n"
+                        "       [--device id] [--scan filter] | --sim [--rtt ms] [--kbps N] [--errors N]\n");
+        return 2;
+    }
+
+    IUploadTarget *target = NULL;
+    SimUpload *simTarget = NULL;
+    if (sim)
+    {
+        simTarget = new SimUpload((uint32_t)rttMs, (uint32_t)kbps, (uint32_t)errorEvery);
+        target = simTarget;
+    }
+    else
+    {
+#ifdef AMI_SDK
+        std::vector<SdkDevice> devices;
+        if (sdkScanDevices(scanFilter, &devices) != ERR_OK)
+        {
+            fprintf(stderr, "upload: cannot initialize the AMI SDK\n");
+            return 1;
+        }
+        for (size_t d = 0; (d < devices.size()) && (target == NULL); d++)
+        {
+            if ((deviceId != NULL) && (devices[d].id != deviceId))     continue;
+            SdkUpload *sdk = new SdkUpload(devices[d]);
+            if (sdk->open() != ERR_OK)
+            {
+                fprintf(stderr, "upload: %s: cannot open the device\n", devices[d].id.c_str());
+                delete sdk;
+                continue;
+            }
+            target = sdk;
+        }
+        if (target == NULL)
+        {
+            fprintf(stderr, "upload: no device\n");
+            sdkEnd();
+            return 1;
+        }
+#else
+        (void)deviceId;
+        (void)scanFilter;
+        fprintf(stderr, "upload: devices need the AMI SDK (Win32 build), use --sim\n");
+        return 2;
+#endif
+    }
+
+    std::string manifest = (manifestPath != NULL) ? manifestPath : std::string(target->label()) + UPLOAD_MANIFEST_EXT;
+    FileUploader uploader(target, (unsigned)window);
+    UploadStats stats;
+    memset(&stats, 0, sizeof(stats));
+    uploader.setBatchBytes((uint16_t)batchBytes);
+    uploader.setForce(force);
+    if (uploader.loadManifest(manifest.c_str()) != ERR_OK)     fprintf(stderr, "upload: %s: cannot read the manifest, files sent again\n", manifest.c_str());
+
+    for (size_t f = 0; f < paths.size(); f++)
+    {
+        int err = uploader.upload(paths[f], (uint8_t)id, name, &stats);
+        if (err != ERR_OK)      fprintf(stderr, "upload: %s: failed (%d)\n", paths[f], err);
+    }
+    if (uploader.saveManifest(manifest.c_str()) != ERR_OK)     fprintf(stderr, "upload: %s: cannot write the manifest\n", manifest.c_str());
+
+    double seconds = stats.durationMs / 1000.0;
+    double kb = stats.bytes / 1024.0;
+    printf("files     %u  uploaded %u  unchanged %u  failed %u  window %u\n", (uint32_t)paths.size(), stats.files,
+        stats.unchanged, stats.failed, uploader.windowSize());
+    printf("uploaded  %.1f kB  %u batches  %u retries  %.2f s  %.1f kB/s\n", kb, stats.batches, stats.retries,
+        seconds, (seconds > 0) ? kb / seconds : 0.0);
+
+    int failed = (int)stats.failed;
+    if (simTarget != NULL)
+    {
+        printf("device    %u files received whole, %u with a wrong checksum\n", simTarget->filesComplete(), simTarget->filesCorrupted());
+        failed += (int)simTarget->filesCorrupted() + (int)(stats.files - simTarget->filesComplete());
+    }
+    delete target;
+#ifdef AMI_SDK
+    if (sim == false)       sdkEnd();
+#endif
+    return (failed > 0) ? 1 : 0;
+}
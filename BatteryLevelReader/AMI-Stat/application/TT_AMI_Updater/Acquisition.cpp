@@ -0,0 +1,260 @@
+/*
+* Acquisition.cpp : This file contains the real-time acquisition pipeline of the streamed channel
+*               data, and the lock-free ring buffers carrying it to the consumers.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include "Acquisition.h"
+#include "ErrCodes.h"
+
+/**
+* @brief ctor: class constructor
+*
+* @param capacity:  number of samples, rounded up to a power of two
+* @return None.
+*/
+SampleRing::SampleRing(uint32_t capacity)
+: mask(0)
+, head(0)
+, tailSeen(0)
+, dropped(0)
+, tail(0)
+, headSeen(0)
+{
+    uint32_t size = 1;
+    while ((size < capacity) && (size < 0x80000000u))     size <<= 1;
+    data.resize(size);
+    mask = size - 1;
+}
+
+/**
+* @brief write: add samples (producer thread only)
+*
+* @param samples:   samples
+* @param count:     number of samples
+* @return Number of samples written: the others did not fit and are counted as overruns
+*/
+uint32_t SampleRing::write(const float *samples, uint32_t count)
+{
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t space = capacity() - (h - tailSeen);
+    if (space < count)
+    {
+        // the consumer may have read since: its index is only loaded when the cached one is short
+        tailSeen = tail.load(std::memory_order_acquire);
+        space = capacity() - (h - tailSeen);
+    }
+    uint32_t n = (count < space) ? count : (uint32_t)space;
+    if (n < count)          dropped.store(dropped.load(std::memory_order_relaxed) + (count - n), std::memory_order_relaxed);
+    if (n == 0)             return 0;
+
+    uint32_t at = (uint32_t)h & mask;
+    uint32_t first = (n < capacity() - at) ? n : capacity() - at;
+    memcpy(&data[at], samples, first * sizeof(float));
+    memcpy(&data[0], samples + first, (n - first) * sizeof(float));
+    head.store(h + n, std::memory_order_release);      // publishes the samples to the consumer
+    return n;
+}
+
+/**
+* @brief read: take the oldest samples (consumer thread only)
+*
+* @param samples:   receives the samples
+* @param max:       max number of samples
+* @return Number of samples read (0: none available)
+*/
+uint32_t SampleRing::read(float *samples, uint32_t max)
+{
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (headSeen - t < max)     headSeen = head.load(std::memory_order_acquire);
+    uint64_t waiting = headSeen - t;
+    uint32_t n = (max < waiting) ? max : (uint32_t)waiting;
+    if (n == 0)             return 0;
+
+    uint32_t at = (uint32_t)t & mask;
+    uint32_t first = (n < capacity() - at) ? n : capacity() - at;
+    memcpy(samples, &data[at], first * sizeof(float));
+    memcpy(samples + first, &data[0], (n - first) * sizeof(float));
+    tail.store(t + n, std::memory_order_release);       // gives the space back to the producer
+    return n;
+}
+
+uint32_t SampleRing::available(void)
+{
+    uint64_t t = tail.load(std::memory_order_acquire);
+    return (uint32_t)(head.load(std::memory_order_acquire) - t);
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param source:    device streaming the samples
+* @param clock:     clock of the producer waits
+* @return None.
+*/
+AcquisitionPipeline::AcquisitionPipeline(ISampleSource *_source, IClock *_clock)
+: source(_source)
+, clock(_clock)
+, consumers(0)
+, channels(0)
+, rate(0)
+, active(false)
+, lastError(ERR_OK)
+, polls(0)
+, idlePolls(0)
+, maxBatch(0)
+, errors(0)
+{
+    for (uint32_t c = 0; c < ACQ_MAX_CHANNELS; c++)     samples[c] = 0;
+}
+
+AcquisitionPipeline::~AcquisitionPipeline()
+{
+    stop();
+}
+
+/**
+* @brief addConsumer: add a consumer, before start()
+*
+* @param capacity:  samples of each of its rings
+* @return The consumer (0, 1, ...), or -1 (too many consumers, already started)
+*/
+int AcquisitionPipeline::addConsumer(uint32_t capacity)
+{
+    if ((consumers >= ACQ_MAX_CONSUMERS) || producer.joinable())    return -1;
+    for (uint32_t c = 0; c < ACQ_MAX_CHANNELS; c++)     rings.push_back(std::unique_ptr<SampleRing>(new SampleRing(capacity)));
+    return consumers++;
+}
+
+/**
+* @brief ring: ring of a channel of a consumer, read by the consumer thread only
+*
+* @param consumer:  consumer, from addConsumer()
+* @param channel:   channel
+* @return The ring, NULL for an unknown consumer or channel
+*/
+SampleRing *AcquisitionPipeline::ring(int consumer, uint32_t channel)
+{
+    if ((consumer < 0) || (consumer >= consumers) || (channel >= ACQ_MAX_CHANNELS))     return NULL;
+    return rings[consumer * ACQ_MAX_CHANNELS + channel].get();
+}
+
+/**
+* @brief start: start the source and the producer thread
+*
+* @return ERR_OK or the error of the source
+*/
+int AcquisitionPipeline::start(void)
+{
+    if (producer.joinable())    return ERR_OK;
+
+    int err = source->start(&channels, &rate);
+    if (err != ERR_OK)      return err;
+    if (channels > ACQ_MAX_CHANNELS)    channels = ACQ_MAX_CHANNELS;
+
+    lastError = ERR_OK;
+    active = true;
+    producer = std::thread(producerEntry, this);
+    return ERR_OK;
+}
+
+/**
+* @brief stop: stop the producer thread and the source
+*
+* @return ERR_OK, or the error that stopped the producer (ACQ_MAX_ERRORS in a row)
+*/
+int AcquisitionPipeline::stop(void)
+{
+    if (producer.joinable() == false)   return ERR_OK;
+
+    active = false;
+    producer.join();
+    source->stop();
+    return lastError;
+}
+
+/**
+* @brief snapshot: counters of the producer, readable while it runs
+*
+* @param stats:     receives the counters
+* @return None.
+*/
+void AcquisitionPipeline::snapshot(AcquisitionStats *stats)
+{
+    stats->polls = polls.load(std::memory_order_relaxed);
+    stats->idlePolls = idlePolls.load(std::memory_order_relaxed);
+    for (uint32_t c = 0; c < ACQ_MAX_CHANNELS; c++)     stats->samples[c] = samples[c].load(std::memory_order_relaxed);
+    stats->maxBatch = maxBatch.load(std::memory_order_relaxed);
+    stats->errors = errors.load(std::memory_order_relaxed);
+}
+
+/**
+* @brief producerEntry: producer thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void AcquisitionPipeline::producerEntry(AcquisitionPipeline *self)
+{
+    self->producerFunc();
+}
+
+/**
+* @brief producerFunc: drain every channel of the source at each poll into the rings of the
+*           consumers, wait ACQ_POLL_MS when the source had nothing
+*
+* @return None.
+*/
+void AcquisitionPipeline::producerFunc(void)
+{
+    std::vector<float> batch;
+    uint32_t counts[ACQ_MAX_CHANNELS];
+    uint32_t failures = 0;
+
+    while (active.load(std::memory_order_acquire))
+    {
+        uint32_t drained = 0;
+        int err;
+
+        memset(counts, 0, sizeof(counts));
+        err = source->available(counts);
+        for (uint32_t c = 0; (err == ERR_OK) && (c < channels); c++)
+        {
+            if (counts[c] == 0)     continue;
+            if (batch.size() < counts[c])   batch.resize(counts[c]);     // the whole backlog in one call
+
+            uint32_t n = 0;
+            err = source->read(c, batch.data(), (uint32_t)batch.size(), &n);
+            if ((err != ERR_OK) || (n == 0))    continue;
+            for (int k = 0; k < consumers; k++)     rings[k * ACQ_MAX_CHANNELS + c]->write(batch.data(), n);
+
+            samples[c].store(samples[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            if (n > maxBatch.load(std::memory_order_relaxed))   maxBatch.store(n, std::memory_order_relaxed);
+            drained += n;
+        }
+        polls.store(polls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (err != ERR_OK)
+        {
+            errors.store(errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (++failures >= ACQ_MAX_ERRORS)
+            {
+                lastError = err;
+                break;
+            }
+        }
+        else
+        {
+            failures = 0;
+        }
+        if (drained == 0)
+        {
+            idlePolls.store(idlePolls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            clock->sleepMs(ACQ_POLL_MS);
+        }
+    }
+    active = false;
+}
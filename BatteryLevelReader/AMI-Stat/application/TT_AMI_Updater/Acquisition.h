@@ -0,0 +1,227 @@
+/*
+* Acquisition.h : This file contains the real-time acquisition pipeline of the streamed channel
+*               data, and the lock-free ring buffers carrying it to the consumers.
+*
+*   In a nutshell, this file implements:
+*       - SampleRing: a wait-free single producer / single consumer ring of float samples. The
+*           producer and the consumer each own one index and only read the other one: no lock,
+*           no retry loop, a bounded number of instructions per call. When the ring is full, the
+*           samples that do not fit are dropped and counted (overruns): the producer never waits
+*           for a consumer.
+*       - ISampleSource: the device streaming the samples, polled (AMI_DeviceAvailableSamples and
+*           AMI_DeviceChannelData in the tools, a synthetic source otherwise)
+*       - AcquisitionPipeline: a producer thread draining the source in bulk, every channel at
+*           each poll, into one ring per channel and per consumer (display, recorder, analytics,
+*           ...). Each consumer reads its rings at its own pace from its own thread; a slow
+*           consumer overruns its rings without delaying the others.
+*
+*   The latency is bounded by the poll period when the source is idle (ACQ_POLL_MS) plus the
+*   period of the consumer; the rings absorb a consumer late by up to their capacity.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _ACQUISITION_H
+#define _ACQUISITION_H
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "DeadlineClock.h"
+
+#define ACQ_MAX_CHANNELS        4           // Max channels of a source (TTL_MAX_AMI_CHANNELS)
+#define ACQ_MAX_CONSUMERS       8           // Max consumers of a pipeline
+#define ACQ_RING_SAMPLES        16384       // Default ring capacity per channel (8 s at 2048 Hz)
+#define ACQ_POLL_MS             2           // Wait of the producer when the source has no sample
+#define ACQ_MAX_ERRORS          10          // Consecutive source errors stopping the producer
+#define ACQ_CACHE_LINE          64          // Size of a cache line (padding of the ring indexes)
+
+
+class SampleRing
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param capacity:  number of samples, rounded up to a power of two
+    * @return None.
+    */
+    SampleRing(uint32_t capacity);
+
+    /**
+    * @brief write: add samples (producer thread only)
+    *
+    * @param samples:   samples
+    * @param count:     number of samples
+    * @return Number of samples written: the others did not fit and are counted as overruns
+    */
+    uint32_t write(const float *samples, uint32_t count);
+
+    /**
+    * @brief read: take the oldest samples (consumer thread only)
+    *
+    * @param samples:   receives the samples
+    * @param max:       max number of samples
+    * @return Number of samples read (0: none available)
+    */
+    uint32_t read(float *samples, uint32_t max);
+
+    /**
+    * @brief available: number of samples waiting (exact from the consumer thread, a lower
+    *           bound elsewhere)
+    *
+    * @return Number of samples
+    */
+    uint32_t available(void);
+
+    uint32_t capacity(void)                                             { return mask + 1; }
+    uint64_t overruns(void)                                             { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<float> data;            // Samples, capacity() entries
+    uint32_t mask;                      // capacity() - 1
+
+    // producer side
+    std::atomic<uint64_t> head;         // Samples written since the start
+    uint64_t tailSeen;                  // Last tail read by the producer
+    std::atomic<uint64_t> dropped;      // Samples that did not fit
+    char padProducer[ACQ_CACHE_LINE];   // Keeps the consumer indexes off the producer cache line
+
+    // consumer side
+    std::atomic<uint64_t> tail;         // Samples read since the start
+    uint64_t headSeen;                  // Last head read by the consumer
+    char padConsumer[ACQ_CACHE_LINE];
+};
+
+
+class ISampleSource
+{
+public:
+    virtual ~ISampleSource() {}
+
+    /**
+    * @brief start: start streaming
+    *
+    * @param channels:  receives the number of channels
+    * @param rate:      receives the samples per second of each channel
+    * @return ERR_OK or an error
+    */
+    virtual int start(uint32_t *channels, uint32_t *rate) = 0;
+
+    /**
+    * @brief available: number of samples waiting in the source
+    *
+    * @param counts:    receives the number of each channel (ACQ_MAX_CHANNELS entries)
+    * @return ERR_OK or an error
+    */
+    virtual int available(uint32_t *counts) = 0;
+
+    /**
+    * @brief read: take the samples waiting on a channel
+    *
+    * @param channel:   channel
+    * @param samples:   receives the samples
+    * @param max:       max number of samples (at least the count given by available())
+    * @param count:     receives the number of samples read
+    * @return ERR_OK or an error
+    */
+    virtual int read(uint32_t channel, float *samples, uint32_t max, uint32_t *count) = 0;
+
+    /**
+    * @brief stop: stop streaming
+    *
+    * @return None.
+    */
+    virtual void stop(void) = 0;
+};
+
+typedef struct
+{
+    uint64_t polls;             // Polls of the source
+    uint64_t idlePolls;         // Polls that found no sample
+    uint64_t samples[ACQ_MAX_CHANNELS];     // Samples acquired per channel
+    uint32_t maxBatch;          // Most samples drained from a channel by one poll
+    uint32_t errors;            // Source calls that failed
+} AcquisitionStats;
+
+
+class AcquisitionPipeline
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param source:    device streaming the samples
+    * @param clock:     clock of the producer waits
+    * @return None.
+    */
+    AcquisitionPipeline(ISampleSource *source, IClock *clock = systemClock());
+    virtual ~AcquisitionPipeline();
+
+    /**
+    * @brief addConsumer: add a consumer, before start()
+    *
+    * @param capacity:  samples of each of its rings
+    * @return The consumer (0, 1, ...), or -1 (too many consumers, already started)
+    */
+    int addConsumer(uint32_t capacity = ACQ_RING_SAMPLES);
+
+    /**
+    * @brief start: start the source and the producer thread
+    *
+    * @return ERR_OK or the error of the source
+    */
+    int start(void);
+
+    /**
+    * @brief stop: stop the producer thread and the source
+    *
+    * @return ERR_OK, or the error that stopped the producer (ACQ_MAX_ERRORS in a row)
+    */
+    int stop(void);
+
+    /**
+    * @brief ring: ring of a channel of a consumer, read by the consumer thread only
+    *
+    * @param consumer:  consumer, from addConsumer()
+    * @param channel:   channel
+    * @return The ring, NULL for an unknown consumer or channel
+    */
+    SampleRing *ring(int consumer, uint32_t channel);
+
+    uint32_t channelCount(void)                                         { return channels; }
+    uint32_t sampleRate(void)                                           { return rate; }
+    bool running(void)                                                  { return active.load(std::memory_order_acquire); }
+
+    /**
+    * @brief snapshot: counters of the producer, readable while it runs
+    *
+    * @param stats:     receives the counters
+    * @return None.
+    */
+    void snapshot(AcquisitionStats *stats);
+
+private:
+    static void producerEntry(AcquisitionPipeline *self);
+    void producerFunc(void);
+
+    ISampleSource *source;              // Device streaming the samples
+    IClock *clock;                      // Clock of the producer waits
+    std::vector<std::unique_ptr<SampleRing> > rings;    // Ring of each consumer and channel
+    int consumers;                      // Number of consumers
+    uint32_t channels;                  // Channels of the source
+    uint32_t rate;                      // Samples per second of each channel
+    std::thread producer;               // Producer thread
+    std::atomic<bool> active;           // The producer thread runs
+    std::atomic<int> lastError;         // Error that stopped the producer
+
+    std::atomic<uint64_t> polls;        // AcquisitionStats, written by the producer thread
+    std::atomic<uint64_t> idlePolls;
+    std::atomic<uint64_t> samples[ACQ_MAX_CHANNELS];
+    std::atomic<uint32_t> maxBatch;
+    std::atomic<uint32_t> errors;
+};
+
+#endif // _ACQUISITION_H
@@ -0,0 +1,261 @@
+/*
+* BatchWriter.cpp : This file contains the class writing the downloaded batches to disk on its own
+*               thread (write-behind), so that the thread receiving them never waits on the disk.
+*
+*   In a nutshell, this class implements:
+*       - a queue of operations (open a file, append data, close it) executed in order by an I/O thread
+*       - the coalescing of the small batches in BATCHWRITER_BLOCK buffers, written with one fwrite
+*       - a bound on the bytes waiting in the queue: write() blocks when the disk cannot keep up
+*       - the files written under a temporary name and renamed once complete (discarded on error)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <errno.h>
+#include <string.h>
+#include "BatchWriter.h"
+
+/**
+* @brief ctor: class constructor, starts the I/O thread
+*
+* @param maxQueued: max number of bytes waiting for the disk before write() blocks
+* @return None.
+*/
+BatchWriter::BatchWriter(size_t _maxQueued)
+: queuedBytes(0)
+, maxQueued(_maxQueued)
+, busy(false)
+, running(true)
+, written(0)
+, failed(0)
+, bytes(0)
+, file(NULL)
+, fileError(false)
+{
+    worker = std::thread(threadEntry, this);
+}
+
+/**
+* @brief dtor: class destructor, writes what is queued and stops the I/O thread
+*
+* @return None.
+*/
+BatchWriter::~BatchWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+        wake.notify_one();
+    }
+    if (worker.joinable())  worker.join();
+    if (file != NULL)                                   // opened and never closed: discard
+    {
+        fclose(file);
+        remove(filePath.c_str());
+    }
+}
+
+/**
+* @brief open: start a file. The data written until close() goes in it.
+*
+* @param path:      temporary path of the file
+* @return None.
+*/
+void BatchWriter::open(const char *path)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Operation op;
+    op.type = BATCHWRITER_OPEN;
+    op.path = path;
+    queue.push_back(op);
+    wake.notify_one();
+}
+
+/**
+* @brief write: append data to the file (copied, written later by the I/O thread)
+*
+* @param data:      bytes
+* @param len:       number of bytes
+* @return None.
+*/
+void BatchWriter::write(const uint8_t *data, uint32_t len)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (running && (queuedBytes > 0) && (queuedBytes + len > maxQueued))    drained.wait(guard);    // let the disk catch up
+
+    // append to the last block while it has room, so that the I/O thread writes large blocks
+    if (queue.empty() || (queue.back().type != BATCHWRITER_DATA) || (queue.back().data.size() + len > BATCHWRITER_BLOCK))
+    {
+        Operation op;
+        op.type = BATCHWRITER_DATA;
+        queue.push_back(op);
+        queue.back().data.reserve((len > BATCHWRITER_BLOCK) ? len : BATCHWRITER_BLOCK);
+    }
+    queue.back().data.insert(queue.back().data.end(), data, data + len);
+    queuedBytes += len;
+    wake.notify_one();
+}
+
+/**
+* @brief close: complete the file
+*
+* @param finalPath: name given to the file once written, NULL to discard the file
+* @return None.
+*/
+void BatchWriter::close(const char *finalPath)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    Operation op;
+    op.type = BATCHWRITER_CLOSE;
+    if (finalPath != NULL)  op.path = finalPath;
+    queue.push_back(op);
+    wake.notify_one();
+}
+
+/**
+* @brief flush: wait until every queued operation is executed
+*
+* @return None.
+*/
+void BatchWriter::flush(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (running && (queue.empty() == false || busy))    drained.wait(guard);
+}
+
+void BatchWriter::takeErrors(std::vector<std::string> *_errors)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    _errors->insert(_errors->end(), errors.begin(), errors.end());
+    errors.clear();
+}
+
+uint32_t BatchWriter::filesWritten(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return written;
+}
+
+uint32_t BatchWriter::filesFailed(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return failed;
+}
+
+uint64_t BatchWriter::bytesWritten(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes;
+}
+
+/**
+* @brief threadEntry: I/O thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void BatchWriter::threadEntry(BatchWriter *self)
+{
+    self->threadFunc();
+}
+
+/**
+* @brief threadFunc: execute the queued operations, all of them at once to limit the locking
+*
+* @return None.
+*/
+void BatchWriter::threadFunc(void)
+{
+    std::deque<Operation> work;
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true)
+    {
+        while (running && queue.empty())    wake.wait(guard);
+        if (queue.empty())                  break;      // stopped and everything written
+
+        work.swap(queue);
+        busy = true;
+        guard.unlock();
+
+        size_t done = 0;
+        for (size_t i = 0; i < work.size(); i++)
+        {
+            execute(work[i]);
+            done += work[i].data.size();
+        }
+        work.clear();
+
+        guard.lock();
+        busy = false;
+        queuedBytes -= done;
+        drained.notify_all();
+    }
+    drained.notify_all();
+}
+
+/**
+* @brief fileFailed: note the first error of the file being written, with errno (I/O thread)
+*
+* @param what:      operation that failed
+* @return None.
+*/
+void BatchWriter::fileFailed(const char *what)
+{
+    if (fileError == false)     fileErrorText = std::string(what) + ": " + strerror(errno);
+    fileError = true;
+}
+
+/**
+* @brief execute: execute one operation (I/O thread)
+*
+* @param op:        operation
+* @return None.
+*/
+void BatchWriter::execute(Operation &op)
+{
+    switch (op.type)
+    {
+        case BATCHWRITER_OPEN:
+            filePath = op.path;
+            fileError = false;
+            fileErrorText.clear();
+            file = fopen(filePath.c_str(), "wb");
+            if (file == NULL)       fileFailed("cannot create the file");
+            else                    setvbuf(file, NULL, _IOFBF, BATCHWRITER_BLOCK);
+            break;
+
+        case BATCHWRITER_DATA:
+            if ((file != NULL) && (fileError == false))
+            {
+                if (fwrite(op.data.data(), 1, op.data.size(), file) != op.data.size())     fileFailed("cannot write");
+                else
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    bytes += op.data.size();
+                }
+            }
+            break;
+
+        case BATCHWRITER_CLOSE:
+        {
+            if ((file != NULL) && (fclose(file) != 0))      fileFailed("cannot write");
+            file = NULL;
+
+            bool keep = (fileError == false) && (op.path.empty() == false);
+            if (keep)
+            {
+                remove(op.path.c_str());                    // rename() does not replace an existing file on Windows
+                keep = (rename(filePath.c_str(), op.path.c_str()) == 0);
+                if (keep == false)  fileFailed("cannot rename the file");
+            }
+            if (keep == false)      remove(filePath.c_str());
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (keep)               written++;
+            else                    failed++;
+            if (fileError && (op.path.empty() == false))    errors.push_back(op.path + ": " + fileErrorText);    // not a discard requested
+            break;
+        }
+    }
+}
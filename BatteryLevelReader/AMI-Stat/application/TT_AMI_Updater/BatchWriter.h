@@ -0,0 +1,134 @@
+/*
+* BatchWriter.h : This file contains the class writing the downloaded batches to disk on its own
+*               thread (write-behind), so that the thread receiving them never waits on the disk.
+*
+*   In a nutshell, this class implements:
+*       - a queue of operations (open a file, append data, close it) executed in order by an I/O thread
+*       - the coalescing of the small batches in BATCHWRITER_BLOCK buffers, written with one fwrite
+*       - a bound on the bytes waiting in the queue: write() blocks when the disk cannot keep up
+*       - the files written under a temporary name and renamed once complete (discarded on error)
+*       - the cause of each file that could not be written (takeErrors), e.g. a missing folder
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _BATCHWRITER_H
+#define _BATCHWRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BATCHWRITER_BLOCK           (64 * 1024)         // Data appended to the queue in blocks of that size
+#define BATCHWRITER_MAX_QUEUED      (16 * 1024 * 1024)  // Max bytes waiting for the disk
+
+class BatchWriter
+{
+public:
+    /**
+    * @brief ctor: class constructor, starts the I/O thread
+    *
+    * @param maxQueued: max number of bytes waiting for the disk before write() blocks
+    * @return None.
+    */
+    BatchWriter(size_t maxQueued = BATCHWRITER_MAX_QUEUED);
+
+    /**
+    * @brief dtor: class destructor, writes what is queued and stops the I/O thread
+    *
+    * @return None.
+    */
+    virtual ~BatchWriter();
+
+    /**
+    * @brief open: start a file. The data written until close() goes in it.
+    *
+    * @param path:      temporary path of the file
+    * @return None.
+    */
+    void open(const char *path);
+
+    /**
+    * @brief write: append data to the file (copied, written later by the I/O thread)
+    *
+    * @param data:      bytes
+    * @param len:       number of bytes
+    * @return None.
+    */
+    void write(const uint8_t *data, uint32_t len);
+
+    /**
+    * @brief close: complete the file
+    *
+    * @param finalPath: name given to the file once written, NULL to discard the file
+    * @return None.
+    */
+    void close(const char *finalPath);
+
+    /**
+    * @brief flush: wait until every queued operation is executed
+    *
+    * @return None.
+    */
+    void flush(void);
+
+    /**
+    * @brief takeErrors: the files that could not be written since the last call, with the cause,
+    *           e.g. "<path>: cannot create the file: No such file or directory"
+    *
+    * @param errors:    receives the messages (appended)
+    * @return None.
+    */
+    void takeErrors(std::vector<std::string> *errors);
+
+    uint32_t filesWritten(void);
+    uint32_t filesFailed(void);
+    uint64_t bytesWritten(void);
+
+private:
+    typedef enum
+    {
+        BATCHWRITER_OPEN,
+        BATCHWRITER_DATA,
+        BATCHWRITER_CLOSE,
+    } OpType;
+
+    typedef struct
+    {
+        OpType type;
+        std::string path;               // File opened, final name of the file closed ("": discard)
+        std::vector<uint8_t> data;      // Data appended
+    } Operation;
+
+    static void threadEntry(BatchWriter *self);
+    void threadFunc(void);
+    void execute(Operation &op);
+    void fileFailed(const char *what);
+
+    std::mutex lock;                    // Protects everything below
+    std::condition_variable wake;       // Signaled when operations are queued and on stop
+    std::condition_variable drained;    // Signaled when queued bytes are written
+    std::deque<Operation> queue;        // Operations waiting for the I/O thread
+    size_t queuedBytes;                 // Data bytes in queue
+    size_t maxQueued;                   // Bound of queuedBytes
+    bool busy;                          // The I/O thread executes operations out of the queue
+    bool running;                       // The I/O thread must keep running
+    std::thread worker;                 // I/O thread
+    uint32_t written;                   // Files written and renamed
+    uint32_t failed;                    // Files discarded on error or on request
+    uint64_t bytes;                     // Data bytes written
+    std::vector<std::string> errors;    // Files not written and why, not taken yet
+
+    // I/O thread only
+    FILE *file;                         // File being written
+    std::string filePath;               // Its temporary path
+    bool fileError;                     // An error occurred on the file
+    std::string fileErrorText;          // What failed and why (first error)
+};
+
+#endif // _BATCHWRITER_H
@@ -0,0 +1,84 @@
+/*
+* BatteryQuery.cpp : This file contains the class responsible to run the battery status transaction
+*               ("A" SLIP channel, GetBatteryStatus) on an opened Slip connection.
+*
+*   In a nutshell, this class implements:
+*       - the request and the wait for its answer, up to BATTERY_QUERY_TIMEOUT_MS
+*       - the frames pushed by the device meanwhile (heartbeats, events) handed to the caller
+*       - the decoding of the state of charge, voltage and charging flag
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include "BatteryQuery.h"
+#include "JsonFields.h"
+#include "ErrCodes.h"
+
+/**
+* @brief ctor: class constructor
+*
+* @param slip:      opened connection to the device
+* @return None.
+*/
+BatteryQuery::BatteryQuery(Slip *_slip)
+: slip(_slip)
+, failedOnSend(false)
+{
+}
+
+/**
+* @brief run: send the request and decode the answer
+*
+* @param reading:   receives the battery status
+* @param fnct:      function receiving the other frames (can be NULL)
+* @param ctx:       opaque context value for that function
+* @return ERR_OK or an ErrCodes.h error (ERR_INV_RESPONSE: a field is missing in the answer)
+*/
+int BatteryQuery::run(BatteryReading *reading, BatteryQueryFrame_t fnct, void *ctx)
+{
+    const char *req = BATTERY_REQUEST;
+    uint8_t buf[BATTERY_FRAME_MAX + 1];         // +1 to terminate the string
+
+    failedOnSend = false;
+    int err = slip->send((const uint8_t *)req, (int)strlen(req));
+    if (err < 0)
+    {
+        failedOnSend = true;
+        return err;
+    }
+
+    IClock *clock = slip->getClock();
+    int64_t deadline = clock->nowMs() + BATTERY_QUERY_TIMEOUT_MS;
+    while (true)
+    {
+        int waitTime = (int)(deadline - clock->nowMs());
+        if (waitTime <= 0)              return ERR_SLIP_TIMEOUT;
+        if (waitTime > BATTERY_READ_TIMEOUT_MS)     waitTime = BATTERY_READ_TIMEOUT_MS;
+
+        err = slip->read(buf, BATTERY_FRAME_MAX, waitTime);
+        if (err == ERR_SLIP_TIMEOUT)    continue;                   // keep waiting up to the deadline
+        if (err < 0)                    return err;
+        if (err == 0)                   continue;
+
+        buf[err] = 0;                   // terminate string
+        if ((buf[0] != 'A') || (strstr((const char *)buf, BATTERY_ANSWER_ID) == NULL))
+        {
+            if (fnct != NULL)           fnct(ctx, buf, err);        // heartbeat or event pushed by the device
+            continue;
+        }
+        break;
+    }
+
+    float soc, voltage;
+    bool charging;
+    const char *json = (const char *)buf;
+    if ((jsonGetNumber(json, "\"SOC\"", &soc) == false) || (jsonGetNumber(json, "\"Voltage\"", &voltage) == false) ||
+        (jsonGetBool(json, "\"Charging\"", &charging) == false))
+        return ERR_INV_RESPONSE;
+
+    reading->soc = (uint8_t)soc;
+    reading->voltage = (uint16_t)voltage;
+    reading->charging = charging;
+    return ERR_OK;
+}
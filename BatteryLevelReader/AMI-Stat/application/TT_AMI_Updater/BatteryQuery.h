@@ -0,0 +1,74 @@
+/*
+* BatteryQuery.h : This file contains the class responsible to run the battery status transaction
+*               ("A" SLIP channel, GetBatteryStatus) on an opened Slip connection.
+*
+*   In a nutshell, this class implements:
+*       - the request and the wait for its answer, up to BATTERY_QUERY_TIMEOUT_MS
+*       - the frames pushed by the device meanwhile (heartbeats, events) handed to the caller
+*       - the decoding of the state of charge, voltage and charging flag
+*
+*   It has no dependency on Windows nor on the UI: IBatteryStatus runs it on the Bluetooth
+*   connection, the tools run it on a simulated device.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _BATTERYQUERY_H
+#define _BATTERYQUERY_H
+
+#include <stdint.h>
+#include "Slip.h"
+
+#define BATTERY_REQUEST             "A" "{\n\"ID\": \"GetBatteryStatus\",\n\"Content\":{}\n}"   // Request JSON message
+#define BATTERY_ANSWER_ID           "GetBatteryStatus"  // Found in the answer
+#define BATTERY_READ_TIMEOUT_MS     2000    // Max time to wait for a frame
+#define BATTERY_QUERY_TIMEOUT_MS    10000   // Max time to wait for the answer (frames of other channels may come first)
+#define BATTERY_FRAME_MAX           1000    // Largest frame accepted
+
+typedef struct
+{
+    uint8_t soc;            // State of charge (%)
+    uint16_t voltage;       // Battery voltage (mV)
+    bool charging;          // Charger connected
+} BatteryReading;
+
+/**
+  * @brief Signature of function that will be called for the frames that are not the answer
+  *
+  * @param ctx:         Opaque context meaningful for the function
+  * @param frame:       frame received (heartbeat, event...)
+  * @param len:         number of bytes in frame
+  * @return         None
+  */
+typedef void (*BatteryQueryFrame_t) (void *ctx, const uint8_t *frame, int len);
+
+
+class BatteryQuery
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param slip:      opened connection to the device
+    * @return None.
+    */
+    BatteryQuery(Slip *slip);
+
+    /**
+    * @brief run: send the request and decode the answer
+    *
+    * @param reading:   receives the battery status
+    * @param fnct:      function receiving the other frames (can be NULL)
+    * @param ctx:       opaque context value for that function
+    * @return ERR_OK or an ErrCodes.h error (ERR_INV_RESPONSE: a field is missing in the answer)
+    */
+    int run(BatteryReading *reading, BatteryQueryFrame_t fnct, void *ctx);
+
+    bool sendFailed(void) const                                         { return failedOnSend; }
+
+private:
+    Slip *slip;                     // Connection to the device
+    bool failedOnSend;              // When true, the error returned by run() happened while sending
+};
+
+#endif // _BATTERYQUERY_H
@@ -0,0 +1,256 @@
+/*
+* BatteryStats.cpp : This file contains the classes computing rolling statistics on the battery
+*               readings (SOC and voltage) of the devices.
+*
+*   In a nutshell, this file implements:
+*       - RollingWindow: O(1) mean, variance, min, max and slope over a fixed size window
+*       - BatteryStats: statistics of one device
+*       - BatteryStatsEngine: statistics of all the devices
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "BatteryStats.h"
+
+#define SECONDS_PER_HOUR        3600.0
+
+RollingWindow::RollingWindow(uint32_t capacity)
+    : cap(capacity ? capacity : 1)
+    , vals(cap)
+    , times(cap)
+{
+    minQ.seq.resize(cap);
+    maxQ.seq.resize(cap);
+    reset();
+}
+
+void RollingWindow::reset(void)
+{
+    n = 0;
+    nextSeq = 0;
+    k = 0.0;
+    t0 = 0.0;
+    sum = sumSq = 0.0;
+    sumT = sumTT = sumTV = 0.0;
+    minQ.head = minQ.size = 0;
+    maxQ.head = maxQ.size = 0;
+}
+
+void RollingWindow::monoPush(MonoQueue &q, uint64_t s, double v, bool isMin)
+{
+    // Drop the front if it just left the window
+    if (q.size && s >= cap && q.seq[q.head] <= s - cap)
+    {
+        q.head = (q.head + 1) % cap;
+        q.size--;
+    }
+
+    // Drop from the back the candidates that can no longer be the min (max)
+    while (q.size)
+    {
+        uint64_t back = q.seq[(q.head + q.size - 1) % cap];
+        double bv = valueOf(back);
+        if ((isMin && bv < v) || (!isMin && bv > v))    break;
+        q.size--;
+    }
+
+    q.seq[(q.head + q.size) % cap] = s;
+    q.size++;
+}
+
+void RollingWindow::push(double t, double v)
+{
+    if (n == 0 && nextSeq == 0)
+    {
+        // Shift everything by the first sample to keep the sums small
+        k = v;
+        t0 = t;
+    }
+    v -= k;
+    t -= t0;
+
+    uint64_t s = nextSeq++;
+    uint32_t slot = (uint32_t)(s % cap);
+
+    if (n == cap)
+    {
+        double ov = vals[slot];
+        double ot = times[slot];
+        sum -= ov;
+        sumSq -= ov * ov;
+        sumT -= ot;
+        sumTT -= ot * ot;
+        sumTV -= ot * ov;
+    }
+    else
+    {
+        n++;
+    }
+
+    monoPush(minQ, s, v, true);
+    monoPush(maxQ, s, v, false);
+
+    vals[slot] = v;
+    times[slot] = t;
+    sum += v;
+    sumSq += v * v;
+    sumT += t;
+    sumTT += t * t;
+    sumTV += t * v;
+}
+
+double RollingWindow::mean(void) const
+{
+    if (n == 0)     return 0.0;
+    return k + sum / n;
+}
+
+double RollingWindow::variance(void) const
+{
+    if (n < 2)      return 0.0;
+    double var = (sumSq - sum * sum / n) / (n - 1);
+    return var > 0.0 ? var : 0.0;          // Rounding can give a tiny negative value
+}
+
+double RollingWindow::min(void) const
+{
+    if (minQ.size == 0)     return 0.0;
+    return k + valueOf(minQ.seq[minQ.head]);
+}
+
+double RollingWindow::max(void) const
+{
+    if (maxQ.size == 0)     return 0.0;
+    return k + valueOf(maxQ.seq[maxQ.head]);
+}
+
+double RollingWindow::slope(void) const
+{
+    if (n < 2)      return 0.0;
+    double den = n * sumTT - sumT * sumT;
+    if (den <= 0.0) return 0.0;             // All the samples at the same time
+    return (n * sumTV - sumT * sum) / den;
+}
+
+
+BatteryStats::BatteryStats(const BatteryStatsConfig &cfg)
+    : config(cfg)
+    , socWin(cfg.window)
+    , voltWin(cfg.window)
+{
+    reset();
+}
+
+void BatteryStats::reset(void)
+{
+    socWin.reset();
+    voltWin.reset();
+    socEwma = 0.0;
+    voltEwma = 0.0;
+    charging = false;
+    lastTimeMs = 0;
+    firstTimeMs = 0;
+    socLast = BATSTAT_INVALID_SOC;
+    voltLast = 0;
+    empty = true;
+}
+
+void BatteryStats::update(int64_t timeMs, uint8_t soc, uint16_t voltage, bool isCharging)
+{
+    if (soc == BATSTAT_INVALID_SOC || soc > 100)    return;
+
+    // Plugging or unplugging the charger makes the voltage jump: restart the windows
+    if (!empty && isCharging != charging)
+    {
+        socWin.reset();
+        voltWin.reset();
+        empty = true;
+    }
+
+    if (empty)
+    {
+        firstTimeMs = timeMs;
+        socEwma = soc;
+        voltEwma = voltage;
+        empty = false;
+    }
+    else
+    {
+        socEwma += config.ewmaAlpha * (soc - socEwma);
+        voltEwma += config.ewmaAlpha * (voltage - voltEwma);
+    }
+
+    double t = (timeMs - firstTimeMs) / 1000.0;
+    socWin.push(t, soc);
+    voltWin.push(t, voltage);
+
+    charging = isCharging;
+    lastTimeMs = timeMs;
+    socLast = soc;
+    voltLast = voltage;
+}
+
+void BatteryStats::snapshot(BatteryStatsSnapshot &ret) const
+{
+    ret.count = socWin.count();
+    ret.valid = socWin.full();
+    ret.charging = charging;
+    ret.lastTimeMs = lastTimeMs;
+
+    ret.socLast = socLast;
+    ret.socMean = socWin.mean();
+    ret.socEwma = socEwma;
+    ret.socMin = socWin.min();
+    ret.socMax = socWin.max();
+    ret.socVariance = socWin.variance();
+    ret.socSlope = socWin.slope() * SECONDS_PER_HOUR;
+
+    ret.voltLast = voltLast;
+    ret.voltMean = voltWin.mean();
+    ret.voltEwma = voltEwma;
+    ret.voltMin = voltWin.min();
+    ret.voltMax = voltWin.max();
+    ret.voltVariance = voltWin.variance();
+    ret.voltSlope = voltWin.slope() * SECONDS_PER_HOUR;
+
+    // Compare variances to the squared thresholds to avoid the square roots
+    ret.stable = ret.valid
+        && ret.socVariance <= config.stableSocStdDev * config.stableSocStdDev
+        && ret.voltVariance <= config.stableVoltStdDev * config.stableVoltStdDev;
+}
+
+
+BatteryStatsEngine::BatteryStatsEngine(const BatteryStatsConfig &cfg)
+    : config(cfg)
+{
+}
+
+void BatteryStatsEngine::setConfig(const BatteryStatsConfig &cfg)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    config = cfg;
+}
+
+void BatteryStatsEngine::update(const std::string &serial, int64_t timeMs, uint8_t soc, uint16_t voltage, bool charging)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, BatteryStats>::iterator it = devices.find(serial);
+    if (it == devices.end())
+        it = devices.insert(std::make_pair(serial, BatteryStats(config))).first;
+    it->second.update(timeMs, soc, voltage, charging);
+}
+
+bool BatteryStatsEngine::get(const std::string &serial, BatteryStatsSnapshot &ret)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, BatteryStats>::const_iterator it = devices.find(serial);
+    if (it == devices.end())    return false;
+    it->second.snapshot(ret);
+    return true;
+}
+
+void BatteryStatsEngine::remove(const std::string &serial)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    devices.erase(serial);
+}
@@ -0,0 +1,216 @@
+/*
+* BatteryStats.h : This file contains the classes computing rolling statistics on the battery
+*               readings (SOC and voltage) of the devices.
+*
+*   In a nutshell, this file implements:
+*       - RollingWindow: fixed size window over one metric. Every update is O(1):
+*           - mean and variance from running sums (values are shifted by the first sample
+*             to keep the sum of squares accurate)
+*           - min and max from monotonic queues (amortized O(1))
+*           - slope versus time from running regression sums (dV/dt)
+*       - BatteryStats: the statistics of one device (SOC and voltage windows plus EWMAs),
+*           with a validity flag (window full) and a stability flag (spread below threshold).
+*           The windows restart when the charger is connected or disconnected since the
+*           voltage jumps at that moment.
+*       - BatteryStatsEngine: one BatteryStats per device serial number, thread safe.
+*
+*   No Windows dependency: the engine is also used by the host tools.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _BATTERYSTATS_H
+#define _BATTERYSTATS_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define BATSTAT_INVALID_SOC     0xFF        // SOC value used by ProductionHelper when the reading failed
+
+/**
+* @brief Tuning of the statistics. The defaults match what AMIStat does (10 samples average).
+*/
+struct BatteryStatsConfig
+{
+    uint32_t window;            // Number of samples in the rolling windows
+    double ewmaAlpha;           // Weight of the new sample in the EWMA (0 < alpha <= 1)
+    double stableSocStdDev;     // Window is stable if the SOC standard deviation is below this (%)
+    double stableVoltStdDev;    // ... and if the voltage standard deviation is below this (mV)
+
+    BatteryStatsConfig() : window(10), ewmaAlpha(0.2), stableSocStdDev(1.5), stableVoltStdDev(25.0) {}
+};
+
+/**
+* @brief Statistics of one device at a given time
+*/
+struct BatteryStatsSnapshot
+{
+    uint32_t count;             // Samples in the window
+    bool valid;                 // Window is full
+    bool stable;                // Window is full and its spread is below the thresholds
+    bool charging;              // Charging state of the last sample
+    int64_t lastTimeMs;         // Time of the last sample
+
+    uint8_t socLast;            // Last reading (%)
+    double socMean;             // Rolling mean (%)
+    double socEwma;             // Exponentially weighted moving average (%)
+    double socMin;              // Rolling min (%)
+    double socMax;              // Rolling max (%)
+    double socVariance;         // Rolling variance (%^2)
+    double socSlope;            // Rolling dSOC/dt (% per hour)
+
+    uint16_t voltLast;          // Last reading (mV)
+    double voltMean;            // Rolling mean (mV)
+    double voltEwma;            // Exponentially weighted moving average (mV)
+    double voltMin;             // Rolling min (mV)
+    double voltMax;             // Rolling max (mV)
+    double voltVariance;        // Rolling variance (mV^2)
+    double voltSlope;           // Rolling dV/dt (mV per hour)
+};
+
+class RollingWindow
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param capacity:  number of samples in the window (>= 1)
+    * @return None.
+    */
+    RollingWindow(uint32_t capacity);
+
+    /**
+    * @brief push: add a sample, dropping the oldest one if the window is full
+    *
+    * @param t:         sample time in seconds (relative to any origin)
+    * @param v:         sample value
+    * @return None.
+    */
+    void push(double t, double v);
+
+    /**
+    * @brief reset: empty the window
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    uint32_t count(void) const                  { return n; }
+    bool full(void) const                       { return n == cap; }
+    double mean(void) const;
+    double variance(void) const;
+    double min(void) const;
+    double max(void) const;
+    double slope(void) const;
+
+private:
+    /**
+    * @brief Monotonic queue of sample sequence numbers, stored in a ring of cap entries.
+    *           The front is the index of the min (or max) of the window.
+    */
+    struct MonoQueue
+    {
+        std::vector<uint64_t> seq;              // Sequence numbers of the candidates
+        uint32_t head;                          // Index of the front
+        uint32_t size;                          // Number of candidates
+    };
+    void monoPush(MonoQueue &q, uint64_t s, double v, bool isMin);
+    double valueOf(uint64_t s) const            { return vals[(uint32_t)(s % cap)]; }
+
+    uint32_t cap;                               // Window capacity
+    uint32_t n;                                 // Samples in the window
+    uint64_t nextSeq;                           // Sequence number of the next sample
+    std::vector<double> vals;                   // Ring of values (shifted by k)
+    std::vector<double> times;                  // Ring of times (shifted by t0)
+    double k;                                   // Value shift (first sample)
+    double t0;                                  // Time shift (first sample)
+    double sum, sumSq;                          // Running sums of values
+    double sumT, sumTT, sumTV;                  // Running sums for the regression
+    MonoQueue minQ;                             // Candidates for the min
+    MonoQueue maxQ;                             // Candidates for the max
+};
+
+class BatteryStats
+{
+public:
+    BatteryStats(const BatteryStatsConfig &cfg = BatteryStatsConfig());
+
+    /**
+    * @brief update: add a battery reading
+    *
+    * @param timeMs:    reading time in ms (monotonic)
+    * @param soc:       state of charge (%). BATSTAT_INVALID_SOC readings are ignored.
+    * @param voltage:   battery voltage (mV)
+    * @param charging:  charger connected
+    * @return None.
+    */
+    void update(int64_t timeMs, uint8_t soc, uint16_t voltage, bool charging);
+
+    /**
+    * @brief reset: forget all the readings
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    /**
+    * @brief snapshot: compute the current statistics (O(1))
+    *
+    * @param ret:       filled with the statistics
+    * @return None.
+    */
+    void snapshot(BatteryStatsSnapshot &ret) const;
+
+private:
+    BatteryStatsConfig config;                  // Tuning
+    RollingWindow socWin;                       // SOC window
+    RollingWindow voltWin;                      // Voltage window
+    double socEwma;                             // SOC EWMA
+    double voltEwma;                            // Voltage EWMA
+    bool charging;                              // Last charging state
+    int64_t lastTimeMs;                         // Last reading time
+    int64_t firstTimeMs;                        // Time origin of the windows
+    uint8_t socLast;                            // Last SOC reading
+    uint16_t voltLast;                          // Last voltage reading
+    bool empty;                                 // No reading since reset
+};
+
+class BatteryStatsEngine
+{
+public:
+    BatteryStatsEngine(const BatteryStatsConfig &cfg = BatteryStatsConfig());
+
+    /**
+    * @brief setConfig: change the tuning. Applies to the devices seen afterward.
+    */
+    void setConfig(const BatteryStatsConfig &cfg);
+
+    /**
+    * @brief update: add a reading for a device (see BatteryStats::update)
+    */
+    void update(const std::string &serial, int64_t timeMs, uint8_t soc, uint16_t voltage, bool charging);
+
+    /**
+    * @brief get: statistics of a device
+    *
+    * @param serial:    device serial number
+    * @param ret:       filled with the statistics
+    * @return false if no reading was ever received for that device
+    */
+    bool get(const std::string &serial, BatteryStatsSnapshot &ret);
+
+    /**
+    * @brief remove: forget a device
+    */
+    void remove(const std::string &serial);
+
+private:
+    std::mutex lock;                                // Protects the map
+    BatteryStatsConfig config;                      // Tuning for new devices
+    std::map<std::string, BatteryStats> devices;    // Statistics per device serial number
+};
+
+#endif // _BATTERYSTATS_H
@@ -17,16 +17,19 @@
 #include "TT_AMI_UpdaterDlg.h"
 #include "lang.h"
 #include "ErrCodes.h"
+#include "BatteryQuery.h"
 #include <string.h>
 #include <stdio.h>
 /**
 * @brief ctor: class constructor
 *
 * @param devAddr: device address
+* @param events:  if not NULL, receives the frames pushed by the device and the battery reading
 * @return None.
 */
-IBatteryStatus::IBatteryStatus(BTH_ADDR devAddr)
+IBatteryStatus::IBatteryStatus(BTH_ADDR devAddr, DeviceEventHub *events)
 : exiting(false)
+, eventHub(events)
 {
     slip = new Slip(devAddr);
 	queryDevice();
@@ -87,99 +90,36 @@ bool IBatteryStatus::getError()
 */
 void IBatteryStatus::queryDevice(void)
 {
-
 	_error = true;
     slip->open();           // Try to open comm channel. In case of error, it will be reported by the send function.
     if (exiting == false)   // The above function may be long to execute
     {
-        const char *req = "A" "{\n\"ID\": \"GetBatteryStatus\",\n\"Content\":{}\n}"; // Request JSON message
-        int err = slip->send((const uint8_t *)req, (int) strlen(req));
-        if (err < 0)                            _errMsg = ErrTranslate(err, TXT_ERR_INFO_GATHER);
-        else if (err != strlen(req))			_errMsg = ErrTranslate(err, TXT_ERR_INFO_GATHER);
+        BatteryQuery query(slip);
+        BatteryReading reading;
+
+        int err = query.run(&reading, forwardFrame, this);
+        if (err != ERR_OK)      _errMsg = ErrTranslate(err, query.sendFailed() ? TXT_ERR_INFO_GATHER : TXT_ERR_RXFAIL);
         else
         {
-            uint8_t buf[1000];
-			time_t t1;
-			time_t t2;
-			time(&t1);
-			while (1)
-			{				
-				err = slip->read(buf, (int) sizeof(buf), 2000);           // 2 secs to get the answer
-				if (strstr( (char * )buf, "GetBatteryStatus") != NULL) break;
-				time(&t2);
-				if ((t2 - t1) > 10) 
-				{
-					err = 0;
-					break;
-				}
-			}
-
-
-            if (err == 0)       err = ERR_SLIP_TIMEOUT;
-
-            if (err < 0)                        _errMsg = ErrTranslate(err, TXT_ERR_RXFAIL);
-            else
-            {
-                buf[err] = L'\0';   // terminate string
-				std::wstring response; 
-				float val = 0;
-				bool bool_val = false;;
-
-                jsonExtract(buf, "\"SOC\"",   NULL, &val, NULL);
-				_SOC = static_cast<unsigned char> (val);
-                jsonExtract(buf, "\"Voltage\"", NULL, &val, NULL);
-				_voltage =val;
-                jsonExtract(buf, "\"Charging\"", NULL, NULL, &bool_val);
-				_charging = bool_val;
-				_error = false;
-			}
+            _SOC = reading.soc;
+            _voltage = reading.voltage;
+            _charging = reading.charging;
+            _error = false;
+            if (eventHub != NULL)   eventHub->onBattery(GetTickCount64(), _SOC, _voltage, _charging);
         }
-
     }
-
-
 }
 
-
-
-void IBatteryStatus::jsonExtract(const uint8_t *resp, const char *key, std::wstring *retData, float * number, bool  *  boolean)
+/**
+* @brief forwardFrame: give the frames pushed by the device during the query to the event hub
+*
+* @param ctx:       This instance
+* @param frame:     frame received (heartbeat, event...)
+* @param len:       number of bytes in frame
+* @return None
+*/
+void IBatteryStatus::forwardFrame(void *ctx, const uint8_t *frame, int len)
 {
-    const char *ptr = strstr((const char *) resp, key);
-    const char *end;
-	assert(ptr != NULL);
-	if (retData != NULL)
-	{
-		// The key provided by the caller already includes the surrounding ""
-		ptr = strstr(ptr, ":");                     // Reach the :
-		ptr = strstr(ptr, "\"");                    // Find the beginning "
-		assert(ptr != NULL);
-		ptr++;                                      // Skip the "
-		end = strstr(ptr + 1, "\"");                  // Find the ending "
-		assert(end != NULL);
-		std::string tmp(ptr, end - ptr);            // isolate the value
-		retData->assign(tmp.begin(), tmp.end());    // convert to wchar
-		return;
-	}
-
-	if (number != NULL)
-	{
-		ptr = strstr(ptr, ":");                     // Reach the :
-		assert(ptr != NULL);
-		ptr++;                                      // Skip the "
-		sscanf(ptr, "%f", number);
-		return;
-    }
-	if (boolean != NULL)
-	{
-		ptr = strstr(ptr, ":");                     // Reach the :
-		assert(ptr != NULL);
-		ptr++;                                      // Skip the "
-		*boolean = false;
-		if (strstr(ptr, "true") != NULL)
-			*boolean = true;
-		if (strstr(ptr, "True") != NULL)
-			*boolean = true;
-		return;
-	}
-
+    IBatteryStatus *pThis = static_cast<IBatteryStatus *>(ctx);
+    if (pThis->eventHub != NULL)    pThis->eventHub->onSlipFrame(frame, len, GetTickCount64());
 }
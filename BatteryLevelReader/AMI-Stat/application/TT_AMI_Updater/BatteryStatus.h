@@ -15,6 +15,7 @@
 #include <Windows.h>
 #include <string>
 #include "Slip.h"
+#include "DeviceEvents.h"
 
 
 
@@ -25,9 +26,11 @@ public:
     * @brief ctor: class constructor
     *
     * @param devAddr: device address
+    * @param events:  if not NULL, receives the 'H' and 'E' frames read while waiting for the answer
+    *                 and the battery reading
     * @return None.
     */
-	IBatteryStatus(BTH_ADDR _devAddr);
+	IBatteryStatus(BTH_ADDR _devAddr, DeviceEventHub *events = NULL);
 	unsigned char getSOC(void);
 	bool getCharging(void);
 	unsigned  short getVoltage(void);
@@ -53,10 +56,19 @@ private:
     */
     void queryDevice(void);
 
-    void jsonExtract(const uint8_t *resp, const char *key, std::wstring *retData,  float *  number, bool  * boolean);
+    /**
+    * @brief forwardFrame: give the frames pushed by the device during the query to the event hub
+    *
+    * @param ctx:       This instance
+    * @param frame:     frame received (heartbeat, event...)
+    * @param len:       number of bytes in frame
+    * @return None
+    */
+    static void forwardFrame(void *ctx, const uint8_t *frame, int len);
 
     volatile bool exiting;							// When true, we want to destroy the object
     Slip *slip;										// Slip instance to use
+    DeviceEventHub *eventHub;						// Receives the frames pushed by the device (may be NULL)
 	std::wstring _errMsg;
 	unsigned char _SOC = 0;
 	unsigned short _voltage = 0;
@@ -0,0 +1,345 @@
+/*
+* ChargeForecast.cpp : This file contains the prediction of the time a device needs on the
+*               charger to reach a battery level.
+*
+*   In a nutshell, this file implements:
+*       - ChargePredictor: the forecast of one device
+*       - ChargePredictorEngine: the forecasts of all the devices and their saved profiles
+*       - chargeFormatWait: the text of a forecast for the operator
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "ChargeForecast.h"
+#include "ErrCodes.h"
+
+#define MS_PER_HOUR             3600000.0
+#define CHARGE_RANGE_Z          1.645       // Range of the forecast: 90% of the charges
+#define CHARGE_CURRENT_MAX      0.9         // Part of the current 1% already charged at most
+#define CHARGE_DRIFT_PERCENT    5           // SOC timed in a charge before its factor is learned (%)
+#define CHARGE_PART_EXT         ".part"     // Extension of the profiles being written
+#define CHARGE_LINE_LEN         512
+
+ChargePredictor::ChargePredictor(const ChargeForecastConfig &config)
+    : cfg(config)
+{
+    for (int b = 0; b < CHARGE_BANDS; b++)
+    {
+        prof.rate[b] = (float)(((uint32_t)b * 10 < cfg.fullSoc) ? cfg.defaultRate : cfg.defaultFullRate);
+        prof.steps[b] = 0;
+    }
+    prof.spread = (float)cfg.defaultSpread;
+    prof.drift = (float)cfg.defaultDrift;
+    reset();
+}
+
+void ChargePredictor::reset(void)
+{
+    empty = true;
+    lastMs = 0;
+    lastSoc = 0;
+    lastCharging = false;
+    inCharge = false;
+    chargeMs = 0;
+    stepTimed = false;
+    stepMs = 0;
+    stepSoc = 0;
+    liveExpected = liveActual = 0.0;
+    livePercent = 0;
+}
+
+int ChargePredictor::bandOf(double soc)
+{
+    int b = (int)(soc / 10.0);
+    return std::min(std::max(b, 0), CHARGE_BANDS - 1);
+}
+
+double ChargePredictor::bandRate(int band) const
+{
+    return prof.rate[band];
+}
+
+/**
+* @brief startCharge: the charger was connected: time the SOC steps from here
+*/
+void ChargePredictor::startCharge(int64_t timeMs, uint8_t soc)
+{
+    inCharge = true;
+    chargeMs = timeMs;
+    stepTimed = false;
+    stepMs = timeMs;
+    stepSoc = soc;
+    liveExpected = liveActual = 0.0;
+    livePercent = 0;
+}
+
+/**
+* @brief endCharge: the charge ended: learn how far it was from the profile
+*/
+void ChargePredictor::endCharge(void)
+{
+    if (inCharge && (livePercent >= CHARGE_DRIFT_PERCENT))
+    {
+        // Less the part of the spread of the steps timed
+        double factor = log(liveExpected / liveActual);
+        double drift = std::max(factor * factor - prof.spread / livePercent, 0.0);
+        prof.drift = (float)((1.0 - cfg.historyWeight) * prof.drift + cfg.historyWeight * drift);
+    }
+    inCharge = false;
+    stepTimed = false;
+    liveExpected = liveActual = 0.0;
+    livePercent = 0;
+}
+
+/**
+* @brief learnStep: learn the rate of an SOC step of the charge
+*
+* @param band:      band of the SOC at the start of the step
+* @param socSteps:  SOC rise of the step (%)
+* @param rate:      its rate (% per hour)
+*/
+void ChargePredictor::learnStep(int band, uint32_t socSteps, double rate)
+{
+    double ratio = log(rate / bandRate(band));
+
+    // Spread: around the factor of the charge, which the drift accounts for. The steps of a few %
+    // are timed more precisely than those of 1%: their variance is brought to 1%.
+    if (livePercent > 0)
+    {
+        double resid = ratio - log(liveExpected / liveActual);
+        prof.spread = (float)((1.0 - cfg.historyWeight) * prof.spread + cfg.historyWeight * resid * resid * socSteps);
+    }
+
+    // Factor of the live charge, against the profile before this step
+    liveExpected += socSteps / bandRate(band);
+    liveActual += socSteps / rate;
+    livePercent += socSteps;
+
+    double w = std::max(cfg.historyWeight, 1.0 / (prof.steps[band] + 2));
+    prof.rate[band] = (float)(prof.rate[band] * exp(w * ratio));
+    prof.steps[band]++;
+}
+
+void ChargePredictor::update(int64_t timeMs, uint8_t soc, bool charging)
+{
+    if (soc > 100)      return;
+
+    if (empty || (timeMs < lastMs))
+    {
+        endCharge();
+        if (charging)   startCharge(timeMs, soc);
+    }
+    else if (charging)
+    {
+        if ((inCharge == false) || (timeMs - chargeMs > cfg.gapMs))
+        {
+            endCharge();
+            startCharge(timeMs, soc);
+        }
+        else if (soc > stepSoc)
+        {
+            // The time since the previous step includes the short disconnections
+            double hours = (timeMs - stepMs) / MS_PER_HOUR;
+            double rate = (hours > 0.0) ? (soc - stepSoc) / hours : 0.0;
+            if (stepTimed && (rate > 0.0) && (rate <= cfg.maxRate))
+                learnStep(bandOf(stepSoc), soc - stepSoc, rate);
+            stepTimed = (rate > 0.0) && (rate <= cfg.maxRate);
+            stepMs = timeMs;
+            stepSoc = soc;
+        }
+        else if (soc < stepSoc)
+        {
+            // Drawn on the charger or gauge corrected: time from the new SOC
+            stepTimed = false;
+            stepMs = timeMs;
+            stepSoc = soc;
+        }
+        chargeMs = timeMs;
+    }
+    else if (inCharge && (timeMs - chargeMs > cfg.gapMs))
+    {
+        endCharge();
+    }
+
+    empty = false;
+    lastMs = timeMs;
+    lastSoc = soc;
+    lastCharging = charging;
+}
+
+void ChargePredictor::forecast(int64_t nowMs, double level, ChargeForecast &ret) const
+{
+    memset(&ret, 0, sizeof(ret));
+    ret.minutes = ret.lowMinutes = ret.highMinutes = -1.0;
+    if (empty)          return;
+
+    ret.valid = true;
+    ret.soc = lastSoc;
+    ret.charging = inCharge && (nowMs - chargeMs <= cfg.gapMs);
+    level = std::min(level, 100.0);
+    if (lastSoc >= level)
+    {
+        ret.ready = true;
+        ret.minutes = ret.lowMinutes = ret.highMinutes = 0.0;
+        ret.rate = bandRate(bandOf(lastSoc));
+        return;
+    }
+
+    // Live factor, weighed against the profile: its variance is the spread over the SOC timed,
+    // the one of the profile is the drift of whole charges
+    double drift = prof.drift;
+    double shrink = 0.0;
+    double factor = 1.0;
+    if (cfg.live && ret.charging && (livePercent > 0))
+    {
+        double measured = prof.spread / livePercent;
+        shrink = (drift + measured > 0.0) ? drift / (drift + measured) : 0.0;
+        factor = exp(log(liveExpected / liveActual) * shrink);
+        drift *= 1.0 - shrink;
+    }
+
+    ret.source = CHARGE_SOURCE_DEFAULT;
+    double hours = 0.0;
+    for (int b = bandOf(lastSoc); b <= bandOf(level - 1.0); b++)
+    {
+        double from = std::max((double)lastSoc, b * 10.0);
+        double to = (b == CHARGE_BANDS - 1) ? level : std::min(level, (b + 1) * 10.0);
+        if (to > from)      hours += (to - from) / (bandRate(b) * factor);
+        if (prof.steps[b] > 0)  ret.source = CHARGE_SOURCE_HISTORY;
+    }
+    if (shrink > 0.0)       ret.source = CHARGE_SOURCE_LIVE;
+    ret.rate = bandRate(bandOf(lastSoc)) * factor;
+
+    // Part of the current 1% already charged: since its step, or half of it when the charge
+    // started on it
+    if (ret.charging)
+    {
+        double onePercent = 1.0 / ret.rate;
+        double done = (nowMs - stepMs) / MS_PER_HOUR + (stepTimed ? 0.0 : 0.5 * onePercent);
+        hours -= std::min(std::max(done, 0.0), CHARGE_CURRENT_MAX * onePercent);
+    }
+
+    double var = prof.spread / std::max(level - lastSoc, 1.0) + drift;
+    double range = exp(CHARGE_RANGE_Z * sqrt(var));
+    ret.minutes = hours * 60.0;
+    ret.lowMinutes = ret.minutes / range;
+    ret.highMinutes = ret.minutes * range;
+}
+
+ChargePredictorEngine::ChargePredictorEngine(const ChargeForecastConfig &cfg)
+    : config(cfg)
+{
+}
+
+void ChargePredictorEngine::update(const std::string &key, int64_t timeMs, uint8_t soc, bool charging)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, ChargePredictor>::iterator it = devices.find(key);
+    if (it == devices.end())
+        it = devices.insert(std::make_pair(key, ChargePredictor(config))).first;
+    it->second.update(timeMs, soc, charging);
+}
+
+bool ChargePredictorEngine::forecast(const std::string &key, int64_t nowMs, double level, ChargeForecast &ret)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, ChargePredictor>::const_iterator it = devices.find(key);
+    if (it == devices.end())
+    {
+        memset(&ret, 0, sizeof(ret));
+        ret.minutes = ret.lowMinutes = ret.highMinutes = -1.0;
+        return false;
+    }
+    it->second.forecast(nowMs, level, ret);
+    return ret.valid;
+}
+
+int ChargePredictorEngine::load(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return ERR_FILE_READ;
+
+    std::lock_guard<std::mutex> guard(lock);
+    char line[CHARGE_LINE_LEN];
+    int ret = ERR_OK;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char key[64];
+        ChargeProfile p;
+        int pos = 0;
+        if (sscanf(line, "%63s %f %f%n", key, &p.spread, &p.drift, &pos) != 3)
+        {
+            if (strspn(line, " \t\r\n") != strlen(line))    ret = ERR_FILE_FORMAT;
+            continue;
+        }
+        bool ok = (p.spread >= 0.0f) && (p.drift >= 0.0f);
+        for (int b = 0; ok && (b < CHARGE_BANDS); b++)
+        {
+            int n = 0;
+            ok = (sscanf(line + pos, "%f %u%n", &p.rate[b], &p.steps[b], &n) == 2) && (p.rate[b] > 0.0f);
+            pos += n;
+        }
+        if (ok == false)
+        {
+            ret = ERR_FILE_FORMAT;
+            continue;
+        }
+
+        std::map<std::string, ChargePredictor>::iterator it = devices.find(key);
+        if (it == devices.end())
+            it = devices.insert(std::make_pair(std::string(key), ChargePredictor(config))).first;
+        it->second.setProfile(p);
+    }
+    fclose(file);
+    return ret;
+}
+
+int ChargePredictorEngine::save(const char *path)
+{
+    std::string tmpPath = std::string(path) + CHARGE_PART_EXT;
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    bool ok = true;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<std::string, ChargePredictor>::const_iterator it;
+        for (it = devices.begin(); ok && (it != devices.end()); ++it)
+        {
+            const ChargeProfile &p = it->second.profile();
+            fprintf(file, "%s %.5f %.5f", it->first.c_str(), p.spread, p.drift);
+            for (int b = 0; b < CHARGE_BANDS; b++)  fprintf(file, " %.3f %u", p.rate[b], p.steps[b]);
+            ok = (fprintf(file, "\n") > 0);
+        }
+    }
+    ok = (ferror(file) == 0) && ok;
+    ok = (fclose(file) == 0) && ok;
+    if (ok)
+    {
+        remove(path);
+        ok = (rename(tmpPath.c_str(), path) == 0);
+    }
+    if (ok == false)
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    return ERR_OK;
+}
+
+const char *chargeFormatWait(const ChargeForecast &f, int level, char *text, size_t size)
+{
+    if (size == 0)      return text;
+    text[0] = '\0';
+    if ((f.valid == false) || f.ready || (f.minutes < 0.0))     return text;
+
+    int minutes = std::max((int)ceil(f.minutes), 1);
+    int low = std::max((int)floor(f.lowMinutes), 1);
+    int high = std::max((int)ceil(f.highMinutes), minutes);
+    snprintf(text, size, "about %d min%s to %d%% (%d-%d min)", minutes, f.charging ? "" : " on the charger", level, low, high);
+    return text;
+}
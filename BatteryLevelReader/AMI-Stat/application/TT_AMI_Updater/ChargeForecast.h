@@ -0,0 +1,219 @@
+/*
+* ChargeForecast.h : This file contains the prediction of the time a device needs on the
+*               charger to reach a battery level, such as the level required to update it.
+*
+*   In a nutshell, this file implements:
+*       - ChargeProfile: the charge history of a device: its usual charge rate (% per hour)
+*           on each 10% of SOC, learned from the SOC steps of its past charges (exponentially
+*           weighted), the spread of the step rates around it and the drift of whole charges
+*           from it
+*       - ChargePredictor: the forecast for one device, fed one reading at a time in constant
+*           time and memory:
+*           - a charge lasts while the charger is connected; short disconnections (the charger
+*               relay of the production fixture toggling) do not end it, their time counts in
+*               the rates
+*           - each SOC step of the charge is timed; its rate updates the profile, and the time
+*               the profile expected for the steps of the charge over the time they took gives
+*               the factor of the live charge (a weaker charger, a warm pack...). It is weighed
+*               against the profile by their precision: the drift of whole charges from the
+*               profile against the spread of the steps over the SOC timed.
+*           - the time to a level is the sum, over the 10% of SOC left, of the SOC left in
+*               each divided by its rate from the profile times the live factor, less the time
+*               already spent on the current percent. Without a charge in progress, it is the
+*               time the device would need once on the charger.
+*           - a range (low, high) around it: the spread of the step rates averages out over
+*               the SOC left, the drift does not but shrinks as the live charge is timed
+*       - ChargePredictorEngine: one ChargePredictor per device, thread safe, with the profiles
+*           saved to a text file so that the charge history outlives the application
+*
+*   Profiles file: one line per device, "<key> <spread> <drift> <rate0> <steps0> ... <rate9> <steps9>".
+*   Written under a temporary name and renamed once complete.
+*
+*   No Windows dependency: the forecast is also used by the host tools.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _CHARGEFORECAST_H
+#define _CHARGEFORECAST_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#define CHARGE_BANDS            10          // Profile rates on 0-9, 10-19, ..., 90-100% SOC
+#define CHARGE_UPDATE_MIN_SOC   25          // Battery level required to update a device (%)
+
+// ChargeForecast::source
+#define CHARGE_SOURCE_DEFAULT   0           // No history: the default rates
+#define CHARGE_SOURCE_HISTORY   1           // Profile of the device
+#define CHARGE_SOURCE_LIVE      2           // Profile corrected by the charge in progress
+
+/**
+* @brief Tuning of the forecast. The defaults suit the AMI packs on their charger.
+*/
+struct ChargeForecastConfig
+{
+    double defaultRate;         // Charge rate without history, below fullSoc (% per hour)
+    double defaultFullRate;     // ... from fullSoc (constant voltage part, % per hour)
+    uint32_t fullSoc;           // SOC where the charge slows down (%)
+    double historyWeight;       // Weight of a new step rate in the profile (0..1)
+    bool live;                  // Correct the profile by the charge in progress
+    double defaultSpread;       // Variance of the log of the step rates over 1% without history
+    double defaultDrift;        // Variance of the log of the factor of a whole charge without history
+    int64_t gapMs;              // Charger disconnected longer than this: the charge ended
+    double maxRate;             // Step rates above this are not learned (% per hour, gauge jumps)
+
+    ChargeForecastConfig()
+    : defaultRate(25.0), defaultFullRate(5.0), fullSoc(80), historyWeight(0.03), live(true)
+    , defaultSpread(0.1), defaultDrift(0.02), gapMs(15 * 60 * 1000), maxRate(120.0) {}
+};
+
+/**
+* @brief Charge history of a device
+*/
+struct ChargeProfile
+{
+    float rate[CHARGE_BANDS];   // Usual charge rate on each 10% of SOC (% per hour)
+    uint32_t steps[CHARGE_BANDS];   // SOC steps learned on each
+    float spread;               // Variance of the log of the step rates over the profile, per 1% step
+    float drift;                // Variance of the log of the factor of a whole charge
+};
+
+/**
+* @brief Forecast of a device at a given time
+*/
+struct ChargeForecast
+{
+    bool valid;                 // A reading was received
+    bool ready;                 // The level is reached
+    bool charging;              // A charge is in progress (else: time once on the charger)
+    int source;                 // CHARGE_SOURCE_xxx
+    uint8_t soc;                // Last reading (%)
+    double minutes;             // Time to reach the level (0 if ready)
+    double lowMinutes;          // Range of that time (about 90%)
+    double highMinutes;
+    double rate;                // Charge rate expected now (% per hour)
+};
+
+class ChargePredictor
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param cfg:       tuning
+    * @return None.
+    */
+    ChargePredictor(const ChargeForecastConfig &cfg = ChargeForecastConfig());
+
+    /**
+    * @brief update: add a battery reading (O(1))
+    *
+    * @param timeMs:    reading time in ms (monotonic)
+    * @param soc:       state of charge (%). Readings above 100 (0xFF: failed) are ignored.
+    * @param charging:  charger connected
+    * @return None.
+    */
+    void update(int64_t timeMs, uint8_t soc, bool charging);
+
+    /**
+    * @brief forecast: time to reach a level (O(CHARGE_BANDS))
+    *
+    * @param nowMs:     current time in ms (same clock as update)
+    * @param level:     battery level to reach (%)
+    * @param ret:       filled with the forecast
+    * @return None.
+    */
+    void forecast(int64_t nowMs, double level, ChargeForecast &ret) const;
+
+    /**
+    * @brief reset: forget the readings, keep the profile
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    const ChargeProfile &profile(void) const                            { return prof; }
+    void setProfile(const ChargeProfile &p)                             { prof = p; }
+
+private:
+    static int bandOf(double soc);
+    double bandRate(int band) const;
+    void learnStep(int band, uint32_t socSteps, double rate);
+    void startCharge(int64_t timeMs, uint8_t soc);
+    void endCharge(void);
+
+    ChargeForecastConfig cfg;       // Tuning
+    ChargeProfile prof;             // Charge history
+
+    // Last reading
+    bool empty;                     // No reading since reset
+    int64_t lastMs;                 // Time of the last reading
+    uint8_t lastSoc;                // SOC of the last reading
+    bool lastCharging;              // Charging state of the last reading
+
+    // Charge in progress
+    bool inCharge;                  // A charge is in progress
+    int64_t chargeMs;               // Last reading on the charger
+    bool stepTimed;                 // stepMs is the time of an SOC step (not of the plug)
+    int64_t stepMs;                 // Time the SOC reached stepSoc
+    uint8_t stepSoc;                // SOC at the last step
+    double liveExpected;            // Time the profile expected for the steps timed (h)
+    double liveActual;              // Time they took (h)
+    uint32_t livePercent;           // SOC they cover (%)
+};
+
+class ChargePredictorEngine
+{
+public:
+    ChargePredictorEngine(const ChargeForecastConfig &cfg = ChargeForecastConfig());
+
+    /**
+    * @brief update: add a reading for a device (see ChargePredictor::update)
+    */
+    void update(const std::string &key, int64_t timeMs, uint8_t soc, bool charging);
+
+    /**
+    * @brief forecast: time a device needs to reach a level (see ChargePredictor::forecast)
+    *
+    * @return false if no reading was ever received for that device (ret.valid false)
+    */
+    bool forecast(const std::string &key, int64_t nowMs, double level, ChargeForecast &ret);
+
+    /**
+    * @brief load: read the profiles saved (the devices not seen yet start from them)
+    *
+    * @param path:      profiles file
+    * @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT
+    */
+    int load(const char *path);
+
+    /**
+    * @brief save: write the profiles of every device known
+    *
+    * @param path:      profiles file
+    * @return ERR_OK, ERR_FILE_WRITE
+    */
+    int save(const char *path);
+
+private:
+    std::mutex lock;                                        // Protects the map
+    ChargeForecastConfig config;                            // Tuning
+    std::map<std::string, ChargePredictor> devices;         // Forecast per device key
+};
+
+/**
+* @brief chargeFormatWait: short text of a forecast for the operator, e.g. "about 12 min to 25%"
+*           or "about 12 min on the charger to 25%"
+*
+* @param f:         forecast
+* @param level:     level the forecast is for (%)
+* @param text:      receives the text ("" if no forecast)
+* @param size:      size of text
+* @return text
+*/
+const char *chargeFormatWait(const ChargeForecast &f, int level, char *text, size_t size);
+
+#endif // _CHARGEFORECAST_H
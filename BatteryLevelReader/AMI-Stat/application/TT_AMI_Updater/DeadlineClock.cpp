@@ -0,0 +1,42 @@
+/*
+* DeadlineClock.cpp : This file contains the real clock used by the protocol engines for their
+*               deadlines and waits.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <chrono>
+#include <thread>
+#include "DeadlineClock.h"
+
+/**
+* @brief nowMs: monotonic time
+*
+* @return Time in milliseconds
+*/
+int64_t SteadyClock::nowMs(void)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* @brief sleepMs: suspend the calling thread
+*
+* @param ms:        time to wait in milliseconds
+* @return None.
+*/
+void SteadyClock::sleepMs(uint32_t ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/**
+* @brief systemClock: real clock shared by the connections which are not given another one
+*
+* @return The clock
+*/
+IClock *systemClock(void)
+{
+    static SteadyClock clock;
+    return &clock;
+}
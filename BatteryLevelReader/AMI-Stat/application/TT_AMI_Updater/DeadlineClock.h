@@ -0,0 +1,73 @@
+/*
+* DeadlineClock.h : This file contains the clock used by the protocol engines for their deadlines
+*               and waits.
+*
+*   In a nutshell, this file defines:
+*       - IClock: the interface giving the time and waiting, used for every protocol timeout
+*           (Slip frames, update chunks and CRC, battery query, Bluetooth recovery wait)
+*       - SteadyClock: the real implementation (monotonic clock, sleeping thread)
+*       - SimClock: a simulated time that only moves when someone waits: a wait of 30 s returns
+*           at once with the time advanced by 30 s, so that the timeout, retry and recovery
+*           scenarios run against a simulated device in microseconds
+*
+*   The connection carries its clock (Slip::setClock()): the engines running on a connection
+*   take their deadlines from it. A simulated connection (e.g. SimDevice) must advance the
+*   simulated time itself when it waits for data that does not come.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _DEADLINECLOCK_H
+#define _DEADLINECLOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+class IClock
+{
+public:
+    virtual ~IClock() {}
+
+    /**
+    * @brief nowMs: monotonic time
+    *
+    * @return Time in milliseconds (arbitrary origin)
+    */
+    virtual int64_t nowMs(void) = 0;
+
+    /**
+    * @brief sleepMs: wait for some time
+    *
+    * @param ms:        time to wait in milliseconds
+    * @return None.
+    */
+    virtual void sleepMs(uint32_t ms) = 0;
+};
+
+class SteadyClock : public IClock
+{
+public:
+    int64_t nowMs(void);
+    void sleepMs(uint32_t ms);
+};
+
+class SimClock : public IClock
+{
+public:
+    SimClock() : now(0)                                                 {}
+
+    int64_t nowMs(void)                                                 { return now.load(std::memory_order_relaxed); }
+    void sleepMs(uint32_t ms)                                           { now.fetch_add(ms, std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> now;       // Simulated time in milliseconds
+};
+
+/**
+* @brief systemClock: real clock shared by the connections which are not given another one
+*
+* @return The clock
+*/
+IClock *systemClock(void);
+
+#endif // _DEADLINECLOCK_H
@@ -0,0 +1,216 @@
+/*
+* DeviceEvents.cpp : This file contains the class responsible to turn what the device pushes
+*               into typed notifications.
+*
+*   In a nutshell, this class implements:
+*       - the decoding of the 'H' and 'E' SLIP frames
+*       - the online/offline and charger states
+*       - the dispatch of the notifications to the subscribers
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include "DeviceEvents.h"
+
+#define ERROR_STATUS_KEY    "ErrorStatusChange"     // 'E' event telling the device state changed
+
+DeviceEventHub::DeviceEventHub()
+    : hbTimeoutMs(DEVEVT_HB_TIMEOUT_MS)
+{
+    memset(subs, 0, sizeof(subs));
+    reset();
+}
+
+int DeviceEventHub::subscribe(uint32_t mask, DeviceEventNotif_t fn, void *ctx)
+{
+    if (fn == NULL || (mask & DEVEVT_MASK_ALL) == 0)  return -1;
+
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < DEVEVT_MAX_SUBSCRIBERS; i++)
+    {
+        if (subs[i].mask == 0)
+        {
+            subs[i].mask = mask & DEVEVT_MASK_ALL;
+            subs[i].fn = fn;
+            subs[i].ctx = ctx;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void DeviceEventHub::unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (id >= 0 && id < DEVEVT_MAX_SUBSCRIBERS)     subs[id].mask = 0;
+}
+
+void DeviceEventHub::setHeartbeatTimeout(uint32_t timeoutMs)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    hbTimeoutMs = timeoutMs;
+}
+
+void DeviceEventHub::reset(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    lastAliveMs = 0;
+    online = false;
+    batteryKnown = false;
+    lastCharging = false;
+}
+
+bool DeviceEventHub::isOnline(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return online;
+}
+
+DeviceEvent DeviceEventHub::makeEvent(DeviceEventType type, int64_t timeMs)
+{
+    DeviceEvent evt;
+    memset(&evt, 0, sizeof(evt));
+    evt.type = type;
+    evt.timeMs = timeMs;
+    return evt;
+}
+
+/**
+* @brief alive: record a proof of life. Must be called with the lock taken.
+*
+* @param timeMs:    reception time
+* @param out:       DEVEVT_ONLINE is added if the device was offline
+* @return None.
+*/
+void DeviceEventHub::alive(int64_t timeMs, std::vector<DeviceEvent> &out)
+{
+    lastAliveMs = timeMs;
+    if (!online)
+    {
+        online = true;
+        out.push_back(makeEvent(DEVEVT_ONLINE, timeMs));
+    }
+}
+
+/**
+* @brief dispatch: call the subscribers. Must be called without the lock.
+*
+* @param events:    events to dispatch, in order
+* @return None.
+*/
+void DeviceEventHub::dispatch(const std::vector<DeviceEvent> &events)
+{
+    if (events.empty())     return;
+
+    Subscriber copy[DEVEVT_MAX_SUBSCRIBERS];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        memcpy(copy, subs, sizeof(copy));
+    }
+
+    for (size_t e = 0; e < events.size(); e++)
+    {
+        for (int i = 0; i < DEVEVT_MAX_SUBSCRIBERS; i++)
+        {
+            if (copy[i].mask & DEVEVT_MASK(events[e].type))     copy[i].fn(copy[i].ctx, &events[e]);
+        }
+    }
+}
+
+void DeviceEventHub::onHeartbeat(int64_t timeMs)
+{
+    std::vector<DeviceEvent> events;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        alive(timeMs, events);
+    }
+    events.push_back(makeEvent(DEVEVT_HEARTBEAT, timeMs));
+    dispatch(events);
+}
+
+bool DeviceEventHub::onSlipFrame(const uint8_t *frame, int len, int64_t timeMs)
+{
+    if (frame == NULL || len < 1)   return false;
+
+    if (frame[0] == DEVEVT_CHANNEL_HEARTBEAT)
+    {
+        onHeartbeat(timeMs);
+        return true;
+    }
+    if (frame[0] != DEVEVT_CHANNEL_EVENT)   return false;
+
+    const char *text = (const char *)frame + 1;
+    int textLen = len - 1;
+
+    // Look for the key without relying on a terminating 0
+    bool errStatus = false;
+    size_t keyLen = strlen(ERROR_STATUS_KEY);
+    for (int i = 0; i + (int)keyLen <= textLen && !errStatus; i++)
+    {
+        errStatus = memcmp(text + i, ERROR_STATUS_KEY, keyLen) == 0;
+    }
+
+    std::vector<DeviceEvent> events;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        alive(timeMs, events);
+    }
+    DeviceEvent evt = makeEvent(errStatus ? DEVEVT_ERROR_STATUS : DEVEVT_DEVICE_EVENT, timeMs);
+    evt.text = text;
+    evt.textLen = textLen;
+    events.push_back(evt);
+    dispatch(events);
+    return true;
+}
+
+void DeviceEventHub::onSdkEvent(uint32_t eventId, int64_t timeMs)
+{
+    std::vector<DeviceEvent> events;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        alive(timeMs, events);
+    }
+    DeviceEvent evt = makeEvent(DEVEVT_SDK_EVENT, timeMs);
+    evt.sdkEventId = eventId;
+    events.push_back(evt);
+    dispatch(events);
+}
+
+void DeviceEventHub::onBattery(int64_t timeMs, uint8_t soc, uint16_t voltage, bool charging)
+{
+    std::vector<DeviceEvent> events;
+    DeviceEvent evt = makeEvent(DEVEVT_BATTERY, timeMs);
+    evt.soc = soc;
+    evt.voltage = voltage;
+    evt.charging = charging;
+    events.push_back(evt);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (batteryKnown && charging != lastCharging)
+        {
+            evt.type = charging ? DEVEVT_CHARGER_CONNECTED : DEVEVT_CHARGER_DISCONNECTED;
+            events.push_back(evt);
+        }
+        batteryKnown = true;
+        lastCharging = charging;
+    }
+    dispatch(events);
+}
+
+bool DeviceEventHub::checkLiveness(int64_t nowMs)
+{
+    std::vector<DeviceEvent> events;
+    bool active;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        active = online && (nowMs - lastAliveMs) <= (int64_t)hbTimeoutMs;
+        if (online && !active)
+        {
+            online = false;
+            events.push_back(makeEvent(DEVEVT_OFFLINE, nowMs));
+        }
+    }
+    dispatch(events);
+    return active;
+}
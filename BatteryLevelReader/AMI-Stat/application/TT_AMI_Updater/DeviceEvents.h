@@ -0,0 +1,167 @@
+/*
+* DeviceEvents.h : This file contains the class responsible to turn what the device pushes
+*               (heartbeats, 'E' events, SDK callbacks) into typed notifications.
+*
+*   In a nutshell, this class implements:
+*       - subscribe/unsubscribe with a mask of the event types of interest
+*       - the inputs: heartbeats, raw SLIP frames ('H' and 'E' channels), SDK device callbacks
+*         and battery readings
+*       - the states derived from them:
+*           - online/offline: online on the first heartbeat, offline when the heartbeats
+*             stay quiet longer than the timeout (checkLiveness)
+*           - charger connected/disconnected from the Charging flag of the battery readings
+*
+*   The online state needs no polling while checkLiveness() is true (see ProductionHelper).
+*   The notifications are called on the thread that fed the input, outside of the lock.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _DEVICEEVENTS_H
+#define _DEVICEEVENTS_H
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+#define DEVEVT_CHANNEL_EVENT        'E'     // SLIP channel of the device events (JSON)
+#define DEVEVT_CHANNEL_HEARTBEAT    'H'     // SLIP channel of the heartbeats
+#define DEVEVT_HB_TIMEOUT_MS        5000    // Default time without heartbeat before declaring the device offline
+#define DEVEVT_MAX_SUBSCRIBERS      8       // Max number of subscribers
+
+typedef enum
+{
+    DEVEVT_HEARTBEAT,               // Heartbeat received
+    DEVEVT_ERROR_STATUS,            // 'E' ErrorStatusChange: device state changed, info must be re-read
+    DEVEVT_DEVICE_EVENT,            // Any other 'E' event (text holds the JSON)
+    DEVEVT_SDK_EVENT,               // SDK device callback (sdkEventId holds the event id)
+    DEVEVT_ONLINE,                  // First heartbeat after being offline
+    DEVEVT_OFFLINE,                 // Heartbeats went quiet
+    DEVEVT_BATTERY,                 // Battery reading
+    DEVEVT_CHARGER_CONNECTED,       // Charging flag went from false to true
+    DEVEVT_CHARGER_DISCONNECTED,    // Charging flag went from true to false
+    DEVEVT_COUNT
+} DeviceEventType;
+
+#define DEVEVT_MASK(type)           (1u << (type))
+#define DEVEVT_MASK_ALL             ((1u << DEVEVT_COUNT) - 1)
+
+struct DeviceEvent
+{
+    DeviceEventType type;           // Event type
+    int64_t timeMs;                 // Time the input was received
+    uint32_t sdkEventId;            // DEVEVT_SDK_EVENT: SDK event id
+    uint8_t soc;                    // Battery events: state of charge (%)
+    uint16_t voltage;               // Battery events: voltage (mV)
+    bool charging;                  // Battery events: charging flag
+    const char *text;               // 'E' events: JSON payload (valid during the call only, not terminated)
+    int textLen;                    // Length of text
+};
+
+// Notification function
+typedef void (*DeviceEventNotif_t)(void *ctx, const DeviceEvent *evt);
+
+class DeviceEventHub
+{
+public:
+    DeviceEventHub();
+
+    /**
+    * @brief subscribe: register a notification function
+    *
+    * @param mask:      DEVEVT_MASK() of the event types to receive
+    * @param fn:        notification function
+    * @param ctx:       opaque context given back to fn
+    * @return subscription id (>= 0), -1 if too many subscribers
+    */
+    int subscribe(uint32_t mask, DeviceEventNotif_t fn, void *ctx);
+
+    /**
+    * @brief unsubscribe: remove a subscription. fn is not called anymore once this returns,
+    *           unless unsubscribe is called from a notification on another thread.
+    *
+    * @param id:        id returned by subscribe
+    * @return None.
+    */
+    void unsubscribe(int id);
+
+    /**
+    * @brief setHeartbeatTimeout: time without heartbeat before declaring the device offline
+    */
+    void setHeartbeatTimeout(uint32_t timeoutMs);
+
+    /**
+    * @brief reset: forget the derived states (e.g. when the device is closed)
+    */
+    void reset(void);
+
+    /**
+    * @brief onHeartbeat: a heartbeat was received
+    *
+    * @param timeMs:    reception time (monotonic ms)
+    * @return None.
+    */
+    void onHeartbeat(int64_t timeMs);
+
+    /**
+    * @brief onSlipFrame: a SLIP frame was received. Only 'H' and 'E' frames are handled.
+    *
+    * @param frame:     frame (first byte is the channel)
+    * @param len:       frame length
+    * @param timeMs:    reception time (monotonic ms)
+    * @return true if the frame was handled
+    */
+    bool onSlipFrame(const uint8_t *frame, int len, int64_t timeMs);
+
+    /**
+    * @brief onSdkEvent: the SDK called its device callback. Also a proof the device is alive.
+    *
+    * @param eventId:   SDK event id
+    * @param timeMs:    reception time (monotonic ms)
+    * @return None.
+    */
+    void onSdkEvent(uint32_t eventId, int64_t timeMs);
+
+    /**
+    * @brief onBattery: a battery reading was received (polled or pushed)
+    *
+    * @param timeMs:    reception time (monotonic ms)
+    * @param soc:       state of charge (%)
+    * @param voltage:   voltage (mV)
+    * @param charging:  charging flag
+    * @return None.
+    */
+    void onBattery(int64_t timeMs, uint8_t soc, uint16_t voltage, bool charging);
+
+    /**
+    * @brief checkLiveness: to call periodically. Sends DEVEVT_OFFLINE when the heartbeats stop.
+    *
+    * @param nowMs:     current time (monotonic ms)
+    * @return true if the heartbeats are flowing (no polling required)
+    */
+    bool checkLiveness(int64_t nowMs);
+
+    bool isOnline(void);
+
+private:
+    struct Subscriber
+    {
+        uint32_t mask;              // Event types of interest (0: free entry)
+        DeviceEventNotif_t fn;      // Notification function
+        void *ctx;                  // Context of fn
+    };
+
+    static DeviceEvent makeEvent(DeviceEventType type, int64_t timeMs);
+    void alive(int64_t timeMs, std::vector<DeviceEvent> &out);
+    void dispatch(const std::vector<DeviceEvent> &events);
+
+    std::mutex lock;                // Protects everything below
+    Subscriber subs[DEVEVT_MAX_SUBSCRIBERS];
+    uint32_t hbTimeoutMs;           // Heartbeat timeout
+    int64_t lastAliveMs;            // Last heartbeat or SDK event
+    bool online;                    // Derived online state
+    bool batteryKnown;              // A battery reading was received
+    bool lastCharging;              // Charging flag of the last battery reading
+};
+
+#endif // _DEVICEEVENTS_H
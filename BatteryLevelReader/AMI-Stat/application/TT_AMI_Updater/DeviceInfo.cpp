@@ -5,6 +5,8 @@
 *   In a nutshell, this class implements a thread that performs the transaction with the device
 *   and then decode the response and push the info toward the application via a callback.
 *   It is done that way to avoid blocking the UI during the transaction.
+*   The battery status is read on the same connection, once the info is received: the
+*   application gets it without opening a connection of its own.
 *
 * Author: Luc Tremblay
 * Project: AMI
@@ -17,6 +19,7 @@
 #include "TT_AMI_UpdaterDlg.h"
 #include "lang.h"
 #include "ErrCodes.h"
+#include "JsonFields.h"
 
 /**
 * @brief ctor: class constructor
@@ -82,6 +85,8 @@ void DeviceInfo::queryDevice(void)
     std::wstring prodId = L"???";
     std::wstring serialNb = L"???";
     std::wstring fwVer = L"???";
+    BatteryReading battery;
+    bool batteryValid = false;
 
     slip->open();           // Try to open comm channel. In case of error, it will be reported by the send function.
     if (exiting == false)   // The above function may be long to execute
@@ -103,11 +108,17 @@ void DeviceInfo::queryDevice(void)
                 jsonExtract(buf, "\"ProductNumber\"",   &prodId);
                 jsonExtract(buf, "\"SerialNumber\"",    &serialNb);
                 jsonExtract(buf, "\"FwMainVersion\"", &fwVer);
+
+                // The connection is open: the battery too (the info does not depend on it)
+                BatteryQuery query(slip);
+                batteryValid = (exiting == false) && (query.run(&battery, NULL, NULL) == ERR_OK);
             }
         }
 
+        if (errMsg != L"")      slip->flightRecorder().dump(CW2A(errMsg.c_str()));     // keep the history of the failure
+
         // Notify the application of the info obtained
-        notifFnct(notifCtx, prodId.c_str(), serialNb.c_str(), fwVer.c_str(), errMsg.c_str());
+        notifFnct(notifCtx, prodId.c_str(), serialNb.c_str(), fwVer.c_str(), errMsg.c_str(), batteryValid ? &battery : NULL);
     }
 
     if (exiting == false)       // Not absolutely safe (could have 2 delete for same object) but unlikely to happen
@@ -120,19 +131,8 @@ void DeviceInfo::queryDevice(void)
 }
 
 /**
-* @brief jsonExtract: extract a field from the json response buffer and convert to wchar
-*       This function assumes that the response is well formed and looks like that:
-*
-*   {"ID":"GetDeviceInfo",
-*    "Content":
-*       {"ProductNumber":"SA9000","SerialNumber":"GA000028","ProductType":1,
-*        "HardwareConfig":4,"FirmwarePNumber":"TT9000","FirmwareVersion":"0.13.0.0",
-*        "HardwareVersion":"2.0.0","ProtocolVersion":"1.0.0"
-*       },
-*    "Status":0
-*   }
-*
-*   In particular, a key should not be a value of another key.
+* @brief jsonExtract: extract a string field from the json response buffer (see JsonFields.h)
+*       and convert it to wchar. retData is left unchanged when the field is missing.
 *
 * @param resp:      Response packet received from device
 * @param key:       Key field to find in the response
@@ -141,20 +141,6 @@ void DeviceInfo::queryDevice(void)
 */
 void DeviceInfo::jsonExtract(const uint8_t *resp, const char *key, std::wstring *retData)
 {
-    const char *ptr = strstr((const char *) resp, key);
-    const char *end;
-    if (ptr != NULL)
-    {
-        // The key provided by the caller already includes the surrounding ""
-
-        ptr = strstr(ptr, ":");                     // Reach the :
-        assert(ptr != NULL);
-        ptr = strstr(ptr, "\"");                    // Find the beginning "
-        assert(ptr != NULL);
-        ptr++;                                      // Skip the "
-        end = strstr(ptr+1, "\"");                  // Find the ending "
-        assert(end != NULL);
-        std::string tmp(ptr, end - ptr);            // isolate the value
-        retData->assign(tmp.begin(), tmp.end());    // convert to wchar
-    }
+    std::string tmp;
+    if (jsonGetString((const char *)resp, key, &tmp))   retData->assign(tmp.begin(), tmp.end());    // convert to wchar
 }
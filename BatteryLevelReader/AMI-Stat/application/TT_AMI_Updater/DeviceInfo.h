@@ -5,6 +5,7 @@
 *   In a nutshell, this class implements a thread that performs the transaction with the device
 *   and then decode the response and push the info toward the application via a callback.
 *   It is done that way to avoid blocking the UI during the transaction.
+*   The battery status is read on the same connection, once the info is received.
 *
 * Author: Luc Tremblay
 * Project: AMI
@@ -16,6 +17,7 @@
 #include <Windows.h>
 #include <string>
 #include "Slip.h"
+#include "BatteryQuery.h"
 
 /**
   * @brief Signature of function that will be called when a new device will be disovered
@@ -25,10 +27,12 @@
   * @param serialNb:    Device serial number
   * @param firmwareVer: Device current firmware version
   * @param errMsg:      Error message (can be "")
+  * @param battery:     Battery status read after the info (NULL if it could not be read)
   * @return         None
   *
   */
-typedef void (*DeviceInfoNotif_t) (void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg);
+typedef void (*DeviceInfoNotif_t) (void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg,
+                                   const BatteryReading *battery);
 
 
 class DeviceInfo
@@ -68,19 +72,8 @@ private:
     void queryDevice(void);
 
     /**
-    * @brief jsonExtract: extract a field from the json response buffer and convert to wchar
-    *       This function assumes that the response is well formed and looks like that:
-    *
-    *   {"ID":"GetDeviceInfo",
-    *    "Content":
-    *       {"ProductNumber":"SA9000","SerialNumber":"GA000028","ProductType":1,
-    *        "HardwareConfig":4,"FirmwarePNumber":"TT9000","FirmwareVersion":"0.13.0.0",
-    *        "HardwareVersion":"2.0.0","ProtocolVersion":"1.0.0"
-    *       },
-    *    "Status":0
-    *   }
-    *
-    *   In particular, a key should not be a value of another key.
+    * @brief jsonExtract: extract a string field from the json response buffer (see JsonFields.h)
+    *       and convert it to wchar. retData is left unchanged when the field is missing.
     *
     * @param resp:      Response packet received from device
     * @param key:       Key field to find in the response
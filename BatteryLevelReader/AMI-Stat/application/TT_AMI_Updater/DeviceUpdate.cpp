@@ -16,44 +16,17 @@
 #include "DeviceUpdate.h"
 #include "TT_AMI_UpdaterDlg.h"
 #include "package.h"
+#include "UpdateSession.h"
 #include "lang.h"
 #include "ErrCodes.h"
-#include "time.h"
-
-// Definitions for the "Q" SLIP channel messages
-// Generic command offsets
-#define CHAN_OFF            0       // Offset to reach the SLIP channel identifier
-#define CMD_OFF             1       // Offset to reach the command number
-
-// Valid channel and commands
-#define CHAN_UPDATE         'Q'     // Channel used to update files
-#define CMD_UPDREQ          0xB0    // Update request command
-#define CMD_UPDRESP         0xB1    // Update response command
-
-// Update request command fields
-#define CMD_UPDREQ_OFFSET       2   // Offset to reach the offset field (4 bytes)
-#define CMD_UPDREQ_DATA         6   // Offset to reach the beginning of the data
-#define CMD_UPDREQ_MAXDATALEN   900 // Max number of data bytes that can be sent in a command
-#define CMD_UPDREQ_MAXLEN   (CMD_UPDREQ_DATA + CMD_UPDREQ_MAXDATALEN)       // See UNSLIPPED_PKT_MAX_SIZE defined in SLIP.h of AMI project
-
-#define CMD_UPDRESP_ERR     2       // Offset to reach the error code field (1 byte)
-#define CMD_UPDRESP_OFFSET  3       // Offset to reach the offset field (4 bytes)
-#define CMD_UPDRESP_LEN     7       // Total length of an update response command
-
-// response error codes in protocol (must match those in FirmwareUpdate.c of MAIN app)
-#define RESP_ERR_OK         0       // No error
-#define RESP_ERR_TOOSHORT   1       // Message too short
-#define RESP_ERR_INVCMD     2       // Invalid command number
-#define RESP_ERR_ERASE      3       // Error during flash erase
-#define RESP_ERR_WRITE      4       // Error during flash programming
-#define RESP_ERR_READ       5       // Error during flash reading
-#define RESP_ERR_CRCDWLD	6		// CRC error during download
-#define RESP_ERR_CRCSAVE	7		// CRC error when reading back image
-#define RESP_ERR_INCOMPATIBLE	8	// Package is incompatible with this device (not used yet but interpreted by PC updater application)
 
 // Bluetooth timeout management
 #define BLUETOOTH_TIMEOUT	20			// Number of seconds that bluetooth driver can't create socket after device crash
-static time_t bluetoothCrashTime = 0;	// Time when the device crash occurs
+static bool bluetoothCrashed = false;	// A device crash occurred
+static int64_t bluetoothCrashMs = 0;	// Clock time when the device crash occurs
+
+#define UPDATE_METRICS_FILE	"TT_AMI_Updater_metrics.jsonl"	// One JSON line per update session, in the temp folder
+#define UPDATE_METRICS_MAX_BYTES	(16 * 1024 * 1024)		// Size it is rotated at (to ".jsonl.1", a single previous file)
 
 
 /**
@@ -62,12 +35,14 @@ static time_t bluetoothCrashTime = 0;	// Time when the device crash occurs
 * @param devAddr:   MAC address of device to update
 * @param fnct:      function to execute to report new device discovery
 * @param ctx:       opaque context value for that function
+* @param clock:     clock of the timeouts and of the Bluetooth recovery wait
 * @return None.
 */
-DeviceUpdate::DeviceUpdate(BTH_ADDR devAddr, DeviceUpdateNotif_t fnct, void *ctx)
+DeviceUpdate::DeviceUpdate(BTH_ADDR devAddr, DeviceUpdateNotif_t fnct, void *ctx, IClock *_clock)
 {
     notifFnct = fnct;
     notifCtx = ctx;
+    clock = _clock;
 
 	// Send info about the update to the screen
 	std::wstring infoStr;
@@ -75,13 +50,16 @@ DeviceUpdate::DeviceUpdate(BTH_ADDR devAddr, DeviceUpdateNotif_t fnct, void *ctx
 	notifFnct(notifCtx, 0, infoStr.c_str(), false);
 
 	// If bluetooth connection crashed earlier, wait until windows drivers can connect to device
-	int seconds = (int)(difftime(time(0), bluetoothCrashTime));
-	if (seconds <= BLUETOOTH_TIMEOUT)
+	if (bluetoothCrashed)
 	{
-		Sleep(1000*(BLUETOOTH_TIMEOUT - seconds));
+		int64_t elapsedMs = clock->nowMs() - bluetoothCrashMs;
+		if (elapsedMs < 1000*BLUETOOTH_TIMEOUT)		clock->sleepMs((uint32_t)(1000*BLUETOOTH_TIMEOUT - elapsedMs));
 	}
 
     slip = new Slip(devAddr);
+    slip->setMetrics(&metrics);
+    slip->setClock(clock);
+    deviceAddr = devAddr;
 
     exiting = false;
     threadBusy = true;
@@ -131,52 +109,48 @@ DWORD DeviceUpdate::updateDeviceEntry(void *arg)
 */
 void DeviceUpdate::updateDevice(void)
 {
-    const uint8_t *filePtr = package;
-    const uint8_t *fileEnd = package + sizeof(package);
-    int timeoutMs = 30000;              // First packet may take long to respond if flash gets erased
-    int lastPercentNotif = 0;           // Last percentage notified to application
-	CString formattedErr;
-    
+    char label[METRICS_LABEL_LEN];
+
+    sprintf_s(label, sizeof(label), "%012llX", (unsigned long long)deviceAddr);
+    metrics.beginSession(label, CW2A(PACKAGEVERSION));
+    lastPercentNotif = 0;
+
     slip->open();           // Try to open comm channel. In case of error, it will be reported by the send function.
     if (exiting == false)   // The above function may be long to execute
     {
-        std::wstring errMsg;                // Error message to return to application. "" as long as everything goes well
-        int rxOffset;                       // Offset returned by the device for the next packet
+        std::wstring errMsg;                // Error message to return to application
+        UpdateSession session(slip, &metrics);
 
-        while ((filePtr < fileEnd) && (errMsg == L""))
+        int err = session.run(package, sizeof(package), progressEntry, this);
+        if (err == ERR_OK)
         {
-            // build request
-            int offset = (int)(filePtr-package);         // offset in file
-            int dataLen = ((int)(fileEnd-filePtr) < CMD_UPDREQ_MAXDATALEN) ? (int) (fileEnd-filePtr) : CMD_UPDREQ_MAXDATALEN;
+            errMsg = langGet(TXT_ERR_DONE);
+        }
+        else
+        {
+            CString formattedErr;
+            formattedErr.Format(L": %d", session.errDetail());
 
-            send(offset, filePtr, dataLen, &errMsg);
-            if (errMsg == L"")                          // if no error yet, wait for response
-            {
-                read(&rxOffset, &errMsg, timeoutMs);
-            }
-            if (errMsg == L"")                          // if no error yet
-            {
-                filePtr = package + rxOffset;
-				if (filePtr < fileEnd)		timeoutMs = 2000;           // All other packets should be answered very quickly
-				else                        timeoutMs = 30000;			// Last packet takes long because CRC is recomputed
+            if (err == ERR_INV_RESPCMD)         errMsg = langGet(TXT_ERR_INCOMPATIBLE) + formattedErr;  // Append command number to ease field troubleshooting
+            else if (err == ERR_INV_RESPLEN)    errMsg = langGet(TXT_ERR_INV_RESPLEN) + formattedErr;   // Append number of bytes received to ease field troubleshooting
+            else if (session.sendFailed())      errMsg = ErrTranslate(err, TXT_ERR_SENDFAIL);
+            else                                errMsg = ErrTranslate(err, TXT_ERR_RXFAIL);
 
-                int percent = (int)((filePtr - package) * 100 / sizeof(package));
-                if (percent != lastPercentNotif)
-                {
-                    lastPercentNotif = percent;
-					if (exiting == false)	notifFnct(notifCtx, lastPercentNotif, L"", false);  // Notify the application of the progress
-                }
+            if (err == ERR_SLIP_TIMEOUT)
+            {
+                bluetoothCrashed = true;
+                bluetoothCrashMs = clock->nowMs();
             }
+            slip->flightRecorder().dump(CW2A(errMsg.c_str()));     // keep the history of the failure
         }
+        metrics.endSession(err);
 
-        if (errMsg == L"")      // If no error during update, send an extra transaction with no data and offset=total length
-        {                       // to indicate the end of the transfer
-            send(sizeof(package), NULL, 0, &errMsg);
-            if (errMsg == L"")                          // if no error yet, wait for response
-            {
-                read(&rxOffset, &errMsg, timeoutMs);
-            }
-            if (errMsg == L"")      errMsg = langGet(TXT_ERR_DONE);     // if no error yet, use Done message
+        char metricsPath[MAX_PATH];
+        DWORD len = GetTempPathA(MAX_PATH, metricsPath);
+        if ((len > 0) && (len + sizeof(UPDATE_METRICS_FILE) <= MAX_PATH))
+        {
+            strcat_s(metricsPath, MAX_PATH, UPDATE_METRICS_FILE);
+            metrics.appendToFile(metricsPath, UPDATE_METRICS_MAX_BYTES);
         }
 
         // send the last notification
@@ -193,95 +167,23 @@ void DeviceUpdate::updateDevice(void)
 }
 
 /**
-* @brief send: Format the message and send it
+* @brief progressEntry: called by the update session after each acknowledged chunk
 *
-* @param offset:    offset in bytes from beginning of the package
-* @param dataPtr:   pointer to the data to transmit
-* @param dataLen:   number of bytes to include in the packet
-* @param retErrMsg: will be filled with an error message if any encountered
+* @param ctx:       An abstract pointer to this instance.
+* @param offset:    Number of bytes acknowledged by the device so far
+* @param total:     Length of the package
 * @return None.
 */
-void DeviceUpdate::send(int offset, const uint8_t *dataPtr, int dataLen, std::wstring *retErrMsg)
+void DeviceUpdate::progressEntry(void *ctx, int offset, int total)
 {
-    uint8_t tmpBuf[CMD_UPDREQ_MAXLEN];
-	CString formattedErr;
-
-    assert(dataLen <= CMD_UPDREQ_MAXDATALEN);
-    assert(retErrMsg != NULL);
-
-    tmpBuf[CHAN_OFF]            = CHAN_UPDATE;
-    tmpBuf[CMD_OFF]             = CMD_UPDREQ;
-    tmpBuf[CMD_UPDREQ_OFFSET+0] = (offset >> 24) & 0xFF;
-    tmpBuf[CMD_UPDREQ_OFFSET+1] = (offset >> 16) & 0xFF;
-    tmpBuf[CMD_UPDREQ_OFFSET+2] = (offset >>  8) & 0xFF;
-    tmpBuf[CMD_UPDREQ_OFFSET+3] = (offset >>  0) & 0xFF;
-    memcpy(&tmpBuf[CMD_UPDREQ_DATA], dataPtr, dataLen);
+    DeviceUpdate *pThis = static_cast<DeviceUpdate *>(ctx);
 
-    // send message
-    int err = slip->send(tmpBuf, CMD_UPDREQ_DATA+dataLen);
-	if (err != CMD_UPDREQ_DATA + dataLen)   *retErrMsg = ErrTranslate(err, TXT_ERR_SENDFAIL);
-}
-
-/**
-* @brief read: wait for and decode an update response message
-*
-*   it is possible that we receive a message from a wrong channel. We just discard it.
-*
-* @param retOffset:     to be filled with the offset returned by the device
-* @param retErrMsg:     to be filled with any error message encountered during the processing
-* @param timeoutMs:     max time to wait for an answer
-* @return None.
-*/
-void DeviceUpdate::read(int *retOffset, std::wstring *retErrMsg, int timeoutMs)
-{
-    int errCode = ERR_OK;
-    uint8_t tmpBuf[1024 * CMD_UPDRESP_LEN];            // Length is big to accept other channel data
-
-    assert(retErrMsg != NULL);
-    assert(*retErrMsg == L"");
-
-    DWORD entryTime = GetTickCount();
-    do
+    int percent = (int)((int64_t)offset * 100 / total);
+    if (percent != pThis->lastPercentNotif)
     {
-        int waitTime = timeoutMs - (GetTickCount() - entryTime);        // Max remaining time to wait for an answer.
-        if (waitTime < 0)       errCode = ERR_SLIP_TIMEOUT;
-        else
-        {
-            // wait response (returns number of bytes received in frame
-            int err = slip->read(tmpBuf, sizeof(tmpBuf), waitTime);
-            if (err == 0)       errCode = ERR_SLIP_TIMEOUT;             // if no byte received, it is a timeout condition
-            else if (err < 0)   errCode = err;
-            else
-            {
-                CString formattedErr;
-                CString formattedCmd;
-                formattedCmd.Format(L": %d", tmpBuf[CMD_OFF]);
-                formattedErr.Format(L": %d", err);
-                
-                if (tmpBuf[CHAN_OFF] != CHAN_UPDATE)    {}  // process only our channel, ignore others
-                else if (tmpBuf[CMD_OFF] != CMD_UPDRESP)            *retErrMsg = langGet(TXT_ERR_INCOMPATIBLE) + formattedCmd;  // Append command number to ease field troubleshooting
-                else if (err != CMD_UPDRESP_LEN)                    *retErrMsg = langGet(TXT_ERR_INV_RESPLEN) + formattedErr;   // Append number of bytes received to ease field troubleshooting
-                else if (tmpBuf[CMD_UPDRESP_ERR] != RESP_ERR_OK)    errCode = tmpBuf[CMD_UPDRESP_ERR];
-                else
-                {
-                    assert(retOffset != NULL);
-                    *retOffset = 0;
-                    *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+0]) << 24;
-                    *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+1]) << 16;
-                    *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+2]) <<  8;
-                    *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+3]) <<  0;
-                    break;                              // valid answer, exit loop
-                }
-            }
-        }
-    } while ((*retErrMsg == L"") && (errCode == ERR_OK));        // Break inside loop when the proper answer is received
-    
-    if (*retErrMsg == L"")      *retErrMsg = ErrTranslate(errCode, TXT_ERR_RXFAIL);
-
-	if (errCode == ERR_SLIP_TIMEOUT)
-	{
-		bluetoothCrashTime = time(0);
-	}
+        pThis->lastPercentNotif = percent;
+        if (pThis->exiting == false)    pThis->notifFnct(pThis->notifCtx, percent, L"", false);  // Notify the application of the progress
+    }
 }
 
 /**
@@ -4,8 +4,10 @@
 *
 *   In a nutshell, this class implements:
 *       - 1 thread that:
-*           - read the file and send it
+*           - read the file and send it (protocol implemented by UpdateSession)
 *       - A progress event is generated at every 1% of transfer done, and at the end.
+*       - The metrics of the session (connect time, round trip times, retries...) are
+*           appended to UPDATE_METRICS_FILE in the temp folder at the end of the transfer.
 *
 * Author: Luc Tremblay
 * Project: AMI
@@ -18,6 +20,7 @@
 #include <BluetoothAPIs.h>
 #include <string>
 #include "Slip.h"
+#include "ProtocolMetrics.h"
 
 /**
   * @brief Signature of function that will be called to indicate update progress
@@ -49,9 +52,10 @@ public:
     * @param devAddr:   MAC address of device to update
     * @param fnct:      function to execute to report new device discovery
     * @param ctx:       opaque context value for that function
+    * @param clock:     clock of the timeouts and of the Bluetooth recovery wait
     * @return None.
     */
-    DeviceUpdate(BTH_ADDR devAddr, DeviceUpdateNotif_t fnct, void *ctx);
+    DeviceUpdate(BTH_ADDR devAddr, DeviceUpdateNotif_t fnct, void *ctx, IClock *clock = systemClock());
 
     /**
     * @brief dtor: class destructor.
@@ -78,29 +82,14 @@ private:
     void updateDevice(void);
 
     /**
-    * @brief send: Format the message and send it
+    * @brief progressEntry: called by the update session after each acknowledged chunk
     *
-    * @param offset:    offset in bytes from beginning of the package
-    * @param dataPtr:   pointer to the data to transmit
-    * @param dataLen:   number of bytes to include in the packet
-    * @param retErrMsg: will be filled with an error message if any encountered
+    * @param ctx:       An abstract pointer to this instance.
+    * @param offset:    Number of bytes acknowledged by the device so far
+    * @param total:     Length of the package
     * @return None.
     */
-    void DeviceUpdate::send(int offset, const uint8_t *dataPtr, int dataLen, std::wstring *retErrMsg);
-
-    /**
-    * @brief read: wait for and decode an update response message
-    *
-    *   it is possible that we receive a message from a wrong channel. We just discard it.
-    *
-    * @param retOffset:     to be filled with the offset returned by the device
-    * @param retErrMsg:     to be filled with any error message encountered during the processing
-    * @param timeoutMs:     max time to wait for an answer
-    * @return None.
-    */
-    void read(int *retOffset, std::wstring *retErrMsg, int timeoutMs);
-
-
+    static void progressEntry(void *ctx, int offset, int total);
 
     DeviceUpdateNotif_t notifFnct;					// Function to execute to report progress
     void *notifCtx;									// Function context
@@ -108,6 +97,10 @@ private:
     volatile bool threadBusy;						// While true, the thread is still running
     volatile bool exiting;							// When true, the object is destroying
     Slip *slip;										// Slip instance to use
+    IClock *clock;									// Clock of the timeouts
+    ProtocolMetrics metrics;						// Metrics of the transfer
+    BTH_ADDR deviceAddr;							// Device MAC address (label of the metrics)
+    int lastPercentNotif;							// Last percentage notified to application
 };
 
 #endif // _DEVICEUPDATE_H
@@ -17,6 +17,7 @@
 #include "TT_AMI_UpdaterDlg.h"
 #include "lang.h"
 #include "ErrCodes.h"
+#include "TraceBuffer.h"
 
 // Definitions for the "P" SLIP channel messages
 // Generic command offsets
@@ -121,12 +122,15 @@ void DeviceUpgrade::upgradeDevice(void)
 		std::wstring errMsg;                // Error message to return to application. "" as long as everything goes well
 
 
+		TRACEPT(TRACEPT_UPG_KEY, sizeof(upgradeKey), 0);
 		send(0, filePtr, sizeof(upgradeKey), &errMsg);
 		if (errMsg == L"")                          // if no error yet, wait for response
 		{
 			read(&errMsg, timeoutMs);
 		}
+		TRACEPT(TRACEPT_UPG_KEY_END, (errMsg == L"") ? 0 : -1, 0);
         if (errMsg == L"")              errMsg = langGet(TXT_ERR_DONE);     // if no error, use Done message
+        else                            slip->flightRecorder().dump(CW2A(errMsg.c_str()));     // keep the history of the failure
 
 		// send the last notification
 		if (exiting == false)	notifFnct(notifCtx, errMsg.c_str());
@@ -182,10 +186,11 @@ void DeviceUpgrade::read(std::wstring *retErrMsg, int timeoutMs)
 	assert(retErrMsg != NULL);
 	assert(*retErrMsg == L"");
 
-	DWORD entryTime = GetTickCount();
+	IClock *clock = slip->getClock();
+	int64_t entryTime = clock->nowMs();
 	do
 	{
-		int waitTime = timeoutMs - (GetTickCount() - entryTime);        // Max remaining time to wait for an answer.
+		int waitTime = timeoutMs - (int)(clock->nowMs() - entryTime);   // Max remaining time to wait for an answer.
 		if (waitTime < 0)       errCode = ERR_SLIP_TIMEOUT;
 		else
 		{
@@ -28,6 +28,10 @@ std::wstring ErrTranslate(int errCode, LPCTSTR basicMsg)
         case ERR_SLIP_TIMEOUT:      retStr = langGet(TXT_ERR_NOANSWER);         break;
         case ERR_SLIP_BUFSHORT:     retStr = langGet(TXT_ERR_INV_RESPLEN);      break;  // Slip frame too big for command sent
         case ERR_INV_RESPLEN:       retStr = langGet(TXT_ERR_INV_RESPLEN);      break;  // frame received does not match expected length
+        case ERR_INV_RESPCMD:       retStr = langGet(TXT_ERR_INCOMPATIBLE);     break;  // device answered with an unknown command
+        case ERR_INV_RESPONSE:      retStr = langGet(TXT_ERR_RXFAIL);           break;  // JSON answer without the expected fields
+        case ERR_DOWNLOAD_LOST:     retStr = langGet(TXT_ERR_RXFAIL);           break;  // batches lost despite the retries
+        case ERR_UPLOAD_REJECTED:   retStr = langGet(TXT_ERR_RXFAIL);           break;  // batches refused despite the retries
 
         // Windows errors are negated to have negative values for error conditions
         case -WSAETIMEDOUT:         retStr = langGet(TXT_ERR_CONNECTFAIL);      break;  // Error obtained while trying to connect
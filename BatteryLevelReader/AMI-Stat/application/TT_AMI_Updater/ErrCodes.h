@@ -17,7 +17,16 @@
 #define ERR_SLIP_TIMEOUT        -3  // No full frame received within allocated time
 #define ERR_SLIP_BUFSHORT       -4  // Buffer provided is too short to hold a complete SLIP frame
 #define ERR_INV_RESPLEN         -5  // Invalid response length
+#define ERR_INV_RESPCMD         -6  // Invalid response command on the update channel
+#define ERR_INV_RESPONSE        -7  // Response does not hold the expected fields
+#define ERR_DOWNLOAD_LOST       -8  // Batches of a stored session still missing after the retries
+#define ERR_SDK_CALL            -9  // A call to the AMI SDK failed
+#define ERR_FILE_WRITE          -10 // A file could not be written
+#define ERR_FILE_READ           -11 // A file could not be read
+#define ERR_FILE_FORMAT         -12 // A file, or the data given for it, does not match the expected format
+#define ERR_UPLOAD_REJECTED     -13 // A batch of a file uploaded still refused by the device after the retries
 
+#ifdef _WIN32
 /**
 * @brief ErrTranslate: convert an error code into a printable text
 *
@@ -26,5 +35,6 @@
 * @return The associated string to display to user
 */
 std::wstring ErrTranslate(int errCode, LPCTSTR basicMsg);
+#endif
 
 #endif // _ERR_CODES_H
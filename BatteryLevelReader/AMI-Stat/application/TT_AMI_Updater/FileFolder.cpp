@@ -0,0 +1,81 @@
+/*
+* FileFolder.cpp : This file contains the checks and the creation of the folders the tools read
+*               from and write to.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <errno.h>
+#include <sys/stat.h>
+#include <string>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include "FileFolder.h"
+#include "ErrCodes.h"
+
+static bool isSeparator(char c)
+{
+    return (c == '/') || (c == '\\');
+}
+
+/**
+* @brief makeFolder: create one folder (its parent exists)
+*
+* @return 0, -1 on error (errno set)
+*/
+static int makeFolder(const char *path)
+{
+#ifdef _WIN32
+    return _mkdir(path);
+#else
+    return mkdir(path, 0777);
+#endif
+}
+
+bool folderExists(const char *path)
+{
+#ifdef _WIN32
+    struct _stat st;
+    if (_stat(path, &st) != 0)      return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)       return false;
+#endif
+    if ((st.st_mode & S_IFMT) == S_IFDIR)   return true;
+    errno = ENOTDIR;
+    return false;
+}
+
+int folderCreate(const char *path)
+{
+    std::string folder(path);
+
+    while ((folder.size() > 1) && isSeparator(folder[folder.size() - 1]))     folder.erase(folder.size() - 1);
+    if (folder.empty() || folderExists(folder.c_str()))     return ERR_OK;
+
+    // the folders above first, from the top: each step only creates what is missing
+    for (size_t pos = 1; pos <= folder.size(); pos++)
+    {
+        if ((pos < folder.size()) && (isSeparator(folder[pos]) == false))      continue;
+        if ((pos < folder.size()) && (folder[pos - 1] == ':'))                  continue;     // drive ("C:\")
+
+        std::string step = folder.substr(0, pos);
+        if (folderExists(step.c_str()))     continue;
+        if ((makeFolder(step.c_str()) != 0) && ((errno != EEXIST) || (folderExists(step.c_str()) == false)))
+        {
+            return ERR_FILE_WRITE;
+        }
+    }
+    return ERR_OK;
+}
+
+int folderCreateFor(const char *filePath)
+{
+    std::string path(filePath);
+    size_t end = path.size();
+
+    while ((end > 0) && (isSeparator(path[end - 1]) == false))      end--;
+    if (end == 0)       return ERR_OK;                  // current folder
+    return folderCreate(path.substr(0, end).c_str());
+}
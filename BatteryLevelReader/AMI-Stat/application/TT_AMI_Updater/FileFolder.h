@@ -0,0 +1,43 @@
+/*
+* FileFolder.h : This file contains the checks and the creation of the folders the tools read
+*               from and write to.
+*
+*   In a nutshell, this file implements:
+*       - folderExists: the folder is there (else errno tells why)
+*       - folderCreate: the folder and the folders above it that are missing are created
+*       - folderCreateFor: same for the folder of a file about to be written
+*
+*   On failure errno is left as set by the system call that failed, so that the caller reports
+*   the path with the real cause (strerror). '/' and '\' are both separators.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _FILEFOLDER_H
+#define _FILEFOLDER_H
+
+/**
+* @brief folderExists: check that a folder exists
+*
+* @param path:      folder
+* @return true if it exists, false otherwise (errno: ENOENT, ENOTDIR...)
+*/
+bool folderExists(const char *path);
+
+/**
+* @brief folderCreate: create a folder, and the folders above it that are missing
+*
+* @param path:      folder
+* @return ERR_OK (also when it already exists), ERR_FILE_WRITE (errno tells why)
+*/
+int folderCreate(const char *path);
+
+/**
+* @brief folderCreateFor: create the folder of a file (see folderCreate)
+*
+* @param filePath:  file
+* @return ERR_OK, ERR_FILE_WRITE (errno tells why)
+*/
+int folderCreateFor(const char *filePath);
+
+#endif // _FILEFOLDER_H
@@ -0,0 +1,270 @@
+/*
+* FileUpload.cpp : This file contains the class uploading files to a device (assets, custom
+*               stimulation programs, images) on the upload channel.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "FileUpload.h"
+#include "ErrCodes.h"
+
+#define UPLOAD_PART_EXT         ".part"     // Extension of the manifest being written
+
+/**
+* @brief uploadChecksum: checksum of a file given to the device, 32 bit sum of the bytes
+*
+* @param data:      content
+* @param len:       number of bytes
+* @return The checksum
+*/
+uint32_t uploadChecksum(const uint8_t *data, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++)    sum += data[i];
+    return sum;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param target:    device receiving the files
+* @param window:    number of batches in flight (1: one at a time)
+* @param clock:     clock of the durations
+* @return None.
+*/
+FileUploader::FileUploader(IUploadTarget *_target, unsigned _window, IClock *_clock)
+: target(_target)
+, window(_window)
+, clock(_clock)
+, batchBytes(UPLOAD_BATCH_BYTES)
+, force(false)
+, content(NULL)
+, contentLen(0)
+, batchLen(0)
+, batchCount(0)
+, fileId(0)
+, nextBatch(0)
+, aborted(false)
+, error(ERR_OK)
+, accepted(0)
+, retried(0)
+, sentBytes(0)
+{
+    if (window == 0)                    window = 1;
+    if (window > UPLOAD_MAX_WINDOW)     window = UPLOAD_MAX_WINDOW;
+}
+
+/**
+* @brief loadManifest: read the manifest of the files the device holds (a missing file gives
+*           an empty manifest)
+*
+* @param path:      manifest file
+* @return ERR_OK, ERR_FILE_READ
+*/
+int FileUploader::loadManifest(const char *path)
+{
+    manifest.clear();
+    FILE *file = fopen(path, "r");
+    if (file == NULL)       return ERR_OK;
+
+    char line[UPLOAD_NAME_MAX + 64];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        ManifestEntry entry;
+        unsigned id;
+        int nameAt = 0;
+        if (sscanf(line, "%x %u %u %n", &entry.cs, &entry.size, &id, &nameAt) < 3)    continue;
+
+        std::string name(line + nameAt);
+        while ((name.empty() == false) && ((name.back() == '\n') || (name.back() == '\r')))   name.pop_back();
+        if ((name.empty() == false) && (id <= 0xFF))     manifest[std::make_pair((uint8_t)id, name)] = entry;
+    }
+    bool readOk = (ferror(file) == 0);
+    fclose(file);
+    return readOk ? ERR_OK : ERR_FILE_READ;
+}
+
+/**
+* @brief saveManifest: write the manifest
+*
+* @param path:      manifest file
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int FileUploader::saveManifest(const char *path)
+{
+    std::string tmpPath = std::string(path) + UPLOAD_PART_EXT;
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    bool ok = true;
+    for (std::map<std::pair<uint8_t, std::string>, ManifestEntry>::const_iterator it = manifest.begin(); ok && (it != manifest.end()); ++it)
+    {
+        ok = (fprintf(file, "%08x %u %u %s\n", it->second.cs, it->second.size, it->first.first, it->first.second.c_str()) > 0);
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (ok)
+    {
+        remove(path);
+        ok = (rename(tmpPath.c_str(), path) == 0);
+    }
+    if (ok == false)
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief upload: upload one file, unless the device already holds it. The file is read whole:
+*           its checksum is given to the device before the first batch.
+*
+* @param path:      file to upload
+* @param id:        file ID
+* @param name:      name of the file on the device (NULL: name of the file in path)
+* @param stats:     statistics, updated
+* @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT (too large, or name too long),
+*           ERR_UPLOAD_REJECTED (batch still refused after the retries), or the error of the target
+*/
+int FileUploader::upload(const char *path, uint8_t id, const char *name, UploadStats *stats)
+{
+    int64_t startMs = clock->nowMs();
+
+    if (name == NULL)
+    {
+        const char *slash = std::max(strrchr(path, '/'), strrchr(path, '\\'));
+        name = (slash != NULL) ? slash + 1 : path;
+    }
+    if ((name[0] == 0) || (strlen(name) >= UPLOAD_NAME_MAX) || (strchr(name, '\n') != NULL))
+    {
+        stats->failed++;
+        return ERR_FILE_FORMAT;
+    }
+
+    std::vector<uint8_t> data;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        stats->failed++;
+        return ERR_FILE_READ;
+    }
+    uint8_t block[64 * 1024];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), file)) > 0)     data.insert(data.end(), block, block + n);
+    bool readOk = (ferror(file) == 0);
+    fclose(file);
+
+    // the batch grows when the file would need more batches than the device counts
+    uint32_t len = batchBytes;
+    if ((uint64_t)len * UPLOAD_BATCHES_MAX < data.size())      len = (uint32_t)((data.size() + UPLOAD_BATCHES_MAX - 1) / UPLOAD_BATCHES_MAX);
+    if ((readOk == false) || (len > UPLOAD_BATCH_MAX))
+    {
+        stats->failed++;
+        return (readOk == false) ? ERR_FILE_READ : ERR_FILE_FORMAT;
+    }
+
+    uint32_t cs = uploadChecksum(data.data(), data.size());
+    std::pair<uint8_t, std::string> key(id, name);
+    std::map<std::pair<uint8_t, std::string>, ManifestEntry>::const_iterator known = manifest.find(key);
+    if ((force == false) && (known != manifest.end()) && (known->second.cs == cs) && (known->second.size == data.size()))
+    {
+        stats->unchanged++;
+        stats->durationMs += clock->nowMs() - startMs;
+        return ERR_OK;
+    }
+
+    content = data.data();
+    contentLen = (uint32_t)data.size();
+    batchLen = (uint16_t)len;
+    batchCount = (uint16_t)((contentLen + len - 1) / len);
+    fileId = id;
+    int err = target->start(id, name, contentLen, batchCount, cs);
+    bool started = (err == ERR_OK);
+    if (started)
+    {
+        nextBatch = 0;
+        aborted = false;
+        error = ERR_OK;
+        accepted = 0;
+        retried = 0;
+        sentBytes = 0;
+
+        std::vector<std::thread> senders;
+        unsigned count = std::min(window, (unsigned)batchCount);
+        for (unsigned s = 0; s < count; s++)    senders.push_back(std::thread(senderEntry, this));
+        for (size_t s = 0; s < senders.size(); s++)     senders[s].join();
+
+        err = error;
+        stats->bytes += sentBytes;
+        stats->batches += accepted;
+        stats->retries += retried;
+        if (err != ERR_OK)      target->cancel(id);
+    }
+    content = NULL;
+
+    // the device no longer holds the previous content once the upload started
+    if (started)    manifest.erase(key);
+    if (err == ERR_OK)
+    {
+        ManifestEntry entry = { cs, contentLen };
+        manifest[key] = entry;
+        stats->files++;
+    }
+    else
+    {
+        stats->failed++;
+    }
+    stats->durationMs += clock->nowMs() - startMs;
+    return err;
+}
+
+/**
+* @brief senderEntry: sender thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void FileUploader::senderEntry(FileUploader *self)
+{
+    self->senderFunc();
+}
+
+/**
+* @brief senderFunc: send batches until none is left or one fails: each batch is sent again at
+*           once when refused, the other senders keep the pipeline full meanwhile
+*
+* @return None.
+*/
+void FileUploader::senderFunc(void)
+{
+    uint32_t batch;
+
+    while ((aborted == false) && ((batch = nextBatch++) < batchCount))
+    {
+        uint32_t offset = batch * batchLen;
+        uint16_t len = (uint16_t)std::min((uint32_t)batchLen, contentLen - offset);
+        int err = ERR_OK;
+
+        for (int attempt = 0; attempt <= UPLOAD_BATCH_RETRIES; attempt++)
+        {
+            uint8_t refused = 0;
+            if (attempt > 0)    retried++;
+            sentBytes += len;
+            err = target->writeBatch(fileId, (uint16_t)batch, content + offset, len, &refused);
+            if ((err == ERR_OK) && (refused != 0))  err = ERR_UPLOAD_REJECTED;
+            if (err == ERR_OK)                      break;
+        }
+        if (err != ERR_OK)
+        {
+            int none = ERR_OK;
+            error.compare_exchange_strong(none, err);
+            aborted = true;
+            return;
+        }
+        accepted++;
+    }
+}
@@ -0,0 +1,188 @@
+/*
+* FileUpload.h : This file contains the class uploading files to a device (assets, custom
+*               stimulation programs, images) on the upload channel.
+*
+*   In a nutshell, this class implements:
+*       - the cut of a file in batches (UPLOAD_BATCH_BYTES by default, larger when the file would
+*           need more than UPLOAD_BATCHES_MAX batches) and its checksum, given to the device when
+*           the upload starts
+*       - the pipelining of the batches: up to "window" batches are in flight at once, each sent
+*           by its own thread as soon as the previous one it sent is acknowledged, so that the
+*           round trip of a batch overlaps the transfer of the others (window 1: one batch at a
+*           time, in order)
+*       - the retry of a batch refused by the device, or whose call failed, up to
+*           UPLOAD_BATCH_RETRIES times; a batch still refused cancels the upload of the file
+*       - the manifest of the files the device holds (checksum and size of each file uploaded,
+*           per file ID and name): a file whose checksum and size did not change is not sent again
+*       - the statistics of the uploads (files, bytes, batches, retries, duration)
+*
+*   The device is reached through IUploadTarget: the AMI SDK in the tools (SdkUpload), a
+*   simulated device otherwise.
+*
+*   Manifest: one line per file, "<checksum hex> <size> <ID> <name>", written under a temporary
+*   name and renamed once complete.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _FILEUPLOAD_H
+#define _FILEUPLOAD_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "DeadlineClock.h"
+
+#define UPLOAD_BATCH_BYTES      1024        // Default size of a batch
+#define UPLOAD_BATCH_MAX        0xFFFF      // Largest batch (TTL_UINT16 size)
+#define UPLOAD_BATCHES_MAX      0xFFFF      // Max number of batches of a file (TTL_UINT16 batchCount)
+#define UPLOAD_BATCH_RETRIES    3           // Max number of times a batch is sent again
+#define UPLOAD_WINDOW           4           // Default number of batches in flight
+#define UPLOAD_MAX_WINDOW       32          // Max number of batches in flight
+#define UPLOAD_NAME_MAX         64          // Max length of the name of a file on the device
+
+class IUploadTarget
+{
+public:
+    virtual ~IUploadTarget() {}
+
+    /**
+    * @brief label: name of the device, used in the messages and the manifest
+    */
+    virtual const char *label(void) = 0;
+
+    /**
+    * @brief start: announce the upload of a file (AMI_UploadFileStart)
+    *
+    * @param id:        file ID (kind of file)
+    * @param name:      name of the file on the device
+    * @param size:      size in bytes
+    * @param batchCount: number of batches
+    * @param cs:        checksum of the file (uploadChecksum())
+    * @return ERR_OK or an error
+    */
+    virtual int start(uint8_t id, const char *name, uint32_t size, uint16_t batchCount, uint32_t cs) = 0;
+
+    /**
+    * @brief writeBatch: send a batch and wait for its acknowledge (AMI_UploadFileWriteBatch).
+    *           Called by many threads at once, one batch each.
+    *
+    * @param id:        file ID
+    * @param batch:     batch number, from 0
+    * @param data:      content of the batch
+    * @param len:       number of bytes
+    * @param refused:   receives the error code of the device for that batch (0: accepted)
+    * @return ERR_OK (the device answered) or an error
+    */
+    virtual int writeBatch(uint8_t id, uint16_t batch, const uint8_t *data, uint16_t len, uint8_t *refused) = 0;
+
+    /**
+    * @brief cancel: abort the upload of a file (AMI_UploadFileCancel)
+    *
+    * @return ERR_OK or an error
+    */
+    virtual int cancel(uint8_t id) = 0;
+};
+
+/**
+* @brief uploadChecksum: checksum of a file given to the device, 32 bit sum of the bytes
+*
+* @param data:      content
+* @param len:       number of bytes
+* @return The checksum
+*/
+uint32_t uploadChecksum(const uint8_t *data, size_t len);
+
+typedef struct
+{
+    uint32_t files;             // Files uploaded
+    uint32_t unchanged;         // Files not sent: the device holds them (manifest)
+    uint32_t failed;            // Files given up
+    uint64_t bytes;             // Bytes sent (retries included)
+    uint32_t batches;           // Batches accepted
+    uint32_t retries;           // Batches sent again
+    int64_t durationMs;         // Duration of the uploads
+} UploadStats;
+
+
+class FileUploader
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param target:    device receiving the files
+    * @param window:    number of batches in flight (1: one at a time)
+    * @param clock:     clock of the durations
+    * @return None.
+    */
+    FileUploader(IUploadTarget *target, unsigned window = UPLOAD_WINDOW, IClock *clock = systemClock());
+
+    void setBatchBytes(uint16_t bytes)                                  { batchBytes = (bytes > 0) ? bytes : UPLOAD_BATCH_BYTES; }
+    void setForce(bool all)                                             { force = all; }
+    unsigned windowSize(void)                                           { return window; }
+
+    /**
+    * @brief loadManifest: read the manifest of the files the device holds (a missing file gives
+    *           an empty manifest)
+    *
+    * @param path:      manifest file
+    * @return ERR_OK, ERR_FILE_READ
+    */
+    int loadManifest(const char *path);
+
+    /**
+    * @brief saveManifest: write the manifest
+    *
+    * @param path:      manifest file
+    * @return ERR_OK, ERR_FILE_WRITE
+    */
+    int saveManifest(const char *path);
+
+    /**
+    * @brief upload: upload one file, unless the device already holds it
+    *
+    * @param path:      file to upload
+    * @param id:        file ID
+    * @param name:      name of the file on the device (NULL: name of the file in path)
+    * @param stats:     statistics, updated
+    * @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT (too large, or name too long),
+    *           ERR_UPLOAD_REJECTED (batch still refused after the retries), or the error of the target
+    */
+    int upload(const char *path, uint8_t id, const char *name, UploadStats *stats);
+
+private:
+    typedef struct
+    {
+        uint32_t cs;            // Checksum
+        uint32_t size;          // Size in bytes
+    } ManifestEntry;
+
+    static void senderEntry(FileUploader *self);
+    void senderFunc(void);
+
+    IUploadTarget *target;              // Device receiving the files
+    unsigned window;                    // Number of batches in flight
+    IClock *clock;                      // Clock of the durations
+    uint16_t batchBytes;                // Size of the batches
+    bool force;                         // Send the files the device holds too
+    std::map<std::pair<uint8_t, std::string>, ManifestEntry> manifest;   // Files the device holds, per ID and name
+
+    // file being uploaded, read only for the senders
+    const uint8_t *content;             // Content of the file
+    uint32_t contentLen;                // Its size
+    uint16_t batchLen;                  // Size of its batches
+    uint16_t batchCount;                // Number of batches
+    uint8_t fileId;                     // File ID
+
+    std::atomic<uint32_t> nextBatch;    // Next batch to send
+    std::atomic<bool> aborted;          // A batch failed: the senders stop
+    std::atomic<int> error;             // Error of the failed batch
+    std::atomic<uint32_t> accepted;     // Batches accepted
+    std::atomic<uint32_t> retried;      // Batches sent again
+    std::atomic<uint64_t> sentBytes;    // Bytes sent
+};
+
+#endif // _FILEUPLOAD_H
@@ -0,0 +1,414 @@
+/*
+* FleetInventory.cpp : This file contains the collection of the inventory of a fleet of devices
+*               (identification, versions, battery, session memory, error log, last self-test)
+*               and the snapshot it gives.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "FleetInventory.h"
+#include "ErrCodes.h"
+
+#define INVENTORY_PART_EXT      ".part"     // Extension of the files being written
+
+/**
+* @brief ctor: class constructor
+*
+* @param parallel:  number of devices queried at once
+* @param depth:     number of commands in flight per device (1: one at a time)
+* @param clock:     clock of the durations
+* @return None.
+*/
+FleetInventory::FleetInventory(unsigned _parallel, unsigned _depth, IClock *_clock)
+: parallel(_parallel)
+, depth(_depth)
+, clock(_clock)
+, devices(NULL)
+, records(NULL)
+, nextDevice(0)
+{
+    if (parallel == 0)                      parallel = 1;
+    if (parallel > INVENTORY_MAX_PARALLEL)  parallel = INVENTORY_MAX_PARALLEL;
+    if (depth == 0)                         depth = 1;
+    if (depth > INVENTORY_MAX_DEPTH)        depth = INVENTORY_MAX_DEPTH;
+}
+
+/**
+* @brief collect: query every device
+*
+* @param devices:   devices
+* @param records:   receives one record per device, in the same order
+* @return Duration of the collection (ms)
+*/
+int64_t FleetInventory::collect(const std::vector<IInventoryDevice *> &_devices, std::vector<InventoryRecord> *_records)
+{
+    int64_t startMs = clock->nowMs();
+
+    devices = &_devices;
+    records = _records;
+    records->assign(devices->size(), InventoryRecord());
+    nextDevice = 0;
+
+    std::vector<std::thread> workers;
+    unsigned count = (unsigned)std::min((size_t)parallel, devices->size());
+    for (unsigned w = 0; w < count; w++)        workers.push_back(std::thread(workerEntry, this));
+    for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+
+    devices = NULL;
+    records = NULL;
+    return clock->nowMs() - startMs;
+}
+
+/**
+* @brief workerEntry: worker thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void FleetInventory::workerEntry(FleetInventory *self)
+{
+    self->workerFunc();
+}
+
+/**
+* @brief workerFunc: query devices until none is left: connect, run the commands of the items
+*           with "depth" of them in flight (this thread and depth - 1 helpers), disconnect
+*
+* @return None.
+*/
+void FleetInventory::workerFunc(void)
+{
+    size_t index;
+
+    while ((index = nextDevice++) < devices->size())
+    {
+        IInventoryDevice *device = (*devices)[index];
+        InventoryRecord *record = &(*records)[index];
+        int64_t startMs = clock->nowMs();
+
+        memset(record, 0, sizeof(*record));
+        strncpy(record->label, device->label(), sizeof(record->label) - 1);
+        int err = device->open();
+        if (err == ERR_OK)
+        {
+            DeviceJob job;
+            job.device = device;
+            job.record = record;
+            job.nextItem = 0;
+            job.collected = 0;
+            job.err = ERR_OK;
+
+            std::vector<std::thread> helpers;
+            for (unsigned h = 1; h < std::min(depth, (unsigned)INVENTORY_ITEMS); h++)  helpers.push_back(std::thread(commandEntry, &job));
+            commandEntry(&job);
+            for (size_t h = 0; h < helpers.size(); h++)     helpers[h].join();
+            device->close();
+
+            record->items = (uint16_t)job.collected;
+            err = job.err;
+        }
+        record->err = err;
+        record->collectMs = (uint32_t)(clock->nowMs() - startMs);
+    }
+}
+
+/**
+* @brief commandEntry: run the commands of the items of a device until none is left
+*
+* @param job:       device
+* @return None.
+*/
+void FleetInventory::commandEntry(DeviceJob *job)
+{
+    uint32_t item;
+
+    while ((item = job->nextItem++) < INVENTORY_ITEMS)
+    {
+        int err = job->device->query(1u << item, job->record);
+        if (err == ERR_OK)
+        {
+            job->collected |= (1u << item);
+        }
+        else
+        {
+            int none = ERR_OK;
+            job->err.compare_exchange_strong(none, err);
+        }
+    }
+}
+
+/**
+* @brief jsonString: write a string of a device as a JSON string
+*
+* @return None.
+*/
+static void jsonString(FILE *file, const char *text, size_t size)
+{
+    fputc('"', file);
+    for (size_t i = 0; (i < size) && (text[i] != 0); i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if ((c == '"') || (c == '\\'))  fprintf(file, "\\%c", c);
+        else if (c < 0x20)              fprintf(file, "\\u%04x", c);
+        else                            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+/**
+* @brief finishFile: close a file written under its temporary name, rename it
+*
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+static int finishFile(FILE *file, bool ok, const std::string &tmpPath, const char *path)
+{
+    ok = (fclose(file) == 0) && ok;
+    if (ok)
+    {
+        remove(path);
+        ok = (rename(tmpPath.c_str(), path) == 0);
+    }
+    if (ok == false)
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief inventorySaveJson: write a snapshot as a JSON document. The fields of an item not
+*           collected are left out.
+*
+* @param path:      file
+* @param records:   records
+* @param takenAt:   time of the snapshot, seconds since the epoch
+* @param collectMs: duration of the collection
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int inventorySaveJson(const char *path, const std::vector<InventoryRecord> &records, int64_t takenAt, int64_t collectMs)
+{
+    std::string tmpPath = std::string(path) + INVENTORY_PART_EXT;
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    fprintf(file, "{\"takenAt\":%lld,\"collectMs\":%lld,\"devices\":[", (long long)takenAt, (long long)collectMs);
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const InventoryRecord &r = records[i];
+        fprintf(file, "%s\n{\"label\":", (i > 0) ? "," : "");
+        jsonString(file, r.label, sizeof(r.label));
+        fprintf(file, ",\"error\":%d,\"collectMs\":%u", r.err, r.collectMs);
+        if (r.items & INVENTORY_INFO)
+        {
+            fprintf(file, ",\"productNumber\":");
+            jsonString(file, r.productNumber, sizeof(r.productNumber));
+            fprintf(file, ",\"serialNumber\":");
+            jsonString(file, r.serialNumber, sizeof(r.serialNumber));
+            fprintf(file, ",\"productType\":%u,\"hardwareConfig\":%u,\"firmwareVersion\":", r.productType, r.hardwareConfig);
+            jsonString(file, r.firmwareVersion, sizeof(r.firmwareVersion));
+            fprintf(file, ",\"subMcuVersion\":");
+            jsonString(file, r.subMcuVersion, sizeof(r.subMcuVersion));
+            fprintf(file, ",\"hardwareVersion\":");
+            jsonString(file, r.hardwareVersion, sizeof(r.hardwareVersion));
+        }
+        if (r.items & INVENTORY_BATTERY)
+        {
+            fprintf(file, ",\"battery\":{\"soc\":%u,\"voltage\":%u,\"charging\":%s}", r.soc, r.voltage, r.charging ? "true" : "false");
+        }
+        if (r.items & INVENTORY_MEMORY)
+        {
+            fprintf(file, ",\"memory\":{\"storageSize\":%u,\"freeSpace\":%u,\"sessions\":%u}", r.storageSize, r.freeSpace, r.sessionCount);
+        }
+        if (r.items & INVENTORY_ERROR_LOG)
+        {
+            fprintf(file, ",\"errorLog\":[");
+            for (int e = 0; e < INVENTORY_ERROR_TYPES; e++)     fprintf(file, "%s%u", (e > 0) ? "," : "", r.errorLog[e]);
+            fprintf(file, "]");
+        }
+        if (r.items & INVENTORY_SELFTEST)
+        {
+            fprintf(file, ",\"lastSelftest\":");
+            jsonString(file, r.selftestDate, sizeof(r.selftestDate));
+        }
+        fprintf(file, "}");
+    }
+    bool ok = (fprintf(file, "\n]}\n") > 0) && (ferror(file) == 0);
+    return finishFile(file, ok, tmpPath, path);
+}
+
+/**
+* @brief serialLess: order of the records in the binary snapshot: serial number, then label
+*/
+static bool serialLess(const InventoryRecord &a, const InventoryRecord &b)
+{
+    int c = strncmp(a.serialNumber, b.serialNumber, sizeof(a.serialNumber));
+    return (c != 0) ? (c < 0) : (strncmp(a.label, b.label, sizeof(a.label)) < 0);
+}
+
+/**
+* @brief inventorySaveIndex: write a snapshot as an indexed binary file
+*
+* @param path:      file
+* @param records:   records
+* @param takenAt:   time of the snapshot, seconds since the epoch
+* @param collectMs: duration of the collection
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int inventorySaveIndex(const char *path, const std::vector<InventoryRecord> &records, int64_t takenAt, int64_t collectMs)
+{
+    std::vector<InventoryRecord> sorted(records);
+    std::sort(sorted.begin(), sorted.end(), serialLess);
+
+    // stable: the records of the same firmware stay sorted by serial number
+    std::vector<uint32_t> byFirmware(sorted.size());
+    for (uint32_t i = 0; i < byFirmware.size(); i++)   byFirmware[i] = i;
+    std::stable_sort(byFirmware.begin(), byFirmware.end(), [&sorted](uint32_t a, uint32_t b) {
+        return strncmp(sorted[a].firmwareVersion, sorted[b].firmwareVersion, INVENTORY_TEXT_MAX) < 0; });
+
+    std::string tmpPath = std::string(path) + INVENTORY_PART_EXT;
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    InventoryFileHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, INVENTORY_MAGIC, sizeof(fh.magic));
+    fh.recordSize = sizeof(InventoryRecord);
+    fh.count = (uint32_t)sorted.size();
+    fh.takenAt = takenAt;
+    fh.collectMs = (uint32_t)collectMs;
+
+    bool ok = (fwrite(&fh, sizeof(fh), 1, file) == 1);
+    if (ok && (sorted.empty() == false))
+    {
+        ok = (fwrite(sorted.data(), sizeof(InventoryRecord), sorted.size(), file) == sorted.size()) &&
+             (fwrite(byFirmware.data(), sizeof(uint32_t), byFirmware.size(), file) == byFirmware.size());
+    }
+    return finishFile(file, ok, tmpPath, path);
+}
+
+/**
+* @brief load: read a binary snapshot
+*
+* @param path:      file
+* @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT
+*/
+int InventorySnapshot::load(const char *path)
+{
+    records.clear();
+    byFirmware.clear();
+    takenAt = 0;
+    collectMs = 0;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)       return ERR_FILE_READ;
+
+    InventoryFileHeader fh;
+    int err = ERR_OK;
+    if ((fread(&fh, sizeof(fh), 1, file) != 1) || (memcmp(fh.magic, INVENTORY_MAGIC, sizeof(fh.magic)) != 0) ||
+        (fh.recordSize != sizeof(InventoryRecord)))
+    {
+        err = ERR_FILE_FORMAT;
+    }
+    else
+    {
+        records.resize(fh.count);
+        byFirmware.resize(fh.count);
+        if ((fh.count > 0) && ((fread(records.data(), sizeof(InventoryRecord), fh.count, file) != fh.count) ||
+                               (fread(byFirmware.data(), sizeof(uint32_t), fh.count, file) != fh.count)))
+        {
+            err = ERR_FILE_FORMAT;
+        }
+        for (size_t i = 0; (err == ERR_OK) && (i < byFirmware.size()); i++)
+        {
+            if (byFirmware[i] >= fh.count)  err = ERR_FILE_FORMAT;
+        }
+    }
+    fclose(file);
+    if (err != ERR_OK)
+    {
+        records.clear();
+        byFirmware.clear();
+        return err;
+    }
+
+    // the strings are used as C strings: terminated whatever the file holds
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        InventoryRecord &r = records[i];
+        r.label[sizeof(r.label) - 1] = 0;
+        r.productNumber[sizeof(r.productNumber) - 1] = 0;
+        r.serialNumber[sizeof(r.serialNumber) - 1] = 0;
+        r.firmwareVersion[sizeof(r.firmwareVersion) - 1] = 0;
+        r.subMcuVersion[sizeof(r.subMcuVersion) - 1] = 0;
+        r.hardwareVersion[sizeof(r.hardwareVersion) - 1] = 0;
+        r.selftestDate[sizeof(r.selftestDate) - 1] = 0;
+    }
+    takenAt = fh.takenAt;
+    collectMs = fh.collectMs;
+    return ERR_OK;
+}
+
+/**
+* @brief find: record of a serial number
+*
+* @param serial:    serial number
+* @return The record, NULL if none
+*/
+const InventoryRecord *InventorySnapshot::find(const char *serial) const
+{
+    std::vector<InventoryRecord>::const_iterator it = std::lower_bound(records.begin(), records.end(), serial,
+        [](const InventoryRecord &r, const char *s) { return strcmp(r.serialNumber, s) < 0; });
+    if ((it == records.end()) || (strcmp(it->serialNumber, serial) != 0))     return NULL;
+    return &*it;
+}
+
+/**
+* @brief select: records matching every criterion given, sorted by serial number (by firmware
+*           version then serial number when the firmware is given). The serial number and the
+*           firmware version are found by their indexes, the other criteria checked on them.
+*
+* @param q:         criteria
+* @param result:    receives the records (valid until the next load)
+* @return Number of records
+*/
+size_t InventorySnapshot::select(const InventoryQuery &q, std::vector<const InventoryRecord *> *result) const
+{
+    std::vector<const InventoryRecord *> candidates;
+
+    result->clear();
+    if (q.serial != NULL)
+    {
+        const InventoryRecord *r = find(q.serial);
+        if (r != NULL)      candidates.push_back(r);
+    }
+    else if (q.firmware != NULL)
+    {
+        std::vector<uint32_t>::const_iterator first = std::lower_bound(byFirmware.begin(), byFirmware.end(), q.firmware,
+            [this](uint32_t i, const char *v) { return strcmp(records[i].firmwareVersion, v) < 0; });
+        for (std::vector<uint32_t>::const_iterator it = first; (it != byFirmware.end()) && (strcmp(records[*it].firmwareVersion, q.firmware) == 0); ++it)
+        {
+            candidates.push_back(&records[*it]);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < records.size(); i++)     candidates.push_back(&records[i]);
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const InventoryRecord &r = *candidates[i];
+        if ((q.firmware != NULL) && (strcmp(r.firmwareVersion, q.firmware) != 0))                          continue;
+        if ((q.socBelow >= 0) && (((r.items & INVENTORY_BATTERY) == 0) || (r.soc >= q.socBelow)))          continue;
+        if ((q.freeBelow >= 0) && (((r.items & INVENTORY_MEMORY) == 0) || (r.storageSize == 0) ||
+                                   ((uint64_t)r.freeSpace * 100 >= (uint64_t)q.freeBelow * r.storageSize)))  continue;
+        if (q.failed && (r.err == ERR_OK))                                                                  continue;
+        result->push_back(&r);
+    }
+    return result->size();
+}
@@ -0,0 +1,246 @@
+/*
+* FleetInventory.h : This file contains the collection of the inventory of a fleet of devices
+*               (identification, versions, battery, session memory, error log, last self-test)
+*               and the snapshot it gives.
+*
+*   In a nutshell, this file implements:
+*       - FleetInventory: the devices queried in parallel by a pool of worker threads (at most
+*           "parallel" devices connected at once); on each device, the commands are pipelined:
+*           up to "depth" of them in flight, so that the round trip of one overlaps the others.
+*           The collection time of each device is kept in its record
+*       - the snapshot files: a JSON document for the people and the other tools, and an
+*           indexed binary file: the records sorted by serial number, then an index of the
+*           records by firmware version
+*       - InventorySnapshot: the binary file loaded, records found by serial number (binary
+*           search) and selected by firmware version (index), battery and free memory
+*
+*   The devices are reached through IInventoryDevice: the AMI SDK in the tools (SdkInventory),
+*   simulated devices otherwise.
+*
+*   Binary file (little endian): InventoryFileHeader, the InventoryRecord sorted by serial number,
+*   then the index: one uint32 per record, the record numbers sorted by firmware version (then
+*   serial number). Written under a temporary name and renamed once complete, as the JSON file.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _FLEETINVENTORY_H
+#define _FLEETINVENTORY_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "DeadlineClock.h"
+
+#define INVENTORY_MAGIC         "AMIINV01"  // First bytes of a binary snapshot
+#define INVENTORY_PARALLEL      8           // Default number of devices queried at once
+#define INVENTORY_MAX_PARALLEL  64          // Max number of devices queried at once
+#define INVENTORY_DEPTH         3           // Default number of commands in flight per device
+#define INVENTORY_MAX_DEPTH     8           // Max number of commands in flight per device
+#define INVENTORY_TEXT_MAX      32          // Size of the strings of DeviceInfoC
+#define INVENTORY_LABEL_MAX     64          // Size of the label (connection ID) kept
+#define INVENTORY_DATE_MAX      20          // "YYYY-MM-DD hh:mm:ss", terminator included
+#define INVENTORY_ERROR_TYPES   32          // Counters of the error log (AMI_MAX_ERROR_TYPES)
+
+// Items of the inventory, one command each
+#define INVENTORY_INFO          0x01        // Identification and versions (AMI_DeviceGetInfo)
+#define INVENTORY_BATTERY       0x02        // AMI_DeviceGetBatteryStatus
+#define INVENTORY_MEMORY        0x04        // AMI_DeviceGetSessionMemoryStatus
+#define INVENTORY_ERROR_LOG     0x08        // AMI_DeviceGetErrorLog
+#define INVENTORY_SELFTEST      0x10        // AMI_DeviceGetLastSelftestDate
+#define INVENTORY_ITEMS         5           // Number of items
+#define INVENTORY_ALL           0x1F        // Every item
+
+typedef struct
+{
+    char label[INVENTORY_LABEL_MAX];        // Connection ID of the device
+    char productNumber[INVENTORY_TEXT_MAX];
+    char serialNumber[INVENTORY_TEXT_MAX];
+    char firmwareVersion[INVENTORY_TEXT_MAX];
+    char subMcuVersion[INVENTORY_TEXT_MAX];
+    char hardwareVersion[INVENTORY_TEXT_MAX];
+    char selftestDate[INVENTORY_DATE_MAX];  // Last self-test, "YYYY-MM-DD hh:mm:ss"
+    uint8_t productType;
+    uint8_t hardwareConfig;
+    uint8_t soc;                // State of charge (%)
+    uint8_t charging;           // Charger connected
+    uint16_t voltage;           // Battery voltage (mV)
+    uint16_t items;             // Items collected (INVENTORY_INFO...)
+    uint32_t storageSize;       // Session memory, bytes
+    uint32_t freeSpace;         // Free session memory, bytes
+    uint32_t sessionCount;      // Sessions stored
+    uint16_t errorLog[INVENTORY_ERROR_TYPES];   // Count of each type of critical error
+    int32_t err;                // First error of the collection (ERR_OK: every item collected)
+    uint32_t collectMs;         // Collection time of the device, connection included
+} InventoryRecord;
+
+typedef struct
+{
+    char magic[8];              // INVENTORY_MAGIC
+    uint32_t recordSize;        // sizeof(InventoryRecord)
+    uint32_t count;             // Number of records
+    int64_t takenAt;            // Time of the snapshot, seconds since the epoch
+    uint32_t collectMs;         // Duration of the collection
+    uint32_t reserved;
+} InventoryFileHeader;
+
+class IInventoryDevice
+{
+public:
+    virtual ~IInventoryDevice() {}
+
+    /**
+    * @brief label: connection ID of the device
+    */
+    virtual const char *label(void) = 0;
+
+    /**
+    * @brief open: connect to the device
+    *
+    * @return ERR_OK or an error (device not reachable)
+    */
+    virtual int open(void) = 0;
+
+    /**
+    * @brief query: run the command of an item and store its fields. The commands of the items of
+    *           a device are called from many threads at once; each item only writes its own fields.
+    *
+    * @param item:      INVENTORY_INFO...
+    * @param record:    receives the fields of the item
+    * @return ERR_OK or an error
+    */
+    virtual int query(uint32_t item, InventoryRecord *record) = 0;
+
+    /**
+    * @brief close: disconnect from the device
+    *
+    * @return None.
+    */
+    virtual void close(void) = 0;
+};
+
+
+class FleetInventory
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param parallel:  number of devices queried at once
+    * @param depth:     number of commands in flight per device (1: one at a time)
+    * @param clock:     clock of the durations
+    * @return None.
+    */
+    FleetInventory(unsigned parallel = INVENTORY_PARALLEL, unsigned depth = INVENTORY_DEPTH, IClock *clock = systemClock());
+
+    /**
+    * @brief collect: query every device
+    *
+    * @param devices:   devices
+    * @param records:   receives one record per device, in the same order
+    * @return Duration of the collection (ms)
+    */
+    int64_t collect(const std::vector<IInventoryDevice *> &devices, std::vector<InventoryRecord> *records);
+
+    unsigned parallelCount(void)                                        { return parallel; }
+    unsigned depthCount(void)                                           { return depth; }
+
+private:
+    typedef struct
+    {
+        IInventoryDevice *device;       // Device queried
+        InventoryRecord *record;        // Its record
+        std::atomic<uint32_t> nextItem; // Next item to query
+        std::atomic<uint32_t> collected;    // Items collected
+        std::atomic<int> err;           // First error
+    } DeviceJob;
+
+    static void workerEntry(FleetInventory *self);
+    void workerFunc(void);
+    static void commandEntry(DeviceJob *job);
+
+    unsigned parallel;                  // Number of devices queried at once
+    unsigned depth;                     // Number of commands in flight per device
+    IClock *clock;                      // Clock of the durations
+
+    const std::vector<IInventoryDevice *> *devices;     // Devices of the collection
+    std::vector<InventoryRecord> *records;              // Their records
+    std::atomic<size_t> nextDevice;     // Next device to query
+};
+
+/**
+* @brief inventorySaveJson: write a snapshot as a JSON document
+*
+* @param path:      file
+* @param records:   records
+* @param takenAt:   time of the snapshot, seconds since the epoch
+* @param collectMs: duration of the collection
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int inventorySaveJson(const char *path, const std::vector<InventoryRecord> &records, int64_t takenAt, int64_t collectMs);
+
+/**
+* @brief inventorySaveIndex: write a snapshot as an indexed binary file
+*
+* @param path:      file
+* @param records:   records
+* @param takenAt:   time of the snapshot, seconds since the epoch
+* @param collectMs: duration of the collection
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int inventorySaveIndex(const char *path, const std::vector<InventoryRecord> &records, int64_t takenAt, int64_t collectMs);
+
+typedef struct
+{
+    const char *serial;         // Serial number (NULL: any)
+    const char *firmware;       // Firmware version (NULL: any)
+    int socBelow;               // State of charge below that % (-1: any)
+    int freeBelow;              // Free session memory below that % (-1: any)
+    bool failed;                // Only the devices whose collection failed
+} InventoryQuery;
+
+
+class InventorySnapshot
+{
+public:
+    InventorySnapshot() : takenAt(0), collectMs(0) {}
+
+    /**
+    * @brief load: read a binary snapshot
+    *
+    * @param path:      file
+    * @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT
+    */
+    int load(const char *path);
+
+    /**
+    * @brief find: record of a serial number
+    *
+    * @param serial:    serial number
+    * @return The record, NULL if none
+    */
+    const InventoryRecord *find(const char *serial) const;
+
+    /**
+    * @brief select: records matching every criterion given, sorted by serial number (by firmware
+    *           version then serial number when the firmware is given)
+    *
+    * @param q:         criteria
+    * @param result:    receives the records (valid until the next load)
+    * @return Number of records
+    */
+    size_t select(const InventoryQuery &q, std::vector<const InventoryRecord *> *result) const;
+
+    size_t size(void) const                                             { return records.size(); }
+    int64_t time(void) const                                            { return takenAt; }
+    int64_t duration(void) const                                        { return collectMs; }
+
+private:
+    std::vector<InventoryRecord> records;   // Records, sorted by serial number
+    std::vector<uint32_t> byFirmware;       // Record numbers, sorted by firmware version
+    int64_t takenAt;                        // Time of the snapshot
+    int64_t collectMs;                      // Duration of the collection
+};
+
+#endif // _FLEETINVENTORY_H
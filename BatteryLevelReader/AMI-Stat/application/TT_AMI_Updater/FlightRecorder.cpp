@@ -0,0 +1,310 @@
+/*
+* FlightRecorder.cpp : This file contains the class keeping the recent protocol events of a
+*               connection, to be dumped to disk for post-mortem analysis.
+*
+*   In a nutshell, this class implements:
+*       - a fixed-size lock-free ring of the last FREC_EVENTS events of a connection
+*       - a consistent snapshot that can be taken from any thread while events are recorded
+*       - a text dump to the dump folder, on error by the owner or for all connections on demand
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include "FlightRecorder.h"
+
+// Update channel fields decoded by recordFrame() (see UpdateSession.h)
+#define FREC_CHAN_UPDATE        'Q'     // Update channel
+#define FREC_CMD_UPDREQ         0xB0    // Update request: offset at byte 2
+#define FREC_CMD_UPDRESP        0xB1    // Update response: error at byte 2, offset at byte 3
+
+static const char *typeNames[FREC_TYPE_COUNT] = { "OPEN", "CLOSE", "TX", "RX", "ERROR", "PROTO" };
+
+/**
+* @brief registry: the live recorders and a copy of the last closed one, for dumpAll()
+*/
+typedef struct
+{
+    std::mutex lock;                        // Protects all the fields
+    std::vector<FlightRecorder *> live;     // Recorders currently existing
+    std::string lastLabel;                  // Label of the last recorder destroyed
+    uint64_t lastTotal = 0;                 // Number of events it recorded
+    std::vector<FlightEvent> lastEvents;    // Its events
+    std::string dumpFolder;                 // Folder receiving the dump files ("": no dump)
+    unsigned dumpCount = 0;                 // Number of dump files written (makes the file names unique)
+} Registry;
+
+static Registry &registry(void)
+{
+    static Registry reg;
+    return reg;
+}
+
+static inline int64_t frecNowUs(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline uint32_t getBE32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+FlightRecorder::FlightRecorder()
+: head(0)
+{
+    for (int i = 0; i < FREC_EVENTS; i++)
+    {
+        ring[i].seq.store(0, std::memory_order_relaxed);
+        ring[i].timeUs.store(0, std::memory_order_relaxed);
+        ring[i].word1.store(0, std::memory_order_relaxed);
+        ring[i].word2.store(0, std::memory_order_relaxed);
+    }
+    label[0] = 0;
+
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.live.push_back(this);
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.live.erase(std::remove(reg.live.begin(), reg.live.end(), this), reg.live.end());
+    if (head.load(std::memory_order_acquire) != 0)      // keep the last connection that did something
+    {
+        reg.lastLabel = label;
+        reg.lastTotal = snapshot(reg.lastEvents);
+    }
+}
+
+/**
+* @brief setLabel: name the connection in the dumps (e.g. device address). Not thread safe.
+*
+* @param label:     connection name
+* @return None.
+*/
+void FlightRecorder::setLabel(const char *_label)
+{
+    strncpy(label, (_label != NULL) ? _label : "", FREC_LABEL_LEN - 1);
+    label[FREC_LABEL_LEN - 1] = 0;
+}
+
+/**
+* @brief record: add an event to the ring. Lock-free, can be called from any thread.
+*
+* @return None.
+*/
+void FlightRecorder::record(uint8_t type, uint8_t channel, uint8_t command, uint32_t offset, uint32_t length, int32_t error)
+{
+    uint64_t idx = head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = ring[idx & (FREC_EVENTS - 1)];
+
+    slot.seq.store(0, std::memory_order_relaxed);               // readers skip the slot while it is written
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.timeUs.store(frecNowUs(), std::memory_order_relaxed);
+    slot.word1.store((uint64_t)type | ((uint64_t)channel << 8) | ((uint64_t)command << 16) | ((uint64_t)offset << 32), std::memory_order_relaxed);
+    slot.word2.store((uint64_t)length | ((uint64_t)(uint32_t)error << 32), std::memory_order_relaxed);
+    slot.seq.store(idx + 1, std::memory_order_release);
+}
+
+/**
+* @brief recordFrame: add a frame event, decoding its channel, command and update offset
+*
+* @param type:      FREC_TX or FREC_RX
+* @param frame:     frame without SLIP framing
+* @param len:       number of bytes in frame
+* @return None.
+*/
+void FlightRecorder::recordFrame(uint8_t type, const uint8_t *frame, int len)
+{
+    uint8_t channel = (len > 0) ? frame[0] : 0;
+    uint8_t command = (len > 1) ? frame[1] : 0;
+    uint32_t offset = 0;
+    int32_t error = 0;
+
+    if (channel == FREC_CHAN_UPDATE)
+    {
+        if ((command == FREC_CMD_UPDREQ) && (len >= 6))         offset = getBE32(&frame[2]);
+        else if ((command == FREC_CMD_UPDRESP) && (len >= 7))
+        {
+            error = frame[2];                   // error code returned by the device
+            offset = getBE32(&frame[3]);
+        }
+    }
+    record(type, channel, command, offset, (uint32_t)len, error);
+}
+
+/**
+* @brief snapshot: copy the events of the ring, oldest first. Events being written are skipped.
+*
+* @param out:       receives the events
+* @return Number of events recorded since creation (can be more than the ones kept)
+*/
+uint64_t FlightRecorder::snapshot(std::vector<FlightEvent> &out) const
+{
+    uint64_t total = head.load(std::memory_order_acquire);
+    uint64_t first = (total > FREC_EVENTS) ? total - FREC_EVENTS : 0;
+
+    out.clear();
+    for (uint64_t idx = first; idx < total; idx++)
+    {
+        const Slot &slot = ring[idx & (FREC_EVENTS - 1)];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != idx + 1)     continue;                       // being written, or already overwritten
+
+        int64_t timeUs = slot.timeUs.load(std::memory_order_relaxed);
+        uint64_t word1 = slot.word1.load(std::memory_order_relaxed);
+        uint64_t word2 = slot.word2.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq)    continue;   // overwritten while copying
+
+        FlightEvent ev;
+        ev.timeUs = timeUs;
+        ev.type = (uint8_t)word1;
+        ev.channel = (uint8_t)(word1 >> 8);
+        ev.command = (uint8_t)(word1 >> 16);
+        ev.offset = (uint32_t)(word1 >> 32);
+        ev.length = (uint32_t)word2;
+        ev.error = (int32_t)(uint32_t)(word2 >> 32);
+        out.push_back(ev);
+    }
+    return total;
+}
+
+/**
+* @brief toText: print the events of the ring, one per line
+*
+* @param out:       receives the text (appended)
+* @return None.
+*/
+void FlightRecorder::toText(std::string &out) const
+{
+    std::vector<FlightEvent> events;
+    uint64_t total = snapshot(events);
+    eventsToText(label, total, events, out);
+}
+
+/**
+* @brief dump: write the events in a new file of the dump folder
+*
+* @param reason:    first line of the file (e.g. the error message)
+* @return 0 on success, -1 if no dump folder is set or the file cannot be written
+*/
+int FlightRecorder::dump(const char *reason) const
+{
+    std::string text;
+    toText(text);
+    return writeDump(label, reason, text);
+}
+
+/**
+* @brief setDumpFolder: set the folder receiving the dump files ("" or NULL: no dump)
+*
+* @param folder:    folder, with or without trailing separator
+* @return None.
+*/
+void FlightRecorder::setDumpFolder(const char *folder)
+{
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> guard(reg.lock);
+
+    reg.dumpFolder = (folder != NULL) ? folder : "";
+    if ((reg.dumpFolder != "") && (reg.dumpFolder.back() != '/') && (reg.dumpFolder.back() != '\\'))   reg.dumpFolder += '/';
+}
+
+/**
+* @brief dumpAll: dump every live recorder and the last closed one in a single file
+*
+* @param reason:    first line of the file
+* @return 0 on success, -1 if no dump folder is set or the file cannot be written
+*/
+int FlightRecorder::dumpAll(const char *reason)
+{
+    std::string text;
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> guard(reg.lock);    // recorders cannot be destroyed while we read them
+
+        for (size_t i = 0; i < reg.live.size(); i++)    reg.live[i]->toText(text);
+        if (reg.lastTotal != 0)
+        {
+            text += "# last closed connection\n";
+            eventsToText(reg.lastLabel.c_str(), reg.lastTotal, reg.lastEvents, text);
+        }
+    }
+    return writeDump("all", reason, text);
+}
+
+/**
+* @brief eventsToText: print events, times relative to the first one
+*
+* @return None.
+*/
+void FlightRecorder::eventsToText(const char *label, uint64_t total, const std::vector<FlightEvent> &events, std::string &out)
+{
+    char line[160];
+
+    snprintf(line, sizeof(line), "# connection %s: %llu events, last %u kept\n", (label[0] != 0) ? label : "-",
+        (unsigned long long)total, (unsigned)events.size());
+    out += line;
+    out += "#   time ms  event  chan  cmd   offset   length  error\n";
+
+    int64_t origin = events.empty() ? 0 : events[0].timeUs;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const FlightEvent &ev = events[i];
+        char chan[8];
+
+        if ((ev.channel >= 0x20) && (ev.channel < 0x7F))    snprintf(chan, sizeof(chan), "'%c'", ev.channel);
+        else                                                snprintf(chan, sizeof(chan), "0x%02X", ev.channel);
+        snprintf(line, sizeof(line), "%11.3f  %-5s  %-4s  0x%02X  %7u  %7u  %5d\n", (ev.timeUs - origin) / 1000.0,
+            (ev.type < FREC_TYPE_COUNT) ? typeNames[ev.type] : "?", chan, ev.command, ev.offset, ev.length, ev.error);
+        out += line;
+    }
+    out += "\n";
+}
+
+/**
+* @brief writeDump: write a dump file in the dump folder
+*
+* @param tag:       part of the file name (connection label or "all")
+* @param reason:    first line of the file
+* @param text:      events
+* @return 0 on success, -1 on error
+*/
+int FlightRecorder::writeDump(const char *tag, const char *reason, const std::string &text)
+{
+    std::string path;
+    {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> guard(reg.lock);
+        if (reg.dumpFolder == "")   return -1;
+
+        char name[128];
+        time_t now = time(0);
+        struct tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        snprintf(name, sizeof(name), FREC_DUMP_PREFIX "%s_%04d%02d%02d_%02d%02d%02d_%u.txt", (tag[0] != 0) ? tag : "conn",
+            local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec, reg.dumpCount++);
+        path = reg.dumpFolder + name;
+    }
+
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL)          return -1;
+    fprintf(f, "# %s\n", (reason != NULL) ? reason : "");
+    fwrite(text.data(), 1, text.size(), f);
+    fclose(f);
+    return 0;
+}
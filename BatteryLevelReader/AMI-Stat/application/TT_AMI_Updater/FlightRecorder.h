@@ -0,0 +1,144 @@
+/*
+* FlightRecorder.h : This file contains the class keeping the recent protocol events of a
+*               connection, to be dumped to disk for post-mortem analysis.
+*
+*   In a nutshell, this class implements:
+*       - a fixed-size ring of the last FREC_EVENTS events of a connection (connection opened/closed,
+*           frame sent/received with its channel, command, offset and length, errors with their code)
+*       - a lock-free record(): a slot is claimed with one atomic increment and written with
+*           relaxed stores, guarded by a per slot sequence number. No allocation, no lock: it costs
+*           a few tens of nanoseconds and is always on.
+*       - a consistent snapshot that can be taken from any thread while events are recorded
+*       - a text dump to the dump folder, done by the owner on error, or for every live
+*           connection (and the last closed one) on demand with dumpAll()
+*
+*   Slip owns one recorder per connection and records the frames and framing errors; the
+*   protocol engines add their own errors (e.g. invalid response length with the length received).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _FLIGHTRECORDER_H
+#define _FLIGHTRECORDER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define FREC_EVENTS             256         // Events kept per connection (power of 2)
+#define FREC_LABEL_LEN          32          // Max length of a recorder label
+#define FREC_DUMP_PREFIX        "TT_AMI_Updater_flight_"    // Prefix of the dump files
+
+typedef enum
+{
+    FREC_OPEN,              // Connection opened
+    FREC_CLOSE,             // Connection closed
+    FREC_TX,                // Frame sent
+    FREC_RX,                // Frame received
+    FREC_ERROR,             // Transport or framing error (error = ErrCodes.h code)
+    FREC_PROTOCOL,          // Protocol engine error (error = code, length = detail such as the length received)
+    FREC_TYPE_COUNT
+} FlightEventType;
+
+typedef struct
+{
+    int64_t timeUs;         // Steady clock time of the event
+    uint8_t type;           // FlightEventType
+    uint8_t channel;        // SLIP channel ('A', 'Q'...), 0 if none
+    uint8_t command;        // Command number (second byte of the frame), 0 if none
+    uint32_t offset;        // Offset field of the update frames, 0 otherwise
+    uint32_t length;        // Frame length or error detail
+    int32_t error;          // Error code (0: none)
+} FlightEvent;
+
+
+class FlightRecorder
+{
+public:
+    FlightRecorder();
+    virtual ~FlightRecorder();
+
+    /**
+    * @brief setLabel: name the connection in the dumps (e.g. device address). Not thread safe.
+    *
+    * @param label:     connection name
+    * @return None.
+    */
+    void setLabel(const char *label);
+
+    /**
+    * @brief record: add an event to the ring. Lock-free, can be called from any thread.
+    *
+    * @return None.
+    */
+    void record(uint8_t type, uint8_t channel, uint8_t command, uint32_t offset, uint32_t length, int32_t error);
+
+    /**
+    * @brief recordFrame: add a frame event, decoding its channel, command and update offset
+    *
+    * @param type:      FREC_TX or FREC_RX
+    * @param frame:     frame without SLIP framing
+    * @param len:       number of bytes in frame
+    * @return None.
+    */
+    void recordFrame(uint8_t type, const uint8_t *frame, int len);
+
+    /**
+    * @brief snapshot: copy the events of the ring, oldest first. Events being written are skipped.
+    *
+    * @param out:       receives the events
+    * @return Number of events recorded since creation (can be more than the ones kept)
+    */
+    uint64_t snapshot(std::vector<FlightEvent> &out) const;
+
+    /**
+    * @brief toText: print the events of the ring, one per line
+    *
+    * @param out:       receives the text (appended)
+    * @return None.
+    */
+    void toText(std::string &out) const;
+
+    /**
+    * @brief dump: write the events in a new file of the dump folder
+    *
+    * @param reason:    first line of the file (e.g. the error message)
+    * @return 0 on success, -1 if no dump folder is set or the file cannot be written
+    */
+    int dump(const char *reason) const;
+
+    /**
+    * @brief setDumpFolder: set the folder receiving the dump files ("" or NULL: no dump)
+    *
+    * @param folder:    folder, with or without trailing separator
+    * @return None.
+    */
+    static void setDumpFolder(const char *folder);
+
+    /**
+    * @brief dumpAll: dump every live recorder and the last closed one in a single file
+    *
+    * @param reason:    first line of the file
+    * @return 0 on success, -1 if no dump folder is set or the file cannot be written
+    */
+    static int dumpAll(const char *reason);
+
+private:
+    typedef struct
+    {
+        std::atomic<uint64_t> seq;      // Index+1 of the event held, 0 while being written
+        std::atomic<int64_t> timeUs;    // FlightEvent.timeUs
+        std::atomic<uint64_t> word1;    // type | channel << 8 | command << 16 | offset << 32
+        std::atomic<uint64_t> word2;    // length | error << 32
+    } Slot;
+
+    static void eventsToText(const char *label, uint64_t total, const std::vector<FlightEvent> &events, std::string &out);
+    static int writeDump(const char *tag, const char *reason, const std::string &text);
+
+    Slot ring[FREC_EVENTS];             // Last events
+    std::atomic<uint64_t> head;         // Number of events recorded (next slot = head % FREC_EVENTS)
+    char label[FREC_LABEL_LEN];         // Name of the connection
+};
+
+#endif // _FLIGHTRECORDER_H
@@ -0,0 +1,87 @@
+/*
+* JsonFields.cpp : This file contains the functions extracting fields from the JSON responses
+*               of the device ("A" SLIP channel).
+*
+*   In a nutshell, this file implements:
+*       - the lookup of a string, number or boolean value by its key
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "JsonFields.h"
+
+/**
+* @brief findValue: reach the value of a key
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @return First character of the value (spaces skipped), NULL if the key is not found
+*/
+static const char *findValue(const char *json, const char *key)
+{
+    const char *ptr = strstr(json, key);
+    if (ptr == NULL)        return NULL;
+
+    ptr = strchr(ptr + strlen(key), ':');           // Reach the :
+    if (ptr == NULL)        return NULL;
+
+    ptr++;
+    while ((*ptr == ' ') || (*ptr == '\t') || (*ptr == '\r') || (*ptr == '\n'))     ptr++;
+    return ptr;
+}
+
+/**
+* @brief jsonGetString: extract a string value
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value, without the ""
+* @return false if the key or its value is not found
+*/
+bool jsonGetString(const char *json, const char *key, std::string *value)
+{
+    const char *ptr = findValue(json, key);
+    if (ptr == NULL)        return false;
+
+    ptr = strchr(ptr, '"');                         // Find the beginning "
+    if (ptr == NULL)        return false;
+    ptr++;                                          // Skip the "
+    const char *end = strchr(ptr, '"');             // Find the ending "
+    if (end == NULL)        return false;
+
+    value->assign(ptr, end - ptr);
+    return true;
+}
+
+/**
+* @brief jsonGetNumber: extract a numeric value
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value
+* @return false if the key or its value is not found
+*/
+bool jsonGetNumber(const char *json, const char *key, float *value)
+{
+    const char *ptr = findValue(json, key);
+    return (ptr != NULL) && (sscanf(ptr, "%f", value) == 1);
+}
+
+/**
+* @brief jsonGetBool: extract a boolean value (true/True or false/False)
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value
+* @return false if the key is not found
+*/
+bool jsonGetBool(const char *json, const char *key, bool *value)
+{
+    const char *ptr = findValue(json, key);
+    if (ptr == NULL)        return false;
+
+    *value = (strncmp(ptr, "true", 4) == 0) || (strncmp(ptr, "True", 4) == 0);
+    return true;
+}
@@ -0,0 +1,60 @@
+/*
+* JsonFields.h : This file contains the functions extracting fields from the JSON responses
+*               of the device ("A" SLIP channel).
+*
+*   In a nutshell, this file implements:
+*       - the lookup of a string, number or boolean value by its key
+*
+*   The responses are small and well formed, for instance:
+*
+*   {"ID":"GetDeviceInfo",
+*    "Content":
+*       {"ProductNumber":"SA9000","SerialNumber":"GA000028","ProductType":1,
+*        "HardwareConfig":4,"FirmwarePNumber":"TT9000","FirmwareVersion":"0.13.0.0",
+*        "HardwareVersion":"2.0.0","ProtocolVersion":"1.0.0"
+*       },
+*    "Status":0
+*   }
+*
+*   so the value is found after the first occurrence of the key: a key should not be a value of
+*   another key. The key given includes the surrounding "" (e.g. "\"SOC\"").
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _JSONFIELDS_H
+#define _JSONFIELDS_H
+
+#include <string>
+
+/**
+* @brief jsonGetString: extract a string value
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value, without the ""
+* @return false if the key or its value is not found
+*/
+bool jsonGetString(const char *json, const char *key, std::string *value);
+
+/**
+* @brief jsonGetNumber: extract a numeric value
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value
+* @return false if the key or its value is not found
+*/
+bool jsonGetNumber(const char *json, const char *key, float *value);
+
+/**
+* @brief jsonGetBool: extract a boolean value (true/True or false/False)
+*
+* @param json:      response, 0 terminated
+* @param key:       key, including the surrounding ""
+* @param value:     receives the value
+* @return false if the key is not found
+*/
+bool jsonGetBool(const char *json, const char *key, bool *value);
+
+#endif // _JSONFIELDS_H
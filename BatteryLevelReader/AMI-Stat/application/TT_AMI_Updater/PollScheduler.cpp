@@ -0,0 +1,187 @@
+/*
+* PollScheduler.cpp : This file contains the class responsible to run the periodic device
+*               requests on a worker thread.
+*
+*   In a nutshell, this class implements:
+*       - the scheduling loop: sleep until the next task is due or a request arrives
+*       - the coalescing of the requests
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "PollScheduler.h"
+
+PollScheduler::PollScheduler()
+    : running(false)
+    , paused(false)
+    , busy(false)
+{
+}
+
+PollScheduler::~PollScheduler()
+{
+    stop();
+}
+
+int PollScheduler::addTask(PollTask_t fn, void *ctx, uint32_t intervalMs)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (fn == NULL || running || tasks.size() >= POLL_MAX_TASKS)    return -1;
+
+    Task t;
+    t.fn = fn;
+    t.ctx = ctx;
+    t.intervalMs = intervalMs;
+    t.pending = false;
+    t.ran = false;
+    t.runs = 0;
+    tasks.push_back(t);
+    return (int)tasks.size() - 1;
+}
+
+void PollScheduler::setInterval(int taskId, uint32_t intervalMs)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (taskId < 0 || taskId >= (int)tasks.size())  return;
+    tasks[taskId].intervalMs = intervalMs;
+    wake.notify_one();
+}
+
+void PollScheduler::request(int taskId)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (taskId < 0 || taskId >= (int)tasks.size())  return;
+    if (tasks[taskId].pending)  return;             // Already waiting: coalesce
+    tasks[taskId].pending = true;
+    wake.notify_one();
+}
+
+int PollScheduler::start(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (running)    return -1;
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        tasks[i].ran = false;
+        tasks[i].pending = false;
+    }
+    running = true;
+    worker = std::thread(threadEntry, this);
+    return 0;
+}
+
+void PollScheduler::stop(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!running)   return;
+        running = false;
+        wake.notify_one();
+    }
+    if (worker.joinable())  worker.join();
+}
+
+void PollScheduler::pause(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    paused = true;
+    wake.notify_one();
+}
+
+void PollScheduler::resume(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    paused = false;
+    wake.notify_one();
+}
+
+bool PollScheduler::isPaused(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return paused;
+}
+
+void PollScheduler::waitIdle(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    // The caller is about to use the link: the task running must be done with it
+    if (std::this_thread::get_id() != worker.get_id())
+        idle.wait(guard, [this] { return !busy; });
+}
+
+uint32_t PollScheduler::runCount(int taskId)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (taskId < 0 || taskId >= (int)tasks.size())  return 0;
+    return tasks[taskId].runs;
+}
+
+/**
+* @brief isDue: check if a task must run now
+*
+* @param t:         task to check
+* @param now:       current time
+* @param next:      lowered to the time the task will be due if it is not due now
+* @return true if the task must run now
+*/
+bool PollScheduler::isDue(const Task &t, Clock::time_point now, Clock::time_point &next) const
+{
+    if (t.pending)                  return true;
+    if (t.intervalMs == 0)          return false;
+    if (!t.ran)                     return true;
+
+    Clock::time_point due = t.lastRun + std::chrono::milliseconds(t.intervalMs);
+    if (due <= now)                 return true;
+    if (due < next)                 next = due;
+    return false;
+}
+
+void PollScheduler::threadEntry(PollScheduler *self)
+{
+    self->threadFunc();
+}
+
+void PollScheduler::threadFunc(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (running)
+    {
+        if (paused)
+        {
+            wake.wait(guard);
+            continue;
+        }
+
+        // Run the first due task, then re-evaluate: a request may have arrived meanwhile
+        Clock::time_point now = Clock::now();
+        Clock::time_point next = now + std::chrono::hours(1);
+        int due = -1;
+        for (size_t i = 0; i < tasks.size() && due < 0; i++)
+        {
+            if (isDue(tasks[i], now, next))    due = (int)i;
+        }
+
+        if (due < 0)
+        {
+            wake.wait_until(guard, next);
+            continue;
+        }
+
+        Task &t = tasks[due];
+        t.pending = false;              // Requests received from now on need a new run
+        PollTask_t fn = t.fn;
+        void *ctx = t.ctx;
+
+        busy = true;
+        guard.unlock();
+        fn(ctx, due);
+        guard.lock();
+        busy = false;
+        idle.notify_all();
+
+        // Periodic schedule restarts from the end of the run, so a slow device is not flooded
+        t.lastRun = Clock::now();
+        t.ran = true;
+        t.runs++;
+    }
+}
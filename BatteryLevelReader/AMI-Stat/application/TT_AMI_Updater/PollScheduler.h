@@ -0,0 +1,139 @@
+/*
+* PollScheduler.h : This file contains the class responsible to run the periodic device
+*               requests (device info, battery status, online status...) on a worker thread.
+*
+*   In a nutshell, this class implements:
+*       - a list of tasks, each with its own interval (0: run only when requested)
+*       - one worker thread running the due tasks one after the other, so the device
+*         never receives two requests at the same time
+*       - request(): run a task as soon as possible. Requests received while the task is
+*         already pending are coalesced into a single run.
+*       - pause()/resume(): hold every task while another procedure (e.g. an update) uses the link.
+*         pause() never blocks (safe from the UI thread): the task running, if any, checks
+*         isPaused() to bail out, and the procedure calls waitIdle() on its own thread.
+*
+*   The tasks publish their results themselves (see ProductionHelper::GetSnapshot) so the UI
+*   never waits on the device.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _POLLSCHEDULER_H
+#define _POLLSCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define POLL_MAX_TASKS          16          // Max number of tasks in one scheduler
+
+// Task function. Called on the scheduler thread.
+typedef void (*PollTask_t)(void *ctx, int taskId);
+
+class PollScheduler
+{
+public:
+    PollScheduler();
+    virtual ~PollScheduler();
+
+    /**
+    * @brief addTask: register a task. Must be called before start().
+    *
+    * @param fn:            task function
+    * @param ctx:           opaque context given back to fn
+    * @param intervalMs:    time between two runs. 0: run only on request()
+    * @return task id (>= 0), -1 if too many tasks or already started
+    */
+    int addTask(PollTask_t fn, void *ctx, uint32_t intervalMs);
+
+    /**
+    * @brief setInterval: change the interval of a task. The next run is rescheduled from its last run.
+    *
+    * @param taskId:        id returned by addTask
+    * @param intervalMs:    time between two runs. 0: run only on request()
+    * @return None.
+    */
+    void setInterval(int taskId, uint32_t intervalMs);
+
+    /**
+    * @brief request: run a task as soon as possible. Duplicate requests are coalesced.
+    *
+    * @param taskId:        id returned by addTask
+    * @return None.
+    */
+    void request(int taskId);
+
+    /**
+    * @brief start: start the worker thread. Every periodic task runs once right away, unless
+    *           paused: a pause taken before start() (e.g. an update running) is kept.
+    *
+    * @return 0 on success, -1 if already started
+    */
+    int start(void);
+
+    /**
+    * @brief stop: stop the worker thread. Waits for the running task to complete.
+    *
+    * @return None.
+    */
+    void stop(void);
+
+    /**
+    * @brief pause/resume: hold the tasks. pause() returns right away, the running task may still
+    *           be completing: see waitIdle(). Requests are kept.
+    *
+    * @return None.
+    */
+    void pause(void);
+    void resume(void);
+
+    /**
+    * @brief isPaused: check if the tasks are held. A long task checks it to bail out early.
+    */
+    bool isPaused(void);
+
+    /**
+    * @brief waitIdle: wait for the running task, if any, to complete. Returns right away when
+    *           called by a task itself. Must not be called from the UI thread.
+    *
+    * @return None.
+    */
+    void waitIdle(void);
+
+    /**
+    * @brief runCount: number of times a task was run (for diagnostics)
+    */
+    uint32_t runCount(int taskId);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Task
+    {
+        PollTask_t fn;                  // Task function
+        void *ctx;                      // Context of fn
+        uint32_t intervalMs;            // Interval between runs (0: on request only)
+        Clock::time_point lastRun;      // Time of the last run
+        bool pending;                   // A request() is waiting
+        bool ran;                       // Run at least once since start()
+        uint32_t runs;                  // Number of runs
+    };
+
+    static void threadEntry(PollScheduler *self);
+    void threadFunc(void);
+    bool isDue(const Task &t, Clock::time_point now, Clock::time_point &next) const;
+
+    std::mutex lock;                    // Protects everything below
+    std::condition_variable wake;       // Signaled on request, stop, resume and config changes
+    std::condition_variable idle;       // Signaled when a task completes
+    std::vector<Task> tasks;            // Registered tasks
+    std::thread worker;                 // Worker thread
+    bool running;                       // Worker thread must keep running
+    bool paused;                        // Tasks are held
+    bool busy;                          // A task is running
+};
+
+#endif // _POLLSCHEDULER_H
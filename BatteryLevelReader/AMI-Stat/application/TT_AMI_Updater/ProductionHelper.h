@@ -10,9 +10,17 @@
 #include <vector>
 #include <functional>
 #include <thread>
+#include <chrono>
+#include <mutex>
 
 #include "DeviceUpdate.h"
 #include "DeviceUpgrade.h"
+#include "BatteryStats.h"
+#include "ChargeForecast.h"
+#include "PollScheduler.h"
+#include "DeviceEvents.h"
+#include "ProtocolMetrics.h"
+#include "ErrCodes.h"
 using namespace std;
 #include  "ami.h"
 #include "lang.h"
@@ -22,6 +30,23 @@ using namespace std;
 #define PROD_UPGREQ_MAXDATALEN 20
 #define PROD_CMD_UPDREQ_MAXDATALEN   900 // Max number of data bytes that can be sent in a command
 
+// Poll intervals of the background scheduler
+#define PROD_POLL_INFO_MS		30000	// Device info barely changes: refreshed on open and on request
+#define PROD_POLL_BATTERY_MS	5000	// Battery status (also read on heartbeat, should the SDK ever deliver them)
+#define PROD_POLL_ONLINE_MS		1000	// Online status (heartbeat state kept by the SDK, no device traffic)
+#define PROD_POLL_RELAY_MS		3000	// Charger relay toggling of the production fixture (own timer, never paused)
+
+// Last values read by the background scheduler. The UI only reads this.
+struct DeviceSnapshot
+{
+	uint32_t seq;				// Incremented every time something changes
+	bool infoValid;				// info was read successfully
+	DeviceInfoC info;			// Last device info
+	bool batteryValid;			// battery was read successfully
+	BatteryStatus battery;		// Last battery status
+	bool online;				// Device online
+};
+
 
 class ProductionHelper
 {
@@ -37,9 +62,22 @@ public:
 		_notifyParameter = nullptr;
 		_updating = false;
 		_exiting = true;
+		_relayOn = false;
+		memset(&_snapshot, 0, sizeof(_snapshot));
+		_snapshot.battery.SOC = 0xff;
+		_pollInfo = _poller.addTask(PollEntry, this, PROD_POLL_INFO_MS);
+		_pollBattery = _poller.addTask(PollEntry, this, PROD_POLL_BATTERY_MS);
+		_pollOnline = _poller.addTask(PollEntry, this, PROD_POLL_ONLINE_MS);
+		_relayTask = _relayTimer.addTask(RelayEntry, this, PROD_POLL_RELAY_MS);
+		_relayTimer.start();
+		_events.subscribe(DEVEVT_MASK(DEVEVT_HEARTBEAT) | DEVEVT_MASK(DEVEVT_ERROR_STATUS) | DEVEVT_MASK(DEVEVT_ONLINE) | DEVEVT_MASK(DEVEVT_OFFLINE), EventEntry, this);
+		AMI_SetCallBack(DeviceCallback, this);
 	}
 	virtual ~ProductionHelper()
 	{
+		_relayTimer.stop();
+		_poller.stop();
+		AMI_SetCallBack(NULL, NULL);
 		AMI_End();
 
 	}
@@ -75,6 +113,21 @@ private:
 	TTL_UINT32 _offset;
 	bool _exiting;
 	bool _updating;
+	bool _relayOn;					// Current state of the fixture charger relay
+
+	PollScheduler _poller;			// Background poll of the opened device
+	int _pollInfo;					// Poll task ids
+	int _pollBattery;
+	int _pollOnline;
+	PollScheduler _relayTimer;		// Charger relay toggling: runs whether a device is opened, polled or updated
+	int _relayTask;
+	std::mutex _linkLock;			// A poll task and the relay never use the link at the same time
+	DeviceEventHub _events;			// Notifications pushed by the device
+	ProtocolMetrics _updateMetrics;	// Metrics of the last update
+	std::mutex _snapshotLock;		// Protects _snapshot
+	DeviceSnapshot _snapshot;		// Last values polled
+	BatteryStatsEngine _batteryStats;	// Rolling statistics of the battery readings per device
+	ChargePredictorEngine _chargeForecast;	// Charge time forecast per device
 public:
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	void SetUIItems(CListBox * deviceList)
@@ -117,9 +170,173 @@ public:
 	}
 	bool Close()
 	{
+		StopPolling();
 		return (AMI_DeviceClose(handle)==0);
 	}
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Start polling the opened device in background. Results are obtained with GetSnapshot.
+	void StartPolling()
+	{
+		{
+			std::lock_guard<std::mutex> guard(_snapshotLock);
+			uint32_t seq = _snapshot.seq;
+			memset(&_snapshot, 0, sizeof(_snapshot));
+			_snapshot.battery.SOC = 0xff;
+			_snapshot.seq = seq + 1;
+		}
+		_events.reset();
+		_poller.start();
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	void StopPolling()
+	{
+		_poller.stop();
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Ask for a refresh of the device info and battery status. Coalesced with pending requests.
+	void RequestRefresh()
+	{
+		_poller.request(_pollInfo);
+		_poller.request(_pollBattery);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Copy of the last polled values. Returns false if nothing changed since lastSeq.
+	bool GetSnapshot(DeviceSnapshot &snapshot, uint32_t lastSeq)
+	{
+		std::lock_guard<std::mutex> guard(_snapshotLock);
+		if (_snapshot.seq == lastSeq) return false;
+		snapshot = _snapshot;
+		return true;
+	}
+	void GetSnapshot(DeviceSnapshot &snapshot)
+	{
+		std::lock_guard<std::mutex> guard(_snapshotLock);
+		snapshot = _snapshot;
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Metrics of the last update (JSON or text). The aggregate of all the updates is in ProtocolMetrics::aggregateJson.
+	void GetUpdateMetrics(std::string &out, bool json)
+	{
+		if (json) _updateMetrics.toJson(out);
+		else _updateMetrics.toText(out);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Subscribe to the notifications pushed by the device (see DeviceEvents.h)
+	int Subscribe(uint32_t mask, DeviceEventNotif_t fn, void * ctx)
+	{
+		return _events.subscribe(mask, fn, ctx);
+	}
+	void Unsubscribe(int id)
+	{
+		_events.unsubscribe(id);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static int64_t NowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static void __stdcall DeviceCallback(AMI_DEVICE_HANDLE device, TTL_UINT32 event_id, void * data, void * param)
+	{
+		ProductionHelper * self = static_cast<ProductionHelper *>(param);
+		if (device == self->handle)
+			self->_events.onSdkEvent(event_id, NowMs());
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static void __stdcall HeartBeatCallback(unsigned int device, void * param)
+	{
+		static_cast<ProductionHelper *>(param)->_events.onHeartbeat(NowMs());
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static void EventEntry(void * ctx, const DeviceEvent * evt)
+	{
+		static_cast<ProductionHelper *>(ctx)->OnEvent(evt);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	void OnEvent(const DeviceEvent * evt)
+	{
+		switch (evt->type)
+		{
+		case DEVEVT_HEARTBEAT:
+			_poller.request(_pollBattery);		// Coalesced if a read is already pending
+			if (_notifyCallback) _notifyCallback(DEVICE_HEART_BEAT, nullptr, _notifyParameter);
+			break;
+		case DEVEVT_ERROR_STATUS:
+			_poller.request(_pollInfo);
+			break;
+		case DEVEVT_ONLINE:
+			_poller.request(_pollInfo);
+			if (_notifyCallback) _notifyCallback(DEVICE_POWERED_ON, nullptr, _notifyParameter);
+			break;
+		case DEVEVT_OFFLINE:
+			if (_notifyCallback) _notifyCallback(DEVICE_POWERED_OFF, nullptr, _notifyParameter);
+			break;
+		default:
+			break;
+		}
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static void PollEntry(void * ctx, int taskId)
+	{
+		static_cast<ProductionHelper *>(ctx)->Poll(taskId);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	void Poll(int taskId)
+	{
+		std::lock_guard<std::mutex> link(_linkLock);
+		if (_poller.isPaused()) return;		// An update took the link while this task was waiting
+		if (taskId == _pollInfo)
+		{
+			DeviceInfoC info;
+			bool valid = GetDeviceInfo(info);
+			std::lock_guard<std::mutex> guard(_snapshotLock);
+			if (valid != _snapshot.infoValid || (valid && memcmp(&info, &_snapshot.info, sizeof(info)) != 0))
+			{
+				_snapshot.infoValid = valid;
+				if (valid) _snapshot.info = info;
+				_snapshot.seq++;
+			}
+		}
+		else if (taskId == _pollBattery)
+		{
+			BatteryStatus battery = GetBatteryStatus();
+			bool valid = battery.SOC != 0xff;
+			std::lock_guard<std::mutex> guard(_snapshotLock);
+			if (valid != _snapshot.batteryValid || (valid && memcmp(&battery, &_snapshot.battery, sizeof(battery)) != 0))
+			{
+				_snapshot.batteryValid = valid;
+				_snapshot.battery = battery;
+				_snapshot.seq++;
+			}
+		}
+		else if (taskId == _pollOnline)
+		{
+			// Ask the SDK only when the device callbacks are quiet. The battery keeps its interval: without
+			// AMI_DeviceSetHBCallback in the SDK, no heartbeat comes to read it.
+			bool online = _events.checkLiveness(NowMs()) || IsDeviceOnline();
+			std::lock_guard<std::mutex> guard(_snapshotLock);
+			if (online != _snapshot.online)
+			{
+				_snapshot.online = online;
+				_snapshot.seq++;
+			}
+		}
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	static void RelayEntry(void * ctx, int taskId)
+	{
+		static_cast<ProductionHelper *>(ctx)->ToggleRelay();
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Toggle the charger relay of the fixture while the battery of the device reads well (last poll)
+	void ToggleRelay()
+	{
+		std::lock_guard<std::mutex> link(_linkLock);
+		_relayOn = !_relayOn;
+		if (isBatStatValid())
+			Set5V_Relay(_relayOn);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	bool GetDeviceInfo(DeviceInfoC & device_info_)
 	{
 		return (AMI_DeviceGetInfo(handle, device_info_, 1)==0);
@@ -144,9 +361,34 @@ public:
 			
 			LastBatStat.SOC=0xff;
 		}
+		else
+		{
+			int64_t now = NowMs();
+			_batteryStats.update(GetDeviceKey(), now, LastBatStat.SOC, LastBatStat.Voltage, LastBatStat.Charging != 0);
+			_chargeForecast.update(GetDeviceKey(), now, LastBatStat.SOC, LastBatStat.Charging != 0);
+			_events.onBattery(now, LastBatStat.SOC, LastBatStat.Voltage, LastBatStat.Charging != 0);
+		}
 		return LastBatStat;
 	}
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Rolling statistics of the readings of the opened device. False if no valid reading yet.
+	bool GetBatteryStats(BatteryStatsSnapshot &stats)
+	{
+		return _batteryStats.get(GetDeviceKey(), stats);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	// Time the opened device needs on the charger to reach a battery level. False if no valid reading yet.
+	bool GetChargeForecast(double level, ChargeForecast &forecast)
+	{
+		return _chargeForecast.forecast(GetDeviceKey(), NowMs(), level, forecast);
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
+	std::string GetDeviceKey()
+	{
+		if (handle < ftdiDevices.size())	return ftdiDevices[handle];
+		return std::string();
+	}
+	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	bool GetBatteryStatus(unsigned char & soc, bool & charging, unsigned short &Voltage)
 	{
 		BatteryStatus battery_status_= GetBatteryStatus();
@@ -185,7 +427,9 @@ public:
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
 	void SetCallbacks(HB_CALLBACK hb_cb)
 	{
-		//AMI_DeviceSetHBCallback(handle,hb_cb,this);
+		// The heartbeats are routed to the event hub (HeartBeatCallback) once the SDK exports
+		// AMI_DeviceSetHBCallback. Until then, the SDK device callback is the proof of life.
+		//AMI_DeviceSetHBCallback(handle,HeartBeatCallback,this);
 
 	}
 
@@ -210,10 +454,13 @@ public:
 		int lastPercentNotif = 0;           // Last percentage notified to application
 		CString formattedErr;
 		int sleep = 1000;
-		UpdateResponse response;
+		UpdateResponse response = {};		// Last answer of the device, 0 until it answers
+		_poller.waitIdle();					// Paused by UpdateDevice: let the running poll give the link back
 		if (_exiting == false)   // The above function may be long to execute
 		{
 			std::wstring errMsg;                // Error message to return to application. "" as long as everything goes well
+			MetricsPhase phase = METRICS_PHASE_FIRST_CHUNK;
+			_updateMetrics.beginSession(GetDeviceKey().c_str());
 			lastResult = TTL_ERROR_NONE;
 			while ((filePtr < fileEnd) && (errMsg == L""))
 			{
@@ -221,8 +468,10 @@ public:
 				int offset = (int)(filePtr - _package);         // offset in file
 				int dataLen = ((int)(fileEnd - filePtr) < PROD_CMD_UPDREQ_MAXDATALEN) ? (int)(fileEnd - filePtr) : PROD_CMD_UPDREQ_MAXDATALEN;
 
-				UpdateResponse response;
+				int64_t sendTime = metricsNowUs();
 				lastResult = AMI_WriteUpdateBatch(handle, offset, filePtr, dataLen, response, timeoutMs);
+				_updateMetrics.rtt(phase, metricsNowUs() - sendTime);
+				if (lastResult == TTL_TIMEOUT) _updateMetrics.timeout();
 
 				errMsg = DeviceUpdate::ErrTranslate(response.error_code, TXT_ERR_RXFAIL);
 
@@ -232,6 +481,9 @@ public:
 				sleep = 0;
 				if (lastResult == TTL_ERROR_NONE && response.error_code == 0)
 				{
+					phase = METRICS_PHASE_CHUNK;
+					if ((int)response.offset > offset) _updateMetrics.transferred(response.offset - offset);
+					else _updateMetrics.retry();
 					filePtr =(uint8_t*)_package + response.offset;
 					if (filePtr < fileEnd)		
 						timeoutMs = 2000;           // All other packets should be answered very quickly
@@ -246,15 +498,30 @@ public:
 					}
 
 				}
+				else if (errMsg == L"")
+				{
+					_updateMetrics.retry();		// Same chunk sent again
+				}
 			}
 			if (errMsg == L"")      // If no error during update, send an extra transaction with no data and offset=total length
 			{                       // to indicate the end of the transfer
 
+				int64_t sendTime = metricsNowUs();
 				lastResult = AMI_WriteUpdateBatch(handle, _packageLen,NULL, 0, response,  timeoutMs);
+				_updateMetrics.rtt(METRICS_PHASE_CRC, metricsNowUs() - sendTime);
 
 				if (lastResult == TTL_ERROR_NONE)
 					errMsg = L"Update done";			
 			}
+			// A refusal comes back with TTL_ERROR_NONE: log the device error code, never 0
+			int result = 0;
+			if (errMsg != L"Update done")
+			{
+				if (response.error_code != 0)				result = response.error_code;
+				else if (lastResult != TTL_ERROR_NONE)		result = (int)lastResult;
+				else										result = ERR_SDK_CALL;
+			}
+			_updateMetrics.endSession(result);
 
 			// send the last notification
 			if (_exiting == false)	_updateNotifCallback(_updateNotifyParameter, lastPercentNotif, errMsg.c_str(), true);
@@ -265,12 +532,14 @@ public:
 	void Upgrade()
 	{
 		UpdateResponse response;
+		_poller.waitIdle();					// Paused by UpgradeDevice: let the running poll give the link back
 		lastResult = AMI_WriteUpgradeKey(handle, _key, _keyLen, response, 1000);
 
 		if (response.error_code == 0  && lastResult == 0)
 			_upgradeNotifCallback(_upgradeNotifyParameter, L"");
 		else
 			_upgradeNotifCallback(_upgradeNotifyParameter, L"Upgrade error");
+		CancelUpdateDevice();				// Resumes the polling
 
 	}
 	////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -301,6 +570,7 @@ public:
 		_updating = true;
 		_updateNotifCallback = notifFunction;
 		_updateNotifyParameter = notifyParameter;
+		_poller.pause();					// Does not block: the update thread waits for the running poll
 		std::thread(UpdateEntry, this).detach();
 		return true;
 	}
@@ -309,6 +579,7 @@ public:
 	{
 		_exiting = true;
 		_updating = false;
+		_poller.resume();
 		return true;
 	}
 	/////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -324,6 +595,7 @@ public:
 		_updating = true;
 		_upgradeNotifCallback = notifFunction;
 		_upgradeNotifyParameter = notifyParameter;
+		_poller.pause();					// Does not block: the upgrade thread waits for the running poll
 		std::thread(UpgradeEntry, this).detach();
 		return true;
 	}
@@ -0,0 +1,354 @@
+/*
+* ProtocolMetrics.cpp : This file contains the classes collecting the performance metrics of the
+*               device protocol.
+*
+*   In a nutshell, this file implements:
+*       - the histogram bucketing and percentiles
+*       - the session management and the process wide aggregate
+*       - the JSON and text exports
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include "ProtocolMetrics.h"
+
+static const char *phaseNames[METRICS_PHASE_COUNT] = { "command", "firstChunk", "chunk", "crc" };
+
+int64_t metricsNowUs(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* @brief appendf: printf at the end of a std::string
+*/
+static void appendf(std::string &out, const char *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len > 0)    out.append(buf, (len < (int)sizeof(buf)) ? len : (int)sizeof(buf) - 1);
+}
+
+/**
+* @brief atomicMin/atomicMax: lock-free min/max update
+*/
+static void atomicMin(std::atomic<int64_t> &a, int64_t v)
+{
+    int64_t cur = a.load(std::memory_order_relaxed);
+    while (v < cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+}
+
+static void atomicMax(std::atomic<int64_t> &a, int64_t v)
+{
+    int64_t cur = a.load(std::memory_order_relaxed);
+    while (v > cur && !a.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+///////////////////////////////////////////////////////////////////////////////
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset(void)
+{
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++)  buckets[i].store(0, std::memory_order_relaxed);
+    n.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    minV.store(INT64_MAX, std::memory_order_relaxed);
+    maxV.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::add(int64_t us)
+{
+    if (us < 0)     us = 0;
+
+    int b = 0;
+    for (uint64_t v = (uint64_t)us; v > 1 && b < METRICS_HIST_BUCKETS - 1; v >>= 1)    b++;
+
+    buckets[b].fetch_add(1, std::memory_order_relaxed);
+    n.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(us, std::memory_order_relaxed);
+    atomicMin(minV, us);
+    atomicMax(maxV, us);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    if (other.count() == 0)     return;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++)  buckets[i].fetch_add(other.bucket(i), std::memory_order_relaxed);
+    n.fetch_add(other.count(), std::memory_order_relaxed);
+    sum.fetch_add(other.sumUs(), std::memory_order_relaxed);
+    atomicMin(minV, other.minUs());
+    atomicMax(maxV, other.maxUs());
+}
+
+int64_t LatencyHistogram::minUs(void) const
+{
+    int64_t v = minV.load(std::memory_order_relaxed);
+    return (v == INT64_MAX) ? 0 : v;
+}
+
+double LatencyHistogram::meanUs(void) const
+{
+    uint64_t c = count();
+    return c ? (double)sumUs() / c : 0.0;
+}
+
+int64_t LatencyHistogram::percentileUs(double p) const
+{
+    uint64_t c = count();
+    if (c == 0)     return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * c + 0.5);
+    if (rank < 1)   rank = 1;
+    if (rank > c)   rank = c;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_HIST_BUCKETS; i++)
+    {
+        seen += bucket(i);
+        if (seen >= rank)
+        {
+            int64_t upper = (i >= 62) ? INT64_MAX : ((int64_t)2 << i) - 1;
+            return (upper < maxUs()) ? upper : maxUs();
+        }
+    }
+    return maxUs();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ProtocolMetrics
+///////////////////////////////////////////////////////////////////////////////
+
+ProtocolMetrics::ProtocolMetrics()
+{
+    reset();
+    sessions.store(0);
+    failures.store(0);
+    lastResult.store(0);
+    durationUs.store(0);
+}
+
+void ProtocolMetrics::reset(void)
+{
+    label[0] = '\0';
+    package[0] = '\0';
+    startUs = metricsNowUs();
+    startedAt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    durationUs.store(0, std::memory_order_relaxed);
+    connectHist.reset();
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++)   rttHist[i].reset();
+    wireTxBytes.store(0, std::memory_order_relaxed);
+    wireRxBytes.store(0, std::memory_order_relaxed);
+    payloadTxBytes.store(0, std::memory_order_relaxed);
+    payloadRxBytes.store(0, std::memory_order_relaxed);
+    framesTx.store(0, std::memory_order_relaxed);
+    framesRx.store(0, std::memory_order_relaxed);
+    framingErrors.store(0, std::memory_order_relaxed);
+    timeouts.store(0, std::memory_order_relaxed);
+    retries.store(0, std::memory_order_relaxed);
+    discardedFrames.store(0, std::memory_order_relaxed);
+    transferBytes.store(0, std::memory_order_relaxed);
+}
+
+ProtocolMetrics &ProtocolMetrics::aggregate(void)
+{
+    static ProtocolMetrics agg;
+    if (agg.label[0] == '\0')  strcpy(agg.label, "aggregate");
+    return agg;
+}
+
+std::mutex &ProtocolMetrics::aggregateLock(void)
+{
+    static std::mutex lock;
+    return lock;
+}
+
+void ProtocolMetrics::beginSession(const char *sessionLabel, const char *sessionPackage)
+{
+    reset();
+    if (sessionLabel != NULL)
+    {
+        strncpy(label, sessionLabel, METRICS_LABEL_LEN - 1);
+        label[METRICS_LABEL_LEN - 1] = '\0';
+    }
+    if (sessionPackage != NULL)
+    {
+        strncpy(package, sessionPackage, METRICS_LABEL_LEN - 1);
+        package[METRICS_LABEL_LEN - 1] = '\0';
+    }
+}
+
+void ProtocolMetrics::endSession(int result)
+{
+    durationUs.store(metricsNowUs() - startUs, std::memory_order_relaxed);
+    sessions.store(1, std::memory_order_relaxed);
+    failures.store(result != 0, std::memory_order_relaxed);
+    lastResult.store(result, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> guard(aggregateLock());
+    aggregate().merge(*this);
+    aggregate().lastResult.store(result, std::memory_order_relaxed);
+}
+
+void ProtocolMetrics::connectTime(int64_t us)
+{
+    connectHist.add(us);
+}
+
+void ProtocolMetrics::merge(const ProtocolMetrics &o)
+{
+    durationUs.fetch_add(o.durationUs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    sessions.fetch_add(o.sessions.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    failures.fetch_add(o.failures.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    connectHist.merge(o.connectHist);
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++)   rttHist[i].merge(o.rttHist[i]);
+    wireTxBytes.fetch_add(o.wireTxBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    wireRxBytes.fetch_add(o.wireRxBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    payloadTxBytes.fetch_add(o.payloadTxBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    payloadRxBytes.fetch_add(o.payloadRxBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    framesTx.fetch_add(o.framesTx.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    framesRx.fetch_add(o.framesRx.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    framingErrors.fetch_add(o.framingErrors.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    timeouts.fetch_add(o.timeouts.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    retries.fetch_add(o.retries.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    discardedFrames.fetch_add(o.discardedFrames.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    transferBytes.fetch_add(o.transferBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+double ProtocolMetrics::throughput(void) const
+{
+    int64_t us = durationUs.load(std::memory_order_relaxed);
+    if (us == 0)    us = metricsNowUs() - startUs;      // Session still running
+    if (us <= 0)    return 0.0;
+    return transferBytes.load(std::memory_order_relaxed) * 1e6 / us;
+}
+
+double ProtocolMetrics::escapeOverhead(void) const
+{
+    // Only the escapes: the 2 END bytes of each frame are framing, not overhead
+    uint64_t payload = payloadTxBytes.load(std::memory_order_relaxed);
+    uint64_t wire = wireTxBytes.load(std::memory_order_relaxed);
+    uint64_t ends = 2 * framesTx.load(std::memory_order_relaxed);
+    if (payload == 0 || wire < ends)    return 1.0;
+    return (double)(wire - ends) / payload;
+}
+
+/**
+* @brief histJson: export one histogram as a JSON object
+*/
+static void histJson(std::string &out, const char *name, const LatencyHistogram &h)
+{
+    appendf(out, "\"%s\":{\"count\":%llu,\"minUs\":%lld,\"meanUs\":%.1f,\"p50Us\":%lld,\"p90Us\":%lld,\"p99Us\":%lld,\"maxUs\":%lld,\"buckets\":[",
+            name, (unsigned long long)h.count(), (long long)h.minUs(), h.meanUs(),
+            (long long)h.percentileUs(50), (long long)h.percentileUs(90), (long long)h.percentileUs(99), (long long)h.maxUs());
+
+    // Trailing empty buckets are omitted
+    int last = METRICS_HIST_BUCKETS - 1;
+    while (last >= 0 && h.bucket(last) == 0)    last--;
+    for (int i = 0; i <= last; i++)     appendf(out, "%s%llu", i ? "," : "", (unsigned long long)h.bucket(i));
+    out += "]}";
+}
+
+void ProtocolMetrics::toJson(std::string &out) const
+{
+    // Labels are device addresses or serial numbers, packages version numbers: no character to escape
+    appendf(out, "{\"label\":\"%s\",\"package\":\"%s\",\"startedAt\":%lld,\"sessions\":%u,\"failures\":%u,\"lastResult\":%d,\"durationUs\":%lld,",
+            label, package, (long long)startedAt, sessions.load(), failures.load(), lastResult.load(), (long long)durationUs.load());
+    appendf(out, "\"wireTxBytes\":%llu,\"wireRxBytes\":%llu,\"payloadTxBytes\":%llu,\"payloadRxBytes\":%llu,\"escapeOverhead\":%.4f,",
+            (unsigned long long)wireTxBytes.load(), (unsigned long long)wireRxBytes.load(),
+            (unsigned long long)payloadTxBytes.load(), (unsigned long long)payloadRxBytes.load(), escapeOverhead());
+    appendf(out, "\"framesTx\":%llu,\"framesRx\":%llu,\"framingErrors\":%llu,\"timeouts\":%llu,\"retries\":%llu,\"discardedFrames\":%llu,",
+            (unsigned long long)framesTx.load(), (unsigned long long)framesRx.load(), (unsigned long long)framingErrors.load(),
+            (unsigned long long)timeouts.load(), (unsigned long long)retries.load(), (unsigned long long)discardedFrames.load());
+    appendf(out, "\"transferBytes\":%llu,\"throughputBps\":%.1f,", (unsigned long long)transferBytes.load(), throughput());
+    histJson(out, "connect", connectHist);
+    out += ",\"rtt\":{";
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++)
+    {
+        if (i)  out += ",";
+        histJson(out, phaseNames[i], rttHist[i]);
+    }
+    out += "}}";
+}
+
+void ProtocolMetrics::toText(std::string &out) const
+{
+    appendf(out, "Session: %s  sessions=%u failures=%u lastResult=%d duration=%.3f s\n",
+            label[0] ? label : "-", sessions.load(), failures.load(), lastResult.load(), durationUs.load() / 1e6);
+    appendf(out, "  Connect: count=%llu mean=%.1f ms max=%.1f ms\n",
+            (unsigned long long)connectHist.count(), connectHist.meanUs() / 1e3, connectHist.maxUs() / 1e3);
+    appendf(out, "  Wire: tx=%llu rx=%llu bytes  Payload: tx=%llu rx=%llu bytes  Escape overhead: %.2f%%\n",
+            (unsigned long long)wireTxBytes.load(), (unsigned long long)wireRxBytes.load(),
+            (unsigned long long)payloadTxBytes.load(), (unsigned long long)payloadRxBytes.load(), (escapeOverhead() - 1.0) * 100.0);
+    appendf(out, "  Frames: tx=%llu rx=%llu  Errors: framing=%llu timeouts=%llu retries=%llu discarded=%llu\n",
+            (unsigned long long)framesTx.load(), (unsigned long long)framesRx.load(), (unsigned long long)framingErrors.load(),
+            (unsigned long long)timeouts.load(), (unsigned long long)retries.load(), (unsigned long long)discardedFrames.load());
+    appendf(out, "  Transfer: %llu bytes at %.1f bytes/s\n", (unsigned long long)transferBytes.load(), throughput());
+    for (int i = 0; i < METRICS_PHASE_COUNT; i++)
+    {
+        const LatencyHistogram &h = rttHist[i];
+        if (h.count() == 0)     continue;
+        appendf(out, "  RTT %-10s count=%llu min=%.2f mean=%.2f p50=%.2f p90=%.2f p99=%.2f max=%.2f ms\n", phaseNames[i],
+                (unsigned long long)h.count(), h.minUs() / 1e3, h.meanUs() / 1e3, h.percentileUs(50) / 1e3,
+                h.percentileUs(90) / 1e3, h.percentileUs(99) / 1e3, h.maxUs() / 1e3);
+    }
+}
+
+void ProtocolMetrics::aggregateJson(std::string &out)
+{
+    std::lock_guard<std::mutex> guard(aggregateLock());
+    aggregate().toJson(out);
+}
+
+void ProtocolMetrics::aggregateText(std::string &out)
+{
+    std::lock_guard<std::mutex> guard(aggregateLock());
+    aggregate().toText(out);
+}
+
+std::mutex &ProtocolMetrics::fileLock(void)
+{
+    static std::mutex lock;
+    return lock;
+}
+
+int ProtocolMetrics::appendToFile(const char *path, uint64_t maxBytes) const
+{
+    std::string json;
+    toJson(json);
+    json += "\n";
+
+    // The sessions of the devices updated in parallel end in any order: one rotation at a time
+    std::lock_guard<std::mutex> guard(fileLock());
+    FILE *f = fopen(path, "ab");
+    if (f == NULL)  return -1;
+    if (maxBytes > 0)
+    {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        if ((size > 0) && ((uint64_t)size + json.size() > maxBytes))
+        {
+            fclose(f);
+            std::string old = std::string(path) + ".1";
+            remove(old.c_str());                    // rename() does not replace an existing file on Windows
+            rename(path, old.c_str());              // on failure, the file keeps growing
+            f = fopen(path, "ab");
+            if (f == NULL)  return -1;
+        }
+    }
+    size_t wr = fwrite(json.data(), 1, json.size(), f);
+    fclose(f);
+    return (wr == json.size()) ? 0 : -1;
+}
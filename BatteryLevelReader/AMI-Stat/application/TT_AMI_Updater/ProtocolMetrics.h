@@ -0,0 +1,209 @@
+/*
+* ProtocolMetrics.h : This file contains the classes collecting the performance metrics of the
+*               device protocol (connection, SLIP framing, update transfer).
+*
+*   In a nutshell, this file implements:
+*       - LatencyHistogram: log2 buckets of microseconds, with count/sum/min/max and percentiles
+*       - ProtocolMetrics: the counters of one session (or the aggregate of many):
+*           - connect time
+*           - round trip time histograms per phase (first chunk = erase, chunks, final CRC, commands)
+*           - payload bytes vs wire bytes in both directions (SLIP escape overhead)
+*           - frames, timeouts, retries, framing errors, frames discarded from other channels
+*           - effective throughput of the transfer
+*       - JSON and text exports, and the JSON lines file of the sessions (rotated at a size)
+*       - a process wide aggregate receiving every session at endSession()
+*
+*   All the counters are relaxed atomics: recording an event costs a few nanoseconds and can be
+*   done from any thread. The times come from the steady (monotonic, high resolution) clock.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _PROTOCOLMETRICS_H
+#define _PROTOCOLMETRICS_H
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#define METRICS_HIST_BUCKETS    32          // Bucket i holds [2^i, 2^(i+1)) us. Last bucket holds everything above.
+#define METRICS_LABEL_LEN       32          // Max length of a session label
+
+typedef enum
+{
+    METRICS_PHASE_COMMAND,      // JSON command/response ('A' channel)
+    METRICS_PHASE_FIRST_CHUNK,  // First update chunk (device erases its flash)
+    METRICS_PHASE_CHUNK,        // Update chunks
+    METRICS_PHASE_CRC,          // Last transaction (device verifies the CRC)
+    METRICS_PHASE_COUNT
+} MetricsPhase;
+
+/**
+* @brief Monotonic time in microseconds
+*/
+int64_t metricsNowUs(void);
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    /**
+    * @brief add: record a sample
+    *
+    * @param us:        latency in microseconds
+    * @return None.
+    */
+    void add(int64_t us);
+
+    /**
+    * @brief merge: add all the samples of another histogram
+    */
+    void merge(const LatencyHistogram &other);
+
+    void reset(void);
+
+    uint64_t count(void) const          { return n.load(std::memory_order_relaxed); }
+    int64_t sumUs(void) const           { return sum.load(std::memory_order_relaxed); }
+    int64_t minUs(void) const;
+    int64_t maxUs(void) const           { return maxV.load(std::memory_order_relaxed); }
+    double meanUs(void) const;
+
+    /**
+    * @brief percentileUs: approximate percentile (upper bound of the bucket, clamped to max)
+    *
+    * @param p:         percentile (0 to 100)
+    * @return latency in us (0 if empty)
+    */
+    int64_t percentileUs(double p) const;
+
+    uint64_t bucket(int i) const        { return buckets[i].load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> buckets[METRICS_HIST_BUCKETS];
+    std::atomic<uint64_t> n;            // Number of samples
+    std::atomic<int64_t> sum;           // Sum of the samples
+    std::atomic<int64_t> minV;          // Min sample (INT64_MAX if none)
+    std::atomic<int64_t> maxV;          // Max sample
+};
+
+class ProtocolMetrics
+{
+public:
+    ProtocolMetrics();
+
+    /**
+    * @brief beginSession: reset the counters and start the session clock
+    *
+    * @param label:     session label (e.g. device address or serial number)
+    * @param package:   version of the package sent to the device (NULL: none)
+    * @return None.
+    */
+    void beginSession(const char *label, const char *package = NULL);
+
+    /**
+    * @brief endSession: stop the session clock and add this session to the aggregate
+    *
+    * @param result:    0 if the session succeeded, the error code otherwise
+    * @return None.
+    */
+    void endSession(int result);
+
+    // Transport
+    void connectTime(int64_t us);
+    void wireTx(int bytes)              { wireTxBytes.fetch_add(bytes, std::memory_order_relaxed); }
+    void wireRx(int bytes)              { wireRxBytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+    // SLIP
+    void frameTx(int payloadBytes)      { framesTx.fetch_add(1, std::memory_order_relaxed); payloadTxBytes.fetch_add(payloadBytes, std::memory_order_relaxed); }
+    void frameRx(int payloadBytes)      { framesRx.fetch_add(1, std::memory_order_relaxed); payloadRxBytes.fetch_add(payloadBytes, std::memory_order_relaxed); }
+    void framingError(void)             { framingErrors.fetch_add(1, std::memory_order_relaxed); }
+
+    // Protocol
+    void rtt(MetricsPhase phase, int64_t us)    { rttHist[phase].add(us); }
+    void timeout(void)                  { timeouts.fetch_add(1, std::memory_order_relaxed); }
+    void retry(void)                    { retries.fetch_add(1, std::memory_order_relaxed); }
+    void discardedFrame(void)           { discardedFrames.fetch_add(1, std::memory_order_relaxed); }
+    void transferred(int bytes)         { transferBytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+    /**
+    * @brief merge: add the counters of another session (used for the aggregate)
+    */
+    void merge(const ProtocolMetrics &other);
+
+    /**
+    * @brief throughput: effective transfer throughput (bytes acknowledged by the device per second)
+    */
+    double throughput(void) const;
+
+    /**
+    * @brief escapeOverhead: wire bytes sent / payload bytes sent (1.0 = no overhead)
+    */
+    double escapeOverhead(void) const;
+
+    /**
+    * @brief toJson/toText: export a snapshot of the counters
+    *
+    * @param out:       string the snapshot is appended to
+    * @return None.
+    */
+    void toJson(std::string &out) const;
+    void toText(std::string &out) const;
+
+    /**
+    * @brief aggregate: the sum of all the sessions ended so far in this process
+    *
+    * @param out:       string the JSON snapshot is appended to
+    * @return None.
+    */
+    static void aggregateJson(std::string &out);
+    static void aggregateText(std::string &out);
+
+    /**
+    * @brief appendToFile: append a JSON snapshot (one line) to a file. When the line would make
+    *           the file larger than maxBytes, the file is first renamed <path>.1 (replacing the
+    *           previous one) and a new file is started: the history takes at most twice maxBytes.
+    *
+    * @param path:      file path
+    * @param maxBytes:  size the file is rotated at, 0: never
+    * @return 0 on success, -1 if the file can't be written
+    */
+    int appendToFile(const char *path, uint64_t maxBytes = 0) const;
+
+private:
+    ProtocolMetrics(const ProtocolMetrics &);               // Not copyable
+    ProtocolMetrics &operator=(const ProtocolMetrics &);
+
+    static ProtocolMetrics &aggregate(void);
+    static std::mutex &aggregateLock(void);
+    static std::mutex &fileLock(void);
+
+    void reset(void);
+
+    char label[METRICS_LABEL_LEN];              // Session label
+    char package[METRICS_LABEL_LEN];            // Version of the package sent
+    int64_t startUs;                            // Session start
+    int64_t startedAt;                          // Session start, ms since the epoch (wall clock)
+    std::atomic<int64_t> durationUs;            // Session duration (sum for the aggregate)
+    std::atomic<uint32_t> sessions;             // Number of sessions ended
+    std::atomic<uint32_t> failures;             // Number of sessions ended with an error
+    std::atomic<int32_t> lastResult;            // Result of the last session
+
+    LatencyHistogram connectHist;               // Connection times
+    LatencyHistogram rttHist[METRICS_PHASE_COUNT];  // Round trip times per phase
+
+    std::atomic<uint64_t> wireTxBytes;          // Bytes written to the socket
+    std::atomic<uint64_t> wireRxBytes;          // Bytes read from the socket
+    std::atomic<uint64_t> payloadTxBytes;       // Payload bytes sent in SLIP frames
+    std::atomic<uint64_t> payloadRxBytes;       // Payload bytes received in SLIP frames
+    std::atomic<uint64_t> framesTx;             // SLIP frames sent
+    std::atomic<uint64_t> framesRx;             // SLIP frames received
+    std::atomic<uint64_t> framingErrors;        // SLIP framing errors
+    std::atomic<uint64_t> timeouts;             // Responses not received in time
+    std::atomic<uint64_t> retries;              // Chunks sent again
+    std::atomic<uint64_t> discardedFrames;      // Frames received from other channels while waiting for a response
+    std::atomic<uint64_t> transferBytes;        // Bytes acknowledged by the device
+};
+
+#endif // _PROTOCOLMETRICS_H
@@ -0,0 +1,418 @@
+/*
+* SessionCatalog.cpp : This file contains the catalog of the headers of a folder of recorded
+*               sessions, kept in an index file to list and search the sessions without opening
+*               them.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "SessionCatalog.h"
+#include "ErrCodes.h"
+
+#define CATALOG_PART_EXT        ".part"     // Extension of the files being written
+
+/**
+* @brief listOne: add a file of a folder to a listing if it is a regular file to catalog
+*
+* @param folder:    folder
+* @param name:      name of the file in the folder
+* @param files:     listing
+* @return None.
+*/
+static void listOne(const char *folder, const char *name, std::vector<CatalogFile> *files)
+{
+    size_t len = strlen(name);
+    size_t partLen = strlen(CATALOG_PART_EXT);
+
+    if ((strcmp(name, CATALOG_INDEX_FILE) == 0) || ((len >= partLen) && (strcmp(name + len - partLen, CATALOG_PART_EXT) == 0)))    return;
+
+    CatalogFile file;
+    file.path = std::string(folder) + "/" + name;
+#ifdef _WIN32
+    struct _stat64 st;
+    if ((_stat64(file.path.c_str(), &st) != 0) || ((st.st_mode & _S_IFREG) == 0))     return;
+#else
+    struct stat st;
+    if ((stat(file.path.c_str(), &st) != 0) || (S_ISREG(st.st_mode) == 0))            return;
+#endif
+    file.size = (uint64_t)st.st_size;
+    file.mtime = (int64_t)st.st_mtime;
+    files->push_back(file);
+}
+
+/**
+* @brief catalogListFolder: list the regular files of a folder (ISessionHeaders::list), the
+*           index files and temporary files excluded
+*
+* @param folder:    folder
+* @param files:     receives the files
+* @return ERR_OK, ERR_FILE_READ (the folder cannot be listed)
+*/
+int catalogListFolder(const char *folder, std::vector<CatalogFile> *files)
+{
+    files->clear();
+#ifdef _WIN32
+    WIN32_FIND_DATAA found;
+    std::string pattern = std::string(folder) + "\\*";
+    HANDLE h = FindFirstFileA(pattern.c_str(), &found);
+    if (h == INVALID_HANDLE_VALUE)      return ERR_FILE_READ;
+    do
+    {
+        if ((found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)  listOne(folder, found.cFileName, files);
+    } while (FindNextFileA(h, &found));
+    FindClose(h);
+#else
+    DIR *dir = opendir(folder);
+    if (dir == NULL)                    return ERR_FILE_READ;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (ent->d_name[0] != '.')      listOne(folder, ent->d_name, files);
+    }
+    closedir(dir);
+#endif
+    return ERR_OK;
+}
+
+/**
+* @brief catalogParseDate: parse a date
+*
+* @param text:      "YYYY-MM-DD" or "YYYY-MM-DD hh:mm[:ss]" (UTC)
+* @param seconds:   receives the seconds since the epoch
+* @return false if the text is not a date
+*/
+bool catalogParseDate(const char *text, int64_t *seconds)
+{
+    int y = 0, m = 0, d = 0, hh = 0, mm = 0, ss = 0;
+    int fields = sscanf(text, "%d-%d-%d %d:%d:%d", &y, &m, &d, &hh, &mm, &ss);
+
+    if ((fields < 3) || (fields == 4) || (m < 1) || (m > 12) || (d < 1) || (d > 31) ||
+        (hh < 0) || (hh > 23) || (mm < 0) || (mm > 59) || (ss < 0) || (ss > 60))    return false;
+
+    // days since 1970-01-01 of the proleptic Gregorian calendar (the year starts in March)
+    y -= (m <= 2) ? 1 : 0;
+    int64_t era = ((y >= 0) ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = era * 146097 + doe - 719468;
+
+    *seconds = days * 86400 + hh * 3600 + mm * 60 + ss;
+    return true;
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param headers:   access to the sessions
+* @param workers:   number of worker threads reading the headers (0: one per core)
+* @param clock:     clock of the durations
+* @return None.
+*/
+SessionCatalog::SessionCatalog(ISessionHeaders *_headers, unsigned _workers, IClock *_clock)
+: headers(_headers)
+, workers(_workers)
+, clock(_clock)
+, dirty(false)
+, nextJob(0)
+{
+    if (workers == 0)       workers = std::thread::hardware_concurrency();
+    if (workers == 0)       workers = 1;
+    if (workers > CATALOG_MAX_WORKERS)  workers = CATALOG_MAX_WORKERS;
+}
+
+/**
+* @brief load: read an index file (a missing file gives an empty catalog)
+*
+* @param path:      index file
+* @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT (not an index file: the catalog is empty)
+*/
+int SessionCatalog::load(const char *path)
+{
+    entries.clear();
+    rebuildIndexes();
+    dirty = false;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)       return ERR_OK;
+
+    std::vector<uint8_t> data;
+    uint8_t block[64 * 1024];
+    size_t n;
+    while ((n = fread(block, 1, sizeof(block), file)) > 0)     data.insert(data.end(), block, block + n);
+    bool readOk = (ferror(file) == 0);
+    fclose(file);
+    if (readOk == false)    return ERR_FILE_READ;
+
+    CatalogFileHeader fh;
+    if ((data.size() < sizeof(fh)) || (memcmp(data.data(), CATALOG_MAGIC, sizeof(fh.magic)) != 0))     return ERR_FILE_FORMAT;
+    memcpy(&fh, data.data(), sizeof(fh));
+    if (fh.headerSize != sizeof(SessionHeader))     return ERR_FILE_FORMAT;
+
+    size_t pos = sizeof(fh);
+    const size_t fixed = sizeof(uint64_t) + sizeof(int64_t) + 1 + sizeof(SessionHeader);
+    std::vector<CatalogEntry> loaded;
+    for (uint64_t i = 0; i < fh.count; i++)
+    {
+        uint16_t pathLen;
+        if (data.size() - pos < sizeof(pathLen))                    return ERR_FILE_FORMAT;
+        memcpy(&pathLen, &data[pos], sizeof(pathLen));
+        pos += sizeof(pathLen);
+        if (data.size() - pos < pathLen + fixed)                    return ERR_FILE_FORMAT;
+
+        CatalogEntry entry;
+        entry.file.path.assign((const char *)&data[pos], pathLen);
+        pos += pathLen;
+        memcpy(&entry.file.size, &data[pos], sizeof(entry.file.size));
+        pos += sizeof(entry.file.size);
+        memcpy(&entry.file.mtime, &data[pos], sizeof(entry.file.mtime));
+        pos += sizeof(entry.file.mtime);
+        entry.session = (data[pos++] != 0);
+        memcpy(&entry.header, &data[pos], sizeof(entry.header));
+        pos += sizeof(entry.header);
+        entry.header.patientID[CATALOG_PATIENT_MAX - 1] = 0;
+        entry.header.serialNumber[CATALOG_SERIAL_MAX - 1] = 0;
+        entry.header.protocolVersion[CATALOG_VERSION_MAX - 1] = 0;
+        loaded.push_back(entry);
+    }
+
+    std::sort(loaded.begin(), loaded.end(), [](const CatalogEntry &a, const CatalogEntry &b) { return a.file.path < b.file.path; });
+    entries.swap(loaded);
+    rebuildIndexes();
+    return ERR_OK;
+}
+
+/**
+* @brief save: write the index file
+*
+* @param path:      index file
+* @return ERR_OK, ERR_FILE_WRITE
+*/
+int SessionCatalog::save(const char *path)
+{
+    std::string tmpPath = std::string(path) + CATALOG_PART_EXT;
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    CatalogFileHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, CATALOG_MAGIC, sizeof(fh.magic));
+    fh.headerSize = sizeof(SessionHeader);
+    fh.count = entries.size();
+
+    bool ok = (fwrite(&fh, sizeof(fh), 1, file) == 1);
+    for (size_t i = 0; ok && (i < entries.size()); i++)
+    {
+        const CatalogEntry &entry = entries[i];
+        uint16_t pathLen = (uint16_t)std::min(entry.file.path.size(), (size_t)UINT16_MAX);
+        uint8_t session = entry.session ? 1 : 0;
+        ok = (fwrite(&pathLen, sizeof(pathLen), 1, file) == 1) &&
+             (fwrite(entry.file.path.data(), 1, pathLen, file) == pathLen) &&
+             (fwrite(&entry.file.size, sizeof(entry.file.size), 1, file) == 1) &&
+             (fwrite(&entry.file.mtime, sizeof(entry.file.mtime), 1, file) == 1) &&
+             (fwrite(&session, 1, 1, file) == 1) &&
+             (fwrite(&entry.header, sizeof(entry.header), 1, file) == 1);
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (ok)
+    {
+        remove(path);                               // rename() does not replace an existing file on Windows
+        ok = (rename(tmpPath.c_str(), path) == 0);
+    }
+    if (ok == false)
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    dirty = false;
+    return ERR_OK;
+}
+
+/**
+* @brief update: bring the catalog up to date with a folder: the entries of the files with the
+*           same size and time are kept, the headers of the other files are read in parallel
+*
+* @param folder:    folder of the sessions
+* @param stats:     receives the statistics
+* @return ERR_OK, or the error of the listing
+*/
+int SessionCatalog::update(const char *folder, CatalogStats *stats)
+{
+    std::vector<CatalogFile> files;
+    int64_t startMs = clock->nowMs();
+
+    memset(stats, 0, sizeof(*stats));
+    int err = headers->list(folder, &files);
+    stats->listMs = clock->nowMs() - startMs;
+    if (err != ERR_OK)      return err;
+    std::sort(files.begin(), files.end(), [](const CatalogFile &a, const CatalogFile &b) { return a.path < b.path; });
+
+    // merge the listing with the entries, both sorted by path
+    std::vector<CatalogEntry> merged;
+    std::vector<size_t> toRead;
+    merged.reserve(files.size());
+    size_t old = 0;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const CatalogFile &f = files[i];
+        while ((old < entries.size()) && (entries[old].file.path < f.path))
+        {
+            old++;
+            stats->removed++;
+        }
+        if ((old < entries.size()) && (entries[old].file.path == f.path))
+        {
+            const CatalogEntry &known = entries[old++];
+            if ((known.file.size == f.size) && (known.file.mtime == f.mtime))
+            {
+                merged.push_back(known);
+                stats->unchanged++;
+                continue;
+            }
+        }
+        CatalogEntry entry;                 // new, or changed: read
+        entry.file = f;
+        entry.session = false;
+        memset(&entry.header, 0, sizeof(entry.header));
+        toRead.push_back(merged.size());
+        merged.push_back(entry);
+    }
+    stats->removed += (uint32_t)(entries.size() - old);
+    stats->files = (uint32_t)files.size();
+    entries.swap(merged);
+
+    // read the headers in parallel: each worker writes the entries of its own jobs only
+    startMs = clock->nowMs();
+    jobs.clear();
+    for (size_t i = 0; i < toRead.size(); i++)  jobs.push_back(&entries[toRead[i]]);
+    nextJob = 0;
+    std::vector<std::thread> pool;
+    unsigned count = (unsigned)std::min((size_t)workers, jobs.size());
+    for (unsigned w = 0; w < count; w++)        pool.push_back(std::thread(workerEntry, this));
+    for (size_t w = 0; w < pool.size(); w++)    pool[w].join();
+    stats->readMs = clock->nowMs() - startMs;
+
+    stats->read = (uint32_t)jobs.size();
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (jobs[i]->session == false)      stats->notSessions++;
+    }
+    jobs.clear();
+
+    if ((stats->read > 0) || (stats->removed > 0))  dirty = true;
+    rebuildIndexes();
+    return ERR_OK;
+}
+
+/**
+* @brief workerEntry: worker thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void SessionCatalog::workerEntry(SessionCatalog *self)
+{
+    self->workerFunc();
+}
+
+/**
+* @brief workerFunc: read headers until no job is left
+*
+* @return None.
+*/
+void SessionCatalog::workerFunc(void)
+{
+    size_t job;
+
+    while ((job = nextJob++) < jobs.size())
+    {
+        CatalogEntry *entry = jobs[job];
+        SessionHeader header;
+
+        memset(&header, 0, sizeof(header));
+        if (headers->readHeader(entry->file.path.c_str(), &header) == ERR_OK)
+        {
+            header.patientID[CATALOG_PATIENT_MAX - 1] = 0;
+            header.serialNumber[CATALOG_SERIAL_MAX - 1] = 0;
+            header.protocolVersion[CATALOG_VERSION_MAX - 1] = 0;
+            entry->header = header;
+            entry->session = true;
+        }
+    }
+}
+
+/**
+* @brief rebuildIndexes: index the sessions per patient, per serial number and by date
+*
+* @return None.
+*/
+void SessionCatalog::rebuildIndexes(void)
+{
+    byDate.clear();
+    byPatient.clear();
+    bySerial.clear();
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].session == false)    continue;
+        byDate.push_back(i);
+        byPatient.insert(std::make_pair(std::string(entries[i].header.patientID), i));
+        bySerial.insert(std::make_pair(std::string(entries[i].header.serialNumber), i));
+    }
+    // stable: the sessions of the same date stay sorted by path
+    std::stable_sort(byDate.begin(), byDate.end(), [this](size_t a, size_t b) { return entries[a].header.dateTime < entries[b].header.dateTime; });
+}
+
+/**
+* @brief query: sessions matching every criterion given, sorted by date. The candidates come
+*           from the most selective index available (patient, serial number, date range); the
+*           other criteria are checked on them.
+*
+* @param q:         criteria
+* @param result:    receives the entries (valid until the next load or update)
+* @return Number of entries
+*/
+size_t SessionCatalog::query(const CatalogQuery &q, std::vector<const CatalogEntry *> *result)
+{
+    std::vector<size_t> candidates;
+
+    result->clear();
+    if ((q.patient != NULL) || (q.serial != NULL))
+    {
+        const std::multimap<std::string, size_t> &index = (q.patient != NULL) ? byPatient : bySerial;
+        std::pair<std::multimap<std::string, size_t>::const_iterator, std::multimap<std::string, size_t>::const_iterator> range =
+            index.equal_range((q.patient != NULL) ? q.patient : q.serial);
+        for (std::multimap<std::string, size_t>::const_iterator it = range.first; it != range.second; ++it)     candidates.push_back(it->second);
+        std::stable_sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+            return (entries[a].header.dateTime != entries[b].header.dateTime) ? (entries[a].header.dateTime < entries[b].header.dateTime) : (a < b); });
+    }
+    else
+    {
+        auto before = [this](size_t i, int64_t date) { return entries[i].header.dateTime < date; };
+        std::vector<size_t>::iterator first = std::lower_bound(byDate.begin(), byDate.end(), q.from, before);
+        std::vector<size_t>::iterator last = std::lower_bound(first, byDate.end(), q.to, before);
+        candidates.assign(first, last);
+    }
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const CatalogEntry &entry = entries[candidates[i]];
+        const SessionHeader &h = entry.header;
+        if ((q.patient != NULL) && (strcmp(h.patientID, q.patient) != 0))             continue;
+        if ((q.serial != NULL) && (strcmp(h.serialNumber, q.serial) != 0))             continue;
+        if ((q.sessionType >= 0) && ((int64_t)h.sessionType != q.sessionType))         continue;
+        if ((h.dateTime < q.from) || (h.dateTime >= q.to))                              continue;
+        result->push_back(&entry);
+    }
+    return result->size();
+}
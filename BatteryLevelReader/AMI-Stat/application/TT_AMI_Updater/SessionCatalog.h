@@ -0,0 +1,215 @@
+/*
+* SessionCatalog.h : This file contains the catalog of the headers of a folder of recorded
+*               sessions, kept in an index file to list and search the sessions without opening
+*               them.
+*
+*   In a nutshell, this class implements:
+*       - the index file (CATALOG_INDEX_FILE in the folder by default): the header of every
+*           session with the size and modification time of its file when it was read
+*       - the update: the folder is listed (names, sizes and times only), the headers of the new
+*           and changed files are read by a pool of worker threads, the entries of the removed
+*           files are dropped; the files that are not sessions are kept too (not read again)
+*       - the queries by patient, serial number, session type and date range, answered from
+*           indexes kept in memory (per patient, per serial number, sorted by date)
+*
+*   The headers are read through ISessionHeaders: AMI_GetSessionFileInfo in the tools
+*   (SdkHeaders), a simulated folder otherwise.
+*
+*   Index file (little endian): CatalogFileHeader, then per entry the length of the path
+*   (uint16), the path, the size (uint64) and time (int64) of the file, a session flag (uint8)
+*   and the SessionHeader. Written under a temporary name and renamed once complete.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SESSIONCATALOG_H
+#define _SESSIONCATALOG_H
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include "DeadlineClock.h"
+
+#define CATALOG_MAGIC           "AMICAT01"  // First bytes of an index file
+#define CATALOG_INDEX_FILE      "sessions.cat"  // Default index file, in the folder of the sessions
+#define CATALOG_MAX_WORKERS     64          // Max number of worker threads
+#define CATALOG_PATIENT_MAX     129         // Size of a patient ID (MyonixHeaderInfo)
+#define CATALOG_SERIAL_MAX      11          // Size of a serial number, terminator included
+#define CATALOG_VERSION_MAX     17          // Size of a protocol version, terminator included
+#define CATALOG_SENSORS         4           // Sensors of a session (channelSensorsID)
+
+typedef struct
+{
+    uint32_t sampleRate;        // Raw sample rate
+    uint32_t rawCount;          // Raw samples (samplesCount_raw)
+    uint32_t rmsCount;          // RMS samples (samplesCount_rms)
+    uint32_t eventsCount;       // Events
+    uint32_t sessionType;       // Type of session (BFB, ETS, RETS...)
+    int32_t sensors[CATALOG_SENSORS];       // Sensor of each channel
+    int64_t dateTime;           // Start of the session, seconds since the epoch
+    uint8_t modified;           // The session was modified after the recording
+    uint8_t productType;        // Product that recorded it
+    char patientID[CATALOG_PATIENT_MAX];    // Patient, null terminated
+    char serialNumber[CATALOG_SERIAL_MAX];  // Serial number of the device, null terminated
+    char protocolVersion[CATALOG_VERSION_MAX];
+} SessionHeader;
+
+typedef struct
+{
+    char magic[8];              // CATALOG_MAGIC
+    uint32_t headerSize;        // sizeof(SessionHeader): an index of another build is read again
+    uint32_t reserved;
+    uint64_t count;             // Number of entries
+} CatalogFileHeader;
+
+typedef struct
+{
+    std::string path;           // Session file
+    uint64_t size;              // Size of the file when its header was read
+    int64_t mtime;              // Modification time of the file when its header was read
+} CatalogFile;
+
+typedef struct
+{
+    CatalogFile file;           // File and its state when read
+    bool session;               // The file is a session: header is valid
+    SessionHeader header;       // Header of the session
+} CatalogEntry;
+
+class ISessionHeaders
+{
+public:
+    virtual ~ISessionHeaders() {}
+
+    /**
+    * @brief list: list the files of a folder, without opening them
+    *
+    * @param folder:    folder of the sessions
+    * @param files:     receives the files
+    * @return ERR_OK or an error
+    */
+    virtual int list(const char *folder, std::vector<CatalogFile> *files) = 0;
+
+    /**
+    * @brief readHeader: read the header of a session. Called by many worker threads at once.
+    *
+    * @param path:      session file
+    * @param header:    receives the header
+    * @return ERR_OK, or an error (not a session, cannot be read)
+    */
+    virtual int readHeader(const char *path, SessionHeader *header) = 0;
+};
+
+/**
+* @brief catalogListFolder: list the regular files of a folder (ISessionHeaders::list), the
+*           index files and temporary files excluded
+*
+* @param folder:    folder
+* @param files:     receives the files
+* @return ERR_OK, ERR_FILE_READ (the folder cannot be listed)
+*/
+int catalogListFolder(const char *folder, std::vector<CatalogFile> *files);
+
+/**
+* @brief catalogParseDate: parse a date
+*
+* @param text:      "YYYY-MM-DD" or "YYYY-MM-DD hh:mm[:ss]" (UTC)
+* @param seconds:   receives the seconds since the epoch
+* @return false if the text is not a date
+*/
+bool catalogParseDate(const char *text, int64_t *seconds);
+
+typedef struct
+{
+    const char *patient;        // Patient ID (NULL: any)
+    const char *serial;         // Serial number of the device (NULL: any)
+    int64_t sessionType;        // Type of session (-1: any)
+    int64_t from;               // First date included (INT64_MIN: any)
+    int64_t to;                 // Date excluded (INT64_MAX: any)
+} CatalogQuery;
+
+typedef struct
+{
+    uint32_t files;             // Files in the folder
+    uint32_t unchanged;         // Entries kept (same size and time)
+    uint32_t read;              // Headers read (new and changed files)
+    uint32_t notSessions;       // Files read that are not sessions
+    uint32_t removed;           // Entries of files no longer there
+    int64_t listMs;             // Duration of the listing
+    int64_t readMs;             // Duration of the reads
+} CatalogStats;
+
+
+class SessionCatalog
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param headers:   access to the sessions
+    * @param workers:   number of worker threads reading the headers (0: one per core)
+    * @param clock:     clock of the durations
+    * @return None.
+    */
+    SessionCatalog(ISessionHeaders *headers, unsigned workers = 0, IClock *clock = systemClock());
+
+    /**
+    * @brief load: read an index file (a missing file gives an empty catalog)
+    *
+    * @param path:      index file
+    * @return ERR_OK, ERR_FILE_READ, ERR_FILE_FORMAT (not an index file: the catalog is empty)
+    */
+    int load(const char *path);
+
+    /**
+    * @brief save: write the index file
+    *
+    * @param path:      index file
+    * @return ERR_OK, ERR_FILE_WRITE
+    */
+    int save(const char *path);
+
+    /**
+    * @brief update: bring the catalog up to date with a folder
+    *
+    * @param folder:    folder of the sessions
+    * @param stats:     receives the statistics
+    * @return ERR_OK, or the error of the listing
+    */
+    int update(const char *folder, CatalogStats *stats);
+
+    /**
+    * @brief query: sessions matching every criterion given, sorted by date
+    *
+    * @param q:         criteria
+    * @param result:    receives the entries (valid until the next load or update)
+    * @return Number of entries
+    */
+    size_t query(const CatalogQuery &q, std::vector<const CatalogEntry *> *result);
+
+    size_t size(void)                                                   { return entries.size(); }
+    unsigned workerCount(void)                                          { return workers; }
+    bool changed(void)                                                  { return dirty; }
+
+private:
+    static void workerEntry(SessionCatalog *self);
+    void workerFunc(void);
+    void rebuildIndexes(void);
+
+    ISessionHeaders *headers;           // Access to the sessions
+    unsigned workers;                   // Number of worker threads
+    IClock *clock;                      // Clock of the durations
+    bool dirty;                         // Changed since loaded or saved
+
+    std::vector<CatalogEntry> entries;  // Entries, sorted by path
+    std::vector<size_t> byDate;         // Sessions (index in entries), sorted by date
+    std::multimap<std::string, size_t> byPatient;   // Sessions per patient
+    std::multimap<std::string, size_t> bySerial;    // Sessions per serial number
+
+    std::vector<CatalogEntry *> jobs;   // Entries whose header is read by the workers
+    std::atomic<size_t> nextJob;        // Next job to take
+};
+
+#endif // _SESSIONCATALOG_H
@@ -0,0 +1,485 @@
+/*
+* SessionColumns.cpp : This file contains the classes writing the columnar session files and
+*               reading them through a memory mapping.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include <algorithm>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "SessionColumns.h"
+#include "ErrCodes.h"
+
+/**
+* @brief alignUp: round an offset up to COLUMNS_ALIGN
+*/
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + COLUMNS_ALIGN - 1) & ~(uint64_t)(COLUMNS_ALIGN - 1);
+}
+
+static bool eventBefore(const ColumnEvent &a, const ColumnEvent &b)
+{
+    return a.sample < b.sample;
+}
+
+ColumnWriter::ColumnWriter()
+: file(NULL)
+, sinkFnct(NULL)
+, sinkCtx(NULL)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+ColumnWriter::~ColumnWriter()
+{
+    abort();
+}
+
+/**
+* @brief create: start a columnar file, the sections placed according to the layout
+*
+* @param path:      file (written under a temporary name until finish())
+* @param layout:    channels, rates and number of samples and events
+* @return ERR_OK or an error
+*/
+int ColumnWriter::create(const char *_path, const ColumnLayout &layout)
+{
+    abort();
+    if ((layout.channels == 0) || (layout.channels > COLUMNS_MAX_CHANNELS) || (layout.rawRate == 0))   return ERR_FILE_FORMAT;
+
+    memset(&header, 0, sizeof(header));
+    header.version = COLUMNS_VERSION;
+    header.headerSize = sizeof(ColumnHeader);
+    header.rawRate = layout.rawRate;
+    header.rmsRate = layout.rmsRate;
+    header.rmsDecimation = layout.rmsDecimation;
+    header.channels = layout.channels;
+
+    uint64_t offset = alignUp(sizeof(ColumnHeader));
+    for (uint32_t c = 0; c < layout.channels; c++)
+    {
+        header.sensors[c] = layout.sensors[c];
+        header.raw[c].offset = offset;
+        header.raw[c].count = layout.rawCount;
+        offset = alignUp(offset + layout.rawCount * sizeof(float));
+    }
+    for (uint32_t c = 0; c < layout.channels; c++)
+    {
+        header.rms[c].offset = offset;
+        header.rms[c].count = layout.rmsCount;
+        offset = alignUp(offset + layout.rmsCount * sizeof(float));
+    }
+    header.events.offset = offset;
+    header.events.count = layout.eventCount;
+    offset = alignUp(offset + layout.eventCount * sizeof(ColumnEvent));
+    header.timeIndex.offset = offset;
+    header.timeIndex.count = layout.rawCount / layout.rawRate + 1;
+    header.fileSize = offset + header.timeIndex.count * sizeof(ColumnTimeIndex);
+
+    raw.written = 0;
+    raw.count = layout.rawCount;
+    raw.extents = header.raw;
+    rms.written = 0;
+    rms.count = layout.rmsCount;
+    rms.extents = header.rms;
+    for (uint32_t c = 0; c < COLUMNS_MAX_CHANNELS; c++)
+    {
+        raw.block[c].clear();
+        rms.block[c].clear();
+    }
+    events.clear();
+    events.reserve((size_t)layout.eventCount);
+
+    path = _path;
+    tmpPath = path + ".part";
+    file = fopen(tmpPath.c_str(), "w+b");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    ColumnHeader blank;                                 // placeholder: the magic is written by finish()
+    memset(&blank, 0, sizeof(blank));
+    return writeAt(0, &blank, sizeof(blank));
+}
+
+int ColumnWriter::appendRaw(const float *frames, uint32_t count)
+{
+    return append(raw, frames, count);
+}
+
+int ColumnWriter::appendRms(const float *frames, uint32_t count)
+{
+    return append(rms, frames, count);
+}
+
+/**
+* @brief append: split frames into the blocks of the channels
+*
+* @param stream:    raw or RMS
+* @param frames:    frames of header.channels values
+* @param count:     number of frames
+* @return ERR_OK or an error
+*/
+int ColumnWriter::append(Stream &stream, const float *frames, uint32_t count)
+{
+    if (file == NULL)                                                       return ERR_FILE_WRITE;
+    if (stream.written + stream.block[0].size() + count > stream.count)     return ERR_FILE_FORMAT;
+
+    uint32_t channels = header.channels;
+    while (count > 0)
+    {
+        uint32_t room = COLUMNS_BLOCK - (uint32_t)stream.block[0].size();
+        uint32_t n = (count < room) ? count : room;
+        for (uint32_t c = 0; c < channels; c++)
+        {
+            std::vector<float> &block = stream.block[c];
+            for (uint32_t i = 0; i < n; i++)        block.push_back(frames[i * channels + c]);
+        }
+        frames += n * channels;
+        count -= n;
+        if (stream.block[0].size() >= COLUMNS_BLOCK)
+        {
+            int err = flushStream(stream);
+            if (err != ERR_OK)  return err;
+        }
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief flushStream: write the blocks of the channels at their place
+*
+* @param stream:    raw or RMS
+* @return ERR_OK or ERR_FILE_WRITE
+*/
+int ColumnWriter::flushStream(Stream &stream)
+{
+    size_t n = stream.block[0].size();
+    if (n == 0)             return ERR_OK;
+
+    for (uint32_t c = 0; c < header.channels; c++)
+    {
+        int err = writeAt(stream.extents[c].offset + stream.written * sizeof(float), stream.block[c].data(), n * sizeof(float));
+        if (err != ERR_OK)  return err;
+        if ((sinkFnct != NULL) && (&stream == &raw))    sinkFnct(sinkCtx, c, stream.block[c].data(), (uint32_t)n);
+        stream.block[c].clear();
+    }
+    stream.written += n;
+    return ERR_OK;
+}
+
+int ColumnWriter::addEvent(uint64_t sample, uint32_t code, float value)
+{
+    if (events.size() >= header.events.count)      return ERR_FILE_FORMAT;
+    ColumnEvent event = { sample, code, value };
+    events.push_back(event);
+    return ERR_OK;
+}
+
+/**
+* @brief finish: write the events, the time index and the header, and give the file its name
+*
+* @return ERR_OK, or an error (samples or events missing, file error): the file is discarded
+*/
+int ColumnWriter::finish(void)
+{
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    int err = flushStream(raw);
+    if (err == ERR_OK)      err = flushStream(rms);
+    if ((err == ERR_OK) && ((raw.written != raw.count) || (rms.written != rms.count) || (events.size() != header.events.count)))  err = ERR_FILE_FORMAT;
+    if (err != ERR_OK)
+    {
+        abort();
+        return err;
+    }
+
+    std::stable_sort(events.begin(), events.end(), eventBefore);
+    if (events.empty() == false)    err = writeAt(header.events.offset, events.data(), events.size() * sizeof(ColumnEvent));
+
+    std::vector<ColumnTimeIndex> index((size_t)header.timeIndex.count);
+    size_t event = 0;
+    for (size_t s = 0; s < index.size(); s++)
+    {
+        index[s].raw = std::min<uint64_t>((uint64_t)s * header.rawRate, raw.count);
+        uint64_t rmsFirst = (header.rmsDecimation > 0) ? (uint64_t)s * header.rawRate / header.rmsDecimation
+                                                       : (uint64_t)s * header.rmsRate;
+        index[s].rms = std::min<uint64_t>(rmsFirst, rms.count);
+        while ((event < events.size()) && (events[event].sample < index[s].raw))    event++;
+        index[s].event = event;
+    }
+    if (err == ERR_OK)      err = writeAt(header.timeIndex.offset, index.data(), index.size() * sizeof(ColumnTimeIndex));
+
+    memcpy(header.magic, COLUMNS_MAGIC, sizeof(header.magic));
+    if (err == ERR_OK)      err = writeAt(0, &header, sizeof(header));
+    if ((fclose(file) != 0) && (err == ERR_OK))     err = ERR_FILE_WRITE;
+    file = NULL;
+
+    if (err == ERR_OK)
+    {
+        remove(path.c_str());                           // rename() does not replace an existing file on Windows
+        if (rename(tmpPath.c_str(), path.c_str()) != 0)     err = ERR_FILE_WRITE;
+    }
+    if (err != ERR_OK)      remove(tmpPath.c_str());
+    return err;
+}
+
+/**
+* @brief abort: discard the file
+*
+* @return None.
+*/
+void ColumnWriter::abort(void)
+{
+    if (file == NULL)       return;
+    fclose(file);
+    file = NULL;
+    remove(tmpPath.c_str());
+}
+
+/**
+* @brief writeAt: write bytes at an offset of the file (beyond 2 GB too)
+*
+* @return ERR_OK or ERR_FILE_WRITE
+*/
+int ColumnWriter::writeAt(uint64_t offset, const void *data, size_t len)
+{
+#ifdef _WIN32
+    bool ok = (_fseeki64(file, (__int64)offset, SEEK_SET) == 0);
+#else
+    bool ok = (fseeko(file, (off_t)offset, SEEK_SET) == 0);
+#endif
+    ok = ok && (fwrite(data, 1, len, file) == len);
+    return ok ? ERR_OK : ERR_FILE_WRITE;
+}
+
+
+MappedFile::MappedFile()
+: base(NULL)
+, length(0)
+#ifdef _WIN32
+, fileHandle(INVALID_HANDLE_VALUE)
+, mapHandle(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/**
+* @brief open: map a file in memory (read only)
+*
+* @param path:      file
+* @param minSize:   size under which the file is rejected (its header)
+* @return ERR_OK, ERR_FILE_READ or ERR_FILE_FORMAT (shorter than minSize)
+*/
+int MappedFile::open(const char *path, uint64_t minSize)
+{
+    close();
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)     return ERR_FILE_READ;
+    LARGE_INTEGER fileSize;
+    if ((GetFileSizeEx(fileHandle, &fileSize) == FALSE) || ((uint64_t)fileSize.QuadPart < minSize) || (fileSize.QuadPart == 0))
+    {
+        close();
+        return ERR_FILE_FORMAT;
+    }
+    length = (uint64_t)fileSize.QuadPart;
+    mapHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapHandle != NULL)  base = (const uint8_t *)MapViewOfFile(mapHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)             return ERR_FILE_READ;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((uint64_t)st.st_size < minSize) || (st.st_size == 0))
+    {
+        ::close(fd);
+        return ERR_FILE_FORMAT;
+    }
+    length = (uint64_t)st.st_size;
+    void *mapping = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);                                        // the mapping keeps the file
+    base = (mapping == MAP_FAILED) ? NULL : (const uint8_t *)mapping;
+#endif
+    if (base == NULL)
+    {
+        close();
+        return ERR_FILE_READ;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief close: unmap the file
+*
+* @return None.
+*/
+void MappedFile::close(void)
+{
+#ifdef _WIN32
+    if (base != NULL)                           UnmapViewOfFile(base);
+    if (mapHandle != NULL)                      CloseHandle(mapHandle);
+    if (fileHandle != INVALID_HANDLE_VALUE)     CloseHandle(fileHandle);
+    mapHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (base != NULL)                           munmap((void *)base, (size_t)length);
+#endif
+    base = NULL;
+    length = 0;
+}
+
+/**
+* @brief valid: check that a section lies in the file
+*
+* @param extent:    section
+* @param elementSize: size of its elements
+* @param minOffset: offset under which the section is rejected (the header)
+* @return true when the section is inside the file
+*/
+bool MappedFile::valid(const ColumnExtent &extent, size_t elementSize, uint64_t minOffset)
+{
+    if (extent.count == 0)                          return true;
+    if ((extent.offset < minOffset) || (extent.offset > length) || (extent.offset % sizeof(float) != 0))  return false;
+    return (extent.count <= (length - extent.offset) / elementSize);
+}
+
+
+ColumnFile::ColumnFile()
+: header(NULL)
+{
+}
+
+ColumnFile::~ColumnFile()
+{
+    close();
+}
+
+/**
+* @brief open: map a columnar file in memory (read only)
+*
+* @param path:      file
+* @return ERR_OK, or an error (missing file, not a columnar file, truncated)
+*/
+int ColumnFile::open(const char *path)
+{
+    close();
+    int err = map.open(path, sizeof(ColumnHeader));
+    if (err != ERR_OK)      return err;
+
+    const uint64_t hs = sizeof(ColumnHeader);
+    header = (const ColumnHeader *)map.data();
+    bool ok = (memcmp(header->magic, COLUMNS_MAGIC, sizeof(header->magic)) == 0) && (header->version == COLUMNS_VERSION) &&
+              (header->headerSize == sizeof(ColumnHeader)) && (header->fileSize <= map.size()) &&
+              (header->channels > 0) && (header->channels <= COLUMNS_MAX_CHANNELS) && (header->rawRate > 0);
+    for (uint32_t c = 0; ok && (c < header->channels); c++)
+    {
+        ok = map.valid(header->raw[c], sizeof(float), hs) && map.valid(header->rms[c], sizeof(float), hs);
+    }
+    ok = ok && map.valid(header->events, sizeof(ColumnEvent), hs) && map.valid(header->timeIndex, sizeof(ColumnTimeIndex), hs) &&
+         (header->timeIndex.count > 0);
+    if (ok == false)
+    {
+        close();
+        return ERR_FILE_FORMAT;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief close: unmap the file
+*
+* @return None.
+*/
+void ColumnFile::close(void)
+{
+    map.close();
+    header = NULL;
+}
+
+const float *ColumnFile::raw(uint32_t channel, double fromSec, double toSec, uint64_t *count, uint64_t *first)
+{
+    *count = 0;
+    if ((header == NULL) || (channel >= header->channels))     return NULL;
+    return range(header->raw[channel], header->rawRate, fromSec, toSec, count, first);
+}
+
+const float *ColumnFile::rms(uint32_t channel, double fromSec, double toSec, uint64_t *count, uint64_t *first)
+{
+    *count = 0;
+    if ((header == NULL) || (channel >= header->channels))     return NULL;
+    return range(header->rms[channel], rmsRateHz(), fromSec, toSec, count, first);
+}
+
+/**
+* @brief rmsRateHz: actual RMS sample rate (rawRate / rmsDecimation, or rmsRate)
+*
+* @return RMS samples per second
+*/
+double ColumnFile::rmsRateHz(void)
+{
+    if (header == NULL)                 return 0;
+    if (header->rmsDecimation > 0)      return (double)header->rawRate / header->rmsDecimation;
+    return header->rmsRate;
+}
+
+/**
+* @brief range: samples of a channel in a time range
+*
+* @return The samples, NULL when the range is empty
+*/
+const float *ColumnFile::range(const ColumnExtent &extent, double rate, double fromSec, double toSec, uint64_t *count, uint64_t *first)
+{
+    if (fromSec < 0)        fromSec = 0;
+    uint64_t from = (uint64_t)(fromSec * rate);
+    uint64_t to = (toSec * rate >= (double)extent.count) ? extent.count : (uint64_t)(toSec * rate);
+    if (first != NULL)      *first = from;
+    if (from >= to)         return NULL;
+
+    *count = to - from;
+    return (const float *)(map.data() + extent.offset) + from;
+}
+
+/**
+* @brief events: events of a time range, found through the time index
+*
+* @param fromSec:   start of the range (seconds from the start of the session)
+* @param toSec:     end of the range (excluded)
+* @param count:     receives the number of events
+* @return The events, NULL when none
+*/
+const ColumnEvent *ColumnFile::events(double fromSec, double toSec, uint64_t *count)
+{
+    *count = 0;
+    if ((header == NULL) || (header->events.count == 0) || (toSec <= fromSec))    return NULL;
+    if (fromSec < 0)        fromSec = 0;
+
+    const ColumnEvent *all = (const ColumnEvent *)(map.data() + header->events.offset);
+    const ColumnTimeIndex *index = (const ColumnTimeIndex *)(map.data() + header->timeIndex.offset);
+    uint64_t last = header->timeIndex.count - 1;
+    uint64_t fromIdx = std::min<uint64_t>((uint64_t)fromSec, last);
+    uint64_t toIdx = std::min<uint64_t>((uint64_t)toSec + 1, last);
+
+    // the index narrows the search to the seconds of the range
+    const ColumnEvent *lo = all + std::min<uint64_t>(index[fromIdx].event, header->events.count);
+    const ColumnEvent *hi = (toIdx >= last) ? all + header->events.count : all + std::min<uint64_t>(index[toIdx].event, header->events.count);
+    ColumnEvent fromEvent = { (uint64_t)(fromSec * header->rawRate), 0, 0 };
+    ColumnEvent toEvent = { (uint64_t)(toSec * header->rawRate), 0, 0 };
+    const ColumnEvent *begin = std::lower_bound(lo, hi, fromEvent, eventBefore);
+    const ColumnEvent *end = std::lower_bound(begin, hi, toEvent, eventBefore);
+    if (begin >= end)       return NULL;
+
+    *count = (uint64_t)(end - begin);
+    return begin;
+}
@@ -0,0 +1,304 @@
+/*
+* SessionColumns.h : This file contains the columnar file format of the recorded sessions, and the
+*               classes writing it and reading it through a memory mapping.
+*
+*   In a nutshell, this file implements:
+*       - ColumnWriter: conversion of a session to the columnar file: the samples are given as
+*           frames (one value per channel) and stored per channel, each channel one contiguous
+*           float array, for the raw and the RMS signals; the events in a table sorted by sample;
+*           a time index giving, every second, the first raw sample, RMS sample and event
+*       - MappedFile: a file mapped in memory, read only (also used by the sidecar files)
+*       - ColumnFile: the file mapped in memory: a channel, a time range of a channel or the
+*           events of a time range are pointers into the mapping (zero-copy), only the pages read
+*           are loaded
+*
+*   File layout (little endian, every section aligned on COLUMNS_ALIGN bytes):
+*       ColumnHeader | raw channel 0..n-1 (float) | RMS channel 0..n-1 (float) |
+*       events (ColumnEvent) | time index (ColumnTimeIndex)
+*   The header is written last: a file left incomplete has no valid magic.
+*   The RMS rate is rawRate / rmsDecimation when the RMS is computed from the raw samples (the
+*   device: 2048 / 102 = 20.08 Hz), else the rmsRate given (rmsDecimation 0).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SESSIONCOLUMNS_H
+#define _SESSIONCOLUMNS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define COLUMNS_MAGIC           "AMICOLS1"  // First bytes of a columnar file
+#define COLUMNS_VERSION         2           // Version of the layout (2: rmsDecimation)
+#define COLUMNS_FILE_EXT        ".amc"      // Extension of the columnar files
+#define COLUMNS_MAX_CHANNELS    4           // Max channels of a session (TTL_MAX_AMI_CHANNELS)
+#define COLUMNS_RAW_RATE        2048        // Default raw sample rate (SAMPLING_RATE)
+#define COLUMNS_RMS_RATE        20          // Default RMS sample rate (OUTPUT_RATE)
+#define COLUMNS_ALIGN           64          // Alignment of the sections
+#define COLUMNS_BLOCK           16384       // Samples buffered per channel before being written
+
+/**
+  * @brief Signature of function that will be called with the raw samples of a channel as they
+  *         are written (e.g. to build the level of detail pyramid in the same pass)
+  *
+  * @param ctx:         Opaque context meaningful for the function
+  * @param channel:     channel
+  * @param samples:     next samples of the channel
+  * @param count:       number of samples
+  * @return         None
+  */
+typedef void (*ColumnBlock_t) (void *ctx, uint32_t channel, const float *samples, uint32_t count);
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint64_t offset;            // Offset of the section in the file
+    uint64_t count;             // Number of elements
+} ColumnExtent;
+
+typedef struct
+{
+    uint64_t sample;            // Raw sample at which the event occurred
+    uint32_t code;              // Event code
+    float value;                // Event value
+} ColumnEvent;
+
+typedef struct
+{
+    uint64_t raw;               // First raw sample of the second
+    uint64_t rms;               // First RMS sample of the second
+    uint64_t event;             // First event of the second
+} ColumnTimeIndex;
+
+typedef struct
+{
+    char magic[8];              // COLUMNS_MAGIC
+    uint32_t version;           // COLUMNS_VERSION
+    uint32_t headerSize;        // sizeof(ColumnHeader)
+    uint32_t rawRate;           // Raw samples per second
+    uint32_t rmsRate;           // RMS samples per second (nominal when rmsDecimation is set)
+    uint32_t rmsDecimation;     // Raw samples per RMS sample (0: the RMS is sampled at rmsRate)
+    uint32_t channels;          // Number of channels
+    int32_t sensors[COLUMNS_MAX_CHANNELS];  // Sensor ID of each channel
+    ColumnExtent raw[COLUMNS_MAX_CHANNELS]; // Raw samples of each channel (float)
+    ColumnExtent rms[COLUMNS_MAX_CHANNELS]; // RMS samples of each channel (float)
+    ColumnExtent events;        // Events (ColumnEvent), sorted by sample
+    ColumnExtent timeIndex;     // Time index (ColumnTimeIndex), one entry per second
+    uint64_t fileSize;          // Size of the file
+} ColumnHeader;
+#pragma pack(pop)
+
+typedef struct
+{
+    uint32_t channels;          // Number of channels
+    uint32_t rawRate;           // Raw samples per second
+    uint32_t rmsRate;           // RMS samples per second (nominal when rmsDecimation is set)
+    uint32_t rmsDecimation;     // Raw samples per RMS sample (0: the RMS is sampled at rmsRate)
+    uint64_t rawCount;          // Raw samples per channel
+    uint64_t rmsCount;          // RMS samples per channel
+    uint64_t eventCount;        // Number of events
+    int32_t sensors[COLUMNS_MAX_CHANNELS];  // Sensor ID of each channel
+} ColumnLayout;
+
+
+class ColumnWriter
+{
+public:
+    ColumnWriter();
+    virtual ~ColumnWriter();
+
+    /**
+    * @brief create: start a columnar file. The sizes of the layout are reserved: the samples
+    *           are written at their place as they come, without being held in memory.
+    *
+    * @param path:      file (written under a temporary name until finish())
+    * @param layout:    channels, rates and number of samples and events
+    * @return ERR_OK or an error
+    */
+    int create(const char *path, const ColumnLayout &layout);
+
+    /**
+    * @brief setRawSink: give the raw samples of each channel to a function as they are written
+    *
+    * @param fnct:      function receiving the samples (NULL: none)
+    * @param ctx:       opaque context value for that function
+    * @return None.
+    */
+    void setRawSink(ColumnBlock_t fnct, void *ctx)                      { sinkFnct = fnct; sinkCtx = ctx; }
+
+    /**
+    * @brief appendRaw: add raw samples
+    *
+    * @param frames:    frames of layout.channels values (one per channel)
+    * @param count:     number of frames
+    * @return ERR_OK, or an error (more samples than the layout)
+    */
+    int appendRaw(const float *frames, uint32_t count);
+
+    /**
+    * @brief appendRms: add RMS samples
+    *
+    * @param frames:    frames of layout.channels values (one per channel)
+    * @param count:     number of frames
+    * @return ERR_OK, or an error (more samples than the layout)
+    */
+    int appendRms(const float *frames, uint32_t count);
+
+    /**
+    * @brief addEvent: add an event
+    *
+    * @param sample:    raw sample at which it occurred
+    * @param code:      event code
+    * @param value:     event value
+    * @return ERR_OK, or an error (more events than the layout)
+    */
+    int addEvent(uint64_t sample, uint32_t code, float value);
+
+    /**
+    * @brief finish: write the events, the time index and the header, and give the file its name
+    *
+    * @return ERR_OK, or an error (samples or events missing, file error): the file is discarded
+    */
+    int finish(void);
+
+    /**
+    * @brief abort: discard the file
+    *
+    * @return None.
+    */
+    void abort(void);
+
+private:
+    typedef struct
+    {
+        std::vector<float> block[COLUMNS_MAX_CHANNELS];   // Samples not written yet, per channel
+        uint64_t written;               // Samples written per channel
+        uint64_t count;                 // Samples expected per channel
+        ColumnExtent *extents;          // Extents of the channels in the header
+    } Stream;
+
+    int append(Stream &stream, const float *frames, uint32_t count);
+    int flushStream(Stream &stream);
+    int writeAt(uint64_t offset, const void *data, size_t len);
+
+    FILE *file;                         // File being written
+    std::string path;                   // Final name of the file
+    std::string tmpPath;                // Temporary name of the file
+    ColumnHeader header;                // Header, completed by finish()
+    Stream raw;                         // Raw samples
+    Stream rms;                         // RMS samples
+    std::vector<ColumnEvent> events;    // Events
+    ColumnBlock_t sinkFnct;             // Function receiving the raw samples
+    void *sinkCtx;                      // Its context
+};
+
+
+class MappedFile
+{
+public:
+    MappedFile();
+    virtual ~MappedFile();
+
+    /**
+    * @brief open: map a file in memory (read only)
+    *
+    * @param path:      file
+    * @param minSize:   size under which the file is rejected (its header)
+    * @return ERR_OK, ERR_FILE_READ or ERR_FILE_FORMAT (shorter than minSize)
+    */
+    int open(const char *path, uint64_t minSize);
+
+    /**
+    * @brief close: unmap the file
+    *
+    * @return None.
+    */
+    void close(void);
+
+    /**
+    * @brief valid: check that a section lies in the file
+    *
+    * @param extent:    section
+    * @param elementSize: size of its elements
+    * @param minOffset: offset under which the section is rejected (the header)
+    * @return true when the section is inside the file
+    */
+    bool valid(const ColumnExtent &extent, size_t elementSize, uint64_t minOffset);
+
+    const uint8_t *data(void)                                           { return base; }
+    uint64_t size(void)                                                 { return length; }
+
+private:
+    const uint8_t *base;                // Mapping of the file
+    uint64_t length;                    // Size of the mapping
+#ifdef _WIN32
+    void *fileHandle;                   // HANDLE of the file
+    void *mapHandle;                    // HANDLE of the mapping
+#endif
+};
+
+
+class ColumnFile
+{
+public:
+    ColumnFile();
+    virtual ~ColumnFile();
+
+    /**
+    * @brief open: map a columnar file in memory (read only)
+    *
+    * @param path:      file
+    * @return ERR_OK, or an error (missing file, not a columnar file, truncated)
+    */
+    int open(const char *path);
+
+    /**
+    * @brief close: unmap the file
+    *
+    * @return None.
+    */
+    void close(void);
+
+    const ColumnHeader &info(void)                                      { return *header; }
+    double durationSec(void)                                            { return (double)header->raw[0].count / header->rawRate; }
+    double rmsRateHz(void);             // Actual RMS samples per second
+
+    /**
+    * @brief raw: raw samples of a channel in a time range, pointer into the mapping
+    *
+    * @param channel:   channel
+    * @param fromSec:   start of the range (seconds from the start of the session)
+    * @param toSec:     end of the range (excluded)
+    * @param count:     receives the number of samples
+    * @param first:     receives the index of the first sample (optional)
+    * @return The samples, NULL when the range or the channel is empty
+    */
+    const float *raw(uint32_t channel, double fromSec, double toSec, uint64_t *count, uint64_t *first = NULL);
+
+    /**
+    * @brief rms: RMS samples of a channel in a time range, pointer into the mapping
+    *
+    * @return The samples, NULL when the range or the channel is empty (see raw())
+    */
+    const float *rms(uint32_t channel, double fromSec, double toSec, uint64_t *count, uint64_t *first = NULL);
+
+    /**
+    * @brief events: events of a time range, pointer into the mapping
+    *
+    * @param fromSec:   start of the range (seconds from the start of the session)
+    * @param toSec:     end of the range (excluded)
+    * @param count:     receives the number of events
+    * @return The events, NULL when none
+    */
+    const ColumnEvent *events(double fromSec, double toSec, uint64_t *count);
+
+private:
+    const float *range(const ColumnExtent &extent, double rate, double fromSec, double toSec, uint64_t *count, uint64_t *first);
+
+    MappedFile map;                     // Mapping of the file
+    const ColumnHeader *header;         // Header, in the mapping
+};
+
+#endif // _SESSIONCOLUMNS_H
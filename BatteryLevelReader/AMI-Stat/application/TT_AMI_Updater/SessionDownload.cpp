@@ -0,0 +1,269 @@
+/*
+* SessionDownload.cpp : This file contains the class downloading the sessions stored in a device.
+*
+*   In a nutshell, this class implements:
+*       - the download of every stored session of a device, one file per session
+*       - the batches streamed to disk as they arrive, in order, through a BatchWriter
+*       - the retry of the failed batches one by one while the session goes on
+*       - the statistics of the download (bytes, batches, retries, duration)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "SessionDownload.h"
+#include "ErrCodes.h"
+
+/**
+* @brief ctor: class constructor
+*
+* @param source:    device holding the sessions
+* @param clock:     clock of the timeouts
+* @return None.
+*/
+SessionDownloader::SessionDownloader(IStoredSessions *_source, IClock *_clock)
+: source(_source)
+, clock(_clock)
+, idleTimeoutMs(DOWNLOAD_IDLE_TIMEOUT_MS)
+, retryTimeoutMs(DOWNLOAD_RETRY_TIMEOUT_MS)
+, nextBatch(0)
+, scanned(0)
+, received(0)
+, receivedBytes(0)
+, lastBatchMs(0)
+, lost(false)
+, active(false)
+{
+}
+
+void SessionDownloader::setTimeouts(uint32_t idleMs, uint32_t retryMs)
+{
+    idleTimeoutMs = idleMs;
+    retryTimeoutMs = retryMs;
+}
+
+/**
+* @brief run: download every stored session
+*
+* @param folder:    folder receiving the files ("<label>_<index>.ami")
+* @param stats:     receives the statistics
+* @return ERR_OK, or the error that prevented the sessions from being listed
+*/
+int SessionDownloader::run(const char *folder, DownloadStats *stats)
+{
+    int64_t startMs = clock->nowMs();
+    uint32_t writtenBefore = writer.filesWritten();
+    uint32_t attempted = 0;
+    uint16_t count = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    sessionErrors.clear();
+    int err = source->count(&count);
+    if (err != ERR_OK)      return err;
+
+    for (uint16_t index = 0; index < count; index++)
+    {
+        StoredSessionInfo info;
+        if ((source->info(index, &info) == ERR_OK) && info.deleted)
+        {
+            stats->skipped++;
+            continue;
+        }
+
+        char path[DOWNLOAD_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s_%03u" DOWNLOAD_FILE_EXT, folder, source->label(), index);
+        err = download(index, path, stats);
+        attempted++;
+        if (err == ERR_DOWNLOAD_LOST)
+        {
+            char text[32];
+            snprintf(text, sizeof(text), "%d", DOWNLOAD_BATCH_RETRIES);
+            sessionErrors.push_back(std::string(path) + ": batches still missing after " + text + " retries");
+        }
+        else if (err != ERR_OK)
+        {
+            char text[48];
+            snprintf(text, sizeof(text), ": device error (%d)", err);
+            sessionErrors.push_back(path + std::string(text));
+        }
+    }
+
+    writer.flush();                             // the sessions count once on disk
+    writer.takeErrors(&sessionErrors);
+    stats->sessions = writer.filesWritten() - writtenBefore;
+    stats->failed = attempted - stats->sessions;
+    stats->durationMs = clock->nowMs() - startMs;
+    return ERR_OK;
+}
+
+/**
+* @brief download: download one session
+*
+* @param index:     session index
+* @param path:      file receiving the session
+* @param stats:     statistics, updated
+* @return ERR_OK or an error (ERR_DOWNLOAD_LOST: batches still missing after the retries)
+*/
+int SessionDownloader::download(uint16_t index, const char *path, DownloadStats *stats)
+{
+    std::string tmpPath = std::string(path) + ".part";
+    uint32_t batchCount = 0;
+    bool done = false;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        state.clear();
+        tries.clear();
+        requestedMs.clear();
+        parked.clear();
+        toRetry.clear();
+        nextBatch = 0;
+        scanned = 0;
+        received = 0;
+        receivedBytes = 0;
+        lastBatchMs = clock->nowMs();
+        lost = false;
+        active = true;
+    }
+
+    writer.open(tmpPath.c_str());
+    int err = source->start(index, batchEntry, this, &batchCount);
+
+    while ((err == ERR_OK) && (done == false))
+    {
+        std::vector<uint32_t> retry;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (state.size() < batchCount)
+            {
+                state.resize(batchCount, BATCH_MISSING);
+                tries.resize(batchCount, 0);
+                requestedMs.resize(batchCount, 0);
+            }
+
+            int64_t now = clock->nowMs();
+            if (now - lastBatchMs >= idleTimeoutMs)                 // device silent: request what is missing
+            {
+                for (uint32_t b = nextBatch; b < batchCount; b++)
+                {
+                    if (state[b] != BATCH_RECEIVED)     requestAgain(b);
+                }
+                lastBatchMs = now;
+            }
+            else
+            {
+                for (uint32_t b = nextBatch; b < scanned; b++)     // the requests lost too
+                {
+                    if ((state[b] == BATCH_REQUESTED) && (now - requestedMs[b] >= retryTimeoutMs))    requestAgain(b);
+                }
+            }
+
+            if (lost)                               err = ERR_DOWNLOAD_LOST;
+            else if (nextBatch >= batchCount)       done = true;
+            retry.swap(toRetry);
+        }
+
+        for (size_t i = 0; (i < retry.size()) && (err == ERR_OK); i++)
+        {
+            err = source->retry(retry[i]);
+            stats->retries++;
+        }
+        if ((err == ERR_OK) && (done == false))     clock->sleepMs(DOWNLOAD_POLL_MS);
+    }
+    source->end();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        active = false;                         // late batches are ignored
+        stats->batches += received;
+        stats->bytes += receivedBytes;
+        parked.clear();
+    }
+    writer.close((err == ERR_OK) ? path : NULL);
+    return err;
+}
+
+/**
+* @brief batchEntry: entry point of the batches
+*
+* @param ctx:       An abstract pointer to this instance.
+* @return None.
+*/
+void SessionDownloader::batchEntry(void *ctx, uint32_t batch, const uint8_t *data, uint32_t len)
+{
+    static_cast<SessionDownloader *>(ctx)->batchReceived(batch, data, len);
+}
+
+/**
+* @brief batchReceived: write a batch, or park it until the batches before it are received
+*
+* @param batch:     batch number
+* @param data:      content of the batch (NULL or len 0: batch received in error)
+* @param len:       number of bytes
+* @return None.
+*/
+void SessionDownloader::batchReceived(uint32_t batch, const uint8_t *data, uint32_t len)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (active == false)    return;
+    if (batch >= state.size())
+    {
+        state.resize(batch + 1, BATCH_MISSING);
+        tries.resize(batch + 1, 0);
+        requestedMs.resize(batch + 1, 0);
+    }
+    if ((batch < nextBatch) || (state[batch] == BATCH_RECEIVED))    return;    // duplicate
+
+    lastBatchMs = clock->nowMs();
+    if ((data == NULL) || (len == 0))
+    {
+        requestAgain(batch);
+        return;
+    }
+
+    for (uint32_t b = (scanned > nextBatch) ? scanned : nextBatch; b < batch; b++)    // the batches skipped are lost: request them again at once
+    {
+        if (state[b] == BATCH_MISSING)      requestAgain(b);
+    }
+    if (batch >= scanned)   scanned = batch + 1;
+    state[batch] = BATCH_RECEIVED;
+    received++;
+    receivedBytes += len;
+
+    if (batch != nextBatch)
+    {
+        parked[batch].assign(data, data + len);
+        return;
+    }
+
+    writer.write(data, len);
+    nextBatch++;
+    std::map<uint32_t, std::vector<uint8_t> >::iterator it;
+    while ((it = parked.find(nextBatch)) != parked.end())
+    {
+        writer.write(it->second.data(), (uint32_t)it->second.size());
+        parked.erase(it);
+        nextBatch++;
+    }
+}
+
+/**
+* @brief requestAgain: schedule the request of a batch (lock held)
+*
+* @param batch:     batch number
+* @return None.
+*/
+void SessionDownloader::requestAgain(uint32_t batch)
+{
+    if (tries[batch] >= DOWNLOAD_BATCH_RETRIES)
+    {
+        lost = true;
+        return;
+    }
+    tries[batch]++;
+    state[batch] = BATCH_REQUESTED;
+    requestedMs[batch] = clock->nowMs();
+    toRetry.push_back(batch);
+}
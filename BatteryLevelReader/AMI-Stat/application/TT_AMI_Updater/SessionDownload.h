@@ -0,0 +1,201 @@
+/*
+* SessionDownload.h : This file contains the class downloading the sessions stored in a device.
+*
+*   In a nutshell, this class implements:
+*       - the download of every stored session of a device, one file per session
+*       - the batches streamed to disk as they arrive, in order, through a BatchWriter
+*       - the retry of the failed batches one by one while the session goes on: a batch that
+*           arrives empty or is skipped (a later batch arrives first) is requested again at once,
+*           a batch requested again and still missing after the retry timeout is requested
+*           again, and the batches still missing when the device stays silent for the idle
+*           timeout are requested again, up to DOWNLOAD_BATCH_RETRIES times each. The timeouts
+*           suit a Bluetooth link by default (setTimeouts: a faster source, larger batches...)
+*       - the statistics of the download (bytes, batches, retries, duration), and the cause of
+*           each session that failed (errors())
+*
+*   The device is reached through IStoredSessions: the AMI SDK in the tools (SdkSessions), a
+*   simulated device in the benchmarks. The batches may be delivered on any thread.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SESSIONDOWNLOAD_H
+#define _SESSIONDOWNLOAD_H
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "BatchWriter.h"
+#include "DeadlineClock.h"
+
+#define DOWNLOAD_IDLE_TIMEOUT_MS    2000    // No batch for that long: the missing batches are requested again
+#define DOWNLOAD_RETRY_TIMEOUT_MS   1000    // A batch requested again and not received for that long is requested again
+#define DOWNLOAD_BATCH_RETRIES      5       // Max number of times a batch is requested again
+#define DOWNLOAD_POLL_MS            2       // Period of the checks of the download progress
+#define DOWNLOAD_PATH_MAX           512     // Max length of the path of a session file
+#define DOWNLOAD_FILE_EXT           ".ami"  // Extension of the session files
+
+/**
+  * @brief Signature of function that will be called for each batch received
+  *
+  * @param ctx:         Opaque context meaningful for the function
+  * @param batch:       batch number, from 0
+  * @param data:        content of the batch (NULL or len 0: batch received in error)
+  * @param len:         number of bytes
+  * @return         None
+  */
+typedef void (*StoredBatch_t) (void *ctx, uint32_t batch, const uint8_t *data, uint32_t len);
+
+typedef struct
+{
+    uint32_t size;              // Session size in bytes (0: unknown)
+    bool deleted;               // Session deleted, not downloaded
+} StoredSessionInfo;
+
+class IStoredSessions
+{
+public:
+    virtual ~IStoredSessions() {}
+
+    /**
+    * @brief label: name of the device, used in the names of the files
+    */
+    virtual const char *label(void) = 0;
+
+    /**
+    * @brief count: number of sessions stored
+    *
+    * @return ERR_OK or an error
+    */
+    virtual int count(uint16_t *count) = 0;
+
+    /**
+    * @brief info: description of a stored session
+    *
+    * @return ERR_OK or an error
+    */
+    virtual int info(uint16_t index, StoredSessionInfo *info) = 0;
+
+    /**
+    * @brief start: start the download of a session. The batches are given to fnct, possibly
+    *           before start() returns.
+    *
+    * @param index:     session index
+    * @param fnct:      function receiving the batches
+    * @param ctx:       opaque context value for that function
+    * @param batchCount: receives the number of batches of the session
+    * @return ERR_OK or an error
+    */
+    virtual int start(uint16_t index, StoredBatch_t fnct, void *ctx, uint32_t *batchCount) = 0;
+
+    /**
+    * @brief retry: request a batch of the session being downloaded again
+    *
+    * @return ERR_OK or an error
+    */
+    virtual int retry(uint32_t batch) = 0;
+
+    /**
+    * @brief end: terminate the download of the session (complete or not)
+    *
+    * @return ERR_OK or an error
+    */
+    virtual int end(void) = 0;
+};
+
+typedef struct
+{
+    uint32_t sessions;          // Sessions downloaded
+    uint32_t failed;            // Sessions given up
+    uint32_t skipped;           // Sessions deleted
+    uint64_t bytes;             // Bytes received
+    uint32_t batches;           // Batches received
+    uint32_t retries;           // Batches requested again
+    int64_t durationMs;         // Duration of the download
+} DownloadStats;
+
+
+class SessionDownloader
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param source:    device holding the sessions
+    * @param clock:     clock of the timeouts
+    * @return None.
+    */
+    SessionDownloader(IStoredSessions *source, IClock *clock = systemClock());
+
+    /**
+    * @brief setTimeouts: times after which the missing batches are requested again
+    *
+    * @param idleMs:    device silent that long: the missing batches (DOWNLOAD_IDLE_TIMEOUT_MS)
+    * @param retryMs:   batch requested again and not received that long (DOWNLOAD_RETRY_TIMEOUT_MS)
+    * @return None.
+    */
+    void setTimeouts(uint32_t idleMs, uint32_t retryMs);
+
+    /**
+    * @brief run: download every stored session
+    *
+    * @param folder:    folder receiving the files ("<label>_<index>.ami")
+    * @param stats:     receives the statistics
+    * @return ERR_OK, or the error that prevented the sessions from being listed (the sessions
+    *           that fail are counted in stats)
+    */
+    int run(const char *folder, DownloadStats *stats);
+
+    /**
+    * @brief download: download one session
+    *
+    * @param index:     session index
+    * @param path:      file receiving the session
+    * @param stats:     statistics, updated
+    * @return ERR_OK or an error (ERR_DOWNLOAD_LOST: batches still missing after the retries)
+    */
+    int download(uint16_t index, const char *path, DownloadStats *stats);
+
+    /**
+    * @brief errors: the sessions that failed in the last run() and why, e.g.
+    *           "<path>: cannot create the file: No such file or directory"
+    */
+    const std::vector<std::string> &errors(void)                        { return sessionErrors; }
+
+private:
+    typedef enum
+    {
+        BATCH_MISSING,
+        BATCH_REQUESTED,                // Requested again, not received yet
+        BATCH_RECEIVED,
+    } BatchState;
+
+    static void batchEntry(void *ctx, uint32_t batch, const uint8_t *data, uint32_t len);
+    void batchReceived(uint32_t batch, const uint8_t *data, uint32_t len);
+    void requestAgain(uint32_t batch);
+
+    IStoredSessions *source;            // Device holding the sessions
+    IClock *clock;                      // Clock of the timeouts
+    uint32_t idleTimeoutMs;             // Device silent that long: the missing batches are requested again
+    uint32_t retryTimeoutMs;            // A batch requested again and not received that long is requested again
+    BatchWriter writer;                 // Write-behind of the files
+    std::vector<std::string> sessionErrors;     // Sessions that failed in the last run and why
+
+    std::mutex lock;                    // Protects everything below (the batches may come on another thread)
+    std::vector<uint8_t> state;         // BatchState of each batch
+    std::vector<uint8_t> tries;         // Number of times each batch was requested again
+    std::vector<int64_t> requestedMs;   // Clock time of the last request of each batch
+    std::map<uint32_t, std::vector<uint8_t> > parked;  // Batches received ahead of a missing one
+    std::vector<uint32_t> toRetry;      // Batches to request again
+    uint32_t nextBatch;                 // Next batch to write
+    uint32_t scanned;                   // The batches before it were checked for gaps
+    uint32_t received;                  // Batches received for this session
+    uint64_t receivedBytes;             // Bytes received for this session
+    int64_t lastBatchMs;                // Clock time of the last batch received
+    bool lost;                          // A batch could not be recovered
+    bool active;                        // A session is being downloaded
+};
+
+#endif // _SESSIONDOWNLOAD_H
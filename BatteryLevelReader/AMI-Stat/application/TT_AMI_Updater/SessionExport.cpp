@@ -0,0 +1,320 @@
+/*
+* SessionExport.cpp : This file contains the class exporting a folder of recorded sessions in
+*               parallel.
+*
+*   In a nutshell, this class implements:
+*       - the skip of the sessions already exported and up to date (index file of the output folder)
+*       - the export of the other sessions by a pool of worker threads
+*       - the aggregate progress and throughput, reported periodically to the caller
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <thread>
+#include "SessionExport.h"
+#include "ErrCodes.h"
+
+#define EXPORT_FINGERPRINT_PRIME    0x100000001B3ULL    // FNV-1a prime
+
+/**
+* @brief exportFingerprint: FNV-1a hash of bytes, to fingerprint the session headers
+*
+* @param data:      bytes
+* @param len:       number of bytes
+* @param hash:      hash of the bytes before (to chain fields), or EXPORT_FINGERPRINT_SEED
+* @return The hash
+*/
+uint64_t exportFingerprint(const void *data, size_t len, uint64_t hash)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= p[i];
+        hash *= EXPORT_FINGERPRINT_PRIME;
+    }
+    return hash;
+}
+
+/**
+* @brief exportFileTime: modification time of a file
+*
+* @param path:      file
+* @param size:      receives the size of the file (optional)
+* @return Time in seconds since the epoch, -1 if the file does not exist
+*/
+int64_t exportFileTime(const char *path, uint64_t *size)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0)    return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)       return -1;
+#endif
+    if (size != NULL)       *size = (uint64_t)st.st_size;
+    return (int64_t)st.st_mtime;
+}
+
+/**
+* @brief ctor: class constructor
+*
+* @param exporter:  access to the sessions
+* @param workers:   number of worker threads (0: one per core)
+* @param clock:     clock of the durations
+* @return None.
+*/
+BatchExporter::BatchExporter(ISessionExporter *_exporter, unsigned _workers, IClock *_clock)
+: exporter(_exporter)
+, workers(_workers)
+, clock(_clock)
+, force(false)
+, startMs(0)
+, nextJob(0)
+, jobsDone(0)
+, jobBytes(0)
+{
+    if (workers == 0)       workers = std::thread::hardware_concurrency();
+    if (workers == 0)       workers = 1;
+    if (workers > EXPORT_MAX_WORKERS)   workers = EXPORT_MAX_WORKERS;
+    memset(&totals, 0, sizeof(totals));
+}
+
+/**
+* @brief run: export the sessions of a folder
+*
+* @param srcFolder: folder of the sessions
+* @param dstFolder: output folder (must exist)
+* @param stats:     receives the statistics
+* @param fnct:      function receiving the progress every EXPORT_REPORT_MS (may be NULL)
+* @param ctx:       opaque context value for that function
+* @return ERR_OK, or the error that prevented the sessions from being listed
+*/
+int BatchExporter::run(const char *srcFolder, const char *_dstFolder, ExportStats *stats, ExportReport_t fnct, void *ctx)
+{
+    std::vector<ExportSource> sources;
+    double percent;
+
+    startMs = clock->nowMs();
+    dstFolder = _dstFolder;
+    memset(&totals, 0, sizeof(totals));
+    memset(stats, 0, sizeof(*stats));
+    jobs.clear();
+    jobBytes = 0;
+
+    int err = exporter->list(srcFolder, &sources);
+    if (err != ERR_OK)      return err;
+
+    loadIndex();
+    totals.files = (uint32_t)sources.size();
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if ((force == false) && upToDate(sources[i]))
+        {
+            totals.skipped++;
+            continue;
+        }
+        jobs.push_back(sources[i]);
+        jobBytes += sources[i].size;
+    }
+
+    progress.reset(new std::atomic<int>[jobs.size() + 1]);
+    for (size_t i = 0; i < jobs.size(); i++)    progress[i] = 0;
+    nextJob = 0;
+    jobsDone = 0;
+
+    std::vector<std::thread> pool;
+    unsigned count = (jobs.size() < workers) ? (unsigned)jobs.size() : workers;
+    for (unsigned w = 0; w < count; w++)        pool.push_back(std::thread(workerEntry, this));
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            bool done = finished.wait_for(guard, std::chrono::milliseconds(EXPORT_REPORT_MS),
+                                          [this]() { return jobsDone >= jobs.size(); });
+            if (done)       break;
+        }
+        if (fnct != NULL)
+        {
+            snapshot(stats, &percent);
+            fnct(ctx, stats, percent);
+        }
+    }
+    for (size_t w = 0; w < pool.size(); w++)    pool[w].join();
+
+    saveIndex();
+    snapshot(stats, &percent);
+    if (fnct != NULL)       fnct(ctx, stats, percent);
+    return ERR_OK;
+}
+
+/**
+* @brief workerEntry: worker thread entry point
+*
+* @param self:      instance
+* @return None.
+*/
+void BatchExporter::workerEntry(BatchExporter *self)
+{
+    self->workerFunc();
+}
+
+/**
+* @brief workerFunc: export jobs until none is left
+*
+* @return None.
+*/
+void BatchExporter::workerFunc(void)
+{
+    size_t job;
+
+    while ((job = nextJob++) < jobs.size())
+    {
+        const ExportSource &source = jobs[job];
+        std::string path = dstFolder + "/" + source.name;
+        std::string tmpPath = path + ".part";
+        ProgressCtx pctx = { this, job };
+        uint32_t samples = 0;
+
+        int err = exporter->exportFile(source, tmpPath.c_str(), progressEntry, &pctx, &samples);
+        if (err == ERR_OK)
+        {
+            remove(path.c_str());                   // rename() does not replace an existing file on Windows
+            if (rename(tmpPath.c_str(), path.c_str()) != 0)     err = ERR_FILE_WRITE;
+        }
+        if (err != ERR_OK)      remove(tmpPath.c_str());
+        progress[job] = 100;
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (err == ERR_OK)
+            {
+                IndexEntry entry = { source.fingerprint, source.mtime };
+                index[source.name] = entry;
+                totals.exported++;
+                totals.bytes += source.size;
+                totals.samples += samples;
+            }
+            else
+            {
+                index.erase(source.name);
+                totals.failed++;
+            }
+            jobsDone++;
+            finished.notify_one();
+        }
+    }
+}
+
+/**
+* @brief progressEntry: progress of an export
+*
+* @param ctx:       An abstract pointer to a ProgressCtx.
+* @param percent:   progress of the file, 0..100
+* @return None.
+*/
+void BatchExporter::progressEntry(void *ctx, int percent)
+{
+    ProgressCtx *pctx = static_cast<ProgressCtx *>(ctx);
+    if (percent < 0)        percent = 0;
+    if (percent > 100)      percent = 100;
+    pctx->self->progress[pctx->job] = percent;
+}
+
+/**
+* @brief upToDate: check whether the output of a session is up to date
+*
+* @param source:    session
+* @return true when exported from the same header and session file time, and still there
+*/
+bool BatchExporter::upToDate(const ExportSource &source)
+{
+    std::map<std::string, IndexEntry>::iterator it = index.find(source.name);
+    if (it == index.end())                          return false;
+    if ((it->second.fingerprint != source.fingerprint) || (it->second.mtime != source.mtime))  return false;
+
+    std::string path = dstFolder + "/" + source.name;
+    return (exportFileTime(path.c_str()) >= 0);
+}
+
+/**
+* @brief loadIndex: read the index of the output folder
+*
+* @return None.
+*/
+void BatchExporter::loadIndex(void)
+{
+    std::string path = dstFolder + "/" EXPORT_INDEX_FILE;
+    char line[EXPORT_PATH_MAX + 64];
+
+    index.clear();
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == NULL)       return;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long fingerprint;
+        long long mtime;
+        int nameAt = 0;
+
+        if (line[0] == '#')     continue;
+        line[strcspn(line, "\r\n")] = 0;
+        if ((sscanf(line, "%llx %lld %n", &fingerprint, &mtime, &nameAt) < 2) || (nameAt == 0) || (line[nameAt] == 0))  continue;
+
+        IndexEntry entry = { (uint64_t)fingerprint, (int64_t)mtime };
+        index[line + nameAt] = entry;
+    }
+    fclose(file);
+}
+
+/**
+* @brief saveIndex: write the index of the output folder (under a temporary name, then renamed)
+*
+* @return None.
+*/
+void BatchExporter::saveIndex(void)
+{
+    std::string path = dstFolder + "/" EXPORT_INDEX_FILE;
+    std::string tmpPath = path + ".part";
+
+    FILE *file = fopen(tmpPath.c_str(), "w");
+    if (file == NULL)       return;
+
+    fprintf(file, "# AMI session export index: <header fingerprint> <session mtime> <output file>\n");
+    for (std::map<std::string, IndexEntry>::iterator it = index.begin(); it != index.end(); ++it)
+    {
+        fprintf(file, "%016llx %lld %s\n", (unsigned long long)it->second.fingerprint, (long long)it->second.mtime, it->first.c_str());
+    }
+    if (fclose(file) != 0)
+    {
+        remove(tmpPath.c_str());
+        return;
+    }
+    remove(path.c_str());
+    rename(tmpPath.c_str(), path.c_str());
+}
+
+/**
+* @brief snapshot: statistics and progress so far
+*
+* @param stats:     receives the statistics
+* @param percent:   receives the progress of the exports to do, weighted by the session sizes
+* @return None.
+*/
+void BatchExporter::snapshot(ExportStats *stats, double *percent)
+{
+    double done = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        done += (double)(jobs[i].size + 1) * progress[i];      // +1: empty sessions count too
+    }
+    *percent = jobs.empty() ? 100.0 : done / (double)(jobBytes + jobs.size());
+
+    std::lock_guard<std::mutex> guard(lock);
+    *stats = totals;
+    stats->durationMs = clock->nowMs() - startMs;
+}
@@ -0,0 +1,202 @@
+/*
+* SessionExport.h : This file contains the class exporting a folder of recorded sessions in
+*               parallel.
+*
+*   In a nutshell, this class implements:
+*       - the listing of the sessions of a folder (ISessionExporter::list)
+*       - the skip of the sessions already exported and up to date: an index file in the output
+*           folder (EXPORT_INDEX_FILE) keeps, per output file, the fingerprint of the session header
+*           and the modification time of the session it was exported from
+*       - the export of the other sessions by a pool of worker threads (one per core by default),
+*           each file exported under a temporary name and renamed once complete
+*       - the aggregate progress (weighted by the size of the sessions) and throughput, reported
+*           periodically to the caller
+*
+*   The sessions are reached through ISessionExporter: the AMI SDK in the tools (SdkExporter), a
+*   simulated exporter otherwise.
+*
+*   Index file: one "<fingerprint> <source mtime> <output name>" line per output file, '#' starts
+*   a comment.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SESSIONEXPORT_H
+#define _SESSIONEXPORT_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "DeadlineClock.h"
+
+#define EXPORT_INDEX_FILE           "export.idx"    // Index of the files exported, in the output folder
+#define EXPORT_MAX_WORKERS          64              // Max number of worker threads
+#define EXPORT_REPORT_MS            500             // Period of the progress reports
+#define EXPORT_PATH_MAX             512             // Max length of a path
+#define EXPORT_FINGERPRINT_SEED     0xCBF29CE484222325ULL  // FNV-1a offset basis
+
+/**
+  * @brief Signature of function that will be called with the progress of an export
+  *
+  * @param ctx:         Opaque context meaningful for the function
+  * @param percent:     progress of the file, 0..100
+  * @return         None
+  */
+typedef void (*ExportProgress_t) (void *ctx, int percent);
+
+typedef struct
+{
+    std::string path;           // Session file
+    std::string name;           // Name of the output file, in the output folder
+    uint64_t fingerprint;       // Fingerprint of the session header (exportFingerprint())
+    int64_t mtime;              // Modification time of the session file
+    uint64_t size;              // Size of the session file
+} ExportSource;
+
+class ISessionExporter
+{
+public:
+    virtual ~ISessionExporter() {}
+
+    /**
+    * @brief list: list the sessions of a folder
+    *
+    * @param folder:    folder of the sessions
+    * @param sources:   receives the sessions
+    * @return ERR_OK or an error
+    */
+    virtual int list(const char *folder, std::vector<ExportSource> *sources) = 0;
+
+    /**
+    * @brief exportFile: export one session. Called by many worker threads at once.
+    *
+    * @param source:    session, from list()
+    * @param path:      output file
+    * @param fnct:      function receiving the progress
+    * @param ctx:       opaque context value for that function
+    * @param samples:   receives the number of samples exported
+    * @return ERR_OK or an error
+    */
+    virtual int exportFile(const ExportSource &source, const char *path, ExportProgress_t fnct, void *ctx, uint32_t *samples) = 0;
+};
+
+typedef struct
+{
+    uint32_t files;             // Sessions found
+    uint32_t exported;          // Sessions exported
+    uint32_t skipped;           // Sessions already up to date
+    uint32_t failed;            // Sessions that failed
+    uint64_t bytes;             // Bytes of the sessions exported
+    uint64_t samples;           // Samples exported
+    int64_t durationMs;         // Duration of the export
+} ExportStats;
+
+/**
+  * @brief Signature of function that will be called with the progress of the batch
+  *
+  * @param ctx:         Opaque context meaningful for the function
+  * @param stats:       statistics so far (durationMs: time elapsed)
+  * @param percent:     progress of the exports to do, 0..100
+  * @return         None
+  */
+typedef void (*ExportReport_t) (void *ctx, const ExportStats *stats, double percent);
+
+/**
+* @brief exportFingerprint: FNV-1a hash of bytes, to fingerprint the session headers
+*
+* @param data:      bytes
+* @param len:       number of bytes
+* @param hash:      hash of the bytes before (to chain fields), or EXPORT_FINGERPRINT_SEED
+* @return The hash
+*/
+uint64_t exportFingerprint(const void *data, size_t len, uint64_t hash = EXPORT_FINGERPRINT_SEED);
+
+/**
+* @brief exportFileTime: modification time of a file
+*
+* @param path:      file
+* @param size:      receives the size of the file (optional)
+* @return Time in seconds since the epoch, -1 if the file does not exist
+*/
+int64_t exportFileTime(const char *path, uint64_t *size = NULL);
+
+
+class BatchExporter
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param exporter:  access to the sessions
+    * @param workers:   number of worker threads (0: one per core)
+    * @param clock:     clock of the durations
+    * @return None.
+    */
+    BatchExporter(ISessionExporter *exporter, unsigned workers = 0, IClock *clock = systemClock());
+
+    /**
+    * @brief setForce: export the sessions even when up to date
+    */
+    void setForce(bool force)                                           { this->force = force; }
+
+    unsigned workerCount(void)                                          { return workers; }
+
+    /**
+    * @brief run: export the sessions of a folder
+    *
+    * @param srcFolder: folder of the sessions
+    * @param dstFolder: output folder (must exist)
+    * @param stats:     receives the statistics
+    * @param fnct:      function receiving the progress every EXPORT_REPORT_MS (may be NULL)
+    * @param ctx:       opaque context value for that function
+    * @return ERR_OK, or the error that prevented the sessions from being listed (the sessions
+    *           that fail are counted in stats)
+    */
+    int run(const char *srcFolder, const char *dstFolder, ExportStats *stats, ExportReport_t fnct, void *ctx);
+
+private:
+    typedef struct
+    {
+        uint64_t fingerprint;           // Fingerprint of the session header
+        int64_t mtime;                  // Modification time of the session
+    } IndexEntry;
+
+    typedef struct
+    {
+        BatchExporter *self;
+        size_t job;                     // Index in jobs
+    } ProgressCtx;
+
+    static void workerEntry(BatchExporter *self);
+    void workerFunc(void);
+    static void progressEntry(void *ctx, int percent);
+    bool upToDate(const ExportSource &source);
+    void loadIndex(void);
+    void saveIndex(void);
+    void snapshot(ExportStats *stats, double *percent);
+
+    ISessionExporter *exporter;         // Access to the sessions
+    unsigned workers;                   // Number of worker threads
+    IClock *clock;                      // Clock of the durations
+    bool force;                         // Export even when up to date
+    std::string dstFolder;              // Output folder
+    int64_t startMs;                    // Clock time of the start of run()
+
+    std::vector<ExportSource> jobs;     // Sessions to export
+    std::unique_ptr<std::atomic<int>[]> progress;   // Progress of each job
+    std::atomic<size_t> nextJob;        // Next job to take
+    std::atomic<size_t> jobsDone;       // Jobs completed
+    uint64_t jobBytes;                  // Bytes of the sessions to export
+
+    std::mutex lock;                    // Protects everything below
+    std::condition_variable finished;   // Signaled when a job completes
+    std::map<std::string, IndexEntry> index;    // Index of the output folder, per output name
+    ExportStats totals;                 // Statistics
+};
+
+#endif // _SESSIONEXPORT_H
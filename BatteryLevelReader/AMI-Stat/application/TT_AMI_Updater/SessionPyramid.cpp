@@ -0,0 +1,479 @@
+/*
+* SessionPyramid.cpp : This file contains the classes building the level of detail pyramid of a
+*               columnar session file and drawing a viewport from it.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "SessionPyramid.h"
+#include "ErrCodes.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define PYRAMID_SSE2
+#endif
+
+#if (PYRAMID_BASE_SHIFT < 2)
+#error "PYRAMID_BASE_SHIFT: the level 0 buckets are reduced 4 samples at a time"
+#endif
+
+#define PYRAMID_BASE            (1u << PYRAMID_BASE_SHIFT)  // Raw samples of a level 0 bucket
+
+typedef struct
+{
+    float min;
+    float max;
+    double sum;                 // Sum of the samples
+    uint64_t count;             // Number of samples
+} PyramidFold;
+
+/**
+* @brief alignUp: round an offset up to COLUMNS_ALIGN
+*/
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + COLUMNS_ALIGN - 1) & ~(uint64_t)(COLUMNS_ALIGN - 1);
+}
+
+/**
+* @brief levelSize: number of buckets of a level
+*
+* @param rawCount:  raw samples per channel
+* @param shift:     log2 of the raw samples of a level 0 bucket
+* @param k:         level
+* @return The number of buckets
+*/
+static uint64_t levelSize(uint64_t rawCount, uint32_t shift, uint32_t k)
+{
+    uint64_t n = (rawCount + (1ull << shift) - 1) >> shift;
+    for (uint32_t i = 0; i < k; i++)    n = (n + 1) / 2;
+    return n;
+}
+
+/**
+* @brief reduceBase: min, max and mean of the PYRAMID_BASE samples of a level 0 bucket
+*
+* @param samples:   samples
+* @param bucket:    receives the bucket
+* @return None.
+*/
+static void reduceBase(const float *samples, PyramidBucket *bucket)
+{
+#ifdef PYRAMID_SSE2
+    __m128 lo = _mm_loadu_ps(samples);
+    __m128 hi = lo;
+    __m128 sum = lo;
+    for (uint32_t i = 4; i < PYRAMID_BASE; i += 4)
+    {
+        __m128 v = _mm_loadu_ps(samples + i);
+        lo = _mm_min_ps(lo, v);
+        hi = _mm_max_ps(hi, v);
+        sum = _mm_add_ps(sum, v);
+    }
+    // horizontal reduction of the 4 lanes
+    lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+    lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+    hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+    hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    bucket->min = _mm_cvtss_f32(lo);
+    bucket->max = _mm_cvtss_f32(hi);
+    bucket->mean = _mm_cvtss_f32(sum) / PYRAMID_BASE;
+#else
+    float lo = samples[0];
+    float hi = samples[0];
+    float sum = samples[0];
+    for (uint32_t i = 1; i < PYRAMID_BASE; i++)
+    {
+        if (samples[i] < lo)    lo = samples[i];
+        if (samples[i] > hi)    hi = samples[i];
+        sum += samples[i];
+    }
+    bucket->min = lo;
+    bucket->max = hi;
+    bucket->mean = sum / PYRAMID_BASE;
+#endif
+}
+
+static void foldSample(PyramidFold &fold, float sample)
+{
+    if ((fold.count == 0) || (sample < fold.min))   fold.min = sample;
+    if ((fold.count == 0) || (sample > fold.max))   fold.max = sample;
+    fold.sum += sample;
+    fold.count++;
+}
+
+static void foldBucket(PyramidFold &fold, const PyramidBucket &bucket, uint64_t count)
+{
+    if ((fold.count == 0) || (bucket.min < fold.min))   fold.min = bucket.min;
+    if ((fold.count == 0) || (bucket.max > fold.max))   fold.max = bucket.max;
+    fold.sum += (double)bucket.mean * count;
+    fold.count += count;
+}
+
+/**
+* @brief pyramidPathFor: name of the pyramid file of a columnar file
+*
+* @param columnsPath: columnar file
+* @return The name, COLUMNS_FILE_EXT replaced by (or else followed by) PYRAMID_FILE_EXT
+*/
+std::string pyramidPathFor(const char *columnsPath)
+{
+    std::string path = columnsPath;
+    size_t extLen = strlen(COLUMNS_FILE_EXT);
+    if ((path.size() > extLen) && (path.compare(path.size() - extLen, extLen, COLUMNS_FILE_EXT) == 0))
+    {
+        path.resize(path.size() - extLen);
+    }
+    return path + PYRAMID_FILE_EXT;
+}
+
+
+PyramidBuilder::PyramidBuilder()
+: channels(0)
+, rawRate(0)
+, rawCount(0)
+, levels(0)
+{
+}
+
+/**
+* @brief begin: start a pyramid
+*
+* @param channels:  number of channels
+* @param rawRate:   raw samples per second
+* @param rawCount:  raw samples per channel
+* @return ERR_OK, or ERR_FILE_FORMAT (no or too many channels)
+*/
+int PyramidBuilder::begin(uint32_t _channels, uint32_t _rawRate, uint64_t _rawCount)
+{
+    if ((_channels == 0) || (_channels > COLUMNS_MAX_CHANNELS))     return ERR_FILE_FORMAT;
+
+    channels = _channels;
+    rawRate = _rawRate;
+    rawCount = _rawCount;
+    levels = 1;
+    while ((levels < PYRAMID_MAX_LEVELS) && (levelSize(rawCount, PYRAMID_BASE_SHIFT, levels - 1) > 1))   levels++;
+    if (levelSize(rawCount, PYRAMID_BASE_SHIFT, levels - 1) > 1)   return ERR_FILE_FORMAT;
+
+    for (uint32_t c = 0; c < COLUMNS_MAX_CHANNELS; c++)
+    {
+        for (uint32_t k = 0; k < PYRAMID_MAX_LEVELS; k++)   state[c].levels[k].clear();
+        if (c < channels)   state[c].levels[0].reserve((size_t)levelSize(rawCount, PYRAMID_BASE_SHIFT, 0));
+        state[c].partialCount = 0;
+        state[c].added = 0;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief add: add the next raw samples of a channel
+*
+* @param channel:   channel
+* @param samples:   samples
+* @param count:     number of samples
+* @return None.
+*/
+void PyramidBuilder::add(uint32_t channel, const float *samples, uint32_t count)
+{
+    if (channel >= channels)    return;
+
+    Channel &ch = state[channel];
+    PyramidBucket bucket;
+    uint32_t i = 0;
+
+    ch.added += count;
+    while (i < count)
+    {
+        if ((ch.partialCount == 0) && (i + PYRAMID_BASE <= count))
+        {
+            // whole buckets straight from the samples
+            for (; i + PYRAMID_BASE <= count; i += PYRAMID_BASE)
+            {
+                reduceBase(samples + i, &bucket);
+                ch.levels[0].push_back(bucket);
+            }
+            continue;
+        }
+
+        // bucket straddling two calls
+        float sample = samples[i++];
+        if ((ch.partialCount == 0) || (sample < ch.partial.min))    ch.partial.min = sample;
+        if ((ch.partialCount == 0) || (sample > ch.partial.max))    ch.partial.max = sample;
+        ch.partial.mean = (ch.partialCount == 0) ? sample : ch.partial.mean + sample;
+        if (++ch.partialCount == PYRAMID_BASE)
+        {
+            ch.partial.mean /= PYRAMID_BASE;
+            ch.levels[0].push_back(ch.partial);
+            ch.partialCount = 0;
+        }
+    }
+}
+
+void PyramidBuilder::addEntry(void *ctx, uint32_t channel, const float *samples, uint32_t count)
+{
+    static_cast<PyramidBuilder *>(ctx)->add(channel, samples, count);
+}
+
+/**
+* @brief bucketCount: raw samples of a bucket (the last bucket of a level may be short)
+*
+* @param level:     level
+* @param index:     bucket in the level
+* @return The number of samples
+*/
+uint64_t PyramidBuilder::bucketCount(uint32_t level, uint64_t index)
+{
+    uint64_t size = 1ull << (PYRAMID_BASE_SHIFT + level);
+    uint64_t start = index * size;
+    return (rawCount - start < size) ? rawCount - start : size;
+}
+
+/**
+* @brief buildLevels: build the levels above level 0, each bucket from two buckets below
+*
+* @param channel:   pyramid of the channel
+* @return None.
+*/
+void PyramidBuilder::buildLevels(Channel &channel)
+{
+    for (uint32_t k = 1; k < levels; k++)
+    {
+        const std::vector<PyramidBucket> &below = channel.levels[k - 1];
+        std::vector<PyramidBucket> &level = channel.levels[k];
+
+        level.resize((below.size() + 1) / 2);
+        for (size_t j = 0; j < level.size(); j++)
+        {
+            const PyramidBucket &a = below[2 * j];
+            if (2 * j + 1 >= below.size())
+            {
+                level[j] = a;
+                continue;
+            }
+            const PyramidBucket &b = below[2 * j + 1];
+            uint64_t countA = bucketCount(k - 1, 2 * j);
+            uint64_t countB = bucketCount(k - 1, 2 * j + 1);
+            level[j].min = (a.min < b.min) ? a.min : b.min;
+            level[j].max = (a.max > b.max) ? a.max : b.max;
+            level[j].mean = (float)(((double)a.mean * countA + (double)b.mean * countB) / (double)(countA + countB));
+        }
+    }
+}
+
+/**
+* @brief write: build the levels and write the file (under a temporary name, then renamed)
+*
+* @param path:      file
+* @return ERR_OK, or an error (samples missing, file error)
+*/
+int PyramidBuilder::write(const char *path)
+{
+    PyramidHeader header;
+    static const uint8_t padding[COLUMNS_ALIGN] = { 0 };
+
+    if (channels == 0)      return ERR_FILE_FORMAT;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PYRAMID_MAGIC, sizeof(header.magic));
+    header.version = PYRAMID_VERSION;
+    header.headerSize = sizeof(PyramidHeader);
+    header.channels = channels;
+    header.rawRate = rawRate;
+    header.baseShift = PYRAMID_BASE_SHIFT;
+    header.levels = levels;
+    header.rawCount = rawCount;
+
+    uint64_t offset = alignUp(sizeof(header));
+    for (uint32_t c = 0; c < channels; c++)
+    {
+        Channel &ch = state[c];
+        if (ch.added != rawCount)       return ERR_FILE_FORMAT;
+        if (ch.partialCount > 0)
+        {
+            ch.partial.mean /= ch.partialCount;
+            ch.levels[0].push_back(ch.partial);
+            ch.partialCount = 0;
+        }
+        buildLevels(ch);
+        for (uint32_t k = 0; k < levels; k++)
+        {
+            header.level[c][k].offset = offset;
+            header.level[c][k].count = ch.levels[k].size();
+            offset = alignUp(offset + ch.levels[k].size() * sizeof(PyramidBucket));
+        }
+    }
+
+    std::string tmpPath = std::string(path) + ".part";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == NULL)       return ERR_FILE_WRITE;
+
+    bool ok = (fwrite(&header, sizeof(header), 1, file) == 1);
+    uint64_t written = sizeof(header);
+    for (uint32_t c = 0; ok && (c < channels); c++)
+    {
+        for (uint32_t k = 0; ok && (k < levels); k++)
+        {
+            const std::vector<PyramidBucket> &level = state[c].levels[k];
+            size_t pad = (size_t)(header.level[c][k].offset - written);
+            ok = (fwrite(padding, 1, pad, file) == pad) &&
+                 (level.empty() || (fwrite(level.data(), sizeof(PyramidBucket), level.size(), file) == level.size()));
+            written += pad + level.size() * sizeof(PyramidBucket);
+        }
+    }
+    if ((fclose(file) != 0) || (ok == false))
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    remove(path);                                       // rename() does not replace an existing file on Windows
+    if (rename(tmpPath.c_str(), path) != 0)
+    {
+        remove(tmpPath.c_str());
+        return ERR_FILE_WRITE;
+    }
+    return ERR_OK;
+}
+
+
+PyramidFile::PyramidFile()
+: header(NULL)
+{
+}
+
+PyramidFile::~PyramidFile()
+{
+    close();
+}
+
+/**
+* @brief open: map a pyramid file in memory (read only)
+*
+* @param path:      file
+* @param columns:   header of the columnar file it was built from
+* @return ERR_OK, or an error (missing file, not a pyramid, not built from that columnar file)
+*/
+int PyramidFile::open(const char *path, const ColumnHeader &columns)
+{
+    close();
+    int err = map.open(path, sizeof(PyramidHeader));
+    if (err != ERR_OK)      return err;
+
+    header = (const PyramidHeader *)map.data();
+    bool ok = (memcmp(header->magic, PYRAMID_MAGIC, sizeof(header->magic)) == 0) && (header->version == PYRAMID_VERSION) &&
+              (header->headerSize == sizeof(PyramidHeader)) && (header->baseShift >= 2) && (header->baseShift <= 24) &&
+              (header->levels > 0) && (header->levels <= PYRAMID_MAX_LEVELS) &&
+              (header->channels == columns.channels) && (header->rawRate == columns.rawRate) && (header->rawCount == columns.raw[0].count);
+    // the viewport indexes the levels without checks: each must hold exactly its buckets, the last one at most one
+    ok = ok && (levelSize(header->rawCount, header->baseShift, header->levels - 1) <= 1);
+    for (uint32_t c = 0; ok && (c < header->channels); c++)
+    {
+        for (uint32_t k = 0; ok && (k < header->levels); k++)
+        {
+            ok = map.valid(header->level[c][k], sizeof(PyramidBucket), sizeof(PyramidHeader)) &&
+                 (header->level[c][k].count == levelSize(header->rawCount, header->baseShift, k));
+        }
+    }
+    if (ok == false)
+    {
+        close();
+        return ERR_FILE_FORMAT;
+    }
+    return ERR_OK;
+}
+
+/**
+* @brief close: unmap the file
+*
+* @return None.
+*/
+void PyramidFile::close(void)
+{
+    map.close();
+    header = NULL;
+}
+
+/**
+* @brief viewport: min, max and mean of each pixel of a time range of a channel
+*
+* @param columns:   columnar file the pyramid was built from (raw samples of the edges)
+* @param channel:   channel
+* @param fromSec:   start of the range (seconds from the start of the session)
+* @param toSec:     end of the range (excluded)
+* @param pixels:    width of the viewport
+* @param out:       receives the pixels (pixels buckets)
+* @return Number of pixels filled: pixels, or fewer when the range holds fewer samples (0: empty)
+*/
+uint32_t PyramidFile::viewport(ColumnFile &columns, uint32_t channel, double fromSec, double toSec, uint32_t pixels, PyramidBucket *out)
+{
+    uint64_t count = 0;
+    uint64_t first = 0;
+
+    if ((header == NULL) || (channel >= header->channels) || (pixels == 0))     return 0;
+    const float *samples = columns.raw(channel, fromSec, toSec, &count, &first);
+    if (samples == NULL)    return 0;
+
+    if (pixels > count)     pixels = (uint32_t)count;
+    uint64_t step = count / pixels;
+    uint64_t extra = count % pixels;
+    for (uint32_t p = 0; p < pixels; p++)
+    {
+        uint64_t lo = first + step * p + extra * p / pixels;
+        uint64_t hi = first + step * (p + 1) + extra * (p + 1) / pixels;
+        fold(channel, samples - first, lo, hi, &out[p]);
+    }
+    return pixels;
+}
+
+/**
+* @brief fold: min, max and mean of a range of raw samples: the raw samples up to the first and
+*           from the last level 0 bucket edge, and in between the fewest buckets covering it,
+*           at most two per level
+*
+* @param channel:   channel
+* @param raw:       raw samples of the channel
+* @param lo:        first sample of the range
+* @param hi:        end of the range (excluded, lo < hi)
+* @param out:       receives the result
+* @return None.
+*/
+void PyramidFile::fold(uint32_t channel, const float *raw, uint64_t lo, uint64_t hi, PyramidBucket *out)
+{
+    const uint32_t shift = header->baseShift;
+    const uint64_t base = 1ull << shift;
+    PyramidFold acc = { 0, 0, 0, 0 };
+
+    uint64_t l = (lo + base - 1) >> shift;                      // first bucket inside the range
+    uint64_t h = (hi == header->rawCount) ? (hi + base - 1) >> shift : hi >> shift;     // end of the buckets inside
+    if (l >= h)
+    {
+        for (uint64_t i = lo; i < hi; i++)      foldSample(acc, raw[i]);
+    }
+    else
+    {
+        for (uint64_t i = lo; i < (l << shift); i++)    foldSample(acc, raw[i]);
+        for (uint64_t i = h << shift; i < hi; i++)      foldSample(acc, raw[i]);
+        for (uint32_t k = 0; l < h; k++)
+        {
+            const PyramidBucket *buckets = level(channel, k);
+            uint64_t size = 1ull << (shift + k);
+            if (l & 1)
+            {
+                foldBucket(acc, buckets[l], (header->rawCount - l * size < size) ? header->rawCount - l * size : size);
+                l++;
+            }
+            if (h & 1)
+            {
+                h--;
+                foldBucket(acc, buckets[h], (header->rawCount - h * size < size) ? header->rawCount - h * size : size);
+            }
+            l >>= 1;
+            h >>= 1;
+        }
+    }
+    out->min = acc.min;
+    out->max = acc.max;
+    out->mean = (acc.count > 0) ? (float)(acc.sum / acc.count) : 0;
+}
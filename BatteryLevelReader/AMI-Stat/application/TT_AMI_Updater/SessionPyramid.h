@@ -0,0 +1,172 @@
+/*
+* SessionPyramid.h : This file contains the level of detail pyramid of the raw signals of a
+*               columnar session file, and the classes building it and drawing a viewport from it.
+*
+*   In a nutshell, this file implements:
+*       - PyramidBuilder: the min, max and mean of the raw samples of each channel over buckets of
+*           2^PYRAMID_BASE_SHIFT samples (level 0), computed as the samples are written (one pass,
+*           SSE2 when available); then each level halves the previous one, up to one bucket
+*       - PyramidFile: the pyramid mapped in memory, next to the columnar file. A viewport of N
+*           pixels folds, per pixel, at most two buckets per level and the raw samples at the
+*           edges of the level 0 buckets: the cost depends on the pixels, not on the time range.
+*           The result is exact (same min and max as a scan of the raw samples).
+*
+*   File layout (little endian, every section aligned on COLUMNS_ALIGN bytes):
+*       PyramidHeader | channel 0 level 0..n-1 | ... | channel c-1 level 0..n-1 (PyramidBucket)
+*   The file takes the name of the columnar file with PYRAMID_FILE_EXT (pyramidPathFor()).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SESSIONPYRAMID_H
+#define _SESSIONPYRAMID_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SessionColumns.h"
+
+#define PYRAMID_MAGIC           "AMILOD01"  // First bytes of a pyramid file
+#define PYRAMID_VERSION         1           // Version of the layout
+#define PYRAMID_FILE_EXT        ".amp"      // Extension of the pyramid files
+#define PYRAMID_BASE_SHIFT      6           // Level 0 buckets hold 2^PYRAMID_BASE_SHIFT raw samples (file ~9% of the raw data)
+#define PYRAMID_MAX_LEVELS      40          // Max levels (level k: 2^(PYRAMID_BASE_SHIFT + k) samples)
+
+#pragma pack(push, 1)
+typedef struct
+{
+    float min;                  // Smallest sample of the bucket
+    float max;                  // Largest sample of the bucket
+    float mean;                 // Mean of the samples of the bucket
+} PyramidBucket;
+
+typedef struct
+{
+    char magic[8];              // PYRAMID_MAGIC
+    uint32_t version;           // PYRAMID_VERSION
+    uint32_t headerSize;        // sizeof(PyramidHeader)
+    uint32_t channels;          // Number of channels
+    uint32_t rawRate;           // Raw samples per second
+    uint32_t baseShift;         // PYRAMID_BASE_SHIFT
+    uint32_t levels;            // Number of levels
+    uint64_t rawCount;          // Raw samples per channel
+    ColumnExtent level[COLUMNS_MAX_CHANNELS][PYRAMID_MAX_LEVELS];   // Buckets of each level of each channel
+} PyramidHeader;
+#pragma pack(pop)
+
+/**
+* @brief pyramidPathFor: name of the pyramid file of a columnar file
+*
+* @param columnsPath: columnar file
+* @return The name, COLUMNS_FILE_EXT replaced by (or else followed by) PYRAMID_FILE_EXT
+*/
+std::string pyramidPathFor(const char *columnsPath);
+
+
+class PyramidBuilder
+{
+public:
+    PyramidBuilder();
+
+    /**
+    * @brief begin: start a pyramid
+    *
+    * @param channels:  number of channels
+    * @param rawRate:   raw samples per second
+    * @param rawCount:  raw samples per channel
+    * @return ERR_OK, or ERR_FILE_FORMAT (no or too many channels)
+    */
+    int begin(uint32_t channels, uint32_t rawRate, uint64_t rawCount);
+
+    /**
+    * @brief add: add the next raw samples of a channel
+    *
+    * @param channel:   channel
+    * @param samples:   samples
+    * @param count:     number of samples
+    * @return None.
+    */
+    void add(uint32_t channel, const float *samples, uint32_t count);
+
+    /**
+    * @brief addEntry: add() with the signature of ColumnBlock_t (ColumnWriter::setRawSink())
+    *
+    * @param ctx:       An abstract pointer to the PyramidBuilder.
+    * @return None.
+    */
+    static void addEntry(void *ctx, uint32_t channel, const float *samples, uint32_t count);
+
+    /**
+    * @brief write: build the levels and write the file (under a temporary name, then renamed)
+    *
+    * @param path:      file
+    * @return ERR_OK, or an error (samples missing, file error)
+    */
+    int write(const char *path);
+
+private:
+    typedef struct
+    {
+        std::vector<PyramidBucket> levels[PYRAMID_MAX_LEVELS];  // Buckets of each level
+        PyramidBucket partial;          // Level 0 bucket being filled (mean: sum of the samples)
+        uint32_t partialCount;          // Samples in that bucket
+        uint64_t added;                 // Samples added
+    } Channel;
+
+    void buildLevels(Channel &channel);
+    uint64_t bucketCount(uint32_t level, uint64_t index);
+
+    uint32_t channels;                  // Number of channels
+    uint32_t rawRate;                   // Raw samples per second
+    uint64_t rawCount;                  // Raw samples per channel
+    uint32_t levels;                    // Number of levels
+    Channel state[COLUMNS_MAX_CHANNELS];    // Pyramid of each channel
+};
+
+
+class PyramidFile
+{
+public:
+    PyramidFile();
+    virtual ~PyramidFile();
+
+    /**
+    * @brief open: map a pyramid file in memory (read only)
+    *
+    * @param path:      file
+    * @param columns:   header of the columnar file it was built from
+    * @return ERR_OK, or an error (missing file, not a pyramid, not built from that columnar file)
+    */
+    int open(const char *path, const ColumnHeader &columns);
+
+    /**
+    * @brief close: unmap the file
+    *
+    * @return None.
+    */
+    void close(void);
+
+    const PyramidHeader &info(void)                                     { return *header; }
+
+    /**
+    * @brief viewport: min, max and mean of each pixel of a time range of a channel
+    *
+    * @param columns:   columnar file the pyramid was built from (raw samples of the edges)
+    * @param channel:   channel
+    * @param fromSec:   start of the range (seconds from the start of the session)
+    * @param toSec:     end of the range (excluded)
+    * @param pixels:    width of the viewport
+    * @param out:       receives the pixels (pixels buckets)
+    * @return Number of pixels filled: pixels, or fewer when the range holds fewer samples (0: empty)
+    */
+    uint32_t viewport(ColumnFile &columns, uint32_t channel, double fromSec, double toSec, uint32_t pixels, PyramidBucket *out);
+
+private:
+    const PyramidBucket *level(uint32_t channel, uint32_t k)            { return (const PyramidBucket *)(map.data() + header->level[channel][k].offset); }
+    void fold(uint32_t channel, const float *raw, uint64_t lo, uint64_t hi, PyramidBucket *out);
+
+    MappedFile map;                     // Mapping of the file
+    const PyramidHeader *header;        // Header, in the mapping
+};
+
+#endif // _SESSIONPYRAMID_H
@@ -0,0 +1,406 @@
+/*
+* SignalDsp.cpp : This file contains the host side processing of the raw signals: notch filter,
+*               RMS envelope and decimation.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <math.h>
+#include <string.h>
+#include <atomic>
+#include "SignalDsp.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DSP_AVX2
+#define DSP_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define DSP_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define DSP_NEON
+#endif
+
+#define DSP_PI                  3.14159265358979323846
+#define DSP_DECIMATOR_CUTOFF    0.9         // Cut-off of the decimator, fraction of the output Nyquist frequency
+
+static std::atomic<bool> forceScalar(false);    // dspForceScalar()
+
+/**
+* @brief dspKernels: name of the kernels built in
+*
+* @return "avx2", "sse2", "neon" or "scalar" ("scalar" as well while dspForceScalar(true))
+*/
+const char *dspKernels(void)
+{
+    if (forceScalar.load(std::memory_order_relaxed))   return "scalar";
+#if defined(DSP_AVX2)
+    return "avx2";
+#elif defined(DSP_SSE2)
+    return "sse2";
+#elif defined(DSP_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+void dspForceScalar(bool force)
+{
+    forceScalar.store(force, std::memory_order_relaxed);
+}
+
+/**
+* @brief dspSumSquares: sum of the squares of samples
+*
+* @param samples:   samples
+* @param count:     number of samples
+* @return The sum
+*/
+float dspSumSquares(const float *samples, uint32_t count)
+{
+    uint32_t i = 0;
+    float sum = 0;
+
+    if (forceScalar.load(std::memory_order_relaxed) == false)
+    {
+#if defined(DSP_AVX2)
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 v = _mm256_loadu_ps(samples + i);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(v, v));
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        sum = _mm_cvtss_f32(half);
+#elif defined(DSP_SSE2)
+        __m128 acc = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 v = _mm_loadu_ps(samples + i);
+            acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+        }
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+        sum = _mm_cvtss_f32(acc);
+#elif defined(DSP_NEON)
+        float32x4_t acc = vdupq_n_f32(0);
+        for (; i + 4 <= count; i += 4)
+        {
+            float32x4_t v = vld1q_f32(samples + i);
+            acc = vmlaq_f32(acc, v, v);
+        }
+        float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+    }
+    for (; i < count; i++)      sum += samples[i] * samples[i];
+    return sum;
+}
+
+/**
+* @brief dspDot: dot product of two arrays
+*
+* @param a:         first array
+* @param b:         second array
+* @param count:     number of values
+* @return The dot product
+*/
+float dspDot(const float *a, const float *b, uint32_t count)
+{
+    uint32_t i = 0;
+    float sum = 0;
+
+    if (forceScalar.load(std::memory_order_relaxed) == false)
+    {
+#if defined(DSP_AVX2)
+        __m256 acc = _mm256_setzero_ps();
+        for (; i + 8 <= count; i += 8)
+        {
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        sum = _mm_cvtss_f32(half);
+#elif defined(DSP_SSE2)
+        __m128 acc = _mm_setzero_ps();
+        for (; i + 4 <= count; i += 4)
+        {
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        }
+        acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+        acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+        sum = _mm_cvtss_f32(acc);
+#elif defined(DSP_NEON)
+        float32x4_t acc = vdupq_n_f32(0);
+        for (; i + 4 <= count; i += 4)      acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+        sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#endif
+    }
+    for (; i < count; i++)      sum += a[i] * b[i];
+    return sum;
+}
+
+
+NotchFilter::NotchFilter()
+{
+    design(DSP_RAW_RATE, 0);
+}
+
+/**
+* @brief design: compute the coefficients and clear the state (RBJ cookbook notch)
+*
+* @param rate:      sample rate
+* @param freq:      frequency rejected (0: the filter passes the signal through)
+* @param q:         quality factor (frequency / bandwidth)
+* @return None.
+*/
+void NotchFilter::design(double rate, double freq, double q)
+{
+    bypass = (freq <= 0) || (rate <= 0) || (q <= 0) || (freq >= rate / 2);
+    if (bypass)
+    {
+        b0 = 1;
+        b1 = b2 = a1 = a2 = 0;
+    }
+    else
+    {
+        double w0 = 2 * DSP_PI * freq / rate;
+        double alpha = sin(w0) / (2 * q);
+        double a0 = 1 + alpha;
+        b0 = (float)(1 / a0);
+        b1 = (float)(-2 * cos(w0) / a0);
+        b2 = b0;
+        a1 = b1;
+        a2 = (float)((1 - alpha) / a0);
+    }
+    reset();
+}
+
+void NotchFilter::reset(void)
+{
+    memset(z1, 0, sizeof(z1));
+    memset(z2, 0, sizeof(z2));
+}
+
+/**
+* @brief process: filter the next samples of the channels, in place. The recursion runs along
+*           time, so the vector kernels filter the four channels together, one per lane: four
+*           frames are loaded, transposed in registers, filtered and transposed back. The other
+*           channel counts and the tail of the block run the scalar loop.
+*
+* @param channels:  samples of each channel (planar, count samples each)
+* @param count:     samples per channel
+* @param nChannels: number of channels (DSP_MAX_CHANNELS max)
+* @return None.
+*/
+void NotchFilter::process(float *const *channels, uint32_t count, uint32_t nChannels)
+{
+    uint32_t start = 0;                 // First sample left to the scalar loop
+
+    if (bypass || (nChannels == 0))     return;
+    if (nChannels > DSP_MAX_CHANNELS)   nChannels = DSP_MAX_CHANNELS;
+
+    if ((nChannels == 4) && (forceScalar.load(std::memory_order_relaxed) == false))
+    {
+        float *c0 = channels[0], *c1 = channels[1], *c2 = channels[2], *c3 = channels[3];
+#if defined(DSP_SSE2)
+        __m128 vb0 = _mm_set1_ps(b0), vb1 = _mm_set1_ps(b1), vb2 = _mm_set1_ps(b2);
+        __m128 va1 = _mm_set1_ps(a1), va2 = _mm_set1_ps(a2);
+        __m128 s1 = _mm_loadu_ps(z1), s2 = _mm_loadu_ps(z2);
+        auto step = [&](__m128 x) -> __m128
+        {
+            __m128 y = _mm_add_ps(_mm_mul_ps(vb0, x), s1);
+            s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(vb1, x), _mm_mul_ps(va1, y)), s2);
+            s2 = _mm_sub_ps(_mm_mul_ps(vb2, x), _mm_mul_ps(va2, y));
+            return y;
+        };
+        for (; start + 4 <= count; start += 4)
+        {
+            __m128 f0 = _mm_loadu_ps(c0 + start), f1 = _mm_loadu_ps(c1 + start);
+            __m128 f2 = _mm_loadu_ps(c2 + start), f3 = _mm_loadu_ps(c3 + start);
+            _MM_TRANSPOSE4_PS(f0, f1, f2, f3);          // fN: frame N, one channel per lane
+            f0 = step(f0);
+            f1 = step(f1);
+            f2 = step(f2);
+            f3 = step(f3);
+            _MM_TRANSPOSE4_PS(f0, f1, f2, f3);          // back to one channel per register
+            _mm_storeu_ps(c0 + start, f0);
+            _mm_storeu_ps(c1 + start, f1);
+            _mm_storeu_ps(c2 + start, f2);
+            _mm_storeu_ps(c3 + start, f3);
+        }
+        _mm_storeu_ps(z1, s1);
+        _mm_storeu_ps(z2, s2);
+#elif defined(DSP_NEON)
+        float32x4_t vb0 = vdupq_n_f32(b0), vb1 = vdupq_n_f32(b1), vb2 = vdupq_n_f32(b2);
+        float32x4_t va1 = vdupq_n_f32(a1), va2 = vdupq_n_f32(a2);
+        float32x4_t s1 = vld1q_f32(z1), s2 = vld1q_f32(z2);
+        auto step = [&](float32x4_t x) -> float32x4_t
+        {
+            float32x4_t y = vaddq_f32(vmulq_f32(vb0, x), s1);
+            s1 = vaddq_f32(vsubq_f32(vmulq_f32(vb1, x), vmulq_f32(va1, y)), s2);
+            s2 = vsubq_f32(vmulq_f32(vb2, x), vmulq_f32(va2, y));
+            return y;
+        };
+        auto transpose = [](float32x4_t &r0, float32x4_t &r1, float32x4_t &r2, float32x4_t &r3)
+        {
+            float32x4x2_t t0 = vzipq_f32(r0, r2), t1 = vzipq_f32(r1, r3);
+            float32x4x2_t u0 = vzipq_f32(t0.val[0], t1.val[0]), u1 = vzipq_f32(t0.val[1], t1.val[1]);
+            r0 = u0.val[0];
+            r1 = u0.val[1];
+            r2 = u1.val[0];
+            r3 = u1.val[1];
+        };
+        for (; start + 4 <= count; start += 4)
+        {
+            float32x4_t f0 = vld1q_f32(c0 + start), f1 = vld1q_f32(c1 + start);
+            float32x4_t f2 = vld1q_f32(c2 + start), f3 = vld1q_f32(c3 + start);
+            transpose(f0, f1, f2, f3);                  // fN: frame N, one channel per lane
+            f0 = step(f0);
+            f1 = step(f1);
+            f2 = step(f2);
+            f3 = step(f3);
+            transpose(f0, f1, f2, f3);                  // back to one channel per register
+            vst1q_f32(c0 + start, f0);
+            vst1q_f32(c1 + start, f1);
+            vst1q_f32(c2 + start, f2);
+            vst1q_f32(c3 + start, f3);
+        }
+        vst1q_f32(z1, s1);
+        vst1q_f32(z2, s2);
+#else
+        (void)c0; (void)c1; (void)c2; (void)c3;
+#endif
+    }
+
+    for (uint32_t c = 0; c < nChannels; c++)
+    {
+        float *samples = channels[c];
+        float s1 = z1[c], s2 = z2[c];                   // State in registers along the channel
+        for (uint32_t i = start; i < count; i++)
+        {
+            float x = samples[i];
+            float y = b0 * x + s1;
+            s1 = (b1 * x - a1 * y) + s2;
+            s2 = b2 * x - a2 * y;
+            samples[i] = y;
+        }
+        z1[c] = s1;
+        z2[c] = s2;
+    }
+}
+
+
+/**
+* @brief ctor: class constructor
+*
+* @param window:    samples of each RMS
+* @param hop:       samples between two RMS (decimation, window max)
+* @return None.
+*/
+RmsEnvelope::RmsEnvelope(uint32_t _window, uint32_t _hop)
+: window((_window > 0) ? _window : 1)
+, hop((_hop > 0) ? _hop : 1)
+{
+    if (hop > window)       hop = window;
+}
+
+void RmsEnvelope::reset(void)
+{
+    pending.clear();
+}
+
+/**
+* @brief process: add samples, compute the RMS that are complete
+*
+* @param samples:   samples
+* @param count:     number of samples
+* @param out:       receives the RMS
+* @param maxOut:    room of out (count / hop + 1 is always enough)
+* @return Number of RMS written
+*/
+uint32_t RmsEnvelope::process(const float *samples, uint32_t count, float *out, uint32_t maxOut)
+{
+    uint32_t produced = 0;
+    size_t pos = 0;
+
+    pending.insert(pending.end(), samples, samples + count);
+    while ((pos + window <= pending.size()) && (produced < maxOut))
+    {
+        out[produced++] = sqrtf(dspSumSquares(pending.data() + pos, window) / window);
+        pos += hop;
+    }
+    pending.erase(pending.begin(), pending.begin() + pos);
+    return produced;
+}
+
+
+/**
+* @brief ctor: class constructor, designs the low-pass filter (windowed sinc, Blackman window,
+*           cut-off at 0.9 of the output Nyquist frequency, unity gain at DC)
+*
+* @param factor:    decimation factor
+* @param tapsPerPhase: taps of each of the factor phases
+* @return None.
+*/
+Decimator::Decimator(uint32_t _factor, uint32_t tapsPerPhase)
+: factor((_factor > 0) ? _factor : 1)
+, next(0)
+{
+    uint32_t n = factor * ((tapsPerPhase > 0) ? tapsPerPhase : 1);
+    double cutoff = DSP_DECIMATOR_CUTOFF * 0.5 / factor;           // cycles per input sample
+    double sum = 0;
+    std::vector<double> taps(n);
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        double t = i - (n - 1) / 2.0;
+        double sinc = (t == 0) ? 2 * cutoff : sin(2 * DSP_PI * cutoff * t) / (DSP_PI * t);
+        double w = (n > 1) ? 0.42 - 0.5 * cos(2 * DSP_PI * i / (n - 1)) + 0.08 * cos(4 * DSP_PI * i / (n - 1)) : 1;
+        taps[i] = sinc * w;
+        sum += taps[i];
+    }
+    reversed.resize(n);
+    for (uint32_t i = 0; i < n; i++)    reversed[i] = (float)(taps[n - 1 - i] / sum);
+    reset();
+}
+
+void Decimator::reset(void)
+{
+    history.assign(reversed.size() - 1, 0.0f);          // the signal starts after zeros
+    next = 0;
+}
+
+/**
+* @brief process: add samples, compute the outputs that are complete. Output k is the filter at
+*           input k * factor: the dot product of the taps with the taps() samples ending there.
+*
+* @param samples:   samples
+* @param count:     number of samples
+* @param out:       receives the outputs
+* @param maxOut:    room of out (count / factor + 1 is always enough)
+* @return Number of outputs written
+*/
+uint32_t Decimator::process(const float *samples, uint32_t count, float *out, uint32_t maxOut)
+{
+    uint32_t produced = 0;
+    uint32_t n = taps();
+
+    history.insert(history.end(), samples, samples + count);
+    while ((next + n <= history.size()) && (produced < maxOut))
+    {
+        out[produced++] = dspDot(reversed.data(), history.data() + next, n);
+        next += factor;
+    }
+    // keep the history of the next output
+    uint32_t drop = (next < history.size()) ? next : (uint32_t)history.size();
+    history.erase(history.begin(), history.begin() + drop);
+    next -= drop;
+    return produced;
+}
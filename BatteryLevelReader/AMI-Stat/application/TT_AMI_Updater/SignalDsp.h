@@ -0,0 +1,189 @@
+/*
+* SignalDsp.h : This file contains the host side processing of the raw signals: notch filter,
+*               RMS envelope and decimation, as the device does it before streaming the RMS.
+*
+*   In a nutshell, this file implements:
+*       - NotchFilter: biquad notch (mains rejection, DSP_NOTCH_US / DSP_NOTCH_EU, Q DSP_NOTCH_Q),
+*           the channels filtered together, one channel per vector lane
+*       - RmsEnvelope: RMS of the last `window` samples every `hop` samples. With the defaults
+*           (DSP_RMS_DECIMATION both), the 2048 Hz raw signal gives the ~20 Hz RMS stream of
+*           the device, output k covering raw samples [k * 102, (k + 1) * 102)
+*       - Decimator: low-pass FIR decimating by an integer factor; only the outputs kept are
+*           computed (the cost of the polyphase form: taps / factor products per input sample)
+*
+*   The kernels work on blocks and keep their state between blocks: a signal processed in one
+*   call or in many gives the same result. They are vectorized at build time: AVX2 (time axis)
+*   when the compiler targets it, SSE2 on x86 and x64, NEON on ARM, scalar otherwise.
+*   dspForceScalar() selects the scalar kernels at run time (reference, benchmarks).
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _SIGNALDSP_H
+#define _SIGNALDSP_H
+
+#include <stdint.h>
+#include <vector>
+
+#define DSP_MAX_CHANNELS        4           // Channels filtered together (TTL_MAX_AMI_CHANNELS)
+#define DSP_RAW_RATE            2048        // Raw sample rate of the device (SAMPLING_RATE)
+#define DSP_RMS_DECIMATION      102         // Raw samples per RMS sample (DOWN_SAMPLING)
+#define DSP_RMS_RATE            20          // Nominal RMS sample rate (OUTPUT_RATE)
+#define DSP_NOTCH_US            60.0        // Mains frequency, North America (NOTCH_FR_US)
+#define DSP_NOTCH_EU            50.0        // Mains frequency, Europe (NOTCH_FR_EU)
+#define DSP_NOTCH_Q             10.0        // Quality factor of the notch (NOTCH_Q)
+#define DSP_DECIMATOR_TAPS      8           // Default taps per phase of a decimator
+
+/**
+* @brief dspKernels: name of the kernels built in
+*
+* @return "avx2", "sse2", "neon" or "scalar" ("scalar" as well while dspForceScalar(true))
+*/
+const char *dspKernels(void);
+
+/**
+* @brief dspForceScalar: use the scalar kernels (reference results, benchmarks)
+*
+* @param force:     true for the scalar kernels, false for the vectorized ones
+* @return None.
+*/
+void dspForceScalar(bool force);
+
+/**
+* @brief dspSumSquares: sum of the squares of samples
+*
+* @param samples:   samples
+* @param count:     number of samples
+* @return The sum
+*/
+float dspSumSquares(const float *samples, uint32_t count);
+
+/**
+* @brief dspDot: dot product of two arrays
+*
+* @param a:         first array
+* @param b:         second array
+* @param count:     number of values
+* @return The dot product
+*/
+float dspDot(const float *a, const float *b, uint32_t count);
+
+
+class NotchFilter
+{
+public:
+    NotchFilter();
+
+    /**
+    * @brief design: compute the coefficients and clear the state
+    *
+    * @param rate:      sample rate
+    * @param freq:      frequency rejected (0: the filter passes the signal through)
+    * @param q:         quality factor (frequency / bandwidth)
+    * @return None.
+    */
+    void design(double rate, double freq, double q = DSP_NOTCH_Q);
+
+    /**
+    * @brief reset: clear the state (start of a new signal)
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    /**
+    * @brief process: filter the next samples of the channels, in place
+    *
+    * @param channels:  samples of each channel (planar, count samples each)
+    * @param count:     samples per channel
+    * @param nChannels: number of channels (DSP_MAX_CHANNELS max)
+    * @return None.
+    */
+    void process(float *const *channels, uint32_t count, uint32_t nChannels);
+
+private:
+    float b0, b1, b2, a1, a2;           // Coefficients (a0 normalized to 1)
+    bool bypass;                        // No frequency rejected
+    float z1[DSP_MAX_CHANNELS];         // State of each channel (transposed direct form II)
+    float z2[DSP_MAX_CHANNELS];
+};
+
+
+class RmsEnvelope
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param window:    samples of each RMS
+    * @param hop:       samples between two RMS (decimation, window max)
+    * @return None.
+    */
+    RmsEnvelope(uint32_t window = DSP_RMS_DECIMATION, uint32_t hop = DSP_RMS_DECIMATION);
+
+    /**
+    * @brief reset: clear the samples pending (start of a new signal)
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    /**
+    * @brief process: add samples, compute the RMS that are complete
+    *
+    * @param samples:   samples
+    * @param count:     number of samples
+    * @param out:       receives the RMS
+    * @param maxOut:    room of out (count / hop + 1 is always enough)
+    * @return Number of RMS written
+    */
+    uint32_t process(const float *samples, uint32_t count, float *out, uint32_t maxOut);
+
+private:
+    uint32_t window;                    // Samples of each RMS
+    uint32_t hop;                       // Samples between two RMS
+    std::vector<float> pending;         // Samples not consumed yet
+};
+
+
+class Decimator
+{
+public:
+    /**
+    * @brief ctor: class constructor, designs the low-pass filter (windowed sinc, Blackman window,
+    *           cut-off at 0.9 of the output Nyquist frequency, unity gain at DC)
+    *
+    * @param factor:    decimation factor
+    * @param tapsPerPhase: taps of each of the factor phases
+    * @return None.
+    */
+    Decimator(uint32_t factor, uint32_t tapsPerPhase = DSP_DECIMATOR_TAPS);
+
+    /**
+    * @brief reset: clear the history (start of a new signal)
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    /**
+    * @brief process: add samples, compute the outputs that are complete
+    *
+    * @param samples:   samples
+    * @param count:     number of samples
+    * @param out:       receives the outputs
+    * @param maxOut:    room of out (count / factor + 1 is always enough)
+    * @return Number of outputs written
+    */
+    uint32_t process(const float *samples, uint32_t count, float *out, uint32_t maxOut);
+
+    uint32_t taps(void)                                                 { return (uint32_t)reversed.size(); }
+
+private:
+    uint32_t factor;                    // Decimation factor
+    std::vector<float> reversed;        // Taps, last one first (dot product with the history)
+    std::vector<float> history;         // Last taps() - 1 samples, then the samples not consumed
+    uint32_t next;                      // Position in history of the first sample of the next output
+};
+
+#endif // _SIGNALDSP_H
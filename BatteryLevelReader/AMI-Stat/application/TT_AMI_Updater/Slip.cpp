@@ -11,20 +11,22 @@
 * Project: AMI
 * Company: Orthogone Technologies inc.
 */
-#include "stdafx.h"
 #include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <string>
 #include "Slip.h"
+#include "WireCapture.h"
 #include "ErrCodes.h"
+#include "TraceBuffer.h"
 
-//
-// SLIP special character codes
-//
-#define		SLIP_END_BYTE             0xC0   // indicates end of packet
-#define		SLIP_ESC_BYTE             0xDB   // indicates byte stuffing
-#define		SLIP_ESC_END_BYTE         0xDC   // ESC ESC_END means END data byte
-#define		SLIP_ESC_ESC_BYTE         0xDD   // ESC ESC_ESC means ESC data byte
-
+static std::mutex captureLock;              // Protects captureFolder
+static std::string captureFolder;           // Folder receiving the capture files ("": no capture)
+static std::atomic<unsigned> captureCount(0);   // Number of capture files created (makes the file names unique)
 
+#ifdef _WIN32
 /**
 * @brief ctor: class constructor
 *
@@ -32,10 +34,31 @@
 * @return None.
 */
 Slip::Slip(BTH_ADDR devAddr)
-: sppComm(NULL)
+: comm(NULL)
+, ownsComm(true)
+, metrics(NULL)
+, clock(systemClock())
 {
     deviceAddr = devAddr;
 }
+#endif
+
+/**
+* @brief ctor: class constructor on an existing connection. The connection is not deleted by Slip.
+*
+* @param comm:      connection to frame
+* @return None.
+*/
+Slip::Slip(IComm *_comm)
+: comm(_comm)
+, ownsComm(false)
+, metrics(NULL)
+, clock(systemClock())
+{
+#ifdef _WIN32
+    deviceAddr = 0;
+#endif
+}
 
 /**
 * @brief dtor: class destructor.
@@ -44,7 +67,8 @@ Slip::Slip(BTH_ADDR devAddr)
 */
 Slip::~Slip()
 {
-    if (sppComm)    delete sppComm;
+    recorder.record(FREC_CLOSE, 0, 0, 0, 0, 0);
+    if (comm && ownsComm)   delete comm;
 }
 
 /**
@@ -54,7 +78,7 @@ Slip::~Slip()
 */
 void Slip::close(void)
 {
-    if (sppComm)    sppComm->close();
+    if (comm)       comm->close();
 }
 
 /**
@@ -64,7 +88,44 @@ void Slip::close(void)
 */
 void Slip::open(void)
 {
-    sppComm = new SppComm(deviceAddr);
+#ifdef _WIN32
+    if (ownsComm == false)  return;         // The connection was given already opened
+
+    char label[CAPTURE_LABEL_LEN];
+    sprintf_s(label, sizeof(label), "%012llX", (unsigned long long)deviceAddr);
+    recorder.setLabel(label);
+    recorder.record(FREC_OPEN, 0, 0, 0, 0, 0);
+
+    IComm *spp = new SppComm(deviceAddr, metrics);
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(captureLock);
+        path = captureFolder;
+    }
+    if (path != "")
+    {
+        char fileName[64];
+        time_t now = time(0);
+        struct tm local;
+        localtime_s(&local, &now);
+        sprintf_s(fileName, sizeof(fileName), "\\%s_%04d%02d%02d_%02d%02d%02d_%u" CAPTURE_FILE_EXT, label,
+            local.tm_year + 1900, local.tm_mon + 1, local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec, captureCount++);
+        spp = new CaptureComm(spp, (path + fileName).c_str(), label);  // Capture errors leave the connection working
+    }
+    comm = spp;
+#endif
+}
+
+/**
+* @brief setCaptureFolder: record the connections opened from now on in capture files of a folder
+*
+* @param folder:    folder receiving the capture files ("" or NULL: stop capturing)
+* @return None.
+*/
+void Slip::setCaptureFolder(const char *folder)
+{
+    std::lock_guard<std::mutex> lock(captureLock);
+    captureFolder = (folder != NULL) ? folder : "";
 }
 
 /**
@@ -82,12 +143,15 @@ void Slip::open(void)
 int Slip::send(const uint8_t *msg, int msgLen)
 {
     int retCode = 0;
+    const uint8_t *frame = msg;     // start of the frame, for the flight recorder
     const uint8_t *ptr = msg;       // ptr parses the buffer to find special code
     int nb = 0;                     // number of bytes parsed
     static const uint8_t delim[1] = { SLIP_END_BYTE };
     static const uint8_t escEnd[2] = { SLIP_ESC_BYTE, SLIP_ESC_END_BYTE };
     static const uint8_t escEsc[2] = { SLIP_ESC_BYTE, SLIP_ESC_ESC_BYTE };
 
+    TRACEPT(TRACEPT_SLIP_SEND, msgLen, (msgLen > 1) ? (frame[0] << 8) | frame[1] : 0);
+
     // send start of frame
     retCode = xmit(delim, sizeof(delim), retCode-sizeof(delim));         // -sizeof(..): Do not count this byte for the return code
 
@@ -121,6 +185,10 @@ int Slip::send(const uint8_t *msg, int msgLen)
     // send end of frame
     retCode = xmit(delim, sizeof(delim), retCode-sizeof(delim));        // -sizeof(..): Do not count this byte for the return code
 
+    if ((metrics != NULL) && (retCode >= 0))    metrics->frameTx(retCode);
+    if (retCode >= 0)   recorder.recordFrame(FREC_TX, frame, msgLen);
+    else                recorder.record(FREC_ERROR, (msgLen > 0) ? frame[0] : 0, (msgLen > 1) ? frame[1] : 0, 0, (uint32_t)msgLen, retCode);
+    TRACEPT(TRACEPT_SLIP_SEND_END, retCode, 0);
     return retCode;
 }
 
@@ -135,7 +203,7 @@ int Slip::send(const uint8_t *msg, int msgLen)
 */
 int Slip::xmit(const uint8_t *msg, int msgLen, int nbSent)
 {
-    int retCode = sppComm->send(msg, msgLen);
+    int retCode = comm->send(msg, msgLen);
     assert((retCode == msgLen) || (retCode < 0));
 
     if (retCode >= 0)   retCode += nbSent;      // if no error, cumulate number of bytes sent
@@ -160,7 +228,8 @@ int Slip::read(uint8_t *retMsg, int maxLen, int waitMs)
     int retCode = 0;
     uint8_t *ptr = retMsg;
 
-    DWORD entryTime = GetTickCount();       // Grab entry time
+    int64_t entryTime = clock->nowMs();     // Grab entry time
+    TRACEPT(TRACEPT_SLIP_READ, waitMs, 0);
 
     // We could discard any data before receiving a C0, but in theory, there is no need to have
     // a C0 at the beginning and at the end; we only need 1 C0 to separate frames.
@@ -200,6 +269,14 @@ int Slip::read(uint8_t *retMsg, int maxLen, int waitMs)
         else if (nb != 1)                           retCode = nb;                   // serial port error code
     } while (retCode == 0);
 
+    if (metrics != NULL)
+    {
+        if (retCode > 0)                        metrics->frameRx(retCode);
+        else if (retCode == ERR_SLIP_FRAMING)   metrics->framingError();
+    }
+    if (retCode > 0)    recorder.recordFrame(FREC_RX, retMsg, retCode);
+    else                recorder.record(FREC_ERROR, (ptr != retMsg) ? retMsg[0] : 0, 0, 0, (uint32_t)(ptr - retMsg), retCode);    // length: bytes of the incomplete frame
+    TRACEPT(TRACEPT_SLIP_READ_END, retCode, (retCode > 1) ? (retMsg[0] << 8) | retMsg[1] : 0);
     return retCode;
 }
 
@@ -208,20 +285,20 @@ int Slip::read(uint8_t *retMsg, int maxLen, int waitMs)
 *
 * @param retMsg:    Pre-allocated buffer that is filled with the received data
 * @param maxLen:    Max number of bytes that can be stored in retMsg
-* @param entryTime: GetTickCount() value when we entered the read function for this frame
+* @param entryTime: clock time when we entered the read function for this frame
 * @param waitMs:    Max time to wait in milliseconds for some data to arrive.
 * @return   > 0     Number of bytes received.
 *           <=0     Timeout
 */
-int Slip::recv(uint8_t *retMsg, int maxLen, DWORD entryTime, int waitMs)
+int Slip::recv(uint8_t *retMsg, int maxLen, int64_t entryTime, int waitMs)
 {
     int retCode = 0;
 
-    DWORD curTime = GetTickCount();
-    int waitTime = waitMs - (curTime-entryTime);
+    int64_t curTime = clock->nowMs();
+    int waitTime = waitMs - (int)(curTime-entryTime);
     
     // if time remain, read data
-    if (waitTime >= 0)  retCode = sppComm->read(retMsg, maxLen, waitTime);
+    if (waitTime >= 0)  retCode = comm->read(retMsg, maxLen, (uint32_t)waitTime);
     
     return retCode;
 }
@@ -7,6 +7,13 @@
 *       - receive data on the connection by deframing the slip format
 *       - abort a connection (via the destructor).
 *
+*   The framing runs on any IComm connection. Besides the Bluetooth one, it can be given an
+*   existing connection (e.g. a ReplayComm feeding back a capture file), in which case it only
+*   borrows it. Every frame sent or received and every framing error is kept in the flight
+*   recorder of the connection (see FlightRecorder.h). When a capture folder is set, every Bluetooth connection opened is recorded
+*   in a capture file of that folder (see WireCapture.h). The frame timeouts, and those of the
+*   engines running on the connection, are taken from the clock of the connection (see DeadlineClock.h).
+*
 * Author: Luc Tremblay
 * Project: AMI
 * Company: Orthogone Technologies inc.
@@ -14,12 +21,28 @@
 #ifndef _SLIP_H
 #define _SLIP_H
 
+#include <stdint.h>
+#ifdef _WIN32
 #include <Windows.h>
 #include "SppComm.h"
+#endif
+#include "icomm.h"
+#include "ProtocolMetrics.h"
+#include "FlightRecorder.h"
+#include "DeadlineClock.h"
+
+//
+// SLIP special character codes
+//
+#define		SLIP_END_BYTE             0xC0   // indicates end of packet
+#define		SLIP_ESC_BYTE             0xDB   // indicates byte stuffing
+#define		SLIP_ESC_END_BYTE         0xDC   // ESC ESC_END means END data byte
+#define		SLIP_ESC_ESC_BYTE         0xDD   // ESC ESC_ESC means ESC data byte
 
 class Slip
 {
 public:
+#ifdef _WIN32
     /**
     * @brief ctor: class constructor
     *
@@ -27,6 +50,15 @@ public:
     * @return None.
     */
     Slip(BTH_ADDR devAddr);
+#endif
+
+    /**
+    * @brief ctor: class constructor on an existing connection. The connection is not deleted by Slip.
+    *
+    * @param comm:      connection to frame
+    * @return None.
+    */
+    Slip(IComm *comm);
     
     /**
     * @brief dtor: class destructor.
@@ -77,6 +109,38 @@ public:
     */
     int read(uint8_t *retMsg, int maxLen, int waitMs);
 
+    /**
+    * @brief setMetrics: set the metrics receiving the frame counts. Must be called before open().
+    *
+    * @param m:         metrics of the session (NULL: none)
+    * @return None.
+    */
+    void setMetrics(ProtocolMetrics *m)                                 { metrics = m; }
+
+    /**
+    * @brief setClock: set the clock of the timeouts of the connection (systemClock() by default)
+    *
+    * @param c:         clock, simulated for a simulated connection
+    * @return None.
+    */
+    void setClock(IClock *c)                                            { clock = c; }
+    IClock *getClock(void) const                                        { return clock; }
+
+    /**
+    * @brief setCaptureFolder: record the connections opened from now on in capture files of a folder
+    *
+    * @param folder:    folder receiving the capture files ("" or NULL: stop capturing)
+    * @return None.
+    */
+    static void setCaptureFolder(const char *folder);
+
+    /**
+    * @brief flightRecorder: recent events of this connection, to dump on error
+    *
+    * @return The recorder of the connection
+    */
+    FlightRecorder &flightRecorder(void)                                { return recorder; }
+
 private:
     /**
     * @brief xmit: send data to sppComm, update count or set an error if required
@@ -95,16 +159,22 @@ private:
     *
     * @param retMsg:    Pre-allocated buffer that is filled with the received data
     * @param maxLen:    Max number of bytes that can be stored in retMsg
-    * @param entryTime: GetTickCount() value when we entered the read function for this frame
+    * @param entryTime: clock time when we entered the read function for this frame
     * @param waitMs:    Max time to wait in milliseconds for some data to arrive.
     * @return   > 0     Number of bytes received.
     *           0       Timeout
     */
-    int recv(uint8_t *retMsg, int maxLen, DWORD entryTime, int waitMs);
-    int recv(char *retMsg, int maxLen, DWORD entryTime, int waitMs)     { return recv((uint8_t *)retMsg, maxLen, entryTime, waitMs); }
+    int recv(uint8_t *retMsg, int maxLen, int64_t entryTime, int waitMs);
+    int recv(char *retMsg, int maxLen, int64_t entryTime, int waitMs)   { return recv((uint8_t *)retMsg, maxLen, entryTime, waitMs); }
 
+#ifdef _WIN32
     BTH_ADDR deviceAddr;        // Device MAC address
-    SppComm *sppComm;           // Pointer to SppComm communication channel for this SLIP instance
+#endif
+    IComm *comm;                // Communication channel for this SLIP instance
+    bool ownsComm;              // When true, comm was created by open() and is deleted with this instance
+    ProtocolMetrics *metrics;   // Metrics of the session (may be NULL)
+    IClock *clock;              // Clock of the timeouts
+    FlightRecorder recorder;    // Recent events of the connection
 };
 
 #endif // _SLIP_H
@@ -21,18 +21,21 @@
 #include <Ws2bth.h>
 #include "SppComm.h"
 #include "ErrCodes.h"
+#include "TraceBuffer.h"
 
 /**
 * @brief ctor: class constructor
 *
 * @param devAddr: device address
+* @param metrics: if not NULL, receives the connect time and the wire byte counts
 * @return None.
 */
-SppComm::SppComm(BTH_ADDR devAddr)
+SppComm::SppComm(BTH_ADDR devAddr, ProtocolMetrics *_metrics)
 : sendBusy(false)
 , readBusy(false)
 , exiting(false)
 , connError(0)
+, metrics(_metrics)
 {
     initBusy = true;            // Connecting the socket may be long. Make sure we do not delete during that time.
 
@@ -50,7 +53,11 @@ SppComm::SppComm(BTH_ADDR devAddr)
     sock = socket(AF_BTH, SOCK_STREAM, BTHPROTO_RFCOMM); // Open a bluetooth socket using RFCOMM protocol
     assert (sock != INVALID_SOCKET);
 
+    int64_t connectStart = metricsNowUs();
+    TRACEPT(TRACEPT_SPP_CONNECT, 0, 0);
     err = connect(sock, (struct sockaddr *) &sockAddr, sizeof(sockAddr));
+    TRACEPT(TRACEPT_SPP_CONNECT_END, (err != 0) ? 0 - WSAGetLastError() : 0, 0);
+    if (metrics != NULL)    metrics->connectTime(metricsNowUs() - connectStart);
     if (err != 0)
     {
         // In case of error opening the connection, it will be reported by the send function
@@ -104,6 +111,7 @@ int SppComm::send(const uint8_t *msg, int msgLen)
 {
     int retCode = 0;
 
+    TRACEPT(TRACEPT_SPP_SEND, msgLen, 0);
     if (exiting == true)    retCode = ERR_SPP_CLOSING;  // return an error, object is being destroyed
     else
     {
@@ -117,10 +125,12 @@ int SppComm::send(const uint8_t *msg, int msgLen)
         {
             assert(sock != INVALID_SOCKET);
             retCode = ::send(sock, (const char *) msg, msgLen, 0);
+            if ((metrics != NULL) && (retCode > 0))     metrics->wireTx(retCode);
         }
         
         sendBusy = false;
     }
+    TRACEPT(TRACEPT_SPP_SEND_END, retCode, 0);
     return retCode;
 }
 
@@ -134,10 +144,11 @@ int SppComm::send(const uint8_t *msg, int msgLen)
 *                   wait for the maxLen to be received.
 * @return Number of bytes received.
 */
-int SppComm::read(uint8_t *retMsg, int maxLen, DWORD maxWaitTimeMs)
+int SppComm::read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
 {
     int retCode = 0;
 
+    TRACEPT(TRACEPT_SPP_READ, maxLen, maxWaitTimeMs);
     if (exiting == true)
     {
         retCode = ERR_SPP_CLOSING;
@@ -168,6 +179,7 @@ int SppComm::read(uint8_t *retMsg, int maxLen, DWORD maxWaitTimeMs)
                 case 1:             // Socket has received data
                     err = recv(sock, (char *)retMsg, maxLen, 0);
                     if (err != 0)   retCode = err;          // return now with number of bytes received
+                    if ((metrics != NULL) && (err > 0))     metrics->wireRx(err);
                     break;
 
                 default:    assert(0);      // Other errors are not expected. Don't know what to do if such error occurs.
@@ -176,5 +188,6 @@ int SppComm::read(uint8_t *retMsg, int maxLen, DWORD maxWaitTimeMs)
     
         readBusy = false;
     }
+    TRACEPT(TRACEPT_SPP_READ_END, retCode, 0);
     return retCode;
 }
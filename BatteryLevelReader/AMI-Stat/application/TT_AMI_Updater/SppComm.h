@@ -22,17 +22,20 @@
 #include <Windows.h>
 #include <stdint.h>
 #include <BluetoothAPIs.h>
+#include "ProtocolMetrics.h"
+#include "icomm.h"
 
-class SppComm
+class SppComm : public IComm
 {
 public:
     /**
     * @brief ctor: class constructor
     *
     * @param devAddr: device address
+    * @param metrics: if not NULL, receives the connect time and the wire byte counts
     * @return None.
     */
-    SppComm(BTH_ADDR devAddr);
+    SppComm(BTH_ADDR devAddr, ProtocolMetrics *metrics = NULL);
 
     /**
     * @brief dtor: class destructor.
@@ -68,7 +71,7 @@ public:
     *                   wait for the maxLen to be received.
     * @return Number of bytes received.
     */
-    int read(uint8_t *retMsg, int maxLen, DWORD maxWaitTimeMs);
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs);
 
 private:
     SOCKET sock;            // Socket used for the communication
@@ -77,6 +80,7 @@ private:
     volatile bool sendBusy; // When true, someone is in the send function
     volatile bool readBusy; // When true, someone is in the read function
     volatile bool exiting;  // When true, we need to destroy the object
+    ProtocolMetrics *metrics;   // Metrics of the session (may be NULL)
 };
 
 #endif // _SPPCOMM_H
@@ -0,0 +1,185 @@
+/*
+* StreamPacket.cpp : This file contains the decoder of the binary stream packets of the "B" SLIP
+*               channel, the samples a device streams in real time.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <string.h>
+#include "StreamPacket.h"
+#include "Slip.h"
+#include "ErrCodes.h"
+
+StreamPacketParser::StreamPacketParser()
+{
+    for (uint32_t c = 0; c < BSTREAM_CHANNELS; c++)     rings[c] = NULL;
+    memset(&counters, 0, sizeof(counters));
+    reset();
+}
+
+/**
+* @brief setRing: ring receiving the samples of a channel
+*
+* @param channel:   channel of the records (0: ChannelA, 1: ChannelB)
+* @param ring:      ring, written by the thread feeding the parser (NULL: samples dropped)
+* @return None.
+*/
+void StreamPacketParser::setRing(uint32_t channel, SampleRing *ring)
+{
+    if (channel < BSTREAM_CHANNELS)     rings[channel] = ring;
+}
+
+void StreamPacketParser::reset(void)
+{
+    synced = false;
+    nextSeq = 0;
+    partialLen = 0;
+    escaped = false;
+    skipping = false;
+}
+
+/**
+* @brief feed: deframe and parse bytes read from the connection. The bytes are modified:
+*           the frames are unescaped in place.
+*
+*   The unescaped byte is never written past the encoded one it comes from: a frame is rebuilt
+*   over its own encoded bytes and parsed there. The frame cut by the end of the bytes, already
+*   unescaped, is moved to partial; the next call completes it there.
+*
+* @param bytes:     SLIP encoded bytes, continuing those of the previous call
+* @param len:       number of bytes
+* @return Number of stream packets parsed
+*/
+uint32_t StreamPacketParser::feed(uint8_t *bytes, uint32_t len)
+{
+    uint8_t *frame = (partialLen > 0) ? partial : bytes;    // Where the current frame is rebuilt
+    uint32_t n = partialLen;                                // Bytes of the current frame
+    uint64_t before = counters.packets;
+
+    counters.bytes += len;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint8_t data = bytes[i];
+
+        if (data == SLIP_END_BYTE)
+        {
+            if ((skipping == false) && (n > 0))
+            {
+                if (frame[0] == BSTREAM_CHANNEL)    parse(frame, n);
+                else                                counters.otherFrames++;
+            }
+            frame = bytes + i + 1;
+            n = 0;
+            escaped = false;
+            skipping = false;
+            continue;
+        }
+        if (skipping)       continue;
+
+        if (escaped)
+        {
+            escaped = false;
+            if (data == SLIP_ESC_END_BYTE)          data = SLIP_END_BYTE;
+            else if (data == SLIP_ESC_ESC_BYTE)     data = SLIP_ESC_BYTE;
+            else
+            {
+                counters.framingErrors++;
+                skipping = true;
+                continue;
+            }
+        }
+        else if (data == SLIP_ESC_BYTE)
+        {
+            escaped = true;
+            continue;
+        }
+
+        if (n >= BSTREAM_PACKET_MAX)
+        {
+            // longer than any stream packet: a frame of another channel (update, JSON answers)
+            if (frame[0] == BSTREAM_CHANNEL)    counters.malformed++;
+            else                                counters.otherFrames++;
+            skipping = true;
+            continue;
+        }
+        frame[n++] = data;
+    }
+
+    if (skipping)               partialLen = 0;
+    else
+    {
+        if ((n > 0) && (frame != partial))  memmove(partial, frame, n);
+        partialLen = n;
+    }
+    return (uint32_t)(counters.packets - before);
+}
+
+/**
+* @brief parseFrame: parse a frame already deframed (Slip::read)
+*
+* @param frame:     frame, channel byte first
+* @param len:       number of bytes
+* @return ERR_OK, ERR_INV_RESPONSE (not a stream packet, or malformed)
+*/
+int StreamPacketParser::parseFrame(const uint8_t *frame, uint32_t len)
+{
+    counters.bytes += len;
+    if ((len == 0) || (frame[0] != BSTREAM_CHANNEL))
+    {
+        counters.otherFrames++;
+        return ERR_INV_RESPONSE;
+    }
+    if (len > BSTREAM_PACKET_MAX)
+    {
+        counters.malformed++;
+        return ERR_INV_RESPONSE;
+    }
+    return parse(frame, len);
+}
+
+/**
+* @brief parse: parse a stream packet, write its samples to the rings
+*
+* @return ERR_OK, ERR_INV_RESPONSE (not made of whole records: the whole records are kept)
+*/
+int StreamPacketParser::parse(const uint8_t *frame, uint32_t len)
+{
+    float samples[BSTREAM_CHANNELS][BSTREAM_RECORDS_MAX];
+    uint32_t counts[BSTREAM_CHANNELS] = { 0, 0 };
+    uint32_t records = (len - 1) / BSTREAM_RECORD_LEN;
+    const uint8_t *rec = frame + 1;
+
+    counters.packets++;
+    for (uint32_t r = 0; r < records; r++, rec += BSTREAM_RECORD_LEN)
+    {
+        uint16_t sum = 0;
+        for (uint32_t b = 0; b < BSTREAM_RECORD_LEN - 2; b++)  sum = (uint16_t)(sum + rec[b]);
+        if (sum != (uint16_t)(rec[7] | (rec[8] << 8)))
+        {
+            counters.checksumErrors++;
+            continue;
+        }
+
+        uint8_t seq = rec[6];
+        if (synced)         counters.seqLost += (uint8_t)(seq - nextSeq);
+        synced = true;
+        nextSeq = (uint8_t)(seq + 1);
+        counters.records++;
+
+        uint16_t mask = (uint16_t)(rec[0] | (rec[1] << 8));
+        if (mask & BSTREAM_HAS_A)   samples[0][counts[0]++] = (float)(int16_t)(rec[2] | (rec[3] << 8));
+        if (mask & BSTREAM_HAS_B)   samples[1][counts[1]++] = (float)(int16_t)(rec[4] | (rec[5] << 8));
+    }
+
+    for (uint32_t c = 0; c < BSTREAM_CHANNELS; c++)
+    {
+        if ((rings[c] != NULL) && (counts[c] > 0))      rings[c]->write(samples[c], counts[c]);
+        counters.samples[c] += counts[c];
+    }
+    if ((len - 1) % BSTREAM_RECORD_LEN != 0)
+    {
+        counters.malformed++;
+        return ERR_INV_RESPONSE;
+    }
+    return ERR_OK;
+}
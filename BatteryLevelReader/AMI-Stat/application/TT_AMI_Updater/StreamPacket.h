@@ -0,0 +1,121 @@
+/*
+* StreamPacket.h : This file contains the decoder of the binary stream packets of the "B" SLIP
+*               channel, the samples a device streams in real time.
+*
+*   In a nutshell, this class implements:
+*       - the SLIP deframing of the bytes read from the connection, in place: the bytes are
+*           unescaped in the buffer they were read in and the packets parsed where they lie.
+*           Only a packet cut by the end of a read is copied (into a fixed buffer), to be
+*           completed by the next one
+*       - the parsing of the packets (also of the frames already deframed by Slip::read): the
+*           records are read field by field from the frame, their samples gathered per channel
+*           on the stack and written with one SampleRing::write per channel and per packet
+*       - the counters of the records lost (sequence gaps, LOG_SEQ_LOST of the SDK), of the
+*           checksum errors (LOG_CHECKSUM_ERROR), of the malformed packets and framing errors
+*
+*   There is no allocation once constructed: the decoder follows the stream at any rate.
+*
+*   Packet: 'B', then whole records of BSTREAM_RECORD_LEN bytes (DataStream of
+*   AMICommandContent.h, little endian, packed), BSTREAM_PACKET_MAX bytes max
+*   (BlUETOOTH_MAX_STREAM_PACKET_SIZE):
+*       int16   ContentMask     BSTREAM_HAS_A: ChannelA holds a sample, BSTREAM_HAS_B: ChannelB
+*       int16   ChannelA
+*       int16   ChannelB
+*       uint8   SequenceNumber  +1 per record, modulo 256
+*       uint16  Checksum        16 bit sum of the 7 bytes before it
+*
+*   A record failing its checksum is dropped: it is counted as a checksum error and, as its
+*   sequence number cannot be trusted, as a record lost by the next valid one.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _STREAMPACKET_H
+#define _STREAMPACKET_H
+
+#include <stdint.h>
+#include "Acquisition.h"
+
+#define BSTREAM_CHANNEL         'B'         // SLIP channel of the stream packets
+#define BSTREAM_PACKET_MAX      520         // Largest packet, channel byte included (BlUETOOTH_MAX_STREAM_PACKET_SIZE)
+#define BSTREAM_RECORD_LEN      9           // Bytes of a record (DATA_STREAM_SIZE)
+#define BSTREAM_RECORDS_MAX     ((BSTREAM_PACKET_MAX - 1) / BSTREAM_RECORD_LEN)     // Records of the largest packet
+#define BSTREAM_CHANNELS        2           // Channels of a record (TTL_MAX_AMI_STREAMING_CHANNELS)
+#define BSTREAM_HAS_A           0x0001      // ContentMask: ChannelA holds a sample
+#define BSTREAM_HAS_B           0x0002      // ContentMask: ChannelB holds a sample
+
+typedef struct
+{
+    uint64_t bytes;             // Bytes fed (SLIP encoded), or frame bytes given to parseFrame()
+    uint64_t packets;           // Stream packets parsed
+    uint64_t records;           // Records passing their checksum
+    uint64_t samples[BSTREAM_CHANNELS];     // Samples decoded per channel
+    uint64_t seqLost;           // Records missing from the sequence
+    uint64_t checksumErrors;    // Records failing their checksum
+    uint64_t malformed;         // Stream packets not made of whole records, or too long
+    uint64_t framingErrors;     // SLIP escapes followed by an invalid byte
+    uint64_t otherFrames;       // Frames of the other channels (skipped)
+} StreamPacketStats;
+
+
+class StreamPacketParser
+{
+public:
+    StreamPacketParser();
+
+    /**
+    * @brief setRing: ring receiving the samples of a channel
+    *
+    * @param channel:   channel of the records (0: ChannelA, 1: ChannelB)
+    * @param ring:      ring, written by the thread feeding the parser (NULL: samples dropped)
+    * @return None.
+    */
+    void setRing(uint32_t channel, SampleRing *ring);
+
+    /**
+    * @brief reset: forget the partial frame and the sequence (new connection), keep the counters
+    *
+    * @return None.
+    */
+    void reset(void);
+
+    /**
+    * @brief feed: deframe and parse bytes read from the connection. The bytes are modified:
+    *           the frames are unescaped in place.
+    *
+    * @param bytes:     SLIP encoded bytes, continuing those of the previous call
+    * @param len:       number of bytes
+    * @return Number of stream packets parsed
+    */
+    uint32_t feed(uint8_t *bytes, uint32_t len);
+
+    /**
+    * @brief parseFrame: parse a frame already deframed (Slip::read)
+    *
+    * @param frame:     frame, channel byte first
+    * @param len:       number of bytes
+    * @return ERR_OK, ERR_INV_RESPONSE (not a stream packet, or malformed)
+    */
+    int parseFrame(const uint8_t *frame, uint32_t len);
+
+    const StreamPacketStats &stats(void)                                { return counters; }
+
+private:
+    /**
+    * @brief parse: parse a stream packet, write its samples to the rings
+    *
+    * @return ERR_OK, ERR_INV_RESPONSE
+    */
+    int parse(const uint8_t *frame, uint32_t len);
+
+    SampleRing *rings[BSTREAM_CHANNELS];    // Ring of each channel (may be NULL)
+    StreamPacketStats counters;         // Counters since the construction
+    bool synced;                        // A valid record was seen: nextSeq is meaningful
+    uint8_t nextSeq;                    // Sequence number expected next
+    uint8_t partial[BSTREAM_PACKET_MAX];    // Frame cut by the end of the previous feed()
+    uint32_t partialLen;                // Bytes in partial
+    bool escaped;                       // The previous feed() ended with an escape byte
+    bool skipping;                      // The current frame is skipped up to the next end byte
+};
+
+#endif // _STREAMPACKET_H
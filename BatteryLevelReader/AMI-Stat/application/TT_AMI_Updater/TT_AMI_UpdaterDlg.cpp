@@ -15,6 +15,8 @@
 #include "TT_AMI_UpdaterDlg.h"
 #include "package.h"
 #include "lang.h"
+#include "Slip.h"
+#include "TraceBuffer.h"
 #include <locale>
 #include <codecvt>
 #ifdef __PRODUCTION__
@@ -29,11 +31,16 @@
 #define IDS_BATTERY_ABOVE_25    L"Battery Level must be more than 25%"
 #define IDS_WARNING             L"Warning"
 #define IDS_KEEP_CHGR_CONNECTED L"Keep charger connected until unit has been fully updated"
+#define IDS_CHARGE_TIME         L"Charge time: "
 #define IDS_INFO                L"Information"
 #define IDS_PREREQUISITES       L"Before running the update program, close all sessions and navigate to the Home screen."
 
 
 #define _BAT_MON__TIMER_TICK_ 200
+#define CAPTURE_OPTION			L"/capture="		// Command line option followed by the folder receiving the capture files
+#define TRACE_OPTION			L"/trace="			// Command line option followed by the trace file written at exit (see TraceBuffer.h)
+#define FLIGHT_DUMP_KEY			'F'					// With Ctrl+Shift: dump the flight recorders of all the connections
+#define CHARGE_PROFILES_FILE	"AMI_ChargeProfiles.txt"	// Charge history of the devices, in the temp folder
 #ifdef _DEBUG
 #define new DEBUG_NEW
 #endif
@@ -52,6 +59,7 @@ CTTAMIUpdaterDlg::CTTAMIUpdaterDlg(LPTSTR pCmdLine, CWnd* pParent /*=nullptr*/)
 	, devLister(NULL)
 	, devInfoPoller(NULL)
 	, cmdLine(pCmdLine)
+	, selectedDevAddr(0)
 {
 	m_hIcon = AfxGetApp()->LoadIcon(IDR_MAINFRAME);
 }
@@ -68,6 +76,30 @@ CTTAMIUpdaterDlg::~CTTAMIUpdaterDlg()
 	assert(devUpgrader == NULL);
 	assert(devLister == NULL);
 	assert(devInfoPoller == NULL);
+	if (!chargeProfilesPath.empty())	chargeForecast.save(chargeProfilesPath.c_str());
+	TraceBuffer::stop();		// All the connections are closed: write the trace file if tracing
+}
+
+/**
+* @brief extractOption: remove a "<name><value>" option from the command line options
+*
+* @param options:	command line options, the option is removed from it
+* @param name:		option name, including the '=' (e.g. CAPTURE_OPTION)
+* @param value:		receives the value of the option (up to the next space)
+* @return true if the option was found
+*/
+static bool extractOption(std::wstring &options, const wchar_t *name, std::wstring &value)
+{
+	size_t optionPos = options.find(name);
+	if (optionPos == std::wstring::npos)	return false;
+
+	size_t valuePos = optionPos + wcslen(name);
+	size_t valueEnd = options.find(L' ', valuePos);
+	if (valueEnd == std::wstring::npos)		valueEnd = options.length();
+	value = options.substr(valuePos, valueEnd - valuePos);
+	options.erase(optionPos, valueEnd - optionPos);
+	while ((options.length() != 0) && (options[0] == L' '))	options.erase(0, 1);
+	return true;
 }
 
 /**
@@ -111,8 +143,26 @@ BEGIN_MESSAGE_MAP(CTTAMIUpdaterDlg, CDialog)
 	ON_BN_CLICKED(IDM_CSP, &CTTAMIUpdaterDlg::OnBnClickedCsp)
 	ON_WM_TIMER()
 	ON_WM_TIMER()
+	ON_MESSAGE(WM_UI_QUEUE, &CTTAMIUpdaterDlg::OnUiQueue)
 END_MESSAGE_MAP()
 
+/**
+* @brief PreTranslateMessage: catch the Ctrl+Shift+F shortcut dumping the flight recorders in the temp folder
+*
+* @param pMsg: message about to be dispatched
+* @return TRUE if the message was processed
+*/
+BOOL CTTAMIUpdaterDlg::PreTranslateMessage(MSG* pMsg)
+{
+	if ((pMsg->message == WM_KEYDOWN) && (pMsg->wParam == FLIGHT_DUMP_KEY) &&
+		(GetKeyState(VK_CONTROL) < 0) && (GetKeyState(VK_SHIFT) < 0))
+	{
+		MessageBeep((FlightRecorder::dumpAll("dump requested by the user") == 0) ? MB_OK : MB_ICONHAND);
+		return TRUE;
+	}
+	return CDialog::PreTranslateMessage(pMsg);
+}
+
 /**
 * @brief OnInitDialog: handler for dialog box initialisation message
 *
@@ -124,10 +174,11 @@ END_MESSAGE_MAP()
 #ifdef __PRODUCTION__
 void CTTAMIUpdaterDlg::ProductionNotify(ProductionHelper::Notifications id, void  * reserved, void  * parameter)
 {
-	if (id == ProductionHelper::DEVICE_POWERED_ON)
-	{
-		static_cast<CTTAMIUpdaterDlg*>(parameter)->SetWindowTextW(_T("Connecting..."));
-	}
+	// Called from the SDK threads: forward to the UI thread
+	UiEvent evt;
+	evt.type = UIEVT_PRODUCTION;
+	evt.value = id;
+	static_cast<CTTAMIUpdaterDlg*>(parameter)->uiQueue.post(evt);
 
 }
 
@@ -142,6 +193,9 @@ void __stdcall HBCB(unsigned int handle, void * param)
 BOOL CTTAMIUpdaterDlg::OnInitDialog()
 {
 	CDialog::OnInitDialog();
+	// Before any worker thread or callback can post to the queue
+	uiQueue.setWakeup(uiQueueWakeup, this);
+	deviceEvents.subscribe(DEVEVT_MASK(DEVEVT_BATTERY), deviceEventEntry, this);
 
 #ifdef __PRODUCTION__
 	//GetDlgItem(IDC_DEVLIST_REFRESH_BUTTON)->EnableWindow(TRUE);
@@ -164,7 +218,23 @@ BOOL CTTAMIUpdaterDlg::OnInitDialog()
 	// get language from region format
 	WCHAR pszLanguage[LOCALE_NAME_MAX_LENGTH];  // arbritary string size
 	GetLocaleInfoEx(LOCALE_NAME_USER_DEFAULT, LOCALE_SENGLISHLANGUAGENAME, pszLanguage, LOCALE_NAME_MAX_LENGTH);
-	if (wcslen(cmdLine) != 0)	wcsncpy(pszLanguage, cmdLine, LOCALE_NAME_MAX_LENGTH);			// override with command line option for test purposes
+	// The flight recorders of the connections are dumped in the temp folder on error
+	char tempPath[MAX_PATH];
+	if (GetTempPathA(MAX_PATH, tempPath) > 0)
+	{
+		FlightRecorder::setDumpFolder(tempPath);
+		// The charge history of the devices is kept from one run to the next
+		chargeProfilesPath = std::string(tempPath) + CHARGE_PROFILES_FILE;
+		chargeForecast.load(chargeProfilesPath.c_str());
+	}
+
+	std::wstring options(cmdLine);
+	std::wstring optionValue;
+	// "/capture=<folder>": record the traffic of every device connection (see WireCapture.h)
+	if (extractOption(options, CAPTURE_OPTION, optionValue))	Slip::setCaptureFolder(CW2A(optionValue.c_str()));
+	// "/trace=<file>": collect the trace points until exit (only in builds with AMI_TRACE defined)
+	if (extractOption(options, TRACE_OPTION, optionValue))		TraceBuffer::start(CW2A(optionValue.c_str()));
+	if (options.length() != 0)	wcsncpy(pszLanguage, options.c_str(), LOCALE_NAME_MAX_LENGTH);		// override with command line option for test purposes
 
     // Put text in proper language on static objects in UI
 	langInit(pszLanguage);
@@ -323,7 +393,13 @@ void CTTAMIUpdaterDlg::deviceListNotifEntry(void *ctx, const wchar_t *devName, B
 
 	CTTAMIUpdaterDlg *pDlg = static_cast<CTTAMIUpdaterDlg *>(ctx);
 
-	pDlg->deviceListNotif(devName, devAddr, isPaired);
+	UiEvent evt;
+	evt.type = UIEVT_DEVLIST;
+	evt.value = (devName == NULL);
+	if (devName != NULL)    evt.text[0] = devName;
+	evt.value64 = devAddr;
+	evt.flag = isPaired;
+	pDlg->uiQueue.post(evt);
 }
 
 /**
@@ -395,6 +471,7 @@ void CTTAMIUpdaterDlg::OnLbnSelchangeDevList()
 	lock.Unlock();
 
 	if (devInfoPoller)  delete devInfoPoller;
+	selectedDevAddr = devAddr;                  // After the delete: the battery read with the info is this device's
 	devInfoPoller = new DeviceInfo(devAddr, deviceInfoNotifEntry, this);
 
 #endif
@@ -413,15 +490,26 @@ void CTTAMIUpdaterDlg::OnLbnSelchangeDevList()
 * @param serialNb:      Serial number of that device
 * @param firmwareVer:   Current firmware version of that device
 * @param errMsg:        Any error message encountered during the polling
+* @param battery:       Battery status read after the info (NULL if not read)
 * @return         None
 */
-void CTTAMIUpdaterDlg::deviceInfoNotifEntry(void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg)
+void CTTAMIUpdaterDlg::deviceInfoNotifEntry(void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg,
+                                            const BatteryReading *battery)
 {
 	// NEVER DELETE THE devPoller IN THIS THREAD (DEAD LOCK CONDITION GUARANTEED)
 
 	CTTAMIUpdaterDlg *pDlg = static_cast<CTTAMIUpdaterDlg *>(ctx);
 
-	pDlg->deviceInfoNotif(productId, serialNb, firmwareVer, errMsg);
+	UiEvent evt;
+	evt.type = UIEVT_DEVINFO;
+	evt.text[0] = productId;
+	evt.text[1] = serialNb;
+	evt.text[2] = firmwareVer;
+	evt.text[3] = errMsg;
+	pDlg->uiQueue.post(evt);
+
+	// After the info: its error message would hide the battery level
+	if (battery != NULL)	pDlg->feedBattery((BTH_ADDR)pDlg->selectedDevAddr.load(), battery);
 }
 
 /**
@@ -476,6 +564,121 @@ void CTTAMIUpdaterDlg::BatteryStatusNotif(const  unsigned char * soc, const unsi
 // Device Update section
 ///////////////////////////////////////////////////////////////////////////////
 
+/**
+* @brief batteryDeviceKey: Key of a device in the battery statistics and the charge forecast
+*
+* @param devAddr:   device MAC address
+* @return           address in hexadecimal
+*/
+static std::string batteryDeviceKey(BTH_ADDR devAddr)
+{
+    char key[32];
+    sprintf_s(key, sizeof(key), "%012llX", (unsigned long long)devAddr);
+    return key;
+}
+
+/**
+* @brief readBattery: Read the battery status of a device. The reading reaches the statistics and
+*                     the forecast through deviceEvents, on the calling thread.
+*
+* @param devAddr:   device MAC address
+* @return           battery status procedure instance, to delete by the caller
+*/
+IBatteryStatus *CTTAMIUpdaterDlg::readBattery(BTH_ADDR devAddr)
+{
+    std::lock_guard<std::mutex> guard(batteryReadLock);
+    batteryReadKey = batteryDeviceKey(devAddr);
+    return new IBatteryStatus(devAddr, &deviceEvents);
+}
+
+/**
+* @brief feedBattery: Give a battery reading taken by another procedure (device info) to the
+*                     statistics and the forecast, through deviceEvents
+*
+* @param devAddr:   device MAC address
+* @param reading:   battery status
+* @return None.
+*/
+void CTTAMIUpdaterDlg::feedBattery(BTH_ADDR devAddr, const BatteryReading *reading)
+{
+    std::lock_guard<std::mutex> guard(batteryReadLock);
+    batteryReadKey = batteryDeviceKey(devAddr);
+    deviceEvents.onBattery((int64_t)GetTickCount64(), reading->soc, reading->voltage, reading->charging);
+}
+
+void CTTAMIUpdaterDlg::deviceEventEntry(void *ctx, const DeviceEvent *evt)
+{
+    static_cast<CTTAMIUpdaterDlg *>(ctx)->deviceEvent(evt);
+}
+
+/**
+* @brief deviceEvent: Notification of deviceEvents, on the thread reading the device (batteryReadLock held).
+*                     The reading of the selected device is shown with the time it needs on the charger.
+*
+* @param evt:       event
+* @return None.
+*/
+void CTTAMIUpdaterDlg::deviceEvent(const DeviceEvent *evt)
+{
+    if (evt->type != DEVEVT_BATTERY)    return;
+    batteryStats.update(batteryReadKey, evt->timeMs, evt->soc, evt->voltage, evt->charging);
+    chargeForecast.update(batteryReadKey, evt->timeMs, evt->soc, evt->charging);
+
+    uint64_t devAddr = selectedDevAddr.load();
+    if (batteryReadKey != batteryDeviceKey((BTH_ADDR)devAddr))    return;
+
+    CString str;
+    str.Format(_T("%s %d%% %d mV "), IDS_BATTERY_LEVEL, (int)evt->soc, (int)evt->voltage);
+    if (evt->charging)
+        str += _T("Charging");
+    if (evt->soc < CHARGE_UPDATE_MIN_SOC)
+    {
+        ChargeForecast forecast;
+        chargeForecast.forecast(batteryReadKey, evt->timeMs, CHARGE_UPDATE_MIN_SOC, forecast);
+        str += chargeWaitText(forecast, L" - ");
+    }
+
+    UiEvent uiEvt;
+    uiEvt.type = UIEVT_BATTERY;
+    uiEvt.text[0] = (const wchar_t *)str;
+    uiEvt.value64 = devAddr;
+    uiQueue.post(uiEvt);
+}
+
+/**
+* @brief batteryGateLevel: Battery level to compare to the minimum level required to update.
+*                          A single reading can be off by a few percent (the gauge estimates the
+*                          SOC from the voltage under load). Once the statistics window is full,
+*                          the lower of the rolling mean and the last reading is used: a high
+*                          reading does not pass alone, and a falling battery is not averaged up.
+*
+* @param soc:       last SOC reading (%)
+* @param stats:     rolling statistics of that device (NULL if none)
+* @return           SOC level (%)
+*/
+unsigned char CTTAMIUpdaterDlg::batteryGateLevel(unsigned char soc, const BatteryStatsSnapshot *stats)
+{
+    if (stats == NULL || !stats->valid)     return soc;
+    unsigned char mean = (unsigned char)(stats->socMean + 0.5);
+    return (mean < soc) ? mean : soc;
+}
+
+/**
+* @brief chargeWaitText: Time the technician must wait for the battery to reach the level
+*                        required to update, shown with the battery messages
+*
+* @param forecast:  charge forecast of the device
+* @param separator: text put before it
+* @return           e.g. "<separator>Charge time: about 12 min to 25% (9-16 min)", empty if no forecast
+*/
+CString CTTAMIUpdaterDlg::chargeWaitText(const ChargeForecast &forecast, const wchar_t *separator)
+{
+    char text[96];
+    chargeFormatWait(forecast, CHARGE_UPDATE_MIN_SOC, text, sizeof(text));
+    if (text[0] == '\0')    return CString();
+    return CString(separator) + IDS_CHARGE_TIME + CString(text);
+}
+
 /**
 * @brief OnBnClickedButtonUpdate: Update button pressed
 *
@@ -492,16 +695,17 @@ void CTTAMIUpdaterDlg::OnBnClickedButtonUpdate()
 	ManageEnables(IDC_UPDATE_BUTTON, true);
 	MessageBox(IDS_PREREQUISITES, IDS_INFO, MB_OK);
 #ifdef __PRODUCTION__
-	unsigned char soc = 0;
-	unsigned short v;
-	bool charging = false;
-
-	bool result = _productionHelper.GetBatteryStatus( soc, charging,v);
-	if (!result)
+	// Use the status polled in background: the device is not queried from the UI thread
+	DeviceSnapshot snapshot;
+	_productionHelper.GetSnapshot(snapshot);
+	if (!snapshot.batteryValid)
 	{
 		MessageBox(IDS_CANT_COMM, IDS_ERROR, MB_OK);
 		return;
 	}
+	unsigned char soc = snapshot.battery.SOC;
+	unsigned short v = snapshot.battery.Voltage;
+	bool charging = snapshot.battery.Charging != 0;
 
 	CString str;
 
@@ -511,21 +715,24 @@ void CTTAMIUpdaterDlg::OnBnClickedButtonUpdate()
 
 	devListErrMsg.SetWindowTextW(str);
 
-	return;
-	if ((soc < 25 ) )
+	BatteryStatsSnapshot stats;
+	if (batteryGateLevel(soc, _productionHelper.GetBatteryStats(stats) ? &stats : NULL) < CHARGE_UPDATE_MIN_SOC)
 	{
+		ChargeForecast forecast;
+		_productionHelper.GetChargeForecast(CHARGE_UPDATE_MIN_SOC, forecast);
+		CString wait = chargeWaitText(forecast, L"\n");
 		if (charging)
 		{
-			MessageBox(IDS_KEEP_CHGR_CONNECTED, IDS_WARNING, MB_OK);
+			MessageBox(IDS_KEEP_CHGR_CONNECTED + wait, IDS_WARNING, MB_OK);
 		}
 		else
 		{
-			MessageBox(IDS_BATTERY_ABOVE_25,  IDS_ERROR, MB_OK);
+			MessageBox(IDS_BATTERY_ABOVE_25 + wait,  IDS_ERROR, MB_OK);
 			return;
 		}
 	}
 
-
+	return;
 
 	_productionHelper.UpdateDevice(deviceUpdateFeedbackEntry, this, package, sizeof(package));
 #else
@@ -541,20 +748,27 @@ void CTTAMIUpdaterDlg::OnBnClickedButtonUpdate()
 
 	//////////////// Requesting battery status
 	bool Skip = false;
-	IBatteryStatus * BatteryStatusPoller = new IBatteryStatus(devAddr);
+	IBatteryStatus * BatteryStatusPoller = readBattery(devAddr);		// The reading feeds the statistics and the forecast
 	if (!BatteryStatusPoller->getError())
 	{
 		unsigned char SOC = BatteryStatusPoller->getSOC();
 		bool charging = BatteryStatusPoller->getCharging();
-		if (SOC < 25 )
+		std::string devKey = batteryDeviceKey(devAddr);
+		int64_t now = (int64_t)GetTickCount64();
+
+		BatteryStatsSnapshot stats;
+		if (batteryGateLevel(SOC, batteryStats.get(devKey, stats) ? &stats : NULL) < CHARGE_UPDATE_MIN_SOC)
 		{
+			ChargeForecast forecast;
+			chargeForecast.forecast(devKey, now, CHARGE_UPDATE_MIN_SOC, forecast);
+			CString wait = chargeWaitText(forecast, L"\n");
 			if (charging)
 			{
-				MessageBox(IDS_KEEP_CHGR_CONNECTED, IDS_WARNING, MB_OK);
+				MessageBox(IDS_KEEP_CHGR_CONNECTED + wait, IDS_WARNING, MB_OK);
 			}
 			else
 			{
-				MessageBox(IDS_BATTERY_ABOVE_25, IDS_ERROR, MB_OK);
+				MessageBox(IDS_BATTERY_ABOVE_25 + wait, IDS_ERROR, MB_OK);
 				Skip = true;
 			}
 		}
@@ -595,7 +809,18 @@ void CTTAMIUpdaterDlg::deviceUpdateFeedbackEntry(void *ctx, int percent, const w
 
 	CTTAMIUpdaterDlg *pDlg = static_cast<CTTAMIUpdaterDlg *>(ctx);
 
-	pDlg->deviceUpdateFeedback(percent, errMsg, endProcedure);
+	if (*errMsg == L'\0' && !endProcedure)
+	{
+		pDlg->uiQueue.postProgress(UI_SLOT_UPDATE, percent);    // Only the latest percent is shown
+		return;
+	}
+
+	UiEvent evt;
+	evt.type = UIEVT_UPDATE;
+	evt.value = percent;
+	evt.text[0] = errMsg;
+	evt.flag = endProcedure;
+	pDlg->uiQueue.post(evt);
 }
 
 /**
@@ -689,7 +914,10 @@ void CTTAMIUpdaterDlg::deviceUpgradeFeedbackEntry(void *ctx, const wchar_t *errM
 
 	CTTAMIUpdaterDlg *pDlg = static_cast<CTTAMIUpdaterDlg *>(ctx);
 
-	pDlg->deviceUpgradeFeedback(errMsg);
+	UiEvent evt;
+	evt.type = UIEVT_UPGRADE;
+	evt.text[0] = errMsg;
+	pDlg->uiQueue.post(evt);
 }
 
 /**
@@ -712,6 +940,80 @@ void CTTAMIUpdaterDlg::deviceUpgradeFeedback(const wchar_t *errMsg)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Worker threads notifications
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+* @brief uiQueueWakeup: Called by uiQueue (on a worker thread) when events become pending
+*
+* @param ctx:       this object
+* @return None.
+*/
+void CTTAMIUpdaterDlg::uiQueueWakeup(void *ctx)
+{
+	CTTAMIUpdaterDlg *pDlg = static_cast<CTTAMIUpdaterDlg *>(ctx);
+
+	::PostMessage(pDlg->GetSafeHwnd(), WM_UI_QUEUE, 0, 0);
+}
+
+/**
+* @brief OnUiQueue: Process the events queued by the worker threads. A bounded number of events
+*                   is processed per message so user input keeps being served; uiQueue posts
+*                   another message if some remain.
+*
+* @return 0
+*/
+LRESULT CTTAMIUpdaterDlg::OnUiQueue(WPARAM wParam, LPARAM lParam)
+{
+	uiQueue.drain(uiEventEntry, this, UI_QUEUE_MAX_EVENTS);
+	return 0;
+}
+
+void CTTAMIUpdaterDlg::uiEventEntry(void *ctx, const UiEvent *evt)
+{
+	static_cast<CTTAMIUpdaterDlg *>(ctx)->uiEvent(evt);
+}
+
+/**
+* @brief uiEvent: Dispatch an event from a worker thread. Runs on the UI thread.
+*
+* @param evt:       event to process
+* @return None.
+*/
+void CTTAMIUpdaterDlg::uiEvent(const UiEvent *evt)
+{
+	switch (evt->type)
+	{
+		case UIQ_TYPE_PROGRESS:
+			if (evt->slot == UI_SLOT_UPDATE)    deviceUpdateFeedback(evt->value, L"", false);
+			break;
+		case UIEVT_DEVLIST:
+			deviceListNotif(evt->value ? NULL : evt->text[0].c_str(), (BTH_ADDR)evt->value64, evt->flag);
+			break;
+		case UIEVT_DEVINFO:
+			deviceInfoNotif(evt->text[0].c_str(), evt->text[1].c_str(), evt->text[2].c_str(), evt->text[3].c_str());
+			break;
+		case UIEVT_UPDATE:
+			deviceUpdateFeedback(evt->value, evt->text[0].c_str(), evt->flag);
+			break;
+		case UIEVT_UPGRADE:
+			deviceUpgradeFeedback(evt->text[0].c_str());
+			break;
+		case UIEVT_BATTERY:
+			if (evt->value64 == selectedDevAddr.load())     devListErrMsg.SetWindowTextW(evt->text[0].c_str());     // Still the device selected
+			break;
+#ifdef __PRODUCTION__
+		case UIEVT_PRODUCTION:
+			if (evt->value == ProductionHelper::DEVICE_POWERED_ON)
+				SetWindowTextW(_T("Connecting..."));
+			break;
+#endif
+		default:
+			break;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Management of visual behavior
 ///////////////////////////////////////////////////////////////////////////////
@@ -834,6 +1136,8 @@ void CTTAMIUpdaterDlg::OnBnClickedOsp()
 		GetDlgItem(IDM_RDI)->EnableWindow(TRUE);
 		PortIsOpened = true;
 		_productionHelper.EnableHeartBeat();
+		_productionHelper.StartPolling();
+		devListErrMsg.SetWindowTextW(_T("Connecting..."));
 	}
 	else
 	{
@@ -845,45 +1149,51 @@ void CTTAMIUpdaterDlg::OnBnClickedOsp()
 ///////////////////////////////////////////////////////////////////////////////////
 void CTTAMIUpdaterDlg::ReadDeviceInfo()
 {
-	//OnBnClickedButtonRefresh();
-	//_productionHelper.EnableHeartBeat();
+#ifdef	__PRODUCTION__
+	_productionHelper.RequestRefresh();		// Read in background, shown by OnTimer
+#endif
+}
 
-//	devListErrMsg.SetWindowTextW(_productionHelper.EnableHeartBeat()?_T("Online"):_T("Offline"));
-	//return;
 #ifdef	__PRODUCTION__
-	DeviceInfoC device_info;
-	bool result = _productionHelper.GetDeviceInfo(device_info);
-	if (result)
+/**
+* @brief ShowDeviceSnapshot: Updates the UI with the values polled in background
+*
+* @param snapshot:  last values polled
+* @return None.
+*/
+void CTTAMIUpdaterDlg::ShowDeviceSnapshot(const DeviceSnapshot &snapshot)
+{
+	if (!snapshot.infoValid)
 	{
-		productId.SetWindowTextW(CString(device_info.ProductNumber));
-		serialNb.SetWindowTextW(CString(device_info.SerialNumber));
-		currentFwVersion.SetWindowTextW(CString(device_info.FirmwareVersion));
-		devInfoFwVer = CString(device_info.FirmwareVersion);
-	}
-	else
+		devListErrMsg.SetWindowTextW(_T("Connecting..."));
 		return;
-	unsigned char soc = 0;
-	bool charging = false;
-	unsigned short v;
+	}
 
-	result = _productionHelper.GetBatteryStatus(soc, charging,v);
-	if (!result)
-	{
+	productId.SetWindowTextW(CString(snapshot.info.ProductNumber));
+	serialNb.SetWindowTextW(CString(snapshot.info.SerialNumber));
+	currentFwVersion.SetWindowTextW(CString(snapshot.info.FirmwareVersion));
+	devInfoFwVer = CString(snapshot.info.FirmwareVersion);
+
+	if (!snapshot.batteryValid)
 		return;
-	}
 
-	
 	CString str;
 
-	str.Format(_T("%s %d%% %d mV "), IDS_BATTERY_LEVEL, (int)soc, v);
-	if (charging)
+	str.Format(_T("%s %d%% %d mV "), IDS_BATTERY_LEVEL, (int)snapshot.battery.SOC, snapshot.battery.Voltage);
+	if (snapshot.battery.Charging)
 		str.Format(_T("%s %s"), str, _T("Charging"));
+	if (snapshot.battery.SOC < CHARGE_UPDATE_MIN_SOC)
+	{
+		ChargeForecast forecast;
+		_productionHelper.GetChargeForecast(CHARGE_UPDATE_MIN_SOC, forecast);
+		str += chargeWaitText(forecast, L" - ");
+	}
 
 	devListErrMsg.SetWindowTextW(str);
 
 	ManageEnables(IDC_DEVLIST_LIST, false);
-#endif
 }
+#endif
 ///////////////////////////////////////////////////////////////////////////////////
 void CTTAMIUpdaterDlg::OnBnClickedCsp()
 {
@@ -900,36 +1210,25 @@ void CTTAMIUpdaterDlg::OnBnClickedCsp()
 
 
 
-bool ComIsBusy = false;
-UINT32 TickTimerCounter = 0;
-UINT32 LastTickTimerCounter = 0;
-bool charging;
-
+/**
+* @brief OnTimer: Shows the values polled in background. No device access here: the poll
+*                 scheduler of the production helper does it on its own thread. Also drains the
+*                 queue of the worker threads, should a wakeup message ever be lost.
+*
+* @param nIDEvent:  timer id
+* @return None.
+*/
 void CTTAMIUpdaterDlg::OnTimer(UINT_PTR nIDEvent)
 {
-	TickTimerCounter += _BAT_MON__TIMER_TICK_;
-	UINT32 deltaT = TickTimerCounter - LastTickTimerCounter;
-	if (ComIsBusy)return;
-	ComIsBusy = true;
-	if (PortIsOpened)
+	uiQueue.drain(uiEventEntry, this, UI_QUEUE_MAX_EVENTS);
+#ifdef	__PRODUCTION__
+	DeviceSnapshot snapshot;
+	if (PortIsOpened && _productionHelper.GetSnapshot(snapshot, lastSnapshotSeq))
 	{
-		devListErrMsg.SetWindowTextW(_T("Connecting..."));
+		lastSnapshotSeq = snapshot.seq;
+		ShowDeviceSnapshot(snapshot);
 		UpdateData(FALSE);
-		ReadDeviceInfo();
-		UpdateData(FALSE);
-	}
-	else
-	{
-		//OnBnClickedButtonRefresh();
-	}
-	if (deltaT > 3000)
-	{
-		LastTickTimerCounter = TickTimerCounter;
-		charging = !charging;
-		if(_productionHelper.isBatStatValid())
-			_productionHelper.Set5V_Relay(charging); //_productionHelper.LastBatStat.Charging);
-
 	}
+#endif
 	CDialog::OnTimer(nIDEvent);
-	ComIsBusy = false;
 }
@@ -9,13 +9,18 @@
 #pragma once
 #include <afxwin.h>
 #include <afxcmn.h>
+#include <atomic>
 #include <list>
+#include <mutex>
 #include <string>
 #include "DeviceUpdate.h"
 #include "DeviceUpgrade.h"
 #include "DeviceList.h"
 #include "DeviceInfo.h"
 #include "BatteryStatus.h"
+#include "BatteryStats.h"
+#include "ChargeForecast.h"
+#include "UiEventQueue.h"
 
 #ifdef __PRODUCTION__
 	#include "ProductionHelper.h"
@@ -25,6 +30,23 @@
 
 
 
+#define WM_UI_QUEUE             (WM_APP + 1)    // Events pending in uiQueue
+#define UI_QUEUE_MAX_EVENTS     32              // Max number of events processed per WM_UI_QUEUE message
+
+// Types of the events carried from the worker threads to the UI thread by uiQueue
+enum UiEventType
+{
+    UIEVT_DEVLIST,              // text[0]: device name, value64: address, flag: paired. value: 1 at end of list
+    UIEVT_DEVINFO,              // text[0..3]: product id, serial number, firmware version, error message
+    UIEVT_UPDATE,               // value: percent, text[0]: message, flag: end of procedure
+    UIEVT_UPGRADE,              // text[0]: message
+    UIEVT_PRODUCTION,           // value: ProductionHelper::Notifications
+    UIEVT_BATTERY,              // text[0]: battery level and charge time, value64: device address
+};
+
+// Progress slots of uiQueue
+#define UI_SLOT_UPDATE          0
+
 // DeviceElem:  Structure to hold the name of a device along with its pairing status and its MAC address
 struct DeviceElem
 {
@@ -78,6 +100,7 @@ public:
 
 	protected:
 	virtual void DoDataExchange(CDataExchange* pDX);	// DDX/DDV support
+	virtual BOOL PreTranslateMessage(MSG* pMsg);		// Ctrl+Shift+F: dump the flight recorders
 
 
 // Implementation
@@ -97,7 +120,8 @@ protected:
 
     static void deviceListNotifEntry(void *ctx, const wchar_t *devName, BTH_ADDR devAddr, bool isPaired);
     void deviceListNotif(const wchar_t *devName, BTH_ADDR devAddr, bool isPaired);
-    static void deviceInfoNotifEntry(void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg);
+    static void deviceInfoNotifEntry(void *ctx, const wchar_t *productId, const wchar_t *serialNb, const wchar_t *firmwareVer, const wchar_t *errMsg,
+                                     const BatteryReading *battery);
     void deviceInfoNotif(const wchar_t *_productId, const wchar_t *_serialNb, const wchar_t *_firmwareVer, const wchar_t *errMsg);
 	static void BatteryStatusNotifEntry(void *ctx, const  unsigned char * soc, const unsigned short *  voltage, const bool* charging, const wchar_t *errMsg);
 	void BatteryStatusNotif(const  unsigned char * soc, const unsigned short *  voltage, const bool* charging, const wchar_t *errMsg);
@@ -107,7 +131,23 @@ protected:
     void deviceUpdateFeedback(int percent, const wchar_t *errMsg, bool endProcedure);
 	void deviceUpgradeFeedback(const wchar_t *errMsg);
 
+    static void uiQueueWakeup(void *ctx);
+    static void uiEventEntry(void *ctx, const UiEvent *evt);
+    void uiEvent(const UiEvent *evt);
+    afx_msg LRESULT OnUiQueue(WPARAM wParam, LPARAM lParam);
+
+    static void deviceEventEntry(void *ctx, const DeviceEvent *evt);
+    void deviceEvent(const DeviceEvent *evt);
+    IBatteryStatus *readBattery(BTH_ADDR devAddr);
+    void feedBattery(BTH_ADDR devAddr, const BatteryReading *reading);
+
     void ManageEnables(int idcButton, bool begin);
+    unsigned char batteryGateLevel(unsigned char soc, const BatteryStatsSnapshot *stats);
+    CString chargeWaitText(const ChargeForecast &forecast, const wchar_t *separator);
+#ifdef __PRODUCTION__
+    void ShowDeviceSnapshot(const DeviceSnapshot &snapshot);
+    uint32_t lastSnapshotSeq = 0;       // Sequence of the last snapshot shown
+#endif
 
 public:
 #ifdef __PRODUCTION__
@@ -119,6 +159,7 @@ public:
 	LPTSTR cmdLine;						// Command line arguments
 
     CCriticalSection uiDataCs;          // Critical section to protect UI data from simultaneous changes and display
+    UiEventQueue uiQueue;               // Notifications from the worker threads, processed on the UI thread
 
     std::list<DeviceElem> deviceList;   // List of device detected on bluetooth with its associated data
     CListBox m_deviceListBox;           // List shown on screen
@@ -126,6 +167,13 @@ public:
     DeviceInfo *devInfoPoller;          // Device information poll procedure instance
     std::wstring devInfoFwVer;          // Firmware version received from API (from device information poller)
 
+    BatteryStatsEngine batteryStats;    // Rolling statistics of the battery readings per device address
+    ChargePredictorEngine chargeForecast;   // Charge time forecast per device address
+    std::string chargeProfilesPath;     // File keeping the charge history of the devices (empty: none)
+    DeviceEventHub deviceEvents;        // Battery readings, heartbeats and events pushed by the device
+    std::mutex batteryReadLock;         // One battery read at a time: its deviceEvents are for batteryReadKey
+    std::string batteryReadKey;         // Device address of the battery read in progress
+    std::atomic<uint64_t> selectedDevAddr;  // Device address selected (0: none): its battery readings are shown
     DeviceUpdate *devUpdater;           // Device update procedure instance
 	DeviceUpgrade *devUpgrader;			// Device upgrade procedure instance
 
@@ -0,0 +1,259 @@
+/*
+* TraceBuffer.cpp : This file contains the static trace points of the transport and protocol hot
+*               paths and the buffer collecting them into a binary trace file.
+*
+*   In a nutshell, this file implements:
+*       - the lock-free write of a trace record in the preallocated buffer
+*       - the trace file written when tracing stops, and its reader
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "TraceBuffer.h"
+
+#define TRACE_HEADER_LEN        26          // Fixed part of the header
+#define TRACE_RECORD_LEN        20          // Bytes per record in the file
+
+typedef struct
+{
+    const char *name;       // Name shown by the decoder
+    uint8_t kind;           // TRACE_KIND_xxx
+} PointInfo;
+
+static const PointInfo pointInfo[TRACEPT_COUNT] =
+{
+    { "none",           TRACE_KIND_INSTANT },
+    { "spp.connect",    TRACE_KIND_BEGIN },
+    { "spp.connect",    TRACE_KIND_END },
+    { "spp.send",       TRACE_KIND_BEGIN },
+    { "spp.send",       TRACE_KIND_END },
+    { "spp.read",       TRACE_KIND_BEGIN },
+    { "spp.read",       TRACE_KIND_END },
+    { "slip.send",      TRACE_KIND_BEGIN },
+    { "slip.send",      TRACE_KIND_END },
+    { "slip.read",      TRACE_KIND_BEGIN },
+    { "slip.read",      TRACE_KIND_END },
+    { "upd.session",    TRACE_KIND_BEGIN },
+    { "upd.session",    TRACE_KIND_END },
+    { "upd.chunk",      TRACE_KIND_INSTANT },
+    { "upd.ack",        TRACE_KIND_INSTANT },
+    { "upd.crc",        TRACE_KIND_INSTANT },
+    { "upg.key",        TRACE_KIND_BEGIN },
+    { "upg.key",        TRACE_KIND_END },
+};
+
+// In memory record: word is written last and is not 0 once the record is complete
+typedef struct
+{
+    std::atomic<int64_t> timeNs;        // TraceRecord.timeNs
+    std::atomic<uint32_t> arg1;         // TraceRecord.arg1
+    std::atomic<uint64_t> word;         // point | thread << 16 | arg0 << 32
+} Slot;
+
+std::atomic<bool> TraceBuffer::active(false);
+
+static std::mutex controlLock;              // Serializes start() and stop()
+static Slot *slots = NULL;                  // Buffer, allocated by the first start() and kept
+static std::atomic<uint64_t> nextRecord(0);  // Number of records claimed since start()
+static std::chrono::steady_clock::time_point origin;    // Steady clock time of start()
+static int64_t originUs;                    // System time of start() (us since 1970)
+static std::string tracePath;               // File written by stop()
+static std::atomic<uint16_t> threadCount(0);    // Number of threads that traced
+
+/**
+* @brief threadNumber: small number identifying the calling thread in the records
+*
+* @return Thread number, from 1
+*/
+static uint16_t threadNumber(void)
+{
+    static thread_local uint16_t number = 0;
+    if (number == 0)        number = ++threadCount;
+    return number;
+}
+
+static void put16(FILE *f, uint16_t v)      { fputc(v & 0xFF, f); fputc(v >> 8, f); }
+static void put32(FILE *f, uint32_t v)      { put16(f, (uint16_t)v); put16(f, (uint16_t)(v >> 16)); }
+static void put64(FILE *f, uint64_t v)      { put32(f, (uint32_t)v); put32(f, (uint32_t)(v >> 32)); }
+
+static uint64_t getLE(const uint8_t *p, int len)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < len; i++)   v |= ((uint64_t)p[i]) << (8 * i);
+    return v;
+}
+
+/**
+* @brief start: start collecting the trace points, to be written to a file by stop()
+*
+* @param path:      trace file to create when stopping
+* @return 0 on success, -1 if tracing is already started
+*/
+int TraceBuffer::start(const char *path)
+{
+    std::lock_guard<std::mutex> guard(controlLock);
+    if (active.load(std::memory_order_relaxed))     return -1;
+
+    if (slots == NULL)      slots = new Slot[TRACE_MAX_RECORDS];
+    for (int i = 0; i < TRACE_MAX_RECORDS; i++)     slots[i].word.store(0, std::memory_order_relaxed);
+
+    tracePath = (path != NULL) ? path : "";
+    origin = std::chrono::steady_clock::now();
+    originUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    nextRecord.store(0, std::memory_order_relaxed);
+    active.store(true, std::memory_order_release);
+    return 0;
+}
+
+/**
+* @brief stop: stop collecting and write the trace file
+*
+* @return 0 on success, -1 if tracing was not started or the file cannot be written
+*/
+int TraceBuffer::stop(void)
+{
+    std::lock_guard<std::mutex> guard(controlLock);
+    if (active.exchange(false) == false)    return -1;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));     // let the trace points in progress complete
+
+    uint64_t claimed = nextRecord.load(std::memory_order_acquire);
+    uint32_t kept = (uint32_t)std::min<uint64_t>(claimed, TRACE_MAX_RECORDS);
+
+    std::vector<TraceRecord> records;
+    records.reserve(kept);
+    for (uint32_t i = 0; i < kept; i++)
+    {
+        uint64_t word = slots[i].word.load(std::memory_order_acquire);
+        if ((word & 0xFFFF) == TRACEPT_NONE)    continue;       // still being written: lost
+
+        TraceRecord rec;
+        rec.timeNs = slots[i].timeNs.load(std::memory_order_relaxed);
+        rec.point = (uint16_t)word;
+        rec.thread = (uint16_t)(word >> 16);
+        rec.arg0 = (uint32_t)(word >> 32);
+        rec.arg1 = slots[i].arg1.load(std::memory_order_relaxed);
+        records.push_back(rec);
+    }
+    // records are claimed in time order, but a thread may be preempted between claiming and reading the clock
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord &a, const TraceRecord &b) { return a.timeNs < b.timeNs; });
+
+    FILE *f = fopen(tracePath.c_str(), "wb");
+    if (f == NULL)          return -1;
+
+    uint8_t header[8] = { 0 };
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    fwrite(header, 1, sizeof(header), f);
+    put64(f, (uint64_t)originUs);
+    put32(f, (uint32_t)records.size());
+    put32(f, (uint32_t)(claimed - records.size()));
+    put16(f, TRACEPT_COUNT);
+    for (int i = 0; i < TRACEPT_COUNT; i++)
+    {
+        size_t len = strlen(pointInfo[i].name);
+        fputc(pointInfo[i].kind, f);
+        fputc((int)len, f);
+        fwrite(pointInfo[i].name, 1, len, f);
+    }
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        put64(f, (uint64_t)records[i].timeNs);
+        put16(f, records[i].point);
+        put16(f, records[i].thread);
+        put32(f, records[i].arg0);
+        put32(f, records[i].arg1);
+    }
+    int err = ferror(f) ? -1 : 0;
+    fclose(f);
+    return err;
+}
+
+/**
+* @brief write: add a record. Lock-free, can be called from any thread. Use TRACEPT().
+*
+* @return None.
+*/
+void TraceBuffer::write(uint16_t point, uint32_t arg0, uint32_t arg1)
+{
+    uint64_t idx = nextRecord.fetch_add(1, std::memory_order_relaxed);
+    if (idx >= TRACE_MAX_RECORDS)   return;                     // full: counted as dropped by stop()
+
+    Slot &slot = slots[idx];
+    slot.timeNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count(), std::memory_order_relaxed);
+    slot.arg1.store(arg1, std::memory_order_relaxed);
+    slot.word.store((uint64_t)point | ((uint64_t)threadNumber() << 16) | ((uint64_t)arg0 << 32), std::memory_order_release);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// TraceReader
+/////////////////////////////////////////////////////////////////////////////////////////
+
+TraceReader::TraceReader()
+: startUs(0)
+, droppedCount(0)
+{
+}
+
+/**
+* @brief open: load a trace file in memory
+*
+* @param path:      trace file to read
+* @return 0 on success, -1 if the file cannot be read, -2 if it is not a valid trace file
+*/
+int TraceReader::open(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)          return -1;
+
+    std::vector<uint8_t> buf;
+    uint8_t block[64 * 1024];
+    size_t nb;
+    while ((nb = fread(block, 1, sizeof(block), f)) > 0)    buf.insert(buf.end(), block, block + nb);
+    fclose(f);
+
+    names.clear();
+    kinds.clear();
+    records.clear();
+
+    if ((buf.size() < TRACE_HEADER_LEN) || (memcmp(buf.data(), TRACE_MAGIC, 4) != 0) || (buf[4] != TRACE_VERSION))
+        return -2;
+
+    const uint8_t *pos = buf.data();
+    const uint8_t *end = pos + buf.size();
+    startUs = (int64_t)getLE(pos + 8, 8);
+    uint32_t recordCount = (uint32_t)getLE(pos + 16, 4);
+    droppedCount = (uint32_t)getLE(pos + 20, 4);
+    uint16_t points = (uint16_t)getLE(pos + 24, 2);
+    pos += TRACE_HEADER_LEN;
+
+    for (uint16_t i = 0; i < points; i++)
+    {
+        if (end - pos < 2)                  return -2;
+        uint8_t kind = *pos++;
+        size_t len = *pos++;
+        if ((size_t)(end - pos) < len)      return -2;
+        kinds.push_back(kind);
+        names.push_back(std::string((const char *)pos, len));
+        pos += len;
+    }
+
+    if ((size_t)(end - pos) < (size_t)recordCount * TRACE_RECORD_LEN)    return -2;
+    records.resize(recordCount);
+    for (uint32_t i = 0; i < recordCount; i++, pos += TRACE_RECORD_LEN)
+    {
+        records[i].timeNs = (int64_t)getLE(pos, 8);
+        records[i].point = (uint16_t)getLE(pos + 8, 2);
+        records[i].thread = (uint16_t)getLE(pos + 10, 2);
+        records[i].arg0 = (uint32_t)getLE(pos + 12, 4);
+        records[i].arg1 = (uint32_t)getLE(pos + 16, 4);
+    }
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+* TraceBuffer.h : This file contains the static trace points of the transport and protocol hot
+*               paths and the buffer collecting them into a binary trace file.
+*
+*   In a nutshell, this file implements:
+*       - TRACEPT(point, arg0, arg1): a static trace point. Without AMI_TRACE defined at build
+*           time it compiles to nothing (the arguments are not even evaluated). With AMI_TRACE,
+*           it costs one predictable branch on a relaxed atomic load while tracing is stopped.
+*       - TraceBuffer: started at runtime with a file name. A trace point then claims a record
+*           of a preallocated buffer with one atomic increment and writes it with relaxed stores:
+*           no lock, no allocation, no I/O. The buffer is written to the file when tracing stops.
+*           When it is full, the following records are dropped (and counted): the start of the
+*           session (connection, erase) is what matters most.
+*       - TraceReader: loads a trace file for the decoder (TT_AMI_Tools trace)
+*
+*   The points come in pairs (xxx and xxx_END, giving a duration) or alone (an instant, such as
+*   a chunk acknowledged). The file carries the names and kinds of the points, so an old
+*   decoder reads the traces of a newer updater.
+*
+*   Trace file format (little endian):
+*       header:     "AMIT" | version (1 byte) | reserved (3 bytes) | start time (8 bytes, us since 1970)
+*                   | records (4 bytes) | dropped records (4 bytes) | points (2 bytes)
+*       points:     kind (1 byte) | name length (1 byte) | name (no terminating 0), by point number
+*       records:    time since start (8 bytes, ns) | point (2 bytes) | thread (2 bytes)
+*                   | arg0 (4 bytes) | arg1 (4 bytes)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _TRACEBUFFER_H
+#define _TRACEBUFFER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#define TRACE_MAGIC             "AMIT"      // First 4 bytes of a trace file
+#define TRACE_VERSION           1           // Version of the file format
+#define TRACE_FILE_EXT          ".amitrace" // Extension of the trace files
+#define TRACE_MAX_RECORDS       (256 * 1024)    // Records kept per trace (24 bytes each in memory)
+
+#define TRACE_KIND_INSTANT      0           // Point marks an instant
+#define TRACE_KIND_BEGIN        1           // Point starts a duration, ended by the next point number
+#define TRACE_KIND_END          2           // Point ends the duration started by the previous point number
+
+// Trace points. A xxx_END point must follow its xxx point. Append new points at the end:
+// the numbers are stored in the trace files.
+typedef enum
+{
+    TRACEPT_NONE,               // Not used (marks a record being written)
+    TRACEPT_SPP_CONNECT,        // SppComm connecting the Bluetooth socket
+    TRACEPT_SPP_CONNECT_END,    //      arg0: 0 or -windows error
+    TRACEPT_SPP_SEND,           // SppComm::send            arg0: bytes
+    TRACEPT_SPP_SEND_END,       //      arg0: result
+    TRACEPT_SPP_READ,           // SppComm::read            arg0: max bytes, arg1: max wait ms
+    TRACEPT_SPP_READ_END,       //      arg0: result
+    TRACEPT_SLIP_SEND,          // Slip::send               arg0: bytes, arg1: channel << 8 | command
+    TRACEPT_SLIP_SEND_END,      //      arg0: result
+    TRACEPT_SLIP_READ,          // Slip::read               arg0: max wait ms
+    TRACEPT_SLIP_READ_END,      //      arg0: result, arg1: channel << 8 | command
+    TRACEPT_UPD_SESSION,        // UpdateSession::run       arg0: package length
+    TRACEPT_UPD_SESSION_END,    //      arg0: result, arg1: offset reached
+    TRACEPT_UPD_CHUNK,          // Update request sent      arg0: offset, arg1: data bytes
+    TRACEPT_UPD_ACK,            // Update response received arg0: offset of the next chunk
+    TRACEPT_UPD_CRC,            // Final request sent (device verifies the CRC)  arg0: package length
+    TRACEPT_UPG_KEY,            // DeviceUpgrade sending the key    arg0: key length
+    TRACEPT_UPG_KEY_END,        //      arg0: 0 or -1 (see the error message)
+    TRACEPT_COUNT
+} TracePoint;
+
+#ifdef AMI_TRACE
+#define TRACEPT(point, arg0, arg1)      do { if (TraceBuffer::active.load(std::memory_order_relaxed)) \
+                                            TraceBuffer::write((point), (uint32_t)(arg0), (uint32_t)(arg1)); } while (0)
+#else
+#define TRACEPT(point, arg0, arg1)      ((void)0)
+#endif
+
+typedef struct
+{
+    int64_t timeNs;         // Time since the start of the trace
+    uint16_t point;         // TracePoint
+    uint16_t thread;        // Number of the thread (1 = first thread that traced)
+    uint32_t arg0;          // Arguments (see TracePoint)
+    uint32_t arg1;
+} TraceRecord;
+
+
+class TraceBuffer
+{
+public:
+    /**
+    * @brief start: start collecting the trace points, to be written to a file by stop()
+    *
+    * @param path:      trace file to create when stopping
+    * @return 0 on success, -1 if tracing is already started
+    */
+    static int start(const char *path);
+
+    /**
+    * @brief stop: stop collecting and write the trace file
+    *
+    * @return 0 on success, -1 if tracing was not started or the file cannot be written
+    */
+    static int stop(void);
+
+    /**
+    * @brief write: add a record. Lock-free, can be called from any thread. Use TRACEPT().
+    *
+    * @return None.
+    */
+    static void write(uint16_t point, uint32_t arg0, uint32_t arg1);
+
+    static std::atomic<bool> active;    // true between start() and stop()
+};
+
+
+class TraceReader
+{
+public:
+    TraceReader();
+
+    /**
+    * @brief open: load a trace file in memory
+    *
+    * @param path:      trace file to read
+    * @return 0 on success, -1 if the file cannot be read, -2 if it is not a valid trace file
+    */
+    int open(const char *path);
+
+    int64_t startTimeUs(void) const                                     { return startUs; }
+    uint32_t dropped(void) const                                        { return droppedCount; }
+    size_t count(void) const                                            { return records.size(); }
+    const TraceRecord &record(size_t i) const                           { return records[i]; }
+    size_t pointCount(void) const                                       { return names.size(); }
+    const char *pointName(uint16_t point) const                         { return (point < names.size()) ? names[point].c_str() : "?"; }
+    uint8_t pointKind(uint16_t point) const                             { return (point < kinds.size()) ? kinds[point] : TRACE_KIND_INSTANT; }
+
+private:
+    int64_t startUs;                    // Start time of the trace (us since 1970)
+    uint32_t droppedCount;              // Records dropped because the buffer was full
+    std::vector<std::string> names;     // Names of the points, by number
+    std::vector<uint8_t> kinds;         // TRACE_KIND_xxx of the points, by number
+    std::vector<TraceRecord> records;   // Records, in time order
+};
+
+#endif // _TRACEBUFFER_H
@@ -0,0 +1,156 @@
+/*
+* UiEventQueue.cpp : This file contains the class responsible to carry the notifications of the
+*               worker threads to the UI thread.
+*
+*   In a nutshell, this class implements:
+*       - the lock-free push (one atomic exchange) and the single consumer pop
+*       - the progress coalescing
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include "UiEventQueue.h"
+
+UiEventQueue::UiEventQueue()
+    : head(&stub)
+    , tail(&stub)
+    , signaled(false)
+    , wakeupFn(NULL)
+    , wakeupCtx(NULL)
+{
+    stub.next.store(NULL);
+    for (int i = 0; i < UIQ_PROGRESS_SLOTS; i++)
+    {
+        progressValue[i].store(0);
+        progressQueued[i].store(false);
+    }
+}
+
+UiEventQueue::~UiEventQueue()
+{
+    Node *node;
+    while ((node = pop()) != NULL)  delete node;
+}
+
+void UiEventQueue::setWakeup(UiEventWakeup_t fn, void *ctx)
+{
+    wakeupCtx.store(ctx, std::memory_order_relaxed);
+    wakeupFn.store(fn, std::memory_order_release);
+
+    // A post before this found no wakeup function but left signaled set: nothing would drain it
+    if ((fn != NULL) && signaled.load(std::memory_order_acquire))
+        fn(ctx);
+}
+
+/**
+* @brief push: link a node at the head. Wait-free for the producers.
+*
+* @param node:      node to push
+* @return None.
+*/
+void UiEventQueue::push(Node *node)
+{
+    node->next.store(NULL, std::memory_order_relaxed);
+    Node *prev = head.exchange(node, std::memory_order_acq_rel);
+    // Between the exchange and this store, the consumer sees the list cut at prev: it waits for the next drain
+    prev->next.store(node, std::memory_order_release);
+}
+
+/**
+* @brief pop: unlink the node at the tail. Consumer thread only.
+*
+* @return node popped (to delete by the caller) or NULL if none is ready
+*/
+UiEventQueue::Node *UiEventQueue::pop(void)
+{
+    Node *t = tail;
+    Node *next = t->next.load(std::memory_order_acquire);
+
+    if (t == &stub)
+    {
+        if (next == NULL)   return NULL;        // Empty
+        tail = next;                            // Skip the stub
+        t = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        tail = next;
+        return t;
+    }
+
+    // t is the last node: re-insert the stub behind it so t can be released
+    if (t != head.load(std::memory_order_acquire))  return NULL;    // A producer is linking a node
+    push(&stub);
+    next = t->next.load(std::memory_order_acquire);
+    if (next != NULL)
+    {
+        tail = next;
+        return t;
+    }
+    return NULL;
+}
+
+/**
+* @brief signal: call the wakeup function if the queue was idle
+*
+* @return None.
+*/
+void UiEventQueue::signal(void)
+{
+    if (signaled.exchange(true, std::memory_order_acq_rel))    return;
+
+    UiEventWakeup_t fn = wakeupFn.load(std::memory_order_acquire);
+    if (fn != NULL)     fn(wakeupCtx.load(std::memory_order_relaxed));
+}
+
+void UiEventQueue::post(const UiEvent &evt)
+{
+    Node *node = new Node;
+    node->evt = evt;
+    push(node);
+    signal();
+}
+
+void UiEventQueue::postProgress(int slot, int value)
+{
+    if (slot < 0 || slot >= UIQ_PROGRESS_SLOTS)     return;
+
+    progressValue[slot].store(value, std::memory_order_release);
+    if (progressQueued[slot].exchange(true, std::memory_order_acq_rel))
+        return;                                 // The entry in the queue will carry this value
+
+    Node *node = new Node;
+    node->evt.type = UIQ_TYPE_PROGRESS;
+    node->evt.slot = slot;
+    push(node);
+    signal();
+}
+
+int UiEventQueue::drain(UiEventNotif_t fn, void *ctx, int maxEvents)
+{
+    signaled.store(false, std::memory_order_release);
+
+    int count = 0;
+    while (count < maxEvents)
+    {
+        Node *node = pop();
+        if (node == NULL)   break;
+
+        if (node->evt.type == UIQ_TYPE_PROGRESS)
+        {
+            // Clear the flag before reading the value: a progress posted afterward queues a new entry
+            progressQueued[node->evt.slot].store(false, std::memory_order_release);
+            node->evt.value = progressValue[node->evt.slot].load(std::memory_order_acquire);
+        }
+        fn(ctx, &node->evt);
+        delete node;
+        count++;
+    }
+
+    // Leftovers (bounded drain or node being linked): ask for another drain
+    if (tail->next.load(std::memory_order_acquire) != NULL || tail != head.load(std::memory_order_acquire))
+        signal();
+    return count;
+}
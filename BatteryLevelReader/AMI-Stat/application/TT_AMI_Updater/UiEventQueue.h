@@ -0,0 +1,115 @@
+/*
+* UiEventQueue.h : This file contains the class responsible to carry the notifications of the
+*               worker threads (device list, info, update, upgrade...) to the UI thread.
+*
+*   In a nutshell, this class implements:
+*       - a lock-free multiple producers / single consumer queue (intrusive linked list with a
+*         stub node): post() never blocks, whatever the UI is doing
+*       - progress coalescing: postProgress() only keeps the latest value per slot. A slot holds
+*         at most one entry in the queue, whatever the number of progress posted meanwhile.
+*       - drain(): called on the UI thread, processes a bounded number of events per call
+*       - a wakeup function called when the queue goes from idle to pending (e.g. PostMessage).
+*         It can be set while the producers already run: the events posted before are then
+*         signaled by setWakeup itself.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _UIEVENTQUEUE_H
+#define _UIEVENTQUEUE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#define UIQ_PROGRESS_SLOTS      8           // Number of progress slots
+#define UIQ_TEXT_COUNT          4           // Number of strings carried by an event
+#define UIQ_TYPE_PROGRESS       -1          // Event type given to the coalesced progress events
+
+struct UiEvent
+{
+    int type;                               // Meaning defined by the application (UIQ_TYPE_PROGRESS: coalesced progress)
+    int slot;                               // Progress slot (progress events)
+    int value;                              // Generic integer value (progress: latest value)
+    uint64_t value64;                       // Generic 64 bits value (e.g. device address)
+    bool flag;                              // Generic flag
+    std::wstring text[UIQ_TEXT_COUNT];      // Generic strings
+
+    UiEvent() : type(0), slot(0), value(0), value64(0), flag(false) {}
+};
+
+// Function processing one event on the UI thread
+typedef void (*UiEventNotif_t)(void *ctx, const UiEvent *evt);
+
+// Function called (on a producer thread) when events become pending
+typedef void (*UiEventWakeup_t)(void *ctx);
+
+class UiEventQueue
+{
+public:
+    UiEventQueue();
+    virtual ~UiEventQueue();
+
+    /**
+    * @brief setWakeup: set the function called when the queue goes from idle to pending. If events
+    *           were posted before (no wakeup called for them), fn is called right away.
+    *
+    * @param fn:        wakeup function (NULL: none, the consumer polls)
+    * @param ctx:       opaque context given back to fn
+    * @return None.
+    */
+    void setWakeup(UiEventWakeup_t fn, void *ctx);
+
+    /**
+    * @brief post: queue an event. Lock-free, can be called from any thread.
+    *
+    * @param evt:       event to queue (copied)
+    * @return None.
+    */
+    void post(const UiEvent &evt);
+
+    /**
+    * @brief postProgress: update the progress of a slot. Lock-free, can be called from any thread.
+    *           If the previous progress of that slot was not drained yet, it is replaced.
+    *
+    * @param slot:      progress slot (0 to UIQ_PROGRESS_SLOTS - 1)
+    * @param value:     progress value
+    * @return None.
+    */
+    void postProgress(int slot, int value);
+
+    /**
+    * @brief drain: process the pending events. Must always be called from the same thread.
+    *
+    * @param fn:        function called for each event
+    * @param ctx:       opaque context given back to fn
+    * @param maxEvents: max number of events processed by this call. If more remain,
+    *                   the wakeup function is called again.
+    * @return number of events processed
+    */
+    int drain(UiEventNotif_t fn, void *ctx, int maxEvents);
+
+private:
+    struct Node
+    {
+        std::atomic<Node *> next;           // Next node (toward the head)
+        UiEvent evt;                        // Event carried
+    };
+
+    void push(Node *node);
+    Node *pop(void);
+    void signal(void);
+
+    std::atomic<Node *> head;               // Last node pushed (producers side)
+    Node *tail;                             // Next node to pop (consumer side)
+    Node stub;                              // Stub node keeping the list never empty
+
+    std::atomic<int> progressValue[UIQ_PROGRESS_SLOTS];     // Latest progress per slot
+    std::atomic<bool> progressQueued[UIQ_PROGRESS_SLOTS];   // A progress entry is in the queue for that slot
+
+    std::atomic<bool> signaled;             // Wakeup already called and not drained yet
+    std::atomic<UiEventWakeup_t> wakeupFn;  // Wakeup function (published after wakeupCtx)
+    std::atomic<void *> wakeupCtx;          // Context of wakeupFn
+};
+
+#endif // _UIEVENTQUEUE_H
@@ -0,0 +1,210 @@
+/*
+* UpdateSession.cpp : This file contains the class responsible to run the firmware update protocol
+*               ("Q" SLIP channel) on an opened Slip connection.
+*
+*   In a nutshell, this class implements:
+*       - the transfer of a package in chunks of CMD_UPDREQ_MAXDATALEN bytes, each acknowledged
+*           by the device with the offset of the next chunk it expects
+*       - the final transaction (no data, offset = package length) making the device verify the CRC
+*       - the per phase round trip times, retries, timeouts and discarded frames in ProtocolMetrics
+*       - the error ending the session in the flight recorder of the connection
+*       - the trace points of the phases (erase, chunk stream, CRC, see TraceBuffer.h)
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <assert.h>
+#include <string.h>
+#include "UpdateSession.h"
+#include "ErrCodes.h"
+#include "TraceBuffer.h"
+
+/**
+* @brief ctor: class constructor
+*
+* @param slip:      opened connection to the device
+* @param metrics:   receives the round trip times, retries... (can be NULL)
+* @return None.
+*/
+UpdateSession::UpdateSession(Slip *_slip, ProtocolMetrics *_metrics)
+: slip(_slip)
+, metrics(_metrics)
+, failedOnSend(false)
+, detail(0)
+{
+}
+
+/**
+* @brief run: transfer a package and wait for the device to verify it
+*
+* @param package:   package to transfer
+* @param packageLen: number of bytes in package
+* @param fnct:      function to execute to report the progress (can be NULL)
+* @param ctx:       opaque context value for that function
+* @return ERR_OK            the device accepted the package
+*         < 0               ErrCodes.h error (ERR_INV_RESPCMD, ERR_INV_RESPLEN: see errDetail())
+*         > 0               RESP_ERR_xxx error code returned by the device
+*/
+int UpdateSession::run(const uint8_t *package, int packageLen, UpdateSessionNotif_t fnct, void *ctx)
+{
+    const uint8_t *filePtr = package;
+    const uint8_t *fileEnd = package + packageLen;
+    int timeoutMs = UPDATE_FIRST_TIMEOUT_MS;
+    int err = ERR_OK;
+    int rxOffset;                       // Offset returned by the device for the next packet
+    MetricsPhase phase = METRICS_PHASE_FIRST_CHUNK;     // First chunk makes the device erase its flash
+
+    failedOnSend = false;
+    detail = 0;
+    TRACEPT(TRACEPT_UPD_SESSION, packageLen, 0);
+
+    while ((filePtr < fileEnd) && (err == ERR_OK))
+    {
+        // build request
+        int offset = (int)(filePtr-package);         // offset in file
+        int dataLen = ((int)(fileEnd-filePtr) < CMD_UPDREQ_MAXDATALEN) ? (int) (fileEnd-filePtr) : CMD_UPDREQ_MAXDATALEN;
+
+        int64_t sendTime = metricsNowUs();
+        TRACEPT(TRACEPT_UPD_CHUNK, offset, dataLen);
+        err = send(offset, filePtr, dataLen);
+        if (err == ERR_OK)  err = read(&rxOffset, timeoutMs);     // if no error yet, wait for response
+        if (err == ERR_OK)
+        {
+            TRACEPT(TRACEPT_UPD_ACK, rxOffset, 0);
+            if (metrics != NULL)
+            {
+                metrics->rtt(phase, metricsNowUs() - sendTime);
+                if (rxOffset > offset)  metrics->transferred(rxOffset - offset);
+                else                    metrics->retry();           // device asks for the same chunk again
+            }
+            phase = METRICS_PHASE_CHUNK;
+
+            filePtr = package + rxOffset;
+            if (filePtr < fileEnd)      timeoutMs = UPDATE_CHUNK_TIMEOUT_MS;
+            else                        timeoutMs = UPDATE_CRC_TIMEOUT_MS;
+
+            if (fnct != NULL)           fnct(ctx, rxOffset, packageLen);
+        }
+    }
+
+    if (err == ERR_OK)      // If no error during update, send an extra transaction with no data and offset=total length
+    {                       // to indicate the end of the transfer
+        int64_t sendTime = metricsNowUs();
+        TRACEPT(TRACEPT_UPD_CRC, packageLen, 0);
+        err = send(packageLen, NULL, 0);
+        if (err == ERR_OK)  err = read(&rxOffset, timeoutMs);
+        if ((err == ERR_OK) && (metrics != NULL))   metrics->rtt(METRICS_PHASE_CRC, metricsNowUs() - sendTime);
+    }
+
+    if (err != ERR_OK)      // keep the protocol level error with the frames that led to it
+    {
+        slip->flightRecorder().record(FREC_PROTOCOL, CHAN_UPDATE, 0, (uint32_t)(filePtr - package), (uint32_t)detail, err);
+    }
+    TRACEPT(TRACEPT_UPD_SESSION_END, err, filePtr - package);
+    return err;
+}
+
+/**
+* @brief buildRequest: format an update request
+*
+* @param frame:     receives the request (CMD_UPDREQ_MAXLEN bytes)
+* @param offset:    offset in bytes from beginning of the package
+* @param dataPtr:   pointer to the data to transmit
+* @param dataLen:   number of bytes to include in the packet (up to CMD_UPDREQ_MAXDATALEN)
+* @return Number of bytes of the request
+*/
+int UpdateSession::buildRequest(uint8_t *frame, int offset, const uint8_t *dataPtr, int dataLen)
+{
+    assert(dataLen <= CMD_UPDREQ_MAXDATALEN);
+
+    frame[CHAN_OFF]             = CHAN_UPDATE;
+    frame[CMD_OFF]              = CMD_UPDREQ;
+    frame[CMD_UPDREQ_OFFSET+0]  = (offset >> 24) & 0xFF;
+    frame[CMD_UPDREQ_OFFSET+1]  = (offset >> 16) & 0xFF;
+    frame[CMD_UPDREQ_OFFSET+2]  = (offset >>  8) & 0xFF;
+    frame[CMD_UPDREQ_OFFSET+3]  = (offset >>  0) & 0xFF;
+    if (dataLen > 0)    memcpy(&frame[CMD_UPDREQ_DATA], dataPtr, dataLen);
+    return CMD_UPDREQ_DATA + dataLen;
+}
+
+/**
+* @brief send: Format the message and send it
+*
+* @param offset:    offset in bytes from beginning of the package
+* @param dataPtr:   pointer to the data to transmit
+* @param dataLen:   number of bytes to include in the packet
+* @return ERR_OK or the error returned by Slip::send()
+*/
+int UpdateSession::send(int offset, const uint8_t *dataPtr, int dataLen)
+{
+    uint8_t tmpBuf[CMD_UPDREQ_MAXLEN];
+    int frameLen = buildRequest(tmpBuf, offset, dataPtr, dataLen);
+
+    // send message
+    int err = slip->send(tmpBuf, frameLen);
+    if (err == frameLen)    return ERR_OK;
+
+    failedOnSend = true;
+    return err;
+}
+
+/**
+* @brief read: wait for and decode an update response message
+*
+*   it is possible that we receive a message from a wrong channel. We just discard it.
+*
+* @param retOffset:     to be filled with the offset returned by the device
+* @param timeoutMs:     max time to wait for an answer
+* @return ERR_OK or an error (see run())
+*/
+int UpdateSession::read(int *retOffset, int timeoutMs)
+{
+    int errCode = ERR_OK;
+    uint8_t tmpBuf[1024 * CMD_UPDRESP_LEN];            // Length is big to accept other channel data
+
+    IClock *clock = slip->getClock();
+    int64_t entryTime = clock->nowMs();
+    while (true)
+    {
+        int waitTime = timeoutMs - (int)(clock->nowMs() - entryTime);          // Max remaining time to wait for an answer.
+        if (waitTime < 0)
+        {
+            errCode = ERR_SLIP_TIMEOUT;
+            break;
+        }
+
+        // wait response (returns number of bytes received in frame
+        int err = slip->read(tmpBuf, sizeof(tmpBuf), waitTime);
+        if (err == 0)       errCode = ERR_SLIP_TIMEOUT;             // if no byte received, it is a timeout condition
+        else if (err < 0)   errCode = err;
+        else if (tmpBuf[CHAN_OFF] != CHAN_UPDATE)                   // process only our channel, ignore others
+        {
+            if (metrics != NULL)    metrics->discardedFrame();
+            continue;
+        }
+        else if (tmpBuf[CMD_OFF] != CMD_UPDRESP)
+        {
+            errCode = ERR_INV_RESPCMD;
+            detail = tmpBuf[CMD_OFF];                   // command number eases field troubleshooting
+        }
+        else if (err != CMD_UPDRESP_LEN)
+        {
+            errCode = ERR_INV_RESPLEN;
+            detail = err;                               // number of bytes received eases field troubleshooting
+        }
+        else if (tmpBuf[CMD_UPDRESP_ERR] != RESP_ERR_OK)    errCode = tmpBuf[CMD_UPDRESP_ERR];
+        else
+        {
+            assert(retOffset != NULL);
+            *retOffset = 0;
+            *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+0]) << 24;
+            *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+1]) << 16;
+            *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+2]) <<  8;
+            *retOffset += ((int)tmpBuf[CMD_UPDRESP_OFFSET+3]) <<  0;
+        }
+        break;
+    }
+
+    if ((errCode == ERR_SLIP_TIMEOUT) && (metrics != NULL))     metrics->timeout();
+    return errCode;
+}
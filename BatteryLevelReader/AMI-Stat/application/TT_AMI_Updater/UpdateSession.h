@@ -0,0 +1,140 @@
+/*
+* UpdateSession.h : This file contains the class responsible to run the firmware update protocol
+*               ("Q" SLIP channel) on an opened Slip connection.
+*
+*   In a nutshell, this class implements:
+*       - the transfer of a package in chunks of CMD_UPDREQ_MAXDATALEN bytes, each acknowledged
+*           by the device with the offset of the next chunk it expects
+*       - the final transaction (no data, offset = package length) making the device verify the CRC
+*       - the per phase round trip times, retries, timeouts and discarded frames in ProtocolMetrics
+*       - the error ending the session in the flight recorder of the connection
+*       - the trace points of the phases (erase, chunk stream, CRC, see TraceBuffer.h)
+*
+*   It has no dependency on Windows nor on the UI: DeviceUpdate runs it on the Bluetooth
+*   connection, the tools run it on a replayed capture.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _UPDATESESSION_H
+#define _UPDATESESSION_H
+
+#include <stdint.h>
+#include "Slip.h"
+#include "ProtocolMetrics.h"
+
+// Definitions for the "Q" SLIP channel messages
+// Generic command offsets
+#define CHAN_OFF            0       // Offset to reach the SLIP channel identifier
+#define CMD_OFF             1       // Offset to reach the command number
+
+// Valid channel and commands
+#define CHAN_UPDATE         'Q'     // Channel used to update files
+#define CMD_UPDREQ          0xB0    // Update request command
+#define CMD_UPDRESP         0xB1    // Update response command
+
+// Update request command fields
+#define CMD_UPDREQ_OFFSET       2   // Offset to reach the offset field (4 bytes)
+#define CMD_UPDREQ_DATA         6   // Offset to reach the beginning of the data
+#define CMD_UPDREQ_MAXDATALEN   900 // Max number of data bytes that can be sent in a command
+#define CMD_UPDREQ_MAXLEN   (CMD_UPDREQ_DATA + CMD_UPDREQ_MAXDATALEN)       // See UNSLIPPED_PKT_MAX_SIZE defined in SLIP.h of AMI project
+
+#define CMD_UPDRESP_ERR     2       // Offset to reach the error code field (1 byte)
+#define CMD_UPDRESP_OFFSET  3       // Offset to reach the offset field (4 bytes)
+#define CMD_UPDRESP_LEN     7       // Total length of an update response command
+
+// response error codes in protocol (must match those in FirmwareUpdate.c of MAIN app)
+#define RESP_ERR_OK         0       // No error
+#define RESP_ERR_TOOSHORT   1       // Message too short
+#define RESP_ERR_INVCMD     2       // Invalid command number
+#define RESP_ERR_ERASE      3       // Error during flash erase
+#define RESP_ERR_WRITE      4       // Error during flash programming
+#define RESP_ERR_READ       5       // Error during flash reading
+#define RESP_ERR_CRCDWLD	6		// CRC error during download
+#define RESP_ERR_CRCSAVE	7		// CRC error when reading back image
+#define RESP_ERR_INCOMPATIBLE	8	// Package is incompatible with this device (not used yet but interpreted by PC updater application)
+
+// Response timeouts
+#define UPDATE_FIRST_TIMEOUT_MS 30000   // First packet may take long to respond if flash gets erased
+#define UPDATE_CHUNK_TIMEOUT_MS 2000    // All other packets should be answered very quickly
+#define UPDATE_CRC_TIMEOUT_MS   30000   // Last packet takes long because CRC is recomputed
+
+/**
+  * @brief Signature of function that will be called after each acknowledged chunk
+  *
+  * @param ctx:         Opaque context meaningful for the notification function
+  * @param offset:      Number of bytes acknowledged by the device so far
+  * @param total:       Length of the package
+  * @return         None
+  */
+typedef void (*UpdateSessionNotif_t) (void *ctx, int offset, int total);
+
+
+class UpdateSession
+{
+public:
+    /**
+    * @brief ctor: class constructor
+    *
+    * @param slip:      opened connection to the device
+    * @param metrics:   receives the round trip times, retries... (can be NULL)
+    * @return None.
+    */
+    UpdateSession(Slip *slip, ProtocolMetrics *metrics = NULL);
+
+    /**
+    * @brief run: transfer a package and wait for the device to verify it
+    *
+    * @param package:   package to transfer
+    * @param packageLen: number of bytes in package
+    * @param fnct:      function to execute to report the progress (can be NULL)
+    * @param ctx:       opaque context value for that function
+    * @return ERR_OK            the device accepted the package
+    *         < 0               ErrCodes.h error (ERR_INV_RESPCMD, ERR_INV_RESPLEN: see errDetail())
+    *         > 0               RESP_ERR_xxx error code returned by the device
+    */
+    int run(const uint8_t *package, int packageLen, UpdateSessionNotif_t fnct, void *ctx);
+
+    /**
+    * @brief buildRequest: format an update request
+    *
+    * @param frame:     receives the request (CMD_UPDREQ_MAXLEN bytes)
+    * @param offset:    offset in bytes from beginning of the package
+    * @param dataPtr:   pointer to the data to transmit
+    * @param dataLen:   number of bytes to include in the packet (up to CMD_UPDREQ_MAXDATALEN)
+    * @return Number of bytes of the request
+    */
+    static int buildRequest(uint8_t *frame, int offset, const uint8_t *dataPtr, int dataLen);
+
+    bool sendFailed(void) const                                         { return failedOnSend; }
+    int errDetail(void) const                                           { return detail; }
+
+private:
+    /**
+    * @brief send: Format the message and send it
+    *
+    * @param offset:    offset in bytes from beginning of the package
+    * @param dataPtr:   pointer to the data to transmit
+    * @param dataLen:   number of bytes to include in the packet
+    * @return ERR_OK or the error returned by Slip::send()
+    */
+    int send(int offset, const uint8_t *dataPtr, int dataLen);
+
+    /**
+    * @brief read: wait for and decode an update response message
+    *
+    *   it is possible that we receive a message from a wrong channel. We just discard it.
+    *
+    * @param retOffset:     to be filled with the offset returned by the device
+    * @param timeoutMs:     max time to wait for an answer
+    * @return ERR_OK or an error (see run())
+    */
+    int read(int *retOffset, int timeoutMs);
+
+    Slip *slip;                     // Connection to the device
+    ProtocolMetrics *metrics;       // Metrics of the session (may be NULL)
+    bool failedOnSend;              // When true, the error returned by run() happened while sending
+    int detail;                     // Command number (ERR_INV_RESPCMD) or length (ERR_INV_RESPLEN) received
+};
+
+#endif // _UPDATESESSION_H
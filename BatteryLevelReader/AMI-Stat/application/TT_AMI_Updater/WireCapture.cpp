@@ -0,0 +1,409 @@
+/*
+* WireCapture.cpp : This file contains the classes responsible to record the raw byte streams of a
+*               device connection in a capture file, and to play them back.
+*
+*   In a nutshell, this file implements:
+*       - CaptureWriter: appends timestamped records (bytes sent, bytes received, markers) to a file
+*       - CaptureReader: loads a capture file in memory and gives access to its records
+*       - CaptureComm: an IComm wrapping another one, recording everything that goes through it
+*       - ReplayComm: an IComm feeding the received bytes of a capture back to a Slip instance
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#include <assert.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "WireCapture.h"
+#include "ErrCodes.h"
+
+#define CAPTURE_HEADER_LEN      16          // magic + version + reserved + start time
+#define CAPTURE_MAX_RECORD      (1 << 24)   // Larger records are considered as corrupted
+#define REPLAY_SLICE_MS         100         // Max sleep of a read() so that close() is seen quickly
+
+/**
+* @brief steadyUs: monotonic time used for the records
+*
+* @return Time in microseconds
+*/
+static int64_t steadyUs(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+* @brief getVarint: decode a LEB128 value
+*
+* @param pos:       position in the buffer, moved after the value
+* @param end:       end of the buffer
+* @param value:     receives the value
+* @return false if the buffer ends before the value
+*/
+static bool getVarint(const uint8_t **pos, const uint8_t *end, uint64_t *value)
+{
+    uint64_t v = 0;
+    for (int shift = 0; (*pos < end) && (shift < 64); shift += 7)
+    {
+        uint8_t b = *(*pos)++;
+        v |= ((uint64_t)(b & 0x7F)) << shift;
+        if ((b & 0x80) == 0)
+        {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CaptureWriter
+/////////////////////////////////////////////////////////////////////////////////////////
+
+CaptureWriter::CaptureWriter()
+: file(NULL)
+, lastUs(0)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+/**
+* @brief open: create the capture file and write its header
+*
+* @param path:      file to create (overwritten if it exists)
+* @param label:     free text stored in the header (e.g. device address)
+* @return 0 on success, -1 if the file cannot be created
+*/
+int CaptureWriter::open(const char *path, const char *label)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    assert(file == NULL);
+    file = fopen(path, "wb");
+    if (file == NULL)       return -1;
+
+    uint8_t header[CAPTURE_HEADER_LEN] = { 0 };
+    int64_t start = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(header, CAPTURE_MAGIC, 4);
+    header[4] = CAPTURE_VERSION;
+    for (int i = 0; i < 8; i++)     header[8 + i] = (uint8_t)(start >> (8 * i));
+
+    size_t labelLen = (label != NULL) ? strlen(label) : 0;
+    if (labelLen >= CAPTURE_LABEL_LEN)  labelLen = CAPTURE_LABEL_LEN - 1;
+
+    fwrite(header, 1, sizeof(header), file);
+    fputc((int)labelLen, file);
+    if (labelLen > 0)       fwrite(label, 1, labelLen, file);
+
+    lastUs = steadyUs();
+    return 0;
+}
+
+/**
+* @brief record: append a record. Can be called from any thread.
+*
+* @param dir:       CAPTURE_DIR_xxx
+* @param data:      bytes of the record
+* @param len:       number of bytes
+* @return None.
+*/
+void CaptureWriter::record(uint8_t dir, const uint8_t *data, int len)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if ((file == NULL) || (len < 0))    return;
+
+    int64_t now = steadyUs();
+    fputc(dir, file);
+    putVarint((uint64_t)(now - lastUs));
+    putVarint((uint64_t)len);
+    if (len > 0)        fwrite(data, 1, len, file);
+    lastUs = now;
+}
+
+/**
+* @brief close: flush and close the file
+*
+* @return None.
+*/
+void CaptureWriter::close(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (file != NULL)   fclose(file);
+    file = NULL;
+}
+
+void CaptureWriter::putVarint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        fputc((int)((value & 0x7F) | 0x80), file);
+        value >>= 7;
+    }
+    fputc((int)value, file);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CaptureReader
+/////////////////////////////////////////////////////////////////////////////////////////
+
+CaptureReader::CaptureReader()
+: startUs(0)
+{
+}
+
+/**
+* @brief open: load a capture file in memory
+*
+* @param path:      capture file to read
+* @return 0 on success, -1 if the file cannot be read, -2 if it is not a valid capture file.
+*         A truncated last record (capture interrupted) is ignored.
+*/
+int CaptureReader::open(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)          return -1;
+
+    std::vector<uint8_t> buf;
+    uint8_t block[64 * 1024];
+    size_t nb;
+    while ((nb = fread(block, 1, sizeof(block), f)) > 0)    buf.insert(buf.end(), block, block + nb);
+    fclose(f);
+
+    return load(buf.data(), buf.size());
+}
+
+/**
+* @brief load: same as open() on a capture already in memory
+*
+* @param buf:       content of a capture file
+* @param len:       number of bytes in buf
+* @return 0 on success, -2 if it is not a valid capture
+*/
+int CaptureReader::load(const uint8_t *buf, size_t len)
+{
+    records.clear();
+    bytes.clear();
+    labelStr.clear();
+
+    if ((len < CAPTURE_HEADER_LEN + 1) || (memcmp(buf, CAPTURE_MAGIC, 4) != 0) || (buf[4] != CAPTURE_VERSION))
+        return -2;
+
+    startUs = 0;
+    for (int i = 0; i < 8; i++)     startUs |= ((int64_t)buf[8 + i]) << (8 * i);
+
+    const uint8_t *pos = buf + CAPTURE_HEADER_LEN;
+    const uint8_t *end = buf + len;
+    size_t labelLen = *pos++;
+    if ((size_t)(end - pos) < labelLen)     return -2;
+    labelStr.assign((const char *)pos, labelLen);
+    pos += labelLen;
+
+    int64_t timeUs = 0;
+    while (pos < end)
+    {
+        CaptureRecord rec;
+        uint64_t delta, recLen;
+
+        rec.dir = *pos++;
+        if ((getVarint(&pos, end, &delta) == false) || (getVarint(&pos, end, &recLen) == false))    break;
+        if (recLen > CAPTURE_MAX_RECORD)        return -2;
+        if ((uint64_t)(end - pos) < recLen)     break;          // capture interrupted in the middle of a record
+
+        timeUs += (int64_t)delta;
+        rec.timeUs = timeUs;
+        rec.offset = (uint32_t)bytes.size();
+        rec.len = (uint32_t)recLen;
+        bytes.insert(bytes.end(), pos, pos + recLen);
+        records.push_back(rec);
+        pos += recLen;
+    }
+    return 0;
+}
+
+/**
+* @brief totalBytes: number of bytes captured in one direction
+*
+* @param dir:       CAPTURE_DIR_xxx
+* @return Number of bytes.
+*/
+uint64_t CaptureReader::totalBytes(uint8_t dir) const
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (records[i].dir == dir)  total += records[i].len;
+    }
+    return total;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// CaptureComm
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+* @brief ctor: class constructor. If the capture file cannot be created, the connection still
+*               works without capture.
+*
+* @param inner:     connection to record. Deleted with this instance.
+* @param path:      capture file to create
+* @param label:     label stored in the capture
+* @return None.
+*/
+CaptureComm::CaptureComm(IComm *_inner, const char *path, const char *label)
+: inner(_inner)
+{
+    writer.open(path, label);
+}
+
+CaptureComm::~CaptureComm()
+{
+    static const char closed[] = "closed";
+    writer.record(CAPTURE_DIR_MARK, (const uint8_t *)closed, sizeof(closed) - 1);
+    writer.close();
+    delete inner;
+}
+
+void CaptureComm::close(void)
+{
+    inner->close();
+}
+
+int CaptureComm::send(const uint8_t *msg, int msgLen)
+{
+    int retCode = inner->send(msg, msgLen);
+    if (retCode > 0)        writer.record(CAPTURE_DIR_TX, msg, retCode);
+    return retCode;
+}
+
+int CaptureComm::read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
+{
+    int retCode = inner->read(retMsg, maxLen, maxWaitTimeMs);
+    if (retCode > 0)        writer.record(CAPTURE_DIR_RX, retMsg, retCode);
+    return retCode;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// ReplayComm
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+* @brief ctor: class constructor. The replay clock starts here.
+*
+* @param reader:    capture to replay (must live longer than this instance)
+* @param mode:      REPLAY_REALTIME or REPLAY_MAXSPEED
+* @param dir:       direction delivered by read()
+* @return None.
+*/
+ReplayComm::ReplayComm(const CaptureReader *_reader, int _mode, uint8_t _dir)
+: reader(_reader)
+, mode(_mode)
+, dir(_dir)
+, startUs(steadyUs())
+, rxRecord(0)
+, rxOffset(0)
+, txRecord(0)
+, txOffset(0)
+, rxBytes(0)
+, txBytes(0)
+, txMismatch(0)
+, exiting(false)
+{
+}
+
+/**
+* @brief send: compare the bytes with the next ones sent in the capture
+*
+* @return msgLen
+*/
+int ReplayComm::send(const uint8_t *msg, int msgLen)
+{
+    if (exiting)            return ERR_SPP_CLOSING;
+
+    txBytes += msgLen;
+    if (dir != CAPTURE_DIR_RX)  return msgLen;          // Extracting the requests: nothing to compare with
+
+    for (int i = 0; i < msgLen; i++)
+    {
+        while ((txRecord < reader->count()) &&
+               ((reader->record(txRecord).dir != CAPTURE_DIR_TX) || (txOffset >= reader->record(txRecord).len)))
+        {
+            txRecord++;
+            txOffset = 0;
+        }
+
+        if (txRecord >= reader->count())    txMismatch++;   // Sending more than the capture
+        else
+        {
+            const CaptureRecord &rec = reader->record(txRecord);
+            if (reader->data(rec)[txOffset] != msg[i])  txMismatch++;
+            txOffset++;
+        }
+    }
+    return msgLen;
+}
+
+/**
+* @brief read: deliver the next bytes of the capture in the replayed direction
+*
+* @return > 0   Number of bytes received
+*         0     Timeout (REPLAY_REALTIME: next record not due yet)
+*         ERR_SPP_CLOSING   close() was called or the capture is exhausted
+*/
+int ReplayComm::read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs)
+{
+    while ((rxRecord < reader->count()) && (reader->record(rxRecord).dir != dir))   rxRecord++;
+
+    if (exiting || (rxRecord >= reader->count()))   return ERR_SPP_CLOSING;
+
+    const CaptureRecord &rec = reader->record(rxRecord);
+    if (mode == REPLAY_REALTIME)
+    {
+        int64_t deadline = steadyUs() + (int64_t)maxWaitTimeMs * 1000;
+        int64_t due = startUs + rec.timeUs;
+        int64_t now;
+        while (((now = steadyUs()) < due) && (now < deadline) && (exiting == false))
+        {
+            int64_t sleepUs = ((due < deadline) ? due : deadline) - now;
+            if (sleepUs > REPLAY_SLICE_MS * 1000)   sleepUs = REPLAY_SLICE_MS * 1000;
+            std::this_thread::sleep_for(std::chrono::microseconds(sleepUs));
+        }
+        if (exiting)        return ERR_SPP_CLOSING;
+        if (now < due)      return 0;               // not received yet at the recorded pace
+    }
+
+    int nb = (int)(rec.len - rxOffset);
+    if (nb > maxLen)        nb = maxLen;
+    memcpy(retMsg, reader->data(rec) + rxOffset, nb);
+    rxOffset += nb;
+    rxBytes += nb;
+    if (rxOffset >= rec.len)
+    {
+        rxRecord++;
+        rxOffset = 0;
+    }
+    return nb;
+}
+
+/**
+* @brief finished: tell if all the bytes of the replayed direction were delivered
+*
+* @return true when read() has nothing left to deliver
+*/
+bool ReplayComm::finished(void) const
+{
+    for (size_t i = rxRecord; i < reader->count(); i++)
+    {
+        if ((reader->record(i).dir == dir) && (reader->record(i).len > ((i == rxRecord) ? rxOffset : 0)))  return false;
+    }
+    return true;
+}
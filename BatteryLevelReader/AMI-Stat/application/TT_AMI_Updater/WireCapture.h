@@ -0,0 +1,230 @@
+/*
+* WireCapture.h : This file contains the classes responsible to record the raw byte streams of a
+*               device connection in a capture file, and to play them back.
+*
+*   In a nutshell, this file implements:
+*       - CaptureWriter: appends timestamped records (bytes sent, bytes received, markers) to a file
+*       - CaptureReader: loads a capture file in memory and gives access to its records
+*       - CaptureComm: an IComm wrapping another one, recording everything that goes through it
+*       - ReplayComm: an IComm feeding the received bytes of a capture back to a Slip instance,
+*           at the recorded pace or as fast as possible, and checking the bytes sent against
+*           the recorded ones.
+*
+*   Capture file format (little endian):
+*       header:     "AMIC" | version (1 byte) | reserved (3 bytes) | start time (8 bytes, us since 1970)
+*                   | label length (1 byte) | label (no terminating 0)
+*       records:    direction (1 byte) | time since previous record (varint, us)
+*                   | length (varint) | bytes
+*   The varints are LEB128 (7 bits per byte, bit 7 set when more bytes follow): a record costs
+*   3 to 6 bytes of overhead.
+*
+*   The raw bytes are captured under the SLIP framing, exactly as exchanged with SppComm, so
+*   a replay exercises the SLIP decoder and the protocol engines with the field traffic.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _WIRECAPTURE_H
+#define _WIRECAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "icomm.h"
+
+#define CAPTURE_MAGIC           "AMIC"      // First 4 bytes of a capture file
+#define CAPTURE_VERSION         1           // Version of the file format
+#define CAPTURE_FILE_EXT        ".amicap"   // Extension of the capture files
+#define CAPTURE_LABEL_LEN       64          // Max length of a capture label (+1 for the terminating 0)
+
+#define CAPTURE_DIR_TX          'T'         // Bytes sent to the device
+#define CAPTURE_DIR_RX          'R'         // Bytes received from the device
+#define CAPTURE_DIR_MARK        'M'         // Text marker (e.g. connection closed)
+
+#define REPLAY_REALTIME         0           // Received bytes are delivered at the time they were recorded
+#define REPLAY_MAXSPEED         1           // Received bytes are delivered as soon as they are asked for
+
+typedef struct
+{
+    int64_t timeUs;         // Time of the record since the start of the capture
+    uint8_t dir;            // CAPTURE_DIR_xxx
+    uint32_t offset;        // Offset of the bytes in the data of the reader
+    uint32_t len;           // Number of bytes
+} CaptureRecord;
+
+
+class CaptureWriter
+{
+public:
+    CaptureWriter();
+    virtual ~CaptureWriter();
+
+    /**
+    * @brief open: create the capture file and write its header
+    *
+    * @param path:      file to create (overwritten if it exists)
+    * @param label:     free text stored in the header (e.g. device address)
+    * @return 0 on success, -1 if the file cannot be created
+    */
+    int open(const char *path, const char *label);
+
+    /**
+    * @brief record: append a record. Can be called from any thread.
+    *
+    * @param dir:       CAPTURE_DIR_xxx
+    * @param data:      bytes of the record
+    * @param len:       number of bytes
+    * @return None.
+    */
+    void record(uint8_t dir, const uint8_t *data, int len);
+
+    /**
+    * @brief close: flush and close the file
+    *
+    * @return None.
+    */
+    void close(void);
+
+    bool isOpen(void) const                                             { return file != NULL; }
+
+private:
+    void putVarint(uint64_t value);
+
+    std::mutex lock;                // Serializes the records of the sending and receiving threads
+    FILE *file;                     // Capture file (NULL: not opened)
+    int64_t lastUs;                 // Steady clock time of the previous record
+};
+
+
+class CaptureReader
+{
+public:
+    CaptureReader();
+
+    /**
+    * @brief open: load a capture file in memory
+    *
+    * @param path:      capture file to read
+    * @return 0 on success, -1 if the file cannot be read, -2 if it is not a valid capture file.
+    *         A truncated last record (capture interrupted) is ignored.
+    */
+    int open(const char *path);
+
+    /**
+    * @brief load: same as open() on a capture already in memory
+    *
+    * @param buf:       content of a capture file
+    * @param len:       number of bytes in buf
+    * @return 0 on success, -2 if it is not a valid capture
+    */
+    int load(const uint8_t *buf, size_t len);
+
+    const char *label(void) const                                       { return labelStr.c_str(); }
+    int64_t startTimeUs(void) const                                     { return startUs; }
+    size_t count(void) const                                            { return records.size(); }
+    const CaptureRecord &record(size_t i) const                         { return records[i]; }
+    const uint8_t *data(const CaptureRecord &rec) const                 { return &bytes[rec.offset]; }
+    int64_t durationUs(void) const                                      { return records.empty() ? 0 : records.back().timeUs; }
+
+    /**
+    * @brief totalBytes: number of bytes captured in one direction
+    *
+    * @param dir:       CAPTURE_DIR_xxx
+    * @return Number of bytes.
+    */
+    uint64_t totalBytes(uint8_t dir) const;
+
+private:
+    std::string labelStr;               // Label of the capture
+    int64_t startUs;                    // Start time of the capture (us since 1970)
+    std::vector<CaptureRecord> records; // Records, in file order
+    std::vector<uint8_t> bytes;         // Bytes of all the records
+};
+
+
+class CaptureComm : public IComm
+{
+public:
+    /**
+    * @brief ctor: class constructor. If the capture file cannot be created, the connection still
+    *               works without capture.
+    *
+    * @param inner:     connection to record. Deleted with this instance.
+    * @param path:      capture file to create
+    * @param label:     label stored in the capture
+    * @return None.
+    */
+    CaptureComm(IComm *inner, const char *path, const char *label);
+    virtual ~CaptureComm();
+
+    void close(void);
+    int send(const uint8_t *msg, int msgLen);
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs);
+
+private:
+    IComm *inner;                   // Recorded connection
+    CaptureWriter writer;           // Capture file
+};
+
+
+class ReplayComm : public IComm
+{
+public:
+    /**
+    * @brief ctor: class constructor. The replay clock starts here.
+    *
+    * @param reader:    capture to replay (must live longer than this instance)
+    * @param mode:      REPLAY_REALTIME or REPLAY_MAXSPEED
+    * @param dir:       direction delivered by read(). CAPTURE_DIR_TX reads back what was sent
+    *                   (used to extract the requests of a capture); send() is then not verified.
+    * @return None.
+    */
+    ReplayComm(const CaptureReader *reader, int mode, uint8_t dir = CAPTURE_DIR_RX);
+
+    void close(void)                                                    { exiting = true; }
+
+    /**
+    * @brief send: compare the bytes with the next ones sent in the capture
+    *
+    * @return msgLen
+    */
+    int send(const uint8_t *msg, int msgLen);
+
+    /**
+    * @brief read: deliver the next bytes of the capture in the replayed direction
+    *
+    * @return > 0   Number of bytes received
+    *         0     Timeout (REPLAY_REALTIME: next record not due yet)
+    *         ERR_SPP_CLOSING   close() was called or the capture is exhausted
+    */
+    int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs);
+
+    /**
+    * @brief finished: tell if all the bytes of the replayed direction were delivered
+    *
+    * @return true when read() has nothing left to deliver
+    */
+    bool finished(void) const;
+    uint64_t bytesRead(void) const                                      { return rxBytes; }
+    uint64_t bytesSent(void) const                                      { return txBytes; }
+    uint64_t txMismatches(void) const                                   { return txMismatch; }
+
+private:
+    const CaptureReader *reader;    // Capture replayed
+    int mode;                       // REPLAY_xxx
+    uint8_t dir;                    // Direction delivered by read()
+    int64_t startUs;                // Steady clock time at which the replay started
+    size_t rxRecord;                // Next record to deliver (index in reader)
+    uint32_t rxOffset;              // Bytes of rxRecord already delivered
+    size_t txRecord;                // Record holding the next byte expected from send()
+    uint32_t txOffset;              // Offset of that byte in txRecord
+    uint64_t rxBytes;               // Bytes delivered by read()
+    uint64_t txBytes;               // Bytes given to send()
+    uint64_t txMismatch;            // Bytes given to send() that differ from the capture (or beyond its end)
+    std::atomic<bool> exiting;      // When true, read() returns ERR_SPP_CLOSING
+};
+
+#endif // _WIRECAPTURE_H
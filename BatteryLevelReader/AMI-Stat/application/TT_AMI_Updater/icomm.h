@@ -0,0 +1,56 @@
+/*
+* icomm.h : This file contains the interface of a byte stream connection to a device
+*
+*   In a nutshell, this interface defines the methods used by the Slip class to:
+*       - send data on the connection
+*       - receive data on the connection
+*       - terminate the connection (a thread stucked in read() must exit with ERR_SPP_CLOSING)
+*
+*   SppComm implements it on the Bluetooth Serial Port Profile. CaptureComm and ReplayComm
+*   (WireCapture.h) implement it to record and replay the traffic of a connection.
+*
+* Project: AMI
+* Company: Thought Technology Ltd.
+*/
+#ifndef _ICOMM_H
+#define _ICOMM_H
+
+#include <stdint.h>
+
+class IComm
+{
+public:
+    virtual ~IComm() {}
+
+    /**
+    * @brief close: terminate the connection
+    *
+    * @return None.
+    */
+    virtual void close(void) = 0;
+
+    /**
+    * @brief send: Send data to the device
+    *
+    * @param msg:       data to send (bytes, not wchar).
+    * @param msgLen:    number of bytes to send
+    * @return > 0   number of bytes sent
+    *         < 0   an error
+    */
+    virtual int send(const uint8_t *msg, int msgLen) = 0;
+
+    /**
+    * @brief read: Read some data from the connection
+    *
+    * @param retMsg:    Pre-allocated buffer that is filled with the received data
+    * @param maxLen:    Max number of bytes that can be stored in retMsg
+    * @param maxWaitTimeMs: Max time to wait in milliseconds for some data to arrive.
+    *                   The function returns as soon as some data is received.
+    * @return > 0   Number of bytes received.
+    *         0     Timeout
+    *         < 0   an error
+    */
+    virtual int read(uint8_t *retMsg, int maxLen, uint32_t maxWaitTimeMs) = 0;
+};
+
+#endif // _ICOMM_H